@@ -0,0 +1,387 @@
+/******************************************************************************
+* Filename: ColourConverterBenchmark.cpp
+*
+* Description:
+* This file contains a C++ console application that measures the ColourConverter
+* in the Common folder, which the MFBitmapMftToEVR and MFVideoEVRWebcamMFT
+* samples can use instead of the CColorConvertDMO Media Foundation transform.
+*
+* Each conversion is timed at each frame size with the vectorised kernels the
+* converter uses on this CPU and with its plain C++ version, and the two outputs
+* are checked to be identical. If built with libyuv the same conversion is also
+* timed with libyuv and the largest difference between its output and the
+* converter's is reported. libyuv's defaults are BT.601 limited range so it's
+* only compared with those settings.
+*
+* Usage:
+* ColourConverterBenchmark [option=value ...]
+*
+* The options are given as name=value, lists are comma separated:
+* sizes=640x480,1920x1080        frame sizes.
+* conversions=YUY2:RGB32,...     source:destination pixel formats.
+* matrix=bt601                   bt601 or bt709.
+* range=limited                  limited or full.
+* ms=300                         the minimum time to spend timing each conversion.
+* csv=results.csv                write the results as CSV.
+*
+* The benchmark doesn't use Media Foundation so it also builds on Linux, the
+* AVX2 kernels are used if the CPU has them. For the libyuv comparison:
+* vcpkg install libyuv
+* g++ -O2 -std=c++17 -DCOLOUR_CONVERTER_LIBYUV ColourConverterBenchmark.cpp -lyuv -o ColourConverterBenchmark
+*
+* License: Public Domain (no warranty, use at own risk)
+/******************************************************************************/
+
+#include "../Common/ColourConverter.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <string>
+#include <vector>
+
+#ifdef COLOUR_CONVERTER_LIBYUV
+#include <libyuv.h>
+#endif
+
+#define DEFAULT_MEASURE_MS 300.0
+#define MIN_ITERATIONS 5
+
+/* The timings for one conversion at one frame size. */
+struct ConversionResult
+{
+  unsigned int Width = 0;
+  unsigned int Height = 0;
+  ColourFormat Source = ColourFormat::I420;
+  ColourFormat Destination = ColourFormat::I420;
+  double SimdMs = 0;                    // Mean time per frame with the vectorised kernels.
+  double PlainMs = 0;                   // Mean time per frame with the plain C++ version.
+  bool IsExact = false;                 // The vectorised and plain C++ outputs are identical.
+  double LibyuvMs = NAN;                // NAN if libyuv isn't built in or has no matching conversion.
+  int LibyuvMaxDifference = -1;
+};
+
+bool ParseFormat(const std::string& name, ColourFormat& format);
+std::vector<std::string> SplitList(const std::string& list);
+double TimeConversion(const std::function<bool()>& convert, double measureMs);
+bool ConvertWithLibyuv(const ColourImage& source, const ColourImage& destination);
+bool WriteCsv(const std::string& path, const std::vector<ConversionResult>& results);
+
+int main(int argc, char* argv[])
+{
+  std::vector<std::pair<unsigned int, unsigned int>> sizes = { { 640, 480 }, { 1280, 720 }, { 1920, 1080 } };
+  std::vector<std::pair<ColourFormat, ColourFormat>> conversions = {
+    { ColourFormat::YUY2, ColourFormat::RGB32 },
+    { ColourFormat::UYVY, ColourFormat::BGRA },
+    { ColourFormat::NV12, ColourFormat::RGB32 },
+    { ColourFormat::I420, ColourFormat::BGRA },
+    { ColourFormat::I420, ColourFormat::RGB24 },
+    { ColourFormat::RGB24, ColourFormat::RGB32 },
+    { ColourFormat::BGRA, ColourFormat::I420 },
+    { ColourFormat::BGRA, ColourFormat::NV12 },
+    { ColourFormat::RGB24, ColourFormat::I420 },
+    { ColourFormat::YUY2, ColourFormat::I420 },
+    { ColourFormat::YUY2, ColourFormat::NV12 },
+    { ColourFormat::I420, ColourFormat::NV12 } };
+  ColourMatrix matrix = ColourMatrix::BT601;
+  ColourRange range = ColourRange::Limited;
+  double measureMs = DEFAULT_MEASURE_MS;
+  std::string csvPath;
+
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    size_t equals = arg.find('=');
+    if (equals == std::string::npos) {
+      printf("Option %s isn't in the form name=value.\n", arg.c_str());
+      return 1;
+    }
+
+    std::string name = arg.substr(0, equals);
+    std::string value = arg.substr(equals + 1);
+
+    if (name == "sizes") {
+      sizes.clear();
+      for (const std::string& item : SplitList(value)) {
+        unsigned int width = 0, height = 0;
+        if (sscanf(item.c_str(), "%ux%u", &width, &height) != 2 || width == 0 || height == 0) {
+          printf("Size %s isn't in the form WxH.\n", item.c_str());
+          return 1;
+        }
+        sizes.push_back({ width, height });
+      }
+    }
+    else if (name == "conversions") {
+      conversions.clear();
+      for (const std::string& item : SplitList(value)) {
+        size_t colon = item.find(':');
+        ColourFormat source, destination;
+        if (colon == std::string::npos || !ParseFormat(item.substr(0, colon), source) || !ParseFormat(item.substr(colon + 1), destination)) {
+          printf("Conversion %s isn't in the form SOURCE:DESTINATION, e.g. YUY2:RGB32.\n", item.c_str());
+          return 1;
+        }
+        conversions.push_back({ source, destination });
+      }
+    }
+    else if (name == "matrix" && (value == "bt601" || value == "bt709")) {
+      matrix = (value == "bt709") ? ColourMatrix::BT709 : ColourMatrix::BT601;
+    }
+    else if (name == "range" && (value == "limited" || value == "full")) {
+      range = (value == "full") ? ColourRange::Full : ColourRange::Limited;
+    }
+    else if (name == "ms") {
+      measureMs = atof(value.c_str());
+    }
+    else if (name == "csv") {
+      csvPath = value;
+    }
+    else {
+      printf("Unknown option %s.\n", name.c_str());
+      return 1;
+    }
+  }
+
+#ifdef COLOUR_CONVERTER_LIBYUV
+  bool useLibyuv = matrix == ColourMatrix::BT601 && range == ColourRange::Limited;
+#else
+  bool useLibyuv = false;
+#endif
+
+  printf("ColourConverter using %s, %s %s range, libyuv %s.\n", ColourConverter::GetSimdName(),
+    (matrix == ColourMatrix::BT709) ? "BT.709" : "BT.601", (range == ColourRange::Full) ? "full" : "limited",
+    useLibyuv ? "compared" : "not compared");
+
+  printf("\n%10s %-14s | %9s %9s %8s %6s | %9s %8s\n", "size", "conversion", "SIMD ms", "C ms", "speedup", "exact", "libyuv ms", "max diff");
+
+  ColourConverter simdConverter(matrix, range, true);
+  ColourConverter plainConverter(matrix, range, false);
+  std::vector<ConversionResult> results;
+
+  for (const auto& size : sizes) {
+    unsigned int width = size.first, height = size.second;
+
+    for (const auto& conversion : conversions) {
+      ConversionResult result;
+      result.Width = width;
+      result.Height = height;
+      result.Source = conversion.first;
+      result.Destination = conversion.second;
+
+      if ((result.Source == ColourFormat::YUY2 || result.Source == ColourFormat::UYVY ||
+        result.Destination == ColourFormat::YUY2 || result.Destination == ColourFormat::UYVY) && (width % 2) != 0) {
+        printf("%4ux%-5u %-14s | skipped, YUY2 and UYVY need an even width.\n", width, height, "");
+        continue;
+      }
+
+      // Noise with a gradient so neighbouring chroma samples differ, the content
+      // doesn't change the timings but gives the comparisons something to check.
+      std::vector<uint8_t> sourceBuffer(GetColourImageSize(result.Source, width, height));
+      uint32_t seed = width * 31 + height;
+      for (size_t i = 0; i < sourceBuffer.size(); i++) {
+        seed = seed * 1664525 + 1013904223;
+        sourceBuffer[i] = (uint8_t)((i / 7) + (seed >> 28));
+      }
+
+      size_t destinationSize = GetColourImageSize(result.Destination, width, height);
+      std::vector<uint8_t> simdBuffer(destinationSize), plainBuffer(destinationSize), libyuvBuffer(destinationSize);
+      ColourImage source = GetColourImage(result.Source, sourceBuffer.data(), width, height);
+      ColourImage simdImage = GetColourImage(result.Destination, simdBuffer.data(), width, height);
+      ColourImage plainImage = GetColourImage(result.Destination, plainBuffer.data(), width, height);
+      ColourImage libyuvImage = GetColourImage(result.Destination, libyuvBuffer.data(), width, height);
+
+      result.SimdMs = TimeConversion([&]() { return simdConverter.Convert(source, simdImage); }, measureMs);
+      result.PlainMs = TimeConversion([&]() { return plainConverter.Convert(source, plainImage); }, measureMs);
+      result.IsExact = simdBuffer == plainBuffer;
+
+      if (useLibyuv && ConvertWithLibyuv(source, libyuvImage)) {
+        result.LibyuvMs = TimeConversion([&]() { return ConvertWithLibyuv(source, libyuvImage); }, measureMs);
+        result.LibyuvMaxDifference = 0;
+        for (size_t i = 0; i < destinationSize; i++) {
+          result.LibyuvMaxDifference = std::max(result.LibyuvMaxDifference, abs(libyuvBuffer[i] - simdBuffer[i]));
+        }
+      }
+
+      std::string name = std::string(GetColourFormatName(result.Source)) + "->" + GetColourFormatName(result.Destination);
+      char libyuvMs[16] = "-", libyuvDifference[16] = "-";
+      if (!std::isnan(result.LibyuvMs)) {
+        snprintf(libyuvMs, sizeof(libyuvMs), "%.3f", result.LibyuvMs);
+        snprintf(libyuvDifference, sizeof(libyuvDifference), "%d", result.LibyuvMaxDifference);
+      }
+
+      printf("%4ux%-5u %-14s | %9.3f %9.3f %7.1fx %6s | %9s %8s\n", width, height, name.c_str(), result.SimdMs, result.PlainMs,
+        result.PlainMs / result.SimdMs, result.IsExact ? "yes" : "NO", libyuvMs, libyuvDifference);
+
+      results.push_back(result);
+    }
+  }
+
+  if (!csvPath.empty() && !WriteCsv(csvPath, results)) {
+    return 1;
+  }
+
+  return 0;
+}
+
+bool ParseFormat(const std::string& name, ColourFormat& format)
+{
+  const ColourFormat formats[] = { ColourFormat::RGB24, ColourFormat::RGB32, ColourFormat::BGRA, ColourFormat::I420,
+    ColourFormat::NV12, ColourFormat::YUY2, ColourFormat::UYVY };
+
+  std::string upper = name;
+  std::transform(upper.begin(), upper.end(), upper.begin(), ::toupper);
+
+  for (ColourFormat candidate : formats) {
+    if (upper == GetColourFormatName(candidate)) {
+      format = candidate;
+      return true;
+    }
+  }
+  return false;
+}
+
+std::vector<std::string> SplitList(const std::string& list)
+{
+  std::vector<std::string> items;
+  size_t start = 0;
+
+  while (start <= list.size()) {
+    size_t end = list.find(',', start);
+    if (end == std::string::npos) {
+      end = list.size();
+    }
+
+    if (end > start) {
+      items.push_back(list.substr(start, end - start));
+    }
+    start = end + 1;
+  }
+
+  return items;
+}
+
+/**
+* Repeats a conversion until at least measureMs have passed and MIN_ITERATIONS
+* have been done, after one untimed run to warm the caches.
+* @param[in] convert: does the conversion.
+* @param[in] measureMs: the minimum time to spend.
+* @@Returns The mean milliseconds per conversion, or NAN if it failed.
+*/
+double TimeConversion(const std::function<bool()>& convert, double measureMs)
+{
+  if (!convert()) {
+    return NAN;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  double elapsedMs = 0;
+  unsigned int iterations = 0;
+
+  while (elapsedMs < measureMs || iterations < MIN_ITERATIONS) {
+    convert();
+    iterations++;
+    elapsedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+  }
+
+  return elapsedMs / iterations;
+}
+
+/**
+* Does a conversion with libyuv, whose ARGB is BGRA in memory.
+* @param[in] source: the image to convert.
+* @param[in] destination: the image to write the converted pixels to.
+* @@Returns true if libyuv has the conversion, false if not or libyuv isn't built in.
+*/
+bool ConvertWithLibyuv(const ColourImage& source, const ColourImage& destination)
+{
+#ifdef COLOUR_CONVERTER_LIBYUV
+  int width = source.Width, height = source.Height;
+  uint8_t* const* s = source.pPlanes;
+  const int* ss = source.Strides;
+  uint8_t* const* d = destination.pPlanes;
+  const int* ds = destination.Strides;
+  bool isSourceBgra = source.Format == ColourFormat::RGB32 || source.Format == ColourFormat::BGRA;
+  bool isDestinationBgra = destination.Format == ColourFormat::RGB32 || destination.Format == ColourFormat::BGRA;
+
+  if (isDestinationBgra) {
+    switch (source.Format) {
+    case ColourFormat::I420: return libyuv::I420ToARGB(s[0], ss[0], s[1], ss[1], s[2], ss[2], d[0], ds[0], width, height) == 0;
+    case ColourFormat::NV12: return libyuv::NV12ToARGB(s[0], ss[0], s[1], ss[1], d[0], ds[0], width, height) == 0;
+    case ColourFormat::YUY2: return libyuv::YUY2ToARGB(s[0], ss[0], d[0], ds[0], width, height) == 0;
+    case ColourFormat::UYVY: return libyuv::UYVYToARGB(s[0], ss[0], d[0], ds[0], width, height) == 0;
+    case ColourFormat::RGB24: return libyuv::RGB24ToARGB(s[0], ss[0], d[0], ds[0], width, height) == 0;
+    default: return false;
+    }
+  }
+  else if (destination.Format == ColourFormat::RGB24) {
+    switch (source.Format) {
+    case ColourFormat::I420: return libyuv::I420ToRGB24(s[0], ss[0], s[1], ss[1], s[2], ss[2], d[0], ds[0], width, height) == 0;
+    case ColourFormat::RGB32:
+    case ColourFormat::BGRA: return libyuv::ARGBToRGB24(s[0], ss[0], d[0], ds[0], width, height) == 0;
+    default: return false;
+    }
+  }
+  else if (destination.Format == ColourFormat::I420) {
+    if (isSourceBgra) {
+      return libyuv::ARGBToI420(s[0], ss[0], d[0], ds[0], d[1], ds[1], d[2], ds[2], width, height) == 0;
+    }
+    switch (source.Format) {
+    case ColourFormat::RGB24: return libyuv::RGB24ToI420(s[0], ss[0], d[0], ds[0], d[1], ds[1], d[2], ds[2], width, height) == 0;
+    case ColourFormat::NV12: return libyuv::NV12ToI420(s[0], ss[0], s[1], ss[1], d[0], ds[0], d[1], ds[1], d[2], ds[2], width, height) == 0;
+    case ColourFormat::YUY2: return libyuv::YUY2ToI420(s[0], ss[0], d[0], ds[0], d[1], ds[1], d[2], ds[2], width, height) == 0;
+    case ColourFormat::UYVY: return libyuv::UYVYToI420(s[0], ss[0], d[0], ds[0], d[1], ds[1], d[2], ds[2], width, height) == 0;
+    default: return false;
+    }
+  }
+  else if (destination.Format == ColourFormat::NV12) {
+    if (isSourceBgra) {
+      return libyuv::ARGBToNV12(s[0], ss[0], d[0], ds[0], d[1], ds[1], width, height) == 0;
+    }
+    switch (source.Format) {
+    case ColourFormat::I420: return libyuv::I420ToNV12(s[0], ss[0], s[1], ss[1], s[2], ss[2], d[0], ds[0], d[1], ds[1], width, height) == 0;
+    case ColourFormat::YUY2: return libyuv::YUY2ToNV12(s[0], ss[0], d[0], ds[0], d[1], ds[1], width, height) == 0;
+    default: return false;
+    }
+  }
+  else if (source.Format == ColourFormat::I420) {
+    switch (destination.Format) {
+    case ColourFormat::YUY2: return libyuv::I420ToYUY2(s[0], ss[0], s[1], ss[1], s[2], ss[2], d[0], ds[0], width, height) == 0;
+    case ColourFormat::UYVY: return libyuv::I420ToUYVY(s[0], ss[0], s[1], ss[1], s[2], ss[2], d[0], ds[0], width, height) == 0;
+    default: return false;
+    }
+  }
+#else
+  (void)source;
+  (void)destination;
+#endif
+
+  return false;
+}
+
+bool WriteCsv(const std::string& path, const std::vector<ConversionResult>& results)
+{
+  FILE* pFile = fopen(path.c_str(), "w");
+  if (pFile == nullptr) {
+    printf("Failed to open %s for writing.\n", path.c_str());
+    return false;
+  }
+
+  fprintf(pFile, "width,height,source,destination,simd,simd_ms,c_ms,exact,libyuv_ms,libyuv_max_difference\n");
+
+  for (const ConversionResult& result : results) {
+    fprintf(pFile, "%u,%u,%s,%s,%s,%.4f,%.4f,%d,", result.Width, result.Height, GetColourFormatName(result.Source),
+      GetColourFormatName(result.Destination), ColourConverter::GetSimdName(), result.SimdMs, result.PlainMs, result.IsExact ? 1 : 0);
+    if (std::isnan(result.LibyuvMs)) {
+      fprintf(pFile, ",\n");
+    }
+    else {
+      fprintf(pFile, "%.4f,%d\n", result.LibyuvMs, result.LibyuvMaxDifference);
+    }
+  }
+
+  fclose(pFile);
+  printf("Results written to %s.\n", path.c_str());
+  return true;
+}
@@ -0,0 +1,1044 @@
+/******************************************************************************
+* Filename: ColourConverter.h
+*
+* Description:
+* This header file contains a colour converter for the uncompressed pixel
+* formats the samples pass between webcams, the EVR and the encoders: RGB24,
+* RGB32, BGRA, I420, NV12, YUY2 and UYVY. It's an alternative to the
+* CColorConvertDMO Media Foundation transform, which needs its own input and
+* output samples and a copy of every frame, with a call that writes straight
+* into the destination buffer, e.g. a locked EVR surface.
+*
+* YUV is converted to and from RGB with the BT.601 or BT.709 matrix in limited
+* (16 to 235) or full (0 to 255) range. The arithmetic is 16 bit fixed point,
+* the same as libyuv, and the vectorised and plain C++ versions give exactly
+* the same output. Chroma is upsampled by repeating each sample and downsampled
+* by averaging each pair or 2x2 block of samples.
+*
+* Strides follow the Media Foundation convention from GetDefaultStride: a
+* negative stride means the image is bottom up, the first row in the buffer is
+* the bottom row of the image.
+*
+* Each row is converted by unpacking it to planar YUV or BGRA, converting
+* between the two if needed and packing it to the destination format. The rows
+* stay in the cache and most conversions skip one or more of the steps. The
+* steps are vectorised with SSE2 on x64 builds and x86 builds with /arch:SSE2,
+* with a plain C++ version for anything else. On x86 the RGB24 shuffles also
+* have an SSSE3 version and the YUV and RGB arithmetic an AVX2 one, which are
+* used when the CPU supports them (see CpuFeatures.h), so no /arch switch is
+* needed.
+*
+* License: Public Domain (no warranty, use at own risk)
+/******************************************************************************/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "CpuFeatures.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define COLOUR_CONVERTER_SSE2 1
+#include <emmintrin.h>
+#endif
+
+// Compiled on any x86 build and only called if the CPU supports them.
+#if defined(COLOUR_CONVERTER_SSE2) && defined(CPU_FEATURES_X86)
+#define COLOUR_CONVERTER_SSSE3 1
+#define COLOUR_CONVERTER_AVX2 1
+#include <immintrin.h>
+#endif
+
+#define COLOUR_YUV_TO_RGB_BITS 6        // Fixed point fraction bits of the YUV to RGB coefficients, the products have to fit in 16 bits.
+#define COLOUR_RGB_TO_YUV_BITS 14       // Fixed point fraction bits of the RGB to YUV coefficients.
+#define COLOUR_CHROMA_OFFSET 128
+
+enum class ColourFormat
+{
+  RGB24,                                // B, G, R bytes.
+  RGB32,                                // B, G, R and an unused byte that's set to 255 when written.
+  BGRA,                                 // B, G, R, A bytes, ARGB32 in Media Foundation.
+  I420,                                 // Y, U and V planes.
+  NV12,                                 // Y plane and an interleaved UV plane.
+  YUY2,                                 // Y0, U, Y1, V bytes.
+  UYVY                                  // U, Y0, V, Y1 bytes.
+};
+
+enum class ColourMatrix
+{
+  BT601,                                // Standard definition, what webcams and libyuv use by default.
+  BT709                                 // High definition.
+};
+
+enum class ColourRange
+{
+  Limited,                              // Luma 16 to 235 and chroma 16 to 240, the usual range for video.
+  Full                                  // 0 to 255, e.g. JPEG and MJPEG webcams.
+};
+
+inline const char* GetColourFormatName(ColourFormat format)
+{
+  switch (format) {
+  case ColourFormat::RGB24: return "RGB24";
+  case ColourFormat::RGB32: return "RGB32";
+  case ColourFormat::BGRA: return "BGRA";
+  case ColourFormat::I420: return "I420";
+  case ColourFormat::NV12: return "NV12";
+  case ColourFormat::YUY2: return "YUY2";
+  case ColourFormat::UYVY: return "UYVY";
+  default: return "unknown";
+  }
+}
+
+inline bool IsYuvColourFormat(ColourFormat format)
+{
+  return format == ColourFormat::I420 || format == ColourFormat::NV12 || format == ColourFormat::YUY2 || format == ColourFormat::UYVY;
+}
+
+/* The planes of an image to convert, the converter doesn't take a copy. */
+struct ColourImage
+{
+  ColourFormat Format = ColourFormat::I420;
+  unsigned int Width = 0;
+  unsigned int Height = 0;
+  uint8_t* pPlanes[3] = { nullptr, nullptr, nullptr };  // The top row of each plane, I420 uses three, NV12 two and the rest one.
+  int Strides[3] = { 0, 0, 0 };                         // Bytes from one row of the image to the next, negative if bottom up.
+};
+
+/**
+* Gets the planes of an image in a single buffer, e.g. a locked Media Foundation
+* buffer, a Y4M frame or a bitmap.
+* @param[in] format: the image's pixel format.
+* @param[in] pBuffer: the start of the buffer.
+* @param[in] width: the image width.
+* @param[in] height: the image height.
+* @param[in] stride: the bytes between the rows of the first plane, 0 for no
+*  padding. Negative if the image is bottom up, as returned by GetDefaultStride,
+*  in which case each plane starts with its bottom row.
+* @@Returns The image's planes.
+*/
+inline ColourImage GetColourImage(ColourFormat format, uint8_t* pBuffer, unsigned int width, unsigned int height, int stride = 0)
+{
+  unsigned int chromaWidth = (width + 1) / 2, chromaHeight = (height + 1) / 2;
+  size_t planeStrides[3] = { 0, 0, 0 }, planeRows[3] = { height, 0, 0 };
+  ColourImage image;
+
+  switch (format) {
+  case ColourFormat::RGB24:
+    planeStrides[0] = (size_t)width * 3;
+    break;
+  case ColourFormat::RGB32:
+  case ColourFormat::BGRA:
+    planeStrides[0] = (size_t)width * 4;
+    break;
+  case ColourFormat::YUY2:
+  case ColourFormat::UYVY:
+    planeStrides[0] = (size_t)chromaWidth * 4;
+    break;
+  case ColourFormat::I420:
+    planeStrides[0] = width;
+    planeStrides[1] = planeStrides[2] = chromaWidth;
+    planeRows[1] = planeRows[2] = chromaHeight;
+    break;
+  case ColourFormat::NV12:
+    planeStrides[0] = width;
+    planeStrides[1] = (size_t)chromaWidth * 2;
+    planeRows[1] = chromaHeight;
+    break;
+  }
+
+  // A stride with padding applies to the chroma planes too, halved for I420's.
+  if (stride != 0) {
+    size_t lumaStride = (size_t)abs(stride);
+    if (format == ColourFormat::I420) {
+      planeStrides[1] = planeStrides[2] = (lumaStride + 1) / 2;
+    }
+    else if (format == ColourFormat::NV12) {
+      planeStrides[1] = lumaStride;
+    }
+    planeStrides[0] = lumaStride;
+  }
+
+  image.Format = format;
+  image.Width = width;
+  image.Height = height;
+
+  uint8_t* pPlane = pBuffer;
+  for (int plane = 0; plane < 3 && planeRows[plane] > 0; plane++) {
+    image.pPlanes[plane] = (stride < 0) ? pPlane + planeStrides[plane] * (planeRows[plane] - 1) : pPlane;
+    image.Strides[plane] = (stride < 0) ? -(int)planeStrides[plane] : (int)planeStrides[plane];
+    pPlane += planeStrides[plane] * planeRows[plane];
+  }
+
+  return image;
+}
+
+/**
+* Gets the planes of an image from its top row and the bytes between rows, e.g.
+* from IMF2DBuffer::Lock2D.
+* @param[in] format: the image's pixel format.
+* @param[in] pTopRow: the top row of the image's first plane.
+* @param[in] width: the image width.
+* @param[in] height: the image height.
+* @param[in] pitch: the bytes from one row to the next, negative if the image
+*  is bottom up.
+* @@Returns The image's planes.
+*/
+inline ColourImage GetColourImageFromTopRow(ColourFormat format, uint8_t* pTopRow, unsigned int width, unsigned int height, int pitch)
+{
+  uint8_t* pBuffer = (pitch < 0) ? pTopRow + (ptrdiff_t)pitch * (height - 1) : pTopRow;
+  return GetColourImage(format, pBuffer, width, height, pitch);
+}
+
+/**
+* Gets a band of an image's rows as an image of its own, so a frame can be split
+* into bands and converted on several threads, e.g. with a FrameBandExecutor and
+* a ColourConverter for each thread.
+* @param[in] image: the whole image.
+* @param[in] top: the first row of the band, even so 4:2:0 chroma rows aren't split.
+* @param[in] rows: the rows in the band.
+* @@Returns The band's planes.
+*/
+inline ColourImage GetColourImageRows(const ColourImage& image, unsigned int top, unsigned int rows)
+{
+  ColourImage band = image;
+  bool isChromaHalfHeight = image.Format == ColourFormat::I420 || image.Format == ColourFormat::NV12;
+
+  band.Height = rows;
+  for (int plane = 0; plane < 3 && image.pPlanes[plane] != nullptr; plane++) {
+    unsigned int planeTop = (plane > 0 && isChromaHalfHeight) ? top / 2 : top;
+    band.pPlanes[plane] = image.pPlanes[plane] + (ptrdiff_t)planeTop * image.Strides[plane];
+  }
+  return band;
+}
+
+/* The bytes needed for an image with no padding between rows. */
+inline size_t GetColourImageSize(ColourFormat format, unsigned int width, unsigned int height)
+{
+  size_t lumaSize = (size_t)width * height, chromaSize = (size_t)((width + 1) / 2) * ((height + 1) / 2);
+
+  switch (format) {
+  case ColourFormat::RGB24: return lumaSize * 3;
+  case ColourFormat::RGB32:
+  case ColourFormat::BGRA: return lumaSize * 4;
+  case ColourFormat::YUY2:
+  case ColourFormat::UYVY: return (size_t)((width + 1) / 2) * 4 * height;
+  default: return lumaSize + chromaSize * 2;
+  }
+}
+
+/* The fixed point coefficients for one matrix and range. */
+struct ColourCoefficients
+{
+  // YUV to RGB with COLOUR_YUV_TO_RGB_BITS fraction bits, chroma is centred on 0 first. Luma
+  // is multiplied by 257 and the top 16 bits of the product with YScale kept, which is
+  // more precise than a 16 bit product.
+  uint16_t YScale = 0;
+  int16_t YScaledOffset = 0;            // The luma offset less the rounding, subtracted after scaling.
+  int16_t UToB = 0;
+  int16_t UToG = 0;                     // Subtracted.
+  int16_t VToG = 0;                     // Subtracted.
+  int16_t VToR = 0;
+
+  // RGB to YUV with COLOUR_RGB_TO_YUV_BITS fraction bits, chroma is from the sum of two pixels.
+  int16_t BToY = 0;
+  int16_t GToY = 0;
+  int16_t RToY = 0;
+  int16_t BToU = 0;
+  int16_t GToU = 0;
+  int16_t RToU = 0;
+  int16_t BToV = 0;
+  int16_t GToV = 0;
+  int16_t RToV = 0;
+  int32_t YBias = 0;                    // The luma offset and rounding.
+  int32_t ChromaBias = 0;               // The chroma offset and rounding.
+};
+
+/**
+* Works out the fixed point conversion coefficients from the luma weights of the
+* red and blue primaries.
+* @param[in] matrix: BT.601 or BT.709.
+* @param[in] range: limited or full range.
+* @@Returns The coefficients.
+*/
+inline ColourCoefficients GetColourCoefficients(ColourMatrix matrix, ColourRange range)
+{
+  double kr = (matrix == ColourMatrix::BT709) ? 0.2126 : 0.299;
+  double kb = (matrix == ColourMatrix::BT709) ? 0.0722 : 0.114;
+  double kg = 1.0 - kr - kb;
+  bool isFull = range == ColourRange::Full;
+  double yScale = isFull ? 1.0 : 255.0 / 219.0;
+  double chromaScale = isFull ? 1.0 : 255.0 / 224.0;
+  int yOffset = isFull ? 0 : 16;
+  double toRgb = 1 << COLOUR_YUV_TO_RGB_BITS, toYuv = 1 << COLOUR_RGB_TO_YUV_BITS;
+  ColourCoefficients c;
+
+  c.YScale = (uint16_t)lround(yScale * toRgb * 255);
+  c.YScaledOffset = (int16_t)(lround(yOffset * yScale * toRgb) - (1 << (COLOUR_YUV_TO_RGB_BITS - 1)));
+  c.UToB = (int16_t)lround(chromaScale * 2 * (1 - kb) * toRgb);
+  c.UToG = (int16_t)lround(chromaScale * 2 * (1 - kb) * kb / kg * toRgb);
+  c.VToG = (int16_t)lround(chromaScale * 2 * (1 - kr) * kr / kg * toRgb);
+  c.VToR = (int16_t)lround(chromaScale * 2 * (1 - kr) * toRgb);
+
+  // The green weights are whatever is left over so white and grey come out exactly.
+  c.BToY = (int16_t)lround(kb / yScale * toYuv);
+  c.RToY = (int16_t)lround(kr / yScale * toYuv);
+  c.GToY = (int16_t)(lround(toYuv / yScale) - c.BToY - c.RToY);
+  c.BToU = (int16_t)lround(0.5 / chromaScale * toYuv);
+  c.RToU = (int16_t)lround(-kr / (2 * (1 - kb)) / chromaScale * toYuv);
+  c.GToU = (int16_t)(-c.BToU - c.RToU);
+  c.RToV = (int16_t)lround(0.5 / chromaScale * toYuv);
+  c.BToV = (int16_t)lround(-kb / (2 * (1 - kr)) / chromaScale * toYuv);
+  c.GToV = (int16_t)(-c.RToV - c.BToV);
+  c.YBias = (yOffset << COLOUR_RGB_TO_YUV_BITS) + (1 << (COLOUR_RGB_TO_YUV_BITS - 1));
+  c.ChromaBias = (COLOUR_CHROMA_OFFSET << (COLOUR_RGB_TO_YUV_BITS + 1)) + (1 << COLOUR_RGB_TO_YUV_BITS);
+  return c;
+}
+
+class ColourConverter
+{
+public:
+  /**
+  * @param[in] matrix: the YUV matrix for conversions between YUV and RGB.
+  * @param[in] range: the YUV range for conversions between YUV and RGB.
+  * @param[in] useSimd: false to only use the plain C++ version, for comparing
+  *  against the vectorised one.
+  */
+  ColourConverter(ColourMatrix matrix = ColourMatrix::BT601, ColourRange range = ColourRange::Limited, bool useSimd = true) :
+    _coefficients(GetColourCoefficients(matrix, range)),
+    _useSimd(useSimd),
+    _useSsse3(useSimd && GetCpuFeatures().Ssse3),
+    _useAvx2(useSimd && GetCpuFeatures().Avx2)
+  { }
+
+  /**
+  * Converts an image to another pixel format. The images have to be the same
+  * size and can't overlap, YUY2 and UYVY images need an even width.
+  * @param[in] source: the image to convert.
+  * @param[in] destination: the image to write the converted pixels to.
+  * @@Returns true if the image was converted, false if the images don't match.
+  */
+  bool Convert(const ColourImage& source, const ColourImage& destination)
+  {
+    unsigned int width = source.Width, height = source.Height;
+
+    if (width == 0 || height == 0 || destination.Width != width || destination.Height != height) {
+      printf("Colour conversion from %ux%u to %ux%u isn't supported, the sizes need to match.\n", width, height, destination.Width, destination.Height);
+      return false;
+    }
+    else if ((Is422(source.Format) || Is422(destination.Format)) && (width % 2) != 0) {
+      printf("Colour conversion from %s to %s needs an even width, not %u.\n", GetColourFormatName(source.Format), GetColourFormatName(destination.Format), width);
+      return false;
+    }
+
+    Allocate(width);
+
+    for (unsigned int y = 0; y < height; y += 2) {
+      unsigned int rows = std::min(2u, height - y);
+      RowPair pair;
+
+      if (IsYuvColourFormat(source.Format)) {
+        ReadYuvRows(source, y, rows, pair);
+      }
+      else {
+        ReadBgraRows(source, destination, y, rows, pair);
+      }
+
+      if (IsYuvColourFormat(destination.Format)) {
+        if (!IsYuvColourFormat(source.Format)) {
+          // Planar formats get their luma written in place.
+          bool isPlanar = destination.Format == ColourFormat::I420 || destination.Format == ColourFormat::NV12;
+          for (unsigned int r = 0; r < rows; r++) {
+            uint8_t* pY = isPlanar ? GetRow(destination, 0, y + r) : _pY[r];
+            BgraToYuvRow(pair.pBgra[r], width, pY, _pU[r], _pV[r]);
+            pair.pY[r] = pY;
+            pair.pU[r] = _pU[r];
+            pair.pV[r] = _pV[r];
+          }
+        }
+        WriteYuvRows(destination, y, rows, pair);
+      }
+      else {
+        for (unsigned int r = 0; r < rows; r++) {
+          WriteBgraRow(source.Format, destination, y + r, pair, r);
+        }
+      }
+    }
+
+    return true;
+  }
+
+  /* The widest instructions the converter uses on this CPU. */
+  static const char* GetSimdName()
+  {
+#if defined(COLOUR_CONVERTER_AVX2)
+    if (GetCpuFeatures().Avx2) {
+      return "AVX2";
+    }
+#endif
+#if defined(COLOUR_CONVERTER_SSSE3)
+    if (GetCpuFeatures().Ssse3) {
+      return "SSSE3";
+    }
+#endif
+#if defined(COLOUR_CONVERTER_SSE2)
+    return "SSE2";
+#else
+    return "none";
+#endif
+  }
+
+private:
+
+  /* Two rows unpacked to planar YUV, with chroma for each row, or BGRA. */
+  struct RowPair
+  {
+    const uint8_t* pY[2] = { nullptr, nullptr };
+    const uint8_t* pU[2] = { nullptr, nullptr };
+    const uint8_t* pV[2] = { nullptr, nullptr };
+    const uint8_t* pBgra[2] = { nullptr, nullptr };
+    bool IsChromaShared = false;        // 4:2:0, both rows point at the same chroma.
+  };
+
+  static bool Is422(ColourFormat format)
+  {
+    return format == ColourFormat::YUY2 || format == ColourFormat::UYVY;
+  }
+
+  static uint8_t* GetRow(const ColourImage& image, int plane, unsigned int row)
+  {
+    return image.pPlanes[plane] + (ptrdiff_t)row * image.Strides[plane];
+  }
+
+  static uint8_t Clamp(int value)
+  {
+    return (uint8_t)std::min(std::max(value, 0), 255);
+  }
+
+  void Allocate(unsigned int width)
+  {
+    size_t chromaWidth = (width + 1) / 2;
+    size_t rowBytes = width + chromaWidth * 2 + (size_t)width * 4;
+
+    if (_scratch.size() < rowBytes * 2 + chromaWidth * 2) {
+      _scratch.resize(rowBytes * 2 + chromaWidth * 2);
+    }
+
+    uint8_t* pNext = _scratch.data();
+    for (int r = 0; r < 2; r++) {
+      _pY[r] = pNext;
+      _pU[r] = _pY[r] + width;
+      _pV[r] = _pU[r] + chromaWidth;
+      _pBgra[r] = _pV[r] + chromaWidth;
+      pNext = _pBgra[r] + (size_t)width * 4;
+    }
+    _pSharedU = pNext;
+    _pSharedV = _pSharedU + chromaWidth;
+  }
+
+  void ReadYuvRows(const ColourImage& source, unsigned int y, unsigned int rows, RowPair& pair)
+  {
+    unsigned int width = source.Width, chromaWidth = (width + 1) / 2;
+
+    switch (source.Format) {
+    case ColourFormat::I420:
+      pair.pY[0] = GetRow(source, 0, y);
+      pair.pY[1] = (rows > 1) ? GetRow(source, 0, y + 1) : nullptr;
+      pair.pU[0] = pair.pU[1] = GetRow(source, 1, y / 2);
+      pair.pV[0] = pair.pV[1] = GetRow(source, 2, y / 2);
+      pair.IsChromaShared = true;
+      break;
+    case ColourFormat::NV12:
+      pair.pY[0] = GetRow(source, 0, y);
+      pair.pY[1] = (rows > 1) ? GetRow(source, 0, y + 1) : nullptr;
+      SplitUvRow(GetRow(source, 1, y / 2), chromaWidth, _pSharedU, _pSharedV);
+      pair.pU[0] = pair.pU[1] = _pSharedU;
+      pair.pV[0] = pair.pV[1] = _pSharedV;
+      pair.IsChromaShared = true;
+      break;
+    default:
+      for (unsigned int r = 0; r < rows; r++) {
+        UnpackYuy2Row(GetRow(source, 0, y + r), width, _pY[r], _pU[r], _pV[r], source.Format == ColourFormat::UYVY);
+        pair.pY[r] = _pY[r];
+        pair.pU[r] = _pU[r];
+        pair.pV[r] = _pV[r];
+      }
+      break;
+    }
+  }
+
+  void ReadBgraRows(const ColourImage& source, const ColourImage& destination, unsigned int y, unsigned int rows, RowPair& pair)
+  {
+    bool isDestinationBgra = destination.Format == ColourFormat::RGB32 || destination.Format == ColourFormat::BGRA;
+
+    for (unsigned int r = 0; r < rows; r++) {
+      if (source.Format == ColourFormat::RGB24) {
+        // Straight into the destination if it's 32 bit so there's nothing left to copy.
+        uint8_t* pBgra = isDestinationBgra ? GetRow(destination, 0, y + r) : _pBgra[r];
+        Rgb24ToBgraRow(GetRow(source, 0, y + r), source.Width, pBgra);
+        pair.pBgra[r] = pBgra;
+      }
+      else {
+        // The unused RGB32 byte is ignored by the YUV and RGB24 conversions.
+        pair.pBgra[r] = GetRow(source, 0, y + r);
+      }
+    }
+  }
+
+  void WriteYuvRows(const ColourImage& destination, unsigned int y, unsigned int rows, const RowPair& pair)
+  {
+    unsigned int width = destination.Width, chromaWidth = (width + 1) / 2;
+
+    if (Is422(destination.Format)) {
+      for (unsigned int r = 0; r < rows; r++) {
+        PackYuy2Row(pair.pY[r], pair.pU[r], pair.pV[r], width, GetRow(destination, 0, y + r), destination.Format == ColourFormat::UYVY);
+      }
+      return;
+    }
+
+    for (unsigned int r = 0; r < rows; r++) {
+      uint8_t* pRow = GetRow(destination, 0, y + r);
+      if (pRow != pair.pY[r]) {
+        memcpy(pRow, pair.pY[r], width);
+      }
+    }
+
+    // 4:2:0 chroma from 4:2:2 rows is the average of the pair, the last row of
+    // an odd height has no pair.
+    const uint8_t* pU = pair.pU[0];
+    const uint8_t* pV = pair.pV[0];
+    bool isPlanar = destination.Format == ColourFormat::I420;
+    uint8_t* pOutU = isPlanar ? GetRow(destination, 1, y / 2) : _pSharedU;
+    uint8_t* pOutV = isPlanar ? GetRow(destination, 2, y / 2) : _pSharedV;
+
+    if (!pair.IsChromaShared && rows > 1) {
+      AverageRows(pair.pU[0], pair.pU[1], chromaWidth, pOutU);
+      AverageRows(pair.pV[0], pair.pV[1], chromaWidth, pOutV);
+      pU = pOutU;
+      pV = pOutV;
+    }
+
+    if (isPlanar) {
+      if (pU != pOutU) {
+        memcpy(pOutU, pU, chromaWidth);
+        memcpy(pOutV, pV, chromaWidth);
+      }
+    }
+    else {
+      MergeUvRow(pU, pV, chromaWidth, GetRow(destination, 1, y / 2));
+    }
+  }
+
+  void WriteBgraRow(ColourFormat sourceFormat, const ColourImage& destination, unsigned int y, const RowPair& pair, unsigned int r)
+  {
+    unsigned int width = destination.Width;
+    uint8_t* pRow = GetRow(destination, 0, y);
+    const uint8_t* pBgra = pair.pBgra[r];
+
+    if (IsYuvColourFormat(sourceFormat)) {
+      uint8_t* pConverted = (destination.Format == ColourFormat::RGB24) ? _pBgra[r] : pRow;
+      YuvToBgraRow(pair.pY[r], pair.pU[r], pair.pV[r], width, pConverted);
+      pBgra = pConverted;
+    }
+
+    if (destination.Format == ColourFormat::RGB24) {
+      BgraToRgb24Row(pBgra, width, pRow);
+    }
+    else if (sourceFormat == ColourFormat::RGB32) {
+      SetOpaqueRow(pBgra, width, pRow);
+    }
+    else if (pBgra != pRow) {
+      memcpy(pRow, pBgra, (size_t)width * 4);
+    }
+  }
+
+  /**
+  * Converts a row of planar YUV with a chroma sample for each pair of pixels to BGRA.
+  * @param[in] pY: the luma samples.
+  * @param[in] pU: the U samples.
+  * @param[in] pV: the V samples.
+  * @param[in] width: the pixels in the row.
+  * @param[out] pBgra: the row to write the pixels to.
+  */
+  void YuvToBgraRow(const uint8_t* pY, const uint8_t* pU, const uint8_t* pV, unsigned int width, uint8_t* pBgra) const
+  {
+    const ColourCoefficients& c = _coefficients;
+    unsigned int x = 0;
+
+    // Each chroma sample is unpacked twice to line up with its two luma samples.
+    // The luma term is at most 17836 and the chroma terms 17280 so the sums can
+    // saturate, but only when the result would be clamped to 255 anyway.
+    if (_useSimd) {
+#ifdef COLOUR_CONVERTER_AVX2
+      if (_useAvx2) {
+        x = YuvToBgraRowAvx2(pY, pU, pV, width, pBgra);
+      }
+#endif
+
+#ifdef COLOUR_CONVERTER_SSE2
+      __m128i zero = _mm_setzero_si128();
+      __m128i yScale = _mm_set1_epi16((short)c.YScale), yOffset = _mm_set1_epi16(c.YScaledOffset);
+      __m128i chromaOffset = _mm_set1_epi16(COLOUR_CHROMA_OFFSET);
+      __m128i uToB = _mm_set1_epi16(c.UToB), uToG = _mm_set1_epi16(c.UToG);
+      __m128i vToG = _mm_set1_epi16(c.VToG), vToR = _mm_set1_epi16(c.VToR);
+      __m128i alpha = _mm_set1_epi8((char)0xFF);
+      for (; x + 8 <= width; x += 8) {
+        __m128i u4 = _mm_cvtsi32_si128(LoadU32(pU + x / 2));
+        __m128i v4 = _mm_cvtsi32_si128(LoadU32(pV + x / 2));
+        __m128i luma8 = _mm_loadl_epi64((const __m128i*)(pY + x));
+        __m128i u = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_unpacklo_epi8(u4, u4), zero), chromaOffset);
+        __m128i v = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_unpacklo_epi8(v4, v4), zero), chromaOffset);
+
+        __m128i luma = _mm_sub_epi16(_mm_mulhi_epu16(_mm_unpacklo_epi8(luma8, luma8), yScale), yOffset);
+        __m128i b = _mm_srai_epi16(_mm_adds_epi16(luma, _mm_mullo_epi16(u, uToB)), COLOUR_YUV_TO_RGB_BITS);
+        __m128i g = _mm_srai_epi16(_mm_subs_epi16(luma,
+          _mm_adds_epi16(_mm_mullo_epi16(u, uToG), _mm_mullo_epi16(v, vToG))), COLOUR_YUV_TO_RGB_BITS);
+        __m128i r = _mm_srai_epi16(_mm_adds_epi16(luma, _mm_mullo_epi16(v, vToR)), COLOUR_YUV_TO_RGB_BITS);
+
+        __m128i bg = _mm_unpacklo_epi8(_mm_packus_epi16(b, b), _mm_packus_epi16(g, g));
+        __m128i ra = _mm_unpacklo_epi8(_mm_packus_epi16(r, r), alpha);
+        _mm_storeu_si128((__m128i*)(pBgra + (size_t)x * 4), _mm_unpacklo_epi16(bg, ra));
+        _mm_storeu_si128((__m128i*)(pBgra + (size_t)x * 4 + 16), _mm_unpackhi_epi16(bg, ra));
+      }
+#endif
+    }
+
+    for (; x < width; x++) {
+      int luma = (int)((pY[x] * 257u * c.YScale) >> 16) - c.YScaledOffset;
+      int u = pU[x / 2] - COLOUR_CHROMA_OFFSET, v = pV[x / 2] - COLOUR_CHROMA_OFFSET;
+      uint8_t* pPixel = pBgra + (size_t)x * 4;
+
+      pPixel[0] = Clamp((luma + u * c.UToB) >> COLOUR_YUV_TO_RGB_BITS);
+      pPixel[1] = Clamp((luma - u * c.UToG - v * c.VToG) >> COLOUR_YUV_TO_RGB_BITS);
+      pPixel[2] = Clamp((luma + v * c.VToR) >> COLOUR_YUV_TO_RGB_BITS);
+      pPixel[3] = 0xFF;
+    }
+  }
+
+  /**
+  * Converts a row of BGRA to planar YUV with a chroma sample for each pair of
+  * pixels. The alpha is ignored.
+  * @param[in] pBgra: the pixels to convert.
+  * @param[in] width: the pixels in the row.
+  * @param[out] pY: the row to write the luma samples to.
+  * @param[out] pU: the row to write the U samples to.
+  * @param[out] pV: the row to write the V samples to.
+  */
+  void BgraToYuvRow(const uint8_t* pBgra, unsigned int width, uint8_t* pY, uint8_t* pU, uint8_t* pV) const
+  {
+    const ColourCoefficients& c = _coefficients;
+    unsigned int x = 0;
+
+    // Each pixel is unpacked to 16 bits and multiplied and added with madd, which
+    // leaves the B+G and R+A halves of each pixel in neighbouring 32 bit lanes for
+    // AddPairs to finish. Chroma does the same with the sums of pairs of pixels.
+    if (_useSimd) {
+#ifdef COLOUR_CONVERTER_AVX2
+      if (_useAvx2) {
+        x = BgraToYuvRowAvx2(pBgra, width, pY, pU, pV);
+      }
+#endif
+
+#ifdef COLOUR_CONVERTER_SSE2
+      __m128i zero = _mm_setzero_si128();
+      __m128i toY = _mm_setr_epi16(c.BToY, c.GToY, c.RToY, 0, c.BToY, c.GToY, c.RToY, 0);
+      __m128i toU = _mm_setr_epi16(c.BToU, c.GToU, c.RToU, 0, c.BToU, c.GToU, c.RToU, 0);
+      __m128i toV = _mm_setr_epi16(c.BToV, c.GToV, c.RToV, 0, c.BToV, c.GToV, c.RToV, 0);
+      __m128i yBias = _mm_set1_epi32(c.YBias), chromaBias = _mm_set1_epi32(c.ChromaBias);
+      for (; x + 8 <= width; x += 8) {
+        __m128i luma[2], chroma[2];
+
+        for (int half = 0; half < 2; half++) {
+          __m128i pixels = _mm_loadu_si128((const __m128i*)(pBgra + (size_t)(x + half * 4) * 4));
+          __m128i low = _mm_unpacklo_epi8(pixels, zero), high = _mm_unpackhi_epi8(pixels, zero);
+          __m128i sums = _mm_add_epi16(_mm_unpacklo_epi64(low, high), _mm_unpackhi_epi64(low, high));
+
+          luma[half] = _mm_srai_epi32(_mm_add_epi32(AddPairs(_mm_madd_epi16(low, toY), _mm_madd_epi16(high, toY)), yBias),
+            COLOUR_RGB_TO_YUV_BITS);
+          chroma[half] = _mm_srai_epi32(_mm_add_epi32(AddPairs(_mm_madd_epi16(sums, toU), _mm_madd_epi16(sums, toV)), chromaBias),
+            COLOUR_RGB_TO_YUV_BITS + 1);
+        }
+
+        __m128i luma16 = _mm_packs_epi32(luma[0], luma[1]);
+        _mm_storel_epi64((__m128i*)(pY + x), _mm_packus_epi16(luma16, luma16));
+
+        // U0 U1 V0 V1 U2 U3 V2 V3 to U0 U1 U2 U3 V0 V1 V2 V3.
+        __m128i chroma16 = _mm_shuffle_epi32(_mm_packs_epi32(chroma[0], chroma[1]), _MM_SHUFFLE(3, 1, 2, 0));
+        __m128i uv = _mm_packus_epi16(chroma16, chroma16);
+        StoreU32(pU + x / 2, _mm_cvtsi128_si32(uv));
+        StoreU32(pV + x / 2, _mm_cvtsi128_si32(_mm_srli_si128(uv, 4)));
+      }
+#endif
+    }
+
+    // The last pixel of an odd width is paired with itself.
+    for (; x < width; x += 2) {
+      const uint8_t* pFirst = pBgra + (size_t)x * 4;
+      const uint8_t* pSecond = (x + 1 < width) ? pFirst + 4 : pFirst;
+
+      pY[x] = Clamp((pFirst[0] * c.BToY + pFirst[1] * c.GToY + pFirst[2] * c.RToY + c.YBias) >> COLOUR_RGB_TO_YUV_BITS);
+      if (x + 1 < width) {
+        pY[x + 1] = Clamp((pSecond[0] * c.BToY + pSecond[1] * c.GToY + pSecond[2] * c.RToY + c.YBias) >> COLOUR_RGB_TO_YUV_BITS);
+      }
+
+      int b = pFirst[0] + pSecond[0], g = pFirst[1] + pSecond[1], r = pFirst[2] + pSecond[2];
+      pU[x / 2] = Clamp((b * c.BToU + g * c.GToU + r * c.RToU + c.ChromaBias) >> (COLOUR_RGB_TO_YUV_BITS + 1));
+      pV[x / 2] = Clamp((b * c.BToV + g * c.GToV + r * c.RToV + c.ChromaBias) >> (COLOUR_RGB_TO_YUV_BITS + 1));
+    }
+  }
+
+  void Rgb24ToBgraRow(const uint8_t* pRgb, unsigned int width, uint8_t* pBgra) const
+  {
+    unsigned int x = 0;
+
+#ifdef COLOUR_CONVERTER_SSSE3
+    if (_useSsse3) {
+      x = Rgb24ToBgraRowSsse3(pRgb, width, pBgra);
+    }
+#endif
+
+    for (; x < width; x++) {
+      pBgra[x * 4] = pRgb[x * 3];
+      pBgra[x * 4 + 1] = pRgb[x * 3 + 1];
+      pBgra[x * 4 + 2] = pRgb[x * 3 + 2];
+      pBgra[x * 4 + 3] = 0xFF;
+    }
+  }
+
+  void BgraToRgb24Row(const uint8_t* pBgra, unsigned int width, uint8_t* pRgb) const
+  {
+    unsigned int x = 0;
+
+#ifdef COLOUR_CONVERTER_SSSE3
+    if (_useSsse3) {
+      x = BgraToRgb24RowSsse3(pBgra, width, pRgb);
+    }
+#endif
+
+    for (; x < width; x++) {
+      pRgb[x * 3] = pBgra[x * 4];
+      pRgb[x * 3 + 1] = pBgra[x * 4 + 1];
+      pRgb[x * 3 + 2] = pBgra[x * 4 + 2];
+    }
+  }
+
+#ifdef COLOUR_CONVERTER_AVX2
+  /* The AVX2 part of YuvToBgraRow, 16 pixels at a time, returning the pixels converted. */
+  CPU_TARGET_AVX2 unsigned int YuvToBgraRowAvx2(const uint8_t* pY, const uint8_t* pU, const uint8_t* pV, unsigned int width, uint8_t* pBgra) const
+  {
+    const ColourCoefficients& c = _coefficients;
+    unsigned int x = 0;
+
+    __m256i yScale256 = _mm256_set1_epi16((short)c.YScale), yOffset256 = _mm256_set1_epi16(c.YScaledOffset);
+    __m256i chromaOffset256 = _mm256_set1_epi16(COLOUR_CHROMA_OFFSET);
+    __m256i uToB256 = _mm256_set1_epi16(c.UToB), uToG256 = _mm256_set1_epi16(c.UToG);
+    __m256i vToG256 = _mm256_set1_epi16(c.VToG), vToR256 = _mm256_set1_epi16(c.VToR);
+    __m256i alpha256 = _mm256_set1_epi8((char)0xFF);
+    for (; x + 16 <= width; x += 16) {
+      __m128i u8 = _mm_loadl_epi64((const __m128i*)(pU + x / 2));
+      __m128i v8 = _mm_loadl_epi64((const __m128i*)(pV + x / 2));
+      __m256i luma = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(pY + x)));
+      __m256i u = _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm_unpacklo_epi8(u8, u8)), chromaOffset256);
+      __m256i v = _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm_unpacklo_epi8(v8, v8)), chromaOffset256);
+
+      luma = _mm256_sub_epi16(_mm256_mulhi_epu16(_mm256_or_si256(_mm256_slli_epi16(luma, 8), luma), yScale256), yOffset256);
+      __m256i b = _mm256_srai_epi16(_mm256_adds_epi16(luma, _mm256_mullo_epi16(u, uToB256)), COLOUR_YUV_TO_RGB_BITS);
+      __m256i g = _mm256_srai_epi16(_mm256_subs_epi16(luma,
+        _mm256_adds_epi16(_mm256_mullo_epi16(u, uToG256), _mm256_mullo_epi16(v, vToG256))), COLOUR_YUV_TO_RGB_BITS);
+      __m256i r = _mm256_srai_epi16(_mm256_adds_epi16(luma, _mm256_mullo_epi16(v, vToR256)), COLOUR_YUV_TO_RGB_BITS);
+
+      // Packing and unpacking work within each 128 bit lane, so the low register
+      // ends up with pixels 0-3 and 8-11 and the high one 4-7 and 12-15.
+      __m256i bg = _mm256_unpacklo_epi8(_mm256_packus_epi16(b, b), _mm256_packus_epi16(g, g));
+      __m256i ra = _mm256_unpacklo_epi8(_mm256_packus_epi16(r, r), alpha256);
+      __m256i low = _mm256_unpacklo_epi16(bg, ra), high = _mm256_unpackhi_epi16(bg, ra);
+      _mm256_storeu_si256((__m256i*)(pBgra + (size_t)x * 4), _mm256_permute2x128_si256(low, high, 0x20));
+      _mm256_storeu_si256((__m256i*)(pBgra + (size_t)x * 4 + 32), _mm256_permute2x128_si256(low, high, 0x31));
+    }
+
+    return x;
+  }
+
+  /* The AVX2 part of BgraToYuvRow, 16 pixels at a time, returning the pixels converted. */
+  CPU_TARGET_AVX2 unsigned int BgraToYuvRowAvx2(const uint8_t* pBgra, unsigned int width, uint8_t* pY, uint8_t* pU, uint8_t* pV) const
+  {
+    const ColourCoefficients& c = _coefficients;
+    unsigned int x = 0;
+
+    __m256i zero256 = _mm256_setzero_si256();
+    __m256i toY256 = _mm256_setr_epi16(c.BToY, c.GToY, c.RToY, 0, c.BToY, c.GToY, c.RToY, 0, c.BToY, c.GToY, c.RToY, 0, c.BToY, c.GToY, c.RToY, 0);
+    __m256i toU256 = _mm256_setr_epi16(c.BToU, c.GToU, c.RToU, 0, c.BToU, c.GToU, c.RToU, 0, c.BToU, c.GToU, c.RToU, 0, c.BToU, c.GToU, c.RToU, 0);
+    __m256i toV256 = _mm256_setr_epi16(c.BToV, c.GToV, c.RToV, 0, c.BToV, c.GToV, c.RToV, 0, c.BToV, c.GToV, c.RToV, 0, c.BToV, c.GToV, c.RToV, 0);
+    __m256i yBias256 = _mm256_set1_epi32(c.YBias), chromaBias256 = _mm256_set1_epi32(c.ChromaBias);
+    __m256i chromaOrder = _mm256_setr_epi32(0, 4, 2, 6, 1, 5, 3, 7);
+    for (; x + 16 <= width; x += 16) {
+      __m256i luma[2], chroma[2];
+
+      // Unpacking works within each 128 bit lane so the low register has pixels
+      // 0, 1, 4 and 5 and the high one 2, 3, 6 and 7, which AddPairs puts back in order.
+      for (int half = 0; half < 2; half++) {
+        __m256i pixels = _mm256_loadu_si256((const __m256i*)(pBgra + (size_t)(x + half * 8) * 4));
+        __m256i low = _mm256_unpacklo_epi8(pixels, zero256), high = _mm256_unpackhi_epi8(pixels, zero256);
+        __m256i sums = _mm256_add_epi16(_mm256_unpacklo_epi64(low, high), _mm256_unpackhi_epi64(low, high));
+
+        luma[half] = _mm256_srai_epi32(_mm256_add_epi32(AddPairs(_mm256_madd_epi16(low, toY256), _mm256_madd_epi16(high, toY256)), yBias256),
+          COLOUR_RGB_TO_YUV_BITS);
+        chroma[half] = _mm256_srai_epi32(_mm256_add_epi32(AddPairs(_mm256_madd_epi16(sums, toU256), _mm256_madd_epi16(sums, toV256)), chromaBias256),
+          COLOUR_RGB_TO_YUV_BITS + 1);
+      }
+
+      __m256i luma16 = _mm256_permute4x64_epi64(_mm256_packs_epi32(luma[0], luma[1]), _MM_SHUFFLE(3, 1, 2, 0));
+      _mm_storeu_si128((__m128i*)(pY + x), _mm_packus_epi16(_mm256_castsi256_si128(luma16), _mm256_extracti128_si256(luma16, 1)));
+
+      // Each lane has two U then two V from each half, the permute gathers the Us then the Vs.
+      __m256i chroma16 = _mm256_permutevar8x32_epi32(_mm256_packs_epi32(chroma[0], chroma[1]), chromaOrder);
+      __m128i uv = _mm_packus_epi16(_mm256_castsi256_si128(chroma16), _mm256_extracti128_si256(chroma16, 1));
+      _mm_storel_epi64((__m128i*)(pU + x / 2), uv);
+      _mm_storel_epi64((__m128i*)(pV + x / 2), _mm_srli_si128(uv, 8));
+    }
+
+    return x;
+  }
+#endif
+
+#ifdef COLOUR_CONVERTER_SSSE3
+  /* The SSSE3 part of Rgb24ToBgraRow, returning the pixels converted. */
+  CPU_TARGET_SSSE3 static unsigned int Rgb24ToBgraRowSsse3(const uint8_t* pRgb, unsigned int width, uint8_t* pBgra)
+  {
+    unsigned int x = 0;
+
+    // Each 16 byte load has 4 pixels and 4 bytes of the next, which is why the
+    // loop stops 2 pixels short of the end of the row.
+    __m128i spread = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    __m128i alpha = _mm_set1_epi32((int)0xFF000000);
+    for (; x + 6 <= width; x += 4) {
+      __m128i pixels = _mm_loadu_si128((const __m128i*)(pRgb + (size_t)x * 3));
+      _mm_storeu_si128((__m128i*)(pBgra + (size_t)x * 4), _mm_or_si128(_mm_shuffle_epi8(pixels, spread), alpha));
+    }
+
+    return x;
+  }
+
+  /* The SSSE3 part of BgraToRgb24Row, returning the pixels converted. */
+  CPU_TARGET_SSSE3 static unsigned int BgraToRgb24RowSsse3(const uint8_t* pBgra, unsigned int width, uint8_t* pRgb)
+  {
+    unsigned int x = 0;
+
+    // Each 16 byte store has 4 pixels and 4 bytes of junk that the next store
+    // overwrites, the loop stops 2 pixels short so the last doesn't run past the row.
+    __m128i pack = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    for (; x + 6 <= width; x += 4) {
+      __m128i pixels = _mm_loadu_si128((const __m128i*)(pBgra + (size_t)x * 4));
+      _mm_storeu_si128((__m128i*)(pRgb + (size_t)x * 3), _mm_shuffle_epi8(pixels, pack));
+    }
+
+    return x;
+  }
+#endif
+
+  /* Copies a row of RGB32 to BGRA with the unused byte set to 255. */
+  void SetOpaqueRow(const uint8_t* pSource, unsigned int width, uint8_t* pBgra) const
+  {
+    unsigned int x = 0;
+
+#ifdef COLOUR_CONVERTER_SSE2
+    if (_useSimd) {
+      __m128i alpha = _mm_set1_epi32((int)0xFF000000);
+      for (; x + 4 <= width; x += 4) {
+        __m128i pixels = _mm_loadu_si128((const __m128i*)(pSource + (size_t)x * 4));
+        _mm_storeu_si128((__m128i*)(pBgra + (size_t)x * 4), _mm_or_si128(pixels, alpha));
+      }
+    }
+#endif
+
+    for (; x < width; x++) {
+      memcpy(pBgra + (size_t)x * 4, pSource + (size_t)x * 4, 3);
+      pBgra[x * 4 + 3] = 0xFF;
+    }
+  }
+
+  /**
+  * Unpacks a row of YUY2 or UYVY to planar YUV.
+  * @param[in] pSource: the packed pixels.
+  * @param[in] width: the pixels in the row, an even number.
+  * @param[out] pY: the row to write the luma samples to.
+  * @param[out] pU: the row to write the U samples to.
+  * @param[out] pV: the row to write the V samples to.
+  * @param[in] isUyvy: true for UYVY, false for YUY2.
+  */
+  void UnpackYuy2Row(const uint8_t* pSource, unsigned int width, uint8_t* pY, uint8_t* pU, uint8_t* pV, bool isUyvy) const
+  {
+    unsigned int x = 0;
+
+#ifdef COLOUR_CONVERTER_SSE2
+    if (_useSimd) {
+      __m128i zero = _mm_setzero_si128(), lowBytes = _mm_set1_epi16(0x00FF);
+      for (; x + 16 <= width; x += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(pSource + (size_t)x * 2));
+        __m128i b = _mm_loadu_si128((const __m128i*)(pSource + (size_t)x * 2 + 16));
+        __m128i even = _mm_packus_epi16(_mm_and_si128(a, lowBytes), _mm_and_si128(b, lowBytes));
+        __m128i odd = _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8));
+        __m128i uv = isUyvy ? even : odd;
+
+        _mm_storeu_si128((__m128i*)(pY + x), isUyvy ? odd : even);
+        _mm_storel_epi64((__m128i*)(pU + x / 2), _mm_packus_epi16(_mm_and_si128(uv, lowBytes), zero));
+        _mm_storel_epi64((__m128i*)(pV + x / 2), _mm_packus_epi16(_mm_srli_epi16(uv, 8), zero));
+      }
+    }
+#endif
+
+    int yIndex = isUyvy ? 1 : 0, uIndex = isUyvy ? 0 : 1;
+    for (; x < width; x += 2) {
+      const uint8_t* pPair = pSource + (size_t)x * 2;
+      pY[x] = pPair[yIndex];
+      pY[x + 1] = pPair[yIndex + 2];
+      pU[x / 2] = pPair[uIndex];
+      pV[x / 2] = pPair[uIndex + 2];
+    }
+  }
+
+  /* Packs a row of planar YUV with a chroma sample for each pair of pixels to YUY2 or UYVY. */
+  void PackYuy2Row(const uint8_t* pY, const uint8_t* pU, const uint8_t* pV, unsigned int width, uint8_t* pDestination, bool isUyvy) const
+  {
+    unsigned int x = 0;
+
+#ifdef COLOUR_CONVERTER_SSE2
+    if (_useSimd) {
+      for (; x + 16 <= width; x += 16) {
+        __m128i luma = _mm_loadu_si128((const __m128i*)(pY + x));
+        __m128i uv = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(pU + x / 2)), _mm_loadl_epi64((const __m128i*)(pV + x / 2)));
+        __m128i low = isUyvy ? _mm_unpacklo_epi8(uv, luma) : _mm_unpacklo_epi8(luma, uv);
+        __m128i high = isUyvy ? _mm_unpackhi_epi8(uv, luma) : _mm_unpackhi_epi8(luma, uv);
+
+        _mm_storeu_si128((__m128i*)(pDestination + (size_t)x * 2), low);
+        _mm_storeu_si128((__m128i*)(pDestination + (size_t)x * 2 + 16), high);
+      }
+    }
+#endif
+
+    int yIndex = isUyvy ? 1 : 0, uIndex = isUyvy ? 0 : 1;
+    for (; x < width; x += 2) {
+      uint8_t* pPair = pDestination + (size_t)x * 2;
+      pPair[yIndex] = pY[x];
+      pPair[yIndex + 2] = pY[x + 1];
+      pPair[uIndex] = pU[x / 2];
+      pPair[uIndex + 2] = pV[x / 2];
+    }
+  }
+
+  /* Splits a row of NV12's interleaved chroma into U and V. */
+  void SplitUvRow(const uint8_t* pUv, unsigned int chromaWidth, uint8_t* pU, uint8_t* pV) const
+  {
+    unsigned int x = 0;
+
+#ifdef COLOUR_CONVERTER_SSE2
+    if (_useSimd) {
+      __m128i lowBytes = _mm_set1_epi16(0x00FF);
+      for (; x + 16 <= chromaWidth; x += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(pUv + (size_t)x * 2));
+        __m128i b = _mm_loadu_si128((const __m128i*)(pUv + (size_t)x * 2 + 16));
+        _mm_storeu_si128((__m128i*)(pU + x), _mm_packus_epi16(_mm_and_si128(a, lowBytes), _mm_and_si128(b, lowBytes)));
+        _mm_storeu_si128((__m128i*)(pV + x), _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8)));
+      }
+    }
+#endif
+
+    for (; x < chromaWidth; x++) {
+      pU[x] = pUv[x * 2];
+      pV[x] = pUv[x * 2 + 1];
+    }
+  }
+
+  /* Interleaves rows of U and V into NV12's chroma. */
+  void MergeUvRow(const uint8_t* pU, const uint8_t* pV, unsigned int chromaWidth, uint8_t* pUv) const
+  {
+    unsigned int x = 0;
+
+#ifdef COLOUR_CONVERTER_SSE2
+    if (_useSimd) {
+      for (; x + 16 <= chromaWidth; x += 16) {
+        __m128i u = _mm_loadu_si128((const __m128i*)(pU + x));
+        __m128i v = _mm_loadu_si128((const __m128i*)(pV + x));
+        _mm_storeu_si128((__m128i*)(pUv + (size_t)x * 2), _mm_unpacklo_epi8(u, v));
+        _mm_storeu_si128((__m128i*)(pUv + (size_t)x * 2 + 16), _mm_unpackhi_epi8(u, v));
+      }
+    }
+#endif
+
+    for (; x < chromaWidth; x++) {
+      pUv[x * 2] = pU[x];
+      pUv[x * 2 + 1] = pV[x];
+    }
+  }
+
+  /* The rounded up average of two rows, the same as _mm_avg_epu8. */
+  void AverageRows(const uint8_t* pA, const uint8_t* pB, unsigned int length, uint8_t* pAverage) const
+  {
+    unsigned int x = 0;
+
+#ifdef COLOUR_CONVERTER_SSE2
+    if (_useSimd) {
+      for (; x + 16 <= length; x += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(pA + x));
+        __m128i b = _mm_loadu_si128((const __m128i*)(pB + x));
+        _mm_storeu_si128((__m128i*)(pAverage + x), _mm_avg_epu8(a, b));
+      }
+    }
+#endif
+
+    for (; x < length; x++) {
+      pAverage[x] = (uint8_t)((pA[x] + pB[x] + 1) >> 1);
+    }
+  }
+
+  static int LoadU32(const uint8_t* pSource)
+  {
+    int value;
+    memcpy(&value, pSource, sizeof(value));
+    return value;
+  }
+
+  static void StoreU32(uint8_t* pDestination, int value)
+  {
+    memcpy(pDestination, &value, sizeof(value));
+  }
+
+  /* Adds neighbouring 32 bit lanes, the sums from low then the sums from high. */
+#ifdef COLOUR_CONVERTER_SSE2
+  static __m128i AddPairs(__m128i low, __m128i high)
+  {
+    __m128 evenLanes = _mm_shuffle_ps(_mm_castsi128_ps(low), _mm_castsi128_ps(high), _MM_SHUFFLE(2, 0, 2, 0));
+    __m128 oddLanes = _mm_shuffle_ps(_mm_castsi128_ps(low), _mm_castsi128_ps(high), _MM_SHUFFLE(3, 1, 3, 1));
+    return _mm_add_epi32(_mm_castps_si128(evenLanes), _mm_castps_si128(oddLanes));
+  }
+#endif
+
+#ifdef COLOUR_CONVERTER_AVX2
+  CPU_TARGET_AVX2 static __m256i AddPairs(__m256i low, __m256i high)
+  {
+    __m256 evenLanes = _mm256_shuffle_ps(_mm256_castsi256_ps(low), _mm256_castsi256_ps(high), _MM_SHUFFLE(2, 0, 2, 0));
+    __m256 oddLanes = _mm256_shuffle_ps(_mm256_castsi256_ps(low), _mm256_castsi256_ps(high), _MM_SHUFFLE(3, 1, 3, 1));
+    return _mm256_add_epi32(_mm256_castps_si256(evenLanes), _mm256_castps_si256(oddLanes));
+  }
+#endif
+
+  ColourCoefficients _coefficients;
+  bool _useSimd;
+  bool _useSsse3;                       // The CPU has SSSE3 and useSimd was set.
+  bool _useAvx2;                        // The CPU has AVX2 and useSimd was set.
+  std::vector<uint8_t> _scratch;        // Two rows of planar YUV and BGRA and a row of 4:2:0 chroma.
+  uint8_t* _pY[2] = { nullptr, nullptr };
+  uint8_t* _pU[2] = { nullptr, nullptr };
+  uint8_t* _pV[2] = { nullptr, nullptr };
+  uint8_t* _pBgra[2] = { nullptr, nullptr };
+  uint8_t* _pSharedU = nullptr;
+  uint8_t* _pSharedV = nullptr;
+};
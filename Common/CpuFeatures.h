@@ -0,0 +1,80 @@
+/******************************************************************************
+* Filename: CpuFeatures.h
+*
+* Description:
+* This header file contains the CPU instruction set checks used by the pixel
+* kernels in the Common folder that have SSSE3 and AVX2 versions. Only SSE2 is
+* part of the x64 baseline, so those versions are compiled into functions of
+* their own and only called once the CPU has been found to support them, and the
+* samples run on any x64 CPU without needing /arch:AVX2 or -mavx2.
+*
+* MSVC allows any intrinsic in any function. GCC and Clang only allow them in
+* functions compiled for the instruction set, which the CPU_TARGET_ attributes
+* do for a single function.
+*
+* License: Public Domain (no warranty, use at own risk)
+/******************************************************************************/
+
+#pragma once
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define CPU_FEATURES_X86 1
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define CPU_TARGET_SSSE3 __attribute__((target("ssse3")))
+#define CPU_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define CPU_TARGET_SSSE3
+#define CPU_TARGET_AVX2
+#endif
+#endif
+
+#define CPU_FEATURES_SSSE3_BIT (1 << 9)     // CPUID leaf 1 ECX.
+#define CPU_FEATURES_OSXSAVE_BIT (1 << 27)  // CPUID leaf 1 ECX, the OS saves the AVX registers and XGETBV can be used.
+#define CPU_FEATURES_AVX_BIT (1 << 28)      // CPUID leaf 1 ECX.
+#define CPU_FEATURES_AVX2_BIT (1 << 5)      // CPUID leaf 7 EBX.
+#define CPU_FEATURES_XCR0_AVX_STATE 0x6     // XCR0 bits for the SSE and AVX register state.
+
+struct CpuFeatures
+{
+  bool Ssse3 = false;
+  bool Avx2 = false;                    // The CPU has AVX2 and the OS saves the 256 bit registers.
+};
+
+/* The instruction sets of the CPU the process is running on, found once. */
+inline const CpuFeatures& GetCpuFeatures()
+{
+  static const CpuFeatures features = []() {
+    CpuFeatures found;
+
+#if defined(CPU_FEATURES_X86) && defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 0);
+    int maxLeaf = info[0];
+
+    __cpuid(info, 1);
+    found.Ssse3 = (info[2] & CPU_FEATURES_SSSE3_BIT) != 0;
+    bool hasAvxState = (info[2] & CPU_FEATURES_OSXSAVE_BIT) && (info[2] & CPU_FEATURES_AVX_BIT) &&
+      (_xgetbv(0) & CPU_FEATURES_XCR0_AVX_STATE) == CPU_FEATURES_XCR0_AVX_STATE;
+
+    if (maxLeaf >= 7 && hasAvxState) {
+      __cpuidex(info, 7, 0);
+      found.Avx2 = (info[1] & CPU_FEATURES_AVX2_BIT) != 0;
+    }
+#elif defined(CPU_FEATURES_X86)
+    // Also checks the OS saves the AVX registers.
+    __builtin_cpu_init();
+    found.Ssse3 = __builtin_cpu_supports("ssse3") != 0;
+    found.Avx2 = __builtin_cpu_supports("avx2") != 0;
+#endif
+
+    return found;
+  }();
+
+  return features;
+}
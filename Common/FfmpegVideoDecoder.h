@@ -0,0 +1,149 @@
+/******************************************************************************
+* Filename: FfmpegVideoDecoder.h
+*
+* Description:
+* This header file contains the FFmpeg libavcodec backend for the VideoDecoder
+* interface. It decodes H264, VP8 and VP9 and is the only backend that supports
+* both slice and frame threading. Frame threading holds back a frame per
+* thread so Drain has to be called at the end of the stream to get them all.
+*
+* Dependencies:
+* vcpkg install ffmpeg
+*
+* License: Public Domain (no warranty, use at own risk)
+/******************************************************************************/
+
+#pragma once
+
+#include "VideoDecoder.h"
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+}
+
+#include <stdio.h>
+
+class FfmpegVideoDecoder : public VideoDecoder
+{
+public:
+  ~FfmpegVideoDecoder()
+  {
+    av_frame_free(&_pFrame);
+    av_packet_free(&_pPacket);
+    avcodec_free_context(&_pCodecContext);
+  }
+
+  const char* GetName() const override
+  {
+    return "ffmpeg";
+  }
+
+  bool SupportsCodec(VideoCodec codec) const override
+  {
+    return codec == VideoCodec::H264 || codec == VideoCodec::VP8 || codec == VideoCodec::VP9;
+  }
+
+  bool SupportsThreading(VideoDecoderThreading threading) const override
+  {
+    return threading == VideoDecoderThreading::None || threading == VideoDecoderThreading::Slice ||
+      threading == VideoDecoderThreading::Frame;
+  }
+
+protected:
+
+  bool Open(const VideoDecoderConfig& config) override
+  {
+    AVCodecID codecID = (config.Codec == VideoCodec::VP9) ? AV_CODEC_ID_VP9 :
+      (config.Codec == VideoCodec::VP8) ? AV_CODEC_ID_VP8 : AV_CODEC_ID_H264;
+
+    const AVCodec* pCodec = avcodec_find_decoder(codecID);
+    if (pCodec == nullptr) {
+      printf("FFmpeg has no %s decoder.\n", GetVideoCodecName(config.Codec));
+      return false;
+    }
+
+    _pCodecContext = avcodec_alloc_context3(pCodec);
+    _pPacket = av_packet_alloc();
+    _pFrame = av_frame_alloc();
+    if (_pCodecContext == nullptr || _pPacket == nullptr || _pFrame == nullptr) {
+      printf("Failed to allocate FFmpeg decoder context.\n");
+      return false;
+    }
+
+    if (config.Threading == VideoDecoderThreading::None) {
+      _pCodecContext->thread_count = 1;
+    }
+    else {
+      _pCodecContext->thread_count = config.Threads;   // 0 is auto detect.
+      _pCodecContext->thread_type = (config.Threading == VideoDecoderThreading::Frame) ? FF_THREAD_FRAME : FF_THREAD_SLICE;
+    }
+
+    int res = avcodec_open2(_pCodecContext, pCodec, nullptr);
+    if (res < 0) {
+      printf("Failed to open FFmpeg %s decoder, error %d.\n", GetVideoCodecName(config.Codec), res);
+      return false;
+    }
+
+    return true;
+  }
+
+  bool Decode(const uint8_t* pData, size_t length, int64_t pts) override
+  {
+    // The packet isn't reference counted so libavcodec takes a copy of the data if it needs to keep it.
+    _pPacket->data = (uint8_t*)pData;
+    _pPacket->size = (int)length;
+    _pPacket->pts = pts;
+
+    int res = avcodec_send_packet(_pCodecContext, _pPacket);
+    av_packet_unref(_pPacket);
+
+    if (res < 0) {
+      printf("FFmpeg decoder rejected access unit, error %d.\n", res);
+      return false;
+    }
+
+    return ReceiveFrames();
+  }
+
+  bool Flush() override
+  {
+    int res = avcodec_send_packet(_pCodecContext, nullptr);
+    if (res < 0 && res != AVERROR_EOF) {
+      printf("Failed to drain FFmpeg decoder, error %d.\n", res);
+      return false;
+    }
+
+    return ReceiveFrames();
+  }
+
+private:
+
+  /* Queues frames until the decoder needs more input or has been drained. */
+  bool ReceiveFrames()
+  {
+    while (true) {
+      int res = avcodec_receive_frame(_pCodecContext, _pFrame);
+
+      if (res == AVERROR(EAGAIN) || res == AVERROR_EOF) {
+        return true;
+      }
+      else if (res < 0) {
+        printf("FFmpeg decoder failed to decode frame, error %d.\n", res);
+        return false;
+      }
+
+      if (_pFrame->format != AV_PIX_FMT_YUV420P && _pFrame->format != AV_PIX_FMT_YUVJ420P) {
+        printf("FFmpeg decoder output pixel format %d isn't 4:2:0.\n", _pFrame->format);
+        av_frame_unref(_pFrame);
+        return false;
+      }
+
+      QueueFrame(_pFrame->data, _pFrame->linesize, _pFrame->width, _pFrame->height, _pFrame->pts);
+      av_frame_unref(_pFrame);
+    }
+  }
+
+  AVCodecContext* _pCodecContext = nullptr;
+  AVPacket* _pPacket = nullptr;
+  AVFrame* _pFrame = nullptr;
+};
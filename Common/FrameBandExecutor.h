@@ -0,0 +1,267 @@
+/******************************************************************************
+* Filename: FrameBandExecutor.h
+*
+* Description:
+* This header file contains a small executor that runs a per frame pixel kernel,
+* e.g. a colour conversion, scale or quality metric, across the cores by
+* splitting the frame into bands of rows. The worker threads are started once
+* and kept for the life of the executor, with the caller's thread doing bands as
+* well, and running a frame doesn't allocate.
+*
+* A band is sized so the rows it reads and writes fit in about
+* FRAME_BAND_CACHE_BYTES, one core's L2 cache, so a kernel that makes more than
+* one pass over its rows finds them still in the cache. There are normally more
+* bands than threads and each thread takes the next band when it finishes one,
+* so a thread that gets descheduled doesn't hold the frame up.
+*
+* The workers can be pinned, worker N to core N, so each keeps its cache and
+* isn't moved between cores mid frame. The caller's thread isn't pinned. Pinning
+* is done with SetThreadAffinityMask on Windows and pthread_setaffinity_np on
+* Linux and isn't available elsewhere.
+*
+* License: Public Domain (no warranty, use at own risk)
+/******************************************************************************/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#define FRAME_BAND_CACHE_BYTES (256 * 1024)   // Bytes of rows a band should read and write, about one core's L2 cache.
+#define FRAME_BAND_MIN_ROWS 8                 // Smaller bands cost more in hand overs than they save.
+
+class FrameBandExecutor
+{
+public:
+  /**
+  * @param[in] threads: the threads to run kernels with, including the caller's,
+  *  0 for one per core.
+  * @param[in] pinThreads: true to pin each worker thread to its own core.
+  */
+  FrameBandExecutor(unsigned int threads = 0, bool pinThreads = true) :
+    _threadCount((threads > 0) ? threads : std::max(1U, std::thread::hardware_concurrency()))
+  {
+    unsigned int cores = std::max(1U, std::thread::hardware_concurrency());
+    _arePinned = pinThreads && _threadCount > 1;
+
+    for (unsigned int i = 1; i < _threadCount; i++) {
+      _workers.push_back(std::thread(&FrameBandExecutor::WorkerLoop, this, i));
+      if (pinThreads && !PinThread(_workers.back(), i % cores)) {
+        _arePinned = false;
+      }
+    }
+  }
+
+  ~FrameBandExecutor()
+  {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _exit = true;
+    }
+    _jobCondition.notify_all();
+
+    for (auto& worker : _workers) {
+      worker.join();
+    }
+  }
+
+  FrameBandExecutor(const FrameBandExecutor&) = delete;
+  FrameBandExecutor& operator=(const FrameBandExecutor&) = delete;
+
+  /* The threads kernels run on, including the caller's, which is thread 0. */
+  unsigned int GetThreadCount() const
+  {
+    return _threadCount;
+  }
+
+  /* True if all the worker threads were pinned to a core. */
+  bool ArePinned() const
+  {
+    return _arePinned;
+  }
+
+  /**
+  * Gets the rows in each band of a frame. A band is sized to fit in
+  * FRAME_BAND_CACHE_BYTES but is made smaller if that would leave a thread with
+  * nothing to do.
+  * @param[in] rows: the rows in the frame.
+  * @param[in] bytesPerRow: the bytes the kernel reads and writes for each row,
+  *  across all the planes of its source and destination.
+  * @param[in] rowAlignment: the band size is a multiple of this, e.g. 2 so 4:2:0
+  *  chroma rows aren't split between bands.
+  * @@Returns The rows in each band, the last band can be shorter.
+  */
+  unsigned int GetBandRows(unsigned int rows, size_t bytesPerRow, unsigned int rowAlignment = 1) const
+  {
+    rowAlignment = std::max(1U, rowAlignment);
+    size_t cacheRows = FRAME_BAND_CACHE_BYTES / std::max((size_t)1, bytesPerRow);
+    size_t threadRows = (rows + _threadCount - 1) / _threadCount;
+    size_t bandRows = std::max((size_t)FRAME_BAND_MIN_ROWS, std::min(cacheRows, threadRows));
+
+    bandRows = (bandRows + rowAlignment - 1) / rowAlignment * rowAlignment;
+    return (unsigned int)std::min(bandRows, (size_t)std::max(rows, 1U));
+  }
+
+  /* The number of bands GetBandRows splits a frame into. */
+  unsigned int GetBandCount(unsigned int rows, size_t bytesPerRow, unsigned int rowAlignment = 1) const
+  {
+    unsigned int bandRows = GetBandRows(rows, bytesPerRow, rowAlignment);
+    return std::max(1U, (rows + bandRows - 1) / bandRows);
+  }
+
+  /**
+  * Runs a kernel over a frame's rows in bands sized by GetBandRows and returns
+  * when they've all finished.
+  * @param[in] rows: the rows in the frame.
+  * @param[in] bytesPerRow: the bytes the kernel reads and writes for each row.
+  * @param[in] rowAlignment: the band size is a multiple of this.
+  * @param[in] kernel: called as kernel(top, bottom, thread) for the rows from
+  *  top up to but not including bottom. Thread is from 0 to GetThreadCount() - 1
+  *  and no two bands run on the same thread at once, so it can index per thread
+  *  scratch buffers.
+  */
+  template<typename Kernel>
+  void Run(unsigned int rows, size_t bytesPerRow, unsigned int rowAlignment, const Kernel& kernel)
+  {
+    unsigned int bandRows = GetBandRows(rows, bytesPerRow, rowAlignment);
+    unsigned int bands = (rows + bandRows - 1) / bandRows;
+
+    RunBands(bands, [&](unsigned int band, unsigned int thread) {
+      kernel(band * bandRows, std::min(rows, (band + 1) * bandRows), thread);
+    });
+  }
+
+  /**
+  * Runs a function for each band, on the worker threads and the caller's, and
+  * returns when they've all finished.
+  * @param[in] bands: the number of bands.
+  * @param[in] job: called as job(band, thread) with each band from 0 to bands - 1.
+  */
+  template<typename Job>
+  void RunBands(unsigned int bands, const Job& job)
+  {
+    // The job is called through a plain function pointer rather than a std::function so nothing is allocated.
+    RunBands(bands, &job, [](const void* pJob, unsigned int band, unsigned int thread) {
+      (*(const Job*)pJob)(band, thread);
+    });
+  }
+
+private:
+
+  typedef void (*BandFunction)(const void* pJob, unsigned int band, unsigned int thread);
+
+  static bool PinThread(std::thread& thread, unsigned int core)
+  {
+#if defined(_WIN32)
+    return core < sizeof(DWORD_PTR) * 8 && SetThreadAffinityMask(thread.native_handle(), (DWORD_PTR)1 << core) != 0;
+#elif defined(__linux__)
+    cpu_set_t cores;
+    CPU_ZERO(&cores);
+    CPU_SET(core, &cores);
+    return pthread_setaffinity_np(thread.native_handle(), sizeof(cores), &cores) == 0;
+#else
+    (void)thread;
+    (void)core;
+    return false;
+#endif
+  }
+
+  void RunBands(unsigned int bands, const void* pJob, BandFunction function)
+  {
+    if (bands <= 1 || _workers.empty()) {
+      for (unsigned int band = 0; band < bands; band++) {
+        function(pJob, band, 0);
+      }
+      return;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _pJob = pJob;
+      _function = function;
+      _bands = bands;
+      _nextBand = 0;
+      _completedBands = 0;
+      _generation++;
+    }
+    _jobCondition.notify_all();
+
+    DoBands(0);
+
+    // Waits for the workers to be idle as well as the bands to be done so none are still looking at this job when the next starts.
+    std::unique_lock<std::mutex> lock(_mutex);
+    _doneCondition.wait(lock, [this]() { return _completedBands == _bands && _activeWorkers == 0; });
+    _pJob = nullptr;
+    _function = nullptr;
+  }
+
+  /* Takes bands from the current job until there are none left. */
+  void DoBands(unsigned int thread)
+  {
+    unsigned int band;
+    while ((band = _nextBand++) < _bands) {
+      _function(_pJob, band, thread);
+
+      if (++_completedBands == _bands) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _doneCondition.notify_all();
+      }
+    }
+  }
+
+  void WorkerLoop(unsigned int thread)
+  {
+    uint64_t generation = 0;
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    while (true) {
+      _jobCondition.wait(lock, [&]() { return _exit || _generation != generation; });
+      if (_exit) {
+        return;
+      }
+
+      generation = _generation;
+      _activeWorkers++;
+      lock.unlock();
+
+      DoBands(thread);
+
+      lock.lock();
+      if (--_activeWorkers == 0) {
+        _doneCondition.notify_all();
+      }
+    }
+  }
+
+  unsigned int _threadCount;
+  bool _arePinned = false;
+  std::vector<std::thread> _workers;
+  std::mutex _mutex;
+  std::condition_variable _jobCondition;
+  std::condition_variable _doneCondition;
+  const void* _pJob = nullptr;
+  BandFunction _function = nullptr;
+  unsigned int _bands = 0;
+  std::atomic<unsigned int> _nextBand{ 0 };
+  std::atomic<unsigned int> _completedBands{ 0 };
+  unsigned int _activeWorkers = 0;
+  uint64_t _generation = 0;
+  bool _exit = false;
+};
@@ -0,0 +1,231 @@
+/******************************************************************************
+* Filename: FrameCopy.h
+*
+* Description:
+* This header file contains the copy used where a frame is handed from one
+* stage to the next, e.g. from a source reader sample to a locked EVR surface or
+* from a decoder's buffers to a frame pool buffer. It copies each plane row by
+* row so the source and destination can have different strides, and either can
+* be bottom up, rather than relying on IMF2DBuffer::ContiguousCopyFrom and a
+* contiguous source, which for a 2D source buffer is an extra copy of its own.
+*
+* Frames larger than the last level cache are copied with SSE2 non-temporal
+* (streaming) stores, which write straight to memory instead of reading each
+* destination line into the cache first and evicting the source and whatever
+* the next stage was using. Smaller frames are copied with memcpy so they're
+* still in the cache when the next stage reads them.
+*
+* License: Public Domain (no warranty, use at own risk)
+/******************************************************************************/
+
+#pragma once
+
+#include "ColourConverter.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FRAME_COPY_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#elif defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#endif
+
+#define FRAME_COPY_DEFAULT_CACHE_BYTES (8 * 1024 * 1024)  // Used if the last level cache size can't be found.
+#define FRAME_COPY_LINE_BYTES 64                          // Cache line size, the streaming stores write whole lines.
+
+enum class FrameCopyMode
+{
+  Auto,                                 // Streaming stores for frames larger than the last level cache.
+  Cached,                               // Always memcpy.
+  Streaming                             // Always streaming stores.
+};
+
+/* The size of the largest cache, usually the L3 shared by all the cores, found once. */
+inline size_t GetLastLevelCacheBytes()
+{
+  static const size_t cacheBytes = []() {
+    size_t bytes = 0;
+
+#if defined(_WIN32)
+    DWORD length = 0;
+    GetLogicalProcessorInformation(nullptr, &length);
+    std::vector<SYSTEM_LOGICAL_PROCESSOR_INFORMATION> processors(length / sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION));
+    if (!processors.empty() && GetLogicalProcessorInformation(processors.data(), &length)) {
+      BYTE level = 0;
+      for (const SYSTEM_LOGICAL_PROCESSOR_INFORMATION& processor : processors) {
+        if (processor.Relationship == RelationCache && processor.Cache.Type != CacheInstruction && processor.Cache.Level >= level) {
+          level = processor.Cache.Level;
+          bytes = processor.Cache.Size;
+        }
+      }
+    }
+#elif defined(_SC_LEVEL3_CACHE_SIZE)
+    long level3 = sysconf(_SC_LEVEL3_CACHE_SIZE), level2 = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    bytes = (level3 > 0) ? (size_t)level3 : (level2 > 0) ? (size_t)level2 : 0;
+#endif
+
+    return (bytes > 0) ? bytes : (size_t)FRAME_COPY_DEFAULT_CACHE_BYTES;
+  }();
+
+  return cacheBytes;
+}
+
+/* True if a copy of this many bytes should use streaming stores. */
+inline bool IsStreamingFrameCopy(size_t bytes, FrameCopyMode mode)
+{
+#if defined(FRAME_COPY_SSE2)
+  return mode == FrameCopyMode::Streaming || (mode == FrameCopyMode::Auto && bytes > GetLastLevelCacheBytes());
+#else
+  (void)bytes;
+  (void)mode;
+  return false;
+#endif
+}
+
+/**
+* Copies the rows of one plane.
+* @param[in] pSource: the top row of the source plane.
+* @param[in] sourceStride: the bytes from one source row to the next, negative
+*  if the source is bottom up.
+* @param[in] pDestination: the top row of the destination plane.
+* @param[in] destinationStride: the bytes from one destination row to the next.
+* @param[in] rowBytes: the bytes to copy from each row.
+* @param[in] rows: the rows to copy.
+* @param[in] isStreaming: true to use streaming stores, which bypass the cache.
+*/
+inline void CopyPlane(const uint8_t* pSource, int sourceStride, uint8_t* pDestination, int destinationStride,
+  size_t rowBytes, unsigned int rows, bool isStreaming)
+{
+  if (rows == 0 || rowBytes == 0) {
+    return;
+  }
+
+  // Rows with no padding and the same direction are one block, which starts at the bottom row if they're bottom up.
+  if (sourceStride == destinationStride && (size_t)abs(sourceStride) == rowBytes) {
+    ptrdiff_t bottomOffset = (sourceStride < 0) ? (ptrdiff_t)sourceStride * (rows - 1) : 0;
+    pSource += bottomOffset;
+    pDestination += bottomOffset;
+    rowBytes *= rows;
+    rows = 1;
+  }
+
+#if defined(FRAME_COPY_SSE2)
+  if (isStreaming) {
+    for (unsigned int y = 0; y < rows; y++) {
+      const uint8_t* pIn = pSource + (ptrdiff_t)y * sourceStride;
+      uint8_t* pOut = pDestination + (ptrdiff_t)y * destinationStride;
+
+      // Only whole cache lines are streamed, a partly written line costs a read of the line from memory anyway and
+      // flushes the write combining buffer early. The bytes before and after are copied normally.
+      size_t head = (FRAME_COPY_LINE_BYTES - ((uintptr_t)pOut & (FRAME_COPY_LINE_BYTES - 1))) & (FRAME_COPY_LINE_BYTES - 1);
+      head = (head < rowBytes) ? head : rowBytes;
+      memcpy(pOut, pIn, head);
+
+      size_t x = head;
+      for (; x + FRAME_COPY_LINE_BYTES <= rowBytes; x += FRAME_COPY_LINE_BYTES) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(pIn + x));
+        __m128i b = _mm_loadu_si128((const __m128i*)(pIn + x + 16));
+        __m128i c = _mm_loadu_si128((const __m128i*)(pIn + x + 32));
+        __m128i d = _mm_loadu_si128((const __m128i*)(pIn + x + 48));
+        _mm_stream_si128((__m128i*)(pOut + x), a);
+        _mm_stream_si128((__m128i*)(pOut + x + 16), b);
+        _mm_stream_si128((__m128i*)(pOut + x + 32), c);
+        _mm_stream_si128((__m128i*)(pOut + x + 48), d);
+      }
+      memcpy(pOut + x, pIn + x, rowBytes - x);
+    }
+
+    // Streaming stores aren't ordered with other stores, the fence makes them visible before the frame is handed on.
+    _mm_sfence();
+    return;
+  }
+#else
+  (void)isStreaming;
+#endif
+
+  for (unsigned int y = 0; y < rows; y++) {
+    memcpy(pDestination + (ptrdiff_t)y * destinationStride, pSource + (ptrdiff_t)y * sourceStride, rowBytes);
+  }
+}
+
+/**
+* Gets the bytes in each row and the number of rows of one plane of an image.
+* @param[in] image: the image.
+* @param[in] plane: the plane, 0 to 2.
+* @param[out] rowBytes: the bytes of pixels in each row, without padding.
+* @param[out] rows: the rows in the plane, 0 if the format doesn't have it.
+*/
+inline void GetColourPlaneSize(const ColourImage& image, int plane, size_t& rowBytes, unsigned int& rows)
+{
+  unsigned int chromaWidth = (image.Width + 1) / 2, chromaHeight = (image.Height + 1) / 2;
+  rowBytes = 0;
+  rows = 0;
+
+  switch (image.Format) {
+  case ColourFormat::RGB24:
+  case ColourFormat::RGB32:
+  case ColourFormat::BGRA:
+  case ColourFormat::YUY2:
+  case ColourFormat::UYVY:
+    if (plane == 0) {
+      rowBytes = GetColourImageSize(image.Format, image.Width, 1);
+      rows = image.Height;
+    }
+    break;
+  case ColourFormat::I420:
+    rowBytes = (plane == 0) ? image.Width : chromaWidth;
+    rows = (plane == 0) ? image.Height : chromaHeight;
+    break;
+  case ColourFormat::NV12:
+    if (plane < 2) {
+      rowBytes = (plane == 0) ? image.Width : (size_t)chromaWidth * 2;
+      rows = (plane == 0) ? image.Height : chromaHeight;
+    }
+    break;
+  }
+}
+
+/**
+* Copies an image to another of the same format and size. The strides can
+* differ, and either image can be bottom up, in which case the copy is flipped.
+* @param[in] source: the image to copy.
+* @param[in] destination: the image to copy to.
+* @param[in] mode: whether to use streaming stores.
+* @@Returns true if the image was copied, false if the formats or sizes differ.
+*/
+inline bool CopyColourImage(const ColourImage& source, const ColourImage& destination, FrameCopyMode mode = FrameCopyMode::Auto)
+{
+  if (source.Format != destination.Format || source.Width != destination.Width || source.Height != destination.Height) {
+    printf("Copying a %ux%u %s image to a %ux%u %s image isn't possible, the formats and sizes need to match.\n",
+      source.Width, source.Height, GetColourFormatName(source.Format),
+      destination.Width, destination.Height, GetColourFormatName(destination.Format));
+    return false;
+  }
+
+  bool isStreaming = IsStreamingFrameCopy(GetColourImageSize(source.Format, source.Width, source.Height), mode);
+
+  for (int plane = 0; plane < 3; plane++) {
+    size_t rowBytes = 0;
+    unsigned int rows = 0;
+    GetColourPlaneSize(source, plane, rowBytes, rows);
+
+    CopyPlane(source.pPlanes[plane], source.Strides[plane], destination.pPlanes[plane], destination.Strides[plane],
+      rowBytes, rows, isStreaming);
+  }
+
+  return true;
+}
@@ -0,0 +1,202 @@
+/******************************************************************************
+* Filename: FrameDeadlineScheduler.h
+*
+* Description:
+* This header file contains a scheduler that decides which captured frames to
+* encode when the encoder can't keep up with the capture rate. Without it the
+* frames that haven't been read queue up in the source reader, each one waits
+* longer than the last and once the source reader runs out of samples its
+* ReadSample call blocks.
+*
+* Each frame's age is how much longer it took to be read than the quickest
+* frame so far, which is the time it spent queued behind the frames before it.
+* The encode cost is a moving average of the time from deciding to encode a
+* frame until it has been sent. A frame is dropped as late if it has been
+* queued for more than a frame interval, so a newer frame is already waiting,
+* and it couldn't be sent within the latency budget. If the encode cost is
+* longer than the frame interval frames are decimated, only every Nth frame is
+* encoded, so the queue doesn't build up in the first place. Key frames are
+* never dropped.
+*
+* Sample times are in the 100ns units Media Foundation uses.
+*
+* License: Public Domain (no warranty, use at own risk)
+/******************************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <chrono>
+
+#define FRAME_SCHEDULER_LATENCY_BUDGET_MS 100       // Frames that can't be sent within this time of being captured are dropped.
+#define FRAME_SCHEDULER_COST_EWMA_WEIGHT 0.125      // Weight of the latest encode in the encode cost moving average.
+#define FRAME_SCHEDULER_HISTOGRAM_BUCKETS 8
+#define FRAME_SCHEDULER_TICKS_PER_MS 10000          // Media Foundation sample times are in 100ns units.
+
+/* Upper bounds of the capture to send latency histogram buckets, the last bucket has no upper bound. */
+static const double FRAME_SCHEDULER_HISTOGRAM_BOUNDS_MS[FRAME_SCHEDULER_HISTOGRAM_BUCKETS - 1] = { 10, 20, 40, 80, 160, 320, 640 };
+
+struct FrameDeadlineStats
+{
+  size_t Captured = 0;
+  size_t Encoded = 0;
+  size_t DroppedLate = 0;               // Frames that were queued for too long to be sent within the latency budget.
+  size_t DroppedDecimated = 0;          // Frames skipped because the encode cost is longer than the frame interval.
+  size_t Sent = 0;
+  double EncodeCostMs = 0;              // Moving average from deciding to encode a frame until it was sent.
+  unsigned int DecimationFactor = 1;    // 1 in every this many frames is encoded.
+  double MeanLatencyMs = 0;             // Capture to send.
+  double MaxLatencyMs = 0;
+  size_t LatencyHistogram[FRAME_SCHEDULER_HISTOGRAM_BUCKETS] = { 0 };
+};
+
+class FrameDeadlineScheduler
+{
+public:
+  /**
+  * @param[in] frameRate: the capture frame rate.
+  * @param[in] latencyBudgetMs: the maximum time from a frame being captured to
+  *  it being sent, frames that can't make it are dropped.
+  */
+  FrameDeadlineScheduler(unsigned int frameRate, unsigned int latencyBudgetMs = FRAME_SCHEDULER_LATENCY_BUDGET_MS) :
+    _frameIntervalMs(1000.0 / frameRate),
+    _latencyBudgetMs(latencyBudgetMs)
+  { }
+
+  /**
+  * Sets the rate frames are offered to the scheduler at, for when some of the
+  * captured frames are decimated before they get to it.
+  * @param[in] frameRate: the new frame rate.
+  */
+  void SetFrameRate(unsigned int frameRate)
+  {
+    _frameIntervalMs = 1000.0 / frameRate;
+  }
+
+  /**
+  * Decides whether to encode a captured frame. Call as soon as the frame has been
+  * read and, if it's to be encoded, follow with OnFrameEncoded once it's been sent.
+  * @param[in] sampleTime: the capture time of the frame in 100ns units.
+  * @param[in] isKeyFrame: true if the frame is going to be encoded as a key frame.
+  * @@Returns true to encode the frame, false to drop it.
+  */
+  bool ShouldEncode(int64_t sampleTime, bool isKeyFrame)
+  {
+    int64_t now = GetTicks();
+    int64_t offset = now - sampleTime;
+    if (_stats.Captured == 0 || offset < _minOffset) {
+      _minOffset = offset;
+    }
+    _stats.Captured++;
+
+    double ageMs = (double)(offset - _minOffset) / FRAME_SCHEDULER_TICKS_PER_MS;
+    _framesSinceEncode++;
+
+    if (!isKeyFrame) {
+      if (ageMs > _frameIntervalMs && ageMs + _stats.EncodeCostMs > _latencyBudgetMs) {
+        _stats.DroppedLate++;
+        return false;
+      }
+      else if (_framesSinceEncode < _stats.DecimationFactor) {
+        _stats.DroppedDecimated++;
+        return false;
+      }
+    }
+
+    _framesSinceEncode = 0;
+    _encodeStart = now;
+    _stats.Encoded++;
+    return true;
+  }
+
+  /**
+  * Updates the encode cost once a frame that ShouldEncode accepted has been
+  * encoded and sent.
+  */
+  void OnFrameEncoded()
+  {
+    double costMs = (double)(GetTicks() - _encodeStart) / FRAME_SCHEDULER_TICKS_PER_MS;
+
+    if (_stats.Encoded == 1) {
+      _stats.EncodeCostMs = costMs;
+    }
+    else {
+      _stats.EncodeCostMs += FRAME_SCHEDULER_COST_EWMA_WEIGHT * (costMs - _stats.EncodeCostMs);
+    }
+
+    _stats.DecimationFactor = 1;
+    while (_stats.DecimationFactor * _frameIntervalMs < _stats.EncodeCostMs) {
+      _stats.DecimationFactor++;
+    }
+  }
+
+  /**
+  * Records the capture to send latency of an encoded frame.
+  * @param[in] sampleTime: the capture time of the frame in 100ns units.
+  */
+  void OnFrameSent(int64_t sampleTime)
+  {
+    double latencyMs = (double)(GetTicks() - _minOffset - sampleTime) / FRAME_SCHEDULER_TICKS_PER_MS;
+    if (latencyMs < 0) {
+      latencyMs = 0;
+    }
+
+    _stats.Sent++;
+    _totalLatencyMs += latencyMs;
+    _stats.MeanLatencyMs = _totalLatencyMs / _stats.Sent;
+    if (latencyMs > _stats.MaxLatencyMs) {
+      _stats.MaxLatencyMs = latencyMs;
+    }
+
+    int bucket = 0;
+    while (bucket < FRAME_SCHEDULER_HISTOGRAM_BUCKETS - 1 && latencyMs > FRAME_SCHEDULER_HISTOGRAM_BOUNDS_MS[bucket]) {
+      bucket++;
+    }
+    _stats.LatencyHistogram[bucket]++;
+  }
+
+  const FrameDeadlineStats& GetStats() const
+  {
+    return _stats;
+  }
+
+private:
+
+  /* The steady clock in sample time units. */
+  static int64_t GetTicks()
+  {
+    return std::chrono::duration_cast<std::chrono::duration<int64_t, std::ratio<1, 10000000>>>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  double _frameIntervalMs;
+  double _latencyBudgetMs;
+  int64_t _minOffset = 0;               // The smallest difference seen between the clock and a sample time, taken as no queueing.
+  int64_t _encodeStart = 0;
+  unsigned int _framesSinceEncode = 0;
+  double _totalLatencyMs = 0;
+  FrameDeadlineStats _stats;
+};
+
+/**
+* Prints the drop counters and the capture to send latency histogram.
+* @param[in] stats: the scheduler's stats.
+*/
+inline void PrintFrameDeadlineStats(const FrameDeadlineStats& stats)
+{
+  printf("Frames captured %zu, encoded %zu, dropped late %zu, dropped decimated %zu, encode cost %.1fms, decimation 1/%u.\n",
+    stats.Captured, stats.Encoded, stats.DroppedLate, stats.DroppedDecimated, stats.EncodeCostMs, stats.DecimationFactor);
+  printf("Capture to send latency mean %.1fms, max %.1fms:", stats.MeanLatencyMs, stats.MaxLatencyMs);
+
+  for (int i = 0; i < FRAME_SCHEDULER_HISTOGRAM_BUCKETS; i++) {
+    if (i < FRAME_SCHEDULER_HISTOGRAM_BUCKETS - 1) {
+      printf(" <=%.0fms %zu", FRAME_SCHEDULER_HISTOGRAM_BOUNDS_MS[i], stats.LatencyHistogram[i]);
+    }
+    else {
+      printf(" >%.0fms %zu", FRAME_SCHEDULER_HISTOGRAM_BOUNDS_MS[i - 1], stats.LatencyHistogram[i]);
+    }
+  }
+  printf("\n");
+}
@@ -0,0 +1,487 @@
+/******************************************************************************
+* Filename: FrameRotator.h
+*
+* Description:
+* This header file contains rotate, mirror and flip kernels for I420, NV12 and
+* RGB32/BGRA frames, for cameras that are mounted sideways or upside down, a
+* mirrored self view and bottom up bitmaps. All eight orientations of a frame
+* are covered: the four rotations, each of them mirrored.
+*
+* The four orientations that swap the width and height are one transpose with
+* the source or destination rows walked bottom up. The transpose is done in
+* tiles with rows one cache line long so the destination lines are finished
+* while they're still in the cache, and within a tile in 8x8 blocks of bytes
+* or 16 bit NV12 chroma pairs, or 4x4 blocks of RGB32 pixels, with SSE2 on x64
+* builds and x86 builds with /arch:SSE2. Mirroring reverses each row 16 bytes
+* at a time and flipping is a copy of the rows in reverse order. The plain C++
+* version gives exactly the same output.
+*
+* ConvertAndRotate does a colour conversion as well, e.g. a webcam's YUY2 to
+* I420 for an encoder, by converting a strip of rows at a time into a buffer
+* that stays in the cache and rotating the strip into place, so the rotation
+* doesn't add a pass over the whole frame.
+*
+* License: Public Domain (no warranty, use at own risk)
+/******************************************************************************/
+
+#pragma once
+
+#include "ColourConverter.h"
+#include "FrameCopy.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FRAME_ROTATOR_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#define FRAME_ROTATOR_TILE_BYTES 64             // The bytes in each row of a transpose tile, one cache line.
+#define FRAME_ROTATOR_STRIP_BYTES (256 * 1024)  // The converted rows ConvertAndRotate keeps in the cache, about one core's L2.
+#define FRAME_ROTATOR_STRIP_ALIGNMENT 16        // Strips are a multiple of this many rows.
+
+enum class FrameOrientation
+{
+  Identity,
+  Rotate90,                             // Clockwise.
+  Rotate180,
+  Rotate270,                            // Clockwise, i.e. 90 anticlockwise.
+  Mirror,                               // Left to right, e.g. a self view.
+  Flip,                                 // Top to bottom, e.g. a bottom up bitmap.
+  Transpose,                            // Rows become columns, a 90 rotation and a mirror.
+  Transverse                            // A 270 rotation and a mirror.
+};
+
+inline const char* GetFrameOrientationName(FrameOrientation orientation)
+{
+  switch (orientation) {
+  case FrameOrientation::Identity: return "identity";
+  case FrameOrientation::Rotate90: return "rotate90";
+  case FrameOrientation::Rotate180: return "rotate180";
+  case FrameOrientation::Rotate270: return "rotate270";
+  case FrameOrientation::Mirror: return "mirror";
+  case FrameOrientation::Flip: return "flip";
+  case FrameOrientation::Transpose: return "transpose";
+  case FrameOrientation::Transverse: return "transverse";
+  default: return "unknown";
+  }
+}
+
+/* True if the orientation swaps the frame's width and height. */
+inline constexpr bool IsFrameOrientationTransposed(FrameOrientation orientation)
+{
+  return orientation == FrameOrientation::Rotate90 || orientation == FrameOrientation::Rotate270 ||
+    orientation == FrameOrientation::Transpose || orientation == FrameOrientation::Transverse;
+}
+
+class FrameRotator
+{
+public:
+  /**
+  * @param[in] useSimd: false to only use the plain C++ version, for comparing
+  *  against the vectorised one.
+  */
+  FrameRotator(bool useSimd = true) :
+    _useSimd(useSimd)
+  { }
+
+  /**
+  * Rotates, mirrors or flips an image into another of the same format.
+  * @param[in] source: the image to rotate, I420, NV12, RGB32 or BGRA.
+  * @param[in] destination: the image to write to, the width and height swapped
+  *  from the source's if the orientation transposes it. The images can't
+  *  overlap.
+  * @param[in] orientation: how to turn the source.
+  * @@Returns true if the image was rotated, false if the images don't match.
+  */
+  bool Rotate(const ColourImage& source, const ColourImage& destination, FrameOrientation orientation)
+  {
+    if (source.Format != destination.Format) {
+      printf("Rotating from %s to %s needs ConvertAndRotate, the formats differ.\n",
+        GetColourFormatName(source.Format), GetColourFormatName(destination.Format));
+      return false;
+    }
+    else if (!IsRotationSupported(source, destination, orientation)) {
+      return false;
+    }
+
+    RotatePlanes(source, destination, orientation);
+    return true;
+  }
+
+  /**
+  * Converts an image to another pixel format and rotates it in the same pass.
+  * @param[in] converter: the converter to convert with.
+  * @param[in] source: the image to convert, any format the converter takes.
+  * @param[in] destination: the image to write to, I420, NV12, RGB32 or BGRA,
+  *  the width and height swapped from the source's if the orientation
+  *  transposes it.
+  * @param[in] orientation: how to turn the source.
+  * @@Returns true if the image was converted and rotated.
+  */
+  bool ConvertAndRotate(ColourConverter& converter, const ColourImage& source, const ColourImage& destination, FrameOrientation orientation)
+  {
+    if (orientation == FrameOrientation::Identity) {
+      return converter.Convert(source, destination);
+    }
+    else if (source.Format == destination.Format) {
+      return Rotate(source, destination, orientation);
+    }
+    else if (!IsRotationSupported(source, destination, orientation)) {
+      return false;
+    }
+
+    unsigned int width = source.Width, height = source.Height;
+    unsigned int stripRows = (unsigned int)(FRAME_ROTATOR_STRIP_BYTES / (GetColourImageSize(destination.Format, width, 2) / 2));
+    stripRows = stripRows / FRAME_ROTATOR_STRIP_ALIGNMENT * FRAME_ROTATOR_STRIP_ALIGNMENT;
+    stripRows = (stripRows > 0) ? stripRows : FRAME_ROTATOR_STRIP_ALIGNMENT;
+
+    _strip.resize(GetColourImageSize(destination.Format, width, stripRows));
+
+    for (unsigned int top = 0; top < height; top += stripRows) {
+      unsigned int rows = (stripRows < height - top) ? stripRows : height - top;
+      ColourImage strip = GetColourImage(destination.Format, _strip.data(), width, rows);
+
+      if (!converter.Convert(GetColourImageRows(source, top, rows), strip)) {
+        return false;
+      }
+      RotatePlanes(strip, GetStripDestination(destination, orientation, top, rows, height), orientation);
+    }
+
+    return true;
+  }
+
+  /* The widest instructions the rotator was built with. */
+  static const char* GetSimdName()
+  {
+#if defined(FRAME_ROTATOR_SSE2)
+    return "SSE2";
+#else
+    return "none";
+#endif
+  }
+
+private:
+
+  /* The bytes in each sample of a plane, 0 for the formats the rotator doesn't take. */
+  static unsigned int GetElementBytes(ColourFormat format, int plane)
+  {
+    switch (format) {
+    case ColourFormat::I420: return 1;
+    case ColourFormat::NV12: return (plane == 0) ? 1 : 2;
+    case ColourFormat::RGB32:
+    case ColourFormat::BGRA: return 4;
+    default: return 0;
+    }
+  }
+
+  static bool IsRotationSupported(const ColourImage& source, const ColourImage& destination, FrameOrientation orientation)
+  {
+    bool isTransposed = IsFrameOrientationTransposed(orientation);
+    unsigned int width = isTransposed ? source.Height : source.Width;
+    unsigned int height = isTransposed ? source.Width : source.Height;
+    bool is420 = destination.Format == ColourFormat::I420 || destination.Format == ColourFormat::NV12;
+
+    if (GetElementBytes(destination.Format, 0) == 0) {
+      printf("Rotating to %s isn't supported, the destination needs to be I420, NV12, RGB32 or BGRA.\n", GetColourFormatName(destination.Format));
+      return false;
+    }
+    else if (source.Width == 0 || source.Height == 0 || destination.Width != width || destination.Height != height) {
+      printf("A %s of a %ux%u image needs a %ux%u destination, not %ux%u.\n", GetFrameOrientationName(orientation),
+        source.Width, source.Height, width, height, destination.Width, destination.Height);
+      return false;
+    }
+    else if (is420 && ((source.Width % 2) != 0 || (source.Height % 2) != 0)) {
+      printf("Rotating %s needs an even width and height, not %ux%u.\n", GetColourFormatName(destination.Format), source.Width, source.Height);
+      return false;
+    }
+
+    return true;
+  }
+
+  /**
+  * Gets the part of the destination a strip of the source's rows goes to, a
+  * band of rows or, if the orientation transposes the image, of columns.
+  * @param[in] destination: the whole destination image.
+  * @param[in] orientation: how the source is turned.
+  * @param[in] top: the first source row in the strip, even.
+  * @param[in] rows: the source rows in the strip, even unless it's the last.
+  * @param[in] sourceHeight: the rows in the whole source.
+  * @@Returns The strip's destination.
+  */
+  static ColourImage GetStripDestination(const ColourImage& destination, FrameOrientation orientation, unsigned int top, unsigned int rows,
+    unsigned int sourceHeight)
+  {
+    bool isBottomUp = orientation == FrameOrientation::Rotate90 || orientation == FrameOrientation::Rotate180 ||
+      orientation == FrameOrientation::Flip || orientation == FrameOrientation::Transverse;
+    unsigned int offset = isBottomUp ? sourceHeight - top - rows : top;
+
+    if (!IsFrameOrientationTransposed(orientation)) {
+      return GetColourImageRows(destination, offset, rows);
+    }
+
+    ColourImage columns = destination;
+    bool isChromaHalfWidth = destination.Format == ColourFormat::I420 || destination.Format == ColourFormat::NV12;
+
+    columns.Width = rows;
+    for (int plane = 0; plane < 3 && destination.pPlanes[plane] != nullptr; plane++) {
+      unsigned int planeOffset = (plane > 0 && isChromaHalfWidth) ? offset / 2 : offset;
+      columns.pPlanes[plane] = destination.pPlanes[plane] + (size_t)planeOffset * GetElementBytes(destination.Format, plane);
+    }
+    return columns;
+  }
+
+  void RotatePlanes(const ColourImage& source, const ColourImage& destination, FrameOrientation orientation)
+  {
+    for (int plane = 0; plane < 3; plane++) {
+      size_t rowBytes = 0;
+      unsigned int rows = 0;
+      GetColourPlaneSize(source, plane, rowBytes, rows);
+
+      if (rows > 0) {
+        unsigned int elementBytes = GetElementBytes(source.Format, plane);
+        RotatePlane(source.pPlanes[plane], source.Strides[plane], destination.pPlanes[plane], destination.Strides[plane],
+          (unsigned int)(rowBytes / elementBytes), rows, elementBytes, orientation);
+      }
+    }
+  }
+
+  /**
+  * Turns one plane. The transposing orientations walk the source or the
+  * destination rows bottom up with a negative stride, e.g. a 90 rotation
+  * clockwise is the transpose of the source flipped top to bottom.
+  * @param[in] pSource: the top row of the source plane.
+  * @param[in] sourceStride: the bytes from one source row to the next.
+  * @param[in] pDestination: the top row of the destination plane.
+  * @param[in] destinationStride: the bytes from one destination row to the next.
+  * @param[in] width: the samples in each source row.
+  * @param[in] height: the source rows.
+  * @param[in] elementBytes: the bytes in each sample, 1, 2 or 4.
+  * @param[in] orientation: how to turn the plane.
+  */
+  void RotatePlane(const uint8_t* pSource, int sourceStride, uint8_t* pDestination, int destinationStride,
+    unsigned int width, unsigned int height, unsigned int elementBytes, FrameOrientation orientation)
+  {
+    const uint8_t* pSourceBottom = pSource + (ptrdiff_t)sourceStride * (height - 1);
+    uint8_t* pDestinationBottom = pDestination + (ptrdiff_t)destinationStride *
+      ((IsFrameOrientationTransposed(orientation) ? width : height) - 1);
+
+    switch (orientation) {
+    case FrameOrientation::Identity:
+      CopyPlane(pSource, sourceStride, pDestination, destinationStride, (size_t)width * elementBytes, height, false);
+      break;
+    case FrameOrientation::Flip:
+      CopyPlane(pSource, sourceStride, pDestinationBottom, -destinationStride, (size_t)width * elementBytes, height, false);
+      break;
+    case FrameOrientation::Mirror:
+      MirrorRows(pSource, sourceStride, pDestination, destinationStride, width, height, elementBytes);
+      break;
+    case FrameOrientation::Rotate180:
+      MirrorRows(pSource, sourceStride, pDestinationBottom, -destinationStride, width, height, elementBytes);
+      break;
+    case FrameOrientation::Transpose:
+      Transpose(pSource, sourceStride, pDestination, destinationStride, width, height, elementBytes);
+      break;
+    case FrameOrientation::Rotate90:
+      Transpose(pSourceBottom, -sourceStride, pDestination, destinationStride, width, height, elementBytes);
+      break;
+    case FrameOrientation::Rotate270:
+      Transpose(pSource, sourceStride, pDestinationBottom, -destinationStride, width, height, elementBytes);
+      break;
+    case FrameOrientation::Transverse:
+      Transpose(pSourceBottom, -sourceStride, pDestinationBottom, -destinationStride, width, height, elementBytes);
+      break;
+    }
+  }
+
+  void MirrorRows(const uint8_t* pSource, int sourceStride, uint8_t* pDestination, int destinationStride,
+    unsigned int width, unsigned int height, unsigned int elementBytes)
+  {
+    switch (elementBytes) {
+    case 1: MirrorRows<1>(pSource, sourceStride, pDestination, destinationStride, width, height); break;
+    case 2: MirrorRows<2>(pSource, sourceStride, pDestination, destinationStride, width, height); break;
+    default: MirrorRows<4>(pSource, sourceStride, pDestination, destinationStride, width, height); break;
+    }
+  }
+
+  template<unsigned int ElementBytes>
+  void MirrorRows(const uint8_t* pSource, int sourceStride, uint8_t* pDestination, int destinationStride,
+    unsigned int width, unsigned int height) const
+  {
+    for (unsigned int y = 0; y < height; y++) {
+      const uint8_t* pIn = pSource + (ptrdiff_t)y * sourceStride;
+      uint8_t* pOut = pDestination + (ptrdiff_t)y * destinationStride;
+      unsigned int x = 0;
+
+#if defined(FRAME_ROTATOR_SSE2)
+      if (_useSimd) {
+        const unsigned int vectorSamples = 16 / ElementBytes;
+        for (; x + vectorSamples <= width; x += vectorSamples) {
+          __m128i samples = _mm_loadu_si128((const __m128i*)(pIn + (size_t)x * ElementBytes));
+          _mm_storeu_si128((__m128i*)(pOut + (size_t)(width - x - vectorSamples) * ElementBytes), ReverseSamples<ElementBytes>(samples));
+        }
+      }
+#endif
+
+      for (; x < width; x++) {
+        memcpy(pOut + (size_t)(width - 1 - x) * ElementBytes, pIn + (size_t)x * ElementBytes, ElementBytes);
+      }
+    }
+  }
+
+  void Transpose(const uint8_t* pSource, int sourceStride, uint8_t* pDestination, int destinationStride,
+    unsigned int width, unsigned int height, unsigned int elementBytes)
+  {
+    switch (elementBytes) {
+    case 1: Transpose<1>(pSource, sourceStride, pDestination, destinationStride, width, height); break;
+    case 2: Transpose<2>(pSource, sourceStride, pDestination, destinationStride, width, height); break;
+    default: Transpose<4>(pSource, sourceStride, pDestination, destinationStride, width, height); break;
+    }
+  }
+
+  /* Writes source column x to destination row x, a tile at a time, going down the source so each destination line is finished in turn. */
+  template<unsigned int ElementBytes>
+  void Transpose(const uint8_t* pSource, int sourceStride, uint8_t* pDestination, int destinationStride,
+    unsigned int width, unsigned int height) const
+  {
+    const unsigned int tile = FRAME_ROTATOR_TILE_BYTES / ElementBytes;
+
+    for (unsigned int x0 = 0; x0 < width; x0 += tile) {
+      unsigned int x1 = (x0 + tile < width) ? x0 + tile : width;
+
+      for (unsigned int y0 = 0; y0 < height; y0 += tile) {
+        unsigned int y1 = (y0 + tile < height) ? y0 + tile : height;
+        unsigned int blockX1 = x0, blockY1 = y0;
+
+#if defined(FRAME_ROTATOR_SSE2)
+        if (_useSimd) {
+          const unsigned int block = (ElementBytes == 4) ? 4 : 8;
+          blockX1 = x0 + (x1 - x0) / block * block;
+          blockY1 = y0 + (y1 - y0) / block * block;
+
+          for (unsigned int x = x0; x < blockX1; x += block) {
+            for (unsigned int y = y0; y < blockY1; y += block) {
+              const uint8_t* pIn = pSource + (ptrdiff_t)y * sourceStride + (size_t)x * ElementBytes;
+              uint8_t* pOut = pDestination + (ptrdiff_t)x * destinationStride + (size_t)y * ElementBytes;
+
+              if (ElementBytes == 1) {
+                TransposeBlock8x8(pIn, sourceStride, pOut, destinationStride);
+              }
+              else if (ElementBytes == 2) {
+                TransposeBlock8x8Pairs(pIn, sourceStride, pOut, destinationStride);
+              }
+              else {
+                TransposeBlock4x4(pIn, sourceStride, pOut, destinationStride);
+              }
+            }
+          }
+        }
+#endif
+
+        // The columns and rows left over from the blocks, or the whole tile for the plain C++ version.
+        TransposeSamples<ElementBytes>(pSource, sourceStride, pDestination, destinationStride, x0, blockX1, blockY1, y1);
+        TransposeSamples<ElementBytes>(pSource, sourceStride, pDestination, destinationStride, blockX1, x1, y0, y1);
+      }
+    }
+  }
+
+  template<unsigned int ElementBytes>
+  static void TransposeSamples(const uint8_t* pSource, int sourceStride, uint8_t* pDestination, int destinationStride,
+    unsigned int x0, unsigned int x1, unsigned int y0, unsigned int y1)
+  {
+    for (unsigned int x = x0; x < x1; x++) {
+      const uint8_t* pIn = pSource + (size_t)x * ElementBytes;
+      uint8_t* pOut = pDestination + (ptrdiff_t)x * destinationStride;
+      for (unsigned int y = y0; y < y1; y++) {
+        memcpy(pOut + (size_t)y * ElementBytes, pIn + (ptrdiff_t)y * sourceStride, ElementBytes);
+      }
+    }
+  }
+
+#if defined(FRAME_ROTATOR_SSE2)
+
+  /* Reverses the order of the samples in a vector. */
+  template<unsigned int ElementBytes>
+  static __m128i ReverseSamples(__m128i samples)
+  {
+    samples = _mm_shuffle_epi32(samples, _MM_SHUFFLE(0, 1, 2, 3));
+    if (ElementBytes <= 2) {
+      samples = _mm_shufflelo_epi16(samples, _MM_SHUFFLE(2, 3, 0, 1));
+      samples = _mm_shufflehi_epi16(samples, _MM_SHUFFLE(2, 3, 0, 1));
+    }
+    if (ElementBytes == 1) {
+      samples = _mm_or_si128(_mm_slli_epi16(samples, 8), _mm_srli_epi16(samples, 8));
+    }
+    return samples;
+  }
+
+  /* Transposes an 8x8 block of bytes. */
+  static void TransposeBlock8x8(const uint8_t* pSource, int sourceStride, uint8_t* pDestination, int destinationStride)
+  {
+    __m128i rows[8];
+    for (int i = 0; i < 8; i++) {
+      rows[i] = _mm_loadl_epi64((const __m128i*)(pSource + (ptrdiff_t)i * sourceStride));
+    }
+
+    // Interleaving bytes, then pairs, then fours of the rows leaves two columns in each vector.
+    __m128i a0 = _mm_unpacklo_epi8(rows[0], rows[1]), a1 = _mm_unpacklo_epi8(rows[2], rows[3]);
+    __m128i a2 = _mm_unpacklo_epi8(rows[4], rows[5]), a3 = _mm_unpacklo_epi8(rows[6], rows[7]);
+    __m128i b0 = _mm_unpacklo_epi16(a0, a1), b1 = _mm_unpackhi_epi16(a0, a1);
+    __m128i b2 = _mm_unpacklo_epi16(a2, a3), b3 = _mm_unpackhi_epi16(a2, a3);
+    __m128i columns[4] = { _mm_unpacklo_epi32(b0, b2), _mm_unpackhi_epi32(b0, b2), _mm_unpacklo_epi32(b1, b3), _mm_unpackhi_epi32(b1, b3) };
+
+    for (int i = 0; i < 4; i++) {
+      _mm_storel_epi64((__m128i*)(pDestination + (ptrdiff_t)(i * 2) * destinationStride), columns[i]);
+      _mm_storel_epi64((__m128i*)(pDestination + (ptrdiff_t)(i * 2 + 1) * destinationStride), _mm_unpackhi_epi64(columns[i], columns[i]));
+    }
+  }
+
+  /* Transposes an 8x8 block of 16 bit samples, NV12 chroma pairs. */
+  static void TransposeBlock8x8Pairs(const uint8_t* pSource, int sourceStride, uint8_t* pDestination, int destinationStride)
+  {
+    __m128i rows[8];
+    for (int i = 0; i < 8; i++) {
+      rows[i] = _mm_loadu_si128((const __m128i*)(pSource + (ptrdiff_t)i * sourceStride));
+    }
+
+    __m128i a0 = _mm_unpacklo_epi16(rows[0], rows[1]), a1 = _mm_unpackhi_epi16(rows[0], rows[1]);
+    __m128i a2 = _mm_unpacklo_epi16(rows[2], rows[3]), a3 = _mm_unpackhi_epi16(rows[2], rows[3]);
+    __m128i a4 = _mm_unpacklo_epi16(rows[4], rows[5]), a5 = _mm_unpackhi_epi16(rows[4], rows[5]);
+    __m128i a6 = _mm_unpacklo_epi16(rows[6], rows[7]), a7 = _mm_unpackhi_epi16(rows[6], rows[7]);
+    __m128i b[8] = {
+      _mm_unpacklo_epi32(a0, a2), _mm_unpackhi_epi32(a0, a2), _mm_unpacklo_epi32(a1, a3), _mm_unpackhi_epi32(a1, a3),
+      _mm_unpacklo_epi32(a4, a6), _mm_unpackhi_epi32(a4, a6), _mm_unpacklo_epi32(a5, a7), _mm_unpackhi_epi32(a5, a7) };
+
+    for (int i = 0; i < 4; i++) {
+      _mm_storeu_si128((__m128i*)(pDestination + (ptrdiff_t)(i * 2) * destinationStride), _mm_unpacklo_epi64(b[i], b[i + 4]));
+      _mm_storeu_si128((__m128i*)(pDestination + (ptrdiff_t)(i * 2 + 1) * destinationStride), _mm_unpackhi_epi64(b[i], b[i + 4]));
+    }
+  }
+
+  /* Transposes a 4x4 block of 32 bit pixels. */
+  static void TransposeBlock4x4(const uint8_t* pSource, int sourceStride, uint8_t* pDestination, int destinationStride)
+  {
+    __m128i r0 = _mm_loadu_si128((const __m128i*)pSource);
+    __m128i r1 = _mm_loadu_si128((const __m128i*)(pSource + sourceStride));
+    __m128i r2 = _mm_loadu_si128((const __m128i*)(pSource + (ptrdiff_t)sourceStride * 2));
+    __m128i r3 = _mm_loadu_si128((const __m128i*)(pSource + (ptrdiff_t)sourceStride * 3));
+
+    __m128i a0 = _mm_unpacklo_epi32(r0, r1), a1 = _mm_unpackhi_epi32(r0, r1);
+    __m128i a2 = _mm_unpacklo_epi32(r2, r3), a3 = _mm_unpackhi_epi32(r2, r3);
+
+    _mm_storeu_si128((__m128i*)pDestination, _mm_unpacklo_epi64(a0, a2));
+    _mm_storeu_si128((__m128i*)(pDestination + destinationStride), _mm_unpackhi_epi64(a0, a2));
+    _mm_storeu_si128((__m128i*)(pDestination + (ptrdiff_t)destinationStride * 2), _mm_unpacklo_epi64(a1, a3));
+    _mm_storeu_si128((__m128i*)(pDestination + (ptrdiff_t)destinationStride * 3), _mm_unpackhi_epi64(a1, a3));
+  }
+
+#endif
+
+  bool _useSimd;
+  std::vector<uint8_t> _strip;          // The converted rows for ConvertAndRotate.
+};
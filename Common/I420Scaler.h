@@ -0,0 +1,120 @@
+/******************************************************************************
+* Filename: I420Scaler.h
+*
+* Description:
+* This header file contains a software scaler for I420 frames, used to step the
+* capture resolution down without restarting the capture device. Each output
+* pixel is the average of the source pixels it covers, a box filter, which is
+* cheap and doesn't alias when scaling down by the integer and 3/4 factors the
+* samples use. Scaling up isn't needed, the full size frame is used as is.
+*
+* License: Public Domain (no warranty, use at own risk)
+/******************************************************************************/
+
+#pragma once
+
+#include <limits.h>
+#include <stdint.h>
+#include <string.h>
+
+/**
+* Gets the number of bytes in an I420 frame with no padding between rows.
+* @param[in] width: the frame width.
+* @param[in] height: the frame height.
+* @@Returns The size of the Y plane plus the two quarter size chroma planes.
+*/
+inline size_t GetI420FrameSize(unsigned int width, unsigned int height)
+{
+  return (size_t)width * height + 2 * (size_t)((width + 1) / 2) * ((height + 1) / 2);
+}
+
+/**
+* Scales one plane down with a box filter.
+* @param[in] pSrc: the source plane.
+* @param[in] srcStride: the bytes between the source rows.
+* @param[in] srcWidth: the source plane width.
+* @param[in] srcHeight: the source plane height.
+* @param[out] pDst: the destination plane.
+* @param[in] dstStride: the bytes between the destination rows.
+* @param[in] dstWidth: the destination plane width, no more than the source width.
+* @param[in] dstHeight: the destination plane height, no more than the source height.
+* @param[in] firstRow: the first destination row to scale, with endRow for
+*  splitting the plane into bands of rows.
+* @param[in] endRow: the destination row after the last to scale.
+*/
+inline void ScaleI420Plane(const uint8_t* pSrc, int srcStride, unsigned int srcWidth, unsigned int srcHeight,
+  uint8_t* pDst, int dstStride, unsigned int dstWidth, unsigned int dstHeight, unsigned int firstRow = 0, unsigned int endRow = UINT_MAX)
+{
+  if (endRow > dstHeight) {
+    endRow = dstHeight;
+  }
+
+  if (srcWidth == dstWidth && srcHeight == dstHeight) {
+    for (unsigned int y = firstRow; y < endRow; y++) {
+      memcpy(pDst + (size_t)y * dstStride, pSrc + (size_t)y * srcStride, dstWidth);
+    }
+    return;
+  }
+
+  for (unsigned int y = firstRow; y < endRow; y++) {
+    unsigned int top = y * srcHeight / dstHeight;
+    unsigned int bottom = (y + 1) * srcHeight / dstHeight;
+    if (bottom <= top) {
+      bottom = top + 1;
+    }
+
+    uint8_t* pDstRow = pDst + (size_t)y * dstStride;
+
+    for (unsigned int x = 0; x < dstWidth; x++) {
+      unsigned int left = x * srcWidth / dstWidth;
+      unsigned int right = (x + 1) * srcWidth / dstWidth;
+      if (right <= left) {
+        right = left + 1;
+      }
+
+      unsigned int sum = 0;
+      for (unsigned int sy = top; sy < bottom; sy++) {
+        const uint8_t* pSrcRow = pSrc + (size_t)sy * srcStride;
+        for (unsigned int sx = left; sx < right; sx++) {
+          sum += pSrcRow[sx];
+        }
+      }
+
+      unsigned int count = (bottom - top) * (right - left);
+      pDstRow[x] = (uint8_t)((sum + count / 2) / count);
+    }
+  }
+}
+
+/**
+* Scales an I420 frame with no padding between rows down to a smaller size.
+* @param[in] pSrc: the source frame.
+* @param[in] srcWidth: the source frame width.
+* @param[in] srcHeight: the source frame height.
+* @param[out] pDst: the destination frame, needs to be GetI420FrameSize(dstWidth, dstHeight) bytes.
+* @param[in] dstWidth: the destination frame width.
+* @param[in] dstHeight: the destination frame height.
+* @param[in] firstRow: the first destination luma row to scale, even so the
+*  chroma rows under it aren't split, with endRow for splitting the frame into
+*  bands of rows, e.g. with a FrameBandExecutor.
+* @param[in] endRow: the destination luma row after the last to scale.
+*/
+inline void ScaleI420(const uint8_t* pSrc, unsigned int srcWidth, unsigned int srcHeight,
+  uint8_t* pDst, unsigned int dstWidth, unsigned int dstHeight, unsigned int firstRow = 0, unsigned int endRow = UINT_MAX)
+{
+  unsigned int srcChromaWidth = (srcWidth + 1) / 2, srcChromaHeight = (srcHeight + 1) / 2;
+  unsigned int dstChromaWidth = (dstWidth + 1) / 2, dstChromaHeight = (dstHeight + 1) / 2;
+
+  const uint8_t* pSrcU = pSrc + (size_t)srcWidth * srcHeight;
+  const uint8_t* pSrcV = pSrcU + (size_t)srcChromaWidth * srcChromaHeight;
+  uint8_t* pDstU = pDst + (size_t)dstWidth * dstHeight;
+  uint8_t* pDstV = pDstU + (size_t)dstChromaWidth * dstChromaHeight;
+
+  unsigned int firstChromaRow = firstRow / 2, endChromaRow = (endRow == UINT_MAX) ? UINT_MAX : (endRow + 1) / 2;
+
+  ScaleI420Plane(pSrc, srcWidth, srcWidth, srcHeight, pDst, dstWidth, dstWidth, dstHeight, firstRow, endRow);
+  ScaleI420Plane(pSrcU, srcChromaWidth, srcChromaWidth, srcChromaHeight, pDstU, dstChromaWidth, dstChromaWidth, dstChromaHeight,
+    firstChromaRow, endChromaRow);
+  ScaleI420Plane(pSrcV, srcChromaWidth, srcChromaWidth, srcChromaHeight, pDstV, dstChromaWidth, dstChromaWidth, dstChromaHeight,
+    firstChromaRow, endChromaRow);
+}
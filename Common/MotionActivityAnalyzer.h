@@ -0,0 +1,212 @@
+/******************************************************************************
+* Filename: MotionActivityAnalyzer.h
+*
+* Description:
+* This header file contains an analyser that finds which parts of a webcam or
+* surveillance picture are changing and produces a per macroblock QP offset map
+* so an encoder spends its bits on them rather than the static background.
+*
+* Each 16x16 luma macroblock is compared to the same block in the previous frame
+* with the sum of absolute differences (SAD). A block whose mean difference is
+* over MOTION_ACTIVE_SAD is active and keeps the encoder's QP. The blocks around
+* an active block and blocks that were active in the last MOTION_HOLD_FRAMES
+* frames are near motion, so the edges of a moving object and the background it
+* uncovers aren't starved. Blocks with a little change, e.g. noise or lighting,
+* get a bigger offset and blocks with none the biggest.
+*
+* Each block gets one of MOTION_LEVEL_COUNT levels and MOTION_LEVEL_QP_OFFSETS
+* has the offset for each, in H264 QP units where +6 doubles the quantiser step.
+* Encoders with a per macroblock offset, x264, use the offsets and ones with a
+* few segments, libvpx's ROI map, use the level as the segment.
+*
+* The SAD uses SSE2 _mm_sad_epu8 where it's available, on x64 builds and x86
+* builds with /arch:SSE2, with a plain C++ version for anything else.
+*
+* License: Public Domain (no warranty, use at own risk)
+/******************************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MOTION_ACTIVITY_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#define MOTION_BLOCK_SIZE 16            // Macroblock size, the same for H264 and VP8.
+#define MOTION_LEVEL_COUNT 4
+#define MOTION_ACTIVE_SAD 6.0           // Mean absolute difference per pixel, 0 to 255, a block needs to be over to be active.
+#define MOTION_STATIC_SAD 1.5           // Blocks under this mean absolute difference are static.
+#define MOTION_HOLD_FRAMES 15           // Frames a block stays near motion after it was last active.
+
+enum class MotionLevel : uint8_t
+{
+  Active = 0,
+  NearMotion = 1,                       // Next to an active block or recently active.
+  LowMotion = 2,                        // Some change but under MOTION_ACTIVE_SAD, e.g. noise or lighting.
+  Static = 3
+};
+
+/* QP offset for each MotionLevel, active blocks keep the encoder's QP so their quality doesn't change. */
+static const float MOTION_LEVEL_QP_OFFSETS[MOTION_LEVEL_COUNT] = { 0.0f, 2.0f, 5.0f, 8.0f };
+
+class MotionActivityAnalyzer
+{
+public:
+  /**
+  * @param[in] width: the frame width.
+  * @param[in] height: the frame height.
+  */
+  MotionActivityAnalyzer(unsigned int width, unsigned int height) :
+    _width(width),
+    _height(height),
+    _mbWidth((width + MOTION_BLOCK_SIZE - 1) / MOTION_BLOCK_SIZE),
+    _mbHeight((height + MOTION_BLOCK_SIZE - 1) / MOTION_BLOCK_SIZE)
+  {
+    size_t blocks = (size_t)_mbWidth * _mbHeight;
+    _previous.resize((size_t)width * height);
+    _framesSinceActive.assign(blocks, MOTION_HOLD_FRAMES);
+    _active.assign(blocks, false);
+    _levels.assign(blocks, (uint8_t)MotionLevel::Active);
+    _qpOffsets.assign(blocks, MOTION_LEVEL_QP_OFFSETS[(int)MotionLevel::Active]);
+  }
+
+  /**
+  * Compares a frame to the previous one and updates the level and QP offset of
+  * each macroblock. The first frame has no previous frame so all its blocks are
+  * active.
+  * @param[in] pLuma: the frame's luma plane.
+  * @param[in] stride: the bytes between the rows of the luma plane.
+  */
+  void Analyse(const uint8_t* pLuma, int stride)
+  {
+    if (_frames > 0) {
+      for (unsigned int mby = 0; mby < _mbHeight; mby++) {
+        for (unsigned int mbx = 0; mbx < _mbWidth; mbx++) {
+          size_t index = (size_t)mby * _mbWidth + mbx;
+          double sad = GetBlockMeanSad(pLuma, stride, mbx, mby);
+
+          _active[index] = sad > MOTION_ACTIVE_SAD;
+          _framesSinceActive[index] = _active[index] ? 0 : std::min(_framesSinceActive[index] + 1, (unsigned int)MOTION_HOLD_FRAMES);
+          _levels[index] = (uint8_t)((sad > MOTION_STATIC_SAD) ? MotionLevel::LowMotion : MotionLevel::Static);
+        }
+      }
+
+      size_t activeBlocks = 0;
+
+      for (unsigned int mby = 0; mby < _mbHeight; mby++) {
+        for (unsigned int mbx = 0; mbx < _mbWidth; mbx++) {
+          size_t index = (size_t)mby * _mbWidth + mbx;
+
+          if (_active[index]) {
+            _levels[index] = (uint8_t)MotionLevel::Active;
+            activeBlocks++;
+          }
+          else if (_framesSinceActive[index] < MOTION_HOLD_FRAMES || IsNextToActive(mbx, mby)) {
+            _levels[index] = (uint8_t)MotionLevel::NearMotion;
+          }
+
+          _qpOffsets[index] = MOTION_LEVEL_QP_OFFSETS[_levels[index]];
+        }
+      }
+
+      _activeFraction = (double)activeBlocks / _levels.size();
+    }
+
+    for (unsigned int y = 0; y < _height; y++) {
+      memcpy(_previous.data() + (size_t)y * _width, pLuma + (size_t)y * stride, _width);
+    }
+
+    _frames++;
+  }
+
+  unsigned int GetMacroblockWidth() const
+  {
+    return _mbWidth;
+  }
+
+  unsigned int GetMacroblockHeight() const
+  {
+    return _mbHeight;
+  }
+
+  /* The MotionLevel of each macroblock, row by row. */
+  const std::vector<uint8_t>& GetLevels() const
+  {
+    return _levels;
+  }
+
+  /* The QP offset of each macroblock, row by row. */
+  const std::vector<float>& GetQpOffsets() const
+  {
+    return _qpOffsets;
+  }
+
+  /* The fraction of the macroblocks that were active in the last frame. */
+  double GetActiveFraction() const
+  {
+    return _activeFraction;
+  }
+
+private:
+
+  /* Mean absolute difference per pixel between a macroblock and the same block in the previous frame. */
+  double GetBlockMeanSad(const uint8_t* pLuma, int stride, unsigned int mbx, unsigned int mby) const
+  {
+    unsigned int left = mbx * MOTION_BLOCK_SIZE, top = mby * MOTION_BLOCK_SIZE;
+    unsigned int blockWidth = std::min((unsigned int)MOTION_BLOCK_SIZE, _width - left);
+    unsigned int blockHeight = std::min((unsigned int)MOTION_BLOCK_SIZE, _height - top);
+    uint64_t sad = 0;
+
+    for (unsigned int y = 0; y < blockHeight; y++) {
+      const uint8_t* pA = pLuma + (size_t)(top + y) * stride + left;
+      const uint8_t* pB = _previous.data() + (size_t)(top + y) * _width + left;
+      unsigned int x = 0;
+
+#ifdef MOTION_ACTIVITY_SSE2
+      if (blockWidth == MOTION_BLOCK_SIZE) {
+        __m128i rowSad = _mm_sad_epu8(_mm_loadu_si128((const __m128i*)pA), _mm_loadu_si128((const __m128i*)pB));
+        // Each half of the register has the sum for 8 of the bytes.
+        sad += (uint64_t)_mm_cvtsi128_si32(rowSad) + (uint64_t)_mm_cvtsi128_si32(_mm_srli_si128(rowSad, 8));
+        x = MOTION_BLOCK_SIZE;
+      }
+#endif
+
+      for (; x < blockWidth; x++) {
+        sad += abs(pA[x] - pB[x]);
+      }
+    }
+
+    return (double)sad / (blockWidth * blockHeight);
+  }
+
+  bool IsNextToActive(unsigned int mbx, unsigned int mby) const
+  {
+    for (unsigned int y = (mby > 0) ? mby - 1 : 0; y <= mby + 1 && y < _mbHeight; y++) {
+      for (unsigned int x = (mbx > 0) ? mbx - 1 : 0; x <= mbx + 1 && x < _mbWidth; x++) {
+        if (_active[(size_t)y * _mbWidth + x]) {
+          return true;
+        }
+      }
+    }
+    return false;
+  }
+
+  unsigned int _width;
+  unsigned int _height;
+  unsigned int _mbWidth;
+  unsigned int _mbHeight;
+  std::vector<uint8_t> _previous;       // Luma of the previous frame with no padding between rows.
+  std::vector<unsigned int> _framesSinceActive;
+  std::vector<bool> _active;
+  std::vector<uint8_t> _levels;
+  std::vector<float> _qpOffsets;
+  size_t _frames = 0;
+  double _activeFraction = 1;
+};
@@ -0,0 +1,113 @@
+/******************************************************************************
+* Filename: OpenH264VideoDecoder.h
+*
+* Description:
+* This header file contains the Cisco openh264 backend for the VideoDecoder
+* interface. openh264 is single threaded and decodes each access unit without
+* delay, so a frame comes out for every complete access unit pushed. Input must be Annex B NAL units with start codes.
+*
+* Dependencies:
+* vcpkg install openh264
+*
+* License: Public Domain (no warranty, use at own risk)
+/******************************************************************************/
+
+#pragma once
+
+#include "VideoDecoder.h"
+
+#include <wels/codec_api.h>
+
+#include <stdio.h>
+#include <string.h>
+
+class OpenH264VideoDecoder : public VideoDecoder
+{
+public:
+  ~OpenH264VideoDecoder()
+  {
+    if (_pDecoder != nullptr) {
+      _pDecoder->Uninitialize();
+      WelsDestroyDecoder(_pDecoder);
+    }
+  }
+
+  const char* GetName() const override
+  {
+    return "openh264";
+  }
+
+  bool SupportsCodec(VideoCodec codec) const override
+  {
+    return codec == VideoCodec::H264;
+  }
+
+  bool SupportsThreading(VideoDecoderThreading threading) const override
+  {
+    return threading == VideoDecoderThreading::None;
+  }
+
+protected:
+
+  bool Open(const VideoDecoderConfig& config) override
+  {
+    if (WelsCreateDecoder(&_pDecoder) != 0 || _pDecoder == nullptr) {
+      printf("Failed to create openh264 decoder.\n");
+      return false;
+    }
+
+    SDecodingParam param;
+    memset(&param, 0, sizeof(param));
+    param.sVideoProperty.eVideoBsType = VIDEO_BITSTREAM_AVC;
+
+    if (_pDecoder->Initialize(&param) != cmResultSuccess) {
+      printf("Failed to initialise openh264 decoder.\n");
+      return false;
+    }
+
+    return true;
+  }
+
+  bool Decode(const uint8_t* pData, size_t length, int64_t pts) override
+  {
+    SBufferInfo info;
+    memset(&info, 0, sizeof(info));
+    info.uiInBsTimeStamp = pts;
+
+    return DecodeBuffer(pData, (int)length, info);
+  }
+
+  bool Flush() override
+  {
+    int endOfStream = 1;
+    _pDecoder->SetOption(DECODER_OPTION_END_OF_STREAM, &endOfStream);
+
+    SBufferInfo info;
+    memset(&info, 0, sizeof(info));
+
+    return DecodeBuffer(nullptr, 0, info);
+  }
+
+private:
+
+  bool DecodeBuffer(const uint8_t* pData, int length, SBufferInfo& info)
+  {
+    uint8_t* planes[3] = { nullptr, nullptr, nullptr };
+
+    DECODING_STATE state = _pDecoder->DecodeFrameNoDelay(pData, length, planes, &info);
+    if (state != dsErrorFree) {
+      printf("openh264 failed to decode access unit, state %d.\n", state);
+      return false;
+    }
+
+    if (info.iBufferStatus == 1) {
+      const SSysMEMBuffer& buffer = info.UsrData.sSystemBuffer;
+      int strides[3] = { buffer.iStride[0], buffer.iStride[1], buffer.iStride[1] };
+      QueueFrame(planes, strides, buffer.iWidth, buffer.iHeight, (int64_t)info.uiOutYuvTimeStamp);
+    }
+
+    return true;
+  }
+
+  ISVCDecoder* _pDecoder = nullptr;
+};
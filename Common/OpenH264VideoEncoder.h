@@ -0,0 +1,194 @@
+/******************************************************************************
+* Filename: OpenH264VideoEncoder.h
+*
+* Description:
+* This header file contains the Cisco openh264 backend for the VideoEncoder
+* interface. openh264 only produces the constrained baseline profile, the same
+* as the H264 samples request from the MFT, and with the camera real-time usage
+* each pushed frame either comes straight back out or is skipped by the rate
+* control. Frame skipping is disabled so there is one access unit per frame.
+* The fast and slow VideoEncoderPreset use the low and high complexity modes.
+* openh264 has no intra refresh option so only periodic key frames are supported,
+* and no per macroblock QP control so QP offset maps aren't either.
+*
+* Dependencies:
+* vcpkg install openh264
+*
+* License: Public Domain (no warranty, use at own risk)
+/******************************************************************************/
+
+#pragma once
+
+#include "VideoEncoder.h"
+
+#include <wels/codec_api.h>
+
+#include <stdio.h>
+#include <string.h>
+
+class OpenH264VideoEncoder : public VideoEncoder
+{
+public:
+  ~OpenH264VideoEncoder()
+  {
+    if (_pEncoder != nullptr) {
+      _pEncoder->Uninitialize();
+      WelsDestroySVCEncoder(_pEncoder);
+    }
+  }
+
+  const char* GetName() const override
+  {
+    return "openh264";
+  }
+
+  VideoCodec GetCodec() const override
+  {
+    return VideoCodec::H264;
+  }
+
+  bool SupportsIntraRefresh() const override
+  {
+    return false;
+  }
+
+  bool SupportsQpOffsetMap() const override
+  {
+    return false;
+  }
+
+protected:
+
+  bool Open(const VideoEncoderConfig& config) override
+  {
+    if (WelsCreateSVCEncoder(&_pEncoder) != 0 || _pEncoder == nullptr) {
+      printf("Failed to create openh264 encoder.\n");
+      return false;
+    }
+
+    SEncParamExt param;
+    _pEncoder->GetDefaultParams(&param);
+
+    float frameRate = (float)config.FrameRateNum / config.FrameRateDen;
+
+    param.iUsageType = CAMERA_VIDEO_REAL_TIME;
+    param.iPicWidth = config.Width;
+    param.iPicHeight = config.Height;
+    param.iTargetBitrate = config.BitrateKbps * 1000;
+    param.iMaxBitrate = config.BitrateKbps * 1000;
+    param.iRCMode = RC_BITRATE_MODE;
+    param.fMaxFrameRate = frameRate;
+    param.bEnableFrameSkip = false;
+    param.uiIntraPeriod = 0;
+    param.eSpsPpsIdStrategy = CONSTANT_ID;
+    param.iMultipleThreadIdc = config.Threads;   // 0 is auto detect.
+    param.iSpatialLayerNum = 1;
+    param.iTemporalLayerNum = 1;
+    if (config.Preset == VideoEncoderPreset::Fast) {
+      param.iComplexityMode = LOW_COMPLEXITY;
+    }
+    else if (config.Preset == VideoEncoderPreset::Slow) {
+      param.iComplexityMode = HIGH_COMPLEXITY;
+    }
+
+    SSpatialLayerConfig& layer = param.sSpatialLayers[0];
+    layer.iVideoWidth = config.Width;
+    layer.iVideoHeight = config.Height;
+    layer.fFrameRate = frameRate;
+    layer.iSpatialBitrate = param.iTargetBitrate;
+    layer.iMaxSpatialBitrate = param.iMaxBitrate;
+    layer.uiProfileIdc = PRO_BASELINE;
+
+    // openh264 threads encode slices so there needs to be a slice per thread.
+    if (config.Threads > 1) {
+      layer.sSliceArgument.uiSliceMode = SM_FIXEDSLCNUM_SLICE;
+      layer.sSliceArgument.uiSliceNum = config.Threads;
+    }
+    else {
+      layer.sSliceArgument.uiSliceMode = SM_SINGLE_SLICE;
+    }
+
+    if (_pEncoder->InitializeExt(&param) != cmResultSuccess) {
+      printf("Failed to initialise openh264 encoder.\n");
+      return false;
+    }
+
+    int videoFormat = videoFormatI420;
+    _pEncoder->SetOption(ENCODER_OPTION_DATAFORMAT, &videoFormat);
+
+    return true;
+  }
+
+  bool Encode(const uint8_t* pI420, int64_t pts, bool keyFrame) override
+  {
+    SSourcePicture picture;
+    memset(&picture, 0, sizeof(picture));
+    picture.iColorFormat = videoFormatI420;
+    picture.iPicWidth = _config.Width;
+    picture.iPicHeight = _config.Height;
+    picture.iStride[0] = _config.Width;
+    picture.iStride[1] = (_config.Width + 1) / 2;
+    picture.iStride[2] = (_config.Width + 1) / 2;
+    GetI420Planes(pI420, (const uint8_t**)&picture.pData[0], (const uint8_t**)&picture.pData[1], (const uint8_t**)&picture.pData[2]);
+    picture.uiTimeStamp = pts * 1000 / VIDEO_ENCODER_CLOCK_RATE;
+
+    if (keyFrame) {
+      _pEncoder->ForceIntraFrame(true);
+    }
+
+    SFrameBSInfo info;
+    memset(&info, 0, sizeof(info));
+
+    if (_pEncoder->EncodeFrame(&picture, &info) != cmResultSuccess) {
+      printf("openh264 failed to encode frame.\n");
+      return false;
+    }
+
+    if (info.eFrameType == videoFrameTypeSkip || info.iFrameSizeInBytes == 0) {
+      return true;
+    }
+
+    // Each layer's NAL units, including their start codes, are contiguous but the layers aren't.
+    EncodedAccessUnit* pAccessUnit = nullptr;
+
+    for (int i = 0; i < info.iLayerNum; i++) {
+      const SLayerBSInfo& layer = info.sLayerInfo[i];
+      size_t layerSize = 0;
+
+      for (int j = 0; j < layer.iNalCount; j++) {
+        layerSize += layer.pNalLengthInByte[j];
+      }
+
+      if (pAccessUnit == nullptr) {
+        pAccessUnit = &QueueAccessUnit(layer.pBsBuf, layerSize, pts, info.eFrameType == videoFrameTypeIDR);
+      }
+      else {
+        pAccessUnit->Data.insert(pAccessUnit->Data.end(), layer.pBsBuf, layer.pBsBuf + layerSize);
+      }
+    }
+
+    return true;
+  }
+
+  bool SetRate(unsigned int bitrateKbps, unsigned int frameRateNum, unsigned int frameRateDen) override
+  {
+    SBitrateInfo bitrate;
+    bitrate.iLayer = SPATIAL_LAYER_ALL;
+    bitrate.iBitrate = bitrateKbps * 1000;
+
+    float frameRate = (float)frameRateNum / frameRateDen;
+
+    // The maximum has to go up first or openh264 clamps the target to the old maximum.
+    if (_pEncoder->SetOption(ENCODER_OPTION_MAX_BITRATE, &bitrate) != cmResultSuccess ||
+      _pEncoder->SetOption(ENCODER_OPTION_BITRATE, &bitrate) != cmResultSuccess ||
+      _pEncoder->SetOption(ENCODER_OPTION_FRAME_RATE, &frameRate) != cmResultSuccess) {
+      printf("openh264 encoder rejected the new rate settings.\n");
+      return false;
+    }
+
+    return true;
+  }
+
+private:
+  ISVCEncoder* _pEncoder = nullptr;
+};
@@ -0,0 +1,236 @@
+/******************************************************************************
+* Filename: SceneChangeDetector.h
+*
+* Description:
+* This header file contains a scene change detector that decides where to put
+* key frames in a live stream instead of leaving it to a fixed interval, which
+* puts them in the middle of scenes where they cost a lot more than the
+* predicted frame they replace while a cut gets an expensive predicted frame.
+*
+* The luma plane of each frame is downsampled to the mean of each
+* SCENE_CHANGE_BLOCK_SIZE square block and compared to the previous frame's
+* with the mean absolute difference (SAD) of the block means. Downsampling
+* first means camera noise and small movements mostly average out. A frame is
+* a cut if its difference is over SCENE_CHANGE_MIN_SAD and SCENE_CHANGE_SAD_RATIO
+* times the recent average, so a scene with a lot of motion isn't taken for a
+* string of cuts. While the scene is static the key frame interval is stretched
+* out as there's nothing for a periodic key frame to refresh.
+*
+* Both steps use SSE2 _mm_sad_epu8 where it's available, on x64 builds and x86
+* builds with /arch:SSE2, with a plain C++ version for anything else.
+*
+* License: Public Domain (no warranty, use at own risk)
+/******************************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SCENE_CHANGE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#define SCENE_CHANGE_BLOCK_SIZE 8               // Luma is downsampled to the mean of each 8x8 block before comparing frames.
+#define SCENE_CHANGE_MIN_SAD 12.0               // Mean difference of the block means, 0 to 255, a cut needs to be over.
+#define SCENE_CHANGE_SAD_RATIO 4.0              // A cut's difference also needs to be this many times the recent average.
+#define SCENE_CHANGE_STATIC_SAD 1.0             // The scene is static while the recent average difference is under this.
+#define SCENE_CHANGE_AVERAGE_WEIGHT 0.1         // Weight of the latest frame in the recent average difference.
+#define SCENE_CHANGE_MIN_KEY_FRAME_DISTANCE 10  // Frames after a key frame before a cut can force another, so a flash doesn't cause two.
+
+enum class SceneKeyFrameReason
+{
+  None,                                 // Encode as a predicted frame.
+  Forced,                               // The caller is already forcing a key frame, e.g. for a new receiver.
+  SceneCut,
+  Interval                              // The first frame or the key frame interval has run out.
+};
+
+struct SceneChangeStats
+{
+  size_t Frames = 0;
+  size_t StaticFrames = 0;
+  size_t SceneCuts = 0;
+  size_t IntervalKeyFrames = 0;
+  size_t ForcedKeyFrames = 0;
+};
+
+class SceneChangeDetector
+{
+public:
+  /**
+  * @param[in] width: the frame width.
+  * @param[in] height: the frame height.
+  * @param[in] keyFrameInterval: the maximum frames between key frames while the scene is changing.
+  * @param[in] staticKeyFrameInterval: the maximum frames between key frames while the scene is static.
+  */
+  SceneChangeDetector(unsigned int width, unsigned int height, unsigned int keyFrameInterval, unsigned int staticKeyFrameInterval) :
+    _blocksWide(width / SCENE_CHANGE_BLOCK_SIZE),
+    _blocksHigh(height / SCENE_CHANGE_BLOCK_SIZE),
+    _keyFrameInterval(keyFrameInterval),
+    _staticKeyFrameInterval(staticKeyFrameInterval)
+  {
+    _current.resize(_blocksWide * _blocksHigh);
+    _previous.resize(_blocksWide * _blocksHigh);
+  }
+
+  /**
+  * Compares a frame to the previous one and decides whether it should be a key
+  * frame. Call for each frame that's going to be encoded, frames that are
+  * dropped before the encoder shouldn't be included.
+  * @param[in] pLuma: the frame's luma plane.
+  * @param[in] stride: the bytes between the rows of the luma plane.
+  * @param[in] isKeyFrameForced: true if the frame is already going to be a key
+  *  frame for some other reason, it still counts as the start of a new interval.
+  * @@Returns Why the frame should be a key frame or None if it shouldn't be.
+  */
+  SceneKeyFrameReason Analyse(const uint8_t* pLuma, int stride, bool isKeyFrameForced)
+  {
+    Downsample(pLuma, stride, _current.data());
+
+    SceneKeyFrameReason reason = SceneKeyFrameReason::None;
+    bool isStatic = _averageSad < SCENE_CHANGE_STATIC_SAD;
+    unsigned int interval = isStatic ? _staticKeyFrameInterval : _keyFrameInterval;
+
+    _stats.Frames++;
+    _framesSinceKeyFrame++;
+
+    if (_stats.Frames == 1) {
+      _lastSad = 0;
+      reason = isKeyFrameForced ? SceneKeyFrameReason::Forced : SceneKeyFrameReason::Interval;
+    }
+    else {
+      _lastSad = (double)GetSad(_current.data(), _previous.data(), _current.size()) / _current.size();
+
+      if (isKeyFrameForced) {
+        reason = SceneKeyFrameReason::Forced;
+      }
+      else if (_framesSinceKeyFrame >= SCENE_CHANGE_MIN_KEY_FRAME_DISTANCE && _lastSad > SCENE_CHANGE_MIN_SAD &&
+        _lastSad > SCENE_CHANGE_SAD_RATIO * _averageSad) {
+        reason = SceneKeyFrameReason::SceneCut;
+      }
+      else if (interval > 0 && _framesSinceKeyFrame >= interval) {
+        reason = SceneKeyFrameReason::Interval;
+      }
+
+      // The average is of the differences within a scene, a cut starts it again.
+      if (reason == SceneKeyFrameReason::SceneCut) {
+        _averageSad = SCENE_CHANGE_STATIC_SAD;
+      }
+      else {
+        _averageSad += SCENE_CHANGE_AVERAGE_WEIGHT * (_lastSad - _averageSad);
+      }
+    }
+
+    switch (reason) {
+    case SceneKeyFrameReason::Forced:
+      _stats.ForcedKeyFrames++;
+      break;
+    case SceneKeyFrameReason::SceneCut:
+      _stats.SceneCuts++;
+      break;
+    case SceneKeyFrameReason::Interval:
+      _stats.IntervalKeyFrames++;
+      break;
+    default:
+      break;
+    }
+
+    if (isStatic) {
+      _stats.StaticFrames++;
+    }
+
+    if (reason != SceneKeyFrameReason::None) {
+      _framesSinceKeyFrame = 0;
+    }
+
+    _current.swap(_previous);
+    return reason;
+  }
+
+  /* The difference between the last two frames analysed. */
+  double GetLastSad() const
+  {
+    return _lastSad;
+  }
+
+  const SceneChangeStats& GetStats() const
+  {
+    return _stats;
+  }
+
+private:
+
+  /* Sets each block to the mean of its luma samples. */
+  void Downsample(const uint8_t* pLuma, int stride, uint8_t* pBlocks) const
+  {
+    const unsigned int blockPixels = SCENE_CHANGE_BLOCK_SIZE * SCENE_CHANGE_BLOCK_SIZE;
+
+    for (unsigned int by = 0; by < _blocksHigh; by++) {
+      const uint8_t* pRow = pLuma + (size_t)by * SCENE_CHANGE_BLOCK_SIZE * stride;
+
+      for (unsigned int bx = 0; bx < _blocksWide; bx++) {
+        const uint8_t* pBlock = pRow + bx * SCENE_CHANGE_BLOCK_SIZE;
+        unsigned int sum = 0;
+
+#ifdef SCENE_CHANGE_SSE2
+        // The SAD against zero of each row of 8 samples is their sum.
+        __m128i zero = _mm_setzero_si128();
+        __m128i sums = _mm_setzero_si128();
+        for (int y = 0; y < SCENE_CHANGE_BLOCK_SIZE; y++) {
+          __m128i samples = _mm_loadl_epi64((const __m128i*)(pBlock + (size_t)y * stride));
+          sums = _mm_add_epi64(sums, _mm_sad_epu8(samples, zero));
+        }
+        sum = (unsigned int)_mm_cvtsi128_si32(sums);
+#else
+        for (int y = 0; y < SCENE_CHANGE_BLOCK_SIZE; y++) {
+          const uint8_t* pSamples = pBlock + (size_t)y * stride;
+          for (int x = 0; x < SCENE_CHANGE_BLOCK_SIZE; x++) {
+            sum += pSamples[x];
+          }
+        }
+#endif
+
+        pBlocks[by * _blocksWide + bx] = (uint8_t)((sum + blockPixels / 2) / blockPixels);
+      }
+    }
+  }
+
+  /* Sum of absolute differences between two sets of block means. */
+  static uint64_t GetSad(const uint8_t* pA, const uint8_t* pB, size_t length)
+  {
+    uint64_t sad = 0;
+    size_t i = 0;
+
+#ifdef SCENE_CHANGE_SSE2
+    __m128i sums = _mm_setzero_si128();
+    for (; i + 16 <= length; i += 16) {
+      __m128i a = _mm_loadu_si128((const __m128i*)(pA + i));
+      __m128i b = _mm_loadu_si128((const __m128i*)(pB + i));
+      sums = _mm_add_epi64(sums, _mm_sad_epu8(a, b));
+    }
+    // Each half of the register has the sum for 8 of the bytes.
+    sad = (uint64_t)_mm_cvtsi128_si32(sums) + (uint64_t)_mm_cvtsi128_si32(_mm_srli_si128(sums, 8));
+#endif
+
+    for (; i < length; i++) {
+      sad += abs(pA[i] - pB[i]);
+    }
+
+    return sad;
+  }
+
+  unsigned int _blocksWide;
+  unsigned int _blocksHigh;
+  unsigned int _keyFrameInterval;
+  unsigned int _staticKeyFrameInterval;
+  std::vector<uint8_t> _current;        // Block means of the frame being analysed.
+  std::vector<uint8_t> _previous;
+  unsigned int _framesSinceKeyFrame = 0;
+  double _averageSad = 0;
+  double _lastSad = 0;
+  SceneChangeStats _stats;
+};
@@ -0,0 +1,253 @@
+/******************************************************************************
+* Filename: VideoAdaptationController.h
+*
+* Description:
+* This header file contains a controller that adapts the resolution, frame rate
+* and bitrate of a live video stream to the CPU and bandwidth available, without
+* restarting the capture or the encoder. It works through a fixed ladder of
+* steps, each a scale of the capture resolution, a frame rate decimation factor
+* and a target bitrate. The frame size is changed by scaling the captured frames
+* and reconfiguring the encoder, and the frame rate by only encoding every Nth
+* frame.
+*
+* The inputs are the time taken by each encode, the size of the encoded frames
+* and the receiver's bandwidth estimate. Every measurement window the encode
+* load, the fraction of the window spent encoding, and the sent bitrate are
+* worked out. The controller steps down if the load is over
+* VIDEO_ADAPTATION_OVERUSE_LOAD or the current step's bitrate is more than the
+* bandwidth estimate. It steps up once the load projected for the step above,
+* from its pixel rate, is under VIDEO_ADAPTATION_UNDERUSE_LOAD and the estimate
+* has room for its bitrate. Going up waits longer than going down so the
+* stream doesn't oscillate.
+*
+* A new step is only made pending by the controller, the caller applies it with
+* the next key frame as the receiver needs one for a resolution change anyway.
+* Each step is logged with the load and bitrate before it and, a couple of
+* windows later, after it.
+*
+* License: Public Domain (no warranty, use at own risk)
+/******************************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <string>
+
+#define VIDEO_ADAPTATION_STEP_COUNT 6
+#define VIDEO_ADAPTATION_WINDOW_MS 1000         // The encode load and sent bitrate are measured over windows of this length.
+#define VIDEO_ADAPTATION_OVERUSE_LOAD 0.85      // Step down if more than this fraction of the time is spent encoding.
+#define VIDEO_ADAPTATION_UNDERUSE_LOAD 0.5      // Step up if the load projected for the step above is under this.
+#define VIDEO_ADAPTATION_BANDWIDTH_HEADROOM 1.2 // Step up only if the bandwidth estimate is this much more than the step's bitrate.
+#define VIDEO_ADAPTATION_DOWN_HOLD_MS 1000      // Minimum time at a step before stepping down.
+#define VIDEO_ADAPTATION_UP_HOLD_MS 5000        // Minimum time at a step before stepping up.
+#define VIDEO_ADAPTATION_EFFECT_WINDOWS 2       // Windows after a step before its effect is logged, the first has the key frame.
+
+/* The ladder, a resolution scale, frame rate divisor and the percentage of the full bitrate for each step. */
+static const unsigned int VIDEO_ADAPTATION_LADDER[VIDEO_ADAPTATION_STEP_COUNT][4] = {
+  { 1, 1, 1, 100 },
+  { 3, 4, 1, 65 },
+  { 1, 2, 1, 40 },
+  { 1, 2, 2, 28 },
+  { 1, 4, 2, 14 },
+  { 1, 4, 3, 10 },
+};
+
+struct VideoAdaptationStep
+{
+  unsigned int Index = 0;               // 0 is the full resolution and frame rate.
+  unsigned int Width = 0;
+  unsigned int Height = 0;
+  unsigned int FrameRateDivisor = 1;    // 1 in every this many captured frames is encoded.
+  unsigned int FrameRate = 0;
+  unsigned int BitrateKbps = 0;
+};
+
+class VideoAdaptationController
+{
+public:
+  /**
+  * @param[in] width: the capture width, the full resolution step.
+  * @param[in] height: the capture height.
+  * @param[in] frameRate: the capture frame rate.
+  * @param[in] bitrateKbps: the target bitrate at the full resolution and frame rate.
+  */
+  VideoAdaptationController(unsigned int width, unsigned int height, unsigned int frameRate, unsigned int bitrateKbps)
+  {
+    for (unsigned int i = 0; i < VIDEO_ADAPTATION_STEP_COUNT; i++) {
+      const unsigned int* pLadder = VIDEO_ADAPTATION_LADDER[i];
+
+      _steps[i].Index = i;
+      _steps[i].Width = (width * pLadder[0] / pLadder[1]) & ~1U;     // Even for the chroma planes.
+      _steps[i].Height = (height * pLadder[0] / pLadder[1]) & ~1U;
+      _steps[i].FrameRateDivisor = pLadder[2];
+      _steps[i].FrameRate = frameRate / pLadder[2];
+      _steps[i].BitrateKbps = bitrateKbps * pLadder[3] / 100;
+    }
+  }
+
+  const VideoAdaptationStep& GetStep() const
+  {
+    return _steps[_current];
+  }
+
+  bool HasPendingStep() const
+  {
+    return _pending != _current;
+  }
+
+  /**
+  * Decides whether a captured frame is encoded at the current step's frame rate.
+  * @param[in] isKeyFrame: true if the frame is going to be a key frame, these are always encoded.
+  * @@Returns true to encode the frame, false if it's decimated.
+  */
+  bool ShouldEncodeFrame(bool isKeyFrame)
+  {
+    if (isKeyFrame || ++_framesSinceEncode >= _steps[_current].FrameRateDivisor) {
+      _framesSinceEncode = 0;
+      return true;
+    }
+    return false;
+  }
+
+  /**
+  * Records an encoded frame.
+  * @param[in] encodeMs: the time the encoder took.
+  * @param[in] bytes: the size of the encoded frame.
+  */
+  void OnFrameEncoded(double encodeMs, size_t bytes)
+  {
+    _windowEncodeMs += encodeMs;
+    _windowBytes += bytes;
+  }
+
+  /**
+  * Sets the receiver's bandwidth estimate.
+  * @param[in] kbps: the estimate, 0 if there isn't one.
+  */
+  void OnBandwidthEstimate(unsigned int kbps)
+  {
+    _bandwidthKbps = kbps;
+  }
+
+  /**
+  * Closes the measurement window if it's complete and decides whether a new step
+  * is needed. Call for every captured frame.
+  * @param[in] nowMs: the current time in milliseconds.
+  */
+  void Update(int64_t nowMs)
+  {
+    if (_windowStartedAt == 0) {
+      _windowStartedAt = nowMs;
+      _stepStartedAt = nowMs;
+      return;
+    }
+    else if (nowMs - _windowStartedAt < VIDEO_ADAPTATION_WINDOW_MS) {
+      return;
+    }
+
+    double windowMs = (double)(nowMs - _windowStartedAt);
+    _load = _windowEncodeMs / windowMs;
+    _sentKbps = _windowBytes * 8 / windowMs;
+    _windowStartedAt = nowMs;
+    _windowEncodeMs = 0;
+    _windowBytes = 0;
+
+    if (_effectWindows > 0 && --_effectWindows == 0) {
+      printf("Video adaptation step %u effect: encode load %.0f%% -> %.0f%%, sent %.0fkbps -> %.0fkbps.\n",
+        _current, _loadBefore * 100, _load * 100, _sentKbpsBefore, _sentKbps);
+    }
+
+    if (HasPendingStep()) {
+      return;
+    }
+
+    int64_t heldMs = nowMs - _stepStartedAt;
+    const VideoAdaptationStep& step = _steps[_current];
+    char reason[64];
+
+    if (_current + 1 < VIDEO_ADAPTATION_STEP_COUNT && heldMs >= VIDEO_ADAPTATION_DOWN_HOLD_MS) {
+      if (_load > VIDEO_ADAPTATION_OVERUSE_LOAD) {
+        snprintf(reason, sizeof(reason), "encode load over %.0f%%", VIDEO_ADAPTATION_OVERUSE_LOAD * 100);
+        SetPending(_current + 1, reason);
+        return;
+      }
+      else if (_bandwidthKbps > 0 && step.BitrateKbps > _bandwidthKbps) {
+        snprintf(reason, sizeof(reason), "bandwidth estimate %ukbps", _bandwidthKbps);
+        SetPending(_current + 1, reason);
+        return;
+      }
+    }
+
+    if (_current > 0 && heldMs >= VIDEO_ADAPTATION_UP_HOLD_MS) {
+      const VideoAdaptationStep& up = _steps[_current - 1];
+      double projectedLoad = _load * GetPixelRate(up) / GetPixelRate(step);
+
+      if (projectedLoad < VIDEO_ADAPTATION_UNDERUSE_LOAD &&
+        (_bandwidthKbps == 0 || up.BitrateKbps * VIDEO_ADAPTATION_BANDWIDTH_HEADROOM <= _bandwidthKbps)) {
+        snprintf(reason, sizeof(reason), "projected encode load %.0f%%", projectedLoad * 100);
+        SetPending(_current - 1, reason);
+      }
+    }
+  }
+
+  /**
+  * Makes the pending step the current one. Call when the encoder has been
+  * reconfigured for it.
+  * @param[in] nowMs: the current time in milliseconds.
+  * @@Returns The new step.
+  */
+  const VideoAdaptationStep& ApplyPendingStep(int64_t nowMs)
+  {
+    const VideoAdaptationStep& from = _steps[_current];
+    const VideoAdaptationStep& to = _steps[_pending];
+
+    printf("Video adaptation step %u -> %u, %ux%u@%u %ukbps -> %ux%u@%u %ukbps, %s, encode load %.0f%%, sent %.0fkbps.\n",
+      from.Index, to.Index, from.Width, from.Height, from.FrameRate, from.BitrateKbps, to.Width, to.Height, to.FrameRate, to.BitrateKbps,
+      _pendingReason.c_str(), _load * 100, _sentKbps);
+
+    _current = _pending;
+    _stepStartedAt = nowMs;
+    _framesSinceEncode = 0;
+    _loadBefore = _load;
+    _sentKbpsBefore = _sentKbps;
+    _effectWindows = VIDEO_ADAPTATION_EFFECT_WINDOWS;
+
+    // The window that's in progress straddles the two steps.
+    _windowStartedAt = nowMs;
+    _windowEncodeMs = 0;
+    _windowBytes = 0;
+
+    return _steps[_current];
+  }
+
+private:
+
+  static double GetPixelRate(const VideoAdaptationStep& step)
+  {
+    return (double)step.Width * step.Height * step.FrameRate;
+  }
+
+  void SetPending(unsigned int index, const char* reason)
+  {
+    _pending = index;
+    _pendingReason = reason;
+  }
+
+  VideoAdaptationStep _steps[VIDEO_ADAPTATION_STEP_COUNT];
+  unsigned int _current = 0;
+  unsigned int _pending = 0;
+  std::string _pendingReason;
+  unsigned int _framesSinceEncode = 0;
+  unsigned int _bandwidthKbps = 0;
+  int64_t _stepStartedAt = 0;
+  int64_t _windowStartedAt = 0;
+  double _windowEncodeMs = 0;
+  size_t _windowBytes = 0;
+  double _load = 0;                     // Fraction of the last window spent encoding.
+  double _sentKbps = 0;                 // Encoded bitrate over the last window.
+  double _loadBefore = 0;
+  double _sentKbpsBefore = 0;
+  unsigned int _effectWindows = 0;      // Windows left until the effect of the last step is logged.
+};
@@ -0,0 +1,33 @@
+/******************************************************************************
+* Filename: VideoCodec.h
+*
+* Description:
+* This header file contains the video codec identifiers shared by the codec
+* neutral VideoEncoder and VideoDecoder interfaces.
+*
+* License: Public Domain (no warranty, use at own risk)
+/******************************************************************************/
+
+#pragma once
+
+enum class VideoCodec
+{
+  H264,
+  VP8,
+  VP9
+};
+
+/* Gets a short display name for a codec. */
+inline const char* GetVideoCodecName(VideoCodec codec)
+{
+  switch (codec) {
+  case VideoCodec::H264:
+    return "H264";
+  case VideoCodec::VP8:
+    return "VP8";
+  case VideoCodec::VP9:
+    return "VP9";
+  default:
+    return "unknown";
+  }
+}
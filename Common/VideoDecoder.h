@@ -0,0 +1,291 @@
+/******************************************************************************
+* Filename: VideoDecoder.h
+*
+* Description:
+* This header file contains a codec neutral video decoder interface, the
+* receive side counterpart of VideoEncoder.h, so decode pipelines can be run
+* and benchmarked without the Media Foundation H264 decoder MFT:
+*  - PushAccessUnit takes one encoded access unit, like IMFTransform::ProcessInput.
+*  - PullFrame is called until it returns NeedMoreInput, like calling
+*    ProcessOutput until it returns MF_E_TRANSFORM_NEED_MORE_INPUT.
+*  - A change in the decoded frame size is reported by PullFrame returning
+*    FormatChanged before the first frame in the new size, rather than the
+*    MF_E_TRANSFORM_STREAM_CHANGE, set output type and flush sequence
+*    GetTransformOutput in MFUtility.h has to go through.
+*
+* Decoded frames are copied into I420 buffers from a VideoFramePool supplied by
+* the caller. Buffers are only allocated when the pool is empty or the frame
+* size grows, so once the pool has warmed up there are no allocations per frame.
+*
+* The backends are in FfmpegVideoDecoder.h, OpenH264VideoDecoder.h and
+* VpxVideoDecoder.h and CreateVideoDecoder in VideoDecoderFactory.h creates one
+* by name.
+*
+* License: Public Domain (no warranty, use at own risk)
+/******************************************************************************/
+
+#pragma once
+
+#include "FrameCopy.h"
+#include "VideoCodec.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#define VIDEO_FRAME_POOL_DEFAULT_SIZE 8
+
+enum class VideoDecoderThreading
+{
+  None,                                 // Single threaded, lowest latency.
+  Slice,                                // Threads split the work within a frame, slices for H264, tiles or token partitions for VP8/VP9.
+  Frame                                 // Threads decode consecutive frames in parallel, more throughput but each thread adds a frame of latency.
+};
+
+enum class VideoDecoderResult
+{
+  NeedMoreInput,
+  Frame,
+  FormatChanged
+};
+
+struct VideoDecoderConfig
+{
+  VideoCodec Codec = VideoCodec::H264;
+  VideoDecoderThreading Threading = VideoDecoderThreading::None;
+  unsigned int Threads = 0;             // 0 lets the backend pick, ignored if Threading is None.
+};
+
+/* A decoded frame with the Y, U and V planes packed one after the other. */
+struct VideoFrameBuffer
+{
+  std::vector<uint8_t> Data;
+  unsigned int Width = 0;
+  unsigned int Height = 0;
+  int64_t Pts = 0;
+};
+
+/**
+* A pool of reusable I420 frame buffers. Acquire and Release can be called from
+* different threads, e.g. the decode thread and a renderer.
+*/
+class VideoFramePool
+{
+public:
+  VideoFramePool(size_t size = VIDEO_FRAME_POOL_DEFAULT_SIZE)
+  {
+    for (size_t i = 0; i < size; i++) {
+      _free.push_back(new VideoFrameBuffer());
+      _buffers.emplace_back(_free.back());
+    }
+  }
+
+  /**
+  * Gets a buffer sized for a frame. A new buffer is only allocated if all the
+  * pool's buffers are in use and an existing one only grows if it's too small.
+  * @param[in] width: the frame width.
+  * @param[in] height: the frame height.
+  * @@Returns A buffer that must be handed back with Release.
+  */
+  VideoFrameBuffer* Acquire(unsigned int width, unsigned int height)
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    VideoFrameBuffer* pBuffer = nullptr;
+    if (_free.empty()) {
+      pBuffer = new VideoFrameBuffer();
+      _buffers.emplace_back(pBuffer);
+    }
+    else {
+      pBuffer = _free.back();
+      _free.pop_back();
+    }
+
+    size_t frameSize = width * height + 2 * ((width + 1) / 2) * ((height + 1) / 2);
+    if (pBuffer->Data.capacity() < frameSize) {
+      _allocations++;
+    }
+
+    pBuffer->Data.resize(frameSize);
+    pBuffer->Width = width;
+    pBuffer->Height = height;
+    return pBuffer;
+  }
+
+  /* Returns a buffer from Acquire, or a decoded frame, to the pool. */
+  void Release(VideoFrameBuffer* pBuffer)
+  {
+    if (pBuffer != nullptr) {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _free.push_back(pBuffer);
+    }
+  }
+
+  /* Gets the number of times frame memory had to be allocated, which should stop rising once the pool has warmed up. */
+  size_t GetAllocationCount()
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _allocations;
+  }
+
+private:
+  std::mutex _mutex;
+  std::vector<std::unique_ptr<VideoFrameBuffer>> _buffers;
+  std::vector<VideoFrameBuffer*> _free;
+  size_t _allocations = 0;
+};
+
+/**
+* Base class for the decoder backends. The public methods deal with the format
+* change events, the frame pool and the output queue so the backends only have
+* to wrap their library's decode call. All methods other than the pool's must be
+* called from the same thread.
+*/
+class VideoDecoder
+{
+public:
+  virtual ~VideoDecoder()
+  {
+    for (VideoFrameBuffer* pFrame : _outputQueue) {
+      _pPool->Release(pFrame);
+    }
+  }
+
+  virtual const char* GetName() const = 0;
+  virtual bool SupportsCodec(VideoCodec codec) const = 0;
+  virtual bool SupportsThreading(VideoDecoderThreading threading) const = 0;
+
+  /**
+  * Creates the underlying decoder.
+  * @param[in] config: the codec and threading mode.
+  * @param[in] pPool: the pool decoded frames are copied into. Must outlive the decoder.
+  * @@Returns true if the decoder was created.
+  */
+  bool Init(const VideoDecoderConfig& config, VideoFramePool* pPool)
+  {
+    if (!SupportsCodec(config.Codec)) {
+      printf("The %s decoder doesn't support %s.\n", GetName(), GetVideoCodecName(config.Codec));
+      return false;
+    }
+    else if (!SupportsThreading(config.Threading)) {
+      printf("The %s decoder doesn't support the requested threading mode.\n", GetName());
+      return false;
+    }
+
+    _config = config;
+    _pPool = pPool;
+    _width = 0;
+    _height = 0;
+    return Open(config);
+  }
+
+  /**
+  * Decodes an access unit. Any frames produced are queued for PullFrame.
+  * @param[in] pData: Annex B NAL units for H264 or a single frame for VP8/VP9.
+  * @param[in] length: the length of the access unit.
+  * @param[in] pts: the presentation timestamp, passed through to the decoded frame.
+  * @@Returns true if the access unit was accepted.
+  */
+  bool PushAccessUnit(const uint8_t* pData, size_t length, int64_t pts)
+  {
+    return Decode(pData, length, pts);
+  }
+
+  /**
+  * Gets the next decoded frame. When FormatChanged is returned GetWidth and
+  * GetHeight have the new size and the next call returns the first frame in it.
+  * @param[out] ppFrame: set to the frame if the result is Frame. The caller
+  *  must hand it back to the pool with VideoFramePool::Release.
+  * @@Returns Frame, FormatChanged or NeedMoreInput.
+  */
+  VideoDecoderResult PullFrame(VideoFrameBuffer** ppFrame)
+  {
+    *ppFrame = nullptr;
+
+    if (_outputQueue.empty()) {
+      return VideoDecoderResult::NeedMoreInput;
+    }
+
+    VideoFrameBuffer* pFrame = _outputQueue.front();
+    if (pFrame->Width != _width || pFrame->Height != _height) {
+      _width = pFrame->Width;
+      _height = pFrame->Height;
+      return VideoDecoderResult::FormatChanged;
+    }
+
+    _outputQueue.pop_front();
+    *ppFrame = pFrame;
+    return VideoDecoderResult::Frame;
+  }
+
+  /**
+  * Signals the end of the input so any frames held for reordering or by frame
+  * threads are queued for PullFrame.
+  * @@Returns true if the decoder was drained.
+  */
+  bool Drain()
+  {
+    return Flush();
+  }
+
+  unsigned int GetWidth() const
+  {
+    return _width;
+  }
+
+  unsigned int GetHeight() const
+  {
+    return _height;
+  }
+
+protected:
+
+  virtual bool Open(const VideoDecoderConfig& config) = 0;
+
+  /* Decodes one access unit and queues the output with QueueFrame. */
+  virtual bool Decode(const uint8_t* pData, size_t length, int64_t pts) = 0;
+
+  /* Queues any frames the decoder is holding back. */
+  virtual bool Flush() = 0;
+
+  /**
+  * Copies a decoded frame from the library's buffers into a pool buffer and
+  * queues it.
+  * @param[in] planes: the Y, U and V plane pointers.
+  * @param[in] strides: the Y, U and V line strides.
+  * @param[in] width: the frame width.
+  * @param[in] height: the frame height.
+  * @param[in] pts: the frame's presentation timestamp.
+  */
+  void QueueFrame(const uint8_t* const planes[3], const int strides[3], unsigned int width, unsigned int height, int64_t pts)
+  {
+    VideoFrameBuffer* pFrame = _pPool->Acquire(width, height);
+    pFrame->Pts = pts;
+
+    uint8_t* pDst = pFrame->Data.data();
+    bool isStreaming = IsStreamingFrameCopy(GetColourImageSize(ColourFormat::I420, width, height), FrameCopyMode::Auto);
+
+    for (int plane = 0; plane < 3; plane++) {
+      unsigned int planeWidth = (plane == 0) ? width : (width + 1) / 2;
+      unsigned int planeHeight = (plane == 0) ? height : (height + 1) / 2;
+
+      CopyPlane(planes[plane], strides[plane], pDst, (int)planeWidth, planeWidth, planeHeight, isStreaming);
+      pDst += (size_t)planeWidth * planeHeight;
+    }
+
+    _outputQueue.push_back(pFrame);
+  }
+
+  VideoDecoderConfig _config;
+
+private:
+  VideoFramePool* _pPool = nullptr;
+  unsigned int _width = 0;
+  unsigned int _height = 0;
+  std::deque<VideoFrameBuffer*> _outputQueue;
+};
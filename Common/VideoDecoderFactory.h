@@ -0,0 +1,76 @@
+/******************************************************************************
+* Filename: VideoDecoderFactory.h
+*
+* Description:
+* This header file creates VideoDecoder backends by name. A backend is only
+* compiled in if its define is set, so an application only needs the libraries
+* for the backends it uses:
+*  - VIDEO_DECODER_FFMPEG: "ffmpeg", H264, VP8 and VP9 (vcpkg install ffmpeg).
+*  - VIDEO_DECODER_OPENH264: "openh264", H264 (vcpkg install openh264).
+*  - VIDEO_DECODER_VPX: "libvpx", VP8 and VP9 (vcpkg install libvpx).
+*
+* License: Public Domain (no warranty, use at own risk)
+/******************************************************************************/
+
+#pragma once
+
+#include "VideoDecoder.h"
+
+#ifdef VIDEO_DECODER_FFMPEG
+#include "FfmpegVideoDecoder.h"
+#endif
+#ifdef VIDEO_DECODER_OPENH264
+#include "OpenH264VideoDecoder.h"
+#endif
+#ifdef VIDEO_DECODER_VPX
+#include "VpxVideoDecoder.h"
+#endif
+
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+* Gets the names of the backends compiled in.
+* @@Returns The backend names in the order they are listed above.
+*/
+inline std::vector<std::string> GetVideoDecoderNames()
+{
+  std::vector<std::string> names;
+#ifdef VIDEO_DECODER_FFMPEG
+  names.push_back("ffmpeg");
+#endif
+#ifdef VIDEO_DECODER_OPENH264
+  names.push_back("openh264");
+#endif
+#ifdef VIDEO_DECODER_VPX
+  names.push_back("libvpx");
+#endif
+  return names;
+}
+
+/**
+* Creates an uninitialised decoder backend.
+* @param[in] name: the backend name from GetVideoDecoderNames.
+* @@Returns The decoder or null if the backend isn't compiled in.
+*/
+inline std::unique_ptr<VideoDecoder> CreateVideoDecoder(const std::string& name)
+{
+#ifdef VIDEO_DECODER_FFMPEG
+  if (name == "ffmpeg") {
+    return std::unique_ptr<VideoDecoder>(new FfmpegVideoDecoder());
+  }
+#endif
+#ifdef VIDEO_DECODER_OPENH264
+  if (name == "openh264") {
+    return std::unique_ptr<VideoDecoder>(new OpenH264VideoDecoder());
+  }
+#endif
+#ifdef VIDEO_DECODER_VPX
+  if (name == "libvpx") {
+    return std::unique_ptr<VideoDecoder>(new VpxVideoDecoder());
+  }
+#endif
+  (void)name; // Unused if no backend is compiled in.
+  return nullptr;
+}
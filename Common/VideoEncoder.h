@@ -0,0 +1,337 @@
+/******************************************************************************
+* Filename: VideoEncoder.h
+*
+* Description:
+* This header file contains a codec neutral video encoder interface so encode
+* pipelines can be run, and benchmarked, without the Media Foundation H264 MFT.
+* It keeps the same contract as the MFT used by the H264 samples:
+*  - PushFrame takes one raw I420 frame, like IMFTransform::ProcessInput.
+*  - PullAccessUnit is called until it returns false, like calling
+*    ProcessOutput until it returns MF_E_TRANSFORM_NEED_MORE_INPUT.
+*  - Drain flushes any frames the encoder is holding, like
+*    MFT_MESSAGE_COMMAND_DRAIN.
+* In addition the bitrate, frame rate and key frame interval can be changed
+* between frames and each access unit records how long its frame took to encode.
+* Reset readies an encoder for a new stream without recreating it so encoders
+* can be kept warm in a VideoEncoderPool.
+*
+* Backends that support it can use intra refresh instead of periodic key frames,
+* each frame codes a band of macroblocks as intra so the whole picture is
+* refreshed over a number of frames without the size spike of a key frame.
+* Backends can also take a QP offset for each macroblock, e.g. from a
+* MotionActivityAnalyzer, to spend fewer bits on the static background.
+*
+* The software backends are in X264VideoEncoder.h, OpenH264VideoEncoder.h and
+* VpxVideoEncoder.h and CreateVideoEncoder in VideoEncoderFactory.h creates one
+* by name.
+*
+* License: Public Domain (no warranty, use at own risk)
+/******************************************************************************/
+
+#pragma once
+
+#include "VideoCodec.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <chrono>
+#include <deque>
+#include <vector>
+
+#define VIDEO_ENCODER_CLOCK_RATE 90000  // Presentation timestamps use the same 90 kHz clock as RTP video.
+#define VIDEO_ENCODER_INTRA_REFRESH_PERIOD 30   // Frames an intra refresh takes if the key frame interval isn't set.
+#define VIDEO_ENCODER_MACROBLOCK_SIZE 16        // QP offset maps have an entry for each macroblock.
+
+/* Speed presets, each backend maps them to its own settings. Default is the real-time tuning the samples use. */
+enum class VideoEncoderPreset
+{
+  Fast,                                 // Less CPU for lower quality at the same bitrate.
+  Default,
+  Slow                                  // More CPU for better quality, may not keep up in real-time at larger frame sizes.
+};
+
+/* Gets a short display name for a preset. */
+inline const char* GetVideoEncoderPresetName(VideoEncoderPreset preset)
+{
+  switch (preset) {
+  case VideoEncoderPreset::Fast:
+    return "fast";
+  case VideoEncoderPreset::Default:
+    return "default";
+  case VideoEncoderPreset::Slow:
+    return "slow";
+  default:
+    return "unknown";
+  }
+}
+
+struct VideoEncoderConfig
+{
+  unsigned int Width = 0;
+  unsigned int Height = 0;
+  unsigned int FrameRateNum = 30;
+  unsigned int FrameRateDen = 1;
+  unsigned int BitrateKbps = 0;
+  unsigned int KeyFrameInterval = 0;    // Frames between key frames, 0 for only the first frame and explicit requests.
+  bool IntraRefresh = false;            // Refresh the picture over KeyFrameInterval frames instead of sending periodic key frames.
+  unsigned int Threads = 0;             // 0 lets the backend pick for the frame size.
+  VideoEncoderPreset Preset = VideoEncoderPreset::Default;
+};
+
+/* One encoded frame, Annex B NAL units for H264 or a single frame for VP8/VP9. */
+struct EncodedAccessUnit
+{
+  std::vector<uint8_t> Data;
+  int64_t Pts = 0;                      // In VIDEO_ENCODER_CLOCK_RATE units.
+  bool IsKeyFrame = false;
+  double EncodeMs = 0;                  // Time spent in the backend's encode call for the frame.
+};
+
+/**
+* Base class for the encoder backends. The public methods deal with the key frame
+* schedule, timing and output queue so the backends only have to wrap their
+* library's encode call. All methods must be called from the same thread.
+*/
+class VideoEncoder
+{
+public:
+  virtual ~VideoEncoder() {}
+
+  virtual const char* GetName() const = 0;
+  virtual VideoCodec GetCodec() const = 0;
+  virtual bool SupportsIntraRefresh() const = 0;
+  virtual bool SupportsQpOffsetMap() const = 0;
+
+  /**
+  * Creates the underlying encoder.
+  * @param[in] config: the frame size and initial rate settings.
+  * @@Returns true if the encoder was created.
+  */
+  bool Init(const VideoEncoderConfig& config)
+  {
+    if (config.IntraRefresh && !SupportsIntraRefresh()) {
+      printf("The %s encoder doesn't support intra refresh.\n", GetName());
+      return false;
+    }
+
+    _config = config;
+    _initialConfig = config;
+    _framesSinceKeyFrame = 0;
+    _keyFrameRequested = true;
+    _ptsOffset = 0;
+    _lastPts = -1;
+    _rebasePts = false;
+    _outputQueue.clear();
+    _qpOffsets.clear();
+    return Open(config);
+  }
+
+  /**
+  * Readies the encoder for a new stream, e.g. when it's handed back to a pool.
+  * Queued output is discarded, the rate settings go back to the ones the encoder
+  * was created with and the next frame is a key frame. The new stream's
+  * timestamps can start from anywhere, they're offset so the library still sees
+  * them increasing as its rate control depends on it.
+  * @@Returns true if the encoder was reset.
+  */
+  bool Reset()
+  {
+    _outputQueue.clear();
+    _qpOffsets.clear();
+    _keyFrameRequested = true;
+    _framesSinceKeyFrame = 0;
+    _rebasePts = (_lastPts >= 0);
+
+    return Reconfigure(_initialConfig.BitrateKbps, _initialConfig.FrameRateNum, _initialConfig.FrameRateDen,
+      _initialConfig.KeyFrameInterval);
+  }
+
+  /**
+  * Encodes a raw frame. Any access units produced are queued for PullAccessUnit.
+  * @param[in] pI420: the frame with the Y, U and V planes packed one after the other.
+  * @param[in] pts: the presentation timestamp in VIDEO_ENCODER_CLOCK_RATE units.
+  * @@Returns true if the frame was accepted.
+  */
+  bool PushFrame(const uint8_t* pI420, int64_t pts)
+  {
+    // With intra refresh the backend refreshes the picture itself, only requested key frames are sent.
+    bool keyFrame = _keyFrameRequested ||
+      (!_config.IntraRefresh && _config.KeyFrameInterval > 0 && _framesSinceKeyFrame >= _config.KeyFrameInterval);
+
+    if (_rebasePts) {
+      _ptsOffset = _lastPts + (int64_t)VIDEO_ENCODER_CLOCK_RATE * _config.FrameRateDen / _config.FrameRateNum - pts;
+      _rebasePts = false;
+    }
+
+    size_t queued = _outputQueue.size();
+    auto encodeStart = std::chrono::steady_clock::now();
+
+    if (!Encode(pI420, pts + _ptsOffset, keyFrame)) {
+      return false;
+    }
+
+    double encodeMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - encodeStart).count();
+    for (size_t i = queued; i < _outputQueue.size(); i++) {
+      _outputQueue[i].Pts -= _ptsOffset;
+      _outputQueue[i].EncodeMs = encodeMs;
+    }
+
+    _lastPts = pts + _ptsOffset;
+
+    _keyFrameRequested = false;
+    _framesSinceKeyFrame = keyFrame ? 1 : _framesSinceKeyFrame + 1;
+
+    return true;
+  }
+
+  /**
+  * Gets the next encoded access unit.
+  * @param[out] accessUnit: the oldest queued access unit.
+  * @@Returns false if there is no output and the encoder needs more input.
+  */
+  bool PullAccessUnit(EncodedAccessUnit& accessUnit)
+  {
+    if (_outputQueue.empty()) {
+      return false;
+    }
+
+    accessUnit = std::move(_outputQueue.front());
+    _outputQueue.pop_front();
+    return true;
+  }
+
+  /**
+  * Flushes any frames held by the encoder, e.g. x264 lookahead, into the output queue.
+  * @@Returns true if the encoder was drained.
+  */
+  bool Drain()
+  {
+    size_t queued = _outputQueue.size();
+    bool flushed = Flush();
+
+    for (size_t i = queued; i < _outputQueue.size(); i++) {
+      _outputQueue[i].Pts -= _ptsOffset;
+    }
+
+    return flushed;
+  }
+
+  /* Makes the next pushed frame a key frame, e.g. in response to an RTCP PLI. */
+  void RequestKeyFrame()
+  {
+    _keyFrameRequested = true;
+  }
+
+  /**
+  * Changes the rate settings, taking effect from the next pushed frame.
+  * @param[in] bitrateKbps: the new target bitrate.
+  * @param[in] frameRateNum: the new frame rate numerator.
+  * @param[in] frameRateDen: the new frame rate denominator.
+  * @param[in] keyFrameInterval: the new number of frames between key frames, 0 to disable. An intra
+  *  refresh period can't be changed, it stays at the one the encoder was created with.
+  * @@Returns true if the encoder accepted the new settings.
+  */
+  bool Reconfigure(unsigned int bitrateKbps, unsigned int frameRateNum, unsigned int frameRateDen, unsigned int keyFrameInterval)
+  {
+    if (frameRateNum == 0 || frameRateDen == 0) {
+      return false;
+    }
+
+    _config.KeyFrameInterval = keyFrameInterval;
+
+    if (bitrateKbps != _config.BitrateKbps || frameRateNum != _config.FrameRateNum || frameRateDen != _config.FrameRateDen) {
+      if (!SetRate(bitrateKbps, frameRateNum, frameRateDen)) {
+        return false;
+      }
+
+      _config.BitrateKbps = bitrateKbps;
+      _config.FrameRateNum = frameRateNum;
+      _config.FrameRateDen = frameRateDen;
+    }
+
+    return true;
+  }
+
+  /**
+  * Sets the QP offset of each macroblock for the frames pushed from now on.
+  * Positive offsets lower the quality, e.g. of the static background.
+  * @param[in] qpOffsets: an offset in H264 QP units, where +6 doubles the
+  *  quantiser step, for each macroblock row by row. Empty to remove the map.
+  * @@Returns true if the backend accepted the map.
+  */
+  bool SetQpOffsetMap(const std::vector<float>& qpOffsets)
+  {
+    size_t macroblocks = (size_t)((_config.Width + VIDEO_ENCODER_MACROBLOCK_SIZE - 1) / VIDEO_ENCODER_MACROBLOCK_SIZE) *
+      ((_config.Height + VIDEO_ENCODER_MACROBLOCK_SIZE - 1) / VIDEO_ENCODER_MACROBLOCK_SIZE);
+
+    if (!qpOffsets.empty() && !SupportsQpOffsetMap()) {
+      printf("The %s encoder doesn't support QP offset maps.\n", GetName());
+      return false;
+    }
+    else if (!qpOffsets.empty() && qpOffsets.size() != macroblocks) {
+      printf("QP offset map has %zu entries, the frame has %zu macroblocks.\n", qpOffsets.size(), macroblocks);
+      return false;
+    }
+
+    _qpOffsets = qpOffsets;
+    return true;
+  }
+
+  const VideoEncoderConfig& GetConfig() const
+  {
+    return _config;
+  }
+
+protected:
+
+  /* Creates the library encoder. Its own key frame placement should be disabled as the base class schedules them. */
+  virtual bool Open(const VideoEncoderConfig& config) = 0;
+
+  /* Encodes one frame and queues the output with QueueAccessUnit. */
+  virtual bool Encode(const uint8_t* pI420, int64_t pts, bool keyFrame) = 0;
+
+  /* Applies a new bitrate and frame rate to the library encoder. */
+  virtual bool SetRate(unsigned int bitrateKbps, unsigned int frameRateNum, unsigned int frameRateDen) = 0;
+
+  /* Queues any delayed frames. The backends here all run without lookahead so there's normally nothing to do. */
+  virtual bool Flush()
+  {
+    return true;
+  }
+
+  /**
+  * Adds an access unit to the output queue. The backend can append more data
+  * to the returned access unit, e.g. one NAL unit at a time.
+  */
+  EncodedAccessUnit& QueueAccessUnit(const uint8_t* pData, size_t length, int64_t pts, bool isKeyFrame)
+  {
+    _outputQueue.emplace_back();
+    EncodedAccessUnit& accessUnit = _outputQueue.back();
+    accessUnit.Data.assign(pData, pData + length);
+    accessUnit.Pts = pts;
+    accessUnit.IsKeyFrame = isKeyFrame;
+    return accessUnit;
+  }
+
+  /* Gets the plane pointers for a packed I420 frame. */
+  void GetI420Planes(const uint8_t* pI420, const uint8_t** ppY, const uint8_t** ppU, const uint8_t** ppV) const
+  {
+    size_t chromaSize = ((_config.Width + 1) / 2) * ((_config.Height + 1) / 2);
+    *ppY = pI420;
+    *ppU = pI420 + _config.Width * _config.Height;
+    *ppV = *ppU + chromaSize;
+  }
+
+  VideoEncoderConfig _config;
+  std::vector<float> _qpOffsets;        // Empty if there's no QP offset map.
+
+private:
+  VideoEncoderConfig _initialConfig;
+  unsigned int _framesSinceKeyFrame = 0;
+  bool _keyFrameRequested = true;
+  int64_t _ptsOffset = 0;               // Added to the stream's timestamps to keep the ones the library sees increasing across a Reset.
+  int64_t _lastPts = -1;                // The last timestamp the library saw.
+  bool _rebasePts = false;
+  std::deque<EncodedAccessUnit> _outputQueue;
+};
@@ -0,0 +1,80 @@
+/******************************************************************************
+* Filename: VideoEncoderFactory.h
+*
+* Description:
+* This header file creates VideoEncoder backends by name. A backend is only
+* compiled in if its define is set, so an application only needs the libraries
+* for the backends it uses:
+*  - VIDEO_ENCODER_X264: "x264", H264 (vcpkg install x264).
+*  - VIDEO_ENCODER_OPENH264: "openh264", H264 (vcpkg install openh264).
+*  - VIDEO_ENCODER_VPX: "libvpx-vp8" and "libvpx-vp9" (vcpkg install libvpx).
+*
+* License: Public Domain (no warranty, use at own risk)
+/******************************************************************************/
+
+#pragma once
+
+#include "VideoEncoder.h"
+
+#ifdef VIDEO_ENCODER_X264
+#include "X264VideoEncoder.h"
+#endif
+#ifdef VIDEO_ENCODER_OPENH264
+#include "OpenH264VideoEncoder.h"
+#endif
+#ifdef VIDEO_ENCODER_VPX
+#include "VpxVideoEncoder.h"
+#endif
+
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+* Gets the names of the backends compiled in.
+* @@Returns The backend names in the order they are listed above.
+*/
+inline std::vector<std::string> GetVideoEncoderNames()
+{
+  std::vector<std::string> names;
+#ifdef VIDEO_ENCODER_X264
+  names.push_back("x264");
+#endif
+#ifdef VIDEO_ENCODER_OPENH264
+  names.push_back("openh264");
+#endif
+#ifdef VIDEO_ENCODER_VPX
+  names.push_back("libvpx-vp8");
+  names.push_back("libvpx-vp9");
+#endif
+  return names;
+}
+
+/**
+* Creates an uninitialised encoder backend.
+* @param[in] name: the backend name from GetVideoEncoderNames.
+* @@Returns The encoder or null if the backend isn't compiled in.
+*/
+inline std::unique_ptr<VideoEncoder> CreateVideoEncoder(const std::string& name)
+{
+#ifdef VIDEO_ENCODER_X264
+  if (name == "x264") {
+    return std::unique_ptr<VideoEncoder>(new X264VideoEncoder());
+  }
+#endif
+#ifdef VIDEO_ENCODER_OPENH264
+  if (name == "openh264") {
+    return std::unique_ptr<VideoEncoder>(new OpenH264VideoEncoder());
+  }
+#endif
+#ifdef VIDEO_ENCODER_VPX
+  if (name == "libvpx-vp8") {
+    return std::unique_ptr<VideoEncoder>(new VpxVideoEncoder(VideoCodec::VP8));
+  }
+  if (name == "libvpx-vp9") {
+    return std::unique_ptr<VideoEncoder>(new VpxVideoEncoder(VideoCodec::VP9));
+  }
+#endif
+  (void)name; // Unused if no backend is compiled in.
+  return nullptr;
+}
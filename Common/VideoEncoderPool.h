@@ -0,0 +1,305 @@
+/******************************************************************************
+* Filename: VideoEncoderPool.h
+*
+* Description:
+* This header file contains a pool of initialised VideoEncoder instances so a
+* new viewer or recording session doesn't wait for an encoder to be created and
+* set up before its first frame. Encoders are kept per profile, the backend,
+* frame size, frame rate, preset and intra refresh mode, and leased to
+* sessions. A warm encoder only needs its bitrate and key frame interval
+* applied when it's leased and is Reset when it's returned. A background
+* thread creates replacements for leased encoders so the next session also
+* finds one waiting.
+*
+* The metrics record the hit rate and how much encoder start up time the warm
+* encoders saved, from the time it took to create each of them.
+*
+* License: Public Domain (no warranty, use at own risk)
+/******************************************************************************/
+
+#pragma once
+
+#include "VideoEncoderFactory.h"
+
+#include <stdio.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define VIDEO_ENCODER_POOL_IDLE_PER_PROFILE 1       // Warm encoders the refill thread keeps ready for each profile.
+#define VIDEO_ENCODER_POOL_MAX_IDLE_PER_PROFILE 4   // Returned encoders beyond this are destroyed.
+
+struct VideoEncoderPoolMetrics
+{
+  size_t Leases = 0;
+  size_t Hits = 0;                      // Leases given a warm encoder.
+  size_t Misses = 0;                    // Leases that had to wait for a new encoder.
+  double HitRate = 0;
+  double MeanHitLeaseMs = 0;            // Time to lease a warm encoder, including applying the session's rate settings.
+  double MeanColdStartMs = 0;           // Time to create and initialise an encoder.
+  double SavedStartMs = 0;              // Total cold start time of the warm encoders handed out.
+};
+
+class VideoEncoderPool
+{
+public:
+  VideoEncoderPool(unsigned int idlePerProfile = VIDEO_ENCODER_POOL_IDLE_PER_PROFILE) :
+    _idlePerProfile(idlePerProfile)
+  {
+    _refillThread = std::thread(&VideoEncoderPool::RefillLoop, this);
+  }
+
+  ~VideoEncoderPool()
+  {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _exit = true;
+    }
+    _refillCondition.notify_all();
+    _refillThread.join();
+  }
+
+  /**
+  * Creates warm encoders for a profile ahead of the first session that needs it.
+  * @param[in] backend: the VideoEncoder backend name.
+  * @param[in] config: the frame size, frame rate and initial rate settings.
+  * @@Returns true if the profile has its warm encoders.
+  */
+  bool Warm(const std::string& backend, const VideoEncoderConfig& config)
+  {
+    std::string key = GetProfileKey(backend, config);
+
+    while (true) {
+      {
+        std::lock_guard<std::mutex> lock(_mutex);
+        Profile& profile = AddProfile(key, backend, config);
+        if (profile.Idle.size() >= _idlePerProfile) {
+          return true;
+        }
+      }
+
+      PooledEncoder pooled;
+      if (!CreateEncoder(backend, config, pooled)) {
+        return false;
+      }
+
+      std::lock_guard<std::mutex> lock(_mutex);
+      _profiles[key].Idle.push_back(std::move(pooled));
+    }
+  }
+
+  /**
+  * Leases an encoder for a session. A warm encoder is used if the profile has
+  * one, otherwise a new one is created.
+  * @param[in] backend: the VideoEncoder backend name.
+  * @param[in] config: the session's frame size and rate settings.
+  * @@Returns The encoder, to be handed back with Return, or null if one couldn't be created.
+  */
+  std::unique_ptr<VideoEncoder> Lease(const std::string& backend, const VideoEncoderConfig& config)
+  {
+    auto leaseStart = std::chrono::steady_clock::now();
+    std::string key = GetProfileKey(backend, config);
+    PooledEncoder pooled;
+    bool hit = false;
+
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      Profile& profile = AddProfile(key, backend, config);
+      if (!profile.Idle.empty()) {
+        pooled = std::move(profile.Idle.back());
+        profile.Idle.pop_back();
+        hit = true;
+      }
+    }
+    _refillCondition.notify_one();
+
+    if (hit) {
+      if (!pooled.Encoder->Reconfigure(config.BitrateKbps, config.FrameRateNum, config.FrameRateDen, config.KeyFrameInterval)) {
+        printf("Warm %s encoder rejected the session's rate settings.\n", backend.c_str());
+        return nullptr;
+      }
+    }
+    else if (!CreateEncoder(backend, config, pooled)) {
+      return nullptr;
+    }
+
+    double leaseMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - leaseStart).count();
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    _leases++;
+    if (hit) {
+      _hits++;
+      _hitLeaseMs += leaseMs;
+      _savedStartMs += pooled.ColdStartMs;
+    }
+    _leasedColdStartMs[pooled.Encoder.get()] = pooled.ColdStartMs;
+
+    return std::move(pooled.Encoder);
+  }
+
+  /**
+  * Hands an encoder back at the end of a session. It's reset and kept for the
+  * next session unless the profile already has enough warm encoders.
+  * @param[in] encoder: the encoder from Lease.
+  */
+  void Return(std::unique_ptr<VideoEncoder> encoder)
+  {
+    if (!encoder) {
+      return;
+    }
+
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    PooledEncoder pooled;
+    pooled.ColdStartMs = _leasedColdStartMs[encoder.get()];
+    _leasedColdStartMs.erase(encoder.get());
+
+    lock.unlock();
+    if (!encoder->Reset()) {
+      return;
+    }
+    lock.lock();
+
+    std::string key = GetProfileKey(encoder->GetName(), encoder->GetConfig());
+    auto profile = _profiles.find(key);
+    if (profile != _profiles.end() && profile->second.Idle.size() < VIDEO_ENCODER_POOL_MAX_IDLE_PER_PROFILE) {
+      pooled.Encoder = std::move(encoder);
+      profile->second.Idle.push_back(std::move(pooled));
+    }
+    else {
+      // Destroy the encoder outside the lock.
+      lock.unlock();
+      encoder.reset();
+    }
+  }
+
+  VideoEncoderPoolMetrics GetMetrics()
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    VideoEncoderPoolMetrics metrics;
+    metrics.Leases = _leases;
+    metrics.Hits = _hits;
+    metrics.Misses = _leases - _hits;
+    metrics.HitRate = (_leases > 0) ? (double)_hits / _leases : 0;
+    metrics.MeanHitLeaseMs = (_hits > 0) ? _hitLeaseMs / _hits : 0;
+    metrics.MeanColdStartMs = (_coldStarts > 0) ? _coldStartMs / _coldStarts : 0;
+    metrics.SavedStartMs = _savedStartMs;
+    return metrics;
+  }
+
+private:
+
+  struct PooledEncoder
+  {
+    std::unique_ptr<VideoEncoder> Encoder;
+    double ColdStartMs = 0;
+  };
+
+  struct Profile
+  {
+    std::string Backend;
+    VideoEncoderConfig Config;
+    std::vector<PooledEncoder> Idle;
+    bool RefillFailed = false;
+  };
+
+  /* The profile key, the thread count and rate settings aren't part of it as the rate settings can be changed on a warm encoder. The preset and intra refresh are set when an encoder is created. */
+  static std::string GetProfileKey(const std::string& backend, const VideoEncoderConfig& config)
+  {
+    return backend + " " + std::to_string(config.Width) + "x" + std::to_string(config.Height) + "@" +
+      std::to_string(config.FrameRateNum) + "/" + std::to_string(config.FrameRateDen) + " " + GetVideoEncoderPresetName(config.Preset) +
+      (config.IntraRefresh ? " intra refresh" : "");
+  }
+
+  /* Adds a profile if it's new. Must be called with the lock held. */
+  Profile& AddProfile(const std::string& key, const std::string& backend, const VideoEncoderConfig& config)
+  {
+    Profile& profile = _profiles[key];
+    if (profile.Backend.empty()) {
+      profile.Backend = backend;
+      profile.Config = config;
+    }
+    return profile;
+  }
+
+  /* Creates and initialises an encoder, timing it. Must be called without the lock held. */
+  bool CreateEncoder(const std::string& backend, const VideoEncoderConfig& config, PooledEncoder& pooled)
+  {
+    auto createStart = std::chrono::steady_clock::now();
+
+    pooled.Encoder = CreateVideoEncoder(backend);
+    if (!pooled.Encoder) {
+      printf("Encoder backend %s isn't available.\n", backend.c_str());
+      return false;
+    }
+    else if (!pooled.Encoder->Init(config)) {
+      pooled.Encoder.reset();
+      return false;
+    }
+
+    pooled.ColdStartMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - createStart).count();
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    _coldStarts++;
+    _coldStartMs += pooled.ColdStartMs;
+    return true;
+  }
+
+  /* Tops up the profiles that have fewer warm encoders than the target, one encoder at a time. */
+  void RefillLoop()
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    while (!_exit) {
+      Profile* pProfile = nullptr;
+      for (auto& entry : _profiles) {
+        if (!entry.second.RefillFailed && entry.second.Idle.size() < _idlePerProfile) {
+          pProfile = &entry.second;
+          break;
+        }
+      }
+
+      if (pProfile == nullptr) {
+        _refillCondition.wait(lock);
+        continue;
+      }
+
+      std::string backend = pProfile->Backend;
+      VideoEncoderConfig config = pProfile->Config;
+
+      lock.unlock();
+      PooledEncoder pooled;
+      bool created = CreateEncoder(backend, config, pooled);
+      lock.lock();
+
+      // Profiles are never removed so the pointer is still valid.
+      if (created) {
+        pProfile->Idle.push_back(std::move(pooled));
+      }
+      else {
+        pProfile->RefillFailed = true;
+      }
+    }
+  }
+
+  unsigned int _idlePerProfile;
+  std::mutex _mutex;
+  std::condition_variable _refillCondition;
+  std::thread _refillThread;
+  bool _exit = false;
+  std::map<std::string, Profile> _profiles;
+  std::map<VideoEncoder*, double> _leasedColdStartMs;
+  size_t _leases = 0;
+  size_t _hits = 0;
+  size_t _coldStarts = 0;
+  double _hitLeaseMs = 0;
+  double _coldStartMs = 0;
+  double _savedStartMs = 0;
+};
@@ -0,0 +1,675 @@
+/******************************************************************************
+* Filename: VideoQualityMetrics.h
+*
+* Description:
+* This header file contains full reference quality metrics for comparing a
+* decoded I420 or NV12 frame with the frame that was encoded, so the quality
+* cost of a faster encoder setting can be measured rather than guessed:
+*  - PSNR of each plane and of the three planes together.
+*  - SSIM of the luma plane over 8x8 windows spaced 4 samples apart.
+*  - Optionally multi-scale SSIM (MS-SSIM) of the luma plane, the same SSIM
+*    windows over QUALITY_MS_SSIM_SCALES halvings of the frame size.
+*
+* The squared error and the SSIM window sums are vectorised with SSE2 on x64
+* builds and x86 builds with /arch:SSE2, and on x86 with AVX2 when the CPU
+* supports it (see CpuFeatures.h), with a plain C++ version for anything else. The frame is
+* split into bands of rows that are measured in parallel by the worker threads
+* of a FrameBandExecutor, either the metrics' own or one shared with other
+* kernels.
+*
+* The SSIM of each window is worked out from the sums of the samples, their
+* squares and their products over the window's four 4x4 blocks, which is the
+* same approach x264 takes. The windows aren't Gaussian weighted so the values
+* are close to, but not the same as, the reference SSIM implementation's.
+*
+* License: Public Domain (no warranty, use at own risk)
+/******************************************************************************/
+
+#pragma once
+
+#include "CpuFeatures.h"
+#include "FrameBandExecutor.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define QUALITY_METRICS_SSE2 1
+#include <emmintrin.h>
+#endif
+
+// Compiled on any x86 build and only called if the CPU supports it.
+#if defined(QUALITY_METRICS_SSE2) && defined(CPU_FEATURES_X86)
+#define QUALITY_METRICS_AVX2 1
+#include <immintrin.h>
+#endif
+
+#define QUALITY_MAX_PSNR 100.0          // Given to planes that are identical.
+#define QUALITY_SSIM_BLOCK_SIZE 4       // SSIM windows are 2x2 blocks, 8x8 samples, and start every block.
+#define QUALITY_SSIM_WINDOW_SAMPLES 64
+#define QUALITY_SSIM_C1 (0.01 * 255 * 0.01 * 255)
+#define QUALITY_SSIM_C2 (0.03 * 255 * 0.03 * 255)
+#define QUALITY_MS_SSIM_SCALES 5
+
+/* Weight of each MS-SSIM scale, from the original paper, the first is the full frame size. */
+static const double QUALITY_MS_SSIM_WEIGHTS[QUALITY_MS_SSIM_SCALES] = { 0.0448, 0.2856, 0.3001, 0.2363, 0.1333 };
+
+enum class QualityPixelFormat
+{
+  I420,                                 // Y, U and V planes.
+  NV12                                  // Y plane and an interleaved UV plane.
+};
+
+/* The planes of a frame to measure, the metrics don't take a copy. */
+struct QualityFrame
+{
+  QualityPixelFormat Format = QualityPixelFormat::I420;
+  unsigned int Width = 0;
+  unsigned int Height = 0;
+  const uint8_t* pPlanes[3] = { nullptr, nullptr, nullptr };    // NV12 only uses the first two.
+  int Strides[3] = { 0, 0, 0 };
+};
+
+struct QualityScores
+{
+  double PsnrY = 0;
+  double PsnrU = 0;
+  double PsnrV = 0;
+  double Psnr = 0;                      // From the squared error of all three planes together.
+  double Ssim = 0;                      // Luma only.
+  double MsSsim = 0;                    // Luma only, 0 unless MS-SSIM is enabled.
+};
+
+/**
+* Gets the planes of an I420 frame with no padding, e.g. from a Y4M file or a
+* VideoFrameBuffer.
+* @param[in] pData: the start of the Y plane, followed by the U and V planes.
+* @param[in] width: the frame width.
+* @param[in] height: the frame height.
+* @@Returns The frame's planes.
+*/
+inline QualityFrame GetI420QualityFrame(const uint8_t* pData, unsigned int width, unsigned int height)
+{
+  unsigned int chromaWidth = (width + 1) / 2, chromaHeight = (height + 1) / 2;
+  QualityFrame frame;
+
+  frame.Format = QualityPixelFormat::I420;
+  frame.Width = width;
+  frame.Height = height;
+  frame.pPlanes[0] = pData;
+  frame.pPlanes[1] = pData + (size_t)width * height;
+  frame.pPlanes[2] = frame.pPlanes[1] + (size_t)chromaWidth * chromaHeight;
+  frame.Strides[0] = width;
+  frame.Strides[1] = chromaWidth;
+  frame.Strides[2] = chromaWidth;
+  return frame;
+}
+
+/**
+* Gets the planes of an NV12 frame with no padding, e.g. from a Media Foundation
+* sample buffer.
+* @param[in] pData: the start of the Y plane, followed by the UV plane.
+* @param[in] width: the frame width.
+* @param[in] height: the frame height.
+* @@Returns The frame's planes.
+*/
+inline QualityFrame GetNV12QualityFrame(const uint8_t* pData, unsigned int width, unsigned int height)
+{
+  QualityFrame frame;
+
+  frame.Format = QualityPixelFormat::NV12;
+  frame.Width = width;
+  frame.Height = height;
+  frame.pPlanes[0] = pData;
+  frame.pPlanes[1] = pData + (size_t)width * height;
+  frame.Strides[0] = width;
+  frame.Strides[1] = ((width + 1) / 2) * 2;
+  return frame;
+}
+
+class VideoQualityMetrics
+{
+public:
+  /**
+  * @param[in] threads: the threads to measure with, including the caller's, 0
+  *  for one per core.
+  * @param[in] msSsim: true to also measure MS-SSIM, which takes about a third as
+  *  long again as the rest.
+  */
+  VideoQualityMetrics(unsigned int threads = 0, bool msSsim = false) :
+    _ownExecutor(new FrameBandExecutor(threads)),
+    _executor(*_ownExecutor),
+    _msSsim(msSsim)
+  { }
+
+  /**
+  * @param[in] executor: the executor to measure with, e.g. one shared with the
+  *  colour conversion and scaling, it has to outlive the metrics.
+  * @param[in] msSsim: true to also measure MS-SSIM.
+  */
+  VideoQualityMetrics(FrameBandExecutor& executor, bool msSsim = false) :
+    _executor(executor),
+    _msSsim(msSsim)
+  { }
+
+  /**
+  * Measures a frame against its reference and adds its scores to the means.
+  * @param[in] reference: the frame that was encoded.
+  * @param[in] distorted: the decoded frame, the same size and format as the reference.
+  * @param[out] scores: the frame's scores.
+  * @@Returns true if the frames could be compared.
+  */
+  bool Measure(const QualityFrame& reference, const QualityFrame& distorted, QualityScores& scores)
+  {
+    if (reference.Width != distorted.Width || reference.Height != distorted.Height || reference.Format != distorted.Format) {
+      printf("Quality metrics need frames of the same size and format, got %ux%u and %ux%u.\n",
+        reference.Width, reference.Height, distorted.Width, distorted.Height);
+      return false;
+    }
+    else if (reference.Width == 0 || reference.Height == 0 || reference.pPlanes[0] == nullptr || distorted.pPlanes[0] == nullptr) {
+      printf("Quality metrics were given an empty frame.\n");
+      return false;
+    }
+
+    unsigned int width = reference.Width, height = reference.Height;
+    unsigned int chromaWidth = (width + 1) / 2, chromaHeight = (height + 1) / 2;
+    unsigned int blockRows = height / QUALITY_SSIM_BLOCK_SIZE;
+    unsigned int windowRows = (blockRows > 1) ? blockRows - 1 : 0;
+    bool isNV12 = reference.Format == QualityPixelFormat::NV12;
+
+    // Bands are whole block rows, the luma rows of a block row and the chroma rows under them.
+    unsigned int groups = (height + QUALITY_SSIM_BLOCK_SIZE - 1) / QUALITY_SSIM_BLOCK_SIZE;
+    unsigned int bands = GetBandCount(width, height);
+    std::vector<BandSums>& sums = _bandSums;
+    sums.assign(bands, BandSums());
+
+    _executor.RunBands(bands, [&](unsigned int band, unsigned int) {
+      unsigned int firstGroup = groups * band / bands, endGroup = groups * (band + 1) / bands;
+      BandSums& bandSums = sums[band];
+      uint64_t even = 0, odd = 0;
+
+      for (unsigned int y = firstGroup * QUALITY_SSIM_BLOCK_SIZE; y < std::min(endGroup * QUALITY_SSIM_BLOCK_SIZE, height); y++) {
+        GetRowSse(reference.pPlanes[0] + (size_t)y * reference.Strides[0], distorted.pPlanes[0] + (size_t)y * distorted.Strides[0],
+          width, even, odd);
+      }
+      bandSums.Sse[0] = even + odd;
+
+      for (unsigned int y = firstGroup * QUALITY_SSIM_BLOCK_SIZE / 2; y < std::min(endGroup * QUALITY_SSIM_BLOCK_SIZE / 2, chromaHeight); y++) {
+        if (isNV12) {
+          // The even bytes are U and the odd ones V.
+          GetRowSse(reference.pPlanes[1] + (size_t)y * reference.Strides[1], distorted.pPlanes[1] + (size_t)y * distorted.Strides[1],
+            chromaWidth * 2, bandSums.Sse[1], bandSums.Sse[2]);
+        }
+        else {
+          for (int plane = 1; plane < 3; plane++) {
+            even = odd = 0;
+            GetRowSse(reference.pPlanes[plane] + (size_t)y * reference.Strides[plane],
+              distorted.pPlanes[plane] + (size_t)y * distorted.Strides[plane], chromaWidth, even, odd);
+            bandSums.Sse[plane] += even + odd;
+          }
+        }
+      }
+
+      AddSsimWindows(reference.pPlanes[0], reference.Strides[0], distorted.pPlanes[0], distorted.Strides[0], width,
+        firstGroup, std::min(endGroup, windowRows), bandSums);
+    });
+
+    BandSums total;
+    for (const BandSums& bandSums : sums) {
+      total.Add(bandSums);
+    }
+
+    uint64_t lumaSamples = (uint64_t)width * height, chromaSamples = (uint64_t)chromaWidth * chromaHeight;
+
+    scores.PsnrY = GetPsnr(total.Sse[0], lumaSamples);
+    scores.PsnrU = GetPsnr(total.Sse[1], chromaSamples);
+    scores.PsnrV = GetPsnr(total.Sse[2], chromaSamples);
+    scores.Psnr = GetPsnr(total.Sse[0] + total.Sse[1] + total.Sse[2], lumaSamples + 2 * chromaSamples);
+    scores.Ssim = (total.Windows > 0) ? total.Ssim / total.Windows : 1;
+    scores.MsSsim = _msSsim ? GetMsSsim(reference, distorted, total) : 0;
+
+    _frames++;
+    _totals.PsnrY += scores.PsnrY;
+    _totals.PsnrU += scores.PsnrU;
+    _totals.PsnrV += scores.PsnrV;
+    _totals.Psnr += scores.Psnr;
+    _totals.Ssim += scores.Ssim;
+    _totals.MsSsim += scores.MsSsim;
+
+    return true;
+  }
+
+  /* The mean of each score over the frames measured since the last Reset. */
+  QualityScores GetMeanScores() const
+  {
+    QualityScores mean;
+    if (_frames > 0) {
+      mean.PsnrY = _totals.PsnrY / _frames;
+      mean.PsnrU = _totals.PsnrU / _frames;
+      mean.PsnrV = _totals.PsnrV / _frames;
+      mean.Psnr = _totals.Psnr / _frames;
+      mean.Ssim = _totals.Ssim / _frames;
+      mean.MsSsim = _totals.MsSsim / _frames;
+    }
+    return mean;
+  }
+
+  size_t GetFrameCount() const
+  {
+    return _frames;
+  }
+
+  /* Clears the means, e.g. between the runs of a benchmark. */
+  void Reset()
+  {
+    _frames = 0;
+    _totals = QualityScores();
+  }
+
+private:
+
+  /* Totals for one band of rows. */
+  struct BandSums
+  {
+    uint64_t Sse[3] = { 0, 0, 0 };      // Squared error of each plane.
+    double Ssim = 0;                    // Sum of the SSIM of each window.
+    double ContrastStructure = 0;       // Sum of the SSIM of each window without its luminance term, for MS-SSIM.
+    size_t Windows = 0;
+
+    void Add(const BandSums& other)
+    {
+      for (int plane = 0; plane < 3; plane++) {
+        Sse[plane] += other.Sse[plane];
+      }
+      Ssim += other.Ssim;
+      ContrastStructure += other.ContrastStructure;
+      Windows += other.Windows;
+    }
+  };
+
+  /* The sums over each 4x4 block of one row of blocks, kept as separate arrays so they can be stored a vector at a time. */
+  struct SsimBlockRow
+  {
+    std::vector<uint32_t> SumA;
+    std::vector<uint32_t> SumB;
+    std::vector<uint32_t> Squares;      // Sum of the squares of both frames' samples.
+    std::vector<uint32_t> Products;
+
+    void Resize(size_t blocks)
+    {
+      SumA.resize(blocks);
+      SumB.resize(blocks);
+      Squares.resize(blocks);
+      Products.resize(blocks);
+    }
+  };
+
+  static double GetPsnr(uint64_t sse, uint64_t samples)
+  {
+    if (sse == 0) {
+      return QUALITY_MAX_PSNR;
+    }
+    return std::min(QUALITY_MAX_PSNR, 10 * std::log10(255.0 * 255.0 * samples / sse));
+  }
+
+  /**
+  * Adds the squared error of one row of samples, keeping the even and odd
+  * samples apart so the U and V samples of an NV12 row can be separated.
+  * @param[in] pA: the reference row.
+  * @param[in] pB: the row to measure.
+  * @param[in] length: the samples in the row.
+  * @param[in,out] even: the squared error of the even samples is added to this.
+  * @param[in,out] odd: the squared error of the odd samples is added to this.
+  */
+  static void GetRowSse(const uint8_t* pA, const uint8_t* pB, unsigned int length, uint64_t& even, uint64_t& odd)
+  {
+    unsigned int x = 0;
+
+    // Each 32 bit lane gains at most 2 * 255^2 a step so a row can't overflow it.
+#ifdef QUALITY_METRICS_AVX2
+    if (GetCpuFeatures().Avx2) {
+      x = GetRowSseAvx2(pA, pB, length, even, odd);
+    }
+#endif
+
+#ifdef QUALITY_METRICS_SSE2
+    __m128i lowBytes = _mm_set1_epi16(0x00FF);
+    __m128i evenSums = _mm_setzero_si128(), oddSums = _mm_setzero_si128();
+    for (; x + 16 <= length; x += 16) {
+      __m128i a = _mm_loadu_si128((const __m128i*)(pA + x));
+      __m128i b = _mm_loadu_si128((const __m128i*)(pB + x));
+      __m128i evenDiff = _mm_sub_epi16(_mm_and_si128(a, lowBytes), _mm_and_si128(b, lowBytes));
+      __m128i oddDiff = _mm_sub_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8));
+      evenSums = _mm_add_epi32(evenSums, _mm_madd_epi16(evenDiff, evenDiff));
+      oddSums = _mm_add_epi32(oddSums, _mm_madd_epi16(oddDiff, oddDiff));
+    }
+    even += SumLanes(evenSums);
+    odd += SumLanes(oddSums);
+#endif
+
+    for (; x < length; x++) {
+      int difference = pA[x] - pB[x];
+      ((x & 1) ? odd : even) += difference * difference;
+    }
+  }
+
+#ifdef QUALITY_METRICS_SSE2
+  /* Adds the four unsigned 32 bit lanes of a register. */
+  static uint64_t SumLanes(__m128i lanes)
+  {
+    uint32_t values[4];
+    _mm_storeu_si128((__m128i*)values, lanes);
+    return (uint64_t)values[0] + values[1] + values[2] + values[3];
+  }
+
+  /* Adds the neighbouring pairs of 32 bit lanes of two registers, giving the sums of four 4 sample blocks in order. */
+  static __m128i AddPairs(__m128i low, __m128i high)
+  {
+    __m128 evenLanes = _mm_shuffle_ps(_mm_castsi128_ps(low), _mm_castsi128_ps(high), _MM_SHUFFLE(2, 0, 2, 0));
+    __m128 oddLanes = _mm_shuffle_ps(_mm_castsi128_ps(low), _mm_castsi128_ps(high), _MM_SHUFFLE(3, 1, 3, 1));
+    return _mm_add_epi32(_mm_castps_si128(evenLanes), _mm_castps_si128(oddLanes));
+  }
+#endif
+
+#ifdef QUALITY_METRICS_AVX2
+  /* The AVX2 part of GetRowSse, 32 samples at a time, returning the samples measured. */
+  CPU_TARGET_AVX2 static unsigned int GetRowSseAvx2(const uint8_t* pA, const uint8_t* pB, unsigned int length, uint64_t& even, uint64_t& odd)
+  {
+    unsigned int x = 0;
+
+    __m256i lowBytes256 = _mm256_set1_epi16(0x00FF);
+    __m256i evenSums256 = _mm256_setzero_si256(), oddSums256 = _mm256_setzero_si256();
+    for (; x + 32 <= length; x += 32) {
+      __m256i a = _mm256_loadu_si256((const __m256i*)(pA + x));
+      __m256i b = _mm256_loadu_si256((const __m256i*)(pB + x));
+      __m256i evenDiff = _mm256_sub_epi16(_mm256_and_si256(a, lowBytes256), _mm256_and_si256(b, lowBytes256));
+      __m256i oddDiff = _mm256_sub_epi16(_mm256_srli_epi16(a, 8), _mm256_srli_epi16(b, 8));
+      evenSums256 = _mm256_add_epi32(evenSums256, _mm256_madd_epi16(evenDiff, evenDiff));
+      oddSums256 = _mm256_add_epi32(oddSums256, _mm256_madd_epi16(oddDiff, oddDiff));
+    }
+    even += SumLanes(_mm256_castsi256_si128(evenSums256)) + SumLanes(_mm256_extracti128_si256(evenSums256, 1));
+    odd += SumLanes(_mm256_castsi256_si128(oddSums256)) + SumLanes(_mm256_extracti128_si256(oddSums256, 1));
+
+    return x;
+  }
+
+  CPU_TARGET_AVX2 static __m256i AddPairs(__m256i low, __m256i high)
+  {
+    __m256 evenLanes = _mm256_shuffle_ps(_mm256_castsi256_ps(low), _mm256_castsi256_ps(high), _MM_SHUFFLE(2, 0, 2, 0));
+    __m256 oddLanes = _mm256_shuffle_ps(_mm256_castsi256_ps(low), _mm256_castsi256_ps(high), _MM_SHUFFLE(3, 1, 3, 1));
+    return _mm256_add_epi32(_mm256_castps_si256(evenLanes), _mm256_castps_si256(oddLanes));
+  }
+
+  /* The AVX2 part of GetSsimBlockRow, 8 blocks at a time, returning the blocks measured. */
+  CPU_TARGET_AVX2 static unsigned int GetSsimBlockRowAvx2(const uint8_t* pA, int strideA, const uint8_t* pB, int strideB, unsigned int blocks, SsimBlockRow& row)
+  {
+    unsigned int bx = 0;
+
+    __m256i zero256 = _mm256_setzero_si256(), ones256 = _mm256_set1_epi16(1);
+    for (; bx + 8 <= blocks; bx += 8) {
+      __m256i sumA[2] = { zero256, zero256 }, sumB[2] = { zero256, zero256 };
+      __m256i squares[2] = { zero256, zero256 }, products[2] = { zero256, zero256 };
+
+      for (int y = 0; y < QUALITY_SSIM_BLOCK_SIZE; y++) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(pA + (size_t)y * strideA + bx * QUALITY_SSIM_BLOCK_SIZE));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(pB + (size_t)y * strideB + bx * QUALITY_SSIM_BLOCK_SIZE));
+        __m256i wideA[2] = { _mm256_unpacklo_epi8(a, zero256), _mm256_unpackhi_epi8(a, zero256) };
+        __m256i wideB[2] = { _mm256_unpacklo_epi8(b, zero256), _mm256_unpackhi_epi8(b, zero256) };
+
+        for (int half = 0; half < 2; half++) {
+          sumA[half] = _mm256_add_epi16(sumA[half], wideA[half]);
+          sumB[half] = _mm256_add_epi16(sumB[half], wideB[half]);
+          squares[half] = _mm256_add_epi32(squares[half],
+            _mm256_add_epi32(_mm256_madd_epi16(wideA[half], wideA[half]), _mm256_madd_epi16(wideB[half], wideB[half])));
+          products[half] = _mm256_add_epi32(products[half], _mm256_madd_epi16(wideA[half], wideB[half]));
+        }
+      }
+
+      _mm256_storeu_si256((__m256i*)(row.SumA.data() + bx),
+        AddPairs(_mm256_madd_epi16(sumA[0], ones256), _mm256_madd_epi16(sumA[1], ones256)));
+      _mm256_storeu_si256((__m256i*)(row.SumB.data() + bx),
+        AddPairs(_mm256_madd_epi16(sumB[0], ones256), _mm256_madd_epi16(sumB[1], ones256)));
+      _mm256_storeu_si256((__m256i*)(row.Squares.data() + bx), AddPairs(squares[0], squares[1]));
+      _mm256_storeu_si256((__m256i*)(row.Products.data() + bx), AddPairs(products[0], products[1]));
+    }
+
+    return bx;
+  }
+#endif
+
+  /**
+  * Gets the sums over each 4x4 block of a row of blocks.
+  * @param[in] pA: the top left sample of the row of blocks in the reference.
+  * @param[in] strideA: the bytes between the reference's rows.
+  * @param[in] pB: the top left sample of the row of blocks in the frame to measure.
+  * @param[in] strideB: the bytes between its rows.
+  * @param[in] blocks: the blocks in the row.
+  * @param[out] row: the sums for each block.
+  */
+  static void GetSsimBlockRow(const uint8_t* pA, int strideA, const uint8_t* pB, int strideB, unsigned int blocks, SsimBlockRow& row)
+  {
+    unsigned int bx = 0;
+
+    // Samples are widened to 16 bits and each vector covers four, or eight for AVX2, blocks. The madd
+    // instructions add neighbouring pairs and AddPairs the two pairs in each block. Unpacking
+    // works within each 128 bit lane so for AVX2 the low register has samples 0-7 and 16-23.
+#ifdef QUALITY_METRICS_AVX2
+    if (GetCpuFeatures().Avx2) {
+      bx = GetSsimBlockRowAvx2(pA, strideA, pB, strideB, blocks, row);
+    }
+#endif
+
+#ifdef QUALITY_METRICS_SSE2
+    __m128i zero = _mm_setzero_si128(), ones = _mm_set1_epi16(1);
+    for (; bx + 4 <= blocks; bx += 4) {
+      __m128i sumA[2] = { zero, zero }, sumB[2] = { zero, zero };
+      __m128i squares[2] = { zero, zero }, products[2] = { zero, zero };
+
+      for (int y = 0; y < QUALITY_SSIM_BLOCK_SIZE; y++) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(pA + (size_t)y * strideA + bx * QUALITY_SSIM_BLOCK_SIZE));
+        __m128i b = _mm_loadu_si128((const __m128i*)(pB + (size_t)y * strideB + bx * QUALITY_SSIM_BLOCK_SIZE));
+        __m128i wideA[2] = { _mm_unpacklo_epi8(a, zero), _mm_unpackhi_epi8(a, zero) };
+        __m128i wideB[2] = { _mm_unpacklo_epi8(b, zero), _mm_unpackhi_epi8(b, zero) };
+
+        for (int half = 0; half < 2; half++) {
+          sumA[half] = _mm_add_epi16(sumA[half], wideA[half]);
+          sumB[half] = _mm_add_epi16(sumB[half], wideB[half]);
+          squares[half] = _mm_add_epi32(squares[half],
+            _mm_add_epi32(_mm_madd_epi16(wideA[half], wideA[half]), _mm_madd_epi16(wideB[half], wideB[half])));
+          products[half] = _mm_add_epi32(products[half], _mm_madd_epi16(wideA[half], wideB[half]));
+        }
+      }
+
+      _mm_storeu_si128((__m128i*)(row.SumA.data() + bx), AddPairs(_mm_madd_epi16(sumA[0], ones), _mm_madd_epi16(sumA[1], ones)));
+      _mm_storeu_si128((__m128i*)(row.SumB.data() + bx), AddPairs(_mm_madd_epi16(sumB[0], ones), _mm_madd_epi16(sumB[1], ones)));
+      _mm_storeu_si128((__m128i*)(row.Squares.data() + bx), AddPairs(squares[0], squares[1]));
+      _mm_storeu_si128((__m128i*)(row.Products.data() + bx), AddPairs(products[0], products[1]));
+    }
+#endif
+
+    for (; bx < blocks; bx++) {
+      uint32_t sumA = 0, sumB = 0, squares = 0, products = 0;
+
+      for (int y = 0; y < QUALITY_SSIM_BLOCK_SIZE; y++) {
+        const uint8_t* pRowA = pA + (size_t)y * strideA + bx * QUALITY_SSIM_BLOCK_SIZE;
+        const uint8_t* pRowB = pB + (size_t)y * strideB + bx * QUALITY_SSIM_BLOCK_SIZE;
+
+        for (int x = 0; x < QUALITY_SSIM_BLOCK_SIZE; x++) {
+          sumA += pRowA[x];
+          sumB += pRowB[x];
+          squares += pRowA[x] * pRowA[x] + pRowB[x] * pRowB[x];
+          products += pRowA[x] * pRowB[x];
+        }
+      }
+
+      row.SumA[bx] = sumA;
+      row.SumB[bx] = sumB;
+      row.Squares[bx] = squares;
+      row.Products[bx] = products;
+    }
+  }
+
+  /**
+  * Adds the SSIM of each 8x8 window that starts in a range of block rows of a plane.
+  * @param[in] pA: the reference plane.
+  * @param[in] strideA: the bytes between the reference's rows.
+  * @param[in] pB: the plane to measure.
+  * @param[in] strideB: the bytes between its rows.
+  * @param[in] width: the plane width.
+  * @param[in] firstRow: the first block row a window starts in.
+  * @param[in] endRow: the block row after the last one a window starts in, the
+  *  windows starting in it need the block row below it.
+  * @param[in,out] sums: the SSIM and window count are added to this.
+  */
+  static void AddSsimWindows(const uint8_t* pA, int strideA, const uint8_t* pB, int strideB, unsigned int width,
+    unsigned int firstRow, unsigned int endRow, BandSums& sums)
+  {
+    unsigned int blocks = width / QUALITY_SSIM_BLOCK_SIZE;
+    if (blocks < 2 || firstRow >= endRow) {
+      return;
+    }
+
+    SsimBlockRow rows[2];
+    rows[0].Resize(blocks);
+    rows[1].Resize(blocks);
+
+    auto getBlockRow = [&](unsigned int blockRow, SsimBlockRow& row) {
+      size_t top = (size_t)blockRow * QUALITY_SSIM_BLOCK_SIZE;
+      GetSsimBlockRow(pA + top * strideA, strideA, pB + top * strideB, strideB, blocks, row);
+    };
+
+    getBlockRow(firstRow, rows[0]);
+
+    for (unsigned int blockRow = firstRow; blockRow < endRow; blockRow++) {
+      const SsimBlockRow& above = rows[(blockRow - firstRow) & 1];
+      SsimBlockRow& below = rows[(blockRow - firstRow + 1) & 1];
+      getBlockRow(blockRow + 1, below);
+
+      for (unsigned int bx = 0; bx + 1 < blocks; bx++) {
+        double sumA = above.SumA[bx] + above.SumA[bx + 1] + below.SumA[bx] + below.SumA[bx + 1];
+        double sumB = above.SumB[bx] + above.SumB[bx + 1] + below.SumB[bx] + below.SumB[bx + 1];
+        double squares = (double)above.Squares[bx] + above.Squares[bx + 1] + below.Squares[bx] + below.Squares[bx + 1];
+        double products = (double)above.Products[bx] + above.Products[bx + 1] + below.Products[bx] + below.Products[bx + 1];
+
+        double meanA = sumA / QUALITY_SSIM_WINDOW_SAMPLES, meanB = sumB / QUALITY_SSIM_WINDOW_SAMPLES;
+        double variances = squares / QUALITY_SSIM_WINDOW_SAMPLES - meanA * meanA - meanB * meanB;
+        double covariance = products / QUALITY_SSIM_WINDOW_SAMPLES - meanA * meanB;
+
+        double luminance = (2 * meanA * meanB + QUALITY_SSIM_C1) / (meanA * meanA + meanB * meanB + QUALITY_SSIM_C1);
+        double contrastStructure = (2 * covariance + QUALITY_SSIM_C2) / (variances + QUALITY_SSIM_C2);
+
+        sums.Ssim += luminance * contrastStructure;
+        sums.ContrastStructure += contrastStructure;
+        sums.Windows++;
+      }
+    }
+  }
+
+  /**
+  * Gets the MS-SSIM of the luma planes. Scales stop once a plane is too small
+  * for two rows and columns of windows and the weights of the scales used are
+  * normalised.
+  * @param[in] reference: the frame that was encoded.
+  * @param[in] distorted: the decoded frame.
+  * @param[in] fullSize: the sums already measured at the full frame size.
+  * @@Returns The MS-SSIM.
+  */
+  double GetMsSsim(const QualityFrame& reference, const QualityFrame& distorted, const BandSums& fullSize)
+  {
+    double scaleContrastStructure[QUALITY_MS_SSIM_SCALES] = { 0 };
+    double lastSsim = (fullSize.Windows > 0) ? fullSize.Ssim / fullSize.Windows : 1;
+    int scales = 1;
+
+    scaleContrastStructure[0] = (fullSize.Windows > 0) ? fullSize.ContrastStructure / fullSize.Windows : 1;
+
+    const uint8_t* pA = reference.pPlanes[0];
+    const uint8_t* pB = distorted.pPlanes[0];
+    int strideA = reference.Strides[0], strideB = distorted.Strides[0];
+    unsigned int width = reference.Width, height = reference.Height;
+
+    for (; scales < QUALITY_MS_SSIM_SCALES; scales++) {
+      unsigned int scaledWidth = width / 2, scaledHeight = height / 2;
+      if (scaledWidth < 3 * QUALITY_SSIM_BLOCK_SIZE || scaledHeight < 3 * QUALITY_SSIM_BLOCK_SIZE) {
+        break;
+      }
+
+      std::vector<uint8_t>& scaledA = _scaledReference[scales];
+      std::vector<uint8_t>& scaledB = _scaledDistorted[scales];
+      scaledA.resize((size_t)scaledWidth * scaledHeight);
+      scaledB.resize((size_t)scaledWidth * scaledHeight);
+
+      unsigned int bands = GetBandCount(scaledWidth, scaledHeight);
+      _executor.RunBands(bands, [&](unsigned int band, unsigned int) {
+        for (unsigned int y = scaledHeight * band / bands; y < scaledHeight * (band + 1) / bands; y++) {
+          Downsample(pA + (size_t)y * 2 * strideA, strideA, scaledA.data() + (size_t)y * scaledWidth, scaledWidth);
+          Downsample(pB + (size_t)y * 2 * strideB, strideB, scaledB.data() + (size_t)y * scaledWidth, scaledWidth);
+        }
+      });
+
+      pA = scaledA.data();
+      pB = scaledB.data();
+      strideA = strideB = scaledWidth;
+      width = scaledWidth;
+      height = scaledHeight;
+
+      unsigned int windowRows = height / QUALITY_SSIM_BLOCK_SIZE - 1;
+      std::vector<BandSums>& sums = _bandSums;
+      sums.assign(bands, BandSums());
+      _executor.RunBands(bands, [&](unsigned int band, unsigned int) {
+        AddSsimWindows(pA, strideA, pB, strideB, width, windowRows * band / bands, windowRows * (band + 1) / bands, sums[band]);
+      });
+
+      BandSums total;
+      for (const BandSums& bandSums : sums) {
+        total.Add(bandSums);
+      }
+
+      scaleContrastStructure[scales] = total.ContrastStructure / total.Windows;
+      lastSsim = total.Ssim / total.Windows;
+    }
+
+    // The coarsest scale uses the full SSIM, with its luminance term, and the others only the contrast and structure.
+    double totalWeight = 0;
+    for (int scale = 0; scale < scales; scale++) {
+      totalWeight += QUALITY_MS_SSIM_WEIGHTS[scale];
+    }
+
+    double msSsim = 1;
+    for (int scale = 0; scale < scales; scale++) {
+      double value = (scale == scales - 1) ? lastSsim : scaleContrastStructure[scale];
+      msSsim *= std::pow(std::max(value, 0.0), QUALITY_MS_SSIM_WEIGHTS[scale] / totalWeight);
+    }
+
+    return msSsim;
+  }
+
+  /* Halves a pair of rows to one with the rounded mean of each 2x2 square. */
+  static void Downsample(const uint8_t* pSource, int stride, uint8_t* pDestination, unsigned int width)
+  {
+    const uint8_t* pBelow = pSource + stride;
+    for (unsigned int x = 0; x < width; x++) {
+      pDestination[x] = (uint8_t)((pSource[2 * x] + pSource[2 * x + 1] + pBelow[2 * x] + pBelow[2 * x + 1] + 2) / 4);
+    }
+  }
+
+  /* Bands for a plane, whole block rows sized to fit in the cache, the two frames are read at full size. */
+  unsigned int GetBandCount(unsigned int width, unsigned int height) const
+  {
+    return _executor.GetBandCount(height, (size_t)width * 2, QUALITY_SSIM_BLOCK_SIZE);
+  }
+
+  std::unique_ptr<FrameBandExecutor> _ownExecutor;   // Only if the executor wasn't given to the constructor.
+  FrameBandExecutor& _executor;
+  bool _msSsim;
+  std::vector<uint8_t> _scaledReference[QUALITY_MS_SSIM_SCALES];    // Downsampled luma for each MS-SSIM scale, the first isn't used.
+  std::vector<uint8_t> _scaledDistorted[QUALITY_MS_SSIM_SCALES];
+  QualityScores _totals;
+  size_t _frames = 0;
+
+  std::vector<BandSums> _bandSums;     // Reused each frame so measuring doesn't allocate.
+};
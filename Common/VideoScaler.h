@@ -0,0 +1,795 @@
+/******************************************************************************
+* Filename: VideoScaler.h
+*
+* Description:
+* This header file contains a video scaler for I420, NV12 and RGB32/BGRA frames,
+* so the samples can produce simulcast layers, thumbnails and adaptation steps
+* at any size rather than only the sizes a webcam offers. It replaces the box
+* filter in I420Scaler.h where the quality matters.
+*
+* There are three filters:
+*  - Bilinear: a triangle filter over the two nearest samples, widened to cover
+*    all the source samples under each output sample when scaling down so it
+*    doesn't alias.
+*  - Bicubic: a Catmull-Rom cubic over the four nearest samples, widened in the
+*    same way, which is sharper than bilinear.
+*  - Area: each output sample is the mean of the source area it covers, the
+*    same as I420Scaler.h but with fractional coverage at the edges.
+*
+* The source can be cropped, to a fractional rectangle if need be, and the
+* picture either stretched to the destination, fitted inside it with black bars
+* (letterbox or pillarbox) or cropped to the destination's aspect ratio, so one
+* pass produces an encoder's input.
+*
+* Each axis has a table with the first source sample and the 14 bit fixed
+* point weights for each output sample, worked out once when the sizes change.
+* Each output row is filtered vertically from the source rows into a 16 bit
+* row with 6 more fraction bits, then horizontally into the destination. Both
+* passes are vectorised with SSE2 on x64 builds and x86 builds with /arch:SSE2,
+* and on x86 with AVX2 when the CPU supports it (see CpuFeatures.h), and the
+* plain C++ version gives exactly the same output.
+*
+* License: Public Domain (no warranty, use at own risk)
+/******************************************************************************/
+
+#pragma once
+
+#include "ColourConverter.h"
+#include "CpuFeatures.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define VIDEO_SCALER_SSE2 1
+#include <emmintrin.h>
+#endif
+
+// Compiled on any x86 build and only called if the CPU supports it.
+#if defined(VIDEO_SCALER_SSE2) && defined(CPU_FEATURES_X86)
+#define VIDEO_SCALER_AVX2 1
+#include <immintrin.h>
+#endif
+
+#define SCALER_WEIGHT_BITS 14           // Fixed point fraction bits of the filter weights.
+#define SCALER_INTERMEDIATE_BITS 6      // Fraction bits kept between the vertical and horizontal passes.
+#define SCALER_CUBIC_A -0.5             // Catmull-Rom.
+#define SCALER_BLACK_LUMA 16            // Limited range black for letterbox bars.
+#define SCALER_BLACK_CHROMA 128
+
+enum class ScaleFilter
+{
+  Bilinear,
+  Bicubic,
+  Area
+};
+
+enum class ScaleFit
+{
+  Stretch,                              // Fill the destination, the aspect ratio can change.
+  Letterbox,                            // Fit inside the destination with black bars above and below or to the sides.
+  Crop                                  // Fill the destination, cropping the source to the destination's aspect ratio.
+};
+
+struct ScaleRect
+{
+  unsigned int Left = 0;
+  unsigned int Top = 0;
+  unsigned int Width = 0;               // 0 for the whole image.
+  unsigned int Height = 0;
+};
+
+/* The source samples and their weights for each output sample along one axis. */
+struct ScaleFilterTable
+{
+  unsigned int Taps = 0;                // Weights for each output sample, some can be 0.
+  std::vector<int> Offsets;             // The first source sample for each output sample.
+  std::vector<int16_t> Weights;         // Taps weights for each output sample, each set adds up to 1 << SCALER_WEIGHT_BITS.
+};
+
+/* The filter's weight for a source sample a distance away, in output samples, from the output sample. */
+inline double GetScaleFilterWeight(ScaleFilter filter, double distance)
+{
+  double x = fabs(distance);
+
+  if (filter == ScaleFilter::Bicubic) {
+    double a = SCALER_CUBIC_A;
+    if (x < 1) {
+      return ((a + 2) * x - (a + 3)) * x * x + 1;
+    }
+    else if (x < 2) {
+      return ((a * x - 5 * a) * x + 8 * a) * x - 4 * a;
+    }
+    return 0;
+  }
+
+  return (x < 1) ? 1 - x : 0;
+}
+
+/**
+* Works out the filter table for one axis. Source samples past the edges are
+* replaced by the edge sample.
+* @param[in] filter: the filter.
+* @param[in] sourceStart: where the cropped source starts, in source samples.
+* @param[in] sourceLength: the length of the cropped source, in source samples.
+* @param[in] sourceSize: the number of samples along the source's axis.
+* @param[in] destinationSize: the number of output samples.
+* @param[in] tapAlignment: the taps are rounded up to a multiple of this.
+* @@Returns The table.
+*/
+inline ScaleFilterTable GetScaleFilterTable(ScaleFilter filter, double sourceStart, double sourceLength, unsigned int sourceSize,
+  unsigned int destinationSize, unsigned int tapAlignment)
+{
+  double scale = sourceLength / destinationSize;
+  double filterScale = std::max(scale, 1.0);
+  double support = ((filter == ScaleFilter::Bicubic) ? 2.0 : 1.0) * filterScale;
+  std::vector<std::vector<double>> weights(destinationSize);
+  std::vector<int> offsets(destinationSize);
+  unsigned int taps = 1;
+
+  for (unsigned int i = 0; i < destinationSize; i++) {
+    std::vector<double> sampleWeights(sourceSize, 0);
+    int first = 0, last = 0;
+
+    if (filter == ScaleFilter::Area) {
+      double left = sourceStart + i * scale, right = left + scale;
+      first = (int)floor(left);
+      last = (int)ceil(right) - 1;
+      for (int j = first; j <= last; j++) {
+        double coverage = std::min(right, (double)j + 1) - std::max(left, (double)j);
+        sampleWeights[std::min(std::max(j, 0), (int)sourceSize - 1)] += std::max(coverage, 0.0);
+      }
+    }
+    else {
+      double centre = sourceStart + (i + 0.5) * scale - 0.5;
+      first = (int)ceil(centre - support);
+      last = (int)floor(centre + support);
+      for (int j = first; j <= last; j++) {
+        sampleWeights[std::min(std::max(j, 0), (int)sourceSize - 1)] += GetScaleFilterWeight(filter, (j - centre) / filterScale);
+      }
+    }
+
+    // Trims the samples with no weight from each end, rounding error can leave a trace on one past the edge.
+    first = std::min(std::max(first, 0), (int)sourceSize - 1);
+    last = std::min(std::max(last, 0), (int)sourceSize - 1);
+    while (first < last && fabs(sampleWeights[first]) < 1e-9) {
+      first++;
+    }
+    while (last > first && fabs(sampleWeights[last]) < 1e-9) {
+      last--;
+    }
+
+    offsets[i] = first;
+    weights[i].assign(sampleWeights.begin() + first, sampleWeights.begin() + last + 1);
+    taps = std::max(taps, (unsigned int)weights[i].size());
+  }
+
+  ScaleFilterTable table;
+  table.Taps = (taps + tapAlignment - 1) / tapAlignment * tapAlignment;
+  table.Offsets = offsets;
+  table.Weights.assign((size_t)destinationSize * table.Taps, 0);
+
+  for (unsigned int i = 0; i < destinationSize; i++) {
+    double total = 0;
+    for (double weight : weights[i]) {
+      total += weight;
+    }
+
+    // The rounding error goes on the biggest weight so each set adds up exactly.
+    int16_t* pWeights = table.Weights.data() + (size_t)i * table.Taps;
+    int sum = 0;
+    size_t biggest = 0;
+    for (size_t t = 0; t < weights[i].size(); t++) {
+      pWeights[t] = (int16_t)lround(weights[i][t] / total * (1 << SCALER_WEIGHT_BITS));
+      sum += pWeights[t];
+      biggest = (pWeights[t] > pWeights[biggest]) ? t : biggest;
+    }
+    pWeights[biggest] = (int16_t)(pWeights[biggest] + (1 << SCALER_WEIGHT_BITS) - sum);
+  }
+
+  return table;
+}
+
+class VideoScaler
+{
+public:
+  /**
+  * @param[in] filter: the filter to scale with.
+  * @param[in] fit: how the picture is fitted to the destination when the aspect
+  *  ratios differ.
+  * @param[in] useSimd: false to only use the plain C++ version, for comparing
+  *  against the vectorised one.
+  */
+  VideoScaler(ScaleFilter filter = ScaleFilter::Bilinear, ScaleFit fit = ScaleFit::Stretch, bool useSimd = true) :
+    _filter(filter),
+    _fit(fit),
+    _useSimd(useSimd),
+    _useAvx2(useSimd && GetCpuFeatures().Avx2)
+  { }
+
+  /**
+  * Scales an image to the destination's size. The tables are only worked out
+  * again when the sizes, crop or format change.
+  * @param[in] source: the image to scale, I420, NV12, RGB32 or BGRA.
+  * @param[in] destination: the image to write to, the same format as the source.
+  * @param[in] crop: the part of the source to use, a width of 0 for all of it.
+  *  The left, top, width and height need to be even for I420 and NV12.
+  * @@Returns true if the image was scaled, false if the images aren't supported.
+  */
+  bool Scale(const ColourImage& source, const ColourImage& destination, const ScaleRect& crop = ScaleRect())
+  {
+    ScaleRect sourceRect = crop;
+    if (sourceRect.Width == 0 || sourceRect.Height == 0) {
+      sourceRect = { 0, 0, source.Width, source.Height };
+    }
+
+    if (source.Format != destination.Format || GetPlaneCount(source.Format) == 0) {
+      printf("Scaling from %s to %s isn't supported, the formats need to match and be I420, NV12, RGB32 or BGRA.\n",
+        GetColourFormatName(source.Format), GetColourFormatName(destination.Format));
+      return false;
+    }
+    else if (destination.Width == 0 || destination.Height == 0 || sourceRect.Width == 0 || sourceRect.Height == 0 ||
+      sourceRect.Left + sourceRect.Width > source.Width || sourceRect.Top + sourceRect.Height > source.Height) {
+      printf("Scaling a %ux%u crop at %u,%u of a %ux%u image to %ux%u isn't possible.\n", sourceRect.Width, sourceRect.Height,
+        sourceRect.Left, sourceRect.Top, source.Width, source.Height, destination.Width, destination.Height);
+      return false;
+    }
+
+    if (!IsConfigured(source, destination, sourceRect)) {
+      Configure(source, destination, sourceRect);
+    }
+
+    for (const PlaneFilters& plane : _planes) {
+      ScalePlane(plane, source.pPlanes[plane.Index], source.Strides[plane.Index], destination.pPlanes[plane.Index], destination.Strides[plane.Index]);
+    }
+
+    return true;
+  }
+
+  /* Where the picture went in the last destination, the rest is black bars. */
+  ScaleRect GetPictureRect() const
+  {
+    return _picture;
+  }
+
+  /* The widest instructions the scaler uses on this CPU. */
+  static const char* GetSimdName()
+  {
+#if defined(VIDEO_SCALER_AVX2)
+    if (GetCpuFeatures().Avx2) {
+      return "AVX2";
+    }
+#endif
+#if defined(VIDEO_SCALER_SSE2)
+    return "SSE2";
+#else
+    return "none";
+#endif
+  }
+
+private:
+
+  /* The filter tables and sizes for one plane. */
+  struct PlaneFilters
+  {
+    int Index = 0;
+    unsigned int Channels = 1;          // Interleaved samples per pixel, 2 for NV12's UV plane and 4 for RGB32.
+    unsigned int Width = 0;             // The destination plane size.
+    unsigned int Height = 0;
+    ScaleRect Picture;                  // In the destination plane's pixels.
+    unsigned int SourceHeight = 0;
+    int FirstColumn = 0;                // The source columns the vertical pass filters.
+    int Columns = 0;
+    ScaleFilterTable Horizontal;
+    ScaleFilterTable Vertical;
+    std::vector<int16_t> HorizontalVectors;   // The horizontal weights laid out to match the order samples are loaded in.
+    std::vector<int32_t> VerticalPairs;       // Each pair of vertical weights packed into 32 bits for the multiply-adds.
+    uint8_t Black[4] = { 0, 0, 0, 0 };
+  };
+
+  static int GetPlaneCount(ColourFormat format)
+  {
+    switch (format) {
+    case ColourFormat::I420: return 3;
+    case ColourFormat::NV12: return 2;
+    case ColourFormat::RGB32:
+    case ColourFormat::BGRA: return 1;
+    default: return 0;
+    }
+  }
+
+  bool IsConfigured(const ColourImage& source, const ColourImage& destination, const ScaleRect& sourceRect) const
+  {
+    return !_planes.empty() && source.Format == _format && source.Width == _sourceWidth && source.Height == _sourceHeight &&
+      destination.Width == _destinationWidth && destination.Height == _destinationHeight && sourceRect.Left == _sourceRect.Left &&
+      sourceRect.Top == _sourceRect.Top && sourceRect.Width == _sourceRect.Width && sourceRect.Height == _sourceRect.Height;
+  }
+
+  /* Works out where the picture goes and the filter tables for each plane. */
+  void Configure(const ColourImage& source, const ColourImage& destination, const ScaleRect& sourceRect)
+  {
+    bool isChromaHalved = source.Format == ColourFormat::I420 || source.Format == ColourFormat::NV12;
+    unsigned int alignment = isChromaHalved ? 2 : 1;
+    double cropLeft = sourceRect.Left, cropTop = sourceRect.Top, cropWidth = sourceRect.Width, cropHeight = sourceRect.Height;
+
+    _format = source.Format;
+    _sourceWidth = source.Width;
+    _sourceHeight = source.Height;
+    _destinationWidth = destination.Width;
+    _destinationHeight = destination.Height;
+    _sourceRect = sourceRect;
+    _picture = { 0, 0, destination.Width, destination.Height };
+
+    double widthScale = (double)destination.Width / cropWidth, heightScale = (double)destination.Height / cropHeight;
+
+    if (_fit == ScaleFit::Letterbox) {
+      double scale = std::min(widthScale, heightScale);
+      _picture.Width = std::max(alignment, (unsigned int)lround(cropWidth * scale) / alignment * alignment);
+      _picture.Height = std::max(alignment, (unsigned int)lround(cropHeight * scale) / alignment * alignment);
+      _picture.Width = std::min(_picture.Width, destination.Width);
+      _picture.Height = std::min(_picture.Height, destination.Height);
+      _picture.Left = (destination.Width - _picture.Width) / 2 / alignment * alignment;
+      _picture.Top = (destination.Height - _picture.Height) / 2 / alignment * alignment;
+    }
+    else if (_fit == ScaleFit::Crop) {
+      // The source is cropped to the destination's aspect ratio, to a fraction of a pixel.
+      double scale = std::max(widthScale, heightScale);
+      double visibleWidth = destination.Width / scale, visibleHeight = destination.Height / scale;
+      cropLeft += (cropWidth - visibleWidth) / 2;
+      cropTop += (cropHeight - visibleHeight) / 2;
+      cropWidth = visibleWidth;
+      cropHeight = visibleHeight;
+    }
+
+    _planes.clear();
+    for (int index = 0; index < GetPlaneCount(source.Format); index++) {
+      PlaneFilters plane;
+      bool isChroma = index > 0;
+      unsigned int divisor = isChroma ? 2 : 1;
+      unsigned int sourceWidth = (source.Width + divisor - 1) / divisor, sourceHeight = (source.Height + divisor - 1) / divisor;
+
+      plane.Index = index;
+      plane.Channels = (source.Format == ColourFormat::NV12 && isChroma) ? 2 : (isChromaHalved ? 1 : 4);
+      plane.Width = (destination.Width + divisor - 1) / divisor;
+      plane.Height = (destination.Height + divisor - 1) / divisor;
+      plane.Picture = { _picture.Left / divisor, _picture.Top / divisor, (_picture.Width + divisor - 1) / divisor, (_picture.Height + divisor - 1) / divisor };
+      plane.SourceHeight = sourceHeight;
+
+      // Each set of horizontal weights fills whole 8 x 16 bit vectors of the interleaved samples.
+      plane.Horizontal = GetScaleFilterTable(_filter, cropLeft / divisor, cropWidth / divisor, sourceWidth, plane.Picture.Width, 8 / plane.Channels);
+      plane.Vertical = GetScaleFilterTable(_filter, cropTop / divisor, cropHeight / divisor, sourceHeight, plane.Picture.Height, 2);
+
+      int lastColumn = 0;
+      plane.FirstColumn = plane.Horizontal.Offsets.front();
+      for (int offset : plane.Horizontal.Offsets) {
+        plane.FirstColumn = std::min(plane.FirstColumn, offset);
+        lastColumn = std::max(lastColumn, offset + (int)plane.Horizontal.Taps);
+      }
+      plane.Columns = std::min(lastColumn, (int)sourceWidth) - plane.FirstColumn;
+
+      // Reads past the last column get padding, the weights for them are 0.
+      size_t rowSamples = (size_t)(lastColumn - plane.FirstColumn) * plane.Channels;
+      if (_row.size() < rowSamples) {
+        _row.assign(rowSamples, 0);
+      }
+
+      LayOutHorizontalVectors(plane);
+      plane.VerticalPairs.resize(plane.Vertical.Weights.size() / 2);
+      for (size_t i = 0; i < plane.VerticalPairs.size(); i++) {
+        plane.VerticalPairs[i] = (int32_t)(((uint32_t)(uint16_t)plane.Vertical.Weights[i * 2 + 1] << 16) | (uint16_t)plane.Vertical.Weights[i * 2]);
+      }
+      _sourceRows.resize(std::max(_sourceRows.size(), (size_t)plane.Vertical.Taps));
+
+      if (source.Format == ColourFormat::RGB32 || source.Format == ColourFormat::BGRA) {
+        plane.Black[3] = 0xFF;
+      }
+      else {
+        memset(plane.Black, isChroma ? SCALER_BLACK_CHROMA : SCALER_BLACK_LUMA, sizeof(plane.Black));
+      }
+
+      _planes.push_back(plane);
+    }
+  }
+
+  /**
+  * Lays the horizontal weights out to match the SSE2 loads. A load is 8 samples:
+  * 8 taps of a single channel, 4 taps of NV12's UV shuffled into U0 U1 V0 V1
+  * U2 U3 V2 V3, or 2 taps of RGB32 shuffled to B0 B1 G0 G1 R0 R1 A0 A1.
+  */
+  static void LayOutHorizontalVectors(PlaneFilters& plane)
+  {
+    const ScaleFilterTable& table = plane.Horizontal;
+    unsigned int channels = plane.Channels, tapsPerVector = 8 / channels;
+    size_t vectors = table.Taps / tapsPerVector;
+
+    plane.HorizontalVectors.assign(table.Offsets.size() * vectors * 8, 0);
+
+    for (size_t i = 0; i < table.Offsets.size(); i++) {
+      const int16_t* pWeights = table.Weights.data() + i * table.Taps;
+      int16_t* pVectors = plane.HorizontalVectors.data() + i * vectors * 8;
+
+      for (size_t v = 0; v < vectors; v++) {
+        for (unsigned int lane = 0; lane < 8; lane++) {
+          unsigned int tap = (channels == 1) ? lane : (channels == 2) ? (lane / 4) * 2 + (lane % 2) : lane % 2;
+          pVectors[v * 8 + lane] = pWeights[v * tapsPerVector + tap];
+        }
+      }
+    }
+  }
+
+  void ScalePlane(const PlaneFilters& plane, const uint8_t* pSource, int sourceStride, uint8_t* pDestination, int destinationStride)
+  {
+    const ScaleRect& picture = plane.Picture;
+    unsigned int channels = plane.Channels;
+
+    for (unsigned int y = 0; y < plane.Height; y++) {
+      uint8_t* pRow = pDestination + (ptrdiff_t)y * destinationStride;
+
+      if (y < picture.Top || y >= picture.Top + picture.Height) {
+        FillBlack(pRow, plane.Width, plane);
+        continue;
+      }
+
+      FillBlack(pRow, picture.Left, plane);
+      FillBlack(pRow + (size_t)(picture.Left + picture.Width) * channels, plane.Width - picture.Left - picture.Width, plane);
+
+      unsigned int outputRow = y - picture.Top;
+      FilterVertical(plane, pSource, sourceStride, outputRow);
+      FilterHorizontal(plane, pRow + (size_t)picture.Left * channels);
+    }
+  }
+
+  static void FillBlack(uint8_t* pRow, unsigned int pixels, const PlaneFilters& plane)
+  {
+    if (plane.Channels == 1) {
+      memset(pRow, plane.Black[0], pixels);
+      return;
+    }
+
+    for (unsigned int x = 0; x < pixels; x++) {
+      memcpy(pRow + (size_t)x * plane.Channels, plane.Black, plane.Channels);
+    }
+  }
+
+  /* Filters the source rows under an output row into the 16 bit row. */
+  void FilterVertical(const PlaneFilters& plane, const uint8_t* pSource, int sourceStride, unsigned int outputRow)
+  {
+    const ScaleFilterTable& table = plane.Vertical;
+    const int16_t* pWeights = table.Weights.data() + (size_t)outputRow * table.Taps;
+    int offset = table.Offsets[outputRow];
+    unsigned int length = (unsigned int)plane.Columns * plane.Channels;
+    const int rounding = 1 << (SCALER_WEIGHT_BITS - SCALER_INTERMEDIATE_BITS - 1);
+    const uint8_t** pRows = _sourceRows.data();
+    const int32_t* pPairs = plane.VerticalPairs.data() + (size_t)outputRow * table.Taps / 2;
+    int16_t* pOutput = _row.data();
+    unsigned int x = 0;
+
+    // The rows past the bottom have no weight.
+    for (unsigned int t = 0; t < table.Taps; t++) {
+      int row = std::min(offset + (int)t, (int)plane.SourceHeight - 1);
+      pRows[t] = pSource + (ptrdiff_t)row * sourceStride + (size_t)plane.FirstColumn * plane.Channels;
+    }
+
+    // Each pair of rows has its bytes interleaved and widened to 16 bits so a
+    // multiply-add applies both weights at once.
+#ifdef VIDEO_SCALER_AVX2
+    if (_useAvx2) {
+      x = FilterVerticalAvx2(table, pRows, pPairs, length, pOutput);
+    }
+#endif
+
+#ifdef VIDEO_SCALER_SSE2
+    if (_useSimd) {
+      const __m128i zero = _mm_setzero_si128();
+      for (; x + 16 <= length; x += 16) {
+        __m128i sums[4];
+        for (int i = 0; i < 4; i++) {
+          sums[i] = _mm_set1_epi32(rounding);
+        }
+
+        for (unsigned int t = 0; t < table.Taps; t += 2) {
+          __m128i a = _mm_loadu_si128((const __m128i*)(pRows[t] + x));
+          __m128i b = _mm_loadu_si128((const __m128i*)(pRows[t + 1] + x));
+          __m128i weights = _mm_set1_epi32(pPairs[t / 2]);
+          __m128i low = _mm_unpacklo_epi8(a, b), high = _mm_unpackhi_epi8(a, b);
+          sums[0] = _mm_add_epi32(sums[0], _mm_madd_epi16(_mm_unpacklo_epi8(low, zero), weights));
+          sums[1] = _mm_add_epi32(sums[1], _mm_madd_epi16(_mm_unpackhi_epi8(low, zero), weights));
+          sums[2] = _mm_add_epi32(sums[2], _mm_madd_epi16(_mm_unpacklo_epi8(high, zero), weights));
+          sums[3] = _mm_add_epi32(sums[3], _mm_madd_epi16(_mm_unpackhi_epi8(high, zero), weights));
+        }
+
+        _mm_storeu_si128((__m128i*)(pOutput + x), _mm_packs_epi32(_mm_srai_epi32(sums[0], SCALER_WEIGHT_BITS - SCALER_INTERMEDIATE_BITS),
+          _mm_srai_epi32(sums[1], SCALER_WEIGHT_BITS - SCALER_INTERMEDIATE_BITS)));
+        _mm_storeu_si128((__m128i*)(pOutput + x + 8), _mm_packs_epi32(_mm_srai_epi32(sums[2], SCALER_WEIGHT_BITS - SCALER_INTERMEDIATE_BITS),
+          _mm_srai_epi32(sums[3], SCALER_WEIGHT_BITS - SCALER_INTERMEDIATE_BITS)));
+      }
+    }
+#endif
+
+    for (; x < length; x++) {
+      int sum = rounding;
+      for (unsigned int t = 0; t < table.Taps; t += 2) {
+        sum += pRows[t][x] * pWeights[t] + pRows[t + 1][x] * pWeights[t + 1];
+      }
+      pOutput[x] = (int16_t)std::min(std::max(sum >> (SCALER_WEIGHT_BITS - SCALER_INTERMEDIATE_BITS), -32768), 32767);
+    }
+  }
+
+#ifdef VIDEO_SCALER_AVX2
+  /* The AVX2 part of FilterVertical, 32 samples at a time, returning the samples done. */
+  CPU_TARGET_AVX2 static unsigned int FilterVerticalAvx2(const ScaleFilterTable& table, const uint8_t** pRows, const int32_t* pPairs,
+    unsigned int length, int16_t* pOutput)
+  {
+    const int rounding = 1 << (SCALER_WEIGHT_BITS - SCALER_INTERMEDIATE_BITS - 1);
+    unsigned int x = 0;
+
+    const __m256i zero = _mm256_setzero_si256();
+    for (; x + 32 <= length; x += 32) {
+      __m256i sums[4];
+      for (int i = 0; i < 4; i++) {
+        sums[i] = _mm256_set1_epi32(rounding);
+      }
+
+      for (unsigned int t = 0; t < table.Taps; t += 2) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(pRows[t] + x));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(pRows[t + 1] + x));
+        __m256i weights = _mm256_set1_epi32(pPairs[t / 2]);
+        __m256i low = _mm256_unpacklo_epi8(a, b), high = _mm256_unpackhi_epi8(a, b);
+        sums[0] = _mm256_add_epi32(sums[0], _mm256_madd_epi16(_mm256_unpacklo_epi8(low, zero), weights));
+        sums[1] = _mm256_add_epi32(sums[1], _mm256_madd_epi16(_mm256_unpackhi_epi8(low, zero), weights));
+        sums[2] = _mm256_add_epi32(sums[2], _mm256_madd_epi16(_mm256_unpacklo_epi8(high, zero), weights));
+        sums[3] = _mm256_add_epi32(sums[3], _mm256_madd_epi16(_mm256_unpackhi_epi8(high, zero), weights));
+      }
+
+      // The unpacks work within each 128 bit lane, samples 0 to 7 and 16 to 23 end up in the first pack.
+      __m256i first = _mm256_packs_epi32(_mm256_srai_epi32(sums[0], SCALER_WEIGHT_BITS - SCALER_INTERMEDIATE_BITS),
+        _mm256_srai_epi32(sums[1], SCALER_WEIGHT_BITS - SCALER_INTERMEDIATE_BITS));
+      __m256i second = _mm256_packs_epi32(_mm256_srai_epi32(sums[2], SCALER_WEIGHT_BITS - SCALER_INTERMEDIATE_BITS),
+        _mm256_srai_epi32(sums[3], SCALER_WEIGHT_BITS - SCALER_INTERMEDIATE_BITS));
+      _mm256_storeu_si256((__m256i*)(pOutput + x), _mm256_permute2x128_si256(first, second, 0x20));
+      _mm256_storeu_si256((__m256i*)(pOutput + x + 16), _mm256_permute2x128_si256(first, second, 0x31));
+    }
+
+    return x;
+  }
+#endif
+
+  /* Filters the 16 bit row into the output row. */
+  void FilterHorizontal(const PlaneFilters& plane, uint8_t* pOutput) const
+  {
+    const ScaleFilterTable& table = plane.Horizontal;
+    unsigned int channels = plane.Channels, width = plane.Picture.Width;
+    const int shift = SCALER_WEIGHT_BITS + SCALER_INTERMEDIATE_BITS;
+    unsigned int x = 0;
+
+#ifdef VIDEO_SCALER_AVX2
+    if (_useAvx2) {
+      x = (channels == 1) ? FilterHorizontalVectorsAvx2<1>(plane, pOutput) :
+        (channels == 2) ? FilterHorizontalVectorsAvx2<2>(plane, pOutput) : FilterHorizontalVectorsAvx2<4>(plane, pOutput);
+    }
+#endif
+
+#ifdef VIDEO_SCALER_SSE2
+    if (_useSimd) {
+      x = (channels == 1) ? FilterHorizontalVectors<1>(plane, pOutput, x) :
+        (channels == 2) ? FilterHorizontalVectors<2>(plane, pOutput, x) : FilterHorizontalVectors<4>(plane, pOutput, x);
+    }
+#endif
+
+    for (; x < width; x++) {
+      const int16_t* pWeights = table.Weights.data() + (size_t)x * table.Taps;
+      const int16_t* pSamples = _row.data() + (size_t)(table.Offsets[x] - plane.FirstColumn) * channels;
+
+      for (unsigned int c = 0; c < channels; c++) {
+        int sum = 1 << (shift - 1);
+        for (unsigned int t = 0; t < table.Taps; t++) {
+          sum += pSamples[t * channels + c] * pWeights[t];
+        }
+        pOutput[(size_t)x * channels + c] = (uint8_t)std::min(std::max(sum >> shift, 0), 255);
+      }
+    }
+  }
+
+#ifdef VIDEO_SCALER_SSE2
+  /**
+  * Filters the 16 bit row into the output row 4 samples at a time: 4 pixels of
+  * a single channel, 2 UV pairs or 1 RGB32 pixel.
+  * @param[in] plane: the plane's filters.
+  * @param[out] pOutput: the output row.
+  * @param[in] x: the first pixel to filter, the ones before it are done.
+  * @@Returns The pixels done, the rest are left for the plain C++ version.
+  */
+  template<unsigned int Channels>
+  unsigned int FilterHorizontalVectors(const PlaneFilters& plane, uint8_t* pOutput, unsigned int x) const
+  {
+    const unsigned int pixelsPerStep = 4 / Channels;
+    const unsigned int vectors = plane.Horizontal.Taps * Channels / 8;
+    const int* pOffsets = plane.Horizontal.Offsets.data();
+    const int16_t* pWeights = plane.HorizontalVectors.data();
+    const int16_t* pRow = _row.data();
+    const int firstColumn = plane.FirstColumn;
+    const unsigned int width = plane.Picture.Width;
+    const int shift = SCALER_WEIGHT_BITS + SCALER_INTERMEDIATE_BITS;
+    const __m128i rounding = _mm_set1_epi32(1 << (shift - 1));
+
+    for (; x + pixelsPerStep <= width; x += pixelsPerStep) {
+      __m128i sums[pixelsPerStep];
+
+      for (unsigned int p = 0; p < pixelsPerStep; p++) {
+        const int16_t* pSamples = pRow + (size_t)(pOffsets[x + p] - firstColumn) * Channels;
+        const int16_t* pPixelWeights = pWeights + (size_t)(x + p) * vectors * 8;
+        __m128i sum = _mm_madd_epi16(LoadSamples<Channels>(pSamples), _mm_loadu_si128((const __m128i*)pPixelWeights));
+        for (unsigned int v = 1; v < vectors; v++) {
+          sum = _mm_add_epi32(sum, _mm_madd_epi16(LoadSamples<Channels>(pSamples + v * 8), _mm_loadu_si128((const __m128i*)(pPixelWeights + v * 8))));
+        }
+        sums[p] = sum;
+      }
+
+      __m128i samples;
+      if (Channels == 1) {
+        samples = AddLanes(sums[0], sums[1 % pixelsPerStep], sums[2 % pixelsPerStep], sums[3 % pixelsPerStep]);
+      }
+      else if (Channels == 2) {
+        // U01 V01 U23 V23 for each pixel, the halves are added.
+        __m128i first = _mm_add_epi32(sums[0], _mm_srli_si128(sums[0], 8));
+        __m128i second = _mm_add_epi32(sums[1 % pixelsPerStep], _mm_srli_si128(sums[1 % pixelsPerStep], 8));
+        samples = _mm_unpacklo_epi64(first, second);
+      }
+      else {
+        samples = sums[0];
+      }
+
+      samples = _mm_srai_epi32(_mm_add_epi32(samples, rounding), shift);
+      samples = _mm_packs_epi32(samples, samples);
+      int packed = _mm_cvtsi128_si32(_mm_packus_epi16(samples, samples));
+      memcpy(pOutput + (size_t)x * Channels, &packed, sizeof(packed));
+    }
+
+    return x;
+  }
+
+  /* Loads 8 samples and puts each channel's neighbouring taps next to each other, as LayOutHorizontalVectors describes. */
+  template<unsigned int Channels>
+  static __m128i LoadSamples(const int16_t* pSamples)
+  {
+    __m128i samples = _mm_loadu_si128((const __m128i*)pSamples);
+    if (Channels == 2) {
+      return _mm_shufflehi_epi16(_mm_shufflelo_epi16(samples, _MM_SHUFFLE(3, 1, 2, 0)), _MM_SHUFFLE(3, 1, 2, 0));
+    }
+    else if (Channels == 4) {
+      return _mm_unpacklo_epi16(samples, _mm_unpackhi_epi64(samples, samples));
+    }
+    return samples;
+  }
+
+  /* The sum of the lanes of each of four registers. */
+  static __m128i AddLanes(__m128i a, __m128i b, __m128i c, __m128i d)
+  {
+    __m128i ab = _mm_add_epi32(_mm_unpacklo_epi32(a, b), _mm_unpackhi_epi32(a, b));
+    __m128i cd = _mm_add_epi32(_mm_unpacklo_epi32(c, d), _mm_unpackhi_epi32(c, d));
+    return _mm_add_epi32(_mm_unpacklo_epi64(ab, cd), _mm_unpackhi_epi64(ab, cd));
+  }
+#endif
+
+#ifdef VIDEO_SCALER_AVX2
+  /**
+  * Filters the 16 bit row into the output row 8 samples at a time: 8 pixels of
+  * a single channel, 4 UV pairs or 2 RGB32 pixels. The sums end up with two
+  * neighbouring pixels in each register, one in each 128 bit lane, so the loads
+  * and weights are laid out the same as for FilterHorizontalVectors. With an
+  * even number of vectors, e.g. bicubic scaling down, each pixel's vectors are
+  * loaded two at a time and the lanes added afterwards, which halves the loads.
+  * @param[in] plane: the plane's filters.
+  * @param[out] pOutput: the output row.
+  * @@Returns The pixels done, the rest are left for the SSE2 and plain C++ versions.
+  */
+  template<unsigned int Channels>
+  CPU_TARGET_AVX2 unsigned int FilterHorizontalVectorsAvx2(const PlaneFilters& plane, uint8_t* pOutput) const
+  {
+    const unsigned int pixelsPerStep = 8 / Channels;
+    const unsigned int vectors = plane.Horizontal.Taps * Channels / 8;
+    const size_t pixelWeights = (size_t)vectors * 8;
+    const int* pOffsets = plane.Horizontal.Offsets.data();
+    const int16_t* pWeights = plane.HorizontalVectors.data();
+    const int16_t* pRow = _row.data();
+    const int firstColumn = plane.FirstColumn;
+    const unsigned int width = plane.Picture.Width;
+    const int shift = SCALER_WEIGHT_BITS + SCALER_INTERMEDIATE_BITS;
+    const __m256i rounding = _mm256_set1_epi32(1 << (shift - 1));
+    unsigned int x = 0;
+
+    for (; x + pixelsPerStep <= width; x += pixelsPerStep) {
+      __m256i sums[pixelsPerStep / 2];
+
+      for (unsigned int p = 0; p < pixelsPerStep / 2; p++) {
+        unsigned int pixel = x + p * 2;
+        const int16_t* pFirst = pRow + (size_t)(pOffsets[pixel] - firstColumn) * Channels;
+        const int16_t* pSecond = pRow + (size_t)(pOffsets[pixel + 1] - firstColumn) * Channels;
+        const int16_t* pPairWeights = pWeights + pixel * pixelWeights;
+        __m256i sum = _mm256_setzero_si256();
+
+        if (vectors % 2 == 0) {
+          __m256i firstSum = sum, secondSum = sum;
+          for (unsigned int v = 0; v < vectors; v += 2) {
+            firstSum = _mm256_add_epi32(firstSum, _mm256_madd_epi16(ArrangeSamples<Channels>(_mm256_loadu_si256((const __m256i*)(pFirst + v * 8))),
+              _mm256_loadu_si256((const __m256i*)(pPairWeights + v * 8))));
+            secondSum = _mm256_add_epi32(secondSum, _mm256_madd_epi16(ArrangeSamples<Channels>(_mm256_loadu_si256((const __m256i*)(pSecond + v * 8))),
+              _mm256_loadu_si256((const __m256i*)(pPairWeights + pixelWeights + v * 8))));
+          }
+          sum = _mm256_add_epi32(_mm256_permute2x128_si256(firstSum, secondSum, 0x20), _mm256_permute2x128_si256(firstSum, secondSum, 0x31));
+        }
+        else {
+          for (unsigned int v = 0; v < vectors; v++) {
+            __m256i samples = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)(pFirst + v * 8))),
+              _mm_loadu_si128((const __m128i*)(pSecond + v * 8)), 1);
+            __m256i weights = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)(pPairWeights + v * 8))),
+              _mm_loadu_si128((const __m128i*)(pPairWeights + pixelWeights + v * 8)), 1);
+            sum = _mm256_add_epi32(sum, _mm256_madd_epi16(ArrangeSamples<Channels>(samples), weights));
+          }
+        }
+        sums[p] = sum;
+      }
+
+      // Gathers the sums so the low lane has the even pixels' samples and the high lane the odd pixels'.
+      __m256i samples;
+      if (Channels == 1) {
+        samples = _mm256_hadd_epi32(_mm256_hadd_epi32(sums[0], sums[1 % (pixelsPerStep / 2)]),
+          _mm256_hadd_epi32(sums[2 % (pixelsPerStep / 2)], sums[3 % (pixelsPerStep / 2)]));
+      }
+      else if (Channels == 2) {
+        // U01 V01 U23 V23 for each pixel, the halves are added.
+        __m256i first = _mm256_add_epi32(sums[0], _mm256_srli_si256(sums[0], 8));
+        __m256i second = _mm256_add_epi32(sums[1 % (pixelsPerStep / 2)], _mm256_srli_si256(sums[1 % (pixelsPerStep / 2)], 8));
+        samples = _mm256_unpacklo_epi64(first, second);
+      }
+      else {
+        samples = sums[0];
+      }
+
+      samples = _mm256_srai_epi32(_mm256_add_epi32(samples, rounding), shift);
+      samples = _mm256_packs_epi32(samples, samples);
+      samples = _mm256_packus_epi16(samples, samples);
+
+      // Interleaves the even and odd pixels back into order.
+      __m128i even = _mm256_castsi256_si128(samples), odd = _mm256_extracti128_si256(samples, 1);
+      __m128i pixels = (Channels == 1) ? _mm_unpacklo_epi8(even, odd) : (Channels == 2) ? _mm_unpacklo_epi16(even, odd) : _mm_unpacklo_epi32(even, odd);
+      _mm_storel_epi64((__m128i*)(pOutput + (size_t)x * Channels), pixels);
+    }
+
+    return x;
+  }
+
+  /* Puts each channel's neighbouring taps next to each other in both 128 bit lanes, as LoadSamples does. */
+  template<unsigned int Channels>
+  CPU_TARGET_AVX2 static __m256i ArrangeSamples(__m256i samples)
+  {
+    if (Channels == 2) {
+      return _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(samples, _MM_SHUFFLE(3, 1, 2, 0)), _MM_SHUFFLE(3, 1, 2, 0));
+    }
+    else if (Channels == 4) {
+      return _mm256_unpacklo_epi16(samples, _mm256_unpackhi_epi64(samples, samples));
+    }
+    return samples;
+  }
+#endif
+
+  ScaleFilter _filter;
+  ScaleFit _fit;
+  bool _useSimd;
+  bool _useAvx2;                        // The CPU has AVX2 and useSimd was set.
+  ColourFormat _format = ColourFormat::I420;
+  unsigned int _sourceWidth = 0;
+  unsigned int _sourceHeight = 0;
+  unsigned int _destinationWidth = 0;
+  unsigned int _destinationHeight = 0;
+  ScaleRect _sourceRect;
+  ScaleRect _picture;
+  std::vector<PlaneFilters> _planes;
+  std::vector<int16_t> _row;            // The vertically filtered row, padded for the horizontal pass's reads past the end.
+  std::vector<const uint8_t*> _sourceRows;  // The source rows under the output row, from the first column filtered.
+};
@@ -0,0 +1,135 @@
+/******************************************************************************
+* Filename: Vp8EncoderProfile.h
+*
+* Description:
+* This header file contains the libvpx VP8 encoder tuning used by the samples
+* that encode VP8. The defaults from vpx_codec_enc_config_default encode on a
+* single thread at the default speed which can't keep up with 720p or 1080p
+* in real-time.
+*
+* The profile is split in two because g_threads has to be set on the config
+* before the encoder is initialised whereas the rest are codec controls that
+* can only be set afterwards.
+*
+* Dependencies:
+* vcpkg install libvpx
+*
+* License: Public Domain (no warranty, use at own risk)
+/******************************************************************************/
+
+#pragma once
+
+#include <vpx/vpx_encoder.h>
+#include <vpx/vp8cx.h>
+
+#include <stdio.h>
+
+struct Vp8EncoderProfile
+{
+  unsigned int Threads = 1;             // g_threads, each thread encodes a band of macroblock rows.
+  int CpuUsed = -6;                     // VP8E_SET_CPUUSED, -16 to 16. Negative values are speed levels for VPX_DL_REALTIME.
+  int NoiseSensitivity = 0;             // VP8E_SET_NOISE_SENSITIVITY, 0 (off) to 6. Denoising helps with webcam noise at lower resolutions.
+  unsigned int StaticThreshold = 1;     // VP8E_SET_STATIC_THRESHOLD, macroblocks that change less than this are skipped.
+  vp8e_token_partitions TokenPartitions = VP8_ONE_TOKENPARTITION;  // VP8E_SET_TOKEN_PARTITIONS, lets the threads write their rows in parallel.
+};
+
+/**
+* Gets the number of token partitions, which VP8 only allows as a power of two up
+* to 8, for a thread count.
+* @param[in] threads: the number of encoder threads.
+* @@Returns The largest token partition setting that doesn't exceed the thread count.
+*/
+inline vp8e_token_partitions GetVp8TokenPartitions(unsigned int threads)
+{
+  if (threads >= 8) {
+    return VP8_EIGHT_TOKENPARTITION;
+  }
+  else if (threads >= 4) {
+    return VP8_FOUR_TOKENPARTITION;
+  }
+  else if (threads >= 2) {
+    return VP8_TWO_TOKENPARTITION;
+  }
+  else {
+    return VP8_ONE_TOKENPARTITION;
+  }
+}
+
+/**
+* Gets an encoder profile suited to a frame size. The thread count follows the
+* heuristic used by browsers, more threads for larger frames but never more than
+* there are cores, and there is one token partition per thread.
+* @param[in] width: the frame width being encoded.
+* @param[in] height: the frame height being encoded.
+* @param[in] cores: the number of cores available, e.g. std::thread::hardware_concurrency().
+* @@Returns An encoder profile for the frame size.
+*/
+inline Vp8EncoderProfile GetVp8EncoderProfile(unsigned int width, unsigned int height, unsigned int cores)
+{
+  Vp8EncoderProfile profile;
+  unsigned int pixels = width * height;
+
+  if (pixels >= 1920 * 1080) {
+    profile.Threads = 8;
+  }
+  else if (pixels >= 1280 * 720) {
+    profile.Threads = 4;
+  }
+  else if (pixels >= 640 * 480) {
+    profile.Threads = 2;
+  }
+  else {
+    profile.Threads = 1;
+    profile.NoiseSensitivity = 1;
+  }
+
+  if (cores > 0 && profile.Threads > cores) {
+    profile.Threads = cores;
+  }
+
+  profile.TokenPartitions = GetVp8TokenPartitions(profile.Threads);
+
+  return profile;
+}
+
+/**
+* Applies the parts of the profile that need to be set on the encoder
+* configuration. Call before vpx_codec_enc_init.
+* @param[in] profile: the encoder profile to apply.
+* @param[out] pConfig: the encoder configuration to update.
+*/
+inline void SetVp8EncoderProfileConfig(const Vp8EncoderProfile& profile, vpx_codec_enc_cfg_t* pConfig)
+{
+  pConfig->g_threads = profile.Threads;
+}
+
+/**
+* Applies the parts of the profile that are codec controls. Call after
+* vpx_codec_enc_init.
+* @param[in] profile: the encoder profile to apply.
+* @param[in] pCodec: the initialised encoder.
+* @@Returns VPX_CODEC_OK if all the controls were set or the first error if not.
+*/
+inline vpx_codec_err_t SetVp8EncoderProfileControls(const Vp8EncoderProfile& profile, vpx_codec_ctx_t* pCodec)
+{
+  vpx_codec_err_t res = VPX_CODEC_OK;
+
+  if ((res = vpx_codec_control(pCodec, VP8E_SET_CPUUSED, profile.CpuUsed)) != VPX_CODEC_OK ||
+    (res = vpx_codec_control(pCodec, VP8E_SET_NOISE_SENSITIVITY, profile.NoiseSensitivity)) != VPX_CODEC_OK ||
+    (res = vpx_codec_control(pCodec, VP8E_SET_STATIC_THRESHOLD, profile.StaticThreshold)) != VPX_CODEC_OK ||
+    (res = vpx_codec_control(pCodec, VP8E_SET_TOKEN_PARTITIONS, (int)profile.TokenPartitions)) != VPX_CODEC_OK) {
+    printf("Failed to set VP8 encoder profile control: %s\n", vpx_codec_err_to_string(res));
+  }
+
+  return res;
+}
+
+/**
+* Prints a one line summary of the encoder profile.
+* @param[in] profile: the encoder profile to print.
+*/
+inline void PrintVp8EncoderProfile(const Vp8EncoderProfile& profile)
+{
+  printf("VP8 encoder profile: threads %u, cpu-used %d, noise sensitivity %d, static threshold %u, token partitions %d.\n",
+    profile.Threads, profile.CpuUsed, profile.NoiseSensitivity, profile.StaticThreshold, 1 << (int)profile.TokenPartitions);
+}
@@ -0,0 +1,240 @@
+/******************************************************************************
+* Filename: Vp9SvcEncoderProfile.h
+*
+* Description:
+* This header file contains the libvpx VP9 scalable video coding (SVC) set up
+* used by the samples that encode VP9. A single SVC encode produces spatial
+* layers at 1/4, 1/2 and the full frame size, each with three temporal layers,
+* so for a 1280x720 input receivers can be served 180p, 360p or 720p at 7.5,
+* 15 or 30 fps by dropping layers rather than running an encoder per resolution
+* as VP8 simulcast has to.
+*
+* As with Vp8EncoderProfile.h the set up is split between the encoder config,
+* before vpx_codec_enc_init, and codec controls, after it.
+*
+* Dependencies:
+* vcpkg install libvpx
+*
+* License: Public Domain (no warranty, use at own risk)
+/******************************************************************************/
+
+#pragma once
+
+#include <vpx/vpx_encoder.h>
+#include <vpx/vp8cx.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#include <utility>
+#include <vector>
+
+#define VP9_SVC_MAX_SPATIAL_LAYERS 3
+#define VP9_SVC_MAX_TEMPORAL_LAYERS 3
+#define VP9_SVC_TEMPORAL_PATTERN_LENGTH 4      // The 0-2-1-2 pattern used for three temporal layers.
+
+struct Vp9SvcEncoderProfile
+{
+  unsigned int SpatialLayers = VP9_SVC_MAX_SPATIAL_LAYERS;
+  unsigned int TemporalLayers = VP9_SVC_MAX_TEMPORAL_LAYERS;
+  unsigned int Threads = 1;             // g_threads, with row based multi-threading enabled.
+  int CpuUsed = 7;                      // VP8E_SET_CPUUSED, VP9 real-time speeds are 5 to 9.
+  int AqMode = 3;                       // VP9E_SET_AQ_MODE, 3 is cyclic refresh which suits real-time.
+  int InterLayerPrediction = INTER_LAYER_PRED_ON;  // VP9E_SET_SVC_INTER_LAYER_PRED, upper spatial layers predict from the layer below.
+};
+
+/**
+* Gets the spatial layer scaling factor. The top layer is full size and each
+* layer below it is half the width and height of the one above.
+* @param[in] profile: the SVC profile.
+* @param[in] spatialLayer: the spatial layer index, 0 is the lowest resolution.
+* @@Returns The denominator of the scaling factor, the numerator is always 1.
+*/
+inline int GetVp9SvcScalingDenominator(const Vp9SvcEncoderProfile& profile, unsigned int spatialLayer)
+{
+  return 1 << (profile.SpatialLayers - 1 - spatialLayer);
+}
+
+/**
+* Gets the frame size of a spatial layer the way libvpx scales it, rounded up to
+* an even size.
+* @param[in] profile: the SVC profile.
+* @param[in] width: the full frame width.
+* @param[in] height: the full frame height.
+* @param[in] spatialLayer: the spatial layer index.
+* @param[out] pLayerWidth: the width of the spatial layer.
+* @param[out] pLayerHeight: the height of the spatial layer.
+*/
+inline void GetVp9SvcLayerSize(const Vp9SvcEncoderProfile& profile, unsigned int width, unsigned int height, unsigned int spatialLayer,
+  unsigned int* pLayerWidth, unsigned int* pLayerHeight)
+{
+  int den = GetVp9SvcScalingDenominator(profile, spatialLayer);
+  *pLayerWidth = width / den;
+  *pLayerHeight = height / den;
+  *pLayerWidth += *pLayerWidth % 2;
+  *pLayerHeight += *pLayerHeight % 2;
+}
+
+/**
+* Gets a spatial layer's share of the total bitrate. The shares are proportional
+* to the layer's width, i.e. 1:2:4 for three layers, which gives the lower
+* resolutions more bits per pixel as their quality is more sensitive to it.
+* @param[in] profile: the SVC profile.
+* @param[in] spatialLayer: the spatial layer index.
+* @@Returns The fraction of the total bitrate for the layer.
+*/
+inline double GetVp9SvcSpatialLayerShare(const Vp9SvcEncoderProfile& profile, unsigned int spatialLayer)
+{
+  unsigned int total = (1 << profile.SpatialLayers) - 1;
+  return (double)(1 << spatialLayer) / total;
+}
+
+/**
+* Applies the SVC layer structure and bitrates to the encoder configuration. Call
+* before vpx_codec_enc_init.
+* @param[in] profile: the SVC profile to apply.
+* @param[in] targetBitrateKbps: the total bitrate across all layers.
+* @param[out] pConfig: the encoder configuration to update.
+*/
+inline void SetVp9SvcEncoderProfileConfig(const Vp9SvcEncoderProfile& profile, unsigned int targetBitrateKbps, vpx_codec_enc_cfg_t* pConfig)
+{
+  // Cumulative share of each temporal layer within its spatial layer.
+  const unsigned int temporalLayerPercent[VP9_SVC_MAX_TEMPORAL_LAYERS] = { 50, 70, 100 };
+  const unsigned int temporalLayerIds[VP9_SVC_TEMPORAL_PATTERN_LENGTH] = { 0, 2, 1, 2 };
+
+  pConfig->g_threads = profile.Threads;
+  pConfig->g_error_resilient = 0;
+  pConfig->g_lag_in_frames = 0;
+  pConfig->rc_end_usage = VPX_CBR;
+  pConfig->rc_target_bitrate = targetBitrateKbps;
+  pConfig->rc_dropframe_thresh = 0;     // Every superframe has every spatial layer.
+
+  pConfig->ss_number_layers = profile.SpatialLayers;
+  pConfig->ts_number_layers = profile.TemporalLayers;
+  pConfig->temporal_layering_mode = (profile.TemporalLayers == 3) ? VP9E_TEMPORAL_LAYERING_MODE_0212 : VP9E_TEMPORAL_LAYERING_MODE_NOLAYERING;
+
+  if (profile.TemporalLayers == 3) {
+    pConfig->ts_periodicity = VP9_SVC_TEMPORAL_PATTERN_LENGTH;
+    for (int i = 0; i < VP9_SVC_TEMPORAL_PATTERN_LENGTH; i++) {
+      pConfig->ts_layer_id[i] = temporalLayerIds[i];
+    }
+    pConfig->ts_rate_decimator[0] = 4;
+    pConfig->ts_rate_decimator[1] = 2;
+    pConfig->ts_rate_decimator[2] = 1;
+  }
+
+  // The layer bitrates are cumulative over the temporal layers of each spatial layer
+  // but not over the spatial layers.
+  for (unsigned int sl = 0; sl < profile.SpatialLayers; sl++) {
+    unsigned int spatialBitrate = (unsigned int)(targetBitrateKbps * GetVp9SvcSpatialLayerShare(profile, sl));
+
+    for (unsigned int tl = 0; tl < profile.TemporalLayers; tl++) {
+      unsigned int percent = (profile.TemporalLayers == 3) ? temporalLayerPercent[tl] : 100;
+      pConfig->layer_target_bitrate[sl * profile.TemporalLayers + tl] = spatialBitrate * percent / 100;
+    }
+  }
+}
+
+/**
+* Applies the SVC codec controls. Call after vpx_codec_enc_init.
+* @param[in] profile: the SVC profile to apply.
+* @param[in] pConfig: the configuration the encoder was initialised with.
+* @param[in] pCodec: the initialised encoder.
+* @@Returns VPX_CODEC_OK if all the controls were set or the first error if not.
+*/
+inline vpx_codec_err_t SetVp9SvcEncoderProfileControls(const Vp9SvcEncoderProfile& profile, const vpx_codec_enc_cfg_t* pConfig, vpx_codec_ctx_t* pCodec)
+{
+  vpx_svc_extra_cfg_t svcParams;
+  memset(&svcParams, 0, sizeof(svcParams));
+
+  for (unsigned int sl = 0; sl < profile.SpatialLayers; sl++) {
+    for (unsigned int tl = 0; tl < profile.TemporalLayers; tl++) {
+      int layer = sl * profile.TemporalLayers + tl;
+      svcParams.max_quantizers[layer] = pConfig->rc_max_quantizer;
+      svcParams.min_quantizers[layer] = pConfig->rc_min_quantizer;
+    }
+    svcParams.scaling_factor_num[sl] = 1;
+    svcParams.scaling_factor_den[sl] = GetVp9SvcScalingDenominator(profile, sl);
+  }
+
+  int tileColumns = 0;
+  while ((1u << (tileColumns + 1)) <= profile.Threads && tileColumns < 4) {
+    tileColumns++;
+  }
+
+  vpx_codec_err_t res = VPX_CODEC_OK;
+
+  if ((res = vpx_codec_control(pCodec, VP9E_SET_SVC, 1)) != VPX_CODEC_OK ||
+    (res = vpx_codec_control(pCodec, VP9E_SET_SVC_PARAMETERS, &svcParams)) != VPX_CODEC_OK ||
+    (res = vpx_codec_control(pCodec, VP9E_SET_SVC_INTER_LAYER_PRED, profile.InterLayerPrediction)) != VPX_CODEC_OK ||
+    (res = vpx_codec_control(pCodec, VP8E_SET_CPUUSED, profile.CpuUsed)) != VPX_CODEC_OK ||
+    (res = vpx_codec_control(pCodec, VP9E_SET_AQ_MODE, profile.AqMode)) != VPX_CODEC_OK ||
+    (res = vpx_codec_control(pCodec, VP9E_SET_ROW_MT, 1)) != VPX_CODEC_OK ||
+    (res = vpx_codec_control(pCodec, VP9E_SET_TILE_COLUMNS, tileColumns)) != VPX_CODEC_OK) {
+    printf("Failed to set VP9 SVC encoder control: %s\n", vpx_codec_err_to_string(res));
+  }
+
+  return res;
+}
+
+/**
+* Prints a one line summary of the SVC profile.
+* @param[in] profile: the SVC profile to print.
+*/
+inline void PrintVp9SvcEncoderProfile(const Vp9SvcEncoderProfile& profile)
+{
+  printf("VP9 SVC encoder profile: spatial layers %u, temporal layers %u, threads %u, cpu-used %d, aq mode %d, inter-layer prediction %d.\n",
+    profile.SpatialLayers, profile.TemporalLayers, profile.Threads, profile.CpuUsed, profile.AqMode, profile.InterLayerPrediction);
+}
+
+/**
+* Splits a VP9 superframe into its frames using the superframe index at the end
+* of the data, see Annex B of the VP9 bitstream specification. With SVC there is
+* one frame per spatial layer, lowest first. Data without an index is a single
+* frame. The index itself isn't part of any of the frames.
+* @param[in] data: the superframe from the encoder.
+* @param[in] size: the length of the superframe.
+* @@Returns The start and length of each frame.
+*/
+inline std::vector<std::pair<const uint8_t*, size_t>> ParseVp9Superframe(const uint8_t* data, size_t size)
+{
+  std::vector<std::pair<const uint8_t*, size_t>> frames;
+
+  if (size > 0) {
+    uint8_t marker = data[size - 1];
+
+    if ((marker & 0xe0) == 0xc0) {
+      size_t frameCount = (marker & 0x07) + 1;
+      size_t sizeBytes = ((marker >> 3) & 0x03) + 1;
+      size_t indexSize = 2 + sizeBytes * frameCount;
+
+      if (size >= indexSize && data[size - indexSize] == marker) {
+        const uint8_t* index = data + size - indexSize + 1;
+        size_t offset = 0;
+
+        for (size_t i = 0; i < frameCount; i++) {
+          size_t frameSize = 0;
+          for (size_t j = 0; j < sizeBytes; j++) {
+            frameSize |= (size_t)(*index++) << (j * 8);
+          }
+
+          if (offset + frameSize > size - indexSize) {
+            frames.clear();
+            break;
+          }
+
+          frames.push_back(std::make_pair(data + offset, frameSize));
+          offset += frameSize;
+        }
+
+        if (!frames.empty()) {
+          return frames;
+        }
+      }
+    }
+
+    frames.push_back(std::make_pair(data, size));
+  }
+
+  return frames;
+}
@@ -0,0 +1,158 @@
+/******************************************************************************
+* Filename: VpxVideoDecoder.h
+*
+* Description:
+* This header file contains the libvpx VP8 and VP9 backend for the VideoDecoder
+* interface. libvpx only threads within a frame, across VP8 token partitions or
+* VP9 tiles and rows, so only the slice threading mode is supported.
+*
+* Dependencies:
+* vcpkg install libvpx
+*
+* License: Public Domain (no warranty, use at own risk)
+/******************************************************************************/
+
+#pragma once
+
+#include "VideoDecoder.h"
+
+#include <vpx/vpx_decoder.h>
+#include <vpx/vp8dx.h>
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <deque>
+#include <thread>
+#include <utility>
+
+class VpxVideoDecoder : public VideoDecoder
+{
+public:
+  ~VpxVideoDecoder()
+  {
+    if (_isOpen) {
+      vpx_codec_destroy(&_vpxCodec);
+    }
+  }
+
+  const char* GetName() const override
+  {
+    return "libvpx";
+  }
+
+  bool SupportsCodec(VideoCodec codec) const override
+  {
+    return codec == VideoCodec::VP8 || codec == VideoCodec::VP9;
+  }
+
+  bool SupportsThreading(VideoDecoderThreading threading) const override
+  {
+    return threading != VideoDecoderThreading::Frame;
+  }
+
+protected:
+
+  bool Open(const VideoDecoderConfig& config) override
+  {
+    vpx_codec_iface_t* pInterface = (config.Codec == VideoCodec::VP9) ? vpx_codec_vp9_dx() : vpx_codec_vp8_dx();
+
+    vpx_codec_dec_cfg_t vpxConfig = { 0 };
+    vpxConfig.threads = 1;
+    if (config.Threading != VideoDecoderThreading::None) {
+      vpxConfig.threads = (config.Threads > 0) ? config.Threads : std::thread::hardware_concurrency();
+    }
+
+    if (vpx_codec_dec_init(&_vpxCodec, pInterface, &vpxConfig, 0)) {
+      printf("Failed to initialize libvpx decoder: %s\n", vpx_codec_error(&_vpxCodec));
+      return false;
+    }
+    _isOpen = true;
+
+    if (config.Codec == VideoCodec::VP9 && vpxConfig.threads > 1) {
+      vpx_codec_control(&_vpxCodec, VP9D_SET_ROW_MT, 1);
+    }
+
+    return true;
+  }
+
+  bool Decode(const uint8_t* pData, size_t length, int64_t pts) override
+  {
+    // libvpx has no presentation timestamp. The user private pointer carries a frame ID instead, as a
+    // pointer is too small for a 64 bit timestamp on 32 bit builds, and the pts is queued against it.
+    uintptr_t frameId = _nextFrameId++;
+    if (_nextFrameId == 0) {
+      _nextFrameId = 1;
+    }
+    _pendingPts.emplace_back(frameId, pts);
+
+    if (vpx_codec_decode(&_vpxCodec, pData, (unsigned int)length, (void*)frameId, 0)) {
+      printf("libvpx failed to decode frame: %s\n", vpx_codec_error(&_vpxCodec));
+      _pendingPts.pop_back();
+      return false;
+    }
+
+    QueueImages(pts);
+    return true;
+  }
+
+  bool Flush() override
+  {
+    if (vpx_codec_decode(&_vpxCodec, nullptr, 0, nullptr, 0)) {
+      printf("Failed to flush libvpx decoder: %s\n", vpx_codec_error(&_vpxCodec));
+      return false;
+    }
+
+    QueueImages(0);
+    return true;
+  }
+
+private:
+
+  void QueueImages(int64_t pts)
+  {
+    vpx_codec_iter_t iter = NULL;
+    vpx_image_t* pImage = nullptr;
+
+    while ((pImage = vpx_codec_get_frame(&_vpxCodec, &iter)) != nullptr) {
+      int64_t framePts = GetFramePts((uintptr_t)pImage->user_priv, pts);
+
+      if (pImage->fmt != VPX_IMG_FMT_I420) {
+        printf("libvpx decoder output format %d isn't I420, frame dropped.\n", pImage->fmt);
+        continue;
+      }
+
+      QueueFrame(pImage->planes, pImage->stride, pImage->d_w, pImage->d_h, framePts);
+    }
+  }
+
+  /**
+  * Takes the pts queued for a frame ID off the FIFO. libvpx outputs frames in
+  * decode order, so entries in front of it are for frames that weren't shown,
+  * such as VP8 alt-ref frames, and are dropped.
+  * @param[in] frameId: the frame ID from the image's user private pointer.
+  * @param[in] defaultPts: the pts to use if the frame ID isn't queued.
+  * @@Returns The frame's pts.
+  */
+  int64_t GetFramePts(uintptr_t frameId, int64_t defaultPts)
+  {
+    if (frameId == 0) {
+      return defaultPts;
+    }
+
+    while (!_pendingPts.empty()) {
+      std::pair<uintptr_t, int64_t> entry = _pendingPts.front();
+      _pendingPts.pop_front();
+      if (entry.first == frameId) {
+        return entry.second;
+      }
+    }
+
+    return defaultPts;
+  }
+
+  vpx_codec_ctx_t _vpxCodec;
+  bool _isOpen = false;
+  uintptr_t _nextFrameId = 1;                             // 0 is the null user private pointer, so it's skipped.
+  std::deque<std::pair<uintptr_t, int64_t>> _pendingPts;  // Frame IDs passed to libvpx and their pts, in decode order.
+};
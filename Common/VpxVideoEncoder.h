@@ -0,0 +1,309 @@
+/******************************************************************************
+* Filename: VpxVideoEncoder.h
+*
+* Description:
+* This header file contains the libvpx VP8 and VP9 backend for the VideoEncoder
+* interface. VP8 uses the Vp8EncoderProfile real-time tuning shared with the
+* MFWebCamWebRTC sample, without token partitions being output separately, and
+* VP9 uses a single layer version of the real-time settings from
+* Vp9SvcEncoderProfile.h. The fast and slow VideoEncoderPreset change the
+* cpu-used speed.
+*
+* The encoder timebase is the 90 kHz presentation clock and each frame's
+* duration is set from the current frame rate, which is what libvpx rate
+* control works from, so a frame rate change doesn't need a config update.
+*
+* libvpx's equivalent of intra refresh is cyclic refresh, which VP8 turns on in
+* real-time mode with error resilience and VP9 with VPX_VP9_AQ_MODE. Neither
+* lets the refresh period be set so with intra refresh the key frame interval
+* only stops the periodic key frames, and the size of any key frame that is
+* requested is capped at VPX_MAX_INTRA_BITRATE_PCT.
+*
+* A QP offset map is applied to VP8 as an ROI map, which has up to four segments
+* each with its own quantiser delta, so the offsets are grouped into four. The
+* ROI map and cyclic refresh both use VP8's segments so maps aren't supported
+* with intra refresh, nor for VP9 which always uses its cyclic refresh AQ mode.
+* libvpx also turns cyclic refresh on by itself for error resilient and CBR
+* encodes, which the VP8 ones here always are, and it would rewrite the segments
+* every frame, so the first map turns it off with VP8E_SET_RTC_EXTERNAL_RATECTRL
+* (libvpx 1.13 or later). That also has rate control update its correction
+* factor on every frame and not re-encode overshooting ones, as for WebRTC. An
+* empty map, e.g. after the encoder is Reset, turns segmentation back off.
+*
+* Dependencies:
+* vcpkg install libvpx
+*
+* License: Public Domain (no warranty, use at own risk)
+/******************************************************************************/
+
+#pragma once
+
+#include "VideoEncoder.h"
+#include "Vp8EncoderProfile.h"
+
+#include <vpx/vpx_encoder.h>
+#include <vpx/vp8cx.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <cmath>
+#include <thread>
+#include <vector>
+
+#define VPX_VP9_CPU_USED 7              // VP8E_SET_CPUUSED, VP9 real-time speeds are 5 to 9.
+#define VPX_VP9_CPU_USED_FAST 9
+#define VPX_VP9_CPU_USED_SLOW 5
+#define VPX_VP8_CPU_USED_FAST -12       // The default VP8 speed is from Vp8EncoderProfile.
+#define VPX_VP8_CPU_USED_SLOW -3
+#define VPX_VP9_AQ_MODE 3               // VP9E_SET_AQ_MODE, cyclic refresh.
+#define VPX_MAX_INTRA_BITRATE_PCT 300   // VP8E_SET_MAX_INTRA_BITRATE_PCT with intra refresh, key frames are at most 3 times an average frame.
+#define VPX_ROI_SEGMENTS 4              // VP8 segments available to an ROI map.
+#define VPX_ROI_MAX_DELTA_Q 63          // The ROI map quantiser deltas are in the 0 to 63 range of rc_min_quantizer, close to H264 QP.
+
+class VpxVideoEncoder : public VideoEncoder
+{
+public:
+  VpxVideoEncoder(VideoCodec codec) :
+    _codec(codec)
+  {}
+
+  ~VpxVideoEncoder()
+  {
+    if (_isOpen) {
+      vpx_codec_destroy(&_vpxCodec);
+    }
+  }
+
+  const char* GetName() const override
+  {
+    return (_codec == VideoCodec::VP9) ? "libvpx-vp9" : "libvpx-vp8";
+  }
+
+  VideoCodec GetCodec() const override
+  {
+    return _codec;
+  }
+
+  bool SupportsIntraRefresh() const override
+  {
+    return true;
+  }
+
+  bool SupportsQpOffsetMap() const override
+  {
+    return _codec == VideoCodec::VP8 && !_config.IntraRefresh;
+  }
+
+protected:
+
+  bool Open(const VideoEncoderConfig& config) override
+  {
+    vpx_codec_iface_t* pInterface = (_codec == VideoCodec::VP9) ? vpx_codec_vp9_cx() : vpx_codec_vp8_cx();
+
+    vpx_codec_err_t res = vpx_codec_enc_config_default(pInterface, &_vpxConfig, 0);
+    if (res) {
+      printf("Failed to get VPX codec config: %s\n", vpx_codec_err_to_string(res));
+      return false;
+    }
+
+    _vpxConfig.g_w = config.Width;
+    _vpxConfig.g_h = config.Height;
+    _vpxConfig.g_timebase.num = 1;
+    _vpxConfig.g_timebase.den = VIDEO_ENCODER_CLOCK_RATE;
+    _vpxConfig.rc_target_bitrate = config.BitrateKbps;
+    _vpxConfig.g_pass = VPX_RC_ONE_PASS;
+    _vpxConfig.rc_end_usage = VPX_CBR;
+    _vpxConfig.g_lag_in_frames = 0;
+    _vpxConfig.rc_resize_allowed = 0;
+    _vpxConfig.kf_mode = VPX_KF_DISABLED;
+
+    Vp8EncoderProfile vp8Profile = GetVp8EncoderProfile(config.Width, config.Height, std::thread::hardware_concurrency());
+    if (config.Threads > 0) {
+      vp8Profile.Threads = config.Threads;
+    }
+    vp8Profile.TokenPartitions = GetVp8TokenPartitions(vp8Profile.Threads);
+    if (config.Preset == VideoEncoderPreset::Fast) {
+      vp8Profile.CpuUsed = VPX_VP8_CPU_USED_FAST;
+    }
+    else if (config.Preset == VideoEncoderPreset::Slow) {
+      vp8Profile.CpuUsed = VPX_VP8_CPU_USED_SLOW;
+    }
+
+    if (_codec == VideoCodec::VP8) {
+      _vpxConfig.g_error_resilient = VPX_ERROR_RESILIENT_DEFAULT;
+      SetVp8EncoderProfileConfig(vp8Profile, &_vpxConfig);
+    }
+    else {
+      _vpxConfig.g_threads = vp8Profile.Threads;
+    }
+
+    if (vpx_codec_enc_init(&_vpxCodec, pInterface, &_vpxConfig, 0)) {
+      printf("Failed to initialize libvpx encoder: %s\n", vpx_codec_error(&_vpxCodec));
+      return false;
+    }
+    _isOpen = true;
+
+    if (config.IntraRefresh && (res = vpx_codec_control(&_vpxCodec, VP8E_SET_MAX_INTRA_BITRATE_PCT, VPX_MAX_INTRA_BITRATE_PCT)) != VPX_CODEC_OK) {
+      printf("Failed to set libvpx maximum intra bitrate: %s\n", vpx_codec_err_to_string(res));
+      return false;
+    }
+
+    if (_codec == VideoCodec::VP8) {
+      return SetVp8EncoderProfileControls(vp8Profile, &_vpxCodec) == VPX_CODEC_OK;
+    }
+
+    int tileColumns = 0;
+    while ((1u << (tileColumns + 1)) <= _vpxConfig.g_threads && tileColumns < 4) {
+      tileColumns++;
+    }
+
+    int cpuUsed = (config.Preset == VideoEncoderPreset::Fast) ? VPX_VP9_CPU_USED_FAST :
+      (config.Preset == VideoEncoderPreset::Slow) ? VPX_VP9_CPU_USED_SLOW : VPX_VP9_CPU_USED;
+
+    if ((res = vpx_codec_control(&_vpxCodec, VP8E_SET_CPUUSED, cpuUsed)) != VPX_CODEC_OK ||
+      (res = vpx_codec_control(&_vpxCodec, VP9E_SET_AQ_MODE, VPX_VP9_AQ_MODE)) != VPX_CODEC_OK ||
+      (res = vpx_codec_control(&_vpxCodec, VP9E_SET_ROW_MT, 1)) != VPX_CODEC_OK ||
+      (res = vpx_codec_control(&_vpxCodec, VP9E_SET_TILE_COLUMNS, tileColumns)) != VPX_CODEC_OK) {
+      printf("Failed to set VP9 encoder control: %s\n", vpx_codec_err_to_string(res));
+      return false;
+    }
+
+    return true;
+  }
+
+  bool Encode(const uint8_t* pI420, int64_t pts, bool keyFrame) override
+  {
+    vpx_image_t rawImage;
+    vpx_img_wrap(&rawImage, VPX_IMG_FMT_I420, _config.Width, _config.Height, 1, (unsigned char*)pI420);
+
+    if (_qpOffsets != _roiQpOffsets && !SetRoiMap()) {
+      return false;
+    }
+
+    return EncodeImage(&rawImage, pts, keyFrame ? VPX_EFLAG_FORCE_KF : 0);
+  }
+
+  bool SetRate(unsigned int bitrateKbps, unsigned int frameRateNum, unsigned int frameRateDen) override
+  {
+    _vpxConfig.rc_target_bitrate = bitrateKbps;
+
+    vpx_codec_err_t res = vpx_codec_enc_config_set(&_vpxCodec, &_vpxConfig);
+    if (res) {
+      printf("libvpx encoder rejected the new bitrate %u kbps: %s\n", bitrateKbps, vpx_codec_err_to_string(res));
+      return false;
+    }
+
+    // Applied again in case the config change worked out the cyclic refresh mode afresh.
+    return !_isCyclicRefreshOff || TurnOffCyclicRefresh();
+  }
+
+  bool Flush() override
+  {
+    return EncodeImage(nullptr, 0, 0);
+  }
+
+private:
+
+  /* Applies the QP offset map as a VP8 ROI map, grouping the offsets into the available segments. */
+  bool SetRoiMap()
+  {
+    vpx_roi_map_t roiMap;
+    memset(&roiMap, 0, sizeof(roiMap));
+    std::vector<unsigned char> segments;
+
+    // libvpx checks the size even for a map that only turns segmentation off, and rejects 0x0.
+    roiMap.rows = (_config.Height + VIDEO_ENCODER_MACROBLOCK_SIZE - 1) / VIDEO_ENCODER_MACROBLOCK_SIZE;
+    roiMap.cols = (_config.Width + VIDEO_ENCODER_MACROBLOCK_SIZE - 1) / VIDEO_ENCODER_MACROBLOCK_SIZE;
+
+    if (!_qpOffsets.empty()) {
+      if (!_isCyclicRefreshOff && !TurnOffCyclicRefresh()) {
+        return false;
+      }
+
+      // Each distinct offset gets its own segment if there are few enough, otherwise they're bucketed evenly.
+      std::vector<float> distinct(_qpOffsets);
+      std::sort(distinct.begin(), distinct.end());
+      distinct.erase(std::unique(distinct.begin(), distinct.end()), distinct.end());
+
+      float minOffset = distinct.front(), maxOffset = distinct.back();
+      if (distinct.size() > VPX_ROI_SEGMENTS) {
+        distinct.resize(VPX_ROI_SEGMENTS);
+        for (int i = 0; i < VPX_ROI_SEGMENTS; i++) {
+          distinct[i] = minOffset + (maxOffset - minOffset) * i / (VPX_ROI_SEGMENTS - 1);
+        }
+      }
+
+      segments.resize(_qpOffsets.size());
+      for (size_t i = 0; i < _qpOffsets.size(); i++) {
+        size_t nearest = 0;
+        for (size_t j = 1; j < distinct.size(); j++) {
+          if (std::fabs(_qpOffsets[i] - distinct[j]) < std::fabs(_qpOffsets[i] - distinct[nearest])) {
+            nearest = j;
+          }
+        }
+        segments[i] = (unsigned char)nearest;
+      }
+
+      for (size_t i = 0; i < distinct.size(); i++) {
+        int deltaQ = (int)std::lround(distinct[i]);
+        roiMap.delta_q[i] = std::max(-VPX_ROI_MAX_DELTA_Q, std::min(VPX_ROI_MAX_DELTA_Q, deltaQ));
+      }
+
+      roiMap.roi_map = segments.data();
+    }
+
+    // Without segments the map turns segmentation back off.
+    vpx_codec_err_t res = vpx_codec_control(&_vpxCodec, VP8E_SET_ROI_MAP, &roiMap);
+    if (res != VPX_CODEC_OK) {
+      printf("libvpx encoder rejected the ROI map: %s\n", vpx_codec_err_to_string(res));
+      return false;
+    }
+
+    _roiQpOffsets = _qpOffsets;
+    return true;
+  }
+
+  /* Stops libvpx's cyclic background refresh, which would otherwise overwrite the ROI map's segments every frame. */
+  bool TurnOffCyclicRefresh()
+  {
+    vpx_codec_err_t res = vpx_codec_control(&_vpxCodec, VP8E_SET_RTC_EXTERNAL_RATECTRL, 1);
+    if (res != VPX_CODEC_OK) {
+      printf("libvpx encoder couldn't turn off cyclic refresh for the ROI map: %s\n", vpx_codec_err_to_string(res));
+      return false;
+    }
+
+    _isCyclicRefreshOff = true;
+    return true;
+  }
+
+  /* Encodes an image, or flushes the encoder if null, and queues the output frames. */
+  bool EncodeImage(const vpx_image_t* pImage, int64_t pts, vpx_enc_frame_flags_t flags)
+  {
+    unsigned long duration = (unsigned long)((uint64_t)VIDEO_ENCODER_CLOCK_RATE * _config.FrameRateDen / _config.FrameRateNum);
+
+    if (vpx_codec_encode(&_vpxCodec, pImage, pts, duration, flags, VPX_DL_REALTIME)) {
+      printf("VPX codec failed to encode frame: %s\n", vpx_codec_error(&_vpxCodec));
+      return false;
+    }
+
+    vpx_codec_iter_t iter = NULL;
+    const vpx_codec_cx_pkt_t* pkt;
+    while ((pkt = vpx_codec_get_cx_data(&_vpxCodec, &iter))) {
+      if (pkt->kind == VPX_CODEC_CX_FRAME_PKT) {
+        QueueAccessUnit((const uint8_t*)pkt->data.frame.buf, pkt->data.frame.sz, pkt->data.frame.pts,
+          (pkt->data.frame.flags & VPX_FRAME_IS_KEY) != 0);
+      }
+    }
+
+    return true;
+  }
+
+  VideoCodec _codec;
+  vpx_codec_ctx_t _vpxCodec;
+  vpx_codec_enc_cfg_t _vpxConfig;
+  bool _isOpen = false;
+  std::vector<float> _roiQpOffsets;     // The QP offset map the current ROI map was made from.
+  bool _isCyclicRefreshOff = false;     // Set by the first ROI map, it stays off for the life of the encoder.
+};
@@ -0,0 +1,202 @@
+/******************************************************************************
+* Filename: X264VideoEncoder.h
+*
+* Description:
+* This header file contains the x264 backend for the VideoEncoder interface. It
+* uses the veryfast preset, or ultrafast and medium for the fast and slow
+* VideoEncoderPreset, with the zerolatency tune, so there are no B frames
+* or lookahead and every pushed frame comes straight back out, and the
+* constrained baseline profile the H264 samples request from the MFT. SPS and
+* PPS NAL units are repeated before every IDR frame so a receiver can start
+* decoding from any key frame.
+*
+* Rate control follows the presentation timestamps rather than the configured
+* frame rate so a change in the capture rate doesn't change the bitrate.
+*
+* With intra refresh x264 sweeps a column of intra macroblocks across the
+* picture over the key frame interval, so after the first IDR frame there are
+* only key frames when one is requested.
+*
+* A QP offset map is passed to x264 as the picture's quant offsets, which are
+* added to its adaptive quantisation. The preset leaves that on.
+*
+* Dependencies:
+* vcpkg install x264
+*
+* License: Public Domain (no warranty, use at own risk)
+/******************************************************************************/
+
+#pragma once
+
+#include "VideoEncoder.h"
+
+#include <stdio.h>
+#include <string.h>
+
+extern "C" {
+#include <x264.h>
+}
+
+#define X264_PRESET "veryfast"
+#define X264_PRESET_FAST "ultrafast"
+#define X264_PRESET_SLOW "medium"
+#define X264_TUNE "zerolatency"
+#define X264_PROFILE "baseline"
+
+class X264VideoEncoder : public VideoEncoder
+{
+public:
+  ~X264VideoEncoder()
+  {
+    if (_pEncoder != nullptr) {
+      x264_encoder_close(_pEncoder);
+    }
+  }
+
+  const char* GetName() const override
+  {
+    return "x264";
+  }
+
+  VideoCodec GetCodec() const override
+  {
+    return VideoCodec::H264;
+  }
+
+  bool SupportsIntraRefresh() const override
+  {
+    return true;
+  }
+
+  bool SupportsQpOffsetMap() const override
+  {
+    return true;
+  }
+
+protected:
+
+  bool Open(const VideoEncoderConfig& config) override
+  {
+    const char* preset = (config.Preset == VideoEncoderPreset::Fast) ? X264_PRESET_FAST :
+      (config.Preset == VideoEncoderPreset::Slow) ? X264_PRESET_SLOW : X264_PRESET;
+
+    if (x264_param_default_preset(&_param, preset, X264_TUNE) < 0) {
+      printf("Failed to apply x264 preset %s.\n", preset);
+      return false;
+    }
+
+    _param.i_log_level = X264_LOG_WARNING;
+    _param.i_threads = (config.Threads > 0) ? config.Threads : X264_THREADS_AUTO;
+    _param.i_width = config.Width;
+    _param.i_height = config.Height;
+    _param.i_csp = X264_CSP_I420;
+    _param.i_fps_num = config.FrameRateNum;
+    _param.i_fps_den = config.FrameRateDen;
+    _param.i_timebase_num = 1;
+    _param.i_timebase_den = VIDEO_ENCODER_CLOCK_RATE;
+    _param.b_vfr_input = 1;
+    _param.i_keyint_max = X264_KEYINT_MAX_INFINITE;
+    if (config.IntraRefresh) {
+      // The keyint is the refresh period, x264 still doesn't insert IDR frames.
+      _param.b_intra_refresh = 1;
+      _param.i_keyint_max = (config.KeyFrameInterval > 0) ? config.KeyFrameInterval : VIDEO_ENCODER_INTRA_REFRESH_PERIOD;
+    }
+    _param.i_scenecut_threshold = 0;
+    _param.b_repeat_headers = 1;
+    _param.b_annexb = 1;
+    SetRateControl(config.BitrateKbps);
+
+    if (x264_param_apply_profile(&_param, X264_PROFILE) < 0) {
+      printf("Failed to apply x264 profile %s.\n", X264_PROFILE);
+      return false;
+    }
+
+    _pEncoder = x264_encoder_open(&_param);
+    if (_pEncoder == nullptr) {
+      printf("Failed to open x264 encoder.\n");
+      return false;
+    }
+
+    return true;
+  }
+
+  bool Encode(const uint8_t* pI420, int64_t pts, bool keyFrame) override
+  {
+    x264_picture_t picture;
+    x264_picture_init(&picture);
+    picture.img.i_csp = X264_CSP_I420;
+    picture.img.i_plane = 3;
+    picture.img.i_stride[0] = _config.Width;
+    picture.img.i_stride[1] = (_config.Width + 1) / 2;
+    picture.img.i_stride[2] = (_config.Width + 1) / 2;
+    GetI420Planes(pI420, (const uint8_t**)&picture.img.plane[0], (const uint8_t**)&picture.img.plane[1],
+      (const uint8_t**)&picture.img.plane[2]);
+    picture.i_pts = pts;
+    picture.i_type = keyFrame ? X264_TYPE_IDR : X264_TYPE_AUTO;
+    if (!_qpOffsets.empty()) {
+      picture.prop.quant_offsets = _qpOffsets.data();     // Used before x264_encoder_encode returns.
+    }
+
+    return EncodePicture(&picture);
+  }
+
+  bool SetRate(unsigned int bitrateKbps, unsigned int frameRateNum, unsigned int frameRateDen) override
+  {
+    _param.i_fps_num = frameRateNum;
+    _param.i_fps_den = frameRateDen;
+    SetRateControl(bitrateKbps);
+
+    if (x264_encoder_reconfig(_pEncoder, &_param) < 0) {
+      printf("x264 encoder rejected the new bitrate %u kbps.\n", bitrateKbps);
+      return false;
+    }
+
+    return true;
+  }
+
+  bool Flush() override
+  {
+    while (x264_encoder_delayed_frames(_pEncoder) > 0) {
+      if (!EncodePicture(nullptr)) {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+private:
+
+  /* Constant bitrate with a one second VBV buffer. x264 only allows the bitrate to be reconfigured if VBV was set when it was opened. */
+  void SetRateControl(unsigned int bitrateKbps)
+  {
+    _param.rc.i_rc_method = X264_RC_ABR;
+    _param.rc.i_bitrate = bitrateKbps;
+    _param.rc.i_vbv_max_bitrate = bitrateKbps;
+    _param.rc.i_vbv_buffer_size = bitrateKbps;
+  }
+
+  /* Encodes a picture, or a delayed frame if null, and queues the NAL units which x264 returns in one contiguous buffer. */
+  bool EncodePicture(x264_picture_t* pPicture)
+  {
+    x264_nal_t* pNals = nullptr;
+    int nalCount = 0;
+    x264_picture_t outPicture;
+
+    int frameSize = x264_encoder_encode(_pEncoder, &pNals, &nalCount, pPicture, &outPicture);
+    if (frameSize < 0) {
+      printf("x264 failed to encode frame.\n");
+      return false;
+    }
+
+    if (frameSize > 0) {
+      // With intra refresh x264 also flags the frame each refresh starts on as a key frame, it's only an IDR frame a receiver can start from.
+      QueueAccessUnit(pNals[0].p_payload, frameSize, outPicture.i_pts, outPicture.i_type == X264_TYPE_IDR);
+    }
+
+    return true;
+  }
+
+  x264_param_t _param;
+  x264_t* _pEncoder = nullptr;
+};
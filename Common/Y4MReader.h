@@ -0,0 +1,148 @@
+/******************************************************************************
+* Filename: Y4MReader.h
+*
+* Description:
+* This header file contains the Y4M (YUV4MPEG2) loader used by the benchmarks
+* to read raw I420 recordings, so their results aren't affected by webcam
+* capture and can be repeated, plus the percentile used to summarise their
+* per frame measurements.
+*
+* Only 8 bit 4:2:0 files are supported, which is what ffmpeg writes for
+* -pix_fmt yuv420p:
+* ffmpeg -i input.mp4 -vf scale=1280:720 -pix_fmt yuv420p -frames:v 300 input.y4m
+*
+* License: Public Domain (no warranty, use at own risk)
+/******************************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#define Y4M_FRAME_HEADER "FRAME"
+
+/* Raw I420 frames loaded from a Y4M file. */
+struct Y4MVideo
+{
+  unsigned int Width = 0;
+  unsigned int Height = 0;
+  unsigned int FrameRateNum = 30;
+  unsigned int FrameRateDen = 1;
+  std::vector<std::vector<uint8_t>> Frames;
+};
+
+/**
+* Checks a Y4M colour space parameter is 8 bit 4:2:0. The suffixes only differ
+* in where the chroma samples are sited, any other, e.g. C420p10, has more
+* bytes per sample.
+* @param[in] param: the colour space parameter including its leading 'C'.
+* @@Returns true if the frames are 8 bit I420.
+*/
+inline bool IsY4MColourSpace420(const std::string& param)
+{
+  return param == "C420" || param == "C420jpeg" || param == "C420mpeg2" || param == "C420paldv";
+}
+
+/**
+* Loads the frames from a Y4M file into memory so disk reads aren't included in
+* the timings. Only 8 bit 4:2:0 is supported, as the codecs expect I420.
+* @param[in] path: the path of the Y4M file.
+* @param[in] maxFrames: the maximum number of frames to load.
+* @param[out] video: the frames and their format.
+* @@Returns true if at least one frame was loaded.
+*/
+inline bool LoadY4M(const char* path, unsigned int maxFrames, Y4MVideo& video)
+{
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    printf("Failed to open %s.\n", path);
+    return false;
+  }
+
+  std::string header;
+  std::getline(file, header);
+  if (header.compare(0, 9, "YUV4MPEG2") != 0) {
+    printf("%s is not a Y4M file.\n", path);
+    return false;
+  }
+
+  // Header parameters are space separated and identified by their first character.
+  size_t posn = 9;
+  while (posn < header.size()) {
+    size_t end = header.find(' ', posn + 1);
+    std::string param = header.substr(posn + 1, end - posn - 1);
+    posn = (end == std::string::npos) ? header.size() : end;
+
+    if (param.empty()) {
+      continue;
+    }
+
+    switch (param[0]) {
+    case 'W':
+      video.Width = atoi(param.c_str() + 1);
+      break;
+    case 'H':
+      video.Height = atoi(param.c_str() + 1);
+      break;
+    case 'F':
+      sscanf(param.c_str() + 1, "%u:%u", &video.FrameRateNum, &video.FrameRateDen);
+      break;
+    case 'C':
+      if (!IsY4MColourSpace420(param)) {
+        printf("Unsupported Y4M colour space %s, only 8 bit 4:2:0 is supported.\n", param.c_str());
+        return false;
+      }
+      break;
+    default:
+      break;
+    }
+  }
+
+  if (video.Width == 0 || video.Height == 0 || video.FrameRateNum == 0 || video.FrameRateDen == 0) {
+    printf("Y4M header missing the frame size or rate.\n");
+    return false;
+  }
+
+  size_t frameSize = video.Width * video.Height + 2 * ((video.Width + 1) / 2) * ((video.Height + 1) / 2);
+  std::string frameHeader;
+
+  while (video.Frames.size() < maxFrames && std::getline(file, frameHeader)) {
+    if (frameHeader.compare(0, 5, Y4M_FRAME_HEADER) != 0) {
+      printf("Y4M frame %zu has an invalid header.\n", video.Frames.size());
+      return false;
+    }
+
+    std::vector<uint8_t> frame(frameSize);
+    if (!file.read((char*)frame.data(), frameSize)) {
+      break;
+    }
+
+    video.Frames.push_back(std::move(frame));
+  }
+
+  if (video.Frames.empty()) {
+    printf("No frames in %s.\n", path);
+    return false;
+  }
+
+  return true;
+}
+
+/* Nearest rank percentile, e.g. 50 or 99. */
+inline double Percentile(std::vector<double> values, double percentile)
+{
+  if (values.empty()) {
+    return 0;
+  }
+
+  std::sort(values.begin(), values.end());
+  size_t rank = (size_t)std::ceil(percentile / 100.0 * values.size());
+  return values[(rank > 0) ? rank - 1 : 0];
+}
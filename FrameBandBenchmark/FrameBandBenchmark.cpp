@@ -0,0 +1,402 @@
+/******************************************************************************
+* Filename: FrameBandBenchmark.cpp
+*
+* Description:
+* This file contains a C++ console application that measures how the per frame
+* pixel kernels in the Common folder scale across cores when a frame is split
+* into bands of rows and run on the FrameBandExecutor's threads. The kernels
+* are:
+*  - yuy2-rgb32: ColourConverter from a webcam's YUY2 to the EVR's RGB32.
+*  - i420-bgra: ColourConverter from decoded I420 to BGRA.
+*  - bgra-i420: ColourConverter from BGRA to I420 for an encoder.
+*  - scale: ScaleI420 down to 3/4 of the size, the adaptation step the samples use.
+*  - metrics: VideoQualityMetrics PSNR and SSIM.
+*
+* Each kernel is timed with each thread count and its speedup and scaling
+* efficiency, the speedup divided by the thread count, are worked out from the
+* single thread time. The output of the pixel kernels is checked to be the same
+* as converting or scaling the whole frame at once.
+*
+* Usage:
+* FrameBandBenchmark [option=value ...]
+*
+* The options are given as name=value, lists are comma separated:
+* sizes=1920x1080,3840x2160      frame sizes, the width and height need to be even.
+* threads=1,2,4,8                thread counts, 1 is always included as the
+*                                baseline, the default is powers of two up to
+*                                one per core.
+* kernels=yuy2-rgb32,scale,...   the kernels to run, the default is all of them.
+* pin=1                          0 to leave the worker threads unpinned.
+* ms=300                         the minimum time to spend timing each kernel.
+* csv=results.csv                write the results as CSV.
+*
+* The benchmark doesn't use Media Foundation so it also builds on Linux:
+* g++ -O2 -std=c++17 FrameBandBenchmark.cpp -pthread -o FrameBandBenchmark
+*
+* License: Public Domain (no warranty, use at own risk)
+/******************************************************************************/
+
+#include "../Common/ColourConverter.h"
+#include "../Common/FrameBandExecutor.h"
+#include "../Common/I420Scaler.h"
+#include "../Common/VideoQualityMetrics.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define DEFAULT_MEASURE_MS 300.0
+#define MIN_ITERATIONS 5
+
+static const char* KERNEL_NAMES[] = { "yuy2-rgb32", "i420-bgra", "bgra-i420", "scale", "metrics" };
+
+/* The source frames for one frame size and a buffer for the kernels to write to. */
+struct TestFrames
+{
+  unsigned int Width = 0;
+  unsigned int Height = 0;
+  std::vector<uint8_t> Yuy2;
+  std::vector<uint8_t> I420;
+  std::vector<uint8_t> Distorted;       // I420 with noise added, for the metrics.
+  std::vector<uint8_t> Bgra;
+  std::vector<uint8_t> Output;          // Big enough for any kernel's output.
+};
+
+/* The timing for one kernel at one frame size and thread count. */
+struct KernelResult
+{
+  std::string Kernel;
+  unsigned int Width = 0;
+  unsigned int Height = 0;
+  unsigned int Threads = 0;
+  double Ms = 0;                        // Mean time per frame.
+  double Speedup = 0;                   // Single thread time over this time.
+  double Efficiency = 0;                // Speedup over the thread count.
+  bool IsChecked = false;               // False for the metrics, which have no pixel output.
+  bool IsExact = false;                 // The output matches running the kernel on the whole frame at once.
+};
+
+std::vector<std::string> SplitList(const std::string& list);
+void CreateTestFrames(unsigned int width, unsigned int height, TestFrames& frames);
+void RunKernel(const std::string& kernel, TestFrames& frames, FrameBandExecutor& executor,
+  std::vector<ColourConverter>& converters, VideoQualityMetrics& metrics);
+size_t GetReferenceOutput(const std::string& kernel, TestFrames& frames, std::vector<uint8_t>& output);
+double TimeKernel(const std::function<void()>& kernel, double measureMs);
+bool WriteCsv(const std::string& path, const std::vector<KernelResult>& results);
+
+int main(int argc, char* argv[])
+{
+  std::vector<std::pair<unsigned int, unsigned int>> sizes = { { 1920, 1080 }, { 3840, 2160 } };
+  std::vector<unsigned int> threadCounts;
+  std::vector<std::string> kernels(std::begin(KERNEL_NAMES), std::end(KERNEL_NAMES));
+  bool pinThreads = true;
+  double measureMs = DEFAULT_MEASURE_MS;
+  std::string csvPath;
+
+  unsigned int cores = std::max(1U, std::thread::hardware_concurrency());
+  for (unsigned int threads = 1; threads < cores; threads *= 2) {
+    threadCounts.push_back(threads);
+  }
+  threadCounts.push_back(cores);
+
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    size_t equals = arg.find('=');
+    if (equals == std::string::npos) {
+      printf("Option %s isn't in the form name=value.\n", arg.c_str());
+      return 1;
+    }
+
+    std::string name = arg.substr(0, equals);
+    std::string value = arg.substr(equals + 1);
+
+    if (name == "sizes") {
+      sizes.clear();
+      for (const std::string& item : SplitList(value)) {
+        unsigned int width = 0, height = 0;
+        if (sscanf(item.c_str(), "%ux%u", &width, &height) != 2 || width == 0 || height == 0 || (width % 2) != 0 || (height % 2) != 0) {
+          printf("Size %s isn't in the form WxH with an even width and height.\n", item.c_str());
+          return 1;
+        }
+        sizes.push_back({ width, height });
+      }
+    }
+    else if (name == "threads") {
+      threadCounts = { 1 };
+      for (const std::string& item : SplitList(value)) {
+        unsigned int threads = (unsigned int)atoi(item.c_str());
+        if (threads == 0) {
+          printf("Thread count %s isn't a number above 0.\n", item.c_str());
+          return 1;
+        }
+        threadCounts.push_back(threads);
+      }
+      std::sort(threadCounts.begin(), threadCounts.end());
+      threadCounts.erase(std::unique(threadCounts.begin(), threadCounts.end()), threadCounts.end());
+    }
+    else if (name == "kernels") {
+      kernels = SplitList(value);
+      for (const std::string& kernel : kernels) {
+        if (std::find(std::begin(KERNEL_NAMES), std::end(KERNEL_NAMES), kernel) == std::end(KERNEL_NAMES)) {
+          printf("Unknown kernel %s.\n", kernel.c_str());
+          return 1;
+        }
+      }
+    }
+    else if (name == "pin") {
+      pinThreads = atoi(value.c_str()) != 0;
+    }
+    else if (name == "ms") {
+      measureMs = atof(value.c_str());
+    }
+    else if (name == "csv") {
+      csvPath = value;
+    }
+    else {
+      printf("Unknown option %s.\n", name.c_str());
+      return 1;
+    }
+  }
+
+  printf("%u cores, ColourConverter built with %s, worker threads %s.\n", cores, ColourConverter::GetSimdName(),
+    pinThreads ? "pinned" : "not pinned");
+
+  std::vector<KernelResult> results;
+
+  for (const auto& size : sizes) {
+    TestFrames frames;
+    CreateTestFrames(size.first, size.second, frames);
+
+    printf("\n%ux%u\n", frames.Width, frames.Height);
+    printf("%-11s %7s %9s %8s %9s %10s %6s\n", "kernel", "threads", "ms/frame", "fps", "speedup", "efficiency", "exact");
+
+    std::vector<double> singleThreadMs(kernels.size(), 0);
+    std::vector<std::vector<uint8_t>> referenceOutputs(kernels.size());
+    std::vector<size_t> referenceSizes(kernels.size(), 0);
+    for (size_t k = 0; k < kernels.size(); k++) {
+      referenceSizes[k] = GetReferenceOutput(kernels[k], frames, referenceOutputs[k]);
+    }
+
+    for (unsigned int threads : threadCounts) {
+      FrameBandExecutor executor(threads, pinThreads);
+      std::vector<ColourConverter> converters(threads);
+      VideoQualityMetrics metrics(executor);
+
+      if (pinThreads && threads > 1 && !executor.ArePinned()) {
+        printf("The worker threads couldn't be pinned on this platform.\n");
+      }
+
+      for (size_t k = 0; k < kernels.size(); k++) {
+        KernelResult result;
+        result.Kernel = kernels[k];
+        result.Width = frames.Width;
+        result.Height = frames.Height;
+        result.Threads = threads;
+
+        std::fill(frames.Output.begin(), frames.Output.end(), 0);
+        result.Ms = TimeKernel([&]() { RunKernel(kernels[k], frames, executor, converters, metrics); }, measureMs);
+
+        if (threads == 1) {
+          singleThreadMs[k] = result.Ms;
+        }
+        result.Speedup = singleThreadMs[k] / result.Ms;
+        result.Efficiency = result.Speedup / threads;
+        result.IsChecked = referenceSizes[k] > 0;
+        result.IsExact = result.IsChecked && std::equal(referenceOutputs[k].begin(), referenceOutputs[k].begin() + referenceSizes[k], frames.Output.begin());
+
+        printf("%-11s %7u %9.3f %8.1f %8.2fx %9.0f%% %6s\n", result.Kernel.c_str(), threads, result.Ms, 1000.0 / result.Ms,
+          result.Speedup, result.Efficiency * 100, !result.IsChecked ? "-" : result.IsExact ? "yes" : "NO");
+
+        results.push_back(result);
+      }
+    }
+  }
+
+  if (!csvPath.empty() && !WriteCsv(csvPath, results)) {
+    return 1;
+  }
+
+  return 0;
+}
+
+std::vector<std::string> SplitList(const std::string& list)
+{
+  std::vector<std::string> items;
+  size_t start = 0;
+
+  while (start <= list.size()) {
+    size_t end = list.find(',', start);
+    if (end == std::string::npos) {
+      end = list.size();
+    }
+
+    if (end > start) {
+      items.push_back(list.substr(start, end - start));
+    }
+    start = end + 1;
+  }
+
+  return items;
+}
+
+/* Fills the source frames with a gradient and noise, the content doesn't change the timings. */
+void CreateTestFrames(unsigned int width, unsigned int height, TestFrames& frames)
+{
+  frames.Width = width;
+  frames.Height = height;
+  frames.I420.resize(GetColourImageSize(ColourFormat::I420, width, height));
+  frames.Distorted.resize(frames.I420.size());
+
+  uint32_t seed = width * 31 + height;
+  for (size_t i = 0; i < frames.I420.size(); i++) {
+    seed = seed * 1664525 + 1013904223;
+    frames.I420[i] = (uint8_t)((i / 7) + (seed >> 28));
+    frames.Distorted[i] = (uint8_t)std::min(255, std::max(0, frames.I420[i] + (int)((seed >> 24) & 7) - 4));
+  }
+
+  frames.Yuy2.resize(GetColourImageSize(ColourFormat::YUY2, width, height));
+  frames.Bgra.resize(GetColourImageSize(ColourFormat::BGRA, width, height));
+  frames.Output.resize(frames.Bgra.size());
+
+  ColourConverter converter;
+  ColourImage i420 = GetColourImage(ColourFormat::I420, frames.I420.data(), width, height);
+  converter.Convert(i420, GetColourImage(ColourFormat::YUY2, frames.Yuy2.data(), width, height));
+  converter.Convert(i420, GetColourImage(ColourFormat::BGRA, frames.Bgra.data(), width, height));
+}
+
+/* Converts an image in bands on the executor's threads, each thread with its own converter. */
+void ConvertInBands(const ColourImage& source, const ColourImage& destination, FrameBandExecutor& executor, std::vector<ColourConverter>& converters)
+{
+  size_t bytesPerRow = (GetColourImageSize(source.Format, source.Width, 2) + GetColourImageSize(destination.Format, destination.Width, 2)) / 2;
+
+  executor.Run(source.Height, bytesPerRow, 2, [&](unsigned int top, unsigned int bottom, unsigned int thread) {
+    converters[thread].Convert(GetColourImageRows(source, top, bottom - top), GetColourImageRows(destination, top, bottom - top));
+  });
+}
+
+/**
+* Runs a kernel over a frame split into bands.
+* @param[in] kernel: the kernel's name.
+* @param[in] frames: the source frames and the buffer to write to.
+* @param[in] executor: the executor to run the bands with.
+* @param[in] converters: a colour converter for each of the executor's threads.
+* @param[in] metrics: quality metrics that use the executor.
+*/
+void RunKernel(const std::string& kernel, TestFrames& frames, FrameBandExecutor& executor,
+  std::vector<ColourConverter>& converters, VideoQualityMetrics& metrics)
+{
+  unsigned int width = frames.Width, height = frames.Height;
+
+  if (kernel == "yuy2-rgb32") {
+    ConvertInBands(GetColourImage(ColourFormat::YUY2, frames.Yuy2.data(), width, height),
+      GetColourImage(ColourFormat::RGB32, frames.Output.data(), width, height), executor, converters);
+  }
+  else if (kernel == "i420-bgra") {
+    ConvertInBands(GetColourImage(ColourFormat::I420, frames.I420.data(), width, height),
+      GetColourImage(ColourFormat::BGRA, frames.Output.data(), width, height), executor, converters);
+  }
+  else if (kernel == "bgra-i420") {
+    ConvertInBands(GetColourImage(ColourFormat::BGRA, frames.Bgra.data(), width, height),
+      GetColourImage(ColourFormat::I420, frames.Output.data(), width, height), executor, converters);
+  }
+  else if (kernel == "scale") {
+    unsigned int scaledWidth = width * 3 / 4, scaledHeight = height * 3 / 4;
+    size_t bytesPerRow = (size_t)width * 3 / 2 * height / scaledHeight + (size_t)scaledWidth * 3 / 2;
+
+    executor.Run(scaledHeight, bytesPerRow, 2, [&](unsigned int top, unsigned int bottom, unsigned int) {
+      ScaleI420(frames.I420.data(), width, height, frames.Output.data(), scaledWidth, scaledHeight, top, bottom);
+    });
+  }
+  else if (kernel == "metrics") {
+    QualityScores scores;
+    metrics.Measure(GetI420QualityFrame(frames.I420.data(), width, height), GetI420QualityFrame(frames.Distorted.data(), width, height), scores);
+  }
+}
+
+/**
+* Runs a pixel kernel on the whole frame at once on the caller's thread.
+* @param[in] kernel: the kernel's name.
+* @param[in] frames: the source frames.
+* @param[out] output: the kernel's output.
+* @@Returns The bytes of output, 0 for kernels with no pixel output.
+*/
+size_t GetReferenceOutput(const std::string& kernel, TestFrames& frames, std::vector<uint8_t>& output)
+{
+  if (kernel == "metrics") {
+    return 0;
+  }
+
+  ColourConverter converter;
+  unsigned int width = frames.Width, height = frames.Height;
+  size_t size = 0;
+  output.assign(frames.Output.size(), 0);
+
+  if (kernel == "yuy2-rgb32") {
+    converter.Convert(GetColourImage(ColourFormat::YUY2, frames.Yuy2.data(), width, height), GetColourImage(ColourFormat::RGB32, output.data(), width, height));
+    size = GetColourImageSize(ColourFormat::RGB32, width, height);
+  }
+  else if (kernel == "i420-bgra") {
+    converter.Convert(GetColourImage(ColourFormat::I420, frames.I420.data(), width, height), GetColourImage(ColourFormat::BGRA, output.data(), width, height));
+    size = GetColourImageSize(ColourFormat::BGRA, width, height);
+  }
+  else if (kernel == "bgra-i420") {
+    converter.Convert(GetColourImage(ColourFormat::BGRA, frames.Bgra.data(), width, height), GetColourImage(ColourFormat::I420, output.data(), width, height));
+    size = GetColourImageSize(ColourFormat::I420, width, height);
+  }
+  else if (kernel == "scale") {
+    ScaleI420(frames.I420.data(), width, height, output.data(), width * 3 / 4, height * 3 / 4);
+    size = GetI420FrameSize(width * 3 / 4, height * 3 / 4);
+  }
+
+  return size;
+}
+
+/**
+* Repeats a kernel until at least measureMs have passed and MIN_ITERATIONS have
+* been done, after one untimed run to warm the caches and the threads.
+* @param[in] kernel: runs the kernel once.
+* @param[in] measureMs: the minimum time to spend.
+* @@Returns The mean milliseconds per run.
+*/
+double TimeKernel(const std::function<void()>& kernel, double measureMs)
+{
+  kernel();
+
+  auto start = std::chrono::steady_clock::now();
+  double elapsedMs = 0;
+  unsigned int iterations = 0;
+
+  while (elapsedMs < measureMs || iterations < MIN_ITERATIONS) {
+    kernel();
+    iterations++;
+    elapsedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+  }
+
+  return elapsedMs / iterations;
+}
+
+bool WriteCsv(const std::string& path, const std::vector<KernelResult>& results)
+{
+  FILE* pFile = fopen(path.c_str(), "w");
+  if (pFile == nullptr) {
+    printf("Failed to open %s for writing.\n", path.c_str());
+    return false;
+  }
+
+  fprintf(pFile, "kernel,width,height,threads,ms,speedup,efficiency,exact\n");
+
+  for (const KernelResult& result : results) {
+    fprintf(pFile, "%s,%u,%u,%u,%.4f,%.3f,%.3f,%s\n", result.Kernel.c_str(), result.Width, result.Height, result.Threads,
+      result.Ms, result.Speedup, result.Efficiency, !result.IsChecked ? "" : result.IsExact ? "1" : "0");
+  }
+
+  fclose(pFile);
+  printf("Results written to %s.\n", path.c_str());
+  return true;
+}
@@ -0,0 +1,313 @@
+/******************************************************************************
+* Filename: FrameCopyBenchmark.cpp
+*
+* Description:
+* This file contains a C++ console application that measures CopyColourImage in
+* the Common folder, the copy the samples use to hand a frame from one stage to
+* the next, against a plain memcpy of each row.
+*
+* Each copy is timed at each frame size, pixel format and layout with memcpy
+* for each row, CopyColourImage with memcpy (cached), CopyColourImage with
+* streaming stores and CopyColourImage choosing by the frame size (auto), and
+* reported as GB/s of frame copied. The layouts are:
+*  - contiguous: the source and destination have no padding.
+*  - padded: the destination rows are padded to a 256 byte pitch, like a
+*    Direct3D surface.
+*  - flipped: the source is bottom up and the destination top down, like an
+*    RGB32 source reader sample going to an EVR surface.
+* The output of each copy is checked against the memcpy one.
+*
+* Usage:
+* FrameCopyBenchmark [option=value ...]
+*
+* The options are given as name=value, lists are comma separated:
+* sizes=640x480,1920x1080        frame sizes, the width and height need to be even.
+* formats=RGB32,I420,NV12        pixel formats.
+* layouts=contiguous,padded      the layouts to time, the default is all of them.
+* frames=1                       frames to cycle through, e.g. enough to exceed
+*                                the last level cache so the source isn't
+*                                already in it.
+* ms=300                         the minimum time to spend timing each copy.
+* csv=results.csv                write the results as CSV.
+*
+* The benchmark doesn't use Media Foundation so it also builds on Linux:
+* g++ -O2 -std=c++17 FrameCopyBenchmark.cpp -o FrameCopyBenchmark
+*
+* License: Public Domain (no warranty, use at own risk)
+/******************************************************************************/
+
+#include "../Common/ColourConverter.h"
+#include "../Common/FrameCopy.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+
+#define DEFAULT_MEASURE_MS 300.0
+#define MIN_ITERATIONS 5
+#define PADDED_PITCH_ALIGNMENT 256
+
+static const char* LAYOUT_NAMES[] = { "contiguous", "padded", "flipped" };
+static const char* METHOD_NAMES[] = { "memcpy-row", "cached", "streaming", "auto" };
+
+/* The timing for one copy method at one frame size, format and layout. */
+struct CopyResult
+{
+  unsigned int Width = 0;
+  unsigned int Height = 0;
+  ColourFormat Format = ColourFormat::I420;
+  std::string Layout;
+  std::string Method;
+  double Ms = 0;                        // Mean time per frame.
+  double GBPerSecond = 0;               // Frame bytes copied per second.
+  bool IsExact = false;                 // The output matches the memcpy one.
+};
+
+std::vector<std::string> SplitList(const std::string& list);
+void CopyRows(const ColourImage& source, const ColourImage& destination);
+double TimeCopy(const std::function<void()>& copy, double measureMs);
+bool WriteCsv(const std::string& path, const std::vector<CopyResult>& results);
+
+int main(int argc, char* argv[])
+{
+  std::vector<std::pair<unsigned int, unsigned int>> sizes = { { 640, 480 }, { 1920, 1080 }, { 3840, 2160 } };
+  std::vector<ColourFormat> formats = { ColourFormat::RGB32, ColourFormat::I420, ColourFormat::NV12 };
+  std::vector<std::string> layouts(std::begin(LAYOUT_NAMES), std::end(LAYOUT_NAMES));
+  unsigned int frameCount = 1;
+  double measureMs = DEFAULT_MEASURE_MS;
+  std::string csvPath;
+
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    size_t equals = arg.find('=');
+    if (equals == std::string::npos) {
+      printf("Option %s isn't in the form name=value.\n", arg.c_str());
+      return 1;
+    }
+
+    std::string name = arg.substr(0, equals);
+    std::string value = arg.substr(equals + 1);
+
+    if (name == "sizes") {
+      sizes.clear();
+      for (const std::string& item : SplitList(value)) {
+        unsigned int width = 0, height = 0;
+        if (sscanf(item.c_str(), "%ux%u", &width, &height) != 2 || width == 0 || height == 0 || (width % 2) != 0 || (height % 2) != 0) {
+          printf("Size %s isn't in the form WxH with an even width and height.\n", item.c_str());
+          return 1;
+        }
+        sizes.push_back({ width, height });
+      }
+    }
+    else if (name == "formats") {
+      formats.clear();
+      for (const std::string& item : SplitList(value)) {
+        const ColourFormat candidates[] = { ColourFormat::RGB24, ColourFormat::RGB32, ColourFormat::BGRA, ColourFormat::I420,
+          ColourFormat::NV12, ColourFormat::YUY2, ColourFormat::UYVY };
+        std::string upper = item;
+        std::transform(upper.begin(), upper.end(), upper.begin(), ::toupper);
+
+        auto found = std::find_if(std::begin(candidates), std::end(candidates),
+          [&](ColourFormat format) { return upper == GetColourFormatName(format); });
+        if (found == std::end(candidates)) {
+          printf("Unknown format %s.\n", item.c_str());
+          return 1;
+        }
+        formats.push_back(*found);
+      }
+    }
+    else if (name == "layouts") {
+      layouts = SplitList(value);
+      for (const std::string& layout : layouts) {
+        if (std::find(std::begin(LAYOUT_NAMES), std::end(LAYOUT_NAMES), layout) == std::end(LAYOUT_NAMES)) {
+          printf("Unknown layout %s.\n", layout.c_str());
+          return 1;
+        }
+      }
+    }
+    else if (name == "frames") {
+      frameCount = std::max(1, atoi(value.c_str()));
+    }
+    else if (name == "ms") {
+      measureMs = atof(value.c_str());
+    }
+    else if (name == "csv") {
+      csvPath = value;
+    }
+    else {
+      printf("Unknown option %s.\n", name.c_str());
+      return 1;
+    }
+  }
+
+  printf("Last level cache %.1f MB, cycling through %u frame(s).\n", GetLastLevelCacheBytes() / (1024.0 * 1024.0), frameCount);
+  printf("%-10s %-6s %-10s %-10s | %9s %8s %6s\n", "size", "format", "layout", "method", "ms/frame", "GB/s", "exact");
+
+  std::vector<CopyResult> results;
+
+  for (const auto& size : sizes) {
+    unsigned int width = size.first, height = size.second;
+
+    for (ColourFormat format : formats) {
+      size_t frameBytes = GetColourImageSize(format, width, height);
+      size_t lumaRowBytes = 0;
+      unsigned int lumaRows = 0;
+      GetColourPlaneSize(GetColourImage(format, nullptr, width, height), 0, lumaRowBytes, lumaRows);
+      int rowBytes = (int)lumaRowBytes;
+      int paddedPitch = (rowBytes + PADDED_PITCH_ALIGNMENT - 1) / PADDED_PITCH_ALIGNMENT * PADDED_PITCH_ALIGNMENT;
+
+      for (const std::string& layout : layouts) {
+        // Negative strides make GetColourImage start each plane from its bottom row.
+        int sourceStride = (layout == "flipped") ? -rowBytes : 0;
+        int destinationStride = (layout == "padded") ? paddedPitch : 0;
+        size_t destinationBytes = (layout == "padded") ? frameBytes / rowBytes * paddedPitch : frameBytes;
+
+        std::vector<std::vector<uint8_t>> sourceBuffers(frameCount, std::vector<uint8_t>(frameBytes));
+        std::vector<std::vector<uint8_t>> destinationBuffers(frameCount, std::vector<uint8_t>(destinationBytes));
+        std::vector<ColourImage> sources, destinations;
+
+        uint32_t seed = width * 31 + height;
+        for (unsigned int f = 0; f < frameCount; f++) {
+          for (size_t i = 0; i < frameBytes; i++) {
+            seed = seed * 1664525 + 1013904223;
+            sourceBuffers[f][i] = (uint8_t)(seed >> 24);
+          }
+          sources.push_back(GetColourImage(format, sourceBuffers[f].data(), width, height, sourceStride));
+          destinations.push_back(GetColourImage(format, destinationBuffers[f].data(), width, height, destinationStride));
+        }
+
+        std::vector<uint8_t> reference;
+
+        for (const char* method : METHOD_NAMES) {
+          std::string methodName = method;
+          FrameCopyMode mode = (methodName == "cached") ? FrameCopyMode::Cached :
+            (methodName == "streaming") ? FrameCopyMode::Streaming : FrameCopyMode::Auto;
+          unsigned int frame = 0;
+
+          for (auto& buffer : destinationBuffers) {
+            std::fill(buffer.begin(), buffer.end(), 0);
+          }
+
+          CopyResult result;
+          result.Width = width;
+          result.Height = height;
+          result.Format = format;
+          result.Layout = layout;
+          result.Method = methodName;
+          result.Ms = TimeCopy([&]() {
+            if (methodName == "memcpy-row") {
+              CopyRows(sources[frame], destinations[frame]);
+            }
+            else {
+              CopyColourImage(sources[frame], destinations[frame], mode);
+            }
+            frame = (frame + 1) % frameCount;
+          }, measureMs);
+          result.GBPerSecond = frameBytes / (result.Ms * 1e6);
+
+          if (methodName == "memcpy-row") {
+            reference = destinationBuffers[0];
+          }
+          result.IsExact = destinationBuffers[0] == reference;
+
+          char sizeName[24];
+          snprintf(sizeName, sizeof(sizeName), "%ux%u", width, height);
+          printf("%-10s %-6s %-10s %-10s | %9.3f %8.2f %6s\n", sizeName, GetColourFormatName(format), layout.c_str(),
+            method, result.Ms, result.GBPerSecond, result.IsExact ? "yes" : "NO");
+
+          results.push_back(result);
+        }
+      }
+    }
+  }
+
+  if (!csvPath.empty() && !WriteCsv(csvPath, results)) {
+    return 1;
+  }
+
+  return 0;
+}
+
+std::vector<std::string> SplitList(const std::string& list)
+{
+  std::vector<std::string> items;
+  size_t start = 0;
+
+  while (start <= list.size()) {
+    size_t end = list.find(',', start);
+    if (end == std::string::npos) {
+      end = list.size();
+    }
+
+    if (end > start) {
+      items.push_back(list.substr(start, end - start));
+    }
+    start = end + 1;
+  }
+
+  return items;
+}
+
+/* The baseline, a memcpy for each row of each plane. */
+void CopyRows(const ColourImage& source, const ColourImage& destination)
+{
+  for (int plane = 0; plane < 3; plane++) {
+    size_t rowBytes = 0;
+    unsigned int rows = 0;
+    GetColourPlaneSize(source, plane, rowBytes, rows);
+
+    for (unsigned int y = 0; y < rows; y++) {
+      memcpy(destination.pPlanes[plane] + (ptrdiff_t)y * destination.Strides[plane],
+        source.pPlanes[plane] + (ptrdiff_t)y * source.Strides[plane], rowBytes);
+    }
+  }
+}
+
+/**
+* Repeats a copy until at least measureMs have passed and MIN_ITERATIONS have
+* been done, after one untimed run to fault in the destination's pages.
+* @param[in] copy: copies one frame.
+* @param[in] measureMs: the minimum time to spend.
+* @@Returns The mean milliseconds per frame.
+*/
+double TimeCopy(const std::function<void()>& copy, double measureMs)
+{
+  copy();
+
+  auto start = std::chrono::steady_clock::now();
+  double elapsedMs = 0;
+  unsigned int iterations = 0;
+
+  while (elapsedMs < measureMs || iterations < MIN_ITERATIONS) {
+    copy();
+    iterations++;
+    elapsedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+  }
+
+  return elapsedMs / iterations;
+}
+
+bool WriteCsv(const std::string& path, const std::vector<CopyResult>& results)
+{
+  FILE* pFile = fopen(path.c_str(), "w");
+  if (pFile == nullptr) {
+    printf("Failed to open %s for writing.\n", path.c_str());
+    return false;
+  }
+
+  fprintf(pFile, "width,height,format,layout,method,ms,gb_per_second,exact\n");
+
+  for (const CopyResult& result : results) {
+    fprintf(pFile, "%u,%u,%s,%s,%s,%.4f,%.3f,%d\n", result.Width, result.Height, GetColourFormatName(result.Format),
+      result.Layout.c_str(), result.Method.c_str(), result.Ms, result.GBPerSecond, result.IsExact ? 1 : 0);
+  }
+
+  fclose(pFile);
+  printf("Results written to %s.\n", path.c_str());
+  return true;
+}
@@ -0,0 +1,364 @@
+/******************************************************************************
+* Filename: FrameRotatorBenchmark.cpp
+*
+* Description:
+* This file contains a C++ console application that measures the FrameRotator
+* in the Common folder, which turns frames from cameras mounted sideways or
+* upside down, and mirrors or flips them, before they're encoded or rendered.
+*
+* Each orientation is timed at each frame size and pixel format on one thread
+* with a naive loop that works out where each pixel goes, with the rotator's
+* plain C++ version and with its vectorised one, and the rotator's outputs are
+* checked against the naive one.
+*
+* The conversion from a webcam format, YUY2 by default, to each destination
+* format that's rotated as it goes (fused) is timed against converting the
+* whole frame and then rotating it (two pass), and the outputs compared.
+*
+* Usage:
+* FrameRotatorBenchmark [option=value ...]
+*
+* The options are given as name=value, lists are comma separated:
+* sizes=1920x1080,3840x2160      frame sizes, the width and height need to be even.
+* formats=I420,NV12,RGB32        pixel formats to rotate.
+* orientations=rotate90,mirror   rotate90, rotate180, rotate270, mirror, flip,
+*                                transpose or transverse, the default is all of
+*                                them.
+* convert=YUY2                   the format to convert from for the fused
+*                                timings, none to skip them.
+* ms=300                         the minimum time to spend timing each rotation.
+* csv=results.csv                write the results as CSV.
+*
+* The benchmark doesn't use Media Foundation so it also builds on Linux:
+* g++ -O2 -std=c++17 FrameRotatorBenchmark.cpp -o FrameRotatorBenchmark
+*
+* License: Public Domain (no warranty, use at own risk)
+/******************************************************************************/
+
+#include "../Common/ColourConverter.h"
+#include "../Common/FrameRotator.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <string>
+#include <vector>
+
+#define DEFAULT_MEASURE_MS 300.0
+#define MIN_ITERATIONS 5
+
+static const FrameOrientation ORIENTATIONS[] = { FrameOrientation::Rotate90, FrameOrientation::Rotate180, FrameOrientation::Rotate270,
+  FrameOrientation::Mirror, FrameOrientation::Flip, FrameOrientation::Transpose, FrameOrientation::Transverse };
+
+/* The timings for one orientation of one frame size and format. */
+struct RotateResult
+{
+  unsigned int Width = 0;
+  unsigned int Height = 0;
+  ColourFormat Format = ColourFormat::I420;
+  FrameOrientation Orientation = FrameOrientation::Identity;
+  double NaiveMs = 0;                   // Mean time per frame for the naive loop.
+  double PlainMs = 0;                   // Mean time per frame with the rotator's plain C++ version.
+  double SimdMs = 0;                    // Mean time per frame with the rotator's vectorised version.
+  bool IsExact = false;                 // Both of the rotator's outputs match the naive loop's.
+  double TwoPassMs = NAN;               // Converting then rotating, NAN if the conversion wasn't timed.
+  double FusedMs = NAN;                 // ConvertAndRotate.
+  bool IsFusedExact = false;            // The fused output matches the two pass one.
+};
+
+bool ParseFormat(const std::string& item, ColourFormat& format);
+std::vector<std::string> SplitList(const std::string& list);
+void RotateNaive(const ColourImage& source, const ColourImage& destination, FrameOrientation orientation);
+double TimeRotate(const std::function<void()>& rotate, double measureMs);
+bool WriteCsv(const std::string& path, const std::vector<RotateResult>& results);
+
+int main(int argc, char* argv[])
+{
+  std::vector<std::pair<unsigned int, unsigned int>> sizes = { { 1920, 1080 }, { 3840, 2160 } };
+  std::vector<ColourFormat> formats = { ColourFormat::I420, ColourFormat::NV12, ColourFormat::RGB32 };
+  std::vector<FrameOrientation> orientations(std::begin(ORIENTATIONS), std::end(ORIENTATIONS));
+  ColourFormat convertFormat = ColourFormat::YUY2;
+  bool isConverting = true;
+  double measureMs = DEFAULT_MEASURE_MS;
+  std::string csvPath;
+
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    size_t equals = arg.find('=');
+    if (equals == std::string::npos) {
+      printf("Option %s isn't in the form name=value.\n", arg.c_str());
+      return 1;
+    }
+
+    std::string name = arg.substr(0, equals);
+    std::string value = arg.substr(equals + 1);
+
+    if (name == "sizes") {
+      sizes.clear();
+      for (const std::string& item : SplitList(value)) {
+        unsigned int width = 0, height = 0;
+        if (sscanf(item.c_str(), "%ux%u", &width, &height) != 2 || width == 0 || height == 0 || (width % 2) != 0 || (height % 2) != 0) {
+          printf("Size %s isn't in the form WxH with an even width and height.\n", item.c_str());
+          return 1;
+        }
+        sizes.push_back({ width, height });
+      }
+    }
+    else if (name == "formats") {
+      formats.clear();
+      for (const std::string& item : SplitList(value)) {
+        ColourFormat format;
+        if (!ParseFormat(item, format) || (format != ColourFormat::I420 && format != ColourFormat::NV12 &&
+          format != ColourFormat::RGB32 && format != ColourFormat::BGRA)) {
+          printf("Format %s isn't I420, NV12, RGB32 or BGRA.\n", item.c_str());
+          return 1;
+        }
+        formats.push_back(format);
+      }
+    }
+    else if (name == "orientations") {
+      orientations.clear();
+      for (const std::string& item : SplitList(value)) {
+        auto found = std::find_if(std::begin(ORIENTATIONS), std::end(ORIENTATIONS),
+          [&](FrameOrientation orientation) { return item == GetFrameOrientationName(orientation); });
+        if (found == std::end(ORIENTATIONS)) {
+          printf("Unknown orientation %s.\n", item.c_str());
+          return 1;
+        }
+        orientations.push_back(*found);
+      }
+    }
+    else if (name == "convert") {
+      isConverting = value != "none";
+      if (isConverting && !ParseFormat(value, convertFormat)) {
+        printf("Unknown format %s.\n", value.c_str());
+        return 1;
+      }
+    }
+    else if (name == "ms") {
+      measureMs = atof(value.c_str());
+    }
+    else if (name == "csv") {
+      csvPath = value;
+    }
+    else {
+      printf("Unknown option %s.\n", name.c_str());
+      return 1;
+    }
+  }
+
+  printf("FrameRotator built with %s, times are for one thread.\n", FrameRotator::GetSimdName());
+  if (isConverting) {
+    printf("Two pass and fused times convert from %s as well as rotating.\n", GetColourFormatName(convertFormat));
+  }
+  printf("%-10s %-6s %-10s | %9s %9s %9s %7s %6s | %9s %9s %6s\n", "size", "format", "rotation", "naive ms", "plain ms", "simd ms",
+    "speedup", "exact", "2pass ms", "fused ms", "exact");
+
+  std::vector<RotateResult> results;
+  ColourConverter converter;
+  FrameRotator simdRotator(true), plainRotator(false);
+
+  for (const auto& size : sizes) {
+    unsigned int width = size.first, height = size.second;
+
+    for (ColourFormat format : formats) {
+      std::vector<uint8_t> sourceBuffer(GetColourImageSize(format, width, height));
+      uint32_t seed = width * 31 + height;
+      for (size_t i = 0; i < sourceBuffer.size(); i++) {
+        seed = seed * 1664525 + 1013904223;
+        sourceBuffer[i] = (uint8_t)(seed >> 24);
+      }
+      ColourImage source = GetColourImage(format, sourceBuffer.data(), width, height);
+
+      // The webcam frame for the fused timings and the whole converted frame the two pass version rotates.
+      std::vector<uint8_t> cameraBuffer, convertedBuffer;
+      ColourImage cameraImage, convertedImage;
+      bool isFusing = isConverting && convertFormat != format;
+      if (isFusing) {
+        cameraBuffer.resize(GetColourImageSize(convertFormat, width, height));
+        for (size_t i = 0; i < cameraBuffer.size(); i++) {
+          seed = seed * 1664525 + 1013904223;
+          cameraBuffer[i] = (uint8_t)(seed >> 24);
+        }
+        convertedBuffer.resize(sourceBuffer.size());
+        cameraImage = GetColourImage(convertFormat, cameraBuffer.data(), width, height);
+        convertedImage = GetColourImage(format, convertedBuffer.data(), width, height);
+      }
+
+      for (FrameOrientation orientation : orientations) {
+        bool isTransposed = IsFrameOrientationTransposed(orientation);
+        unsigned int rotatedWidth = isTransposed ? height : width, rotatedHeight = isTransposed ? width : height;
+        std::vector<uint8_t> naiveBuffer(sourceBuffer.size()), plainBuffer(sourceBuffer.size()), simdBuffer(sourceBuffer.size());
+        ColourImage naiveImage = GetColourImage(format, naiveBuffer.data(), rotatedWidth, rotatedHeight);
+        ColourImage plainImage = GetColourImage(format, plainBuffer.data(), rotatedWidth, rotatedHeight);
+        ColourImage simdImage = GetColourImage(format, simdBuffer.data(), rotatedWidth, rotatedHeight);
+
+        RotateResult result;
+        result.Width = width;
+        result.Height = height;
+        result.Format = format;
+        result.Orientation = orientation;
+        result.NaiveMs = TimeRotate([&]() { RotateNaive(source, naiveImage, orientation); }, measureMs);
+        result.PlainMs = TimeRotate([&]() { plainRotator.Rotate(source, plainImage, orientation); }, measureMs);
+        result.SimdMs = TimeRotate([&]() { simdRotator.Rotate(source, simdImage, orientation); }, measureMs);
+        result.IsExact = plainBuffer == naiveBuffer && simdBuffer == naiveBuffer;
+
+        char twoPassText[16] = "-", fusedText[16] = "-";
+        const char* fusedExactText = "-";
+        if (isFusing) {
+          result.TwoPassMs = TimeRotate([&]() {
+            converter.Convert(cameraImage, convertedImage);
+            simdRotator.Rotate(convertedImage, naiveImage, orientation);
+          }, measureMs);
+          result.FusedMs = TimeRotate([&]() { simdRotator.ConvertAndRotate(converter, cameraImage, simdImage, orientation); }, measureMs);
+          result.IsFusedExact = simdBuffer == naiveBuffer;
+
+          snprintf(twoPassText, sizeof(twoPassText), "%.3f", result.TwoPassMs);
+          snprintf(fusedText, sizeof(fusedText), "%.3f", result.FusedMs);
+          fusedExactText = result.IsFusedExact ? "yes" : "NO";
+        }
+
+        char sizeName[24];
+        snprintf(sizeName, sizeof(sizeName), "%ux%u", width, height);
+        printf("%-10s %-6s %-10s | %9.3f %9.3f %9.3f %6.1fx %6s | %9s %9s %6s\n", sizeName, GetColourFormatName(format),
+          GetFrameOrientationName(orientation), result.NaiveMs, result.PlainMs, result.SimdMs, result.NaiveMs / result.SimdMs,
+          result.IsExact ? "yes" : "NO", twoPassText, fusedText, fusedExactText);
+
+        results.push_back(result);
+      }
+    }
+  }
+
+  if (!csvPath.empty() && !WriteCsv(csvPath, results)) {
+    return 1;
+  }
+
+  return 0;
+}
+
+bool ParseFormat(const std::string& item, ColourFormat& format)
+{
+  const ColourFormat candidates[] = { ColourFormat::RGB24, ColourFormat::RGB32, ColourFormat::BGRA, ColourFormat::I420,
+    ColourFormat::NV12, ColourFormat::YUY2, ColourFormat::UYVY };
+  std::string upper = item;
+  std::transform(upper.begin(), upper.end(), upper.begin(), ::toupper);
+
+  auto found = std::find_if(std::begin(candidates), std::end(candidates),
+    [&](ColourFormat candidate) { return upper == GetColourFormatName(candidate); });
+  if (found == std::end(candidates)) {
+    return false;
+  }
+
+  format = *found;
+  return true;
+}
+
+std::vector<std::string> SplitList(const std::string& list)
+{
+  std::vector<std::string> items;
+  size_t start = 0;
+
+  while (start <= list.size()) {
+    size_t end = list.find(',', start);
+    if (end == std::string::npos) {
+      end = list.size();
+    }
+
+    if (end > start) {
+      items.push_back(list.substr(start, end - start));
+    }
+    start = end + 1;
+  }
+
+  return items;
+}
+
+/* The baseline, each sample of each plane copied to where the orientation puts it. */
+void RotateNaive(const ColourImage& source, const ColourImage& destination, FrameOrientation orientation)
+{
+  for (int plane = 0; plane < 3; plane++) {
+    size_t rowBytes = 0;
+    unsigned int rows = 0;
+    GetColourPlaneSize(source, plane, rowBytes, rows);
+    if (rows == 0) {
+      continue;
+    }
+
+    size_t sampleBytes = (source.Format == ColourFormat::I420) ? 1 : (source.Format == ColourFormat::NV12) ? plane + 1 : 4;
+    unsigned int width = (unsigned int)(rowBytes / sampleBytes);
+
+    for (unsigned int y = 0; y < rows; y++) {
+      for (unsigned int x = 0; x < width; x++) {
+        unsigned int toX = x, toY = y;
+        switch (orientation) {
+        case FrameOrientation::Rotate90: toX = rows - 1 - y; toY = x; break;
+        case FrameOrientation::Rotate180: toX = width - 1 - x; toY = rows - 1 - y; break;
+        case FrameOrientation::Rotate270: toX = y; toY = width - 1 - x; break;
+        case FrameOrientation::Mirror: toX = width - 1 - x; break;
+        case FrameOrientation::Flip: toY = rows - 1 - y; break;
+        case FrameOrientation::Transpose: toX = y; toY = x; break;
+        case FrameOrientation::Transverse: toX = rows - 1 - y; toY = width - 1 - x; break;
+        default: break;
+        }
+
+        memcpy(destination.pPlanes[plane] + (ptrdiff_t)toY * destination.Strides[plane] + toX * sampleBytes,
+          source.pPlanes[plane] + (ptrdiff_t)y * source.Strides[plane] + x * sampleBytes, sampleBytes);
+      }
+    }
+  }
+}
+
+/**
+* Repeats a rotation until at least measureMs have passed and MIN_ITERATIONS
+* have been done, after one untimed run to fault in the destination's pages.
+* @param[in] rotate: rotates one frame.
+* @param[in] measureMs: the minimum time to spend.
+* @@Returns The mean milliseconds per frame.
+*/
+double TimeRotate(const std::function<void()>& rotate, double measureMs)
+{
+  rotate();
+
+  auto start = std::chrono::steady_clock::now();
+  double elapsedMs = 0;
+  unsigned int iterations = 0;
+
+  while (elapsedMs < measureMs || iterations < MIN_ITERATIONS) {
+    rotate();
+    iterations++;
+    elapsedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+  }
+
+  return elapsedMs / iterations;
+}
+
+bool WriteCsv(const std::string& path, const std::vector<RotateResult>& results)
+{
+  FILE* pFile = fopen(path.c_str(), "w");
+  if (pFile == nullptr) {
+    printf("Failed to open %s for writing.\n", path.c_str());
+    return false;
+  }
+
+  fprintf(pFile, "width,height,format,orientation,naive_ms,plain_ms,simd_ms,exact,two_pass_ms,fused_ms,fused_exact\n");
+
+  for (const RotateResult& result : results) {
+    fprintf(pFile, "%u,%u,%s,%s,%.4f,%.4f,%.4f,%d,", result.Width, result.Height, GetColourFormatName(result.Format),
+      GetFrameOrientationName(result.Orientation), result.NaiveMs, result.PlainMs, result.SimdMs, result.IsExact ? 1 : 0);
+    if (!std::isnan(result.FusedMs)) {
+      fprintf(pFile, "%.4f,%.4f,%d", result.TwoPassMs, result.FusedMs, result.IsFusedExact ? 1 : 0);
+    }
+    else {
+      fprintf(pFile, ",,");
+    }
+    fprintf(pFile, "\n");
+  }
+
+  fclose(pFile);
+  printf("Results written to %s.\n", path.c_str());
+  return true;
+}
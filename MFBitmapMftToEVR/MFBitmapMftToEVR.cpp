@@ -8,6 +8,11 @@
 * (https://msdn.microsoft.com/en-us/library/windows/desktop/ms694916%28v=vs.85%29.aspx).
 * This example extended the MFBitmapToEVR sample by adding the MFT transform.
 *
+* The transform needs an input and output sample for each bitmap and a copy from
+* its output into the EVR's Direct3D surface. Set USE_COLOUR_CONVERTER to true to
+* use the ColourConverter in the Common folder instead, which converts the bitmap
+* straight into the locked surface.
+*
 * Author:
 * Aaron Clauson (aaron@sipsorcery.com)
 *
@@ -17,6 +22,7 @@
 * License: Public Domain (no warranty, use at own risk)
 /******************************************************************************/
 
+#include "..\Common\ColourConverter.h"
 #include "..\Common\MFUtility.h"
 
 #include <d3d9.h>
@@ -50,6 +56,7 @@
 #define SAMPLE_COUNT 100
 #define FRAME_RATE 10
 #define SAMPLE_DURATION 10 * 1000 * 1000 / FRAME_RATE
+#define USE_COLOUR_CONVERTER false  // Set to true to convert with the ColourConverter instead of the CColorConvertDMO MFT.
 
 // Forward function definitions.
 DWORD InitializeWindow(LPVOID lpThreadParameter);
@@ -76,6 +83,8 @@ int main()
   IDirect3DDeviceManager9* pD3DManager = NULL;
   IMFVideoSampleAllocator* pVideoSampleAllocator = NULL;
   IMFSample* pD3DVideoSample = NULL;
+  IMFMediaBuffer* pDstBuffer = NULL;
+  IMF2DBuffer* p2DBuffer = NULL;
   RECT rc = { 0, 0, FRAME_WIDTH, FRAME_HEIGHT };
   BOOL fSelected = false;
 
@@ -83,6 +92,7 @@ int main()
   IMFTransform* pColorConvTransform = NULL; // This is colour converter MFT is used to convert between RGB32 and RGB24.
   IMFMediaType* pImfRgb24Type = NULL, * pImfRgb32Type = NULL;
   IMFMediaType* pVideoSourceOutType = NULL;
+  ColourConverter colourConverter; // Converts the RGB24 bitmaps to RGB32 when USE_COLOUR_CONVERTER is set.
 
   CHECK_HR(CoInitializeEx(NULL, COINIT_APARTMENTTHREADED | COINIT_DISABLE_OLE1DDE),
     "COM initialisation failed.");
@@ -175,38 +185,40 @@ int main()
   CHECK_HR(pSinkMediaTypeHandler->SetCurrentMediaType(pImfEvrSinkType),
     "Failed to set input media type on EVR sink.");
 
-  // ----- Create an MFT to convert between RGB24 and RGB32. -----
+  if (!USE_COLOUR_CONVERTER) {
+    // ----- Create an MFT to convert between RGB24 and RGB32. -----
 
-  CHECK_HR(MFCreateMediaType(&pImfRgb24Type), "Failed to create RGB24 media type.");
-  CHECK_HR(MFCreateMediaType(&pImfRgb32Type), "Failed to create RGB32 media type.");
+    CHECK_HR(MFCreateMediaType(&pImfRgb24Type), "Failed to create RGB24 media type.");
+    CHECK_HR(MFCreateMediaType(&pImfRgb32Type), "Failed to create RGB32 media type.");
 
-  CHECK_HR(CoCreateInstance(CLSID_CColorConvertDMO, NULL, CLSCTX_INPROC_SERVER,
-    IID_IUnknown, (void**)&colorConvTransformUnk),
-    "Failed to create colour converter MFT.");
+    CHECK_HR(CoCreateInstance(CLSID_CColorConvertDMO, NULL, CLSCTX_INPROC_SERVER,
+      IID_IUnknown, (void**)&colorConvTransformUnk),
+      "Failed to create colour converter MFT.");
 
-  CHECK_HR(colorConvTransformUnk->QueryInterface(IID_PPV_ARGS(&pColorConvTransform)),
-    "Failed to get IMFTransform interface from colour converter MFT object.");
+    CHECK_HR(colorConvTransformUnk->QueryInterface(IID_PPV_ARGS(&pColorConvTransform)),
+      "Failed to get IMFTransform interface from colour converter MFT object.");
 
-  // The input to the transform is a copy of the media type set as the input for the EVR stream sink
-  // but with the video format changed from RGB32 to RGB24.
-  CHECK_HR(pImfEvrSinkType->CopyAllItems(pImfRgb24Type), "Error copying media type attributes to colour converter input media type.");
-  CHECK_HR(pImfRgb24Type->SetGUID(MF_MT_SUBTYPE, MFVideoFormat_RGB24), "Failed to set video sub-type attribute on media type.");
-  CHECK_HR(pColorConvTransform->SetInputType(0, pImfRgb24Type, 0), "Failed to set input media type on colour converter MFT.");
+    // The input to the transform is a copy of the media type set as the input for the EVR stream sink
+    // but with the video format changed from RGB32 to RGB24.
+    CHECK_HR(pImfEvrSinkType->CopyAllItems(pImfRgb24Type), "Error copying media type attributes to colour converter input media type.");
+    CHECK_HR(pImfRgb24Type->SetGUID(MF_MT_SUBTYPE, MFVideoFormat_RGB24), "Failed to set video sub-type attribute on media type.");
+    CHECK_HR(pColorConvTransform->SetInputType(0, pImfRgb24Type, 0), "Failed to set input media type on colour converter MFT.");
 
-  // The output from the transform is an exact copy of the media type set as the input for the EVR stream sink.
-  CHECK_HR(pImfEvrSinkType->CopyAllItems(pImfRgb32Type), "Error copying media type attributes to colour converter output media type.");
-  CHECK_HR(pColorConvTransform->SetOutputType(0, pImfRgb32Type, 0), "Failed to set output media type on colour converter MFT.");
+    // The output from the transform is an exact copy of the media type set as the input for the EVR stream sink.
+    CHECK_HR(pImfEvrSinkType->CopyAllItems(pImfRgb32Type), "Error copying media type attributes to colour converter output media type.");
+    CHECK_HR(pColorConvTransform->SetOutputType(0, pImfRgb32Type, 0), "Failed to set output media type on colour converter MFT.");
 
-  DWORD mftStatus = 0;
-  CHECK_HR(pColorConvTransform->GetInputStatus(0, &mftStatus), "Failed to get input status from colour converter MFT.");
-  if (MFT_INPUT_STATUS_ACCEPT_DATA != mftStatus) {
-    printf("Colour converter MFT is not accepting data.\n");
-    goto done;
-  }
+    DWORD mftStatus = 0;
+    CHECK_HR(pColorConvTransform->GetInputStatus(0, &mftStatus), "Failed to get input status from colour converter MFT.");
+    if (MFT_INPUT_STATUS_ACCEPT_DATA != mftStatus) {
+      printf("Colour converter MFT is not accepting data.\n");
+      goto done;
+    }
 
-  CHECK_HR(pColorConvTransform->ProcessMessage(MFT_MESSAGE_COMMAND_FLUSH, NULL), "Failed to process FLUSH command on colour converter MFT.");
-  CHECK_HR(pColorConvTransform->ProcessMessage(MFT_MESSAGE_NOTIFY_BEGIN_STREAMING, NULL), "Failed to process BEGIN_STREAMING command on colour converter MFT.");
-  CHECK_HR(pColorConvTransform->ProcessMessage(MFT_MESSAGE_NOTIFY_START_OF_STREAM, NULL), "Failed to process START_OF_STREAM command on colour converter MFT.");
+    CHECK_HR(pColorConvTransform->ProcessMessage(MFT_MESSAGE_COMMAND_FLUSH, NULL), "Failed to process FLUSH command on colour converter MFT.");
+    CHECK_HR(pColorConvTransform->ProcessMessage(MFT_MESSAGE_NOTIFY_BEGIN_STREAMING, NULL), "Failed to process BEGIN_STREAMING command on colour converter MFT.");
+    CHECK_HR(pColorConvTransform->ProcessMessage(MFT_MESSAGE_NOTIFY_START_OF_STREAM, NULL), "Failed to process START_OF_STREAM command on colour converter MFT.");
+  }
 
   // ----- Source and sink now configured. Set up remaining infrastructure and then start sampling. -----
 
@@ -217,6 +229,8 @@ int main()
   CHECK_HR(pVideoSampleAllocator->SetDirectXManager(pD3DManager), "Failed to set D3DManager on video sample allocator.");
   CHECK_HR(pVideoSampleAllocator->InitializeSampleAllocator(1, pImfEvrSinkType), "Failed to initialise video sample allocator.");
   CHECK_HR(pVideoSampleAllocator->AllocateSample(&pD3DVideoSample), "Failed to allocate video sample.");
+  CHECK_HR(pD3DVideoSample->GetBufferByIndex(0, &pDstBuffer), "Failed to get destination buffer.");
+  CHECK_HR(pDstBuffer->QueryInterface(IID_PPV_ARGS(&p2DBuffer)), "Failed to get pointer to 2D buffer.");
 
   // Get clocks organised.
   CHECK_HR(MFCreatePresentationClock(&pClock), "Failed to create presentation clock.");
@@ -231,8 +245,8 @@ int main()
   BYTE* pBitmapMediaBufferData = NULL;
   DWORD bufferMaxLength = 0;
   DWORD bufferCurrLength = 0;
-  IMFMediaBuffer* pDstBuffer = NULL;
-  IMF2DBuffer* p2DBuffer = NULL;
+  IMFSample* pBitmapOutSample = NULL;
+  IMFMediaBuffer* pBitmapOutMediaBuffer = NULL;
   DWORD bitmapBufferLength = 3 * FRAME_WIDTH * FRAME_HEIGHT;
   BYTE* bitmapBuffer = new BYTE[bitmapBufferLength]; // RGB24
   BYTE* bitmapConvertedBuffer = NULL;
@@ -260,43 +274,59 @@ int main()
       }
     }
 
-    // Create a dummy IMFSample for the bitmap.
-    CHECK_HR(MFCreateSample(&pBitmapInSample), "Failed to create bitmap input IMFSample.");
-    CHECK_HR(MFCreateMemoryBuffer(bitmapBufferLength, &pBitmapInMediaBuffer), "Failed to create bitmap input sample memory buffer.");
-    CHECK_HR(pBitmapInSample->AddBuffer(pBitmapInMediaBuffer), "Failed to add bitmap sample to buffer.");
-    CHECK_HR(pBitmapInMediaBuffer->Lock(&pBitmapMediaBufferData, &bufferMaxLength, &bufferCurrLength), "Failed to lock bitmap media buffer.");
-    memcpy_s(pBitmapMediaBufferData, bufferMaxLength, bitmapBuffer, bitmapBufferLength);
-    CHECK_HR(pBitmapInMediaBuffer->Unlock(), "Failed to unlock bitmap buffer.");
-    CHECK_HR(pBitmapInMediaBuffer->SetCurrentLength(bitmapBufferLength), "Failed to set bitmap buffer current length.");
-    CHECK_HR(pBitmapInSample->SetSampleTime(llTimeStamp), "Error setting the bitmap sample time.");
-    CHECK_HR(pBitmapInSample->SetSampleDuration(sampleDuration), "Error setting the bitmap sample duration.");
-
-    //CreateBitmapFromSample(L"capture_premft.bmp", BITMAP_WIDTH, BITMAP_HEIGHT, 24, pBitmapInSample);
-
-     // Apply the colour conversion transform to the dummy sample.
-    CHECK_HR(pColorConvTransform->ProcessInput(0, pBitmapInSample, NULL), "Colour conversion MFT process input failed.");
-
-    MFT_OUTPUT_STREAM_INFO si = { 0 };
-    DWORD mftStatus = 0;
-    IMFSample* pBitmapOutSample = NULL;
-    IMFMediaBuffer* pBitmapOutMediaBuffer = NULL;
-    MFT_OUTPUT_DATA_BUFFER mftOutBuffer;
-
-    CHECK_HR(pColorConvTransform->GetOutputStreamInfo(0, &si), "Failed to get output stream info from colour conversion MFT.");
-    CHECK_HR(MFCreateSample(&pBitmapOutSample), "Failed to create bitmap output IMFSample.");
-    CHECK_HR(MFCreateMemoryBuffer(si.cbSize, &pBitmapOutMediaBuffer), "Failed to create bitmap output sample memory buffer.");
-    CHECK_HR(pBitmapOutSample->AddBuffer(pBitmapOutMediaBuffer), "Failed to add bitmap output sample to buffer.");
-    mftOutBuffer.dwStreamID = 0;
-    mftOutBuffer.dwStatus = 0;
-    mftOutBuffer.pEvents = NULL;
-    mftOutBuffer.pSample = pBitmapOutSample;
+    if (USE_COLOUR_CONVERTER) {
+      // Convert straight into the surface, its pitch can be wider than the frame.
+      BYTE* pScanline0 = NULL;
+      LONG pitch = 0;
+      ColourImage bitmapImage = GetColourImage(ColourFormat::RGB24, bitmapBuffer, FRAME_WIDTH, FRAME_HEIGHT);
 
-    auto mftHr = pColorConvTransform->ProcessOutput(0, 1, &mftOutBuffer, &mftStatus);
+      CHECK_HR(p2DBuffer->Lock2D(&pScanline0, &pitch), "Failed to lock D3D video sample buffer.");
+      bool isConverted = colourConverter.Convert(bitmapImage,
+        GetColourImageFromTopRow(ColourFormat::RGB32, pScanline0, FRAME_WIDTH, FRAME_HEIGHT, pitch));
+      CHECK_HR(p2DBuffer->Unlock2D(), "Failed to unlock D3D video sample buffer.");
 
-    printf("Colour conversion result %.2X, MFT status %.2X.\n", mftHr, mftStatus);
+      if (!isConverted) {
+        break;
+      }
+    }
+    else {
+      // Create a dummy IMFSample for the bitmap.
+      CHECK_HR(MFCreateSample(&pBitmapInSample), "Failed to create bitmap input IMFSample.");
+      CHECK_HR(MFCreateMemoryBuffer(bitmapBufferLength, &pBitmapInMediaBuffer), "Failed to create bitmap input sample memory buffer.");
+      CHECK_HR(pBitmapInSample->AddBuffer(pBitmapInMediaBuffer), "Failed to add bitmap sample to buffer.");
+      CHECK_HR(pBitmapInMediaBuffer->Lock(&pBitmapMediaBufferData, &bufferMaxLength, &bufferCurrLength), "Failed to lock bitmap media buffer.");
+      memcpy_s(pBitmapMediaBufferData, bufferMaxLength, bitmapBuffer, bitmapBufferLength);
+      CHECK_HR(pBitmapInMediaBuffer->Unlock(), "Failed to unlock bitmap buffer.");
+      CHECK_HR(pBitmapInMediaBuffer->SetCurrentLength(bitmapBufferLength), "Failed to set bitmap buffer current length.");
+      CHECK_HR(pBitmapInSample->SetSampleTime(llTimeStamp), "Error setting the bitmap sample time.");
+      CHECK_HR(pBitmapInSample->SetSampleDuration(sampleDuration), "Error setting the bitmap sample duration.");
+
+      //CreateBitmapFromSample(L"capture_premft.bmp", BITMAP_WIDTH, BITMAP_HEIGHT, 24, pBitmapInSample);
+
+       // Apply the colour conversion transform to the dummy sample.
+      CHECK_HR(pColorConvTransform->ProcessInput(0, pBitmapInSample, NULL), "Colour conversion MFT process input failed.");
+
+      MFT_OUTPUT_STREAM_INFO si = { 0 };
+      DWORD mftStatus = 0;
+      MFT_OUTPUT_DATA_BUFFER mftOutBuffer;
+
+      CHECK_HR(pColorConvTransform->GetOutputStreamInfo(0, &si), "Failed to get output stream info from colour conversion MFT.");
+      CHECK_HR(MFCreateSample(&pBitmapOutSample), "Failed to create bitmap output IMFSample.");
+      CHECK_HR(MFCreateMemoryBuffer(si.cbSize, &pBitmapOutMediaBuffer), "Failed to create bitmap output sample memory buffer.");
+      CHECK_HR(pBitmapOutSample->AddBuffer(pBitmapOutMediaBuffer), "Failed to add bitmap output sample to buffer.");
+      mftOutBuffer.dwStreamID = 0;
+      mftOutBuffer.dwStatus = 0;
+      mftOutBuffer.pEvents = NULL;
+      mftOutBuffer.pSample = pBitmapOutSample;
+
+      auto mftHr = pColorConvTransform->ProcessOutput(0, 1, &mftOutBuffer, &mftStatus);
+
+      printf("Colour conversion result %.2X, MFT status %.2X.\n", mftHr, mftStatus);
+
+      if (mftHr != S_OK) {
+        break;
+      }
 
-    if (mftHr == S_OK)
-    {
       //CreateBitmapFromSample(L"capture_postmft.bmp", BITMAP_WIDTH, BITMAP_HEIGHT, 32, pBitmapOutSample);
 
       IMFMediaBuffer* buf = NULL;
@@ -304,21 +334,15 @@ int main()
 
       CHECK_HR(pBitmapOutSample->ConvertToContiguousBuffer(&buf), "ConvertToContiguousBuffer failed.");
       CHECK_HR(buf->Lock(&bitmapConvertedBuffer, NULL, &currLength), "Failed to lock converted buffer IMFSample.");
-      CHECK_HR(buf->Unlock(), "Unlock buffer failed.");
-
-      CHECK_HR(pD3DVideoSample->SetSampleTime(llTimeStamp), "Failed to set D3D video sample time.");
-      CHECK_HR(pD3DVideoSample->SetSampleDuration(sampleDuration), "Failed to set D3D video sample duration.");
-      CHECK_HR(pD3DVideoSample->GetBufferByIndex(0, &pDstBuffer), "Failed to get destination buffer.");
-      CHECK_HR(pDstBuffer->QueryInterface(IID_PPV_ARGS(&p2DBuffer)), "Failed to get pointer to 2D buffer.");
       CHECK_HR(p2DBuffer->ContiguousCopyFrom(bitmapConvertedBuffer, currLength), "Failed to copy bitmap to D2D buffer.");
-      
-      CHECK_HR(pStreamSink->ProcessSample(pD3DVideoSample), "Streamsink process sample failed.");
+      CHECK_HR(buf->Unlock(), "Unlock buffer failed.");
 
       SAFE_RELEASE(buf);
     }
-    else {
-      break;
-    }
+
+    CHECK_HR(pD3DVideoSample->SetSampleTime(llTimeStamp), "Failed to set D3D video sample time.");
+    CHECK_HR(pD3DVideoSample->SetSampleDuration(sampleDuration), "Failed to set D3D video sample duration.");
+    CHECK_HR(pStreamSink->ProcessSample(pD3DVideoSample), "Streamsink process sample failed.");
 
     Sleep(SAMPLE_DURATION / 10000);
 
@@ -332,8 +356,10 @@ int main()
   }
 
   delete[] bitmapBuffer;
-  SAFE_RELEASE(p2DBuffer);
-  SAFE_RELEASE(pDstBuffer);
+  SAFE_RELEASE(pBitmapInSample);
+  SAFE_RELEASE(pBitmapInMediaBuffer);
+  SAFE_RELEASE(pBitmapOutSample);
+  SAFE_RELEASE(pBitmapOutMediaBuffer);
 
 done:
 
@@ -353,6 +379,8 @@ done:
   SAFE_RELEASE(pD3DManager);
   SAFE_RELEASE(pVideoSampleAllocator);
   SAFE_RELEASE(pD3DVideoSample);
+  SAFE_RELEASE(p2DBuffer);
+  SAFE_RELEASE(pDstBuffer);
 
   SAFE_RELEASE(colorConvTransformUnk);
   SAFE_RELEASE(pColorConvTransform);
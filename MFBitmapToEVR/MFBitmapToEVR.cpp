@@ -17,6 +17,7 @@
 * License: Public Domain (no warranty, use at own risk)
 /******************************************************************************/
 
+#include "..\Common\FrameCopy.h"
 #include "..\Common\MFUtility.h"
 
 #include <d3d9.h>
@@ -236,7 +237,14 @@ int main()
 
     CHECK_HR(pD3DVideoSample->SetSampleTime(llTimeStamp), "Failed to set D3D video sample time.");
     CHECK_HR(pD3DVideoSample->SetSampleDuration(sampleDuration), "Failed to set D3D video sample duration.");
-    CHECK_HR(p2DBuffer->ContiguousCopyFrom(bitmapBuffer, bitmapBufferLength), "Failed to copy bitmap to D2D buffer.");
+
+    // The bitmap is bottom up like a BMP, the default for RGB32.
+    BYTE* pScanline0 = NULL;
+    LONG pitch = 0;
+    CHECK_HR(p2DBuffer->Lock2D(&pScanline0, &pitch), "Failed to lock D3D video sample buffer.");
+    CopyColourImage(GetColourImage(ColourFormat::RGB32, bitmapBuffer, BITMAP_WIDTH, BITMAP_HEIGHT, -4 * BITMAP_WIDTH),
+      GetColourImageFromTopRow(ColourFormat::RGB32, pScanline0, BITMAP_WIDTH, BITMAP_HEIGHT, pitch));
+    CHECK_HR(p2DBuffer->Unlock2D(), "Failed to unlock D3D video sample buffer.");
 
     CHECK_HR(pStreamSink->ProcessSample(pD3DVideoSample), "Stream sink process sample failed.");
 
@@ -11,6 +11,9 @@
 * ffmpeg -vcodec rawvideo -s 640x480 -pix_fmt yuv420p -i rawframes.yuv -vframes 1 output.jpeg
 * ffmpeg -vcodec rawvideo -s 640x480 -pix_fmt yuv420p -i rawframes.yuv out.avi
 *
+* To measure the speed and quality of an encode and decode round trip, rather
+* than dump it, see the RoundTripBenchmark sample.
+*
 * Author:
 * Aaron Clauson (aaron@sipsorcery.com)
 *
@@ -20,6 +20,7 @@
 * License: Public Domain (no warranty, use at own risk)
 /******************************************************************************/
 
+#include "..\Common\FrameCopy.h"
 #include "..\Common\MFUtility.h"
 
 #include <d3d9.h>
@@ -88,6 +89,8 @@ int main()
   IMFMediaBuffer* pDstBuffer = NULL;
   RECT rc = { 0, 0, VIDEO_WIDTH, VIDEO_HEIGHT };
   BOOL fSelected = false;
+  UINT32 frameWidth = 0, frameHeight = 0;
+  LONG sourceStride = 0;
 
   IMFMediaEventGenerator* pEventGenerator = NULL;
   IMFMediaEventGenerator* pstreamSinkEventGenerator = NULL;
@@ -216,6 +219,13 @@ int main()
   std::cout << "EVR input media type defined as:" << std::endl;
   std::cout << GetMediaTypeDescription(pImfEvrSinkType) << std::endl << std::endl;
 
+  // ----- Work out how to read the source reader's RGB32 frames. -----
+
+  CHECK_HR(MFGetAttributeSize(pVideoSourceOutType, MF_MT_FRAME_SIZE, &frameWidth, &frameHeight), "Failed to get video frame size.");
+
+  // Only used if the reader's buffers aren't 2D buffers, which give their own pitch.
+  CHECK_HR(GetDefaultStride(pVideoSourceOutType, &sourceStride), "Failed to get video default stride.");
+
   // ----- Set up event handler for sink events otherwise memory leaks. -----
 
   CHECK_HR(pVideoSink->QueryInterface(IID_IMFMediaEventGenerator, (void**)&pEventGenerator),
@@ -252,11 +262,10 @@ int main()
   // Start the sample read-write loop.
   IMFSample* videoSample = NULL;
   IMFMediaBuffer* pSrcBuffer = NULL;
-  BYTE* pbBuffer = NULL;
+  IMF2DBuffer* pSrc2DBuffer = NULL;
   DWORD streamIndex, flags;
   LONGLONG llTimeStamp;
   UINT32 uiAttribute = 0;
-  DWORD dwBuffer = 0;
 
   while (true)
   {
@@ -299,10 +308,30 @@ int main()
 
       CHECK_HR(pD3DVideoSample->SetSampleTime(llTimeStamp), "Failed to set D3D video sample time.");
       CHECK_HR(pD3DVideoSample->SetSampleDuration(sampleDuration), "Failed to set D3D video sample duration.");
+
+      // ----- Copy the frame straight into the Direct3D sample. -----
+
+      BYTE* pSrcData = NULL, * pDstScanline0 = NULL;
+      LONG srcPitch = 0, dstPitch = 0;
+      ColourImage frameImage;
+
       CHECK_HR(videoSample->ConvertToContiguousBuffer(&pSrcBuffer), "Failed to get buffer from video sample.");
-      CHECK_HR(pSrcBuffer->Lock(&pbBuffer, NULL, &dwBuffer), "Failed to lock sample buffer.");
-      CHECK_HR(p2DBuffer->ContiguousCopyFrom(pbBuffer, dwBuffer), "Failed to unlock sample buffer.");
-      CHECK_HR(pSrcBuffer->Unlock(), "Failed to unlock source buffer.\n");
+
+      // Locking a 2D buffer with Lock2D gives its top row and pitch, where Lock would copy it to a contiguous buffer
+      // first. A plain buffer starts with the bottom row if the default stride is negative.
+      if (SUCCEEDED(pSrcBuffer->QueryInterface(IID_PPV_ARGS(&pSrc2DBuffer)))) {
+        CHECK_HR(pSrc2DBuffer->Lock2D(&pSrcData, &srcPitch), "Failed to lock source 2D buffer.");
+        frameImage = GetColourImageFromTopRow(ColourFormat::RGB32, pSrcData, frameWidth, frameHeight, srcPitch);
+      }
+      else {
+        CHECK_HR(pSrcBuffer->Lock(&pSrcData, NULL, NULL), "Failed to lock sample buffer.");
+        frameImage = GetColourImage(ColourFormat::RGB32, pSrcData, frameWidth, frameHeight, sourceStride);
+      }
+
+      CHECK_HR(p2DBuffer->Lock2D(&pDstScanline0, &dstPitch), "Failed to lock D3D video sample buffer.");
+      CopyColourImage(frameImage, GetColourImageFromTopRow(ColourFormat::RGB32, pDstScanline0, frameWidth, frameHeight, dstPitch));
+      CHECK_HR(p2DBuffer->Unlock2D(), "Failed to unlock D3D video sample buffer.");
+      CHECK_HR((pSrc2DBuffer != NULL) ? pSrc2DBuffer->Unlock2D() : pSrcBuffer->Unlock(), "Failed to unlock source buffer.");
 
       CHECK_HR(videoSample->GetUINT32(MFSampleExtension_FrameCorruption, &uiAttribute), "Failed to get frame corruption attribute.");
       CHECK_HR(pD3DVideoSample->SetUINT32(MFSampleExtension_FrameCorruption, uiAttribute), "Failed to set frame corruption attribute.");
@@ -316,6 +345,7 @@ int main()
       Sleep(sampleDuration / 10000); // Duration is given in 100's of nano seconds.
     }
 
+    SAFE_RELEASE(pSrc2DBuffer);
     SAFE_RELEASE(pSrcBuffer);
     SAFE_RELEASE(videoSample);
   }
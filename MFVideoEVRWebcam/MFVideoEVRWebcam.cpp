@@ -28,6 +28,7 @@
 * License: Public Domain (no warranty, use at own risk)
 /******************************************************************************/
 
+#include "..\Common\FrameCopy.h"
 #include "..\Common\MFUtility.h"
 
 #include <d3d9.h>
@@ -62,6 +63,7 @@
 #define WEBCAM_PIXEL_FORMAT MFVideoFormat_RGB24
 //#define WEBCAM_PIXEL_FORMAT MFVideoFormat_YUY2
 #define RENDERER_PIXEL_FORMAT MFVideoFormat_RGB32
+#define RENDERER_COLOUR_FORMAT ColourFormat::RGB32  // Needs to match RENDERER_PIXEL_FORMAT.
 //#define PIXEL_FORMAT MFVideoFormat_RGB32
 //#define PIXEL_FORMAT MFVideoFormat_YUY2
 //#define PIXEL_FORMAT MFVideoFormat_I420
@@ -101,6 +103,7 @@ int main()
   IMFSample* pD3DVideoSample = NULL;
   RECT rc = { 0, 0, VIDEO_WIDTH, VIDEO_HEIGHT };
   BOOL fSelected = false;
+  LONG readerStride = 0;
 
   CHECK_HR(CoInitializeEx(NULL, COINIT_APARTMENTTHREADED | COINIT_DISABLE_OLE1DDE),
     "COM initialisation failed.");
@@ -255,6 +258,9 @@ int main()
   CHECK_HR(pVideoReader->SetCurrentMediaType((DWORD)MF_SOURCE_READER_FIRST_VIDEO_STREAM, NULL, pSourceReaderType),
     "Failed to set output media type on webcam source reader.");
 
+  // Only used if the reader's buffers aren't 2D buffers, which give their own pitch.
+  CHECK_HR(GetDefaultStride(pSourceReaderType, &readerStride), "Failed to get source reader default stride.");
+
   // ----- Source and sink now configured. Set up remaining infrastructure and then start sampling. -----
 
   // Get Direct3D surface organised.
@@ -327,20 +333,33 @@ int main()
 
       // ----- Make Direct3D sample. -----
       IMFMediaBuffer* buf = NULL;
-      DWORD bufLength = 0, lockedBufLength = 0;
-      BYTE* pByteBuf = NULL;
+      IMF2DBuffer* pSrc2DBuffer = NULL;
+      BYTE* pSrcData = NULL, * pDstScanline0 = NULL;
+      LONG srcPitch = 0, dstPitch = 0;
+      ColourImage frameImage;
 
       CHECK_HR(pVideoSample->ConvertToContiguousBuffer(&buf), "ConvertToContiguousBuffer failed.");
-      CHECK_HR(buf->GetCurrentLength(&bufLength), "Get buffer length failed.");
-      CHECK_HR(buf->Lock(&pByteBuf, NULL, &lockedBufLength), "Failed to lock sample buffer.");
+
+      // Locking a 2D buffer with Lock2D gives its top row and pitch, where Lock would copy it to a contiguous buffer
+      // first. A plain buffer starts with the bottom row if the default stride is negative.
+      if (SUCCEEDED(buf->QueryInterface(IID_PPV_ARGS(&pSrc2DBuffer)))) {
+        CHECK_HR(pSrc2DBuffer->Lock2D(&pSrcData, &srcPitch), "Failed to lock source 2D buffer.");
+        frameImage = GetColourImageFromTopRow(RENDERER_COLOUR_FORMAT, pSrcData, VIDEO_WIDTH, VIDEO_HEIGHT, srcPitch);
+      }
+      else {
+        CHECK_HR(buf->Lock(&pSrcData, NULL, NULL), "Failed to lock sample buffer.");
+        frameImage = GetColourImage(RENDERER_COLOUR_FORMAT, pSrcData, VIDEO_WIDTH, VIDEO_HEIGHT, readerStride);
+      }
 
       CHECK_HR(pD3DVideoSample->SetSampleTime(evrTimestamp), "Failed to set D3D video sample time.");
       CHECK_HR(pD3DVideoSample->SetSampleDuration(sampleDuration), "Failed to set D3D video sample duration.");
       CHECK_HR(pD3DVideoSample->GetBufferByIndex(0, &pDstBuffer), "Failed to get destination buffer.");
       CHECK_HR(pDstBuffer->QueryInterface(IID_PPV_ARGS(&p2DBuffer)), "Failed to get pointer to 2D buffer.");
-      CHECK_HR(p2DBuffer->ContiguousCopyFrom(pByteBuf, bufLength), "Failed to copy D2D buffer (check the source media type matches the EVR input type).");
+      CHECK_HR(p2DBuffer->Lock2D(&pDstScanline0, &dstPitch), "Failed to lock D3D video sample buffer.");
+      CopyColourImage(frameImage, GetColourImageFromTopRow(RENDERER_COLOUR_FORMAT, pDstScanline0, VIDEO_WIDTH, VIDEO_HEIGHT, dstPitch));
+      CHECK_HR(p2DBuffer->Unlock2D(), "Failed to unlock D3D video sample buffer.");
 
-      CHECK_HR(buf->Unlock(), "Failed to unlock source buffer.");
+      CHECK_HR((pSrc2DBuffer != NULL) ? pSrc2DBuffer->Unlock2D() : buf->Unlock(), "Failed to unlock source buffer.");
 
       //CHECK_HR(videoSample->GetUINT32(MFSampleExtension_FrameCorruption, &uiAttribute), "Failed to get frame corruption attribute.");
       //CHECK_HR(pD3DVideoSample->SetUINT32(MFSampleExtension_FrameCorruption, uiAttribute), "Failed to set frame corruption attribute.");
@@ -351,6 +370,7 @@ int main()
 
       CHECK_HR(pStreamSink->ProcessSample(pD3DVideoSample), "Streamsink process sample failed.");
 
+      SAFE_RELEASE(pSrc2DBuffer);
       SAFE_RELEASE(buf);
 
       evrTimestamp += sampleDuration;
@@ -12,6 +12,18 @@
 * afterwards and this sample still serves as a useful demonstration of how
 * to wire up an MFT transform.
 *
+* The CColorConvertDMO Transform needs an output sample for each frame and a
+* copy from it into the EVR's Direct3D surface. Set USE_COLOUR_CONVERTER to true
+* to use the ColourConverter in the Common folder instead, which converts each
+* webcam frame straight into the locked surface. The webcam's pixel format then
+* needs to be one the ColourConverter supports, e.g. YUY2, NV12 or RGB24, not
+* MJPG.
+*
+* With USE_COLOUR_CONVERTER set, VIDEO_ORIENTATION can turn the picture from a
+* camera that's mounted on its side or upside down, or mirror it for a self
+* view. The FrameRotator in the Common folder rotates each frame as it's
+* converted, so turning it doesn't add another pass over the frame.
+*
 * Author:
 * Aaron Clauson (aaron@sipsorcery.com)
 *
@@ -21,6 +33,8 @@
 * License: Public Domain (no warranty, use at own risk)
 /******************************************************************************/
 
+#include "..\Common\ColourConverter.h"
+#include "..\Common\FrameRotator.h"
 #include "..\Common\MFUtility.h"
 
 #include <d3d9.h>
@@ -52,11 +66,17 @@
 #define VIDEO_WIDTH  640
 #define VIDEO_HEIGHT 480
 #define VIDEO_FRAME_RATE 30
+#define USE_COLOUR_CONVERTER false  // Set to true to convert with the ColourConverter instead of the CColorConvertDMO MFT.
+#define VIDEO_ORIENTATION FrameOrientation::Identity  // Only with USE_COLOUR_CONVERTER, e.g. Rotate90 for a camera on its side, Mirror for a self view.
+#define DISPLAY_TRANSPOSED (USE_COLOUR_CONVERTER && IsFrameOrientationTransposed(VIDEO_ORIENTATION))
+#define DISPLAY_WIDTH  (DISPLAY_TRANSPOSED ? VIDEO_HEIGHT : VIDEO_WIDTH)
+#define DISPLAY_HEIGHT (DISPLAY_TRANSPOSED ? VIDEO_WIDTH : VIDEO_HEIGHT)
 #define WEBCAM_DEVICE_INDEX 0	  // Adjust according to desired video capture device.
 
 // Forward function definitions.
 DWORD InitializeWindow(LPVOID lpThreadParameter);
 HRESULT GetVideoSourceFromDevice(UINT nDevice, IMFMediaSource** ppVideoSource, IMFSourceReader** ppVideoReader);
+bool GetColourFormat(const GUID& subtype, ColourFormat& format);
 
 // Constants 
 const WCHAR CLASS_NAME[] = L"MFVideoEVRWebcam Window Class";
@@ -87,13 +107,26 @@ int main()
   IDirect3DDeviceManager9* pD3DManager = NULL;
   IMFVideoSampleAllocator* pVideoSampleAllocator = NULL;
   IMFSample* pD3DVideoSample = NULL;
-  RECT rc = { 0, 0, VIDEO_WIDTH, VIDEO_HEIGHT };
+  IMFMediaBuffer* pDstBuffer = NULL;
+  IMF2DBuffer* p2DBuffer = NULL;
+  IMFSample* videoSample = NULL;
+  IMFMediaBuffer* pSrcBuffer = NULL;
+  IMF2DBuffer* pSrc2DBuffer = NULL;
+  RECT rc = { 0, 0, DISPLAY_WIDTH, DISPLAY_HEIGHT };
   BOOL fSelected = false;
 
   IUnknown* colorConvTransformUnk = NULL;
   IMFTransform* pColorConvTransform = NULL; // This is colour converter MFT is used to convert between the webcam pixel format and RGB32.
   IMFMediaType* pDecInputMediaType = NULL, * pDecOutputMediaType = NULL;
+  IMFSample* mftOutSample = NULL;
+  IMFMediaBuffer* mftOutBuffer = NULL, * mftOutContiguousBuffer = NULL;
+
   IMFMediaType* pWebcamSourceType = NULL;
+  GUID webcamSubtype = GUID_NULL;
+  ColourFormat webcamFormat = ColourFormat::YUY2;
+  LONG webcamStride = 0;
+  ColourConverter colourConverter; // Converts the webcam pixel format to the RGB32 the EVR takes.
+  FrameRotator frameRotator;       // Turns the webcam frames to VIDEO_ORIENTATION as they're converted.
 
   CHECK_HR(CoInitializeEx(NULL, COINIT_APARTMENTTHREADED | COINIT_DISABLE_OLE1DDE),
     "COM initialisation failed.");
@@ -208,7 +241,7 @@ int main()
   CHECK_HR(pImfEvrSinkType->SetUINT32(MF_MT_INTERLACE_MODE, MFVideoInterlace_Progressive), "Failed to set interlace mode attribute on media type.");
   CHECK_HR(pImfEvrSinkType->SetUINT32(MF_MT_ALL_SAMPLES_INDEPENDENT, TRUE), "Failed to set independent samples attribute on media type.");
   CHECK_HR(MFSetAttributeRatio(pImfEvrSinkType, MF_MT_PIXEL_ASPECT_RATIO, 1, 1), "Failed to set pixel aspect ratio attribute on media type.");
-  CHECK_HR(MFSetAttributeSize(pImfEvrSinkType, MF_MT_FRAME_SIZE, VIDEO_WIDTH, VIDEO_HEIGHT), "Failed to set the frame size attribute on media type.");
+  CHECK_HR(MFSetAttributeSize(pImfEvrSinkType, MF_MT_FRAME_SIZE, DISPLAY_WIDTH, DISPLAY_HEIGHT), "Failed to set the frame size attribute on media type.");
   CHECK_HR(MFSetAttributeSize(pImfEvrSinkType, MF_MT_FRAME_RATE, VIDEO_FRAME_RATE, 1), "Failed to set the frame rate attribute on media type.");
   CHECK_HR(CopyAttribute(videoSourceOutputType, pImfEvrSinkType, MF_MT_DEFAULT_STRIDE), "Failed to copy default stride attribute.");
 
@@ -216,6 +249,7 @@ int main()
   CHECK_HR(MFCreateMediaType(&pWebcamSourceType), "Failed to create webcam output media type.");
   CHECK_HR(pImfEvrSinkType->CopyAllItems(pWebcamSourceType), "Error copying media type attributes from EVR input to webcam output media type.");
   CHECK_HR(CopyAttribute(videoSourceOutputType, pWebcamSourceType, MF_MT_SUBTYPE), "Failed to set video sub-type attribute on webcam media type.");
+  CHECK_HR(MFSetAttributeSize(pWebcamSourceType, MF_MT_FRAME_SIZE, VIDEO_WIDTH, VIDEO_HEIGHT), "Failed to set the frame size attribute on webcam media type.");
 
   CHECK_HR(pSinkMediaTypeHandler->SetCurrentMediaType(pImfEvrSinkType),
     "Failed to set input media type on EVR sink.");
@@ -226,34 +260,48 @@ int main()
   std::cout << "EVR input media type defined as:" << std::endl;
   std::cout << GetMediaTypeDescription(pImfEvrSinkType) << std::endl << std::endl;
 
-  // ----- Create an MFT to convert between webcam pixel format and RGB32. -----
+  if (USE_COLOUR_CONVERTER) {
+    // ----- Work out how to read the webcam frames for the colour conversion to RGB32. -----
 
-  CHECK_HR(CoCreateInstance(CLSID_CColorConvertDMO, NULL, CLSCTX_INPROC_SERVER,
-    IID_IUnknown, (void**)&colorConvTransformUnk),
-    "Failed to create colour converter MFT.");
-
-  CHECK_HR(colorConvTransformUnk->QueryInterface(IID_PPV_ARGS(&pColorConvTransform)),
-    "Failed to get IMFTransform interface from colour converter MFT object.");
-
-  MFCreateMediaType(&pDecInputMediaType);
-  CHECK_HR(pWebcamSourceType->CopyAllItems(pDecInputMediaType), "Error copying media type attributes to colour converter input media type.");
-  CHECK_HR(pColorConvTransform->SetInputType(0, pDecInputMediaType, 0), "Failed to set input media type on colour converter MFT.");
-
-  // The output from the transform is an exact copy of the media type set as the input for the EVR stream sink.
-  MFCreateMediaType(&pDecOutputMediaType);
-  CHECK_HR(pImfEvrSinkType->CopyAllItems(pDecOutputMediaType), "Error copying media type attributes to colour converter output media type.");
-  CHECK_HR(pColorConvTransform->SetOutputType(0, pDecOutputMediaType, 0), "Failed to set output media type on colour converter MFT.");
+    CHECK_HR(pWebcamSourceType->GetGUID(MF_MT_SUBTYPE, &webcamSubtype), "Failed to get webcam video sub-type.");
+    if (!GetColourFormat(webcamSubtype, webcamFormat)) {
+      printf("Webcam pixel format %s isn't supported by the colour converter.\n", GetGUIDNameConst(webcamSubtype));
+      goto done;
+    }
 
-  DWORD mftStatus = 0;
-  CHECK_HR(pColorConvTransform->GetInputStatus(0, &mftStatus), "Failed to get input status from colour converter MFT.");
-  if (MFT_INPUT_STATUS_ACCEPT_DATA != mftStatus) {
-    printf("Colour converter MFT is not accepting data.\n");
-    goto done;
+    // Only used if the webcam's buffers aren't 2D buffers, which give their own pitch.
+    CHECK_HR(GetDefaultStride(pWebcamSourceType, &webcamStride), "Failed to get webcam default stride.");
   }
+  else {
+    // ----- Create an MFT to convert between webcam pixel format and RGB32. -----
+
+    CHECK_HR(CoCreateInstance(CLSID_CColorConvertDMO, NULL, CLSCTX_INPROC_SERVER,
+      IID_IUnknown, (void**)&colorConvTransformUnk),
+      "Failed to create colour converter MFT.");
+
+    CHECK_HR(colorConvTransformUnk->QueryInterface(IID_PPV_ARGS(&pColorConvTransform)),
+      "Failed to get IMFTransform interface from colour converter MFT object.");
+
+    MFCreateMediaType(&pDecInputMediaType);
+    CHECK_HR(pWebcamSourceType->CopyAllItems(pDecInputMediaType), "Error copying media type attributes to colour converter input media type.");
+    CHECK_HR(pColorConvTransform->SetInputType(0, pDecInputMediaType, 0), "Failed to set input media type on colour converter MFT.");
+
+    // The output from the transform is an exact copy of the media type set as the input for the EVR stream sink.
+    MFCreateMediaType(&pDecOutputMediaType);
+    CHECK_HR(pImfEvrSinkType->CopyAllItems(pDecOutputMediaType), "Error copying media type attributes to colour converter output media type.");
+    CHECK_HR(pColorConvTransform->SetOutputType(0, pDecOutputMediaType, 0), "Failed to set output media type on colour converter MFT.");
+
+    DWORD mftStatus = 0;
+    CHECK_HR(pColorConvTransform->GetInputStatus(0, &mftStatus), "Failed to get input status from colour converter MFT.");
+    if (MFT_INPUT_STATUS_ACCEPT_DATA != mftStatus) {
+      printf("Colour converter MFT is not accepting data.\n");
+      goto done;
+    }
 
-  CHECK_HR(pColorConvTransform->ProcessMessage(MFT_MESSAGE_COMMAND_FLUSH, NULL), "Failed to process FLUSH command on colour converter MFT.");
-  CHECK_HR(pColorConvTransform->ProcessMessage(MFT_MESSAGE_NOTIFY_BEGIN_STREAMING, NULL), "Failed to process BEGIN_STREAMING command on colour converter MFT.");
-  CHECK_HR(pColorConvTransform->ProcessMessage(MFT_MESSAGE_NOTIFY_START_OF_STREAM, NULL), "Failed to process START_OF_STREAM command on colour converter MFT.");
+    CHECK_HR(pColorConvTransform->ProcessMessage(MFT_MESSAGE_COMMAND_FLUSH, NULL), "Failed to process FLUSH command on colour converter MFT.");
+    CHECK_HR(pColorConvTransform->ProcessMessage(MFT_MESSAGE_NOTIFY_BEGIN_STREAMING, NULL), "Failed to process BEGIN_STREAMING command on colour converter MFT.");
+    CHECK_HR(pColorConvTransform->ProcessMessage(MFT_MESSAGE_NOTIFY_START_OF_STREAM, NULL), "Failed to process START_OF_STREAM command on colour converter MFT.");
+  }
 
   // ----- Source and sink now configured. Set up remaining infrastructure and then start sampling. -----
 
@@ -264,6 +312,8 @@ int main()
   CHECK_HR(pVideoSampleAllocator->SetDirectXManager(pD3DManager), "Failed to set D3DManager on video sample allocator.");
   CHECK_HR(pVideoSampleAllocator->InitializeSampleAllocator(1, pImfEvrSinkType), "Failed to initialise video sample allocator.");
   CHECK_HR(pVideoSampleAllocator->AllocateSample(&pD3DVideoSample), "Failed to allocate video sample.");
+  CHECK_HR(pD3DVideoSample->GetBufferByIndex(0, &pDstBuffer), "Failed to get destination buffer.");
+  CHECK_HR(pDstBuffer->QueryInterface(IID_PPV_ARGS(&p2DBuffer)), "Failed to get pointer to 2D buffer.");
 
   // Get clocks organised.
   CHECK_HR(MFCreatePresentationClock(&pClock), "Failed to create presentation clock.");
@@ -273,10 +323,6 @@ int main()
   CHECK_HR(pClock->Start(0), "Error starting presentation clock.");
 
   // Start the sample read-write loop.
-  IMFSample* videoSample = NULL;
-  IMFMediaBuffer* pDstBuffer = NULL;
-  IMF2DBuffer* p2DBuffer = NULL;
-  BYTE* pbBuffer = NULL;
   DWORD streamIndex, flags;
   LONGLONG llTimeStamp;
   UINT32 uiAttribute = 0;
@@ -312,7 +358,6 @@ int main()
     else
     {
       LONGLONG sampleDuration = 0;
-      DWORD mftOutFlags;
 
       // ----- Video source sample. -----
 
@@ -321,79 +366,91 @@ int main()
 
       //printf("Attempting to convert sample, sample duration %llu, sample time %llu, evr timestamp %llu.\n", sampleDuration, llTimeStamp, evrTimestamp);
 
-      // Relies on the webcam pixel format being RGB24.
-      //CreateBitmapFromSample(L"capture_premft.bmp", VIDEO_WIDTH, VIDEO_HEIGHT, 24, videoSample);
-
-      // ----- Apply colour conversion transfrom. -----
+      if (USE_COLOUR_CONVERTER) {
+        // ----- Convert straight into the Direct3D sample. -----
 
-      CHECK_HR(pColorConvTransform->ProcessInput(0, videoSample, NULL), "The colour conversion decoder ProcessInput call failed.");
+        BYTE* pSrcData = NULL, * pDstScanline0 = NULL;
+        LONG srcPitch = 0, dstPitch = 0;
+        ColourImage webcamImage;
 
-      IMFSample* mftOutSample = NULL;
-      IMFMediaBuffer* mftOutBuffer = NULL;
-      MFT_OUTPUT_STREAM_INFO StreamInfo;
-      MFT_OUTPUT_DATA_BUFFER outputDataBuffer;
-      DWORD processOutputStatus = 0;
+        CHECK_HR(videoSample->ConvertToContiguousBuffer(&pSrcBuffer), "ConvertToContiguousBuffer failed.");
 
-      CHECK_HR(pColorConvTransform->GetOutputStreamInfo(0, &StreamInfo), "Failed to get output stream info from colour conversion MFT.");
-      CHECK_HR(MFCreateSample(&mftOutSample), "Failed to create MF sample.");
-      CHECK_HR(MFCreateMemoryBuffer(StreamInfo.cbSize, &mftOutBuffer), "Failed to create memory buffer.");
-      CHECK_HR(mftOutSample->AddBuffer(mftOutBuffer), "Failed to add sample to buffer.");
-      outputDataBuffer.dwStreamID = 0;
-      outputDataBuffer.dwStatus = 0;
-      outputDataBuffer.pEvents = NULL;
-      outputDataBuffer.pSample = mftOutSample;
+        // A 2D buffer gives its top row and pitch, a plain buffer starts with the
+        // bottom row if the default stride is negative.
+        if (SUCCEEDED(pSrcBuffer->QueryInterface(IID_PPV_ARGS(&pSrc2DBuffer)))) {
+          CHECK_HR(pSrc2DBuffer->Lock2D(&pSrcData, &srcPitch), "Failed to lock source 2D buffer.");
+          webcamImage = GetColourImageFromTopRow(webcamFormat, pSrcData, VIDEO_WIDTH, VIDEO_HEIGHT, srcPitch);
+        }
+        else {
+          CHECK_HR(pSrcBuffer->Lock(&pSrcData, NULL, NULL), "Failed to lock source buffer.");
+          webcamImage = GetColourImage(webcamFormat, pSrcData, VIDEO_WIDTH, VIDEO_HEIGHT, webcamStride);
+        }
 
-      auto mftProcessOutput = pColorConvTransform->ProcessOutput(0, 1, &outputDataBuffer, &processOutputStatus);
+        CHECK_HR(p2DBuffer->Lock2D(&pDstScanline0, &dstPitch), "Failed to lock D3D video sample buffer.");
+        bool isConverted = frameRotator.ConvertAndRotate(colourConverter, webcamImage,
+          GetColourImageFromTopRow(ColourFormat::RGB32, pDstScanline0, DISPLAY_WIDTH, DISPLAY_HEIGHT, dstPitch), VIDEO_ORIENTATION);
+        CHECK_HR(p2DBuffer->Unlock2D(), "Failed to unlock D3D video sample buffer.");
+        CHECK_HR((pSrc2DBuffer != NULL) ? pSrc2DBuffer->Unlock2D() : pSrcBuffer->Unlock(), "Failed to unlock source buffer.");
 
-      //printf("Colour conversion result %.2X, MFT status %.2X.\n", mftProcessOutput, processOutputStatus);
+        if (!isConverted) {
+          printf("Failed to convert the webcam frame.\n");
+          goto done;
+        }
+      }
+      else {
+        // ----- Apply colour conversion transfrom. -----
 
-      if (mftProcessOutput == S_OK)
-      {
-        // ----- Make Direct3D sample. -----
-        IMFMediaBuffer* buf = NULL;
-        DWORD bufLength = 0, pByteBufLength = 0;
+        MFT_OUTPUT_STREAM_INFO StreamInfo;
+        MFT_OUTPUT_DATA_BUFFER outputDataBuffer;
+        DWORD processOutputStatus = 0;
         BYTE* pByteBuf = NULL;
+        DWORD pByteBufLength = 0;
+
+        CHECK_HR(pColorConvTransform->ProcessInput(0, videoSample, NULL), "The colour conversion decoder ProcessInput call failed.");
+
+        CHECK_HR(pColorConvTransform->GetOutputStreamInfo(0, &StreamInfo), "Failed to get output stream info from colour conversion MFT.");
+        CHECK_HR(MFCreateSample(&mftOutSample), "Failed to create MF sample.");
+        CHECK_HR(MFCreateMemoryBuffer(StreamInfo.cbSize, &mftOutBuffer), "Failed to create memory buffer.");
+        CHECK_HR(mftOutSample->AddBuffer(mftOutBuffer), "Failed to add sample to buffer.");
+        outputDataBuffer.dwStreamID = 0;
+        outputDataBuffer.dwStatus = 0;
+        outputDataBuffer.pEvents = NULL;
+        outputDataBuffer.pSample = mftOutSample;
+
+        auto mftProcessOutput = pColorConvTransform->ProcessOutput(0, 1, &outputDataBuffer, &processOutputStatus);
+        if (mftProcessOutput != S_OK) {
+          printf("Colour conversion failed with %.2X.\n", mftProcessOutput);
+          goto done;
+        }
 
-        CHECK_HR(mftOutSample->ConvertToContiguousBuffer(&buf), "ConvertToContiguousBuffer failed.");
-        CHECK_HR(buf->GetCurrentLength(&bufLength), "Get buffer length failed.");
-        CHECK_HR(buf->Lock(&pByteBuf, NULL, &pByteBufLength), "Failed to lock sample buffer.");
-
-        //printf("Color converted sample size %u.\n", bufLength);
-
-        //CreateBitmapFile(L"capture_postmft.bmp", VIDEO_WIDTH, VIDEO_HEIGHT, 32, pByteBuf, pByteBufLength);
+        // ----- Copy into the Direct3D sample. -----
 
-        //CHECK_HR(pD3DVideoSample->SetSampleTime(llTimeStamp), "Failed to set D3D video sample time.");
-        CHECK_HR(pD3DVideoSample->SetSampleTime(evrTimestamp), "Failed to set D3D video sample time.");
-        CHECK_HR(pD3DVideoSample->SetSampleDuration(sampleDuration), "Failed to set D3D video sample duration.");
-        CHECK_HR(pD3DVideoSample->GetBufferByIndex(0, &pDstBuffer), "Failed to get destination buffer.");
-        CHECK_HR(pDstBuffer->QueryInterface(IID_PPV_ARGS(&p2DBuffer)), "Failed to get pointer to 2D buffer.");
+        CHECK_HR(mftOutSample->ConvertToContiguousBuffer(&mftOutContiguousBuffer), "ConvertToContiguousBuffer failed.");
+        CHECK_HR(mftOutContiguousBuffer->Lock(&pByteBuf, NULL, &pByteBufLength), "Failed to lock sample buffer.");
         CHECK_HR(p2DBuffer->ContiguousCopyFrom(pByteBuf, pByteBufLength), "Failed to copy D2D buffer.");
+        CHECK_HR(mftOutContiguousBuffer->Unlock(), "Failed to unlock source buffer.");
+      }
 
-        //CHECK_HR(videoSample->GetUINT32(MFSampleExtension_FrameCorruption, &uiAttribute), "Failed to get frame corruption attribute.");
-        //CHECK_HR(pD3DVideoSample->SetUINT32(MFSampleExtension_FrameCorruption, uiAttribute), "Failed to set frame corruption attribute.");
-        CHECK_HR(videoSample->GetUINT32(MFSampleExtension_Discontinuity, &uiAttribute), "Failed to get discontinuity attribute.");
-        CHECK_HR(pD3DVideoSample->SetUINT32(MFSampleExtension_Discontinuity, uiAttribute), "Failed to set discontinuity attribute.");
-        CHECK_HR(videoSample->GetUINT32(MFSampleExtension_CleanPoint, &uiAttribute), "Failed to get clean point attribute.");
-        CHECK_HR(pD3DVideoSample->SetUINT32(MFSampleExtension_CleanPoint, uiAttribute), "Failed to set clean point attribute.");
+      CHECK_HR(pD3DVideoSample->SetSampleTime(evrTimestamp), "Failed to set D3D video sample time.");
+      CHECK_HR(pD3DVideoSample->SetSampleDuration(sampleDuration), "Failed to set D3D video sample duration.");
 
-        CHECK_HR(pStreamSink->ProcessSample(pD3DVideoSample), "Streamsink process sample failed.");
+      //CHECK_HR(videoSample->GetUINT32(MFSampleExtension_FrameCorruption, &uiAttribute), "Failed to get frame corruption attribute.");
+      //CHECK_HR(pD3DVideoSample->SetUINT32(MFSampleExtension_FrameCorruption, uiAttribute), "Failed to set frame corruption attribute.");
+      CHECK_HR(videoSample->GetUINT32(MFSampleExtension_Discontinuity, &uiAttribute), "Failed to get discontinuity attribute.");
+      CHECK_HR(pD3DVideoSample->SetUINT32(MFSampleExtension_Discontinuity, uiAttribute), "Failed to set discontinuity attribute.");
+      CHECK_HR(videoSample->GetUINT32(MFSampleExtension_CleanPoint, &uiAttribute), "Failed to get clean point attribute.");
+      CHECK_HR(pD3DVideoSample->SetUINT32(MFSampleExtension_CleanPoint, uiAttribute), "Failed to set clean point attribute.");
 
-        CHECK_HR(buf->Unlock(), "Failed to unlock source buffer.");
+      CHECK_HR(pStreamSink->ProcessSample(pD3DVideoSample), "Streamsink process sample failed.");
 
-        SAFE_RELEASE(buf);
-        SAFE_RELEASE(mftOutSample);
-        SAFE_RELEASE(mftOutBuffer);
-      }
-      else {
-        printf("Colour conversion failed with %.2X.\n", mftProcessOutput);
-        break;
-      }
-     
       evrTimestamp += sampleDuration;
     }
 
-    SAFE_RELEASE(p2DBuffer);
-    SAFE_RELEASE(pDstBuffer);
+    SAFE_RELEASE(mftOutContiguousBuffer);
+    SAFE_RELEASE(mftOutBuffer);
+    SAFE_RELEASE(mftOutSample);
+    SAFE_RELEASE(pSrc2DBuffer);
+    SAFE_RELEASE(pSrcBuffer);
     SAFE_RELEASE(videoSample);
   }
 
@@ -423,6 +480,19 @@ done:
   SAFE_RELEASE(pD3DManager);
   SAFE_RELEASE(pVideoSampleAllocator);
   SAFE_RELEASE(pD3DVideoSample);
+  SAFE_RELEASE(p2DBuffer);
+  SAFE_RELEASE(pDstBuffer);
+  SAFE_RELEASE(pWebcamSourceType);
+  SAFE_RELEASE(colorConvTransformUnk);
+  SAFE_RELEASE(pColorConvTransform);
+  SAFE_RELEASE(pDecInputMediaType);
+  SAFE_RELEASE(pDecOutputMediaType);
+  SAFE_RELEASE(mftOutContiguousBuffer);
+  SAFE_RELEASE(mftOutBuffer);
+  SAFE_RELEASE(mftOutSample);
+  SAFE_RELEASE(pSrc2DBuffer);
+  SAFE_RELEASE(pSrcBuffer);
+  SAFE_RELEASE(videoSample);
 
   return 0;
 }
@@ -480,6 +550,41 @@ done:
   return hr;
 }
 
+/**
+* Gets the ColourConverter pixel format for a Media Foundation video sub-type.
+* @param[in] subtype: the video sub-type, e.g. MFVideoFormat_YUY2.
+* @param[out] format: set to the matching pixel format if there is one.
+* @@Returns true if the ColourConverter supports the sub-type, false if not.
+*/
+bool GetColourFormat(const GUID& subtype, ColourFormat& format)
+{
+  if (subtype == MFVideoFormat_RGB24) {
+    format = ColourFormat::RGB24;
+  }
+  else if (subtype == MFVideoFormat_RGB32) {
+    format = ColourFormat::RGB32;
+  }
+  else if (subtype == MFVideoFormat_ARGB32) {
+    format = ColourFormat::BGRA;
+  }
+  else if (subtype == MFVideoFormat_I420 || subtype == MFVideoFormat_IYUV) {
+    format = ColourFormat::I420;
+  }
+  else if (subtype == MFVideoFormat_NV12) {
+    format = ColourFormat::NV12;
+  }
+  else if (subtype == MFVideoFormat_YUY2) {
+    format = ColourFormat::YUY2;
+  }
+  else if (subtype == MFVideoFormat_UYVY) {
+    format = ColourFormat::UYVY;
+  }
+  else {
+    return false;
+  }
+  return true;
+}
+
 /**
 * Initialises a new empty Window to host the video renderer and
 * starts the message loop. This function needs to be called on a
@@ -502,8 +607,8 @@ DWORD InitializeWindow(LPVOID lpThreadParameter)
       WS_OVERLAPPEDWINDOW,
       CW_USEDEFAULT,
       CW_USEDEFAULT,
-      VIDEO_WIDTH,
-      VIDEO_HEIGHT,
+      DISPLAY_WIDTH,
+      DISPLAY_HEIGHT,
       NULL,
       NULL,
       GetModuleHandle(NULL),
@@ -23,6 +23,10 @@
 * 3. Start ffplay BEFORE running this sample:
 * ffplay -i test.sdp -x 640 -y 480 -profile:v baseline -protocol_whitelist "file,rtp,udp"
 *
+* Key frames are forced by a scene change detector at cuts and, while the scene
+* is moving, at least every KEY_FRAME_INTERVAL frames. The encoder's own GOP is
+* set to the longer static interval.
+*
 * Author:
 * Aaron Clauson (aaron@sipsorcery.com)
 *
@@ -39,6 +43,8 @@
 #endif
 
 #include "../Common/MFUtility.h"
+#include "../Common/FrameDeadlineScheduler.h"
+#include "../Common/SceneChangeDetector.h"
 
 #include <stdio.h>
 #include <tchar.h>
@@ -70,6 +76,10 @@
 #define RTP_PAYLOAD_ID 96         // Needs to match the attribute set in the SDP (a=rtpmap:96 H264/90000).
 #define H264_RTP_HEADER_LENGTH 2
 #define FFPLAY_RTP_PORT 1234      // The port this sample will send to.
+#define LATENCY_BUDGET_MS 100     // Frames that can't be encoded and sent within this time of being captured are dropped.
+#define STATS_INTERVAL_FRAMES 300 // How often the frame drop and latency stats are printed.
+#define KEY_FRAME_INTERVAL 20     // Maximum frames between key frames while the scene is moving.
+#define STATIC_KEY_FRAME_INTERVAL 150 // Maximum frames between key frames while the scene is static, the encoder's GOP size.
 
 /**
 * Minimal 12 byte RTP header structure. No facility for extensions etc.
@@ -122,6 +132,10 @@ int main()
   IMFTransform* pDecoderTransform = NULL; // This is H264 Decoder MFT.
   IMFMediaType* pDecInputMediaType = NULL, * pDecOutputMediaType = NULL;
   DWORD mftStatus = 0;
+  ICodecAPI* pEncoderCodecApi = NULL;
+  IMFMediaBuffer* pFrameBuffer = NULL;
+  BYTE* pFrameData = NULL;
+  VARIANT codecApiValue;
 
   WSADATA wsaData;
   uint16_t rtpSsrc = 3334; // Supposed to be pseudo-random.
@@ -129,6 +143,8 @@ int main()
   uint32_t rtpTimestamp = 0;
   SOCKET rtpSocket = INVALID_SOCKET;
   sockaddr_in service, dest;
+  FrameDeadlineScheduler frameScheduler(OUTPUT_FRAME_RATE, LATENCY_BUDGET_MS);
+  SceneChangeDetector sceneDetector(OUTPUT_FRAME_WIDTH, OUTPUT_FRAME_HEIGHT, KEY_FRAME_INTERVAL, STATIC_KEY_FRAME_INTERVAL);
 
   CHECK_HR(CoInitializeEx(NULL, COINIT_APARTMENTTHREADED | COINIT_DISABLE_OLE1DDE),
     "COM initialisation failed.");
@@ -224,6 +240,15 @@ int main()
   CHECK_HR(pEncoderTransfrom->SetInputType(0, pMFTInputMediaType, 0),
     "Failed to set input media type on H.264 encoder MFT.");
 
+  // The scene change detector forces the key frames, the encoder's GOP only needs to cover a static scene.
+  CHECK_HR(spEncoderTransfromUnk->QueryInterface(IID_PPV_ARGS(&pEncoderCodecApi)),
+    "Failed to get ICodecAPI interface from H264 encoder MFT object.");
+
+  VariantInit(&codecApiValue);
+  codecApiValue.vt = VT_UI4;
+  codecApiValue.ulVal = STATIC_KEY_FRAME_INTERVAL;
+  CHECK_HR(pEncoderCodecApi->SetValue(&CODECAPI_AVEncMPVGOPSize, &codecApiValue), "Failed to set GOP size on H264 encoder MFT.");
+
   CHECK_HR(pEncoderTransfrom->GetInputStatus(0, &mftStatus), "Failed to get input status from H.264 MFT.");
   if (MFT_INPUT_STATUS_ACCEPT_DATA != mftStatus) {
     printf("E: ApplyTransform() pEncoderTransfrom->GetInputStatus() not accept data.\n");
@@ -243,6 +268,7 @@ int main()
   LONGLONG llVideoTimeStamp, llSampleDuration;
   int sampleCount = 0;
   BOOL h264EncodeTransformFlushed = FALSE;
+  LONGLONG llOutputTimeStamp = 0;
 
   while (true)
   {
@@ -288,6 +314,34 @@ int main()
 
       //printf("Sample count %d, Sample flags %d, sample duration %I64d, sample time %I64d\n", sampleCount, sampleFlags, llSampleDuration, llVideoTimeStamp);
 
+      // If the encoder can't keep up, frames queue up in the source reader. Dropping the ones that are
+      // too late, or some of them if encoding takes longer than the frame interval, keeps the latency
+      // bounded. The first frame is always encoded as the encoder starts with an IDR frame.
+      bool encodeFrame = frameScheduler.ShouldEncode(llVideoTimeStamp, sampleCount == 0);
+
+      if (frameScheduler.GetStats().Captured % STATS_INTERVAL_FRAMES == 0) {
+        PrintFrameDeadlineStats(frameScheduler.GetStats());
+      }
+
+      if (!encodeFrame) {
+        sampleCount++;
+        SAFE_RELEASE(pVideoSample);
+        continue;
+      }
+
+      CHECK_HR(pVideoSample->ConvertToContiguousBuffer(&pFrameBuffer), "ConvertToContiguousBuffer failed.");
+      CHECK_HR(pFrameBuffer->Lock(&pFrameData, NULL, NULL), "Failed to lock video sample buffer.");
+
+      // The first frame is an IDR frame anyway.
+      if (sceneDetector.Analyse(pFrameData, OUTPUT_FRAME_WIDTH, sampleCount == 0) != SceneKeyFrameReason::None && sampleCount != 0) {
+        codecApiValue.vt = VT_UI4;
+        codecApiValue.ulVal = 1;
+        CHECK_HR(pEncoderCodecApi->SetValue(&CODECAPI_AVEncVideoForceKeyFrame, &codecApiValue), "Failed to force a key frame on H264 encoder MFT.");
+      }
+
+      CHECK_HR(pFrameBuffer->Unlock(), "Failed to unlock video sample buffer.");
+      SAFE_RELEASE(pFrameBuffer);
+
       // Apply the H264 encoder transform
       CHECK_HR(pEncoderTransfrom->ProcessInput(0, pVideoSample, 0),
         "The H264 encoder ProcessInput call failed.");
@@ -313,12 +367,16 @@ int main()
           //printf("H264 sample ready for transmission.\n");
 
           SendH264RtpSample(rtpSocket, dest, pH264EncodeOutSample, rtpSsrc, (uint32_t)(llVideoTimeStamp / 10000), &rtpSeqNum);
+
+          CHECK_HR(pH264EncodeOutSample->GetSampleTime(&llOutputTimeStamp), "Error getting H264 sample time.");
+          frameScheduler.OnFrameSent(llOutputTimeStamp);
         }
 
         SAFE_RELEASE(pH264EncodeOutSample);
       }
       // *****
 
+      frameScheduler.OnFrameEncoded();
       sampleCount++;
 
       // Note: Apart from memory leak issues if the media samples are not released the videoReader->ReadSample
@@ -330,6 +388,11 @@ int main()
 
 done:
 
+  PrintFrameDeadlineStats(frameScheduler.GetStats());
+  printf("Key frames forced %zu, scene cuts %zu, interval %zu, static frames %zu of %zu.\n", sceneDetector.GetStats().ForcedKeyFrames,
+    sceneDetector.GetStats().SceneCuts, sceneDetector.GetStats().IntervalKeyFrames, sceneDetector.GetStats().StaticFrames,
+    sceneDetector.GetStats().Frames);
+
   printf("finished.\n");
   auto c = getchar();
 
@@ -338,6 +401,8 @@ done:
   SAFE_RELEASE(pSrcOutMediaType);
   SAFE_RELEASE(spEncoderTransfromUnk);
   SAFE_RELEASE(pEncoderTransfrom);
+  SAFE_RELEASE(pEncoderCodecApi);
+  SAFE_RELEASE(pFrameBuffer);
   SAFE_RELEASE(pMFTInputMediaType);
   SAFE_RELEASE(pMFTOutputMediaType);
 
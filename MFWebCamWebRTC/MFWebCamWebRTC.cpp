@@ -3,29 +3,43 @@
 *
 * Description:
 * This file contains a C++ console application that captures the real-time video
-* stream from a webcam using Windows Media Foundation and streams it to a WebRTC
-* client.
+* stream from a webcam, and audio from a microphone, using Windows Media Foundation
+* and streams them to a WebRTC client. The audio is Opus encoded and bundled on
+* the same socket and DTLS/SRTP connection as the video under its own SSRC.
 *
 * Dependencies:
-* vcpkg install openssl libsrtp libvpx zlib
+* vcpkg install openssl libsrtp libvpx opus zlib
 *
 * To connect to the program the steps are below. The example uses the loopback address
 * for the connection so the program and the browser need to be running on the same machine.
-* The program only supports a single client and needs to be restarted at the end
-* of each connection.
+* Multiple browsers can connect at the same time. Each one gets its own DTLS connection,
+* which is progressed on a small worker pool, and SRTP context.
 *
 * 1. Build and run this program.
 * 2. Open the mfwebrtc.html file in a browser.
 * 3. Press the Start button on the web page and the webcam feed should appear.
 *
-* Browser Interop (as of 19 Jan 2020, confirmed on 29 Feb 2020):
+* Signaling is a WHIP style (RFC9725) HTTP exchange. The browser POSTs its SDP offer
+* to http://127.0.0.1:8080/webrtc and gets the SDP answer back in the 201 response.
+* Each offer gets its own ICE credentials and its session is created before the
+* browser's first STUN binding request arrives. A DELETE to the URL in the Location
+* header closes the session.
+*
+* The video resolution, frame rate and bitrate are stepped down when the encoder
+* can't keep up or the browser's bandwidth estimate, from its REMB feedback, drops
+* and back up when there's room again. The capture format doesn't change, frames
+* are scaled and decimated before the encoder.
+*
+* Key frames are placed by a scene change detector rather than libvpx's fixed
+* interval, at cuts and, while the scene is static, much less often. With
+* VIDEO_INTRA_REFRESH the picture is refreshed a band at a time by libvpx's
+* cyclic refresh instead and key frames are only sent to new sessions.
+*
+* Browser Interop:
 * - Works in Chrome.
 * - Works in Edge Chromium.
-* - Doesn't work in Firefox. Firefox requires a STUN binding request to be sent from the
-*   remote peer before it will initiate the DTLS handshake. To send a binding request
-*   the SDP answer from the browser is required (in order to get the ICE username and
-*   password). To get the SDP there needs to be some kind of signaling transport such
-*   a web socket. That would add a lot of noise to this example so stick to Chrome.
+* - Not tested in Firefox. It couldn't connect when the offer was hard coded in
+*   mfwebrtc.html, which is no longer the case.
 *
 * Author:
 * Aaron Clauson (aaron@sipsorcery.com)
@@ -41,7 +55,18 @@
 #define WIN32_LEAN_AND_MEAN
 #endif
 
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+
 #include "../Common/MFUtility.h"
+#include "../Common/FrameDeadlineScheduler.h"
+#include "../Common/I420Scaler.h"
+#include "../Common/SceneChangeDetector.h"
+#include "../Common/VideoAdaptationController.h"
+#include "../Common/VideoScaler.h"
+#include "../Common/Vp8EncoderProfile.h"
+#include "../Common/Vp9SvcEncoderProfile.h"
 
 #include <stdio.h>
 #include <tchar.h>
@@ -59,13 +84,30 @@
 #include <openssl/bio.h>
 #include <openssl/srtp.h>
 #include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <openssl/x509.h>
 #include <vpx/vpx_encoder.h>
 #include <vpx/vp8cx.h>
+#include <opus/opus.h>
 #include <zlib.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <deque>
 #include <exception>
+#include <functional>
 #include <iostream>
 #include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <sstream>
+#include <string>
 #include <thread>
 #include <vector>
 
@@ -78,38 +120,110 @@
 #pragma comment(lib, "Ws2_32.lib")
 
 #define WEBCAM_DEVICE_INDEX 0	    // Adjust according to desired video capture device.
+#define AUDIO_CAPTURE_DEVICE_INDEX 0   // Adjust according to desired audio capture device.
 #define OUTPUT_FRAME_WIDTH 640		// Adjust if the webcam does not support this frame width.
 #define OUTPUT_FRAME_HEIGHT 480		// Adjust if the webcam does not support this frame height.
 #define OUTPUT_FRAME_RATE 30      // Adjust if the webcam does not support this frame rate.
 #define RTP_MAX_PAYLOAD 1400      // Maximum size of an RTP packet, needs to be under the Ethernet MTU.
 #define RTP_HEADER_LENGTH 12
 #define RTP_VERSION 2
-#define RTP_PAYLOAD_ID 100         // Needs to match the attribute set in the SDP (a=rtpmap:100 VP8/90000).
+#define VIDEO_CODEC_VP9 false      // Set to true to send a single VP9 SVC encode instead of VP8. The browser's offer needs to include VP9 profile 0.
 #define RTP_SSRC 337799
-#define VP8_RTP_HEADER_LENGTH 1
+#define VP8_RTP_HEADER_LENGTH 6         // Full RFC7741 payload descriptor with the PictureID, TL0PICIDX and TID extensions.
 #define RTP_LISTEN_PORT 8888      // The port this sample will listen on for an RTP connection from a WebRTC client.
 #define DTLS_CERTIFICATE_FILE "localhost.pem"
 #define DTLS_KEY_FILE "localhost_key.pem"
+#define DTLS_USE_ECDSA_CERTIFICATE false  // Set to true to use an ECDSA P-256 certificate generated in memory at startup instead of the certificate files.
 #define DTLS_COOKIE "sipsorcery"
 #define RECEIVE_BUFFER_LENGTH 4096
 #define SRTP_MASTER_KEY_KEY_LEN 16
 #define SRTP_MASTER_KEY_SALT_LEN 14
-#define ICE_USERNAME "EJYWWCUDJQLTXTNQRXEJ"
-#define ICE_USERNAME_LENGTH 20
-#define ICE_PASSWORD "SKYKPPYLTZOAVCLTGHDUODANRKSPOVQVKXJULOGG" // Must match the value in the SDP given to the client.
-#define ICE_PASSWORD_LENGTH 40
+#define ICE_USERNAME_LENGTH 20         // Length of the random ICE ufrag put in each SDP answer.
+#define ICE_PASSWORD_LENGTH 40         // Length of the random ICE password put in each SDP answer.
 #define SRTP_AUTH_KEY_LENGTH 10
 #define VP8_TIMESTAMP_SPACING 3000
+#define DTLS_MTU 1200                   // Maximum size of a datagram carrying DTLS records.
+#define DTLS_RECORD_HEADER_LENGTH 13
+#define DTLS_WORKER_THREAD_COUNT 4      // Number of threads available to progress DTLS handshakes.
+#define DTLS_HANDSHAKE_TIMEOUT_MS 10000 // Sessions that haven't completed the DTLS handshake in this period are removed.
+#define ICE_CONSENT_TIMEOUT_MS 30000    // Sessions that haven't had an authenticated STUN binding request in this period are torn down (RFC7675).
+#define EVENT_LOOP_MAX_WAIT_MS 100      // Maximum time the event loop waits on the socket before checking its timers.
+#define VP8_TEMPORAL_LAYER_COUNT 3      // Temporal layers in the VP8 stream, TL0 is 1/4 of the frame rate, TL1 1/2 and TL2 the full rate.
+#define SESSION_MAX_TEMPORAL_LAYER 2    // Highest temporal layer sent to each session. Lower it to thin the stream the way a forwarding node would under congestion.
+#define SESSION_MAX_SPATIAL_LAYER 2     // Highest VP9 spatial layer sent to each session, 0 is 1/4 of the frame size, 1 is 1/2 and 2 the full size.
+#define OPUS_SSRC 337800
+#define OPUS_SAMPLE_RATE 48000          // Opus RTP always uses a 48KHz clock, the source reader resamples the microphone to it.
+#define OPUS_CHANNELS 1
+#define OPUS_FRAME_SAMPLES 960          // 20ms frames.
+#define OPUS_BITRATE 32000
+#define OPUS_EXPECTED_PACKET_LOSS_PERCENT 10  // In-band FEC is only added when the encoder expects some loss.
+#define OPUS_MAX_PACKET_LENGTH 1275
+#define OPUS_DTX_FRAME_MAX_LENGTH 2     // Encoded frames this short are DTX frames during silence and aren't sent.
+#define RTP_AUDIO_LEVEL_EXTENSION_LENGTH 8
+#define RTCP_SR_INTERVAL_MS 1000        // How often RTCP sender reports are sent for each stream.
+#define RTCP_CNAME "mfwebcamwebrtc"     // Shared by the audio and video streams so the browser synchronises them.
+#define MEDIA_STREAM_ID "webcam"
+#define HTTP_LISTEN_PORT 8080           // The port the browser POSTs its SDP offer to.
+#define HTTP_SIGNALING_PATH "/webrtc"   // The URL path offers are POSTed to, sessions are at HTTP_SIGNALING_PATH/<ICE ufrag>.
+#define HTTP_MAX_REQUEST_LENGTH 65536   // Browser offers are a few KB.
+#define HTTP_RECEIVE_TIMEOUT_MS 2000    // A client that hasn't sent its whole request in this period is disconnected.
+#define HTTP_WORKER_THREAD_COUNT 4      // Number of threads reading and answering signaling requests.
+#define HTTP_MAX_PENDING_CONNECTIONS 64 // Connections accepted while this many are waiting for a worker are closed straight away.
+#define VIDEO_LATENCY_BUDGET_MS 100     // Video frames that can't be encoded and sent within this time of being captured are dropped.
+#define VIDEO_STATS_INTERVAL_FRAMES 300 // How often the video frame drop and latency stats are printed.
+#define VIDEO_BITRATE_KBPS 300          // Target bitrate at the full resolution and frame rate, adaptation steps scale it down.
+#define VIDEO_ADAPTATION_ENABLED true   // Set to false to always send the full resolution and frame rate.
+#define VIDEO_KEY_FRAME_INTERVAL 20     // Maximum frames between key frames while the scene is moving.
+#define VIDEO_STATIC_KEY_FRAME_INTERVAL 150 // Maximum frames between key frames while the scene is static.
+#define VIDEO_INTRA_REFRESH false       // Set to true to avoid key frame size spikes, key frames are then only forced for new sessions.
+#define VIDEO_MAX_INTRA_BITRATE_PCT 300 // With intra refresh the key frames that are sent are capped at 3 times an average frame.
 
 // Forward function definitions.
 class StunMessage;
-HRESULT SendRtpSample(SOCKET socket, sockaddr_in& dst, srtp_t* srtpSession, byte* frameData, size_t frameLength, uint32_t ssrc, uint32_t timestamp, uint16_t* seqNum);
+class SdpOffer;
+class WebRtcSession;
+class SessionTable;
+class Vp8PayloadDescriptor;
+class Vp9PayloadDescriptor;
+class RtpHeader;
+class RtpTimestampClock;
+struct RtpSenderStats;
+HRESULT SendRtpSample(SOCKET socket, WebRtcSession& session, byte* frameData, size_t frameLength, uint32_t ssrc, uint32_t timestamp, Vp8PayloadDescriptor& descriptor, bool isEndOfFrame);
+HRESULT SendVp9RtpSample(SOCKET socket, WebRtcSession& session, const byte* frameData, size_t frameLength, uint32_t ssrc, uint32_t timestamp, Vp9PayloadDescriptor& descriptor, bool isEndOfPicture);
+HRESULT SendRtpPacket(SOCKET socket, WebRtcSession& session, RtpHeader& rtpHeader, const uint8_t* descriptor, int descriptorLength, const uint8_t* payload, size_t payloadLength,
+  RtpSenderStats& stats);
+void SendVp9Superframe(SOCKET rtpSocket, std::vector<std::shared_ptr<WebRtcSession>>& readySessions, const vpx_codec_cx_pkt_t* pkt,
+  Vp9PayloadDescriptor& descriptor, uint32_t ssrc, uint32_t timestamp);
 void krx_ssl_info_callback(const SSL* ssl, int where, int ret);
 int verify_cookie(SSL* ssl, const unsigned char* cookie, unsigned int cookie_len);
 int generate_cookie(SSL* ssl, unsigned char* cookie, unsigned int* cookie_len);
-int StreamWebcam(SOCKET rtpSocket, sockaddr_in& dest, srtp_t* srtpSession);
-void RtpSocketListen(SOCKET rtpSocket);
-void SendStunBindingResponse(SOCKET rtpSocket, StunMessage& bindingRequest, sockaddr_in client);
+int StreamWebcam(SOCKET rtpSocket, SessionTable& sessions, RtpTimestampClock& videoClock);
+int StreamMicrophone(SOCKET rtpSocket, SessionTable& sessions, RtpTimestampClock& audioClock, std::atomic<bool>& exit);
+void SendRtcpSenderReports(SOCKET rtpSocket, WebRtcSession& session, RtpTimestampClock& videoClock, RtpTimestampClock& audioClock);
+void SetVp8TemporalLayerBitrates(unsigned int targetBitrateKbps, vpx_codec_enc_cfg_t* pConfig);
+uint8_t GetAudioLevel(const int16_t* pcm, size_t sampleCount);
+void SendStunBindingResponse(SOCKET rtpSocket, StunMessage& bindingRequest, sockaddr_in client, const std::string& icePassword);
+void FlushDtlsRecords(SOCKET rtpSocket, WebRtcSession& session);
+bool CreateSrtpSession(WebRtcSession& session);
+bool CreateEcdsaCertificate(X509** ppCert, EVP_PKEY** ppKey);
+std::string GetCertificateFingerprint(X509* cert);
+std::string GetRandomIceString(size_t length);
+std::string GetSdpAnswer(const SdpOffer& offer, const WebRtcSession& session, const std::string& fingerprint);
+
+/*
+* VP8 temporal layer pattern 0-2-1-2. TL0 frames only reference and update the last
+* frame buffer, TL1 frames reference the last TL0 frame and update the golden buffer
+* and TL2 frames reference both but update nothing. Any layer can be dropped along
+* with those above it and the remaining frames still decode.
+*/
+const int VP8_TEMPORAL_PATTERN_LENGTH = 4;
+const int VP8_TEMPORAL_LAYER_IDS[VP8_TEMPORAL_PATTERN_LENGTH] = { 0, 2, 1, 2 };
+const vpx_enc_frame_flags_t VP8_TEMPORAL_LAYER_FLAGS[VP8_TEMPORAL_PATTERN_LENGTH] = {
+  VP8_EFLAG_NO_REF_GF | VP8_EFLAG_NO_REF_ARF | VP8_EFLAG_NO_UPD_GF | VP8_EFLAG_NO_UPD_ARF,
+  VP8_EFLAG_NO_REF_ARF | VP8_EFLAG_NO_UPD_LAST | VP8_EFLAG_NO_UPD_GF | VP8_EFLAG_NO_UPD_ARF | VP8_EFLAG_NO_UPD_ENTROPY,
+  VP8_EFLAG_NO_REF_GF | VP8_EFLAG_NO_REF_ARF | VP8_EFLAG_NO_UPD_LAST | VP8_EFLAG_NO_UPD_ARF | VP8_EFLAG_NO_UPD_ENTROPY,
+  VP8_EFLAG_NO_REF_ARF | VP8_EFLAG_NO_UPD_LAST | VP8_EFLAG_NO_UPD_GF | VP8_EFLAG_NO_UPD_ARF | VP8_EFLAG_NO_UPD_ENTROPY,
+};
 
 #define SSL_WHERE_INFO(ssl, w, flag, msg) {                \
     if(w & flag) {                                         \
@@ -154,6 +268,279 @@ public:
   }
 };
 
+/**
+* VP8 RTP payload descriptor from RFC7741 section 4.2. Always serialised with the
+* X, I (15 bit PictureID), L and T extensions present:
+*
+*      0 1 2 3 4 5 6 7
+*     +-+-+-+-+-+-+-+-+
+*     |X|R|N|S|R| PID | (REQUIRED)
+*     +-+-+-+-+-+-+-+-+
+*  X: |I|L|T|K| RSV   |
+*     +-+-+-+-+-+-+-+-+
+*  I: |M| PictureID   |
+*     +-+-+-+-+-+-+-+-+
+*     |   PictureID   |
+*     +-+-+-+-+-+-+-+-+
+*  L: |   TL0PICIDX   |
+*     +-+-+-+-+-+-+-+-+
+*  T: |TID|Y|  KEYIDX |
+*     +-+-+-+-+-+-+-+-+
+*/
+class Vp8PayloadDescriptor
+{
+public:
+  uint8_t NonReference = 0;        // 1 bit, the frame can be discarded without affecting any other frame.
+  uint8_t StartOfPartition = 0;    // 1 bit.
+  uint8_t PartitionIndex = 0;      // 4 bits.
+  uint16_t PictureID = 0;          // 15 bits, incremented for each frame.
+  uint8_t TL0PicIdx = 0;           // 8 bits, incremented for each TL0 frame.
+  uint8_t TemporalLayerID = 0;     // 2 bits.
+  uint8_t LayerSync = 0;           // 1 bit, the frame only depends on TL0 frames.
+
+  void Serialise(uint8_t* buf)
+  {
+    buf[0] = 0x80 | (NonReference << 5 & 0x20) | (StartOfPartition << 4 & 0x10) | (PartitionIndex & 0x0f);
+    buf[1] = 0x80 | 0x40 | 0x20;   // I, L and T present, no KEYIDX.
+    buf[2] = 0x80 | (PictureID >> 8 & 0x7f);
+    buf[3] = PictureID & 0xff;
+    buf[4] = TL0PicIdx;
+    buf[5] = (TemporalLayerID << 6 & 0xc0) | (LayerSync << 5 & 0x20);
+  }
+};
+
+/**
+* VP9 RTP payload descriptor from RFC9628 section 4.2 in non-flexible mode, i.e.
+* the layer indices and TL0PICIDX are sent and the references are described by
+* the group of frames in the scalability structure:
+*
+*      0 1 2 3 4 5 6 7
+*     +-+-+-+-+-+-+-+-+
+*     |I|P|L|F|B|E|V|Z| (REQUIRED)
+*     +-+-+-+-+-+-+-+-+
+* I:  |M| PICTURE ID  | (RECOMMENDED)
+*     +-+-+-+-+-+-+-+-+
+* M:  | EXTENDED PID  | (RECOMMENDED)
+*     +-+-+-+-+-+-+-+-+
+* L:  |  TID  |U| SID |D| (Conditionally RECOMMENDED)
+*     +-+-+-+-+-+-+-+-+
+*     |   TL0PICIDX   | (Conditionally REQUIRED)
+*     +-+-+-+-+-+-+-+-+
+* V:  | SS            |
+*     | ..            |
+*     +-+-+-+-+-+-+-+-+
+*/
+class Vp9PayloadDescriptor
+{
+public:
+  static const int MAX_LENGTH = 5 + 1 + VP9_SVC_MAX_SPATIAL_LAYERS * 4 + 1 + VP9_SVC_TEMPORAL_PATTERN_LENGTH * 2;
+
+  uint8_t InterPicturePredicted = 0;  // 1 bit (P), the layer frame references an earlier picture.
+  uint8_t StartOfFrame = 0;           // 1 bit (B), first packet of a layer frame.
+  uint8_t EndOfFrame = 0;             // 1 bit (E), last packet of a layer frame.
+  uint8_t ScalabilityStructure = 0;   // 1 bit (V), the SS data is included. Sent at the start of keyframes.
+  uint8_t NotUpperReference = 0;      // 1 bit (Z), the layer frame isn't used to predict a higher spatial layer.
+  uint16_t PictureID = 0;             // 15 bits, one per superframe, shared by its spatial layers.
+  uint8_t TemporalLayerID = 0;        // 3 bits.
+  uint8_t SwitchingUpPoint = 0;       // 1 bit (U).
+  uint8_t SpatialLayerID = 0;         // 3 bits.
+  uint8_t InterLayerDependency = 0;   // 1 bit (D), the layer frame is predicted from the spatial layer below.
+  uint8_t TL0PicIdx = 0;              // 8 bits, incremented for each TL0 picture.
+
+  // Scalability structure.
+  uint8_t SpatialLayerCount = 1;
+  uint16_t Widths[VP9_SVC_MAX_SPATIAL_LAYERS] = { 0 };
+  uint16_t Heights[VP9_SVC_MAX_SPATIAL_LAYERS] = { 0 };
+
+  /* Serialises the descriptor and returns its length. */
+  int Serialise(uint8_t* buf)
+  {
+    // Group of frames for the 0-2-1-2 temporal pattern: temporal layer, switching up point and reference picture difference.
+    const uint8_t gofTemporalLayers[VP9_SVC_TEMPORAL_PATTERN_LENGTH] = { 0, 2, 1, 2 };
+    const uint8_t gofSwitchingUp[VP9_SVC_TEMPORAL_PATTERN_LENGTH] = { 0, 1, 1, 0 };
+    const uint8_t gofPDiff[VP9_SVC_TEMPORAL_PATTERN_LENGTH] = { 4, 1, 2, 1 };
+
+    int posn = 0;
+
+    buf[posn++] = 0x80 | (InterPicturePredicted << 6 & 0x40) | 0x20 | (StartOfFrame << 3 & 0x08) |
+      (EndOfFrame << 2 & 0x04) | (ScalabilityStructure << 1 & 0x02) | (NotUpperReference & 0x01);   // I and L set, F clear.
+    buf[posn++] = 0x80 | (PictureID >> 8 & 0x7f);
+    buf[posn++] = PictureID & 0xff;
+    buf[posn++] = (TemporalLayerID << 5 & 0xe0) | (SwitchingUpPoint << 4 & 0x10) | (SpatialLayerID << 1 & 0x0e) | (InterLayerDependency & 0x01);
+    buf[posn++] = TL0PicIdx;
+
+    if (ScalabilityStructure) {
+      buf[posn++] = ((SpatialLayerCount - 1) << 5 & 0xe0) | 0x10 | 0x08;   // N_S, Y and G.
+      for (int i = 0; i < SpatialLayerCount; i++) {
+        buf[posn++] = Widths[i] >> 8 & 0xff;
+        buf[posn++] = Widths[i] & 0xff;
+        buf[posn++] = Heights[i] >> 8 & 0xff;
+        buf[posn++] = Heights[i] & 0xff;
+      }
+      buf[posn++] = VP9_SVC_TEMPORAL_PATTERN_LENGTH;
+      for (int i = 0; i < VP9_SVC_TEMPORAL_PATTERN_LENGTH; i++) {
+        buf[posn++] = (gofTemporalLayers[i] << 5 & 0xe0) | (gofSwitchingUp[i] << 4 & 0x10) | (1 << 2);   // One reference.
+        buf[posn++] = gofPDiff[i];
+      }
+    }
+
+    return posn;
+  }
+};
+
+/**
+* RTP audio level header extension from RFC6464 in the RFC8285 one-byte header
+* form. Lets a receiver, or a forwarding node, tell which streams have someone
+* speaking without decoding the audio:
+*
+*      0                   1                   2                   3
+*      0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+*     +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+*     |       0xBE    |    0xDE       |           length=1            |
+*     +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+*     |  ID   | len=0 |V| level       |    0 (pad)    |    0 (pad)    |
+*     +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+*/
+class RtpAudioLevelExtension
+{
+public:
+  uint8_t ID = 0;                 // 4 bits, the extmap ID from the browser's offer.
+  uint8_t VoiceActivity = 0;      // 1 bit.
+  uint8_t Level = 127;            // 7 bits, -dBov so 0 is the loudest and 127 silence.
+
+  void Serialise(uint8_t* buf)
+  {
+    buf[0] = 0xBE;
+    buf[1] = 0xDE;
+    buf[2] = 0x00;
+    buf[3] = 0x01;
+    buf[4] = (ID << 4 & 0xf0);
+    buf[5] = (VoiceActivity << 7 & 0x80) | (Level & 0x7f);
+    buf[6] = 0x00;
+    buf[7] = 0x00;
+  }
+};
+
+/**
+* RTCP sender report from RFC3550 section 6.4.1. No reception report blocks are
+* included as this sample only sends media. The NTP and RTP timestamps are what
+* the browser uses to line the audio and video streams up.
+*/
+class RtcpSenderReport
+{
+public:
+  static const int LENGTH = 28;
+
+  uint32_t SyncSource = 0;
+  uint64_t NtpTimestamp = 0;      // 32 bits of seconds since 1900 and 32 bits of fraction.
+  uint32_t RtpTimestamp = 0;      // The same instant as the NTP timestamp on the stream's RTP clock.
+  uint32_t PacketCount = 0;
+  uint32_t OctetCount = 0;
+
+  int Serialise(uint8_t* buf)
+  {
+    buf[0] = RTP_VERSION << 6;      // No padding and no report blocks.
+    buf[1] = 200;
+    buf[2] = 0x00;
+    buf[3] = LENGTH / 4 - 1;
+    WriteUInt32(&buf[4], SyncSource);
+    WriteUInt32(&buf[8], (uint32_t)(NtpTimestamp >> 32));
+    WriteUInt32(&buf[12], (uint32_t)NtpTimestamp);
+    WriteUInt32(&buf[16], RtpTimestamp);
+    WriteUInt32(&buf[20], PacketCount);
+    WriteUInt32(&buf[24], OctetCount);
+    return LENGTH;
+  }
+
+private:
+  static void WriteUInt32(uint8_t* buf, uint32_t value)
+  {
+    buf[0] = value >> 24 & 0xff;
+    buf[1] = value >> 16 & 0xff;
+    buf[2] = value >> 8 & 0xff;
+    buf[3] = value & 0xff;
+  }
+};
+
+/**
+* RTCP source description from RFC3550 section 6.5 with a single chunk holding
+* the CNAME item, which every compound RTCP packet has to carry.
+*/
+class RtcpSdesCname
+{
+public:
+  uint32_t SyncSource = 0;
+  std::string CName;
+
+  /* Serialises the SDES packet and returns its length. The buffer needs to be at least GetLength() bytes. */
+  int Serialise(uint8_t* buf)
+  {
+    int length = GetLength();
+    memset(buf, 0, length);
+
+    buf[0] = RTP_VERSION << 6 | 0x01;   // One chunk.
+    buf[1] = 202;
+    buf[2] = (length / 4 - 1) >> 8 & 0xff;
+    buf[3] = (length / 4 - 1) & 0xff;
+    buf[4] = SyncSource >> 24 & 0xff;
+    buf[5] = SyncSource >> 16 & 0xff;
+    buf[6] = SyncSource >> 8 & 0xff;
+    buf[7] = SyncSource & 0xff;
+    buf[8] = 1;                         // CNAME item.
+    buf[9] = (uint8_t)CName.size();
+    memcpy(&buf[10], CName.data(), CName.size());
+    // The chunk is terminated by at least one null byte and padded to 32 bits, both already zeroed.
+
+    return length;
+  }
+
+  int GetLength()
+  {
+    return 8 + ((2 + (int)CName.size() + 1 + 3) / 4) * 4;
+  }
+};
+
+/**
+* Receiver Estimated Maximum Bitrate, a payload specific feedback message (PT=206,
+* FMT=15) from draft-alvestrand-rmcat-remb. The browser sends it with its receive
+* side bandwidth estimate when goog-remb is negotiated for the video stream.
+*/
+class RtcpRemb
+{
+public:
+  uint32_t Bitrate = 0;           // Bits per second.
+
+  /**
+  * Looks for a REMB message in a decrypted compound RTCP packet.
+  * @param[in] buf: the compound RTCP packet.
+  * @param[in] length: the length of the packet.
+  * @@Returns true if there was a REMB message and Bitrate has been set from it.
+  */
+  bool Deserialise(const uint8_t* buf, int length)
+  {
+    int offset = 0;
+
+    while (offset + 4 <= length) {
+      const uint8_t* pPacket = &buf[offset];
+      int packetLength = ((pPacket[2] << 8) + pPacket[3] + 1) * 4;
+      if (offset + packetLength > length) {
+        break;
+      }
+
+      if (pPacket[1] == 206 && (pPacket[0] & 0x1f) == 15 && packetLength >= 20 && memcmp(&pPacket[12], "REMB", 4) == 0) {
+        uint8_t exponent = pPacket[17] >> 2;
+        uint32_t mantissa = ((pPacket[17] & 0x03) << 16) + (pPacket[18] << 8) + pPacket[19];
+        Bitrate = (exponent < 14) ? mantissa << exponent : UINT32_MAX;
+        return true;
+      }
+
+      offset += packetLength;
+    }
+
+    return false;
+  }
+};
+
 /* STUN message types needed for this example. */
 enum class StunMessageTypes : uint16_t
 {
@@ -208,6 +595,9 @@ public:
     else {
       Type = ((buffer[0] << 8) & 0xff00) + buffer[1];
       Length = ((buffer[2] << 8) & 0xff00) + buffer[3];
+      if (HEADER_LENGTH + Length > bufferLength) {
+        throw std::runtime_error("Could not deserialise STUN attribute, length exceeds buffer.");
+      }
       Padding = (Length % 4 != 0) ? 4 - (Length % 4) : 0;
       Value.resize(Length);
       memcpy_s(Value.data(), Length, buffer + HEADER_LENGTH, Length);
@@ -392,346 +782,1893 @@ public:
       bufPosn += att.HEADER_LENGTH + att.Length + att.Padding;
     }
   }
-};
-
-int main()
-{
-  // Socket variables.
-  WSADATA wsaData;
-  SOCKET rtpSocket = INVALID_SOCKET;
-  sockaddr_in service, dest;
-  unsigned char recvBuffer[RECEIVE_BUFFER_LENGTH];
-  sockaddr_in clientAddr;
-  int clientAddrLen = sizeof(clientAddr);
-
-  // DTLS variables.
-  SSL_CTX* ctx = nullptr;		/* main ssl context */
-  SSL* ssl = nullptr;       /* the SSL* which represents a "connection" */
-  BIO* bio = nullptr;
-
-  // SRTP variables.
-  unsigned char dtls_buffer[SRTP_MASTER_KEY_KEY_LEN * 2 + SRTP_MASTER_KEY_SALT_LEN * 2];
-  unsigned char client_write_key[SRTP_MASTER_KEY_KEY_LEN + SRTP_MASTER_KEY_SALT_LEN];
-  unsigned char server_write_key[SRTP_MASTER_KEY_KEY_LEN + SRTP_MASTER_KEY_SALT_LEN];
-  size_t keyMaterialOffset = 0;
-  srtp_policy_t* srtpPolicy = nullptr;
-  srtp_t* srtpSession = nullptr;
 
-  try {
+  /* Checks whether the message has an attribute, e.g. the flag only USE-CANDIDATE. */
+  bool HasAttribute(StunAttributeTypes type)
+  {
+    for (auto& att : Attributes) {
+      if (att.Type == (uint16_t)type) {
+        return true;
+      }
+    }
+    return false;
+  }
 
-    // Initialise Winsock
-    int iResult = WSAStartup(MAKEWORD(2, 2), &wsaData);
-    if (iResult != 0) {
-      printf("WSAStartup failed: %d\n", iResult);
-      goto done;
+  /* Gets the value of the USERNAME attribute or an empty string if there isn't one. */
+  std::string GetUsername()
+  {
+    for (auto& att : Attributes) {
+      if (att.Type == (uint16_t)StunAttributeTypes::Username) {
+        return std::string(att.Value.begin(), att.Value.end());
+      }
     }
+    return std::string();
+  }
 
-    // Initialise OpenSSL
-    SSL_library_init();
-    SSL_load_error_strings();
-    ERR_load_BIO_strings();
-    OpenSSL_add_all_algorithms();
+  /**
+  * Checks the MESSAGE-INTEGRITY attribute of a received message. The HMAC covers
+  * the message up to the attribute with the header length adjusted to end after
+  * it, see RFC5389 section 15.4.
+  * @param[in] buffer: the buffer the message was deserialised from.
+  * @param[in] bufferLength: the length of the message in the buffer.
+  * @param[in] icePwd: the ICE password the HMAC is keyed with.
+  * @param[in] icePwdLen: the length of the ICE password.
+  * @@Returns true if the attribute is present and the HMAC matches.
+  */
+  bool CheckMessageIntegrity(const uint8_t* buffer, int bufferLength, const char* icePwd, int icePwdLen)
+  {
+    int posn = FindAttribute(buffer, bufferLength, StunAttributeTypes::MessageIntegrity);
+    if (posn < 0 || posn + StunAttribute::HEADER_LENGTH + StunAttribute::MESSAGE_INTEGRITY_ATTRIBUTE_HMAC_LENGTH > bufferLength) {
+      return false;
+    }
 
-    // Dump any openssl errors.
-    ERR_print_errors_fp(stderr);
+    std::vector<uint8_t> hmacInput(buffer, buffer + posn);
+    uint16_t adjustedLength = posn - HEADER_LENGTH + StunAttribute::HEADER_LENGTH + StunAttribute::MESSAGE_INTEGRITY_ATTRIBUTE_HMAC_LENGTH;
+    hmacInput[2] = (adjustedLength >> 8) & 0xff;
+    hmacInput[3] = adjustedLength & 0xff;
 
-    // Initialise libsrtp.
-    srtp_init();
+    UINT hmacLength = StunAttribute::MESSAGE_INTEGRITY_ATTRIBUTE_HMAC_LENGTH;
+    uint8_t hmac[StunAttribute::MESSAGE_INTEGRITY_ATTRIBUTE_HMAC_LENGTH];
 
-    //------
-    // Set up single UDP socket that will do all send/receive with the browser.
-    //------
-    service.sin_family = AF_INET;
-    service.sin_addr.s_addr = INADDR_ANY;
-    service.sin_port = htons(RTP_LISTEN_PORT);
-
-    rtpSocket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
-    if (rtpSocket == INVALID_SOCKET) {
-      wprintf(L"socket function failed with error: %u\n", WSAGetLastError());
-      goto done;
-    }
-
-    iResult = bind(rtpSocket, (SOCKADDR*)&service, sizeof (service));
-    if (iResult == SOCKET_ERROR) {
-      wprintf(L"bind failed with error %u\n", WSAGetLastError());
-      closesocket(rtpSocket);
-      goto done;
-    }
+    HMAC(EVP_sha1(), icePwd, icePwdLen, hmacInput.data(), hmacInput.size(), hmac, &hmacLength);
 
-    printf("Waiting for browser connection...\n");
+    return CRYPTO_memcmp(hmac, buffer + posn + StunAttribute::HEADER_LENGTH, StunAttribute::MESSAGE_INTEGRITY_ATTRIBUTE_HMAC_LENGTH) == 0;
+  }
 
-    //------
-    // STUN
-    //------
-    int recvResult = recvfrom(rtpSocket, (char*)recvBuffer, RECEIVE_BUFFER_LENGTH, 0, (sockaddr*)&clientAddr, &clientAddrLen);
-    if (recvResult == SOCKET_ERROR) {
-      wprintf(L"recvfrom failed with error %d\n", WSAGetLastError());
-      throw std::runtime_error("Initial receive when waiting for STUN packet failed.");
+  /**
+  * Checks the FINGERPRINT attribute of a received message, which must be the last
+  * attribute.
+  * @param[in] buffer: the buffer the message was deserialised from.
+  * @param[in] bufferLength: the length of the message in the buffer.
+  * @@Returns true if the attribute is present and the CRC matches.
+  */
+  bool CheckFingerprint(const uint8_t* buffer, int bufferLength)
+  {
+    int posn = FindAttribute(buffer, bufferLength, StunAttributeTypes::FingerPrint);
+    if (posn < 0 || posn + StunAttribute::HEADER_LENGTH + StunAttribute::FINGERPRINT_ATTRIBUTE_CRC32_LENGTH != bufferLength) {
+      return false;
     }
-    else {
-      printf("Received %d bytes from %s:%d.\n", recvResult, inet_ntoa(clientAddr.sin_addr), ntohs(clientAddr.sin_port));
-      StunMessage stunMsg;
-      stunMsg.Deserialise(recvBuffer, recvResult);
 
-      printf("STUN message received, type %d, message length %d.\n", stunMsg.Type, stunMsg.Length);
+    uint32_t crc = crc32(0L, Z_NULL, 0);
+    crc = crc32(crc, (const unsigned char*)buffer, posn);
+    crc = crc ^ StunAttribute::FINGERPRINT_XOR;
 
-       // Send binding success response. This response will trigger the browser to start the DTLS handshake.
-      if (stunMsg.Type == (uint16_t)StunMessageTypes::BindingRequest) {
-        printf("Sending initial STUN binding response.\n");
-        SendStunBindingResponse(rtpSocket, stunMsg, clientAddr);
-      }
-    }
+    const uint8_t* crcBuffer = buffer + posn + StunAttribute::HEADER_LENGTH;
+    uint32_t receivedCrc = (crcBuffer[0] << 24) | (crcBuffer[1] << 16) | (crcBuffer[2] << 8) | crcBuffer[3];
 
-    //------
-    // DTLS
-    //------
-    ctx = SSL_CTX_new(DTLS_server_method());	// Copes with DTLS 1.0 and 1.2.
-    if (!ctx) {
-      printf("Error: cannot create SSL_CTX.\n");
-      goto done;
-    }
+    return crc == receivedCrc;
+  }
 
-    int r = SSL_CTX_set_cipher_list(ctx, "ALL:!ADH:!LOW:!EXP:!MD5:@STRENGTH");
-    if (r != 1) {
-      printf("Error: cannot set the cipher list.\n");
-      goto done;
-    }
+private:
 
-    /* enable srtp */
-    r = SSL_CTX_set_tlsext_use_srtp(ctx, "SRTP_AES128_CM_SHA1_80");
-    if (r != 0) {
-      printf("Error: cannot setup srtp.\n");
-      goto done;
-    }
+  /* Gets the offset of the first attribute of the specified type in a serialised message or -1 if not found. */
+  static int FindAttribute(const uint8_t* buffer, int bufferLength, StunAttributeTypes type)
+  {
+    int bufPosn = HEADER_LENGTH;
 
-    /* certificate file; contains also the public key */
-    r = SSL_CTX_use_certificate_file(ctx, DTLS_CERTIFICATE_FILE, SSL_FILETYPE_PEM);
-    if (r != 1) {
-      printf("Error: cannot load certificate file.\n");
-      goto done;
-    }
+    while (bufPosn + StunAttribute::HEADER_LENGTH <= bufferLength) {
+      uint16_t attType = ((buffer[bufPosn] << 8) & 0xff00) + buffer[bufPosn + 1];
+      uint16_t attLength = ((buffer[bufPosn + 2] << 8) & 0xff00) + buffer[bufPosn + 3];
 
-    /* load private key */
-    r = SSL_CTX_use_PrivateKey_file(ctx, DTLS_KEY_FILE, SSL_FILETYPE_PEM);
-    if (r != 1) {
-      printf("Error: cannot load private key file.\n");
-      goto done;
-    }
+      if (attType == (uint16_t)type) {
+        return bufPosn;
+      }
 
-    /* check if the private key is valid */
-    r = SSL_CTX_check_private_key(ctx);
-    if (r != 1) {
-      printf("Error: checking the private key failed.\n");
-      goto done;
+      bufPosn += StunAttribute::HEADER_LENGTH + attLength + ((attLength % 4 != 0) ? 4 - (attLength % 4) : 0);
     }
 
-    // Don't need to use a handshake cookie at this point. The DTLS 
-    // handshake does not get initiated until the ICE connection is done
-    // and that serves as the DoS protection.
-    //SSL_CTX_set_cookie_generate_cb(ctx, generate_cookie);
-    //SSL_CTX_set_cookie_verify_cb(ctx, verify_cookie);
-    SSL_CTX_set_ecdh_auto(ctx, 1);                        // Needed for FireFox DTLS negotiation.
-    SSL_CTX_set_verify(ctx, SSL_VERIFY_NONE, nullptr);    // The client doesn't have to send it's certificate.
+    return -1;
+  }
+};
 
-    // DTLS context now created. Accept new clients and do the handshake.
-    bio = BIO_new_dgram(rtpSocket, BIO_NOCLOSE);
-    if (!bio) {
-      printf("Error: BIO_new_dgram failed.\n");
-      goto done;
-    }
+/**
+* The parts of a browser's SDP offer needed to answer it. Only what this sample
+* sends is looked for: VP8, or VP9 profile 0, video, Opus audio and the audio level
+* header extension. The browser picks the payload types and extmap IDs and the
+* answer has to use them.
+*/
+class SdpOffer
+{
+public:
+  struct MediaSection
+  {
+    std::string Kind;                   // From the m-line, e.g. video or audio.
+    std::string Protocol;               // From the m-line, the answer has to use the same one, e.g. UDP/TLS/RTP/SAVPF.
+    std::string FirstFormat;            // Used in the m-line of the answer when the section is rejected.
+    std::string Mid;
+    uint8_t PayloadType = 0;            // The offer's payload type for the codec this sample sends, 0 if the section is rejected.
+    uint8_t AudioLevelExtensionID = 0;  // 0 if the offer doesn't have the audio level extension.
+  };
 
-    ssl = SSL_new(ctx);
-    if (!ssl) {
-      printf("Error: SSL_new failed.\n");
-      goto done;
-    }
+  std::string IceUsername;              // The browser's ufrag, the second half of the STUN USERNAME.
+  std::vector<MediaSection> MediaSections;
 
-    SSL_set_bio(ssl, bio, bio);
-    SSL_set_info_callback(ssl, krx_ssl_info_callback);    // info callback.
-    SSL_set_accept_state(ssl);
+  /**
+  * Parses an SDP offer. The first video section with the codec this sample sends,
+  * and the first audio section with Opus, are accepted. Any others are rejected.
+  * @param[in] sdp: the SDP offer from the browser.
+  * @@Returns true if the offer has ICE credentials and an accepted video section.
+  */
+  bool Parse(const std::string& sdp)
+  {
+    const char* videoCodec = (VIDEO_CODEC_VP9) ? "VP9/90000" : "VP8/90000";
+    const char* audioLevelUri = "urn:ietf:params:rtp-hdrext:ssrc-audio-level";
+
+    std::vector<std::string> formats;     // Payload types on the current m-line, in the browser's order of preference.
+    std::map<std::string, std::string> rtpmaps;
+    std::map<std::string, std::string> fmtps;
+    bool haveVideo = false, haveAudio = false;
+
+    // Picks the payload type for the section just finished, once all its attributes are known.
+    auto endSection = [&]() {
+      if (MediaSections.empty()) {
+        return;
+      }
 
-    //BIO_ADDR* clientBio = BIO_ADDR_new();
-    //DTLSv1_listen(ssl, clientBio);
-    //printf("New DTLS client connection.\n");
+      MediaSection& section = MediaSections.back();
+      bool isVideo = section.Kind == "video" && !haveVideo;
+      bool isAudio = section.Kind == "audio" && !haveAudio;
 
-    // Attempt to complete the DTLS handshake
-    // If successful, the DTLS link state is initialized internally
-    if (SSL_accept(ssl) <= 0) {
-      printf("Failed to complete SSL handshake.\n");
-      goto done;
-    }
-    else {
-      printf("DTLS Handshake completed.\n");
-    }
+      for (auto& format : formats) {
+        std::string codec = rtpmaps[format];
+        std::transform(codec.begin(), codec.end(), codec.begin(), ::toupper);
 
-    //------
-    // SRTP
-    //------
-    const char* label = "EXTRACTOR-dtls_srtp";
-
-    r = SSL_export_keying_material(ssl,
-      dtls_buffer,
-      sizeof(dtls_buffer),
-      label,
-      strlen(label),
-      NULL,
-      0,
-      0);
-    if (r != 1) {
-      printf("Error: exporting DTLS key material.\n");
-      goto done;
-    }
+        if ((isVideo && codec == videoCodec && (!VIDEO_CODEC_VP9 || fmtps[format].empty() || fmtps[format].find("profile-id=0") != std::string::npos)) ||
+          (isAudio && codec == "OPUS/48000/2")) {
+          section.PayloadType = (uint8_t)atoi(format.c_str());
+          break;
+        }
+      }
 
-    memcpy(&client_write_key[0], &dtls_buffer[keyMaterialOffset], SRTP_MASTER_KEY_KEY_LEN);
-    keyMaterialOffset += SRTP_MASTER_KEY_KEY_LEN;
-    memcpy(&server_write_key[0], &dtls_buffer[keyMaterialOffset], SRTP_MASTER_KEY_KEY_LEN);
-    keyMaterialOffset += SRTP_MASTER_KEY_KEY_LEN;
-    memcpy(&client_write_key[SRTP_MASTER_KEY_KEY_LEN], &dtls_buffer[keyMaterialOffset], SRTP_MASTER_KEY_SALT_LEN);
-    keyMaterialOffset += SRTP_MASTER_KEY_SALT_LEN;
-    memcpy(&server_write_key[SRTP_MASTER_KEY_KEY_LEN], &dtls_buffer[keyMaterialOffset], SRTP_MASTER_KEY_SALT_LEN);
+      if (section.Mid.empty()) {
+        section.PayloadType = 0;          // Can't be bundled without a mid.
+      }
 
-    srtp_policy_t* srtpPolicy = new srtp_policy_t();
-    srtp_t* srtpSession = new srtp_t();
+      haveVideo |= isVideo && section.PayloadType != 0;
+      haveAudio |= isAudio && section.PayloadType != 0;
+    };
 
-    srtp_crypto_policy_set_rtp_default(&srtpPolicy->rtp);
-    srtp_crypto_policy_set_rtcp_default(&srtpPolicy->rtcp);
-
-    /* Init transmit direction */
-    srtpPolicy->key = server_write_key;
-
-    srtpPolicy->ssrc.value = 0;
-    srtpPolicy->window_size = 128;
-    srtpPolicy->allow_repeat_tx = 0;
-    srtpPolicy->ssrc.type = ssrc_any_outbound;
-    srtpPolicy->next = NULL;
-
-    auto err = srtp_create(srtpSession, srtpPolicy);
-    if (err != srtp_err_status_ok) {
-      printf("Unable to create SRTP session.\n");
-      goto done;
-    }
-    else {
-      printf("SRTP session created.\n");
-    }
-
-    // Need to keep responding to STUN binding requests or the connection will be flagged as disconnected.
-    std::thread listenThread(RtpSocketListen, rtpSocket);
-
-    // The connection with the browser should now be negotiated.
-    // Webcam sample streaming can commence.
-    StreamWebcam(rtpSocket, clientAddr, srtpSession);
+    size_t posn = 0;
+    while (posn < sdp.size()) {
+      size_t lineEnd = sdp.find('\n', posn);
+      if (lineEnd == std::string::npos) {
+        lineEnd = sdp.size();
+      }
 
-    delete(srtpSession);
-    delete(srtpPolicy);
-  }
-  catch (std::exception & excp) {
-    std::cout << "Exception: " << excp.what() << std::endl;
-  }
+      std::string line = sdp.substr(posn, lineEnd - posn);
+      if (!line.empty() && line.back() == '\r') {
+        line.pop_back();
+      }
+      posn = lineEnd + 1;
 
-done:
+      if (line.compare(0, 2, "m=") == 0) {
+        endSection();
 
-  ERR_print_errors_fp(stderr);
+        // m=<media> <port> <proto> <fmt> ...
+        MediaSection section;
+        std::istringstream fields(line.substr(2));
+        std::string port, format;
+        fields >> section.Kind >> port >> section.Protocol;
 
-  printf("Cleanup.\n");
+        formats.clear();
+        while (fields >> format) {
+          formats.push_back(format);
+        }
+        section.FirstFormat = (formats.empty()) ? "0" : formats.front();
 
-  // OpenSSL cleanup.
-  if (ctx != nullptr) {
-    SSL_CTX_free(ctx);
-  }
+        rtpmaps.clear();
+        fmtps.clear();
+        MediaSections.push_back(section);
+      }
+      else if (line.compare(0, 12, "a=ice-ufrag:") == 0) {
+        if (IceUsername.empty()) {
+          IceUsername = line.substr(12);
+        }
+      }
+      else if (MediaSections.empty()) {
+        continue;
+      }
+      else if (line.compare(0, 6, "a=mid:") == 0) {
+        MediaSections.back().Mid = line.substr(6);
+      }
+      else if (line.compare(0, 9, "a=rtpmap:") == 0 || line.compare(0, 7, "a=fmtp:") == 0) {
+        // a=rtpmap:<payload type> <encoding name>/<clock rate>[/<channels>] and a=fmtp:<payload type> <parameters>
+        size_t colon = line.find(':');
+        size_t space = line.find(' ', colon);
+        if (space != std::string::npos) {
+          auto& values = (line[2] == 'r') ? rtpmaps : fmtps;
+          values[line.substr(colon + 1, space - colon - 1)] = line.substr(space + 1);
+        }
+      }
+      else if (line.compare(0, 9, "a=extmap:") == 0) {
+        // a=extmap:<id>[/<direction>] <uri>, only one byte header IDs can be used.
+        size_t space = line.find(' ');
+        int id = atoi(line.c_str() + 9);
+        if (space != std::string::npos && line.compare(space + 1, std::string::npos, audioLevelUri) == 0 && id >= 1 && id <= 14) {
+          MediaSections.back().AudioLevelExtensionID = (uint8_t)id;
+        }
+      }
+    }
 
-  if (ssl != nullptr) {
-    SSL_shutdown(ssl);
-    SSL_free(ssl);
+    endSection();
+
+    return !IceUsername.empty() && haveVideo;
   }
+};
 
-  ERR_remove_state(0);
-  //ENGINE_cleanup();
-  //CONF_modules_unload(1);
-  ERR_free_strings();
-  EVP_cleanup();
-  sk_SSL_COMP_free(SSL_COMP_get_compression_methods());
-  CRYPTO_cleanup_all_ex_data();
+/* Lifecycle of a browser connection. */
+enum class SessionState
+{
+  AwaitingIce,      // SDP answer sent, waiting for the browser to nominate a candidate pair.
+  IceConnected,     // Candidate pair nominated with USE-CANDIDATE, waiting for the DTLS ClientHello.
+  DtlsHandshaking,  // DTLS records are being exchanged.
+  SrtpReady,        // DTLS handshake complete and SRTP keys derived, media can be sent.
+  Closed,           // DTLS close, failure or timeout. The session will be removed.
+};
 
-  // Winsock cleanup
-  closesocket(rtpSocket);
-  WSACleanup();
+/**
+* Gets a monotonic millisecond timestamp for measuring and scheduling session events.
+*/
+int64_t SteadyClockMilliseconds()
+{
+  return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
 }
 
-void SendStunBindingResponse(SOCKET rtpSocket, StunMessage & bindingRequest, sockaddr_in client)
+/**
+* Gets the current wall clock time as a 64 bit NTP timestamp for RTCP sender reports.
+*/
+uint64_t GetNtpTimestamp()
 {
-  StunMessage stunBindingResp(StunMessageTypes::BindingSuccessResponse);
-  std::copy(bindingRequest.TransactionID, bindingRequest.TransactionID + StunMessage::TRANSACTION_ID_LENGTH, stunBindingResp.TransactionID);
-
-  // Add required attributes.
-  stunBindingResp.AddXorMappedAttribute(client.sin_family, ntohs(client.sin_port), ntohl(client.sin_addr.s_addr), StunMessage::MAGIC_COOKIE_BYTES);
-  stunBindingResp.AddHmacAttribute(ICE_PASSWORD, ICE_PASSWORD_LENGTH);
-  stunBindingResp.AddFingerprintAttribute();
-
-  uint8_t* respBuffer = nullptr;
-  int respBufferLength = stunBindingResp.Serialise(&respBuffer);
-
-  //printf("Sending STUN response packet, length %d.\n", respBufferLength);
-
-  sendto(rtpSocket, (const char*)respBuffer, respBufferLength, 0, (sockaddr*)&client, sizeof(client));
+  const uint64_t ntpEpochOffsetSeconds = 2208988800ULL;   // 1900 to 1970.
+
+  int64_t microseconds = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+  uint64_t seconds = microseconds / 1000000 + ntpEpochOffsetSeconds;
+  uint64_t fraction = ((uint64_t)(microseconds % 1000000) << 32) / 1000000;
+
+  return seconds << 32 | fraction;
+}
+
+/**
+* Pairs the RTP timestamp of the most recently captured sample of a stream with
+* the time it was captured so RTCP sender reports can map the moment they are
+* sent onto the stream's RTP timeline. The audio and video are captured on
+* separate threads with their own RTP clocks and this is what relates them.
+*/
+class RtpTimestampClock
+{
+public:
+  RtpTimestampClock(uint32_t clockRate) :
+    _clockRate(clockRate)
+  {}
+
+  /* Called by the media thread for each captured sample. */
+  void Set(uint32_t rtpTimestamp, int64_t capturedAt)
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _rtpTimestamp = rtpTimestamp;
+    _capturedAt = capturedAt;
+  }
+
+  /**
+  * Gets the RTP timestamp for a point in time by extrapolating from the last
+  * captured sample.
+  * @param[in] at: the time to get the RTP timestamp for from SteadyClockMilliseconds.
+  * @param[out] pRtpTimestamp: the RTP timestamp for the time.
+  * @@Returns false if no sample has been captured yet.
+  */
+  bool GetTimestamp(int64_t at, uint32_t* pRtpTimestamp)
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_capturedAt == 0) {
+      return false;
+    }
+
+    *pRtpTimestamp = _rtpTimestamp + (uint32_t)((at - _capturedAt) * _clockRate / 1000);
+    return true;
+  }
+
+private:
+  std::mutex _mutex;
+  uint32_t _clockRate;
+  uint32_t _rtpTimestamp = 0;
+  int64_t _capturedAt = 0;
+};
+
+/* Counts of what has been sent on one RTP stream to a session, for its RTCP sender reports. */
+struct RtpSenderStats
+{
+  uint32_t PacketCount = 0;
+  uint32_t OctetCount = 0;        // Payload octets, not including the RTP header or SRTP authentication tag.
+};
+
+/**
+* Per client connection state. A session is created by an HTTP signaling worker
+* when the browser's SDP offer is answered, with its own ICE credentials, and gets
+* its remote end point from the candidate pair the browser nominates with a STUN
+* binding request that authenticates with them. The DTLS connection is attached to memory BIOs rather than the socket so
+* that the demultiplexer remains the only reader of the socket and the handshake
+* can be progressed on any of the worker threads.
+*/
+class WebRtcSession
+{
+public:
+  std::string IceUsername;          // Our ufrag from the SDP answer, the first half of the STUN USERNAME.
+  std::string IcePassword;          // Keys the MESSAGE-INTEGRITY of the STUN binding requests and responses.
+  std::string RemoteIceUsername;    // The browser's ufrag from the SDP offer.
+  sockaddr_in RemoteEndPoint;       // The nominated pair's, set by the session table. Read with GetRemoteEndPoint, it changes if the browser nominates another pair.
+  std::mutex EndPointLock;          // Protects RemoteEndPoint, which the media threads send to.
+  std::vector<sockaddr_in> ValidEndPoints;    // Remote end points of the pairs whose checks have passed. Only accessed by the event loop.
+  uint8_t VideoPayloadType = 0;     // The payload types and audio level extmap ID from the browser's offer.
+  uint8_t AudioPayloadType = 0;     // 0 if the offer didn't have Opus.
+  uint8_t AudioLevelExtensionID = 0;
+  std::atomic<SessionState> State = SessionState::AwaitingIce;
+  SSL* Ssl = nullptr;
+  BIO* ReadBio = nullptr;           // Received DTLS records are written here for OpenSSL to consume.
+  BIO* WriteBio = nullptr;          // DTLS records generated by OpenSSL are read from here and sent on the socket.
+  srtp_t SrtpSession = nullptr;
+  srtp_t SrtpReceiveSession = nullptr;  // Decrypts the RTCP from the browser. Only accessed by the event loop once the session is ready.
+  uint16_t RtpSeqNum = 0;           // Only accessed by the video media thread.
+  uint16_t AudioRtpSeqNum = 0;      // Only accessed by the audio media thread.
+
+  std::mutex SslLock;               // Serialises use of the SSL object between worker threads.
+  std::mutex SrtpLock;              // Serialises use of the SRTP context, and the stats, between the audio and video threads and the RTCP timer.
+  RtpSenderStats VideoStats;
+  RtpSenderStats AudioStats;
+  std::mutex PendingLock;           // Protects the queue of received DTLS records.
+  std::deque<std::vector<uint8_t>> PendingRecords;
+  std::atomic<bool> StepQueued = false;       // Stops the same session being queued on the worker pool more than once.
+  std::atomic<int64_t> RetransmitDueAt = 0;   // When the DTLS retransmit timer expires, 0 if not running.
+  int64_t ConsentExpiresAt = 0;               // Extended by each authenticated STUN binding request. Only accessed by the event loop.
+  uint8_t MaxTemporalLayer = SESSION_MAX_TEMPORAL_LAYER;  // Frames from higher temporal layers aren't sent to this session.
+  uint8_t MaxSpatialLayer = SESSION_MAX_SPATIAL_LAYER;    // VP9 layer frames from higher spatial layers aren't sent to this session.
+  std::atomic<uint32_t> RembBitrate = 0;      // The browser's latest bandwidth estimate in bits per second, 0 until it sends one.
+
+  // Setup phase timestamps, see PrintSetupTimes.
+  int64_t CreatedAt = 0;                      // SDP offer received.
+  int64_t IceConnectedAt = 0;                 // First nomination of a candidate pair. Only accessed by the event loop.
+  int64_t HandshakeStartedAt = 0;             // First DTLS record, the ClientHello.
+  int64_t HandshakeCompletedAt = 0;
+  int64_t SrtpReadyAt = 0;                    // SRTP keys exported and the SRTP context created.
+  int64_t FirstRtpAt = 0;                     // First RTP packet sent, always a keyframe. Only accessed by the media thread.
+
+  WebRtcSession(const std::string& iceUsername, const std::string& icePassword, const SdpOffer& offer, SSL_CTX* sslCtx)
+  {
+    IceUsername = iceUsername;
+    IcePassword = icePassword;
+    RemoteIceUsername = offer.IceUsername;
+    memset(&RemoteEndPoint, 0, sizeof(RemoteEndPoint));
+    CreatedAt = SteadyClockMilliseconds();
+
+    for (auto& section : offer.MediaSections) {
+      if (section.Kind == "video" && section.PayloadType != 0) {
+        VideoPayloadType = section.PayloadType;
+      }
+      else if (section.Kind == "audio" && section.PayloadType != 0) {
+        AudioPayloadType = section.PayloadType;
+        AudioLevelExtensionID = section.AudioLevelExtensionID;
+      }
+    }
+
+    Ssl = SSL_new(sslCtx);
+    if (!Ssl) {
+      throw std::runtime_error("SSL_new failed for new session.");
+    }
+
+    ReadBio = BIO_new(BIO_s_mem());
+    WriteBio = BIO_new(BIO_s_mem());
+    if (!ReadBio || !WriteBio) {
+      // The destructor doesn't run for a constructor that throws.
+      BIO_free(ReadBio);
+      BIO_free(WriteBio);
+      SSL_free(Ssl);
+      Ssl = nullptr;
+      throw std::runtime_error("Failed to create DTLS memory BIOs for new session.");
+    }
+
+    // An empty memory BIO needs to signal "retry" rather than EOF so the handshake waits for the next record.
+    BIO_set_mem_eof_return(ReadBio, -1);
+    BIO_set_mem_eof_return(WriteBio, -1);
+
+    SSL_set_bio(Ssl, ReadBio, WriteBio);          // The SSL object now owns the BIOs.
+    DTLS_set_link_mtu(Ssl, DTLS_MTU);
+    //SSL_set_info_callback(Ssl, krx_ssl_info_callback);    // Useful when debugging a single client.
+    SSL_set_accept_state(Ssl);
+  }
+
+  ~WebRtcSession()
+  {
+    if (SrtpSession != nullptr) {
+      srtp_dealloc(SrtpSession);
+    }
+
+    if (SrtpReceiveSession != nullptr) {
+      srtp_dealloc(SrtpReceiveSession);
+    }
+
+    if (Ssl != nullptr) {
+      SSL_free(Ssl);
+    }
+  }
+
+  /* Gets the remote end point of the nominated candidate pair, all zeros until there is one. */
+  sockaddr_in GetRemoteEndPoint()
+  {
+    std::lock_guard<std::mutex> lock(EndPointLock);
+    return RemoteEndPoint;
+  }
+
+  /**
+  * Prints how long each phase of the connection setup took. The answer to ICE phase
+  * includes the browser applying the SDP answer.
+  */
+  void PrintSetupTimes()
+  {
+    sockaddr_in remoteEndPoint = GetRemoteEndPoint();
+    printf("Session %s:%d setup: answer to ICE %lldms, ICE to ClientHello %lldms, DTLS %lldms, SRTP key export %lldms, first keyframe RTP %lldms, total %lldms.\n",
+      inet_ntoa(remoteEndPoint.sin_addr), ntohs(remoteEndPoint.sin_port),
+      IceConnectedAt - CreatedAt,
+      HandshakeStartedAt - IceConnectedAt,
+      HandshakeCompletedAt - HandshakeStartedAt,
+      SrtpReadyAt - HandshakeCompletedAt,
+      FirstRtpAt - SrtpReadyAt,
+      FirstRtpAt - CreatedAt);
+  }
+};
+
+/**
+* Thread safe table of the client sessions keyed by the ICE ufrag given to the
+* browser in the SDP answer. Sessions are also indexed by the remote end point of
+* the candidate pair the browser nominated, which is how DTLS records and RTCP
+* are matched to them.
+*/
+class SessionTable
+{
+public:
+  /* Finds the session whose nominated candidate pair has a remote end point. */
+  std::shared_ptr<WebRtcSession> Find(const sockaddr_in& remoteEndPoint)
+  {
+    std::lock_guard<std::mutex> lock(_lock);
+    auto it = _endPoints.find(GetKey(remoteEndPoint));
+    return (it != _endPoints.end()) ? it->second : nullptr;
+  }
+
+  /* Finds a session by our ICE ufrag, the first half of the STUN USERNAME. */
+  std::shared_ptr<WebRtcSession> FindByIceUsername(const std::string& iceUsername)
+  {
+    std::lock_guard<std::mutex> lock(_lock);
+    auto it = _sessions.find(iceUsername);
+    return (it != _sessions.end()) ? it->second : nullptr;
+  }
+
+  /* Creates a session for an SDP offer, returns null if the ICE ufrag is already in use. */
+  std::shared_ptr<WebRtcSession> Create(const std::string& iceUsername, const std::string& icePassword, const SdpOffer& offer, SSL_CTX* sslCtx)
+  {
+    auto session = std::make_shared<WebRtcSession>(iceUsername, icePassword, offer, sslCtx);
+    std::lock_guard<std::mutex> lock(_lock);
+    if (!_sessions.emplace(iceUsername, session).second) {
+      return nullptr;
+    }
+    printf("New session %s, session count %zu.\n", iceUsername.c_str(), _sessions.size());
+    return session;
+  }
+
+  /* Sets the remote end point of a session and indexes it, replacing the end point of a previously nominated pair. */
+  void Bind(std::shared_ptr<WebRtcSession> session, const sockaddr_in& remoteEndPoint)
+  {
+    std::lock_guard<std::mutex> lock(_lock);
+    std::lock_guard<std::mutex> endPointLock(session->EndPointLock);
+
+    auto previousIt = _endPoints.find(GetKey(session->RemoteEndPoint));
+    if (previousIt != _endPoints.end() && previousIt->second == session) {
+      _endPoints.erase(previousIt);
+    }
+
+    session->RemoteEndPoint = remoteEndPoint;
+    _endPoints[GetKey(remoteEndPoint)] = session;
+  }
+
+  /* Removes the session from the table, and its end point if it's still the session bound to it. */
+  void Remove(std::shared_ptr<WebRtcSession> session)
+  {
+    std::lock_guard<std::mutex> lock(_lock);
+    auto it = _sessions.find(session->IceUsername);
+    if (it != _sessions.end() && it->second == session) {
+      _sessions.erase(it);
+    }
+
+    auto endPointIt = _endPoints.find(GetKey(session->GetRemoteEndPoint()));
+    if (endPointIt != _endPoints.end() && endPointIt->second == session) {
+      _endPoints.erase(endPointIt);
+    }
+  }
+
+  std::vector<std::shared_ptr<WebRtcSession>> GetAll()
+  {
+    std::vector<std::shared_ptr<WebRtcSession>> all;
+    std::lock_guard<std::mutex> lock(_lock);
+    for (auto& entry : _sessions) {
+      all.push_back(entry.second);
+    }
+    return all;
+  }
+
+  /* Gets the sessions that have completed the DTLS handshake and can be sent media. */
+  std::vector<std::shared_ptr<WebRtcSession>> GetReady()
+  {
+    std::vector<std::shared_ptr<WebRtcSession>> ready;
+    std::lock_guard<std::mutex> lock(_lock);
+    for (auto& entry : _sessions) {
+      if (entry.second->State == SessionState::SrtpReady) {
+        ready.push_back(entry.second);
+      }
+    }
+    return ready;
+  }
+
+private:
+  std::mutex _lock;
+  std::map<std::string, std::shared_ptr<WebRtcSession>> _sessions;
+  std::map<uint64_t, std::shared_ptr<WebRtcSession>> _endPoints;
+
+  static uint64_t GetKey(const sockaddr_in& remoteEndPoint)
+  {
+    return ((uint64_t)remoteEndPoint.sin_addr.s_addr << 16) | remoteEndPoint.sin_port;
+  }
+};
+
+/**
+* Small fixed size thread pool used to progress DTLS handshakes. The handshake
+* crypto is the expensive part of setting up a new connection and running it
+* here keeps the socket demultiplexer, and the sessions it's already serving,
+* responsive while a burst of new clients connect.
+*/
+class WorkerPool
+{
+public:
+  WorkerPool(int threadCount)
+  {
+    for (int i = 0; i < threadCount; i++) {
+      _threads.push_back(std::thread(&WorkerPool::Run, this));
+    }
+  }
+
+  ~WorkerPool()
+  {
+    {
+      std::lock_guard<std::mutex> lock(_lock);
+      _exit = true;
+    }
+    _signal.notify_all();
+
+    for (auto& t : _threads) {
+      t.join();
+    }
+  }
+
+  void Queue(std::function<void()> task)
+  {
+    {
+      std::lock_guard<std::mutex> lock(_lock);
+      _tasks.push_back(task);
+    }
+    _signal.notify_one();
+  }
+
+private:
+  std::vector<std::thread> _threads;
+  std::deque<std::function<void()>> _tasks;
+  std::mutex _lock;
+  std::condition_variable _signal;
+  bool _exit = false;
+
+  void Run()
+  {
+    while (true) {
+      std::function<void()> task;
+      {
+        std::unique_lock<std::mutex> lock(_lock);
+        _signal.wait(lock, [this] { return _exit || !_tasks.empty(); });
+        if (_tasks.empty()) {
+          return;
+        }
+        task = _tasks.front();
+        _tasks.pop_front();
+      }
+      task();
+    }
+  }
+};
+
+/**
+* Collects DTLS handshake durations, measured from the first ClientHello to the
+* SRTP keys being available, so the impact of many clients joining at once can
+* be observed.
+*/
+class HandshakeStats
+{
+public:
+  void Add(double durationMilliseconds)
+  {
+    std::lock_guard<std::mutex> lock(_lock);
+    _durations.push_back(durationMilliseconds);
+  }
+
+  size_t Count()
+  {
+    std::lock_guard<std::mutex> lock(_lock);
+    return _durations.size();
+  }
+
+  /* Nearest rank percentile, e.g. 50 or 99. */
+  double Percentile(double percentile)
+  {
+    std::vector<double> sorted;
+    {
+      std::lock_guard<std::mutex> lock(_lock);
+      sorted = _durations;
+    }
+
+    if (sorted.empty()) {
+      return 0;
+    }
+
+    std::sort(sorted.begin(), sorted.end());
+    size_t rank = (size_t)std::ceil(percentile / 100.0 * sorted.size());
+    return sorted[(rank > 0) ? rank - 1 : 0];
+  }
+
+private:
+  std::mutex _lock;
+  std::vector<double> _durations;
+};
+
+/**
+* Min-heap of timers for the event loop. Timers can be added from any thread,
+* e.g. the DTLS workers arming a retransmit, but their callbacks only ever run
+* on the event loop thread.
+*/
+class TimerQueue
+{
+public:
+  void Add(int64_t dueAt, std::function<void()> callback)
+  {
+    std::lock_guard<std::mutex> lock(_lock);
+    _timers.push(Timer{ dueAt, _sequence++, callback });
+  }
+
+  /* Gets the time the earliest timer is due or INT64_MAX if there are none. */
+  int64_t NextDueAt()
+  {
+    std::lock_guard<std::mutex> lock(_lock);
+    return (_timers.empty()) ? INT64_MAX : _timers.top().DueAt;
+  }
+
+  /* Runs the callbacks for all the timers due at or before now, earliest first. */
+  void RunExpired(int64_t now)
+  {
+    while (true) {
+      std::function<void()> callback;
+      {
+        std::lock_guard<std::mutex> lock(_lock);
+        if (_timers.empty() || _timers.top().DueAt > now) {
+          break;
+        }
+        callback = _timers.top().Callback;
+        _timers.pop();
+      }
+      callback();
+    }
+  }
+
+private:
+  struct Timer
+  {
+    int64_t DueAt;
+    uint64_t Sequence;        // Keeps timers due at the same time in the order they were added.
+    std::function<void()> Callback;
+
+    bool operator>(const Timer& other) const
+    {
+      return (DueAt != other.DueAt) ? DueAt > other.DueAt : Sequence > other.Sequence;
+    }
+  };
+
+  std::mutex _lock;
+  uint64_t _sequence = 0;
+  std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>> _timers;
+};
+
+/*
+
+From RFC5764:
+                   +----------------+
+                   | 127 < B < 192 -+--> forward to RTP
+                   |                |
+       packet -->  |  19 < B < 64  -+--> forward to DTLS
+                   |                |
+                   |       B < 2   -+--> forward to STUN
+                   +----------------+
+
+ICE-lite agent (RFC8445 section 2.5) for the UDP socket. It never sends connectivity
+checks, it only answers the browser's, which must carry a USERNAME made up of the
+ufrags from a session's SDP answer and offer, a valid MESSAGE-INTEGRITY keyed with the
+session's ICE password and a FINGERPRINT. The browser is the controlling agent and
+checks every candidate pair, each one that passes is answered and recorded as valid.
+The session is bound to a pair when the browser nominates it with USE-CANDIDATE, and
+moves to another pair, along with its DTLS, RTP and RTCP, if the browser nominates
+that one later, e.g. after a network change.
+
+Consent freshness (RFC7675) is driven by the checks on the nominated pair. Browsers
+keep sending them every few seconds for as long as they want the media, so each
+authenticated request on it extends the session's consent by ICE_CONSENT_TIMEOUT_MS. When consent
+expires the session is torn down: it's removed from the session table, which stops
+the media thread encoding and sending for it, a DTLS close_notify is sent and the
+SSL and SRTP contexts are freed when the last reference to the session is released.
+
+Everything, socket reads, consent, handshake timeouts and DTLS retransmits, runs
+on a single event loop thread driven by a timer queue. Only the DTLS handshake
+crypto is handed off to the worker pool.
+*/
+class IceLiteAgent
+{
+public:
+  IceLiteAgent(SOCKET rtpSocket, SSL_CTX* sslCtx, SessionTable& sessions, RtpTimestampClock& videoClock, RtpTimestampClock& audioClock) :
+    _rtpSocket(rtpSocket),
+    _sslCtx(sslCtx),
+    _sessions(sessions),
+    _videoClock(videoClock),
+    _audioClock(audioClock),
+    _dtlsWorkers(DTLS_WORKER_THREAD_COUNT)
+  {}
+
+  /**
+  * Creates the session for a browser's SDP offer with its own random ICE credentials.
+  * Called by the HTTP signaling workers. The session's timers start now so a session
+  * that never gets a connectivity check is removed by the DTLS handshake timeout.
+  * @param[in] offer: the browser's SDP offer.
+  * @@Returns The new session. Throws if the session's DTLS context can't be allocated.
+  */
+  std::shared_ptr<WebRtcSession> CreateSession(const SdpOffer& offer)
+  {
+    // Null means the random ufrag collided with an existing session's and a new one is tried,
+    // an allocation failure throws out of the loop.
+    std::shared_ptr<WebRtcSession> session;
+    while (session == nullptr) {
+      session = _sessions.Create(GetRandomIceString(ICE_USERNAME_LENGTH), GetRandomIceString(ICE_PASSWORD_LENGTH), offer, _sslCtx);
+    }
+
+    std::weak_ptr<WebRtcSession> weakSession = session;
+    _timers.Add(session->CreatedAt + DTLS_HANDSHAKE_TIMEOUT_MS, [this, weakSession]() { OnHandshakeTimer(weakSession); });
+    _timers.Add(session->CreatedAt + ICE_CONSENT_TIMEOUT_MS, [this, weakSession]() { OnConsentTimer(weakSession); });
+
+    return session;
+  }
+
+  /**
+  * Closes a session at the request of the signaling channel. The teardown is done
+  * on the event loop.
+  * @param[in] iceUsername: the ICE ufrag from the session's SDP answer.
+  * @@Returns false if there's no session with the ufrag.
+  */
+  bool CloseSession(const std::string& iceUsername)
+  {
+    auto session = _sessions.FindByIceUsername(iceUsername);
+    if (session == nullptr) {
+      return false;
+    }
+
+    _timers.Add(0, [this, session]() {
+      if (session->State != SessionState::Closed) {
+        TeardownSession(session, "closed by signaling");
+      }
+    });
+    return true;
+  }
+
+  void Run(std::atomic<bool>& exit)
+  {
+    unsigned char recvBuffer[RECEIVE_BUFFER_LENGTH];
+    sockaddr_in clientAddr;
+    int clientAddrLen = sizeof(clientAddr);
+
+    printf("ICE-lite event loop started.\n");
+
+    while (!exit) {
+      // Sleep until the next timer is due. The wait is capped so timers armed by the DTLS
+      // workers and the exit flag are noticed promptly.
+      int64_t waitMilliseconds = std::max<int64_t>(_timers.NextDueAt() - SteadyClockMilliseconds(), 0);
+      waitMilliseconds = std::min<int64_t>(waitMilliseconds, EVENT_LOOP_MAX_WAIT_MS);
+
+      fd_set readSet;
+      FD_ZERO(&readSet);
+      FD_SET(_rtpSocket, &readSet);
+      timeval waitTimeout = { 0, (long)(waitMilliseconds * 1000) };
+
+      int selectResult = select(0, &readSet, nullptr, nullptr, &waitTimeout);
+      if (selectResult == SOCKET_ERROR) {
+        wprintf(L"select failed with error %d\n", WSAGetLastError());
+        break;
+      }
+      else if (selectResult > 0) {
+        clientAddrLen = sizeof(clientAddr);
+        int recvResult = recvfrom(_rtpSocket, (char*)recvBuffer, RECEIVE_BUFFER_LENGTH, 0, (sockaddr*)&clientAddr, &clientAddrLen);
+        if (recvResult == SOCKET_ERROR) {
+          wprintf(L"recvfrom failed with error %d\n", WSAGetLastError());
+        }
+        else if (recvResult > 0) {
+          //printf("Received %d bytes from %s:%d.\n", recvResult, inet_ntoa(clientAddr.sin_addr), ntohs(clientAddr.sin_port));
+
+          // See section 5.1.2 RFC5764.
+          if (recvBuffer[0] == 0x00 || recvBuffer[0] == 0x01) {
+            // STUN packet.
+            try {
+              StunMessage stunMsg;
+              stunMsg.Deserialise(recvBuffer, recvResult);
+
+              if (stunMsg.Type == (uint16_t)StunMessageTypes::BindingRequest) {
+                OnBindingRequest(stunMsg, recvBuffer, recvResult, clientAddr);
+              }
+            }
+            catch (std::exception& excp) {
+              printf("Failed to process STUN packet from %s:%d. %s\n", inet_ntoa(clientAddr.sin_addr), ntohs(clientAddr.sin_port), excp.what());
+            }
+          }
+          else if (recvBuffer[0] >= 128 && recvBuffer[0] <= 191) {
+            // RTP/RTCP packet. Nothing but RTCP is expected as the streams are send only, the payload type tells
+            // them apart (RFC5761 section 4).
+            //printf("RTP or RTCP packet received.\n");
+            if (recvBuffer[1] >= 192 && recvBuffer[1] <= 223) {
+              OnRtcpPacket(recvBuffer, recvResult, clientAddr);
+            }
+          }
+          else if (recvBuffer[0] >= 20 && recvBuffer[0] <= 63) {
+            OnDtlsRecord(recvBuffer, recvResult, clientAddr);
+          }
+          else {
+            printf("Unknown packet type received.\n");
+          }
+        }
+      }
+
+      _timers.RunExpired(SteadyClockMilliseconds());
+    }
+
+    printf("ICE-lite event loop stopped.\n");
+  }
+
+private:
+  SOCKET _rtpSocket;
+  SSL_CTX* _sslCtx;
+  SessionTable& _sessions;
+  RtpTimestampClock& _videoClock;
+  RtpTimestampClock& _audioClock;
+  HandshakeStats _handshakeStats;
+  TimerQueue _timers;
+  WorkerPool _dtlsWorkers;      // Declared last so the workers are joined before anything they use is destroyed.
+
+  /**
+  * Answers an ICE connectivity check. The USERNAME is our ufrag followed by the
+  * browser's, separated by a colon, and identifies the session. Checks that fail
+  * authentication are dropped. Checks that pass are answered on every pair, and a
+  * check with USE-CANDIDATE selects its pair for the session's media.
+  */
+  void OnBindingRequest(StunMessage& bindingRequest, const uint8_t* buffer, int bufferLength, const sockaddr_in& client)
+  {
+    const char* rejectReason = nullptr;
+    std::string username = bindingRequest.GetUsername();
+    size_t colonPosn = username.find(':');
+    auto session = (colonPosn != std::string::npos) ? _sessions.FindByIceUsername(username.substr(0, colonPosn)) : nullptr;
+
+    if (!bindingRequest.CheckFingerprint(buffer, bufferLength)) {
+      rejectReason = "missing or invalid FINGERPRINT";
+    }
+    else if (session == nullptr || username.compare(colonPosn + 1, std::string::npos, session->RemoteIceUsername) != 0) {
+      rejectReason = "unknown USERNAME";
+    }
+    else if (!bindingRequest.CheckMessageIntegrity(buffer, bufferLength, session->IcePassword.c_str(), (int)session->IcePassword.size())) {
+      rejectReason = "missing or invalid MESSAGE-INTEGRITY";
+    }
+    else if (session->State == SessionState::Closed) {
+      rejectReason = "session closed";
+    }
+
+    if (rejectReason != nullptr) {
+      printf("STUN binding request from %s:%d rejected, %s.\n", inet_ntoa(client.sin_addr), ntohs(client.sin_port), rejectReason);
+      return;
+    }
+
+    auto validIt = std::find_if(session->ValidEndPoints.begin(), session->ValidEndPoints.end(),
+      [&](const sockaddr_in& endPoint) { return IsSameEndPoint(endPoint, client); });
+    if (validIt == session->ValidEndPoints.end()) {
+      session->ValidEndPoints.push_back(client);
+      printf("Session %s candidate pair with %s:%d valid.\n", session->IceUsername.c_str(), inet_ntoa(client.sin_addr), ntohs(client.sin_port));
+    }
+
+    bool isSelected = session->IceConnectedAt != 0 && IsSameEndPoint(session->GetRemoteEndPoint(), client);
+
+    if (!isSelected && bindingRequest.HasAttribute(StunAttributeTypes::UseCandidate)) {
+      _sessions.Bind(session, client);
+      isSelected = true;
+
+      if (session->IceConnectedAt == 0) {
+        session->IceConnectedAt = SteadyClockMilliseconds();
+
+        SessionState awaitingIce = SessionState::AwaitingIce;
+        session->State.compare_exchange_strong(awaitingIce, SessionState::IceConnected);
+
+        printf("Session %s ICE connected, nominated %s:%d.\n", session->IceUsername.c_str(), inet_ntoa(client.sin_addr), ntohs(client.sin_port));
+      }
+      else {
+        printf("Session %s nominated %s:%d, the media moves to it.\n", session->IceUsername.c_str(), inet_ntoa(client.sin_addr), ntohs(client.sin_port));
+      }
+    }
+
+    // Consent is for the pair the media is sent on, checks on the others don't extend it.
+    if (isSelected) {
+      session->ConsentExpiresAt = SteadyClockMilliseconds() + ICE_CONSENT_TIMEOUT_MS;
+    }
+
+    // The response on the nominated pair will trigger the browser to start the DTLS handshake.
+    SendStunBindingResponse(_rtpSocket, bindingRequest, client, session->IcePassword);
+  }
+
+  static bool IsSameEndPoint(const sockaddr_in& endPoint, const sockaddr_in& other)
+  {
+    return endPoint.sin_addr.s_addr == other.sin_addr.s_addr && endPoint.sin_port == other.sin_port;
+  }
+
+  /* Queues a received DTLS record on its session and schedules a handshake step. */
+  void OnDtlsRecord(const uint8_t* buffer, int bufferLength, const sockaddr_in& client)
+  {
+    auto session = _sessions.Find(client);
+    if (session == nullptr) {
+      printf("DTLS packet received from %s:%d without a session.\n", inet_ntoa(client.sin_addr), ntohs(client.sin_port));
+    }
+    else if (session->State != SessionState::Closed) {
+      SessionState iceConnected = SessionState::IceConnected;
+      if (session->State.compare_exchange_strong(iceConnected, SessionState::DtlsHandshaking)) {
+        session->HandshakeStartedAt = SteadyClockMilliseconds();
+      }
+
+      {
+        std::lock_guard<std::mutex> lock(session->PendingLock);
+        session->PendingRecords.push_back(std::vector<uint8_t>(buffer, buffer + bufferLength));
+      }
+
+      QueueDtlsStep(session);
+    }
+  }
+
+  /**
+  * Decrypts an RTCP packet from the browser and records the bandwidth estimate
+  * if it has one. The rest of the feedback isn't used.
+  */
+  void OnRtcpPacket(uint8_t* buffer, int bufferLength, const sockaddr_in& client)
+  {
+    auto session = _sessions.Find(client);
+    if (session == nullptr || session->State != SessionState::SrtpReady) {
+      return;
+    }
+
+    auto unprotRes = srtp_unprotect_rtcp(session->SrtpReceiveSession, buffer, &bufferLength);
+    if (unprotRes != srtp_err_status_ok) {
+      printf("SRTCP unprotect failed with error code %d.\n", unprotRes);
+      return;
+    }
+
+    RtcpRemb remb;
+    if (remb.Deserialise(buffer, bufferLength)) {
+      session->RembBitrate = remb.Bitrate;
+    }
+  }
+
+  void QueueDtlsStep(std::shared_ptr<WebRtcSession> session)
+  {
+    if (!session->StepQueued.exchange(true)) {
+      _dtlsWorkers.Queue([this, session]() { DtlsHandshakeStep(session); });
+    }
+  }
+
+  void OnHandshakeTimer(std::weak_ptr<WebRtcSession> weakSession)
+  {
+    auto session = weakSession.lock();
+    if (session != nullptr && session->State != SessionState::SrtpReady && session->State != SessionState::Closed) {
+      TeardownSession(session, "DTLS handshake timed out");
+    }
+  }
+
+  void OnConsentTimer(std::weak_ptr<WebRtcSession> weakSession)
+  {
+    auto session = weakSession.lock();
+    if (session == nullptr || session->State == SessionState::Closed) {
+      return;
+    }
+
+    if (SteadyClockMilliseconds() >= session->ConsentExpiresAt) {
+      TeardownSession(session, "ICE consent expired");
+    }
+    else {
+      // Consent was refreshed since the timer was armed, check again when the latest refresh runs out.
+      _timers.Add(session->ConsentExpiresAt, [this, weakSession]() { OnConsentTimer(weakSession); });
+    }
+  }
+
+  /* Sends the session its sender reports and re-arms itself until the session closes. */
+  void OnRtcpTimer(std::weak_ptr<WebRtcSession> weakSession)
+  {
+    auto session = weakSession.lock();
+    if (session != nullptr && session->State == SessionState::SrtpReady) {
+      SendRtcpSenderReports(_rtpSocket, *session, _videoClock, _audioClock);
+      _timers.Add(SteadyClockMilliseconds() + RTCP_SR_INTERVAL_MS, [this, weakSession]() { OnRtcpTimer(weakSession); });
+    }
+  }
+
+  void OnRetransmitTimer(std::weak_ptr<WebRtcSession> weakSession)
+  {
+    auto session = weakSession.lock();
+    if (session != nullptr && session->State == SessionState::DtlsHandshaking) {
+      int64_t retransmitDueAt = session->RetransmitDueAt;
+      if (retransmitDueAt != 0 && retransmitDueAt <= SteadyClockMilliseconds()) {
+        session->RetransmitDueAt = 0;
+        QueueDtlsStep(session);
+      }
+    }
+  }
+
+  /**
+  * Removes a session from the table, which is also what unsubscribes it from the
+  * media thread, and lets the browser know with a DTLS close_notify if the handshake
+  * had completed.
+  */
+  void TeardownSession(std::shared_ptr<WebRtcSession> session, const char* reason)
+  {
+    sockaddr_in remoteEndPoint = session->GetRemoteEndPoint();
+    printf("Closing session %s for %s:%d, %s.\n", session->IceUsername.c_str(), inet_ntoa(remoteEndPoint.sin_addr), ntohs(remoteEndPoint.sin_port), reason);
+
+    bool wasReady = session->State.exchange(SessionState::Closed) == SessionState::SrtpReady;
+    _sessions.Remove(session);
+
+    if (wasReady) {
+      _dtlsWorkers.Queue([this, session]() {
+        std::lock_guard<std::mutex> sslLock(session->SslLock);
+        SSL_shutdown(session->Ssl);
+        FlushDtlsRecords(_rtpSocket, *session);
+      });
+    }
+  }
+
+  /**
+  * Progresses a session's DTLS connection with any records that have been received
+  * and, if it's timer has expired, retransmits the last flight. Runs on the worker
+  * pool.
+  */
+  void DtlsHandshakeStep(std::shared_ptr<WebRtcSession> session)
+  {
+    std::lock_guard<std::mutex> sslLock(session->SslLock);
+
+    // Any records arriving from now on need a new step.
+    session->StepQueued = false;
+
+    {
+      std::lock_guard<std::mutex> pendingLock(session->PendingLock);
+      while (!session->PendingRecords.empty()) {
+        auto& record = session->PendingRecords.front();
+        BIO_write(session->ReadBio, record.data(), (int)record.size());
+        session->PendingRecords.pop_front();
+      }
+    }
+
+    if (session->State == SessionState::DtlsHandshaking) {
+      // Only retransmits if the timer has actually expired.
+      DTLSv1_handle_timeout(session->Ssl);
+
+      int r = SSL_do_handshake(session->Ssl);
+
+      FlushDtlsRecords(_rtpSocket, *session);
+
+      if (r == 1) {
+        session->RetransmitDueAt = 0;
+        session->HandshakeCompletedAt = SteadyClockMilliseconds();
+
+        if (!CreateSrtpSession(*session)) {
+          CloseFromWorker(session);
+        }
+        else {
+          session->SrtpReadyAt = SteadyClockMilliseconds();
+
+          double duration = (double)(SteadyClockMilliseconds() - session->HandshakeStartedAt);
+          _handshakeStats.Add(duration);
+
+          printf("DTLS handshake with %s:%d completed in %.0fms (count %zu, p50 %.0fms, p99 %.0fms).\n",
+            inet_ntoa(session->GetRemoteEndPoint().sin_addr), ntohs(session->GetRemoteEndPoint().sin_port), duration,
+            _handshakeStats.Count(), _handshakeStats.Percentile(50), _handshakeStats.Percentile(99));
+
+          // Setting the state is what makes the session visible to the media threads, the video one forces a keyframe for it.
+          SessionState handshaking = SessionState::DtlsHandshaking;
+          if (session->State.compare_exchange_strong(handshaking, SessionState::SrtpReady)) {
+            std::weak_ptr<WebRtcSession> weakSession = session;
+            _timers.Add(SteadyClockMilliseconds() + RTCP_SR_INTERVAL_MS, [this, weakSession]() { OnRtcpTimer(weakSession); });
+          }
+        }
+      }
+      else {
+        int err = SSL_get_error(session->Ssl, r);
+        if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
+          timeval timeout;
+          if (DTLSv1_get_timeout(session->Ssl, &timeout)) {
+            int64_t retransmitDueAt = SteadyClockMilliseconds() + timeout.tv_sec * 1000 + timeout.tv_usec / 1000;
+            session->RetransmitDueAt = retransmitDueAt;
+
+            std::weak_ptr<WebRtcSession> weakSession = session;
+            _timers.Add(retransmitDueAt, [this, weakSession]() { OnRetransmitTimer(weakSession); });
+          }
+        }
+        else {
+          printf("DTLS handshake with %s:%d failed, error %d.\n", inet_ntoa(session->GetRemoteEndPoint().sin_addr), ntohs(session->GetRemoteEndPoint().sin_port), err);
+          ERR_print_errors_fp(stderr);
+          CloseFromWorker(session);
+        }
+      }
+    }
+    else if (session->State == SessionState::SrtpReady) {
+      // Records after the handshake are only expected to be alerts, e.g. close_notify.
+      unsigned char appData[RECEIVE_BUFFER_LENGTH];
+      while (SSL_read(session->Ssl, appData, sizeof(appData)) > 0);
+
+      FlushDtlsRecords(_rtpSocket, *session);
+
+      if (SSL_get_shutdown(session->Ssl) & SSL_RECEIVED_SHUTDOWN) {
+        printf("DTLS connection with %s:%d closed by remote peer.\n", inet_ntoa(session->GetRemoteEndPoint().sin_addr), ntohs(session->GetRemoteEndPoint().sin_port));
+        CloseFromWorker(session);
+      }
+    }
+  }
+
+  /* Marks a session closed from a worker thread. The removal is done on the event loop. */
+  void CloseFromWorker(std::shared_ptr<WebRtcSession> session)
+  {
+    session->State = SessionState::Closed;
+    _timers.Add(0, [this, session]() { _sessions.Remove(session); });
+  }
+};
+
+/**
+* Minimal HTTP server for WHIP style (RFC9725) signaling:
+*  - POST HTTP_SIGNALING_PATH with an application/sdp offer gets a 201 Created with
+*    the SDP answer and a Location header for the session.
+*  - DELETE of the Location URL closes the session.
+*  - OPTIONS is answered for the browser's CORS preflight, mfwebrtc.html is opened
+*    from a file so every response has CORS headers.
+*
+* One request is handled per connection. Connections are accepted on one thread
+* and handed to a worker pool, and each has HTTP_RECEIVE_TIMEOUT_MS in total to
+* send its request, so a slow client only holds up one worker for a bounded time
+* and never stops new connections being accepted. Answering an offer only needs
+* the session object, and its SSL object, creating so it takes well under a
+* millisecond and doing it here means the session is ready before the browser's
+* first connectivity check arrives.
+*/
+class HttpSignalingListener
+{
+public:
+  HttpSignalingListener(SOCKET listenSocket, IceLiteAgent& iceAgent, const std::string& fingerprint) :
+    _listenSocket(listenSocket),
+    _iceAgent(iceAgent),
+    _fingerprint(fingerprint),
+    _connectionWorkers(HTTP_WORKER_THREAD_COUNT)
+  {}
+
+  void Run(std::atomic<bool>& exit)
+  {
+    printf("HTTP signaling listening on port %d.\n", HTTP_LISTEN_PORT);
+
+    while (!exit) {
+      fd_set readSet;
+      FD_ZERO(&readSet);
+      FD_SET(_listenSocket, &readSet);
+      timeval waitTimeout = { 0, EVENT_LOOP_MAX_WAIT_MS * 1000 };
+
+      int selectResult = select(0, &readSet, nullptr, nullptr, &waitTimeout);
+      if (selectResult == SOCKET_ERROR) {
+        wprintf(L"HTTP select failed with error %d\n", WSAGetLastError());
+        break;
+      }
+      else if (selectResult > 0) {
+        SOCKET clientSocket = accept(_listenSocket, nullptr, nullptr);
+        if (clientSocket == INVALID_SOCKET) {
+          wprintf(L"accept failed with error %d\n", WSAGetLastError());
+        }
+        else if (_pendingConnections >= HTTP_MAX_PENDING_CONNECTIONS) {
+          printf("HTTP connection dropped, %d are already waiting.\n", HTTP_MAX_PENDING_CONNECTIONS);
+          closesocket(clientSocket);
+        }
+        else {
+          _pendingConnections++;
+          _connectionWorkers.Queue([this, clientSocket]() {
+            _pendingConnections--;
+            OnConnection(clientSocket);
+            closesocket(clientSocket);
+          });
+        }
+      }
+    }
+
+    printf("HTTP signaling stopped.\n");
+  }
+
+private:
+  struct HttpRequest
+  {
+    std::string Method;
+    std::string Path;
+    std::string Body;
+  };
+
+  SOCKET _listenSocket;
+  IceLiteAgent& _iceAgent;
+  std::string _fingerprint;
+  std::atomic<int> _pendingConnections = 0;
+  WorkerPool _connectionWorkers;        // Last so the workers are joined before the other members are destroyed.
+
+  void OnConnection(SOCKET clientSocket)
+  {
+    HttpRequest request;
+    if (!ReadRequest(clientSocket, request)) {
+      printf("Failed to read HTTP request.\n");
+      return;
+    }
+
+    int64_t receivedAt = SteadyClockMilliseconds();
+    std::string sessionPathPrefix = HTTP_SIGNALING_PATH "/";
+
+    if (request.Method == "OPTIONS") {
+      SendResponse(clientSocket, "204 No Content", "", "");
+    }
+    else if (request.Method == "POST" && request.Path == HTTP_SIGNALING_PATH) {
+      SdpOffer offer;
+      if (!offer.Parse(request.Body)) {
+        printf("SDP offer rejected, it needs ICE credentials and %s video.\n", (VIDEO_CODEC_VP9) ? "VP9" : "VP8");
+        SendResponse(clientSocket, "400 Bad Request", "", "");
+      }
+      else {
+        std::shared_ptr<WebRtcSession> session;
+        try {
+          session = _iceAgent.CreateSession(offer);
+        }
+        catch (std::exception& excp) {
+          printf("Failed to create session for SDP offer. %s\n", excp.what());
+          SendResponse(clientSocket, "500 Internal Server Error", "", "");
+          return;
+        }
+
+        std::string answer = GetSdpAnswer(offer, *session, _fingerprint);
+
+        SendResponse(clientSocket, "201 Created",
+          "Content-Type: application/sdp\r\nLocation: " + sessionPathPrefix + session->IceUsername + "\r\n", answer);
+
+        printf("SDP offer for session %s answered in %lldms.\n", session->IceUsername.c_str(), SteadyClockMilliseconds() - receivedAt);
+      }
+    }
+    else if (request.Method == "DELETE" && request.Path.compare(0, sessionPathPrefix.size(), sessionPathPrefix) == 0) {
+      bool found = _iceAgent.CloseSession(request.Path.substr(sessionPathPrefix.size()));
+      SendResponse(clientSocket, (found) ? "200 OK" : "404 Not Found", "", "");
+    }
+    else {
+      SendResponse(clientSocket, "404 Not Found", "", "");
+    }
+  }
+
+  /**
+  * Reads an HTTP request. Only the request line and Content-Length header are
+  * needed, the rest of the headers are ignored.
+  * @param[in] clientSocket: the accepted connection.
+  * @param[out] request: the method, path and body of the request.
+  * @@Returns true if a whole request was read before the timeout.
+  */
+  bool ReadRequest(SOCKET clientSocket, HttpRequest& request)
+  {
+    // The timeout covers the whole request, a receive timeout would restart with each trickled byte.
+    int64_t deadline = SteadyClockMilliseconds() + HTTP_RECEIVE_TIMEOUT_MS;
+
+    // Bounds the response too, for a client that stops reading.
+    DWORD sendTimeout = HTTP_RECEIVE_TIMEOUT_MS;
+    setsockopt(clientSocket, SOL_SOCKET, SO_SNDTIMEO, (const char*)&sendTimeout, sizeof(sendTimeout));
+
+    std::string received;
+    char buffer[RECEIVE_BUFFER_LENGTH];
+    size_t headersEnd = std::string::npos;
+    size_t contentLength = 0;
+
+    while (headersEnd == std::string::npos || received.size() < headersEnd + contentLength) {
+      if (received.size() > HTTP_MAX_REQUEST_LENGTH) {
+        return false;
+      }
+
+      int64_t remaining = deadline - SteadyClockMilliseconds();
+      if (remaining <= 0) {
+        return false;
+      }
+
+      fd_set readSet;
+      FD_ZERO(&readSet);
+      FD_SET(clientSocket, &readSet);
+      timeval waitTimeout = { (long)(remaining / 1000), (long)(remaining % 1000) * 1000 };
+
+      if (select(0, &readSet, nullptr, nullptr, &waitTimeout) <= 0) {
+        return false;
+      }
+
+      int recvResult = recv(clientSocket, buffer, sizeof(buffer), 0);
+      if (recvResult <= 0) {
+        return false;
+      }
+      received.append(buffer, recvResult);
+
+      if (headersEnd == std::string::npos) {
+        size_t blankLine = received.find("\r\n\r\n");
+        if (blankLine != std::string::npos) {
+          headersEnd = blankLine + 4;
+
+          std::string headers = received.substr(0, blankLine);
+          std::transform(headers.begin(), headers.end(), headers.begin(), ::tolower);
+          size_t contentLengthPosn = headers.find("\r\ncontent-length:");
+          if (contentLengthPosn != std::string::npos) {
+            contentLength = strtoul(headers.c_str() + contentLengthPosn + 17, nullptr, 10);
+          }
+
+          // Request line: <method> <path> HTTP/1.1
+          std::istringstream requestLine(received.substr(0, received.find("\r\n")));
+          requestLine >> request.Method >> request.Path;
+        }
+      }
+    }
+
+    request.Body = received.substr(headersEnd, contentLength);
+    return true;
+  }
+
+  void SendResponse(SOCKET clientSocket, const char* status, const std::string& headers, const std::string& body)
+  {
+    std::string response = std::string("HTTP/1.1 ") + status + "\r\n" +
+      "Access-Control-Allow-Origin: *\r\n"
+      "Access-Control-Allow-Methods: POST, DELETE, OPTIONS\r\n"
+      "Access-Control-Allow-Headers: Content-Type\r\n"
+      "Access-Control-Allow-Private-Network: true\r\n"
+      "Access-Control-Expose-Headers: Location\r\n"
+      "Connection: close\r\n" +
+      headers +
+      "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n" +
+      body;
+
+    send(clientSocket, response.data(), (int)response.size(), 0);
+  }
+};
+
+int main()
+{
+  // Socket variables.
+  WSADATA wsaData;
+  SOCKET rtpSocket = INVALID_SOCKET;
+  SOCKET httpSocket = INVALID_SOCKET;
+  sockaddr_in service;
+
+  // DTLS variables.
+  SSL_CTX* ctx = nullptr;		/* main ssl context */
+  X509* cert = nullptr;
+  EVP_PKEY* key = nullptr;
+
+  try {
+
+    // Initialise Winsock
+    int iResult = WSAStartup(MAKEWORD(2, 2), &wsaData);
+    if (iResult != 0) {
+      printf("WSAStartup failed: %d\n", iResult);
+      goto done;
+    }
+
+    // Initialise OpenSSL
+    SSL_library_init();
+    SSL_load_error_strings();
+    ERR_load_BIO_strings();
+    OpenSSL_add_all_algorithms();
+
+    // Dump any openssl errors.
+    ERR_print_errors_fp(stderr);
+
+    // Initialise libsrtp.
+    srtp_init();
+
+    //------
+    // Set up single UDP socket that will do all send/receive with the browsers.
+    //------
+    service.sin_family = AF_INET;
+    service.sin_addr.s_addr = INADDR_ANY;
+    service.sin_port = htons(RTP_LISTEN_PORT);
+
+    rtpSocket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (rtpSocket == INVALID_SOCKET) {
+      wprintf(L"socket function failed with error: %u\n", WSAGetLastError());
+      goto done;
+    }
+
+    iResult = bind(rtpSocket, (SOCKADDR*)&service, sizeof (service));
+    if (iResult == SOCKET_ERROR) {
+      wprintf(L"bind failed with error %u\n", WSAGetLastError());
+      closesocket(rtpSocket);
+      goto done;
+    }
+
+    //------
+    // TCP socket the browsers POST their SDP offers to.
+    //------
+    service.sin_port = htons(HTTP_LISTEN_PORT);
+
+    httpSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (httpSocket == INVALID_SOCKET) {
+      wprintf(L"HTTP socket function failed with error: %u\n", WSAGetLastError());
+      goto done;
+    }
+
+    if (bind(httpSocket, (SOCKADDR*)&service, sizeof(service)) == SOCKET_ERROR || listen(httpSocket, SOMAXCONN) == SOCKET_ERROR) {
+      wprintf(L"HTTP bind or listen failed with error %u\n", WSAGetLastError());
+      goto done;
+    }
+
+    //------
+    // DTLS
+    //------
+    ctx = SSL_CTX_new(DTLS_server_method());	// Copes with DTLS 1.0 and 1.2.
+    if (!ctx) {
+      printf("Error: cannot create SSL_CTX.\n");
+      goto done;
+    }
+
+    int r = SSL_CTX_set_cipher_list(ctx, "ALL:!ADH:!LOW:!EXP:!MD5:@STRENGTH");
+    if (r != 1) {
+      printf("Error: cannot set the cipher list.\n");
+      goto done;
+    }
+
+    /* enable srtp */
+    r = SSL_CTX_set_tlsext_use_srtp(ctx, "SRTP_AES128_CM_SHA1_80");
+    if (r != 0) {
+      printf("Error: cannot setup srtp.\n");
+      goto done;
+    }
+
+    if (DTLS_USE_ECDSA_CERTIFICATE) {
+      if (!CreateEcdsaCertificate(&cert, &key)) {
+        printf("Error: cannot create ECDSA certificate.\n");
+        goto done;
+      }
+
+      r = SSL_CTX_use_certificate(ctx, cert);
+      if (r != 1) {
+        printf("Error: cannot use ECDSA certificate.\n");
+        goto done;
+      }
+
+      r = SSL_CTX_use_PrivateKey(ctx, key);
+      if (r != 1) {
+        printf("Error: cannot use ECDSA private key.\n");
+        goto done;
+      }
+    }
+    else {
+      /* certificate file; contains also the public key */
+      r = SSL_CTX_use_certificate_file(ctx, DTLS_CERTIFICATE_FILE, SSL_FILETYPE_PEM);
+      if (r != 1) {
+        printf("Error: cannot load certificate file.\n");
+        goto done;
+      }
+
+      /* load private key */
+      r = SSL_CTX_use_PrivateKey_file(ctx, DTLS_KEY_FILE, SSL_FILETYPE_PEM);
+      if (r != 1) {
+        printf("Error: cannot load private key file.\n");
+        goto done;
+      }
+    }
+
+    /* check if the private key is valid */
+    r = SSL_CTX_check_private_key(ctx);
+    if (r != 1) {
+      printf("Error: checking the private key failed.\n");
+      goto done;
+    }
+
+    // Don't need to use a handshake cookie at this point. The DTLS 
+    // handshake does not get initiated until the ICE connection is done
+    // and that serves as the DoS protection.
+    //SSL_CTX_set_cookie_generate_cb(ctx, generate_cookie);
+    //SSL_CTX_set_cookie_verify_cb(ctx, verify_cookie);
+    SSL_CTX_set_ecdh_auto(ctx, 1);                        // Needed for FireFox DTLS negotiation.
+    SSL_CTX_set_verify(ctx, SSL_VERIFY_NONE, nullptr);    // The client doesn't have to send it's certificate.
+    SSL_CTX_set_options(ctx, SSL_OP_NO_QUERY_MTU);        // Memory BIOs can't report a path MTU, DTLS_MTU is set on each session instead.
+
+    // The fingerprint only needs to be calculated once, every session uses the same certificate.
+    std::string fingerprint = GetCertificateFingerprint(SSL_CTX_get0_certificate(ctx));
+    printf("DTLS certificate fingerprint sha-256 %s.\n", fingerprint.c_str());
+
+    printf("Waiting for SDP offers on http://127.0.0.1:%d%s...\n", HTTP_LISTEN_PORT, HTTP_SIGNALING_PATH);
+
+    {
+      SessionTable sessions;
+      RtpTimestampClock videoClock(90000);
+      RtpTimestampClock audioClock(OPUS_SAMPLE_RATE);
+      IceLiteAgent iceAgent(rtpSocket, ctx, sessions, videoClock, audioClock);
+      HttpSignalingListener signaling(httpSocket, iceAgent, fingerprint);
+      std::atomic<bool> exitEventLoop = false;
+
+      // The event loop answers STUN binding requests, which need to keep being responded to or the browser will
+      // flag the connection as disconnected, tracks consent, passes DTLS records to the worker pool and sends
+      // the RTCP sender reports.
+      std::thread eventLoopThread(&IceLiteAgent::Run, &iceAgent, std::ref(exitEventLoop));
+
+      // Signaling connections are accepted on this thread, and offers answered, and their sessions created, on its workers.
+      std::thread signalingThread(&HttpSignalingListener::Run, &signaling, std::ref(exitEventLoop));
+
+      // The microphone is captured and encoded on its own thread and sent to the same sessions as the webcam.
+      std::thread microphoneThread(StreamMicrophone, rtpSocket, std::ref(sessions), std::ref(audioClock), std::ref(exitEventLoop));
+
+      // Webcam sample streaming can commence. Each sample is sent to the sessions that have completed
+      // their DTLS handshake.
+      StreamWebcam(rtpSocket, sessions, videoClock);
+
+      exitEventLoop = true;
+      microphoneThread.join();
+      signalingThread.join();
+      eventLoopThread.join();
+    }
+  }
+  catch (std::exception & excp) {
+    std::cout << "Exception: " << excp.what() << std::endl;
+  }
+
+done:
+
+  ERR_print_errors_fp(stderr);
+
+  printf("Cleanup.\n");
+
+  // OpenSSL cleanup.
+  if (ctx != nullptr) {
+    SSL_CTX_free(ctx);
+  }
+
+  X509_free(cert);
+  EVP_PKEY_free(key);
+
+  ERR_remove_state(0);
+  //ENGINE_cleanup();
+  //CONF_modules_unload(1);
+  ERR_free_strings();
+  EVP_cleanup();
+  sk_SSL_COMP_free(SSL_COMP_get_compression_methods());
+  CRYPTO_cleanup_all_ex_data();
+
+  // Winsock cleanup
+  closesocket(httpSocket);
+  closesocket(rtpSocket);
+  WSACleanup();
+}
+
+void SendStunBindingResponse(SOCKET rtpSocket, StunMessage & bindingRequest, sockaddr_in client, const std::string& icePassword)
+{
+  StunMessage stunBindingResp(StunMessageTypes::BindingSuccessResponse);
+  std::copy(bindingRequest.TransactionID, bindingRequest.TransactionID + StunMessage::TRANSACTION_ID_LENGTH, stunBindingResp.TransactionID);
+
+  // Add required attributes.
+  stunBindingResp.AddXorMappedAttribute(client.sin_family, ntohs(client.sin_port), ntohl(client.sin_addr.s_addr), StunMessage::MAGIC_COOKIE_BYTES);
+  stunBindingResp.AddHmacAttribute(icePassword.c_str(), (int)icePassword.size());
+  stunBindingResp.AddFingerprintAttribute();
+
+  uint8_t* respBuffer = nullptr;
+  int respBufferLength = stunBindingResp.Serialise(&respBuffer);
+
+  //printf("Sending STUN response packet, length %d.\n", respBufferLength);
+
+  sendto(rtpSocket, (const char*)respBuffer, respBufferLength, 0, (sockaddr*)&client, sizeof(client));
 
   free(respBuffer);
 }
 
-/*
+/**
+* Sends any DTLS records OpenSSL has written to the session's write BIO. The
+* memory BIO doesn't preserve datagram boundaries so whole records are packed
+* into datagrams of up to DTLS_MTU bytes.
+*/
+void FlushDtlsRecords(SOCKET rtpSocket, WebRtcSession& session)
+{
+  int pending = (int)BIO_ctrl_pending(session.WriteBio);
+  if (pending <= 0) {
+    return;
+  }
+
+  std::vector<uint8_t> records(pending);
+  int length = BIO_read(session.WriteBio, records.data(), pending);
+  sockaddr_in remoteEndPoint = session.GetRemoteEndPoint();
+
+  int datagramStart = 0;
+  int posn = 0;
+
+  while (posn + DTLS_RECORD_HEADER_LENGTH <= length) {
+    int recordLength = DTLS_RECORD_HEADER_LENGTH + ((records[posn + 11] << 8) | records[posn + 12]);
+
+    if (posn > datagramStart && posn + recordLength - datagramStart > DTLS_MTU) {
+      sendto(rtpSocket, (const char*)&records[datagramStart], posn - datagramStart, 0, (sockaddr*)&remoteEndPoint, sizeof(remoteEndPoint));
+      datagramStart = posn;
+    }
+
+    posn += recordLength;
+  }
+
+  if (length > datagramStart) {
+    sendto(rtpSocket, (const char*)&records[datagramStart], length - datagramStart, 0, (sockaddr*)&remoteEndPoint, sizeof(remoteEndPoint));
+  }
+}
+
+/**
+* Derives the SRTP keys from the completed DTLS handshake and creates the
+* session's transmit and receive SRTP contexts.
+*/
+bool CreateSrtpSession(WebRtcSession& session)
+{
+  unsigned char dtls_buffer[SRTP_MASTER_KEY_KEY_LEN * 2 + SRTP_MASTER_KEY_SALT_LEN * 2];
+  unsigned char client_write_key[SRTP_MASTER_KEY_KEY_LEN + SRTP_MASTER_KEY_SALT_LEN];
+  unsigned char server_write_key[SRTP_MASTER_KEY_KEY_LEN + SRTP_MASTER_KEY_SALT_LEN];
+  size_t keyMaterialOffset = 0;
+  srtp_policy_t srtpPolicy;
+
+  const char* label = "EXTRACTOR-dtls_srtp";
+
+  int r = SSL_export_keying_material(session.Ssl,
+    dtls_buffer,
+    sizeof(dtls_buffer),
+    label,
+    strlen(label),
+    NULL,
+    0,
+    0);
+  if (r != 1) {
+    printf("Error: exporting DTLS key material.\n");
+    return false;
+  }
+
+  memcpy(&client_write_key[0], &dtls_buffer[keyMaterialOffset], SRTP_MASTER_KEY_KEY_LEN);
+  keyMaterialOffset += SRTP_MASTER_KEY_KEY_LEN;
+  memcpy(&server_write_key[0], &dtls_buffer[keyMaterialOffset], SRTP_MASTER_KEY_KEY_LEN);
+  keyMaterialOffset += SRTP_MASTER_KEY_KEY_LEN;
+  memcpy(&client_write_key[SRTP_MASTER_KEY_KEY_LEN], &dtls_buffer[keyMaterialOffset], SRTP_MASTER_KEY_SALT_LEN);
+  keyMaterialOffset += SRTP_MASTER_KEY_SALT_LEN;
+  memcpy(&server_write_key[SRTP_MASTER_KEY_KEY_LEN], &dtls_buffer[keyMaterialOffset], SRTP_MASTER_KEY_SALT_LEN);
+
+  memset(&srtpPolicy, 0, sizeof(srtpPolicy));
+  srtp_crypto_policy_set_rtp_default(&srtpPolicy.rtp);
+  srtp_crypto_policy_set_rtcp_default(&srtpPolicy.rtcp);
+
+  /* Init transmit direction */
+  srtpPolicy.key = server_write_key;
+
+  srtpPolicy.ssrc.value = 0;
+  srtpPolicy.window_size = 128;
+  srtpPolicy.allow_repeat_tx = 0;
+  srtpPolicy.ssrc.type = ssrc_any_outbound;
+  srtpPolicy.next = NULL;
+
+  auto err = srtp_create(&session.SrtpSession, &srtpPolicy);
+  if (err != srtp_err_status_ok) {
+    printf("Unable to create SRTP session, error %d.\n", err);
+    return false;
+  }
+
+  /* Init receive direction, needs its own context as each one can only have one wildcard SSRC policy. */
+  srtpPolicy.key = client_write_key;
+  srtpPolicy.ssrc.type = ssrc_any_inbound;
+
+  err = srtp_create(&session.SrtpReceiveSession, &srtpPolicy);
+  if (err != srtp_err_status_ok) {
+    printf("Unable to create receive SRTP session, error %d.\n", err);
+    return false;
+  }
+
+  return true;
+}
 
-From RFC5764:
-                   +----------------+
-                   | 127 < B < 192 -+--> forward to RTP
-                   |                |
-       packet -->  |  19 < B < 64  -+--> forward to DTLS
-                   |                |
-                   |       B < 2   -+--> forward to STUN
-                   +----------------+
+/**
+* Generates a self signed ECDSA P-256 certificate in memory. Signing with an
+* ECDSA key is a lot cheaper than RSA, which shortens the server's part of the
+* DTLS handshake, and there are no files to load.
+* @param[out] ppCert: the new certificate.
+* @param[out] ppKey: the certificate's private key.
+* @@Returns true if the certificate was created.
 */
-void RtpSocketListen(SOCKET rtpSocket)
+bool CreateEcdsaCertificate(X509** ppCert, EVP_PKEY** ppKey)
 {
-  unsigned char recvBuffer[RECEIVE_BUFFER_LENGTH];
-  sockaddr_in clientAddr;
-  int clientAddrLen = sizeof(clientAddr);
+  EVP_PKEY* key = nullptr;
+  X509* cert = nullptr;
+  X509_NAME* name = nullptr;
+  bool success = false;
+
+  EVP_PKEY_CTX* keyCtx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, nullptr);
+  if (keyCtx == nullptr ||
+    EVP_PKEY_keygen_init(keyCtx) != 1 ||
+    EVP_PKEY_CTX_set_ec_paramgen_curve_nid(keyCtx, NID_X9_62_prime256v1) != 1 ||
+    EVP_PKEY_keygen(keyCtx, &key) != 1) {
+    printf("Error: failed to generate ECDSA key.\n");
+    goto done;
+  }
+
+  cert = X509_new();
+  if (cert == nullptr) {
+    goto done;
+  }
+
+  X509_set_version(cert, 2);
+  ASN1_INTEGER_set(X509_get_serialNumber(cert), (long)(SteadyClockMilliseconds() & 0x7fffffff));
+  X509_gmtime_adj(X509_get_notBefore(cert), -24 * 60 * 60);       // Allow for clock skew with the browser.
+  X509_gmtime_adj(X509_get_notAfter(cert), 30 * 24 * 60 * 60);
+  X509_set_pubkey(cert, key);
+
+  name = X509_get_subject_name(cert);
+  X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char*)"MFWebCamWebRTC", -1, -1, 0);
+  X509_set_issuer_name(cert, name);
+
+  if (X509_sign(cert, key, EVP_sha256()) == 0) {
+    printf("Error: failed to sign ECDSA certificate.\n");
+    goto done;
+  }
+
+  *ppCert = cert;
+  *ppKey = key;
+  cert = nullptr;
+  key = nullptr;
+  success = true;
+
+done:
+
+  EVP_PKEY_CTX_free(keyCtx);
+  X509_free(cert);
+  EVP_PKEY_free(key);
 
-  printf("RTP socket listener started.\n");
+  return success;
+}
 
-  while (true) {
-    int recvResult = recvfrom(rtpSocket, (char*)recvBuffer, RECEIVE_BUFFER_LENGTH, 0, (sockaddr*)&clientAddr, &clientAddrLen);
-    if (recvResult == SOCKET_ERROR) {
-      wprintf(L"recvfrom failed with error %d\n", WSAGetLastError());
+/**
+* Gets the SHA-256 fingerprint of a certificate in the format used by the SDP
+* fingerprint attribute, e.g. C6:ED:8C:...
+* @param[in] cert: the certificate to get the fingerprint for.
+* @@Returns the fingerprint or an empty string if it could not be calculated.
+*/
+std::string GetCertificateFingerprint(X509* cert)
+{
+  unsigned char digest[EVP_MAX_MD_SIZE];
+  unsigned int digestLength = 0;
+  char hex[4];
+  std::string fingerprint;
+
+  if (cert != nullptr && X509_digest(cert, EVP_sha256(), digest, &digestLength) == 1) {
+    for (unsigned int i = 0; i < digestLength; i++) {
+      snprintf(hex, sizeof(hex), (i == 0) ? "%02X" : ":%02X", digest[i]);
+      fingerprint += hex;
     }
-    else {
-      //printf("Received %d bytes from %s:%d.\n", recvResult, inet_ntoa(clientAddr.sin_addr), ntohs(clientAddr.sin_port));
-
-      // See section 5.1.2 RFC5764.
-      if (recvBuffer[0] == 0x00 || recvBuffer[0] == 0x01) {
-        // STUN packet.
-        //printf("STUN packet received.\n");
-        StunMessage stunMsg;
-        stunMsg.Deserialise(recvBuffer, recvResult);
-
-        // Send binding success response.
-        if (stunMsg.Type == (uint16_t)StunMessageTypes::BindingRequest) {
-          SendStunBindingResponse(rtpSocket, stunMsg, clientAddr);
-        }
-      }
-      else if (recvBuffer[0] >= 128 && recvBuffer[0] <= 191) {
-        // RTP/RTCP packet.
-        //printf("RTP or RTCP packet received.\n");
+  }
+
+  return fingerprint;
+}
+
+/**
+* Gets a random string for the ICE ufrag or password. Upper case letters are a
+* subset of the ice-char set in RFC8839 section 5.4.
+* @param[in] length: the number of characters.
+* @@Returns The random string.
+*/
+std::string GetRandomIceString(size_t length)
+{
+  std::vector<uint8_t> random(length);
+  RAND_bytes(random.data(), (int)length);
+
+  std::string iceString;
+  for (auto r : random) {
+    iceString += (char)('A' + r % 26);
+  }
+  return iceString;
+}
+
+/**
+* Builds the SDP answer for a browser's offer. The offer's media sections are
+* answered in order, the accepted video and audio sections use the offer's payload
+* types and are bundled on the one ICE and DTLS transport with the session's ICE
+* credentials. Rejected sections get a zero port.
+* @param[in] offer: the browser's SDP offer.
+* @param[in] session: the session created for the offer.
+* @param[in] fingerprint: the SHA-256 fingerprint of the DTLS certificate.
+* @@Returns The SDP answer.
+*/
+std::string GetSdpAnswer(const SdpOffer& offer, const WebRtcSession& session, const std::string& fingerprint)
+{
+  std::string port = std::to_string(RTP_LISTEN_PORT);
+  std::string bundle = "a=group:BUNDLE";
+  std::string media;
+
+  for (auto& section : offer.MediaSections) {
+    if (section.PayloadType == 0) {
+      media += "m=" + section.Kind + " 0 " + section.Protocol + " " + section.FirstFormat + "\r\n";
+      if (!section.Mid.empty()) {
+        media += "a=mid:" + section.Mid + "\r\n";
       }
-      else if (recvBuffer[0] >= 20 && recvBuffer[0] <= 63) {
-        // DTLS packet.
-        //printf("DTLS packet received.\n");
+      continue;
+    }
+
+    std::string payloadType = std::to_string(section.PayloadType);
+    bundle += " " + section.Mid;
+
+    media += "m=" + section.Kind + " " + port + " " + section.Protocol + " " + payloadType + "\r\n";
+    media += "c=IN IP4 127.0.0.1\r\n";
+    media += "a=candidate:1251003584 1 udp 1038230912 127.0.0.1 " + port + " typ host generation 0\r\n";
+    media += "a=end-of-candidates\r\n";
+    media += "a=ice-ufrag:" + session.IceUsername + "\r\n";
+    media += "a=ice-pwd:" + session.IcePassword + "\r\n";
+    media += "a=fingerprint:sha-256 " + fingerprint + "\r\n";
+    media += "a=setup:passive\r\n";      // The browser is the DTLS client.
+    media += "a=mid:" + section.Mid + "\r\n";
+    media += "a=sendonly\r\n";
+    media += "a=rtcp-mux\r\n";
+    media += "a=msid:" MEDIA_STREAM_ID " " + section.Kind + "\r\n";
+
+    if (section.Kind == "video") {
+      if (VIDEO_CODEC_VP9) {
+        media += "a=rtpmap:" + payloadType + " VP9/90000\r\n";
+        media += "a=fmtp:" + payloadType + " profile-id=0\r\n";
       }
       else {
-        printf("Unknown packet type received.\n");
+        media += "a=rtpmap:" + payloadType + " VP8/90000\r\n";
+      }
+      media += "a=rtcp-fb:" + payloadType + " goog-remb\r\n";     // Asks the browser for its bandwidth estimate.
+      media += "a=ssrc:" + std::to_string(RTP_SSRC) + " cname:" RTCP_CNAME "\r\n";
+    }
+    else {
+      if (section.AudioLevelExtensionID != 0) {
+        media += "a=extmap:" + std::to_string(section.AudioLevelExtensionID) + " urn:ietf:params:rtp-hdrext:ssrc-audio-level\r\n";
       }
+      media += "a=rtpmap:" + payloadType + " opus/48000/2\r\n";
+      media += "a=fmtp:" + payloadType + " minptime=10;useinbandfec=1;usedtx=1\r\n";
+      media += "a=ssrc:" + std::to_string(OPUS_SSRC) + " cname:" RTCP_CNAME "\r\n";
     }
   }
+
+  std::string answer = "v=0\r\n";
+  answer += "o=- " + std::to_string(session.CreatedAt) + " 1 IN IP4 127.0.0.1\r\n";
+  answer += "s=-\r\n";
+  answer += "t=0 0\r\n";
+  answer += "a=ice-lite\r\n";
+  answer += bundle + "\r\n";
+  answer += media;
+
+  return answer;
 }
 
-int StreamWebcam(SOCKET rtpSocket, sockaddr_in& dest, srtp_t* srtpSession)
+int StreamWebcam(SOCKET rtpSocket, SessionTable& sessions, RtpTimestampClock& videoClock)
 {
   IMFMediaSource* pVideoSource = NULL;
   IMFSourceReader* pVideoReader = NULL;
@@ -742,10 +2679,17 @@ int StreamWebcam(SOCKET rtpSocket, sockaddr_in& dest, srtp_t* srtpSession)
 
   vpx_codec_ctx_t* vpxCodec = nullptr;
   vpx_image_t* rawImage = nullptr;
+  Vp8EncoderProfile vp8Profile;
+  Vp9SvcEncoderProfile vp9Profile;
+  vpx_codec_iface_t* vpxInterface = (VIDEO_CODEC_VP9) ? vpx_codec_vp9_cx() : vpx_codec_vp8_cx();
 
-  uint16_t rtpSsrc = RTP_SSRC; // Supposed to be pseudo-random.
-  uint16_t rtpSeqNum = 0;
+  uint32_t rtpSsrc = RTP_SSRC; // Supposed to be pseudo-random.
   uint32_t rtpTimestamp = 0;
+  FrameDeadlineScheduler frameScheduler(OUTPUT_FRAME_RATE, VIDEO_LATENCY_BUDGET_MS);
+  VideoAdaptationController adaptation(OUTPUT_FRAME_WIDTH, OUTPUT_FRAME_HEIGHT, OUTPUT_FRAME_RATE, VIDEO_BITRATE_KBPS);
+  std::vector<uint8_t> scaledFrame(GetI420FrameSize(OUTPUT_FRAME_WIDTH, OUTPUT_FRAME_HEIGHT));
+  VideoScaler scaler(ScaleFilter::Bilinear);
+  SceneChangeDetector sceneDetector(OUTPUT_FRAME_WIDTH, OUTPUT_FRAME_HEIGHT, VIDEO_KEY_FRAME_INTERVAL, VIDEO_STATIC_KEY_FRAME_INTERVAL);
 
   /*CHECK_HR(CoInitializeEx(NULL, COINIT_APARTMENTTHREADED | COINIT_DISABLE_OLE1DDE),
     "COM initialisation failed.");*/
@@ -781,10 +2725,10 @@ int StreamWebcam(SOCKET rtpSocket, sockaddr_in& dest, srtp_t* srtpSession)
   vpx_codec_enc_cfg_t vpxConfig;
   vpx_codec_err_t res;
 
-  printf("Using %s\n", vpx_codec_iface_name(vpx_codec_vp8_cx()));
+  printf("Using %s\n", vpx_codec_iface_name(vpxInterface));
 
   /* Populate encoder configuration */
-  res = vpx_codec_enc_config_default((vpx_codec_vp8_cx()), &vpxConfig, 0);
+  res = vpx_codec_enc_config_default(vpxInterface, &vpxConfig, 0);
 
   if (res) {
     printf("Failed to get VPX codec config: %s\n", vpx_codec_err_to_string(res));
@@ -795,7 +2739,7 @@ int StreamWebcam(SOCKET rtpSocket, sockaddr_in& dest, srtp_t* srtpSession)
 
     vpxConfig.g_w = OUTPUT_FRAME_WIDTH;
     vpxConfig.g_h = OUTPUT_FRAME_HEIGHT;
-    vpxConfig.rc_target_bitrate = 300; // in kbps.
+    vpxConfig.rc_target_bitrate = VIDEO_BITRATE_KBPS;
     vpxConfig.rc_min_quantizer = 20; // 50;
     vpxConfig.rc_max_quantizer = 30; // 60;
     vpxConfig.g_pass = VPX_RC_ONE_PASS;
@@ -803,13 +2747,57 @@ int StreamWebcam(SOCKET rtpSocket, sockaddr_in& dest, srtp_t* srtpSession)
     vpxConfig.g_error_resilient = VPX_ERROR_RESILIENT_DEFAULT;
     vpxConfig.g_lag_in_frames = 0;
     vpxConfig.rc_resize_allowed = 0;
-    vpxConfig.kf_max_dist = 20;
+    vpxConfig.kf_mode = VPX_KF_DISABLED;  // Key frames are forced by the scene change detector.
+
+    if (VIDEO_CODEC_VP9) {
+      // One encode with three spatial and three temporal layers, the layers each session
+      // doesn't want are dropped by the packetiser.
+      vp9Profile.Threads = GetVp8EncoderProfile(OUTPUT_FRAME_WIDTH, OUTPUT_FRAME_HEIGHT, std::thread::hardware_concurrency()).Threads;
+      SetVp9SvcEncoderProfileConfig(vp9Profile, vpxConfig.rc_target_bitrate, &vpxConfig);
+      PrintVp9SvcEncoderProfile(vp9Profile);
+
+      if (vpx_codec_enc_init(vpxCodec, vpxInterface, &vpxConfig, 0)) {
+        printf("Failed to initialize libvpx encoder.\n");
+        goto done;
+      }
+
+      if (SetVp9SvcEncoderProfileControls(vp9Profile, &vpxConfig, vpxCodec) != VPX_CODEC_OK) {
+        goto done;
+      }
+    }
+    else {
+      // Temporal scalability, the target bitrates are cumulative for each layer.
+      vpxConfig.ts_number_layers = VP8_TEMPORAL_LAYER_COUNT;
+      vpxConfig.ts_periodicity = VP8_TEMPORAL_PATTERN_LENGTH;
+      vpxConfig.ts_rate_decimator[0] = 4;
+      vpxConfig.ts_rate_decimator[1] = 2;
+      vpxConfig.ts_rate_decimator[2] = 1;
+      SetVp8TemporalLayerBitrates(vpxConfig.rc_target_bitrate, &vpxConfig);
+      for (int i = 0; i < VP8_TEMPORAL_PATTERN_LENGTH; i++) {
+        vpxConfig.ts_layer_id[i] = VP8_TEMPORAL_LAYER_IDS[i];
+      }
 
-    /* Initialize codec */
-    if (vpx_codec_enc_init(vpxCodec, (vpx_codec_vp8_cx()), &vpxConfig, 0)) {
-      printf("Failed to initialize libvpx encoder.\n");
-      goto done;
-    }
+      vp8Profile = GetVp8EncoderProfile(OUTPUT_FRAME_WIDTH, OUTPUT_FRAME_HEIGHT, std::thread::hardware_concurrency());
+      SetVp8EncoderProfileConfig(vp8Profile, &vpxConfig);
+      PrintVp8EncoderProfile(vp8Profile);
+
+      /* Initialize codec */
+      // Output partitions means each partition comes out as its own packet so it can be packetised on its own.
+      if (vpx_codec_enc_init(vpxCodec, vpxInterface, &vpxConfig, VPX_CODEC_USE_OUTPUT_PARTITION)) {
+        printf("Failed to initialize libvpx encoder.\n");
+        goto done;
+      }
+
+      if (SetVp8EncoderProfileControls(vp8Profile, vpxCodec) != VPX_CODEC_OK) {
+        goto done;
+      }
+    }
+
+    // Cyclic refresh is already on, VP8 enables it with error resilience and VP9 with its AQ mode.
+    if (VIDEO_INTRA_REFRESH && vpx_codec_control(vpxCodec, VP8E_SET_MAX_INTRA_BITRATE_PCT, VIDEO_MAX_INTRA_BITRATE_PCT)) {
+      printf("Failed to set libvpx maximum intra bitrate: %s\n", vpx_codec_error(vpxCodec));
+      goto done;
+    }
   }
 
   // Ready to go.
@@ -821,6 +2809,21 @@ int StreamWebcam(SOCKET rtpSocket, sockaddr_in& dest, srtp_t* srtpSession)
   LONGLONG llVideoTimeStamp, llSampleDuration;
   int sampleCount = 0;
   UINT vp8Timestamp = 0;
+  int temporalPatternPosn = 0;
+  Vp8PayloadDescriptor vp8Descriptor;
+  vp8Descriptor.PictureID = SteadyClockMilliseconds() & 0x7fff;   // Supposed to be random.
+  std::vector<std::shared_ptr<WebRtcSession>> frameSessions;       // The sessions the frame currently being packetised is going to.
+  Vp9PayloadDescriptor vp9Descriptor;
+  vp9Descriptor.PictureID = vp8Descriptor.PictureID;
+  vp9Descriptor.SpatialLayerCount = vp9Profile.SpatialLayers;
+  for (unsigned int sl = 0; sl < vp9Profile.SpatialLayers; sl++) {
+    unsigned int layerWidth = 0, layerHeight = 0;
+    GetVp9SvcLayerSize(vp9Profile, OUTPUT_FRAME_WIDTH, OUTPUT_FRAME_HEIGHT, sl, &layerWidth, &layerHeight);
+    vp9Descriptor.Widths[sl] = layerWidth;
+    vp9Descriptor.Heights[sl] = layerHeight;
+  }
+  uint8_t vp9PreviousTemporalLayer = 0;
+  unsigned int framesSinceKeyFrame = 0;
 
   while (true)
   {
@@ -835,6 +2838,8 @@ int StreamWebcam(SOCKET rtpSocket, sockaddr_in& dest, srtp_t* srtpSession)
 
     if (pVideoSample)
     {
+      videoClock.Set(vp8Timestamp, SteadyClockMilliseconds());
+
       CHECK_HR(pVideoSample->SetSampleTime(llVideoTimeStamp), "Error setting the video sample time.");
       CHECK_HR(pVideoSample->GetSampleDuration(&llSampleDuration), "Error getting video sample duration.");
       CHECK_HR(pVideoSample->GetSampleFlags(&sampleFlags), "Error getting sample flags.");
@@ -855,27 +2860,212 @@ int StreamWebcam(SOCKET rtpSocket, sockaddr_in& dest, srtp_t* srtpSession)
       //printf("Sample count %d, Sample flags %d, sample duration %I64d, sample time %I64d\n", sampleCount, sampleFlags, llSampleDuration, llVideoTimeStamp);
       vpx_image_t* const img = vpx_img_wrap(rawImage, VPX_IMG_FMT_I420, OUTPUT_FRAME_WIDTH, OUTPUT_FRAME_HEIGHT, 1, frameData);
 
-      const vpx_codec_cx_pkt_t* pkt;
-      vpx_enc_frame_flags_t flags = 0;
-
-      if (vpx_codec_encode(vpxCodec, rawImage, sampleCount, 1, flags, VPX_DL_REALTIME)) {
-        printf("VPX codec failed to encode the frame.\n");
-        goto done;
-      }
-      else {
-        vpx_codec_iter_t iter = NULL;
-
-        while ((pkt = vpx_codec_get_cx_data(vpxCodec, &iter))) {
-          switch (pkt->kind) {
-          case VPX_CODEC_CX_FRAME_PKT:
-            SendRtpSample(rtpSocket, dest, srtpSession, (byte *)pkt->data.raw.buf, pkt->data.raw.sz, rtpSsrc, vp8Timestamp, &rtpSeqNum);
-            break;
-          default:
-            break;
-          }
-        }
-      }
-
+      const vpx_codec_cx_pkt_t* pkt;
+      vpx_enc_frame_flags_t flags = 0;
+
+      // A session that has just become ready can't display anything until it gets a keyframe so
+      // force one rather than waiting for the next scene cut or interval.
+      auto readySessions = sessions.GetReady();
+      for (auto& session : readySessions) {
+        if (session->FirstRtpAt == 0) {
+          flags |= VPX_EFLAG_FORCE_KF;
+          temporalPatternPosn = 0;      // Keyframes always start a new pattern in TL0.
+        }
+      }
+
+      if (VIDEO_ADAPTATION_ENABLED && !readySessions.empty()) {
+        // The lowest estimate of the sessions' browsers, they all get the same encode.
+        uint32_t bandwidthEstimate = 0;
+        for (auto& session : readySessions) {
+          uint32_t rembBitrate = session->RembBitrate;
+          if (rembBitrate != 0 && (bandwidthEstimate == 0 || rembBitrate < bandwidthEstimate)) {
+            bandwidthEstimate = rembBitrate;
+          }
+        }
+
+        adaptation.OnBandwidthEstimate(bandwidthEstimate / 1000);
+        adaptation.Update(SteadyClockMilliseconds());
+      }
+
+      if (readySessions.empty()) {
+        // No sessions to send to so don't spend CPU encoding. The next session to become ready gets a keyframe anyway.
+      }
+      else if (!adaptation.ShouldEncodeFrame((flags & VPX_EFLAG_FORCE_KF) != 0)) {
+        // Decimated to the adaptation step's frame rate.
+      }
+      else if (!frameScheduler.ShouldEncode(llVideoTimeStamp, (flags & VPX_EFLAG_FORCE_KF) != 0)) {
+        // The encoder has fallen behind real time. The temporal pattern carries on from the last encoded
+        // frame so the layer dependencies are unchanged.
+      }
+      else {
+        bool frameEncoded = false, keyFrameEncoded = false;
+        size_t frameBytes = 0;
+
+        // Analysed at the capture size so an adaptation step doesn't look like a scene cut. With intra refresh a cut is
+        // refreshed the same as any other frame.
+        if (sceneDetector.Analyse(frameData, OUTPUT_FRAME_WIDTH, (flags & VPX_EFLAG_FORCE_KF) != 0) != SceneKeyFrameReason::None &&
+          !VIDEO_INTRA_REFRESH) {
+          flags |= VPX_EFLAG_FORCE_KF;
+          temporalPatternPosn = 0;
+        }
+
+        // A new adaptation step is applied with a keyframe, the browser needs one for the resolution change. It waits
+        // for the next one, forced for a new session or by the scene change detector, rather than adding one unless
+        // the scene is static and the next one could be seconds away.
+        if (adaptation.HasPendingStep() && ((flags & VPX_EFLAG_FORCE_KF) || framesSinceKeyFrame + 1 >= VIDEO_KEY_FRAME_INTERVAL)) {
+          const VideoAdaptationStep& step = adaptation.ApplyPendingStep(SteadyClockMilliseconds());
+
+          vpxConfig.g_w = step.Width;
+          vpxConfig.g_h = step.Height;
+
+          if (VIDEO_CODEC_VP9) {
+            SetVp9SvcEncoderProfileConfig(vp9Profile, step.BitrateKbps, &vpxConfig);
+            for (unsigned int sl = 0; sl < vp9Profile.SpatialLayers; sl++) {
+              unsigned int layerWidth = 0, layerHeight = 0;
+              GetVp9SvcLayerSize(vp9Profile, step.Width, step.Height, sl, &layerWidth, &layerHeight);
+              vp9Descriptor.Widths[sl] = layerWidth;
+              vp9Descriptor.Heights[sl] = layerHeight;
+            }
+          }
+          else {
+            vpxConfig.rc_target_bitrate = step.BitrateKbps;
+            SetVp8TemporalLayerBitrates(step.BitrateKbps, &vpxConfig);
+          }
+
+          // The encoder can go down from, and back up to, the size it was initialised with without being recreated.
+          if (vpx_codec_enc_config_set(vpxCodec, &vpxConfig)) {
+            printf("Failed to reconfigure libvpx encoder for %ux%u: %s\n", step.Width, step.Height, vpx_codec_error(vpxCodec));
+            goto done;
+          }
+
+          frameScheduler.SetFrameRate(step.FrameRate);
+          flags |= VPX_EFLAG_FORCE_KF;
+          temporalPatternPosn = 0;
+        }
+
+        if (adaptation.GetStep().Width != OUTPUT_FRAME_WIDTH || adaptation.GetStep().Height != OUTPUT_FRAME_HEIGHT) {
+          // Bilinear rather than ScaleI420's box filter so the lower steps don't alias, the tables are only rebuilt when the step changes.
+          scaler.Scale(GetColourImage(ColourFormat::I420, frameData, OUTPUT_FRAME_WIDTH, OUTPUT_FRAME_HEIGHT),
+            GetColourImage(ColourFormat::I420, scaledFrame.data(), adaptation.GetStep().Width, adaptation.GetStep().Height));
+          vpx_img_wrap(rawImage, VPX_IMG_FMT_I420, adaptation.GetStep().Width, adaptation.GetStep().Height, 1, scaledFrame.data());
+        }
+
+        if (!VIDEO_CODEC_VP9) {
+          // The VP9 encoder applies its own 0-2-1-2 pattern from temporal_layering_mode.
+          flags |= VP8_TEMPORAL_LAYER_FLAGS[temporalPatternPosn];
+          vpx_codec_control(vpxCodec, VP8E_SET_TEMPORAL_LAYER_ID, VP8_TEMPORAL_LAYER_IDS[temporalPatternPosn]);
+        }
+
+        auto encodeStart = std::chrono::steady_clock::now();
+
+        if (vpx_codec_encode(vpxCodec, rawImage, sampleCount, 1, flags, VPX_DL_REALTIME)) {
+          printf("VPX codec failed to encode the frame.\n");
+          goto done;
+        }
+
+        double encodeMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - encodeStart).count();
+
+        vpx_codec_iter_t iter = NULL;
+
+        while ((pkt = vpx_codec_get_cx_data(vpxCodec, &iter))) {
+          switch (pkt->kind) {
+          case VPX_CODEC_CX_FRAME_PKT:
+          {
+            frameEncoded = true;
+            keyFrameEncoded = keyFrameEncoded || (pkt->data.frame.flags & VPX_FRAME_IS_KEY) != 0;
+            frameBytes += pkt->data.frame.sz;
+
+            if (VIDEO_CODEC_VP9) {
+              // The whole superframe, every spatial layer, comes out as one packet.
+              vpx_svc_layer_id_t layerId;
+              memset(&layerId, 0, sizeof(layerId));
+              vpx_codec_control(vpxCodec, VP9E_GET_SVC_LAYER_ID, &layerId);
+
+              vp9Descriptor.TemporalLayerID = layerId.temporal_layer_id;
+              vp9Descriptor.SwitchingUpPoint = (layerId.temporal_layer_id == 1 ||
+                (layerId.temporal_layer_id == 2 && vp9PreviousTemporalLayer == 0)) ? 1 : 0;
+              vp9PreviousTemporalLayer = layerId.temporal_layer_id;
+
+              SendVp9Superframe(rtpSocket, readySessions, pkt, vp9Descriptor, rtpSsrc, vp8Timestamp);
+              break;
+            }
+
+            // Each partition arrives as a separate packet, the first partition has the modes and motion vectors
+            // and the rest are the token partitions. All but the last are flagged as fragments.
+            bool isFirstPartition = pkt->data.frame.partition_id <= 0;
+            bool isLastPartition = (pkt->data.frame.flags & VPX_FRAME_IS_FRAGMENT) == 0;
+
+            if (isFirstPartition) {
+              bool isKeyFrame = (pkt->data.frame.flags & VPX_FRAME_IS_KEY) != 0;
+
+              if (isKeyFrame) {
+                // libvpx can also decide to insert a keyframe, the pattern restarts from it.
+                temporalPatternPosn = 0;
+              }
+
+              int temporalLayerId = VP8_TEMPORAL_LAYER_IDS[temporalPatternPosn];
+              if (temporalLayerId == 0) {
+                vp8Descriptor.TL0PicIdx++;
+              }
+              vp8Descriptor.TemporalLayerID = temporalLayerId;
+              vp8Descriptor.LayerSync = (temporalLayerId <= 1) ? 1 : 0;
+              vp8Descriptor.NonReference = (pkt->data.frame.flags & VPX_FRAME_IS_DROPPABLE) ? 1 : 0;
+
+              // Decide which sessions get the frame once so they get all of its partitions.
+              frameSessions.clear();
+              for (auto& session : readySessions) {
+                if (temporalLayerId > session->MaxTemporalLayer) {
+                  continue;     // Dropped without re-encoding, the session's RTP sequence numbers stay contiguous.
+                }
+                else if (session->FirstRtpAt == 0 && !isKeyFrame) {
+                  continue;     // Nothing for the browser to decode against until it has a keyframe.
+                }
+                frameSessions.push_back(session);
+              }
+            }
+
+            // The partition is sent before the next one is pulled from the encoder.
+            vp8Descriptor.PartitionIndex = (pkt->data.frame.partition_id > 0) ? pkt->data.frame.partition_id : 0;
+            for (auto& session : frameSessions) {
+              SendRtpSample(rtpSocket, *session, (byte*)pkt->data.frame.buf, pkt->data.frame.sz, rtpSsrc, vp8Timestamp, vp8Descriptor, isLastPartition);
+            }
+
+            if (isLastPartition) {
+              for (auto& session : frameSessions) {
+                if (session->FirstRtpAt == 0) {
+                  session->FirstRtpAt = SteadyClockMilliseconds();
+                  session->PrintSetupTimes();
+                }
+              }
+
+              frameSessions.clear();
+              vp8Descriptor.PictureID = (vp8Descriptor.PictureID + 1) & 0x7fff;
+            }
+            break;
+          }
+          default:
+            break;
+          }
+        }
+
+        temporalPatternPosn = (temporalPatternPosn + 1) % VP8_TEMPORAL_PATTERN_LENGTH;
+
+        if (frameEncoded) {
+          frameScheduler.OnFrameSent(llVideoTimeStamp);
+          framesSinceKeyFrame = keyFrameEncoded ? 0 : framesSinceKeyFrame + 1;
+        }
+        frameScheduler.OnFrameEncoded();
+        adaptation.OnFrameEncoded(encodeMs, frameBytes);
+
+        if (frameScheduler.GetStats().Encoded % VIDEO_STATS_INTERVAL_FRAMES == 0) {
+          PrintFrameDeadlineStats(frameScheduler.GetStats());
+
+          const SceneChangeStats& sceneStats = sceneDetector.GetStats();
+          printf("Key frames forced %zu, scene cuts %zu, interval %zu, static frames %zu of %zu.\n", sceneStats.ForcedKeyFrames,
+            sceneStats.SceneCuts, sceneStats.IntervalKeyFrames, sceneStats.StaticFrames, sceneStats.Frames);
+        }
+      }
+
       vpx_img_free(img);
 
       CHECK_HR(buf->Unlock(),
@@ -897,6 +3087,8 @@ int StreamWebcam(SOCKET rtpSocket, sockaddr_in& dest, srtp_t* srtpSession)
 
 done:
 
+  PrintFrameDeadlineStats(frameScheduler.GetStats());
+
   printf("finished.\n");
   auto c = getchar();
 
@@ -912,58 +3104,444 @@ done:
   return 0;
 }
 
-HRESULT SendRtpSample(SOCKET socket, sockaddr_in& dst, srtp_t* srtpSession, byte* frameData, size_t frameLength, uint32_t ssrc, uint32_t timestamp, uint16_t* seqNum)
-{
-  HRESULT hr = S_OK;
-
-  uint16_t pktSeqNum = *seqNum;
-
-  for (UINT offset = 0; offset < frameLength;)
-  {
-    bool isLast = ((offset + RTP_MAX_PAYLOAD) >= frameLength); // Note can be first and last packet at same time if a small frame.
-    UINT payloadLength = !isLast ? RTP_MAX_PAYLOAD : frameLength - offset;
-
-    RtpHeader rtpHeader;
-    rtpHeader.SyncSource = ssrc;
-    rtpHeader.SeqNum = pktSeqNum++;
-    rtpHeader.Timestamp = timestamp;
-    rtpHeader.MarkerBit = (isLast) ? 1 : 0;    // Marker bit gets set on last packet in frame.
-    rtpHeader.PayloadType = RTP_PAYLOAD_ID;
-
-    uint8_t* hdrSerialised = NULL;
-    rtpHeader.Serialise(&hdrSerialised);
-
-    int rtpPacketSize = RTP_HEADER_LENGTH + VP8_RTP_HEADER_LENGTH + payloadLength;
-    int srtpPacketSize = rtpPacketSize + SRTP_AUTH_KEY_LENGTH;
-    uint8_t* rtpPacket = (uint8_t*)malloc(srtpPacketSize);
-    memcpy_s(rtpPacket, rtpPacketSize, hdrSerialised, RTP_HEADER_LENGTH);
-    rtpPacket[RTP_HEADER_LENGTH] = (offset == 0) ? 0x10 : 0x00 ; // Set the VP8 header byte.
-    memcpy_s(&rtpPacket[RTP_HEADER_LENGTH + VP8_RTP_HEADER_LENGTH], payloadLength, &frameData[offset], payloadLength);
-
-    //printf("Sending RTP packet, length %d.\n", rtpPacketSize);
-
-    auto protRes = srtp_protect(*srtpSession, rtpPacket, &rtpPacketSize);
-    if (protRes != srtp_err_status_ok) {
-      printf("SRTP protect failed with error code %d.\n", protRes);
-      hr = E_FAIL;
-      break;
-    }
-
-    sendto(socket, (const char*)rtpPacket, srtpPacketSize, 0, (sockaddr*)&dst, sizeof(dst));
-
-    offset += payloadLength;
-
-    free(hdrSerialised);
-    free(rtpPacket);
+/**
+* Sets the bitrates of the VP8 temporal layers, they're cumulative so each one
+* includes the layers below it.
+* @param[in] targetBitrateKbps: the bitrate of the whole stream.
+* @param[out] pConfig: the encoder configuration to set the layer bitrates on.
+*/
+void SetVp8TemporalLayerBitrates(unsigned int targetBitrateKbps, vpx_codec_enc_cfg_t* pConfig)
+{
+  pConfig->ts_target_bitrate[0] = targetBitrateKbps * 40 / 100;
+  pConfig->ts_target_bitrate[1] = targetBitrateKbps * 60 / 100;
+  pConfig->ts_target_bitrate[2] = targetBitrateKbps;
+}
+
+/**
+* Packetises a VP8 partition, or a whole frame, into RTP packets and sends them
+* to a session.
+* @param[in] isEndOfFrame: true if this is the last partition of the frame, the
+*  marker bit is set on its last packet.
+*/
+HRESULT SendRtpSample(SOCKET socket, WebRtcSession& session, byte* frameData, size_t frameLength, uint32_t ssrc, uint32_t timestamp, Vp8PayloadDescriptor& descriptor, bool isEndOfFrame)
+{
+  HRESULT hr = S_OK;
+
+  for (UINT offset = 0; offset < frameLength;)
+  {
+    bool isLast = ((offset + RTP_MAX_PAYLOAD) >= frameLength); // Note can be first and last packet at same time if a small frame.
+    UINT payloadLength = !isLast ? RTP_MAX_PAYLOAD : frameLength - offset;
+
+    RtpHeader rtpHeader;
+    rtpHeader.SyncSource = ssrc;
+    rtpHeader.SeqNum = session.RtpSeqNum++;
+    rtpHeader.Timestamp = timestamp;
+    rtpHeader.MarkerBit = (isLast && isEndOfFrame) ? 1 : 0;    // Marker bit gets set on last packet in frame.
+    rtpHeader.PayloadType = session.VideoPayloadType;
+
+    uint8_t descriptorSerialised[VP8_RTP_HEADER_LENGTH];
+    descriptor.StartOfPartition = (offset == 0) ? 1 : 0;
+    descriptor.Serialise(descriptorSerialised);
+
+    hr = SendRtpPacket(socket, session, rtpHeader, descriptorSerialised, VP8_RTP_HEADER_LENGTH, &frameData[offset], payloadLength, session.VideoStats);
+
+    offset += payloadLength;
+
+    if (hr != S_OK) {
+      break;
+    }
   }
 
-done:
+  return hr;
+}
+
+/**
+* Packetises a single VP9 layer frame into RTP packets and sends them to a session.
+* @param[in] isEndOfPicture: true if this is the highest spatial layer the session
+*  gets from the superframe, the marker bit is set on its last packet.
+*/
+HRESULT SendVp9RtpSample(SOCKET socket, WebRtcSession& session, const byte* frameData, size_t frameLength, uint32_t ssrc, uint32_t timestamp, Vp9PayloadDescriptor& descriptor, bool isEndOfPicture)
+{
+  HRESULT hr = S_OK;
+  uint8_t includeScalabilityStructure = descriptor.ScalabilityStructure;
+
+  for (UINT offset = 0; offset < frameLength;)
+  {
+    bool isLast = ((offset + RTP_MAX_PAYLOAD) >= frameLength);
+    UINT payloadLength = !isLast ? RTP_MAX_PAYLOAD : frameLength - offset;
+
+    RtpHeader rtpHeader;
+    rtpHeader.SyncSource = ssrc;
+    rtpHeader.SeqNum = session.RtpSeqNum++;
+    rtpHeader.Timestamp = timestamp;
+    rtpHeader.MarkerBit = (isLast && isEndOfPicture) ? 1 : 0;
+    rtpHeader.PayloadType = session.VideoPayloadType;
+
+    uint8_t descriptorSerialised[Vp9PayloadDescriptor::MAX_LENGTH];
+    descriptor.StartOfFrame = (offset == 0) ? 1 : 0;
+    descriptor.EndOfFrame = isLast ? 1 : 0;
+    descriptor.ScalabilityStructure = (offset == 0) ? includeScalabilityStructure : 0;   // Only needed in the first packet.
+    int descriptorLength = descriptor.Serialise(descriptorSerialised);
+
+    hr = SendRtpPacket(socket, session, rtpHeader, descriptorSerialised, descriptorLength, &frameData[offset], payloadLength, session.VideoStats);
+
+    offset += payloadLength;
+
+    if (hr != S_OK) {
+      break;
+    }
+  }
+
+  descriptor.ScalabilityStructure = includeScalabilityStructure;
+
+  return hr;
+}
+
+/**
+* Assembles an RTP packet from its header, payload descriptor and payload then
+* SRTP protects it and sends it to a session.
+* @param[in] descriptor: the payload descriptor, or the header extension if the
+*  header's extension flag is set, that goes between the RTP header and payload.
+* @param[in] stats: the session's stats for the stream the packet is on.
+*/
+HRESULT SendRtpPacket(SOCKET socket, WebRtcSession& session, RtpHeader& rtpHeader, const uint8_t* descriptor, int descriptorLength, const uint8_t* payload, size_t payloadLength,
+  RtpSenderStats& stats)
+{
+  HRESULT hr = S_OK;
 
-  *seqNum = pktSeqNum;
+  uint8_t* hdrSerialised = NULL;
+  rtpHeader.Serialise(&hdrSerialised);
+
+  int rtpPacketSize = RTP_HEADER_LENGTH + descriptorLength + (int)payloadLength;
+  int srtpPacketSize = rtpPacketSize + SRTP_AUTH_KEY_LENGTH;
+  uint8_t* rtpPacket = (uint8_t*)malloc(srtpPacketSize);
+  memcpy_s(rtpPacket, rtpPacketSize, hdrSerialised, RTP_HEADER_LENGTH);
+  memcpy_s(&rtpPacket[RTP_HEADER_LENGTH], descriptorLength, descriptor, descriptorLength);
+  memcpy_s(&rtpPacket[RTP_HEADER_LENGTH + descriptorLength], payloadLength, payload, payloadLength);
+
+  //printf("Sending RTP packet, length %d.\n", rtpPacketSize);
+
+  srtp_err_status_t protRes;
+  {
+    std::lock_guard<std::mutex> srtpLock(session.SrtpLock);
+
+    protRes = srtp_protect(session.SrtpSession, rtpPacket, &rtpPacketSize);
+    if (protRes == srtp_err_status_ok) {
+      stats.PacketCount++;
+      stats.OctetCount += (uint32_t)payloadLength + (rtpHeader.HeaderExtensionFlag ? 0 : descriptorLength);
+    }
+  }
+
+  if (protRes != srtp_err_status_ok) {
+    printf("SRTP protect failed with error code %d.\n", protRes);
+    hr = E_FAIL;
+  }
+  else {
+    sockaddr_in remoteEndPoint = session.GetRemoteEndPoint();
+    sendto(socket, (const char*)rtpPacket, srtpPacketSize, 0, (sockaddr*)&remoteEndPoint, sizeof(remoteEndPoint));
+  }
+
+  free(hdrSerialised);
+  free(rtpPacket);
 
   return hr;
 }
 
+/**
+* Sends a VP9 SVC superframe to the ready sessions. Each session gets the spatial
+* layers up to its MaxSpatialLayer, so 180p, 360p and 720p receivers are all
+* served from the one encode, and superframes from temporal layers above its
+* MaxTemporalLayer are dropped completely.
+* @param[in] pkt: the encoder output, a superframe with a frame per spatial layer.
+* @param[in] descriptor: the payload descriptor with the temporal layer and
+*  switching up point already set for the superframe.
+*/
+void SendVp9Superframe(SOCKET rtpSocket, std::vector<std::shared_ptr<WebRtcSession>>& readySessions, const vpx_codec_cx_pkt_t* pkt,
+  Vp9PayloadDescriptor& descriptor, uint32_t ssrc, uint32_t timestamp)
+{
+  bool isKeyFrame = (pkt->data.frame.flags & VPX_FRAME_IS_KEY) != 0;
+  auto layerFrames = ParseVp9Superframe((const uint8_t*)pkt->data.frame.buf, pkt->data.frame.sz);
+
+  if (layerFrames.empty()) {
+    return;
+  }
+
+  if (descriptor.TemporalLayerID == 0) {
+    descriptor.TL0PicIdx++;
+  }
+
+  uint8_t topSpatialLayer = (uint8_t)(layerFrames.size() - 1);
+
+  for (auto& session : readySessions) {
+    if (descriptor.TemporalLayerID > session->MaxTemporalLayer) {
+      continue;
+    }
+    else if (session->FirstRtpAt == 0 && !isKeyFrame) {
+      continue;
+    }
+
+    uint8_t sessionTopLayer = std::min(topSpatialLayer, session->MaxSpatialLayer);
+
+    for (uint8_t sl = 0; sl <= sessionTopLayer; sl++) {
+      descriptor.SpatialLayerID = sl;
+      descriptor.InterPicturePredicted = isKeyFrame ? 0 : 1;
+      descriptor.InterLayerDependency = (sl > 0) ? 1 : 0;
+      descriptor.NotUpperReference = (sl == topSpatialLayer) ? 1 : 0;
+      descriptor.ScalabilityStructure = (isKeyFrame && sl == 0) ? 1 : 0;
+
+      SendVp9RtpSample(rtpSocket, *session, layerFrames[sl].first, layerFrames[sl].second, ssrc, timestamp, descriptor, sl == sessionTopLayer);
+    }
+
+    if (session->FirstRtpAt == 0) {
+      session->FirstRtpAt = SteadyClockMilliseconds();
+      session->PrintSetupTimes();
+    }
+  }
+
+  descriptor.PictureID = (descriptor.PictureID + 1) & 0x7fff;
+}
+
+/**
+* Captures PCM audio from a microphone, encodes it with Opus in 20ms frames and
+* sends it to the ready sessions. The packets go on the same socket and SRTP
+* contexts as the video but under their own SSRC, with in-band FEC so a lost
+* packet can be recovered from the one after it, and DTX so almost nothing is
+* sent during silence. Runs on its own thread until the exit flag is set.
+*/
+int StreamMicrophone(SOCKET rtpSocket, SessionTable& sessions, RtpTimestampClock& audioClock, std::atomic<bool>& exit)
+{
+  IMFMediaSource* pAudioSource = NULL;
+  IMFSourceReader* pAudioReader = NULL;
+  IMFMediaType* pSrcOutMediaType = NULL;
+  OpusEncoder* pOpusEncoder = nullptr;
+  int opusErr = OPUS_OK;
+  std::vector<int16_t> pcmBuffer;
+  uint8_t opusFrame[OPUS_MAX_PACKET_LENGTH];
+  uint32_t audioTimestamp = 0;
+  bool isTalkspurtStart = true;
+  const size_t frameSamples = OPUS_FRAME_SAMPLES * OPUS_CHANNELS;
+
+  CHECK_HR(MFStartup(MF_VERSION),
+    "Media Foundation initialisation failed.");
+
+  CHECK_HR(GetSourceFromCaptureDevice(DeviceType::Audio, AUDIO_CAPTURE_DEVICE_INDEX, &pAudioSource, &pAudioReader),
+    "Failed to get microphone audio source.");
+
+  // The source reader converts from the microphone's native format if it's different.
+  CHECK_HR(MFCreateMediaType(&pSrcOutMediaType), "Failed to create audio media type.");
+  CHECK_HR(pSrcOutMediaType->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Audio), "Failed to set major audio type.");
+  CHECK_HR(pSrcOutMediaType->SetGUID(MF_MT_SUBTYPE, MFAudioFormat_PCM), "Failed to set audio sub type to PCM.");
+  CHECK_HR(pSrcOutMediaType->SetUINT32(MF_MT_AUDIO_NUM_CHANNELS, OPUS_CHANNELS), "Failed to set audio channels.");
+  CHECK_HR(pSrcOutMediaType->SetUINT32(MF_MT_AUDIO_SAMPLES_PER_SECOND, OPUS_SAMPLE_RATE), "Failed to set audio sample rate.");
+  CHECK_HR(pSrcOutMediaType->SetUINT32(MF_MT_AUDIO_BITS_PER_SAMPLE, 16), "Failed to set audio bits per sample.");
+  CHECK_HR(pSrcOutMediaType->SetUINT32(MF_MT_AUDIO_BLOCK_ALIGNMENT, OPUS_CHANNELS * 2), "Failed to set audio block alignment.");
+  CHECK_HR(pSrcOutMediaType->SetUINT32(MF_MT_AUDIO_AVG_BYTES_PER_SECOND, OPUS_SAMPLE_RATE * OPUS_CHANNELS * 2), "Failed to set audio bytes per second.");
+
+  CHECK_HR(pAudioReader->SetCurrentMediaType(MF_SOURCE_READER_FIRST_AUDIO_STREAM, NULL, pSrcOutMediaType),
+    "Failed to set PCM media type on microphone source reader.");
+
+  pOpusEncoder = opus_encoder_create(OPUS_SAMPLE_RATE, OPUS_CHANNELS, OPUS_APPLICATION_VOIP, &opusErr);
+  if (opusErr != OPUS_OK) {
+    printf("Failed to create Opus encoder: %s\n", opus_strerror(opusErr));
+    goto done;
+  }
+
+  opus_encoder_ctl(pOpusEncoder, OPUS_SET_BITRATE(OPUS_BITRATE));
+  opus_encoder_ctl(pOpusEncoder, OPUS_SET_SIGNAL(OPUS_SIGNAL_VOICE));
+  opus_encoder_ctl(pOpusEncoder, OPUS_SET_INBAND_FEC(1));
+  opus_encoder_ctl(pOpusEncoder, OPUS_SET_PACKET_LOSS_PERC(OPUS_EXPECTED_PACKET_LOSS_PERCENT));
+  opus_encoder_ctl(pOpusEncoder, OPUS_SET_DTX(1));
+
+  printf("Reading audio samples from microphone.\n");
+
+  while (!exit)
+  {
+    IMFSample* pAudioSample = NULL;
+    DWORD streamIndex = 0, flags = 0;
+    LONGLONG llAudioTimeStamp = 0;
+
+    CHECK_HR(pAudioReader->ReadSample(
+      MF_SOURCE_READER_FIRST_AUDIO_STREAM,
+      0,                              // Flags.
+      &streamIndex,                   // Receives the actual stream index.
+      &flags,                         // Receives status flags.
+      &llAudioTimeStamp,              // Receives the time stamp.
+      &pAudioSample                   // Receives the sample or NULL.
+    ), "Error reading audio sample.");
+
+    int64_t readAt = SteadyClockMilliseconds();
+
+    if (pAudioSample)
+    {
+      IMFMediaBuffer* buf = NULL;
+      byte* pcmData = NULL;
+      DWORD pcmLength = 0;
+
+      CHECK_HR(pAudioSample->ConvertToContiguousBuffer(&buf),
+        "ConvertToContiguousBuffer failed.");
+
+      CHECK_HR(buf->Lock(&pcmData, NULL, &pcmLength),
+        "Failed to lock audio sample buffer.");
+
+      pcmBuffer.insert(pcmBuffer.end(), (int16_t*)pcmData, (int16_t*)(pcmData + pcmLength));
+
+      CHECK_HR(buf->Unlock(),
+        "Failed to unlock audio sample buffer.");
+
+      SAFE_RELEASE(buf);
+      SAFE_RELEASE(pAudioSample);
+    }
+
+    // The capture buffers don't line up with the 20ms Opus frames so PCM is carried over between reads.
+    size_t consumed = 0;
+    while (pcmBuffer.size() - consumed >= frameSamples) {
+      const int16_t* pcmFrame = pcmBuffer.data() + consumed;
+
+      // The last buffered sample was captured as the read returned, count back from it to the start of the frame.
+      int64_t capturedAt = readAt - (int64_t)((pcmBuffer.size() - consumed) / OPUS_CHANNELS * 1000 / OPUS_SAMPLE_RATE);
+
+      int encodedLength = opus_encode(pOpusEncoder, pcmFrame, OPUS_FRAME_SAMPLES, opusFrame, sizeof(opusFrame));
+      if (encodedLength < 0) {
+        printf("Opus encode failed: %s\n", opus_strerror(encodedLength));
+        goto done;
+      }
+
+      audioClock.Set(audioTimestamp, capturedAt);
+
+      if (encodedLength <= OPUS_DTX_FRAME_MAX_LENGTH) {
+        // Silence, nothing is sent and the browser plays comfort noise until the next packet.
+        isTalkspurtStart = true;
+      }
+      else {
+        RtpAudioLevelExtension audioLevel;
+        audioLevel.VoiceActivity = 1;
+        audioLevel.Level = GetAudioLevel(pcmFrame, frameSamples);
+
+        uint8_t audioLevelSerialised[RTP_AUDIO_LEVEL_EXTENSION_LENGTH];
+
+        for (auto& session : sessions.GetReady()) {
+          if (session->AudioPayloadType == 0) {
+            continue;     // The browser's offer didn't have Opus audio.
+          }
+
+          RtpHeader rtpHeader;
+          rtpHeader.SyncSource = OPUS_SSRC;
+          rtpHeader.SeqNum = session->AudioRtpSeqNum++;
+          rtpHeader.Timestamp = audioTimestamp;
+          rtpHeader.MarkerBit = isTalkspurtStart ? 1 : 0;   // First packet after silence.
+          rtpHeader.PayloadType = session->AudioPayloadType;
+
+          // Each browser picks its own extmap ID, without one the extension isn't sent.
+          int audioLevelLength = 0;
+          if (session->AudioLevelExtensionID != 0) {
+            audioLevel.ID = session->AudioLevelExtensionID;
+            audioLevel.Serialise(audioLevelSerialised);
+            audioLevelLength = RTP_AUDIO_LEVEL_EXTENSION_LENGTH;
+            rtpHeader.HeaderExtensionFlag = 1;
+          }
+
+          SendRtpPacket(rtpSocket, *session, rtpHeader, audioLevelSerialised, audioLevelLength, opusFrame, encodedLength, session->AudioStats);
+        }
+
+        isTalkspurtStart = false;
+      }
+
+      // The RTP clock keeps running through DTX gaps.
+      audioTimestamp += OPUS_FRAME_SAMPLES;
+      consumed += frameSamples;
+    }
+
+    pcmBuffer.erase(pcmBuffer.begin(), pcmBuffer.begin() + consumed);
+  }
+
+done:
+
+  printf("Microphone streaming finished.\n");
+
+  if (pOpusEncoder != nullptr) {
+    opus_encoder_destroy(pOpusEncoder);
+  }
+
+  SAFE_RELEASE(pAudioSource);
+  SAFE_RELEASE(pAudioReader);
+  SAFE_RELEASE(pSrcOutMediaType);
+
+  return 0;
+}
+
+/**
+* Gets the level of a frame of PCM audio for the RFC6464 audio level extension.
+* @param[in] pcm: the 16 bit PCM samples.
+* @param[in] sampleCount: the number of samples.
+* @@Returns The level in -dBov, from 0 for full scale to 127 for silence.
+*/
+uint8_t GetAudioLevel(const int16_t* pcm, size_t sampleCount)
+{
+  double sumSquares = 0;
+  for (size_t i = 0; i < sampleCount; i++) {
+    sumSquares += (double)pcm[i] * pcm[i];
+  }
+
+  double rms = std::sqrt(sumSquares / sampleCount) / 32768.0;
+  if (rms <= 0) {
+    return 127;
+  }
+
+  long level = std::lround(-20.0 * std::log10(rms));
+  return (uint8_t)std::min<long>(std::max<long>(level, 0), 127);
+}
+
+/**
+* Sends a compound RTCP packet, a sender report and the CNAME, for each stream
+* that has had packets sent to the session. The RTP timestamps in the reports
+* are for the same instant as the NTP timestamp which is what lets the browser
+* synchronise the audio and video playout.
+*/
+void SendRtcpSenderReports(SOCKET rtpSocket, WebRtcSession& session, RtpTimestampClock& videoClock, RtpTimestampClock& audioClock)
+{
+  struct StreamReport { uint32_t Ssrc; RtpTimestampClock& Clock; RtpSenderStats& Stats; };
+  StreamReport streams[] = {
+    { RTP_SSRC, videoClock, session.VideoStats },
+    { OPUS_SSRC, audioClock, session.AudioStats },
+  };
+
+  for (auto& stream : streams) {
+    uint8_t rtcpPacket[RECEIVE_BUFFER_LENGTH];
+    RtcpSenderReport senderReport;
+    RtcpSdesCname sdes;
+
+    senderReport.SyncSource = stream.Ssrc;
+    senderReport.NtpTimestamp = GetNtpTimestamp();
+    if (!stream.Clock.GetTimestamp(SteadyClockMilliseconds(), &senderReport.RtpTimestamp)) {
+      continue;
+    }
+
+    sdes.SyncSource = stream.Ssrc;
+    sdes.CName = RTCP_CNAME;
+
+    std::lock_guard<std::mutex> srtpLock(session.SrtpLock);
+
+    if (stream.Stats.PacketCount == 0) {
+      continue;
+    }
+
+    senderReport.PacketCount = stream.Stats.PacketCount;
+    senderReport.OctetCount = stream.Stats.OctetCount;
+
+    int rtcpPacketSize = senderReport.Serialise(rtcpPacket);
+    rtcpPacketSize += sdes.Serialise(&rtcpPacket[rtcpPacketSize]);
+
+    auto protRes = srtp_protect_rtcp(session.SrtpSession, rtcpPacket, &rtcpPacketSize);
+    if (protRes != srtp_err_status_ok) {
+      printf("SRTCP protect failed with error code %d.\n", protRes);
+    }
+    else {
+      sockaddr_in remoteEndPoint = session.GetRemoteEndPoint();
+      sendto(rtpSocket, (const char*)rtcpPacket, rtcpPacketSize, 0, (sockaddr*)&remoteEndPoint, sizeof(remoteEndPoint));
+    }
+  }
+}
+
 int verify_cookie(SSL* ssl, const unsigned char* cookie, unsigned int cookie_len)
 {
   // Accept any cookie.
@@ -6,13 +6,23 @@
 * stream from a webcam using Windows Media Foundation and streams it to a WebRTC
 * client.
 *
+* The H264 encoder output is packetised per NAL unit as specified in RFC6184
+* packetization-mode=1. Small NAL units such as the SPS and PPS are aggregated
+* into STAP-A packets and NAL units larger than the MTU are split into FU-A
+* fragments. The SPS and PPS are sent in front of every IDR frame, as browsers
+* can't start decoding without them, and the profile-level-id in the SDP offer
+* is taken from the encoder's SPS so it matches what is actually sent.
+*
 * Dependencies:
 * vcpkg install openssl libsrtp zlib
 *
 * To connect to the program the steps are:
-* 1. Start the program and then open the client.html file in a browser.
-*
-* Status: Chrome not able to decode H264 bitstream.
+* 1. Start the program, it prints the profile-level-id from the encoder's SPS.
+* 2. Open mfwebrtc.html in a browser with the profile-level-id as the URL
+*    fragment, e.g. mfwebrtc.html#profile-level-id=42e01f, which the program
+*    prints. The page puts it in the fmtp line of its SDP offer. Without the
+*    fragment the offer has 42e01f, the configured constrained baseline level
+*    3.1, and won't match an encoder that writes different SPS values.
 *
 * Author:
 * Aaron Clauson (aaron@sipsorcery.com)
@@ -45,12 +55,16 @@
 #include <openssl/bio.h>
 #include <openssl/srtp.h>
 #include <openssl/err.h>
+#include <openssl/pem.h>
+#include <openssl/x509.h>
 #include <zlib.h> // For CRC32.
 
 #include <exception>
 #include <iostream>
 #include <iterator>
+#include <string>
 #include <thread>
+#include <utility>
 #include <vector>
 
 #pragma comment(lib, "mf.lib")
@@ -70,7 +84,17 @@
 #define RTP_VERSION 2
 #define RTP_PAYLOAD_ID 96         // Needs to match the attribute set in the SDP (a=rtpmap:96 H264/90000).
 #define RTP_SSRC 337799
-#define H264_RTP_HEADER_LENGTH 2
+#define H264_PROFILE eAVEncH264VProfile_ConstrainedBase
+#define H264_LEVEL eAVEncH264VLevel3_1
+#define H264_KEYFRAME_SPACING 60      // Frames between IDRs, there's no keyframe request handling so this is how long a lost frame corrupts the picture.
+#define H264_NAL_TYPE_IDR 5
+#define H264_NAL_TYPE_SPS 7
+#define H264_NAL_TYPE_PPS 8
+#define H264_NAL_TYPE_AUD 9
+#define H264_NAL_TYPE_STAP_A 24
+#define H264_NAL_TYPE_FU_A 28
+#define H264_FU_A_HEADER_LENGTH 2     // FU indicator and FU header.
+#define H264_STAP_A_NAL_SIZE_LENGTH 2
 #define RTP_LISTEN_PORT 8888      // The port this sample will listen on for an RTP connection from a WebRTC client.
 #define DTLS_CERTIFICATE_FILE "localhost.pem"
 #define DTLS_KEY_FILE "localhost_key.pem"
@@ -78,17 +102,35 @@
 #define RECEIVE_BUFFER_LENGTH 4096
 #define SRTP_MASTER_KEY_KEY_LEN 16
 #define SRTP_MASTER_KEY_SALT_LEN 14
+#define ICE_USERNAME "EJYWWCUDJQLTXTNQRXEJ"                      // Must match the value in the SDP given to the client.
 #define ICE_PASSWORD "SKYKPPYLTZOAVCLTGHDUODANRKSPOVQVKXJULOGG" // Must match the value in the SDP given to the client.
 #define ICE_PASSWORD_LENGTH 40
 #define SRTP_AUTH_KEY_LENGTH 10
 
+/**
+* The parameter sets from the encoder. The most recent SPS and PPS are kept so
+* they can be sent in front of any IDR frame the encoder outputs without them.
+*/
+struct H264ParameterSets
+{
+  std::vector<uint8_t> Sps;
+  std::vector<uint8_t> Pps;
+  std::string ProfileLevelId;   // The profile-level-id advertised in the SDP offer.
+};
+
 // Forward function definitions.
-HRESULT SendH264RtpSample(SOCKET socket, sockaddr_in& dst, srtp_t* srtpSession, IMFSample* pH264Sample, uint32_t ssrc, uint32_t timestamp, uint16_t* seqNum);
+HRESULT CreateWebcamH264Encoder(IMFSourceReader** ppVideoReader, IMFTransform** ppEncoderTransform, H264ParameterSets& paramSets);
+HRESULT SendH264RtpSample(SOCKET socket, sockaddr_in& dst, srtp_t* srtpSession, IMFSample* pH264Sample, H264ParameterSets& paramSets, uint32_t ssrc, uint32_t timestamp, uint16_t* seqNum);
+std::vector<std::pair<const uint8_t*, size_t>> GetH264NalUnits(const uint8_t* data, size_t length);
+std::string GetH264ProfileLevelId(const uint8_t* sps, size_t spsLength);
+void UpdateH264ParameterSet(std::vector<uint8_t>& paramSet, const uint8_t* nal, size_t nalLength, H264ParameterSets& paramSets);
 void krx_ssl_info_callback(const SSL* ssl, int where, int ret);
 int verify_cookie(SSL* ssl, unsigned char* cookie, unsigned int cookie_len);
 int generate_cookie(SSL* ssl, unsigned char* cookie, unsigned int* cookie_len);
-int StreamWebcam(SOCKET rtpSocket, sockaddr_in& dest, srtp_t* srtpSession);
+int StreamWebcam(SOCKET rtpSocket, sockaddr_in& dest, srtp_t* srtpSession, IMFSourceReader* pVideoReader, IMFTransform* pEncoderTransfrom, H264ParameterSets& paramSets);
 void listenThread(SOCKET rtpSocket);
+std::string GetCertificateFingerprint(const char* certificateFile);
+void PrintSdpOffer(const std::string& fingerprint, const std::string& profileLevelId);
 
 #define SSL_WHERE_INFO(ssl, w, flag, msg) {                \
     if(w & flag) {                                         \
@@ -435,6 +477,11 @@ int main()
   srtp_policy_t* srtpPolicy = nullptr;
   srtp_t* srtpSession = nullptr;
 
+  // Media Foundation variables.
+  IMFSourceReader* pVideoReader = NULL;
+  IMFTransform* pEncoderTransfrom = NULL;
+  H264ParameterSets h264ParamSets;
+
   try {
 
     // Initialise Winsock
@@ -481,6 +528,12 @@ int main()
       wprintf(L"bind returned success\n");
     }
 
+    // The encoder is set up before the SDP offer is printed as the profile-level-id has to match its SPS.
+    CHECK_HR(CreateWebcamH264Encoder(&pVideoReader, &pEncoderTransfrom, h264ParamSets),
+      "Failed to create the webcam H264 encoder.");
+
+    PrintSdpOffer(GetCertificateFingerprint(DTLS_CERTIFICATE_FILE), h264ParamSets.ProfileLevelId);
+
     //----
     // STUN
     int recvResult = recvfrom(rtpSocket, (char*)recvBuffer, RECEIVE_BUFFER_LENGTH, 0, (sockaddr*)&clientAddr, &clientAddrLen);
@@ -574,7 +627,12 @@ int main()
     SSL_set_info_callback(ssl, krx_ssl_info_callback);    // info callback.
     SSL_set_accept_state(ssl);
 
-    DTLSv1_listen(ssl, &clientAddr);
+    {
+      // The client address is already known from STUN, the BIO_ADDR just needs to be valid for OpenSSL 1.1.
+      BIO_ADDR* dtlsClientAddr = BIO_ADDR_new();
+      DTLSv1_listen(ssl, dtlsClientAddr);
+      BIO_ADDR_free(dtlsClientAddr);
+    }
 
     printf("New DTLS client connection.\n");
 
@@ -639,7 +697,7 @@ int main()
     // Have to keep responding to STUN binding requests or the connection will be flagged as disconnected.
     std::thread t1(listenThread, rtpSocket);
 
-    StreamWebcam(rtpSocket, clientAddr, srtpSession);
+    StreamWebcam(rtpSocket, clientAddr, srtpSession, pVideoReader, pEncoderTransfrom, h264ParamSets);
 
     delete(srtpSession);
     delete(srtpPolicy);
@@ -654,6 +712,9 @@ done:
 
   printf("Cleanup.\n");
 
+  SAFE_RELEASE(pVideoReader);
+  SAFE_RELEASE(pEncoderTransfrom);
+
   // OpenSSL cleanup.
   if (ctx != nullptr) {
     SSL_CTX_free(ctx);
@@ -750,24 +811,29 @@ void listenThread(SOCKET rtpSocket)
   }
 }
 
-int StreamWebcam(SOCKET rtpSocket, sockaddr_in& dest, srtp_t* srtpSession)
+/**
+* Opens the webcam and creates the H264 encoder MFT that its samples are fed to.
+* The SPS and PPS are taken from the encoder's sequence header if it provides
+* one, otherwise they're picked up from the first IDR frame and the
+* profile-level-id for the SDP offer is built from the configured profile and level.
+* @param[out] ppVideoReader: the source reader for the webcam.
+* @param[out] ppEncoderTransform: the H264 encoder, ready to accept samples.
+* @param[out] paramSets: the encoder's parameter sets and profile-level-id.
+* @@Returns S_OK if successful or an error code if not.
+*/
+HRESULT CreateWebcamH264Encoder(IMFSourceReader** ppVideoReader, IMFTransform** ppEncoderTransform, H264ParameterSets& paramSets)
 {
   IMFMediaSource* pVideoSource = NULL;
   IMFSourceReader* pVideoReader = NULL;
-  WCHAR* webcamFriendlyName;
   IMFMediaType* pSrcOutMediaType = NULL;
   IUnknown* spEncoderTransfromUnk = NULL;
   IMFTransform* pEncoderTransfrom = NULL; // This is H264 Encoder MFT.
-  IMFMediaType* pMFTInputMediaType = NULL, * pMFTOutputMediaType = NULL;
-  UINT friendlyNameLength = 0;
-  IUnknown* spDecTransformUnk = NULL;
-  IMFTransform* pDecoderTransform = NULL; // This is H264 Decoder MFT.
-  IMFMediaType* pDecInputMediaType = NULL, * pDecOutputMediaType = NULL;
+  IMFMediaType* pMFTInputMediaType = NULL, * pMFTOutputMediaType = NULL, * pMFTCurrentOutputType = NULL;
+  IMFAttributes* pEncoderAttributes = NULL;
+  UINT8* pSequenceHeader = NULL;
+  UINT32 sequenceHeaderLength = 0;
   DWORD mftStatus = 0;
-
-  uint16_t rtpSsrc = RTP_SSRC; // Supposed to be pseudo-random.
-  uint16_t rtpSeqNum = 0;
-  uint32_t rtpTimestamp = 0;
+  HRESULT hr = E_FAIL;
 
   /*CHECK_HR(CoInitializeEx(NULL, COINIT_APARTMENTTHREADED | COINIT_DISABLE_OLE1DDE),
     "COM initialisation failed.");*/
@@ -800,6 +866,10 @@ int StreamWebcam(SOCKET rtpSocket, sockaddr_in& dest, srtp_t* srtpSession)
   CHECK_HR(spEncoderTransfromUnk->QueryInterface(IID_PPV_ARGS(&pEncoderTransfrom)),
     "Failed to get IMFTransform interface from H264 encoder MFT object.");
 
+  // Without low latency mode the encoder buffers frames before outputting them.
+  CHECK_HR(pEncoderTransfrom->GetAttributes(&pEncoderAttributes), "Failed to get H264 encoder MFT attributes.");
+  CHECK_HR(pEncoderAttributes->SetUINT32(MF_LOW_LATENCY, TRUE), "Failed to set low latency mode on H264 encoder MFT.");
+
   MFCreateMediaType(&pMFTInputMediaType);
   CHECK_HR(pSrcOutMediaType->CopyAllItems(pMFTInputMediaType), "Error copying media type attributes to decoder output media type.");
   CHECK_HR(pMFTInputMediaType->SetGUID(MF_MT_SUBTYPE, MFVideoFormat_IYUV), "Error setting video subtype.");
@@ -809,9 +879,9 @@ int StreamWebcam(SOCKET rtpSocket, sockaddr_in& dest, srtp_t* srtpSession)
   CHECK_HR(pMFTOutputMediaType->SetGUID(MF_MT_SUBTYPE, MFVideoFormat_H264), "Error setting video sub type.");
   CHECK_HR(pMFTOutputMediaType->SetUINT32(MF_MT_AVG_BITRATE, 240000), "Error setting average bit rate.");
   CHECK_HR(pMFTOutputMediaType->SetUINT32(MF_MT_INTERLACE_MODE, 2), "Error setting interlace mode.");
-  CHECK_HR(MFSetAttributeRatio(pMFTOutputMediaType, MF_MT_MPEG2_PROFILE, eAVEncH264VProfile_ConstrainedBase, 1), "Failed to set profile on H264 MFT out type.");
-  //CHECK_HR(pMFTOutputMediaType->SetDouble(MF_MT_MPEG2_LEVEL, 3.1), "Failed to set level on H264 MFT out type.\n");
-  //CHECK_HR(pMFTOutputMediaType->SetUINT32(MF_MT_MAX_KEYFRAME_SPACING, 10), "Failed to set key frame interval on H264 MFT out type.\n");
+  CHECK_HR(pMFTOutputMediaType->SetUINT32(MF_MT_MPEG2_PROFILE, H264_PROFILE), "Failed to set profile on H264 MFT out type.");
+  CHECK_HR(pMFTOutputMediaType->SetUINT32(MF_MT_MPEG2_LEVEL, H264_LEVEL), "Failed to set level on H264 MFT out type.");
+  CHECK_HR(pMFTOutputMediaType->SetUINT32(MF_MT_MAX_KEYFRAME_SPACING, H264_KEYFRAME_SPACING), "Failed to set key frame interval on H264 MFT out type.");
   //CHECK_HR(pMFTOutputMediaType->SetUINT32(CODECAPI_AVEncCommonQuality, 100), "Failed to set H264 codec quality.\n");
 
   std::cout << "H264 encoder output type: " << GetMediaTypeDescription(pMFTOutputMediaType) << std::endl;
@@ -830,17 +900,70 @@ int StreamWebcam(SOCKET rtpSocket, sockaddr_in& dest, srtp_t* srtpSession)
     goto done;
   }
 
+  // The sequence header is Annex B formatted, the same as the encoded samples.
+  CHECK_HR(pEncoderTransfrom->GetOutputCurrentType(0, &pMFTCurrentOutputType), "Failed to get the H264 encoder output type.");
+  if (pMFTCurrentOutputType->GetAllocatedBlob(MF_MT_MPEG_SEQUENCE_HEADER, &pSequenceHeader, &sequenceHeaderLength) == S_OK) {
+    for (auto& nal : GetH264NalUnits(pSequenceHeader, sequenceHeaderLength)) {
+      uint8_t nalType = nal.first[0] & 0x1f;
+      if (nalType == H264_NAL_TYPE_SPS) {
+        UpdateH264ParameterSet(paramSets.Sps, nal.first, nal.second, paramSets);
+      }
+      else if (nalType == H264_NAL_TYPE_PPS) {
+        UpdateH264ParameterSet(paramSets.Pps, nal.first, nal.second, paramSets);
+      }
+    }
+    CoTaskMemFree(pSequenceHeader);
+  }
+
+  if (!paramSets.Sps.empty()) {
+    paramSets.ProfileLevelId = GetH264ProfileLevelId(paramSets.Sps.data(), paramSets.Sps.size());
+  }
+  else {
+    // Constrained baseline is profile_idc 66 with constraint_set0, 1 and 2 flags, the level is 10 times the level number.
+    char profileLevelId[7];
+    snprintf(profileLevelId, sizeof(profileLevelId), "%02x%02x%02x",
+      66, (H264_PROFILE == eAVEncH264VProfile_ConstrainedBase) ? 0xe0 : 0x00, H264_LEVEL);
+    paramSets.ProfileLevelId = profileLevelId;
+    printf("H264 encoder didn't provide a sequence header, using profile-level-id %s from the configured profile and level.\n", profileLevelId);
+  }
+
   //CHECK_HR(pEncoderTransfrom->ProcessMessage(MFT_MESSAGE_COMMAND_FLUSH, NULL), "Failed to process FLUSH command on H.264 MFT.");
   CHECK_HR(pEncoderTransfrom->ProcessMessage(MFT_MESSAGE_NOTIFY_BEGIN_STREAMING, NULL), "Failed to process BEGIN_STREAMING command on H.264 MFT.");
   CHECK_HR(pEncoderTransfrom->ProcessMessage(MFT_MESSAGE_NOTIFY_START_OF_STREAM, NULL), "Failed to process START_OF_STREAM command on H.264 MFT.");
 
+  *ppVideoReader = pVideoReader;
+  *ppEncoderTransform = pEncoderTransfrom;
+  pVideoReader = NULL;
+  pEncoderTransfrom = NULL;
+  hr = S_OK;
+
+done:
+
+  SAFE_RELEASE(pVideoSource);
+  SAFE_RELEASE(pVideoReader);
+  SAFE_RELEASE(pSrcOutMediaType);
+  SAFE_RELEASE(spEncoderTransfromUnk);
+  SAFE_RELEASE(pEncoderTransfrom);
+  SAFE_RELEASE(pEncoderAttributes);
+  SAFE_RELEASE(pMFTInputMediaType);
+  SAFE_RELEASE(pMFTOutputMediaType);
+  SAFE_RELEASE(pMFTCurrentOutputType);
+
+  return hr;
+}
+
+int StreamWebcam(SOCKET rtpSocket, sockaddr_in& dest, srtp_t* srtpSession, IMFSourceReader* pVideoReader, IMFTransform* pEncoderTransfrom, H264ParameterSets& paramSets)
+{
+  uint32_t rtpSsrc = RTP_SSRC; // Supposed to be pseudo-random.
+  uint16_t rtpSeqNum = 0;
+
   // Ready to go.
 
   printf("Reading video samples from webcam.\n");
 
   IMFSample* pVideoSample = NULL, * pH264EncodeOutSample = NULL;
   DWORD streamIndex = 0, flags = 0, sampleFlags = 0;
-  LONGLONG llVideoTimeStamp, llSampleDuration;
+  LONGLONG llVideoTimeStamp, llSampleDuration, llEncodedTimeStamp;
   int sampleCount = 0;
   BOOL h264EncodeTransformFlushed = FALSE;
 
@@ -912,7 +1035,11 @@ int StreamWebcam(SOCKET rtpSocket, sockaddr_in& dest, srtp_t* srtpSession)
 
           //printf("H264 sample ready for transmission.\n");
 
-          SendH264RtpSample(rtpSocket, dest, srtpSession, pH264EncodeOutSample, rtpSsrc, (uint32_t)(llVideoTimeStamp / 10000), &rtpSeqNum);
+          // The encoder carries the capture time through to its output sample. The RTP timestamp is the 100ns
+          // sample time converted to the 90KHz video clock.
+          CHECK_HR(pH264EncodeOutSample->GetSampleTime(&llEncodedTimeStamp), "Error getting the H264 sample time.");
+
+          SendH264RtpSample(rtpSocket, dest, srtpSession, pH264EncodeOutSample, paramSets, rtpSsrc, (uint32_t)(llEncodedTimeStamp * 9 / 1000), &rtpSeqNum);
         }
 
         SAFE_RELEASE(pH264EncodeOutSample);
@@ -933,30 +1060,79 @@ done:
   printf("finished.\n");
   auto c = getchar();
 
-  SAFE_RELEASE(pVideoSource);
-  SAFE_RELEASE(pVideoReader);
-  SAFE_RELEASE(pSrcOutMediaType);
-  SAFE_RELEASE(spEncoderTransfromUnk);
-  SAFE_RELEASE(pEncoderTransfrom);
-  SAFE_RELEASE(pMFTInputMediaType);
-  SAFE_RELEASE(pMFTOutputMediaType);
+  SAFE_RELEASE(pVideoSample);
+  SAFE_RELEASE(pH264EncodeOutSample);
 
   WSACleanup();
 
   return 0;
 }
 
-HRESULT SendH264RtpSample(SOCKET socket, sockaddr_in& dst, srtp_t* srtpSession, IMFSample* pH264Sample, uint32_t ssrc, uint32_t timestamp, uint16_t* seqNum)
+/**
+* Sends an RTP packet protected with SRTP.
+* @param[in] socket: the socket to send on.
+* @param[in] dst: the remote WebRTC client.
+* @param[in] srtpSession: the SRTP session to protect the packet with.
+* @param[in] rtpHeader: the RTP header for the packet.
+* @param[in] payload: the RTP payload.
+* @param[in] payloadLength: the length of the RTP payload.
+* @@Returns S_OK if the packet was protected and sent or an error code if not.
+*/
+HRESULT SendSrtpPacket(SOCKET socket, sockaddr_in& dst, srtp_t* srtpSession, RtpHeader& rtpHeader, const uint8_t* payload, int payloadLength)
 {
-  static uint16_t h264HeaderStart = 0x1c89;   // Start RTP packet in frame 0x1c 0x89
-  static uint16_t h264HeaderMiddle = 0x1c09;  // Middle RTP packet in frame 0x1c 0x09
-  static uint16_t h264HeaderEnd = 0x1c49;     // Last RTP packet in frame 0x1c 0x49
+  HRESULT hr = S_OK;
+  uint8_t* hdrSerialised = NULL;
+  rtpHeader.Serialise(&hdrSerialised);
 
+  int rtpPacketSize = RTP_HEADER_LENGTH + payloadLength;
+  int srtpPacketSize = rtpPacketSize + SRTP_AUTH_KEY_LENGTH;
+  uint8_t* rtpPacket = (uint8_t*)malloc(srtpPacketSize);
+  memcpy_s(rtpPacket, srtpPacketSize, hdrSerialised, RTP_HEADER_LENGTH);
+  memcpy_s(&rtpPacket[RTP_HEADER_LENGTH], payloadLength, payload, payloadLength);
+
+  auto protRes = srtp_protect(*srtpSession, rtpPacket, &rtpPacketSize);
+  if (protRes != srtp_err_status_ok) {
+    printf("SRTP protect failed with error code %d.\n", protRes);
+    hr = E_FAIL;
+  }
+  else {
+    sendto(socket, (const char*)rtpPacket, rtpPacketSize, 0, (sockaddr*)&dst, sizeof(dst));
+  }
+
+  free(hdrSerialised);
+  free(rtpPacket);
+
+  return hr;
+}
+
+/**
+* Sends an H264 access unit from the encoder as RTP packets using RFC6184
+* packetization-mode=1. Consecutive NAL units that fit in one packet together are
+* sent as a STAP-A, a NAL unit that fits on its own is sent as a single NAL unit
+* packet and larger ones are fragmented into FU-A packets. The marker bit is set
+* on the last packet of the access unit.
+* @param[in] socket: the socket to send on.
+* @param[in] dst: the remote WebRTC client.
+* @param[in] srtpSession: the SRTP session to protect the packets with.
+* @param[in] pH264Sample: the encoder output sample with an Annex B access unit.
+* @param[in,out] paramSets: the most recent SPS and PPS, updated from the sample and
+*  inserted in front of an IDR frame that doesn't have its own.
+* @param[in] ssrc: the RTP synchronisation source.
+* @param[in] timestamp: the RTP timestamp for the access unit.
+* @param[in,out] seqNum: the next RTP sequence number, updated for the packets sent.
+* @@Returns S_OK if successful or an error code if not.
+*/
+HRESULT SendH264RtpSample(SOCKET socket, sockaddr_in& dst, srtp_t* srtpSession, IMFSample* pH264Sample, H264ParameterSets& paramSets, uint32_t ssrc, uint32_t timestamp, uint16_t* seqNum)
+{
   HRESULT hr = S_OK;
 
   IMFMediaBuffer* buf = NULL;
   DWORD frameLength = 0, buffCurrLen = 0, buffMaxLen = 0;
   byte* frameData = NULL;
+  std::vector<std::pair<const uint8_t*, size_t>> nals;
+  bool haveSps = false, havePps = false;
+  std::vector<uint8_t> payload;
+  uint16_t pktSeqNum = *seqNum;
 
   hr = pH264Sample->ConvertToContiguousBuffer(&buf);
   CHECK_HR(hr, "ConvertToContiguousBuffer failed.");
@@ -967,64 +1143,112 @@ HRESULT SendH264RtpSample(SOCKET socket, sockaddr_in& dst, srtp_t* srtpSession,
   hr = buf->Lock(&frameData, &buffMaxLen, &buffCurrLen);
   CHECK_HR(hr, "Failed to lock H264 sample buffer.");
 
-  uint16_t pktSeqNum = *seqNum;
+  for (auto& nal : GetH264NalUnits(frameData, frameLength)) {
+    uint8_t nalType = nal.first[0] & 0x1f;
 
-  for (UINT offset = 0; offset < frameLength;)
-  {
-    bool isLast = ((offset + RTP_MAX_PAYLOAD) >= frameLength); // Note can be first and last packet at same time if a small frame.
-    UINT payloadLength = !isLast ? RTP_MAX_PAYLOAD : frameLength - offset;
+    if (nalType == H264_NAL_TYPE_AUD) {
+      // The marker bit delimits access units in RTP.
+      continue;
+    }
+    else if (nalType == H264_NAL_TYPE_SPS) {
+      UpdateH264ParameterSet(paramSets.Sps, nal.first, nal.second, paramSets);
+      haveSps = true;
+    }
+    else if (nalType == H264_NAL_TYPE_PPS) {
+      UpdateH264ParameterSet(paramSets.Pps, nal.first, nal.second, paramSets);
+      havePps = true;
+    }
+    else if (nalType == H264_NAL_TYPE_IDR && (!haveSps || !havePps)) {
+      if (paramSets.Sps.empty() || paramSets.Pps.empty()) {
+        printf("No SPS and PPS available to send with the IDR frame.\n");
+      }
+      else {
+        if (!haveSps) {
+          nals.push_back(std::make_pair(paramSets.Sps.data(), paramSets.Sps.size()));
+        }
+        if (!havePps) {
+          nals.push_back(std::make_pair(paramSets.Pps.data(), paramSets.Pps.size()));
+        }
+        haveSps = havePps = true;
+      }
+    }
+
+    nals.push_back(nal);
+  }
+
+  for (size_t i = 0; i < nals.size() && hr == S_OK;) {
+    const uint8_t* nal = nals[i].first;
+    size_t nalLength = nals[i].second;
 
     RtpHeader rtpHeader;
     rtpHeader.SyncSource = ssrc;
-    rtpHeader.SeqNum = pktSeqNum++;
     rtpHeader.Timestamp = timestamp;
-    rtpHeader.MarkerBit = 0;    // Set on first and last packet in frame.
     rtpHeader.PayloadType = RTP_PAYLOAD_ID;
 
-    uint16_t h264Header = h264HeaderMiddle;
+    if (nalLength > RTP_MAX_PAYLOAD) {
+      // FU-A, section 5.8 RFC6184. The NAL header is replaced by the FU indicator, with the F and NRI bits, and the
+      // FU header, with the start and end bits and the NAL type.
+      for (size_t offset = 1; offset < nalLength && hr == S_OK;) {
+        size_t fragmentLength = (nalLength - offset > RTP_MAX_PAYLOAD - H264_FU_A_HEADER_LENGTH) ? RTP_MAX_PAYLOAD - H264_FU_A_HEADER_LENGTH : nalLength - offset;
+        bool isEnd = offset + fragmentLength == nalLength;
 
-    if (isLast)
-    {
-      // This is the First AND Last RTP packet in the frame.
-      h264Header = h264HeaderEnd;
-      rtpHeader.MarkerBit = 1;
-    }
-    else if (offset == 0)
-    {
-      h264Header = h264HeaderStart;
-      rtpHeader.MarkerBit = 1;
+        payload.clear();
+        payload.push_back((nal[0] & 0xe0) | H264_NAL_TYPE_FU_A);
+        payload.push_back(((offset == 1) ? 0x80 : 0x00) | (isEnd ? 0x40 : 0x00) | (nal[0] & 0x1f));
+        payload.insert(payload.end(), nal + offset, nal + offset + fragmentLength);
+
+        rtpHeader.SeqNum = pktSeqNum++;
+        rtpHeader.MarkerBit = (isEnd && i == nals.size() - 1) ? 1 : 0;
+        hr = SendSrtpPacket(socket, dst, srtpSession, rtpHeader, payload.data(), (int)payload.size());
+
+        offset += fragmentLength;
+      }
+
+      i++;
     }
-
-    uint8_t* hdrSerialised = NULL;
-    rtpHeader.Serialise(&hdrSerialised);
-
-    int rtpPacketSize = RTP_HEADER_LENGTH + H264_RTP_HEADER_LENGTH + payloadLength;
-    int srtpPacketSize = rtpPacketSize + SRTP_AUTH_KEY_LENGTH;
-    uint8_t* rtpPacket = (uint8_t*)malloc(srtpPacketSize);
-    memcpy_s(rtpPacket, rtpPacketSize, hdrSerialised, RTP_HEADER_LENGTH);
-    rtpPacket[RTP_HEADER_LENGTH] = (byte)(h264Header >> 8 & 0xff);
-    rtpPacket[RTP_HEADER_LENGTH + 1] = (byte)(h264Header & 0xff);
-    memcpy_s(&rtpPacket[RTP_HEADER_LENGTH + H264_RTP_HEADER_LENGTH], payloadLength, &frameData[offset], payloadLength);
-
-    //printf("Sending RTP packet, length %d.\n", rtpPacketSize);
-
-    auto protRes = srtp_protect(*srtpSession, rtpPacket, &rtpPacketSize);
-    if (protRes != srtp_err_status_ok) {
-      printf("SRTP protect failed with error code %d.\n", protRes);
-      hr = E_FAIL;
-      break;
+    else {
+      // Take as many of the following NAL units as will fit in a STAP-A, section 5.7.1 RFC6184.
+      size_t end = i;
+      size_t aggregateLength = 1;
+      while (end < nals.size() && aggregateLength + H264_STAP_A_NAL_SIZE_LENGTH + nals[end].second <= RTP_MAX_PAYLOAD) {
+        aggregateLength += H264_STAP_A_NAL_SIZE_LENGTH + nals[end].second;
+        end++;
+      }
+
+      payload.clear();
+
+      if (end - i <= 1) {
+        // Single NAL unit packet.
+        end = i + 1;
+        payload.insert(payload.end(), nal, nal + nalLength);
+      }
+      else {
+        // The STAP-A F bit is set if any aggregated NAL unit has it and the NRI is the highest of them.
+        uint8_t stapHeader = H264_NAL_TYPE_STAP_A;
+        for (size_t j = i; j < end; j++) {
+          stapHeader |= nals[j].first[0] & 0x80;
+          if ((nals[j].first[0] & 0x60) > (stapHeader & 0x60)) {
+            stapHeader = (stapHeader & 0x9f) | (nals[j].first[0] & 0x60);
+          }
+        }
+
+        payload.push_back(stapHeader);
+        for (size_t j = i; j < end; j++) {
+          payload.push_back((nals[j].second >> 8) & 0xff);
+          payload.push_back(nals[j].second & 0xff);
+          payload.insert(payload.end(), nals[j].first, nals[j].first + nals[j].second);
+        }
+      }
+
+      rtpHeader.SeqNum = pktSeqNum++;
+      rtpHeader.MarkerBit = (end == nals.size()) ? 1 : 0;
+      hr = SendSrtpPacket(socket, dst, srtpSession, rtpHeader, payload.data(), (int)payload.size());
+
+      i = end;
     }
-
-    sendto(socket, (const char*)rtpPacket, srtpPacketSize, 0, (sockaddr*)&dst, sizeof(dst));
-
-    offset += payloadLength;
-
-    free(hdrSerialised);
-    free(rtpPacket);
   }
-  
-  hr = buf->Unlock();
-  CHECK_HR(hr, "Failed to unlock video sample buffer.");
+
+  buf->Unlock();
 
 done:
 
@@ -1035,6 +1259,149 @@ done:
   return hr;
 }
 
+/**
+* Splits an H264 Annex B byte stream into its NAL units.
+* @param[in] data: the byte stream with 3 or 4 byte start codes.
+* @param[in] length: the length of the byte stream.
+* @@Returns The start and length of each NAL unit, without the start codes.
+*/
+std::vector<std::pair<const uint8_t*, size_t>> GetH264NalUnits(const uint8_t* data, size_t length)
+{
+  std::vector<std::pair<const uint8_t*, size_t>> nals;
+  size_t nalStart = 0;
+  bool inNal = false;
+
+  auto addNal = [&](size_t nalEnd) {
+    // A NAL unit never ends in a zero byte so any are the leading zero of a 4 byte start code or trailing zeros.
+    while (nalEnd > nalStart && data[nalEnd - 1] == 0x00) {
+      nalEnd--;
+    }
+    if (nalEnd > nalStart) {
+      nals.push_back(std::make_pair(data + nalStart, nalEnd - nalStart));
+    }
+  };
+
+  for (size_t i = 0; i + 2 < length;) {
+    if (data[i] == 0x00 && data[i + 1] == 0x00 && data[i + 2] == 0x01) {
+      if (inNal) {
+        addNal(i);
+      }
+      i += 3;
+      nalStart = i;
+      inNal = true;
+    }
+    else {
+      i++;
+    }
+  }
+
+  if (inNal) {
+    addNal(length);
+  }
+
+  return nals;
+}
+
+/**
+* Gets the SDP profile-level-id for an SPS, RFC6184 section 8.1. It's the three
+* bytes following the NAL header: profile_idc, the constraint flags and level_idc.
+* @param[in] sps: the SPS NAL unit, including its NAL header.
+* @param[in] spsLength: the length of the SPS.
+* @@Returns The profile-level-id as 6 hex characters or empty if the SPS is too short.
+*/
+std::string GetH264ProfileLevelId(const uint8_t* sps, size_t spsLength)
+{
+  char profileLevelId[7] = { 0 };
+
+  if (spsLength >= 4) {
+    snprintf(profileLevelId, sizeof(profileLevelId), "%02x%02x%02x", sps[1], sps[2], sps[3]);
+  }
+
+  return profileLevelId;
+}
+
+/**
+* Keeps a copy of an SPS or PPS from the encoder. A new SPS is checked against the
+* profile-level-id that was put in the SDP offer as the browser may not be able to
+* decode a stream that doesn't match.
+* @param[in,out] paramSet: the parameter set to update, paramSets.Sps or paramSets.Pps.
+* @param[in] nal: the SPS or PPS NAL unit.
+* @param[in] nalLength: the length of the NAL unit.
+* @param[in] paramSets: the parameter sets with the advertised profile-level-id.
+*/
+void UpdateH264ParameterSet(std::vector<uint8_t>& paramSet, const uint8_t* nal, size_t nalLength, H264ParameterSets& paramSets)
+{
+  if (paramSet.size() == nalLength && memcmp(paramSet.data(), nal, nalLength) == 0) {
+    return;
+  }
+
+  paramSet.assign(nal, nal + nalLength);
+
+  if (&paramSet == &paramSets.Sps && !paramSets.ProfileLevelId.empty()) {
+    std::string profileLevelId = GetH264ProfileLevelId(nal, nalLength);
+    if (profileLevelId != paramSets.ProfileLevelId) {
+      printf("Warning: encoder SPS has profile-level-id %s but the SDP offer has %s.\n", profileLevelId.c_str(), paramSets.ProfileLevelId.c_str());
+    }
+  }
+}
+
+/**
+* Gets the SHA-256 fingerprint of the DTLS certificate for the SDP offer.
+* @param[in] certificateFile: the PEM certificate file.
+* @@Returns The fingerprint as colon separated hex bytes or empty if the certificate couldn't be read.
+*/
+std::string GetCertificateFingerprint(const char* certificateFile)
+{
+  unsigned char digest[EVP_MAX_MD_SIZE];
+  unsigned int digestLength = 0;
+  char hex[4];
+  std::string fingerprint;
+
+  BIO* certBio = BIO_new_file(certificateFile, "r");
+  X509* cert = (certBio != nullptr) ? PEM_read_bio_X509(certBio, nullptr, nullptr, nullptr) : nullptr;
+
+  if (cert != nullptr && X509_digest(cert, EVP_sha256(), digest, &digestLength) == 1) {
+    for (unsigned int i = 0; i < digestLength; i++) {
+      snprintf(hex, sizeof(hex), (i == 0) ? "%02X" : ":%02X", digest[i]);
+      fingerprint += hex;
+    }
+  }
+
+  X509_free(cert);
+  BIO_free(certBio);
+
+  return fingerprint;
+}
+
+/**
+* Prints the SDP offer the browser needs and the mfwebrtc.html URL that makes
+* the page use the same profile-level-id in its copy of the offer.
+* @param[in] fingerprint: the SHA-256 fingerprint of the DTLS certificate.
+* @param[in] profileLevelId: the profile-level-id from the encoder's SPS.
+*/
+void PrintSdpOffer(const std::string& fingerprint, const std::string& profileLevelId)
+{
+  printf("SDP offer:\n");
+  printf("v=0\n");
+  printf("o=- 0 0 IN IP4 127.0.0.1\n");
+  printf("s=-\n");
+  printf("t=0 0\n");
+  printf("m=video %d RTP/SAVPF %d\n", RTP_LISTEN_PORT, RTP_PAYLOAD_ID);
+  printf("c=IN IP4 127.0.0.1\n");
+  printf("a=candidate:1251003584 1 udp 1038230912 127.0.0.1 %d typ host generation 0\n", RTP_LISTEN_PORT);
+  printf("a=end-of-candidates\n");
+  printf("a=ice-ufrag:%s\n", ICE_USERNAME);
+  printf("a=ice-pwd:%s\n", ICE_PASSWORD);
+  printf("a=fingerprint:sha-256 %s\n", fingerprint.c_str());
+  printf("a=setup:actpass\n");
+  printf("a=sendonly\n");
+  printf("a=rtcp-mux\n");
+  printf("a=mid:video\n");
+  printf("a=rtpmap:%d H264/90000\n", RTP_PAYLOAD_ID);
+  printf("a=fmtp:%d level-asymmetry-allowed=1;packetization-mode=1;profile-level-id=%s\n", RTP_PAYLOAD_ID, profileLevelId.c_str());
+  printf("Open mfwebrtc.html#profile-level-id=%s in a browser to connect.\n", profileLevelId.c_str());
+}
+
 int verify_cookie(SSL* ssl, unsigned char* cookie, unsigned int cookie_len)
 {
   // Accept any cookie.
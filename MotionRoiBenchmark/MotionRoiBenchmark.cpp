@@ -0,0 +1,467 @@
+/******************************************************************************
+* Filename: MotionRoiBenchmark.cpp
+*
+* Description:
+* This file contains a C++ console application that measures the bitrate saved
+* by giving the encoder a QP offset map from the MotionActivityAnalyzer in the
+* Common folder, so the static background of a webcam or surveillance picture
+* gets fewer bits than the parts that are changing. Each encoder backend that
+* supports QP offset maps encodes the same Y4M recording at a range of bitrates,
+* once without a map and once with one, and the output is decoded with a
+* VideoDecoder backend.
+*
+* The quality that matters is the foreground's, the macroblocks the analyser
+* finds active or near motion, so the PSNR is measured over just those. The
+* saving at constant foreground quality is the Bjontegaard delta rate (BD-rate)
+* between the two sets of rate and foreground PSNR points, negative means the
+* map needs fewer bits. The whole frame PSNR is printed as well to show what the
+* background gave up.
+*
+* Before the rate sweep each backend is checked with an encoder from the
+* VideoEncoderPool that's given a map, returned and leased again, as a session
+* that starts on a reused encoder must be able to encode with or without a map.
+*
+* A fixed camera recording with a person or traffic moving through it works
+* best. One can be recorded from a webcam with ffmpeg on Windows:
+* ffmpeg -f dshow -video_size 640x480 -framerate 30 -i video="<webcam name>" -pix_fmt yuv420p -frames:v 600 input.y4m
+*
+* Usage:
+* MotionRoiBenchmark input.y4m [max frames] [backend]
+*
+* Dependencies:
+* vcpkg install x264 libvpx ffmpeg
+*
+* The benchmark doesn't use Media Foundation so it also builds on Linux, leave
+* out the -D define and library for any backend that isn't installed. A decoder
+* backend for each encoder's codec is needed:
+* g++ -O2 -std=c++17 -DVIDEO_ENCODER_X264 -DVIDEO_ENCODER_VPX -DVIDEO_DECODER_FFMPEG MotionRoiBenchmark.cpp -lx264 -lvpx -lavcodec -lavutil -lpthread -o MotionRoiBenchmark
+*
+* License: Public Domain (no warranty, use at own risk)
+/******************************************************************************/
+
+#include "../Common/MotionActivityAnalyzer.h"
+#include "../Common/VideoDecoderFactory.h"
+#include "../Common/VideoEncoderFactory.h"
+#include "../Common/VideoEncoderPool.h"
+#include "../Common/Y4MReader.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <string>
+#include <utility>
+#include <vector>
+
+#define DEFAULT_MAX_FRAMES 600
+#define DEFAULT_BITS_PER_PIXEL 0.07     // The middle of the bitrate range for the input resolution.
+#define KEY_FRAME_INTERVAL 150
+#define RATE_POINTS 4
+#define BD_RATE_INTEGRATION_STEPS 100
+#define MAX_PSNR 100.0                  // Given to frames that are identical to the input.
+
+/* Multiples of the default bitrate each backend is encoded at. */
+static const double RATE_MULTIPLIERS[RATE_POINTS] = { 0.5, 0.75, 1.0, 1.5 };
+
+/* The analyser's output for each input frame, worked out once and used for every encode. */
+struct MotionMaps
+{
+  std::vector<std::vector<float>> QpOffsets;
+  std::vector<std::vector<uint8_t>> Levels;
+  double MeanActiveFraction = 0;
+  double AnalyseUs = 0;                 // Mean time the analyser took per frame.
+};
+
+/* Results of encoding the whole input at one bitrate with or without the QP offset map. */
+struct RatePoint
+{
+  double Kbps = 0;
+  double Psnr = 0;                      // Mean luma PSNR of the foreground macroblocks.
+  double FramePsnr = 0;                 // Mean luma PSNR of the whole frame.
+  size_t DecodedFrames = 0;
+};
+
+void AnalyseMotion(const Y4MVideo& video, MotionMaps& maps);
+bool CheckPooledReuse(const Y4MVideo& video, const MotionMaps& maps, const std::string& backend);
+bool RunEncode(const Y4MVideo& video, const MotionMaps& maps, const std::string& backend, unsigned int bitrateKbps, bool useMap, RatePoint& point);
+double GetPsnr(uint64_t squaredError, size_t samples);
+double GetBdRate(std::vector<RatePoint> reference, std::vector<RatePoint> test);
+
+int main(int argc, char* argv[])
+{
+  if (argc < 2) {
+    printf("Usage: %s input.y4m [max frames] [backend]\n", argv[0]);
+    return 1;
+  }
+
+  std::vector<std::string> backends;
+  for (const std::string& backend : GetVideoEncoderNames()) {
+    std::unique_ptr<VideoEncoder> encoder = CreateVideoEncoder(backend);
+    if (encoder && encoder->SupportsQpOffsetMap()) {
+      backends.push_back(backend);
+    }
+  }
+
+  if (argc > 3) {
+    backends.assign(1, argv[3]);
+  }
+
+  if (backends.empty()) {
+    printf("No encoder backends that support QP offset maps compiled in, build with VIDEO_ENCODER_X264 and/or VIDEO_ENCODER_VPX defined.\n");
+    return 1;
+  }
+
+  unsigned int maxFrames = (argc > 2) ? atoi(argv[2]) : DEFAULT_MAX_FRAMES;
+
+  Y4MVideo video;
+  if (!LoadY4M(argv[1], maxFrames, video)) {
+    return 1;
+  }
+
+  MotionMaps maps;
+  AnalyseMotion(video, maps);
+
+  double frameRate = (double)video.FrameRateNum / video.FrameRateDen;
+  unsigned int defaultKbps = (unsigned int)(video.Width * video.Height * frameRate * DEFAULT_BITS_PER_PIXEL / 1000);
+
+  printf("Input %ux%u at %.2f fps, %zu frames, %.1f%% of macroblocks active on average, analyser %.1fus per frame.\n",
+    video.Width, video.Height, frameRate, video.Frames.size(), maps.MeanActiveFraction * 100, maps.AnalyseUs);
+
+  printf("\n%12s %8s | %10s %8s %8s | %10s %8s %8s\n", "backend", "target", "plain kbps", "fg PSNR", "PSNR",
+    "map kbps", "fg PSNR", "PSNR");
+
+  std::vector<std::pair<std::string, double>> bdRates;
+
+  for (const std::string& backend : backends) {
+    if (!CheckPooledReuse(video, maps, backend)) {
+      printf("%s encoder FAILED the pooled reuse check.\n", backend.c_str());
+      return 1;
+    }
+  }
+
+  for (const std::string& backend : backends) {
+    std::vector<RatePoint> plainPoints, mapPoints;
+
+    for (int i = 0; i < RATE_POINTS; i++) {
+      unsigned int bitrateKbps = (unsigned int)(defaultKbps * RATE_MULTIPLIERS[i]);
+      RatePoint plainPoint, mapPoint;
+
+      if (!RunEncode(video, maps, backend, bitrateKbps, false, plainPoint) ||
+        !RunEncode(video, maps, backend, bitrateKbps, true, mapPoint)) {
+        return 1;
+      }
+
+      printf("%12s %8u | %10.1f %8.2f %8.2f | %10.1f %8.2f %8.2f\n", backend.c_str(), bitrateKbps,
+        plainPoint.Kbps, plainPoint.Psnr, plainPoint.FramePsnr, mapPoint.Kbps, mapPoint.Psnr, mapPoint.FramePsnr);
+
+      plainPoints.push_back(plainPoint);
+      mapPoints.push_back(mapPoint);
+    }
+
+    bdRates.push_back({ backend, GetBdRate(plainPoints, mapPoints) });
+  }
+
+  printf("\n%12s %33s\n", "backend", "BD-rate at equal foreground PSNR");
+
+  for (auto& bdRate : bdRates) {
+    if (std::isnan(bdRate.second)) {
+      printf("%12s %33s\n", bdRate.first.c_str(), "no PSNR overlap");
+    }
+    else {
+      printf("%12s %32.1f%%\n", bdRate.first.c_str(), bdRate.second);
+    }
+  }
+
+  return 0;
+}
+
+/**
+* Runs the motion activity analyser over the input to get the QP offset map and
+* macroblock levels for each frame.
+* @param[in] video: the input frames.
+* @param[out] maps: the analyser's output for each frame.
+*/
+void AnalyseMotion(const Y4MVideo& video, MotionMaps& maps)
+{
+  MotionActivityAnalyzer analyser(video.Width, video.Height);
+  double totalActive = 0;
+  double totalUs = 0;
+
+  for (const std::vector<uint8_t>& frame : video.Frames) {
+    auto analyseStart = std::chrono::steady_clock::now();
+    analyser.Analyse(frame.data(), video.Width);
+    totalUs += std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - analyseStart).count();
+
+    maps.QpOffsets.push_back(analyser.GetQpOffsets());
+    maps.Levels.push_back(analyser.GetLevels());
+    totalActive += analyser.GetActiveFraction();
+  }
+
+  maps.MeanActiveFraction = totalActive / video.Frames.size();
+  maps.AnalyseUs = totalUs / video.Frames.size();
+}
+
+/**
+* Encodes the input at one bitrate and decodes the output to measure the quality
+* of the foreground and the whole frame.
+* @param[in] video: the frames to encode.
+* @param[in] maps: the analyser's output for each frame.
+* @param[in] backend: the VideoEncoder backend name.
+* @param[in] bitrateKbps: the target bitrate.
+* @param[in] useMap: true to give the encoder each frame's QP offset map.
+* @param[out] point: the bitrate and PSNR achieved.
+* @@Returns true if the input was encoded and decoded.
+*/
+/**
+* Leases an encoder, encodes a frame with a QP offset map and returns it, then
+* leases the same encoder again and encodes without a map and with one.
+* @param[in] video: the input frames.
+* @param[in] maps: the QP offset maps for the input frames.
+* @param[in] backend: the encoder backend to check.
+* @@Returns true if every frame was encoded.
+*/
+bool CheckPooledReuse(const Y4MVideo& video, const MotionMaps& maps, const std::string& backend)
+{
+  VideoEncoderConfig config;
+  config.Width = video.Width;
+  config.Height = video.Height;
+  config.FrameRateNum = video.FrameRateNum;
+  config.FrameRateDen = video.FrameRateDen;
+  config.BitrateKbps = (unsigned int)(video.Width * video.Height * ((double)video.FrameRateNum / video.FrameRateDen) * DEFAULT_BITS_PER_PIXEL / 1000);
+  config.KeyFrameInterval = KEY_FRAME_INTERVAL;
+
+  // No warm encoders are kept so the second lease gets the returned one.
+  VideoEncoderPool encoderPool(0);
+  EncodedAccessUnit accessUnit;
+  int64_t frameDuration = (int64_t)VIDEO_ENCODER_CLOCK_RATE * video.FrameRateDen / video.FrameRateNum;
+  size_t frames = video.Frames.size();
+
+  std::unique_ptr<VideoEncoder> encoder = encoderPool.Lease(backend, config);
+  if (!encoder || !encoder->SetQpOffsetMap(maps.QpOffsets[0]) || !encoder->PushFrame(video.Frames[0].data(), 0)) {
+    return false;
+  }
+  while (encoder->PullAccessUnit(accessUnit)) {}
+
+  VideoEncoder* pReturned = encoder.get();
+  encoderPool.Return(std::move(encoder));
+
+  encoder = encoderPool.Lease(backend, config);
+  if (!encoder) {
+    return false;
+  }
+  else if (encoder.get() != pReturned) {
+    printf("%s encoder wasn't kept by the pool when it was returned.\n", backend.c_str());
+    return false;
+  }
+
+  // The returned encoder was Reset so the first frame goes without a map.
+  if (!encoder->PushFrame(video.Frames[1 % frames].data(), frameDuration) ||
+    !encoder->SetQpOffsetMap(maps.QpOffsets[2 % frames]) ||
+    !encoder->PushFrame(video.Frames[2 % frames].data(), 2 * frameDuration) ||
+    !encoder->Drain()) {
+    return false;
+  }
+  while (encoder->PullAccessUnit(accessUnit)) {}
+
+  encoderPool.Return(std::move(encoder));
+  return true;
+}
+
+bool RunEncode(const Y4MVideo& video, const MotionMaps& maps, const std::string& backend, unsigned int bitrateKbps, bool useMap, RatePoint& point)
+{
+  std::unique_ptr<VideoEncoder> encoder = CreateVideoEncoder(backend);
+  if (!encoder) {
+    printf("Encoder backend %s isn't available.\n", backend.c_str());
+    return false;
+  }
+
+  VideoEncoderConfig config;
+  config.Width = video.Width;
+  config.Height = video.Height;
+  config.FrameRateNum = video.FrameRateNum;
+  config.FrameRateDen = video.FrameRateDen;
+  config.BitrateKbps = bitrateKbps;
+  config.KeyFrameInterval = KEY_FRAME_INTERVAL;
+
+  if (!encoder->Init(config)) {
+    return false;
+  }
+
+  std::unique_ptr<VideoDecoder> decoder;
+  for (const std::string& decoderName : GetVideoDecoderNames()) {
+    decoder = CreateVideoDecoder(decoderName);
+    if (decoder && decoder->SupportsCodec(encoder->GetCodec())) {
+      break;
+    }
+    decoder.reset();
+  }
+
+  if (!decoder) {
+    printf("No decoder backend for %s compiled in, build with VIDEO_DECODER_FFMPEG, VIDEO_DECODER_OPENH264 and/or VIDEO_DECODER_VPX defined.\n",
+      GetVideoCodecName(encoder->GetCodec()));
+    return false;
+  }
+
+  VideoFramePool pool;
+  VideoDecoderConfig decoderConfig;
+  decoderConfig.Codec = encoder->GetCodec();
+
+  if (!decoder->Init(decoderConfig, &pool)) {
+    return false;
+  }
+
+  EncodedAccessUnit accessUnit;
+  VideoFrameBuffer* pFrame = nullptr;
+  size_t encodedBytes = 0;
+  double totalPsnr = 0, totalFramePsnr = 0;
+  size_t foregroundFrames = 0;
+  unsigned int mbWidth = (video.Width + MOTION_BLOCK_SIZE - 1) / MOTION_BLOCK_SIZE;
+  int64_t frameDuration = (int64_t)VIDEO_ENCODER_CLOCK_RATE * video.FrameRateDen / video.FrameRateNum;
+
+  // Measures the PSNR of each decoded frame, and of its foreground macroblocks, against the input frame with its timestamp.
+  auto pullFrames = [&]() {
+    VideoDecoderResult decodeResult;
+    while ((decodeResult = decoder->PullFrame(&pFrame)) != VideoDecoderResult::NeedMoreInput) {
+      if (decodeResult == VideoDecoderResult::Frame) {
+        size_t frameIndex = (size_t)((pFrame->Pts + frameDuration / 2) / frameDuration);
+
+        if (frameIndex < video.Frames.size() && pFrame->Width == video.Width && pFrame->Height == video.Height) {
+          const uint8_t* pInput = video.Frames[frameIndex].data();
+          const std::vector<uint8_t>& levels = maps.Levels[frameIndex];
+          uint64_t squaredError = 0, foregroundSquaredError = 0;
+          size_t foregroundSamples = 0;
+
+          for (unsigned int y = 0; y < video.Height; y++) {
+            for (unsigned int x = 0; x < video.Width; x++) {
+              int difference = pInput[(size_t)y * video.Width + x] - pFrame->Data[(size_t)y * video.Width + x];
+              uint8_t level = levels[(y / MOTION_BLOCK_SIZE) * mbWidth + x / MOTION_BLOCK_SIZE];
+
+              squaredError += difference * difference;
+              if (level <= (uint8_t)MotionLevel::NearMotion) {
+                foregroundSquaredError += difference * difference;
+                foregroundSamples++;
+              }
+            }
+          }
+
+          totalFramePsnr += GetPsnr(squaredError, (size_t)video.Width * video.Height);
+          if (foregroundSamples > 0) {
+            totalPsnr += GetPsnr(foregroundSquaredError, foregroundSamples);
+            foregroundFrames++;
+          }
+          point.DecodedFrames++;
+        }
+
+        pool.Release(pFrame);
+      }
+    }
+  };
+
+  for (size_t i = 0; i <= video.Frames.size(); i++) {
+    if (i == video.Frames.size()) {
+      if (!encoder->Drain()) {
+        return false;
+      }
+    }
+    else {
+      if (useMap && !encoder->SetQpOffsetMap(maps.QpOffsets[i])) {
+        return false;
+      }
+
+      if (!encoder->PushFrame(video.Frames[i].data(), (int64_t)i * frameDuration)) {
+        return false;
+      }
+    }
+
+    while (encoder->PullAccessUnit(accessUnit)) {
+      encodedBytes += accessUnit.Data.size();
+
+      if (!decoder->PushAccessUnit(accessUnit.Data.data(), accessUnit.Data.size(), accessUnit.Pts)) {
+        return false;
+      }
+
+      pullFrames();
+    }
+  }
+
+  if (!decoder->Drain()) {
+    return false;
+  }
+  pullFrames();
+
+  double seconds = (double)video.Frames.size() * video.FrameRateDen / video.FrameRateNum;
+
+  point.Kbps = encodedBytes * 8 / seconds / 1000;
+  point.Psnr = (foregroundFrames > 0) ? totalPsnr / foregroundFrames : 0;
+  point.FramePsnr = (point.DecodedFrames > 0) ? totalFramePsnr / point.DecodedFrames : 0;
+
+  if (point.DecodedFrames != video.Frames.size()) {
+    printf("%s at %ukbps decoded %zu of %zu frames, the PSNR only includes those.\n", backend.c_str(), bitrateKbps,
+      point.DecodedFrames, video.Frames.size());
+  }
+
+  return true;
+}
+
+/**
+* Gets the PSNR of 8 bit samples from their total squared error.
+* @param[in] squaredError: the sum of the squared differences.
+* @param[in] samples: the number of samples.
+* @@Returns The PSNR in dB, MAX_PSNR if there's no error.
+*/
+double GetPsnr(uint64_t squaredError, size_t samples)
+{
+  if (squaredError == 0) {
+    return MAX_PSNR;
+  }
+
+  double mse = (double)squaredError / samples;
+  return std::min(MAX_PSNR, 10 * std::log10(255.0 * 255.0 / mse));
+}
+
+/**
+* Gets the Bjontegaard delta rate, the average difference in bitrate between two
+* rate and PSNR curves over the PSNR range they share. The curves are piecewise
+* linear in log bitrate, which is less sensitive to a noisy point than the cubic
+* fit of the original method.
+* @param[in] reference: the points of the reference curve.
+* @param[in] test: the points of the curve being compared.
+* @@Returns The percentage change in bitrate of the test curve at equal PSNR, or NaN if the curves don't overlap.
+*/
+double GetBdRate(std::vector<RatePoint> reference, std::vector<RatePoint> test)
+{
+  auto byPsnr = [](const RatePoint& a, const RatePoint& b) { return a.Psnr < b.Psnr; };
+  std::sort(reference.begin(), reference.end(), byPsnr);
+  std::sort(test.begin(), test.end(), byPsnr);
+
+  double minPsnr = std::max(reference.front().Psnr, test.front().Psnr);
+  double maxPsnr = std::min(reference.back().Psnr, test.back().Psnr);
+  if (maxPsnr <= minPsnr) {
+    return NAN;
+  }
+
+  // Log bitrate at a PSNR by interpolating between the points either side of it.
+  auto logRateAt = [](const std::vector<RatePoint>& curve, double psnr) {
+    size_t i = 1;
+    while (i < curve.size() - 1 && curve[i].Psnr < psnr) {
+      i++;
+    }
+
+    const RatePoint& low = curve[i - 1];
+    const RatePoint& high = curve[i];
+    double fraction = (high.Psnr > low.Psnr) ? (psnr - low.Psnr) / (high.Psnr - low.Psnr) : 0;
+    return std::log(low.Kbps) + fraction * (std::log(high.Kbps) - std::log(low.Kbps));
+  };
+
+  double totalDifference = 0;
+  for (int step = 0; step <= BD_RATE_INTEGRATION_STEPS; step++) {
+    double psnr = minPsnr + (maxPsnr - minPsnr) * step / BD_RATE_INTEGRATION_STEPS;
+    double weight = (step == 0 || step == BD_RATE_INTEGRATION_STEPS) ? 0.5 : 1.0;     // Trapezoidal rule.
+    totalDifference += weight * (logRateAt(test, psnr) - logRateAt(reference, psnr));
+  }
+
+  double meanDifference = totalDifference / BD_RATE_INTEGRATION_STEPS;
+  return (std::exp(meanDifference) - 1) * 100;
+}
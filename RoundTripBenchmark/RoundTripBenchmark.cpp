@@ -0,0 +1,479 @@
+/******************************************************************************
+* Filename: RoundTripBenchmark.cpp
+*
+* Description:
+* This file contains a C++ console application that is the measuring version of
+* the MFH264RoundTrip sample. Instead of capturing from a webcam and dumping the
+* decoded frames it reads a Y4M recording, encodes it with the VideoEncoder
+* backends in the Common folder, decodes the output with a VideoDecoder backend
+* and compares every decoded frame to the frame it came from.
+*
+* Each run is one combination of encoder backend, and so codec, target bitrate,
+* key frame interval (GOP), VideoEncoderPreset and thread count, and the runs
+* sweep every combination of the lists given on the command line. For each run
+* the encode frame rate, the 50th, 90th and 99th percentile time the encoder
+* took per frame, the bitstream size and bitrate, and the mean PSNR of each
+* plane, luma SSIM and optionally MS-SSIM against the input, measured with the
+* VideoQualityMetrics in the Common folder, are recorded. The results are
+* printed and can be written as CSV and/or JSON so they can be kept and
+* compared between builds.
+*
+* A Y4M test file can be recorded from a webcam or converted from an mp4 with ffmpeg:
+* ffmpeg -i input.mp4 -vf scale=1280:720 -pix_fmt yuv420p -frames:v 300 input.y4m
+*
+* Usage:
+* RoundTripBenchmark input.y4m [option=value ...]
+*
+* The options are given as name=value, lists are comma separated:
+* frames=300                     the maximum frames to load from the input.
+* backends=x264,libvpx-vp8       the encoder backends, default all compiled in.
+* bitrates=500,1000,2000         target bitrates in kbps, default one for the input resolution.
+* gops=30,300                    key frame intervals in frames, 0 for only the first.
+* presets=fast,default,slow      VideoEncoderPreset names.
+* threads=1,4                    encoder threads, 0 lets the backend pick.
+* msssim=1                       also measure MS-SSIM.
+* csv=results.csv                write the results as CSV.
+* json=results.json              write the results as JSON.
+*
+* Dependencies:
+* vcpkg install x264 openh264 libvpx ffmpeg
+*
+* The benchmark doesn't use Media Foundation so it also builds on Linux, leave
+* out the -D define and library for any backend that isn't installed. A decoder
+* backend for each encoder's codec is needed:
+* g++ -O2 -std=c++17 -DVIDEO_ENCODER_X264 -DVIDEO_ENCODER_VPX -DVIDEO_DECODER_FFMPEG RoundTripBenchmark.cpp -lx264 -lvpx -lavcodec -lavutil -lpthread -o RoundTripBenchmark
+*
+* License: Public Domain (no warranty, use at own risk)
+/******************************************************************************/
+
+#include "../Common/VideoDecoderFactory.h"
+#include "../Common/VideoEncoderFactory.h"
+#include "../Common/VideoQualityMetrics.h"
+#include "../Common/Y4MReader.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#define DEFAULT_MAX_FRAMES 300
+#define DEFAULT_BITS_PER_PIXEL 0.07     // Used to pick a bitrate for the input resolution if none is specified.
+#define DEFAULT_KEY_FRAME_INTERVAL 30
+
+/* The encoder settings for one run of the sweep. */
+struct RunSettings
+{
+  std::string Backend;
+  unsigned int BitrateKbps = 0;
+  unsigned int KeyFrameInterval = 0;
+  VideoEncoderPreset Preset = VideoEncoderPreset::Default;
+  unsigned int Threads = 0;
+};
+
+/* Results of encoding and decoding the whole input with one set of settings. */
+struct RunResult
+{
+  RunSettings Settings;
+  VideoCodec Codec = VideoCodec::H264;
+  double EncodeFramesPerSecond = 0;     // From the time spent in the encoder calls only, the decode isn't included.
+  double P50EncodeMs = 0;
+  double P90EncodeMs = 0;
+  double P99EncodeMs = 0;
+  size_t Bytes = 0;
+  double Kbps = 0;
+  size_t KeyFrames = 0;
+  size_t DecodedFrames = 0;
+  QualityScores Quality;                // Means over the decoded frames.
+  double MetricsFramesPerSecond = 0;    // How fast the quality metrics were measured.
+};
+
+bool RunRoundTrip(const Y4MVideo& video, const RunSettings& settings, VideoQualityMetrics& metrics, RunResult& result);
+bool ParsePreset(const std::string& name, VideoEncoderPreset& preset);
+std::vector<std::string> SplitList(const std::string& list);
+bool WriteCsv(const std::string& path, const std::vector<RunResult>& results);
+bool WriteJson(const std::string& path, const Y4MVideo& video, const std::vector<RunResult>& results);
+
+int main(int argc, char* argv[])
+{
+  if (argc < 2) {
+    printf("Usage: %s input.y4m [frames=N] [backends=a,b] [bitrates=kbps,...] [gops=N,...] [presets=fast,default,slow] [threads=N,...] [msssim=1] [csv=path] [json=path]\n", argv[0]);
+    return 1;
+  }
+
+  unsigned int maxFrames = DEFAULT_MAX_FRAMES;
+  std::vector<std::string> backends = GetVideoEncoderNames();
+  std::vector<unsigned int> bitrates, keyFrameIntervals = { DEFAULT_KEY_FRAME_INTERVAL }, threadCounts = { 0 };
+  std::vector<VideoEncoderPreset> presets = { VideoEncoderPreset::Default };
+  std::string csvPath, jsonPath;
+  bool msSsim = false;
+
+  for (int i = 2; i < argc; i++) {
+    std::string arg = argv[i];
+    size_t equals = arg.find('=');
+    if (equals == std::string::npos) {
+      printf("Option %s isn't in the form name=value.\n", arg.c_str());
+      return 1;
+    }
+
+    std::string name = arg.substr(0, equals);
+    std::string value = arg.substr(equals + 1);
+
+    if (name == "frames") {
+      maxFrames = atoi(value.c_str());
+    }
+    else if (name == "backends") {
+      backends = SplitList(value);
+    }
+    else if (name == "bitrates" || name == "gops" || name == "threads") {
+      std::vector<unsigned int>& numbers = (name == "bitrates") ? bitrates : (name == "gops") ? keyFrameIntervals : threadCounts;
+      numbers.clear();
+      for (const std::string& item : SplitList(value)) {
+        numbers.push_back(atoi(item.c_str()));
+      }
+    }
+    else if (name == "presets") {
+      presets.clear();
+      for (const std::string& item : SplitList(value)) {
+        VideoEncoderPreset preset;
+        if (!ParsePreset(item, preset)) {
+          printf("Unknown preset %s, use fast, default or slow.\n", item.c_str());
+          return 1;
+        }
+        presets.push_back(preset);
+      }
+    }
+    else if (name == "msssim") {
+      msSsim = atoi(value.c_str()) != 0;
+    }
+    else if (name == "csv") {
+      csvPath = value;
+    }
+    else if (name == "json") {
+      jsonPath = value;
+    }
+    else {
+      printf("Unknown option %s.\n", name.c_str());
+      return 1;
+    }
+  }
+
+  if (backends.empty()) {
+    printf("No encoder backends compiled in, build with VIDEO_ENCODER_X264, VIDEO_ENCODER_OPENH264 and/or VIDEO_ENCODER_VPX defined.\n");
+    return 1;
+  }
+
+  Y4MVideo video;
+  if (!LoadY4M(argv[1], maxFrames, video)) {
+    return 1;
+  }
+
+  double frameRate = (double)video.FrameRateNum / video.FrameRateDen;
+  if (bitrates.empty()) {
+    bitrates.push_back((unsigned int)(video.Width * video.Height * frameRate * DEFAULT_BITS_PER_PIXEL / 1000));
+  }
+
+  size_t runCount = backends.size() * bitrates.size() * keyFrameIntervals.size() * presets.size() * threadCounts.size();
+  printf("Input %ux%u at %.2f fps, %zu frames, %zu runs.\n", video.Width, video.Height, frameRate, video.Frames.size(), runCount);
+
+  printf("\n%12s %8s %6s %8s %7s | %8s %8s %8s %8s | %10s %9s | %7s %7s %7s %7s %7s\n", "backend", "kbps", "gop", "preset", "threads",
+    "enc fps", "p50 ms", "p90 ms", "p99 ms", "bytes", "kbps", "PSNR Y", "PSNR U", "PSNR V", "SSIM", "MS-SSIM");
+
+  VideoQualityMetrics metrics(0, msSsim);
+  std::vector<RunResult> results;
+
+  for (const std::string& backend : backends) {
+    for (unsigned int bitrateKbps : bitrates) {
+      for (unsigned int keyFrameInterval : keyFrameIntervals) {
+        for (VideoEncoderPreset preset : presets) {
+          for (unsigned int threads : threadCounts) {
+            RunSettings settings;
+            settings.Backend = backend;
+            settings.BitrateKbps = bitrateKbps;
+            settings.KeyFrameInterval = keyFrameInterval;
+            settings.Preset = preset;
+            settings.Threads = threads;
+
+            RunResult result;
+            if (!RunRoundTrip(video, settings, metrics, result)) {
+              printf("%12s run failed, skipping it.\n", backend.c_str());
+              continue;
+            }
+
+            printf("%12s %8u %6u %8s %7u | %8.1f %8.2f %8.2f %8.2f | %10zu %9.1f | %7.2f %7.2f %7.2f %7.4f %7.4f\n", backend.c_str(),
+              bitrateKbps, keyFrameInterval, GetVideoEncoderPresetName(preset), threads, result.EncodeFramesPerSecond,
+              result.P50EncodeMs, result.P90EncodeMs, result.P99EncodeMs, result.Bytes, result.Kbps, result.Quality.PsnrY,
+              result.Quality.PsnrU, result.Quality.PsnrV, result.Quality.Ssim, result.Quality.MsSsim);
+
+            results.push_back(result);
+          }
+        }
+      }
+    }
+  }
+
+  if (!results.empty()) {
+    double metricsFramesPerSecond = 0;
+    for (const RunResult& result : results) {
+      metricsFramesPerSecond += result.MetricsFramesPerSecond;
+    }
+    printf("\nQuality metrics measured at a mean of %.1f fps.\n", metricsFramesPerSecond / results.size());
+  }
+
+  if (!csvPath.empty() && !WriteCsv(csvPath, results)) {
+    return 1;
+  }
+
+  if (!jsonPath.empty() && !WriteJson(jsonPath, video, results)) {
+    return 1;
+  }
+
+  return (results.size() == runCount) ? 0 : 1;
+}
+
+/**
+* Encodes the input with one set of settings and decodes the output to measure
+* its quality against the input.
+* @param[in] video: the frames to encode.
+* @param[in] settings: the encoder backend and its settings.
+* @param[in] metrics: measures the decoded frames, its means are reset for the run.
+* @param[out] result: the speed, size and quality of the run.
+* @@Returns true if the input was encoded and decoded.
+*/
+bool RunRoundTrip(const Y4MVideo& video, const RunSettings& settings, VideoQualityMetrics& metrics, RunResult& result)
+{
+  result.Settings = settings;
+  metrics.Reset();
+
+  std::unique_ptr<VideoEncoder> encoder = CreateVideoEncoder(settings.Backend);
+  if (!encoder) {
+    printf("Encoder backend %s isn't available.\n", settings.Backend.c_str());
+    return false;
+  }
+
+  VideoEncoderConfig config;
+  config.Width = video.Width;
+  config.Height = video.Height;
+  config.FrameRateNum = video.FrameRateNum;
+  config.FrameRateDen = video.FrameRateDen;
+  config.BitrateKbps = settings.BitrateKbps;
+  config.KeyFrameInterval = settings.KeyFrameInterval;
+  config.Threads = settings.Threads;
+  config.Preset = settings.Preset;
+
+  if (!encoder->Init(config)) {
+    return false;
+  }
+
+  result.Codec = encoder->GetCodec();
+
+  std::unique_ptr<VideoDecoder> decoder;
+  for (const std::string& decoderName : GetVideoDecoderNames()) {
+    decoder = CreateVideoDecoder(decoderName);
+    if (decoder && decoder->SupportsCodec(encoder->GetCodec())) {
+      break;
+    }
+    decoder.reset();
+  }
+
+  if (!decoder) {
+    printf("No decoder backend for %s compiled in, build with VIDEO_DECODER_FFMPEG, VIDEO_DECODER_OPENH264 and/or VIDEO_DECODER_VPX defined.\n",
+      GetVideoCodecName(encoder->GetCodec()));
+    return false;
+  }
+
+  VideoFramePool pool;
+  VideoDecoderConfig decoderConfig;
+  decoderConfig.Codec = encoder->GetCodec();
+
+  if (!decoder->Init(decoderConfig, &pool)) {
+    return false;
+  }
+
+  EncodedAccessUnit accessUnit;
+  VideoFrameBuffer* pFrame = nullptr;
+  std::vector<double> encodeTimes;
+  double encodeSeconds = 0;
+  double metricsSeconds = 0;
+  int64_t frameDuration = (int64_t)VIDEO_ENCODER_CLOCK_RATE * video.FrameRateDen / video.FrameRateNum;
+
+  // Measures each decoded frame against the input frame with its timestamp.
+  auto pullFrames = [&]() {
+    VideoDecoderResult decodeResult;
+    while ((decodeResult = decoder->PullFrame(&pFrame)) != VideoDecoderResult::NeedMoreInput) {
+      if (decodeResult == VideoDecoderResult::Frame) {
+        size_t frameIndex = (size_t)((pFrame->Pts + frameDuration / 2) / frameDuration);
+
+        if (frameIndex < video.Frames.size() && pFrame->Width == video.Width && pFrame->Height == video.Height) {
+          QualityScores scores;
+          auto metricsStart = std::chrono::steady_clock::now();
+          metrics.Measure(GetI420QualityFrame(video.Frames[frameIndex].data(), video.Width, video.Height),
+            GetI420QualityFrame(pFrame->Data.data(), pFrame->Width, pFrame->Height), scores);
+          metricsSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - metricsStart).count();
+          result.DecodedFrames++;
+        }
+
+        pool.Release(pFrame);
+      }
+    }
+  };
+
+  for (size_t i = 0; i <= video.Frames.size(); i++) {
+    auto encodeStart = std::chrono::steady_clock::now();
+
+    if (i == video.Frames.size()) {
+      if (!encoder->Drain()) {
+        return false;
+      }
+    }
+    else if (!encoder->PushFrame(video.Frames[i].data(), (int64_t)i * frameDuration)) {
+      return false;
+    }
+
+    std::vector<EncodedAccessUnit> accessUnits;
+    while (encoder->PullAccessUnit(accessUnit)) {
+      accessUnits.push_back(accessUnit);
+    }
+
+    encodeSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - encodeStart).count();
+
+    for (const EncodedAccessUnit& encoded : accessUnits) {
+      result.Bytes += encoded.Data.size();
+      result.KeyFrames += encoded.IsKeyFrame ? 1 : 0;
+      encodeTimes.push_back(encoded.EncodeMs);
+
+      if (!decoder->PushAccessUnit(encoded.Data.data(), encoded.Data.size(), encoded.Pts)) {
+        return false;
+      }
+
+      pullFrames();
+    }
+  }
+
+  if (!decoder->Drain()) {
+    return false;
+  }
+  pullFrames();
+
+  double seconds = (double)video.Frames.size() * video.FrameRateDen / video.FrameRateNum;
+
+  result.EncodeFramesPerSecond = (encodeSeconds > 0) ? video.Frames.size() / encodeSeconds : 0;
+  result.P50EncodeMs = Percentile(encodeTimes, 50);
+  result.P90EncodeMs = Percentile(encodeTimes, 90);
+  result.P99EncodeMs = Percentile(encodeTimes, 99);
+  result.Kbps = result.Bytes * 8 / seconds / 1000;
+  result.Quality = metrics.GetMeanScores();
+  result.MetricsFramesPerSecond = (metricsSeconds > 0) ? result.DecodedFrames / metricsSeconds : 0;
+
+  if (result.DecodedFrames != video.Frames.size()) {
+    printf("%s at %ukbps decoded %zu of %zu frames, the quality metrics only include those.\n", settings.Backend.c_str(),
+      settings.BitrateKbps, result.DecodedFrames, video.Frames.size());
+  }
+
+  return true;
+}
+
+/* Gets the VideoEncoderPreset with the name GetVideoEncoderPresetName gives it. */
+bool ParsePreset(const std::string& name, VideoEncoderPreset& preset)
+{
+  for (VideoEncoderPreset candidate : { VideoEncoderPreset::Fast, VideoEncoderPreset::Default, VideoEncoderPreset::Slow }) {
+    if (name == GetVideoEncoderPresetName(candidate)) {
+      preset = candidate;
+      return true;
+    }
+  }
+  return false;
+}
+
+/* Splits a comma separated list, empty items are left out. */
+std::vector<std::string> SplitList(const std::string& list)
+{
+  std::vector<std::string> items;
+  size_t start = 0;
+
+  while (start <= list.size()) {
+    size_t end = list.find(',', start);
+    if (end == std::string::npos) {
+      end = list.size();
+    }
+
+    if (end > start) {
+      items.push_back(list.substr(start, end - start));
+    }
+    start = end + 1;
+  }
+
+  return items;
+}
+
+/**
+* Writes the results as CSV with a header row, one row per run.
+* @param[in] path: the file to write.
+* @param[in] results: the results of the runs.
+* @@Returns true if the file was written.
+*/
+bool WriteCsv(const std::string& path, const std::vector<RunResult>& results)
+{
+  FILE* pFile = fopen(path.c_str(), "w");
+  if (pFile == nullptr) {
+    printf("Failed to open %s for writing.\n", path.c_str());
+    return false;
+  }
+
+  fprintf(pFile, "backend,codec,bitrate_kbps,gop,preset,threads,encode_fps,p50_encode_ms,p90_encode_ms,p99_encode_ms,bytes,kbps,key_frames,decoded_frames,"
+    "psnr_y,psnr_u,psnr_v,psnr,ssim,ms_ssim\n");
+
+  for (const RunResult& result : results) {
+    const RunSettings& settings = result.Settings;
+    fprintf(pFile, "%s,%s,%u,%u,%s,%u,%.2f,%.3f,%.3f,%.3f,%zu,%.2f,%zu,%zu,%.3f,%.3f,%.3f,%.3f,%.5f,%.5f\n", settings.Backend.c_str(),
+      GetVideoCodecName(result.Codec), settings.BitrateKbps, settings.KeyFrameInterval, GetVideoEncoderPresetName(settings.Preset),
+      settings.Threads, result.EncodeFramesPerSecond, result.P50EncodeMs, result.P90EncodeMs, result.P99EncodeMs, result.Bytes,
+      result.Kbps, result.KeyFrames, result.DecodedFrames, result.Quality.PsnrY, result.Quality.PsnrU, result.Quality.PsnrV,
+      result.Quality.Psnr, result.Quality.Ssim, result.Quality.MsSsim);
+  }
+
+  fclose(pFile);
+  printf("Results written to %s.\n", path.c_str());
+  return true;
+}
+
+/**
+* Writes the input format and the results as a JSON object with a runs array.
+* @param[in] path: the file to write.
+* @param[in] video: the input, for its format.
+* @param[in] results: the results of the runs.
+* @@Returns true if the file was written.
+*/
+bool WriteJson(const std::string& path, const Y4MVideo& video, const std::vector<RunResult>& results)
+{
+  FILE* pFile = fopen(path.c_str(), "w");
+  if (pFile == nullptr) {
+    printf("Failed to open %s for writing.\n", path.c_str());
+    return false;
+  }
+
+  fprintf(pFile, "{\n  \"width\": %u,\n  \"height\": %u,\n  \"frame_rate\": %.3f,\n  \"frames\": %zu,\n  \"runs\": [",
+    video.Width, video.Height, (double)video.FrameRateNum / video.FrameRateDen, video.Frames.size());
+
+  for (size_t i = 0; i < results.size(); i++) {
+    const RunResult& result = results[i];
+    const RunSettings& settings = result.Settings;
+
+    // The backend names are all plain ASCII so they don't need escaping.
+    fprintf(pFile, "%s\n    { \"backend\": \"%s\", \"codec\": \"%s\", \"bitrate_kbps\": %u, \"gop\": %u, \"preset\": \"%s\", \"threads\": %u, "
+      "\"encode_fps\": %.2f, \"p50_encode_ms\": %.3f, \"p90_encode_ms\": %.3f, \"p99_encode_ms\": %.3f, \"bytes\": %zu, \"kbps\": %.2f, "
+      "\"key_frames\": %zu, \"decoded_frames\": %zu, \"psnr_y\": %.3f, \"psnr_u\": %.3f, \"psnr_v\": %.3f, \"psnr\": %.3f, "
+      "\"ssim\": %.5f, \"ms_ssim\": %.5f }", (i > 0) ? "," : "", settings.Backend.c_str(),
+      GetVideoCodecName(result.Codec), settings.BitrateKbps, settings.KeyFrameInterval, GetVideoEncoderPresetName(settings.Preset),
+      settings.Threads, result.EncodeFramesPerSecond, result.P50EncodeMs, result.P90EncodeMs, result.P99EncodeMs, result.Bytes,
+      result.Kbps, result.KeyFrames, result.DecodedFrames, result.Quality.PsnrY, result.Quality.PsnrU, result.Quality.PsnrV,
+      result.Quality.Psnr, result.Quality.Ssim, result.Quality.MsSsim);
+  }
+
+  fprintf(pFile, "\n  ]\n}\n");
+  fclose(pFile);
+  printf("Results written to %s.\n", path.c_str());
+  return true;
+}
@@ -0,0 +1,348 @@
+/******************************************************************************
+* Filename: SceneChangeBenchmark.cpp
+*
+* Description:
+* This file contains a C++ console application that measures the bitrate saved
+* by placing key frames with the SceneChangeDetector in the Common folder
+* rather than on the fixed 20 frame interval the WebRTC sample used. Each
+* encoder backend encodes the same Y4M recording at a range of bitrates, once
+* with each key frame placement, and the output is decoded with a VideoDecoder
+* backend to measure its luma PSNR against the input. The saving at equal PSNR
+* is the Bjontegaard delta rate (BD-rate) between the two sets of rate and PSNR
+* points, negative means the scene change placement needs fewer bits for the
+* same quality.
+*
+* The recording needs some scene cuts and static stretches for the comparison to
+* mean anything. One can be made by joining clips with ffmpeg:
+* ffmpeg -i a.mp4 -i b.mp4 -i c.mp4 -filter_complex "[0:v][1:v][2:v]concat=n=3:v=1[v]" -map "[v]" -vf scale=640:480 -pix_fmt yuv420p -frames:v 600 input.y4m
+*
+* Usage:
+* SceneChangeBenchmark input.y4m [max frames] [backend]
+*
+* Dependencies:
+* vcpkg install x264 openh264 libvpx ffmpeg
+*
+* The benchmark doesn't use Media Foundation so it also builds on Linux, leave
+* out the -D define and library for any backend that isn't installed. A decoder
+* backend for each encoder's codec is needed:
+* g++ -O2 -std=c++17 -DVIDEO_ENCODER_X264 -DVIDEO_ENCODER_VPX -DVIDEO_DECODER_FFMPEG SceneChangeBenchmark.cpp -lx264 -lvpx -lavcodec -lavutil -lpthread -o SceneChangeBenchmark
+*
+* License: Public Domain (no warranty, use at own risk)
+/******************************************************************************/
+
+#include "../Common/SceneChangeDetector.h"
+#include "../Common/VideoDecoderFactory.h"
+#include "../Common/VideoEncoderFactory.h"
+#include "../Common/Y4MReader.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <string>
+#include <utility>
+#include <vector>
+
+#define DEFAULT_MAX_FRAMES 600
+#define DEFAULT_BITS_PER_PIXEL 0.07     // The middle of the bitrate range for the input resolution.
+#define FIXED_KEY_FRAME_INTERVAL 20     // The interval the WebRTC sample used, kf_max_dist.
+#define SCENE_KEY_FRAME_INTERVAL 20     // Longest interval with the scene change detector while the scene is moving.
+#define SCENE_STATIC_KEY_FRAME_INTERVAL 150   // Longest interval with the scene change detector while the scene is static.
+#define RATE_POINTS 4
+#define BD_RATE_INTEGRATION_STEPS 100
+#define MAX_PSNR 100.0                  // Given to frames that are identical to the input.
+
+/* Multiples of the default bitrate each backend is encoded at. */
+static const double RATE_MULTIPLIERS[RATE_POINTS] = { 0.5, 0.75, 1.0, 1.5 };
+
+/* Results of encoding the whole input at one bitrate with one key frame placement. */
+struct RatePoint
+{
+  double Kbps = 0;
+  double Psnr = 0;                      // Mean luma PSNR of the decoded frames.
+  size_t KeyFrames = 0;
+  size_t SceneCuts = 0;
+  size_t DecodedFrames = 0;
+  double AnalyseUs = 0;                 // Mean time the scene change detector took per frame.
+};
+
+bool RunEncode(const Y4MVideo& video, const std::string& backend, unsigned int bitrateKbps, bool sceneChange, RatePoint& point);
+double GetLumaPsnr(const uint8_t* pA, const uint8_t* pB, unsigned int width, unsigned int height);
+double GetBdRate(std::vector<RatePoint> reference, std::vector<RatePoint> test);
+
+int main(int argc, char* argv[])
+{
+  if (argc < 2) {
+    printf("Usage: %s input.y4m [max frames] [backend]\n", argv[0]);
+    return 1;
+  }
+
+  std::vector<std::string> backends = GetVideoEncoderNames();
+  if (argc > 3) {
+    backends.assign(1, argv[3]);
+  }
+
+  if (backends.empty()) {
+    printf("No encoder backends compiled in, build with VIDEO_ENCODER_X264, VIDEO_ENCODER_OPENH264 and/or VIDEO_ENCODER_VPX defined.\n");
+    return 1;
+  }
+
+  unsigned int maxFrames = (argc > 2) ? atoi(argv[2]) : DEFAULT_MAX_FRAMES;
+
+  Y4MVideo video;
+  if (!LoadY4M(argv[1], maxFrames, video)) {
+    return 1;
+  }
+
+  double frameRate = (double)video.FrameRateNum / video.FrameRateDen;
+  unsigned int defaultKbps = (unsigned int)(video.Width * video.Height * frameRate * DEFAULT_BITS_PER_PIXEL / 1000);
+
+  printf("Input %ux%u at %.2f fps, %zu frames, fixed key frame interval %u, scene change intervals %u and %u when static.\n",
+    video.Width, video.Height, frameRate, video.Frames.size(), FIXED_KEY_FRAME_INTERVAL, SCENE_KEY_FRAME_INTERVAL, SCENE_STATIC_KEY_FRAME_INTERVAL);
+
+  printf("\n%12s %8s | %10s %8s %10s | %10s %8s %10s %6s %10s\n", "backend", "target", "fixed kbps", "PSNR", "keyframes",
+    "scene kbps", "PSNR", "keyframes", "cuts", "analyse us");
+
+  std::vector<std::pair<std::string, double>> bdRates;
+
+  for (const std::string& backend : backends) {
+    std::vector<RatePoint> fixedPoints, scenePoints;
+
+    for (int i = 0; i < RATE_POINTS; i++) {
+      unsigned int bitrateKbps = (unsigned int)(defaultKbps * RATE_MULTIPLIERS[i]);
+      RatePoint fixedPoint, scenePoint;
+
+      if (!RunEncode(video, backend, bitrateKbps, false, fixedPoint) ||
+        !RunEncode(video, backend, bitrateKbps, true, scenePoint)) {
+        return 1;
+      }
+
+      printf("%12s %8u | %10.1f %8.2f %10zu | %10.1f %8.2f %10zu %6zu %10.1f\n", backend.c_str(), bitrateKbps,
+        fixedPoint.Kbps, fixedPoint.Psnr, fixedPoint.KeyFrames, scenePoint.Kbps, scenePoint.Psnr, scenePoint.KeyFrames,
+        scenePoint.SceneCuts, scenePoint.AnalyseUs);
+
+      fixedPoints.push_back(fixedPoint);
+      scenePoints.push_back(scenePoint);
+    }
+
+    bdRates.push_back({ backend, GetBdRate(fixedPoints, scenePoints) });
+  }
+
+  printf("\n%12s %22s\n", "backend", "BD-rate at equal PSNR");
+
+  for (auto& bdRate : bdRates) {
+    if (std::isnan(bdRate.second)) {
+      printf("%12s %22s\n", bdRate.first.c_str(), "no PSNR overlap");
+    }
+    else {
+      printf("%12s %21.1f%%\n", bdRate.first.c_str(), bdRate.second);
+    }
+  }
+
+  return 0;
+}
+
+/**
+* Encodes the input at one bitrate and decodes the output to measure its quality.
+* @param[in] video: the frames to encode.
+* @param[in] backend: the VideoEncoder backend name.
+* @param[in] bitrateKbps: the target bitrate.
+* @param[in] sceneChange: true to place key frames with the scene change
+*  detector, false for the fixed interval.
+* @param[out] point: the bitrate and PSNR achieved.
+* @@Returns true if the input was encoded and decoded.
+*/
+bool RunEncode(const Y4MVideo& video, const std::string& backend, unsigned int bitrateKbps, bool sceneChange, RatePoint& point)
+{
+  std::unique_ptr<VideoEncoder> encoder = CreateVideoEncoder(backend);
+  if (!encoder) {
+    printf("Encoder backend %s isn't available.\n", backend.c_str());
+    return false;
+  }
+
+  VideoEncoderConfig config;
+  config.Width = video.Width;
+  config.Height = video.Height;
+  config.FrameRateNum = video.FrameRateNum;
+  config.FrameRateDen = video.FrameRateDen;
+  config.BitrateKbps = bitrateKbps;
+  config.KeyFrameInterval = sceneChange ? 0 : FIXED_KEY_FRAME_INTERVAL;     // The detector requests all the key frames itself.
+
+  if (!encoder->Init(config)) {
+    return false;
+  }
+
+  std::unique_ptr<VideoDecoder> decoder;
+  for (const std::string& decoderName : GetVideoDecoderNames()) {
+    decoder = CreateVideoDecoder(decoderName);
+    if (decoder && decoder->SupportsCodec(encoder->GetCodec())) {
+      break;
+    }
+    decoder.reset();
+  }
+
+  if (!decoder) {
+    printf("No decoder backend for %s compiled in, build with VIDEO_DECODER_FFMPEG, VIDEO_DECODER_OPENH264 and/or VIDEO_DECODER_VPX defined.\n",
+      GetVideoCodecName(encoder->GetCodec()));
+    return false;
+  }
+
+  VideoFramePool pool;
+  VideoDecoderConfig decoderConfig;
+  decoderConfig.Codec = encoder->GetCodec();
+
+  if (!decoder->Init(decoderConfig, &pool)) {
+    return false;
+  }
+
+  SceneChangeDetector detector(video.Width, video.Height, SCENE_KEY_FRAME_INTERVAL, SCENE_STATIC_KEY_FRAME_INTERVAL);
+  EncodedAccessUnit accessUnit;
+  VideoFrameBuffer* pFrame = nullptr;
+  size_t encodedBytes = 0;
+  double totalPsnr = 0;
+  double analyseUs = 0;
+  int64_t frameDuration = (int64_t)VIDEO_ENCODER_CLOCK_RATE * video.FrameRateDen / video.FrameRateNum;
+
+  // Measures the PSNR of each decoded frame against the input frame with its timestamp.
+  auto pullFrames = [&]() {
+    VideoDecoderResult decodeResult;
+    while ((decodeResult = decoder->PullFrame(&pFrame)) != VideoDecoderResult::NeedMoreInput) {
+      if (decodeResult == VideoDecoderResult::Frame) {
+        size_t frameIndex = (size_t)((pFrame->Pts + frameDuration / 2) / frameDuration);
+
+        if (frameIndex < video.Frames.size() && pFrame->Width == video.Width && pFrame->Height == video.Height) {
+          totalPsnr += GetLumaPsnr(video.Frames[frameIndex].data(), pFrame->Data.data(), video.Width, video.Height);
+          point.DecodedFrames++;
+        }
+
+        pool.Release(pFrame);
+      }
+    }
+  };
+
+  for (size_t i = 0; i <= video.Frames.size(); i++) {
+    if (i == video.Frames.size()) {
+      if (!encoder->Drain()) {
+        return false;
+      }
+    }
+    else {
+      if (sceneChange) {
+        auto analyseStart = std::chrono::steady_clock::now();
+        SceneKeyFrameReason reason = detector.Analyse(video.Frames[i].data(), video.Width, false);
+        analyseUs += std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - analyseStart).count();
+
+        if (reason != SceneKeyFrameReason::None) {
+          encoder->RequestKeyFrame();
+        }
+      }
+
+      if (!encoder->PushFrame(video.Frames[i].data(), (int64_t)i * frameDuration)) {
+        return false;
+      }
+    }
+
+    while (encoder->PullAccessUnit(accessUnit)) {
+      encodedBytes += accessUnit.Data.size();
+      point.KeyFrames += accessUnit.IsKeyFrame ? 1 : 0;
+
+      if (!decoder->PushAccessUnit(accessUnit.Data.data(), accessUnit.Data.size(), accessUnit.Pts)) {
+        return false;
+      }
+
+      pullFrames();
+    }
+  }
+
+  if (!decoder->Drain()) {
+    return false;
+  }
+  pullFrames();
+
+  double seconds = (double)video.Frames.size() * video.FrameRateDen / video.FrameRateNum;
+
+  point.Kbps = encodedBytes * 8 / seconds / 1000;
+  point.Psnr = (point.DecodedFrames > 0) ? totalPsnr / point.DecodedFrames : 0;
+  point.SceneCuts = detector.GetStats().SceneCuts;
+  point.AnalyseUs = sceneChange ? analyseUs / video.Frames.size() : 0;
+
+  if (point.DecodedFrames != video.Frames.size()) {
+    printf("%s at %ukbps decoded %zu of %zu frames, the PSNR only includes those.\n", backend.c_str(), bitrateKbps,
+      point.DecodedFrames, video.Frames.size());
+  }
+
+  return true;
+}
+
+/**
+* Gets the PSNR of one luma plane against another.
+* @param[in] pA: the reference frame.
+* @param[in] pB: the frame to measure.
+* @param[in] width: the frame width.
+* @param[in] height: the frame height.
+* @@Returns The PSNR in dB, MAX_PSNR if the planes are identical.
+*/
+double GetLumaPsnr(const uint8_t* pA, const uint8_t* pB, unsigned int width, unsigned int height)
+{
+  uint64_t squaredError = 0;
+  size_t samples = (size_t)width * height;
+
+  for (size_t i = 0; i < samples; i++) {
+    int difference = pA[i] - pB[i];
+    squaredError += difference * difference;
+  }
+
+  if (squaredError == 0) {
+    return MAX_PSNR;
+  }
+
+  double mse = (double)squaredError / samples;
+  return std::min(MAX_PSNR, 10 * std::log10(255.0 * 255.0 / mse));
+}
+
+/**
+* Gets the Bjontegaard delta rate, the average difference in bitrate between two
+* rate and PSNR curves over the PSNR range they share. The curves are piecewise
+* linear in log bitrate, which is less sensitive to a noisy point than the cubic
+* fit of the original method.
+* @param[in] reference: the points of the reference curve.
+* @param[in] test: the points of the curve being compared.
+* @@Returns The percentage change in bitrate of the test curve at equal PSNR, or NaN if the curves don't overlap.
+*/
+double GetBdRate(std::vector<RatePoint> reference, std::vector<RatePoint> test)
+{
+  auto byPsnr = [](const RatePoint& a, const RatePoint& b) { return a.Psnr < b.Psnr; };
+  std::sort(reference.begin(), reference.end(), byPsnr);
+  std::sort(test.begin(), test.end(), byPsnr);
+
+  double minPsnr = std::max(reference.front().Psnr, test.front().Psnr);
+  double maxPsnr = std::min(reference.back().Psnr, test.back().Psnr);
+  if (maxPsnr <= minPsnr) {
+    return NAN;
+  }
+
+  // Log bitrate at a PSNR by interpolating between the points either side of it.
+  auto logRateAt = [](const std::vector<RatePoint>& curve, double psnr) {
+    size_t i = 1;
+    while (i < curve.size() - 1 && curve[i].Psnr < psnr) {
+      i++;
+    }
+
+    const RatePoint& low = curve[i - 1];
+    const RatePoint& high = curve[i];
+    double fraction = (high.Psnr > low.Psnr) ? (psnr - low.Psnr) / (high.Psnr - low.Psnr) : 0;
+    return std::log(low.Kbps) + fraction * (std::log(high.Kbps) - std::log(low.Kbps));
+  };
+
+  double totalDifference = 0;
+  for (int step = 0; step <= BD_RATE_INTEGRATION_STEPS; step++) {
+    double psnr = minPsnr + (maxPsnr - minPsnr) * step / BD_RATE_INTEGRATION_STEPS;
+    double weight = (step == 0 || step == BD_RATE_INTEGRATION_STEPS) ? 0.5 : 1.0;     // Trapezoidal rule.
+    totalDifference += weight * (logRateAt(test, psnr) - logRateAt(reference, psnr));
+  }
+
+  double meanDifference = totalDifference / BD_RATE_INTEGRATION_STEPS;
+  return (std::exp(meanDifference) - 1) * 100;
+}
@@ -0,0 +1,326 @@
+/******************************************************************************
+* Filename: VideoDecoderBenchmark.cpp
+*
+* Description:
+* This file contains a C++ console application that measures the decode
+* throughput of the backends behind the codec neutral VideoDecoder interface in
+* the Common folder, FFmpeg libavcodec, openh264 and libvpx, with each threading
+* mode they support. The video track is demuxed from an mp4 file with
+* libavformat, H264 is converted to Annex B as the openh264 decoder and the RTP
+* depacketisers use, and held in memory so file reads aren't included in the
+* timings. The track is decoded a number of times back to back to get a stable
+* figure from a short clip.
+*
+* Decoded frames go into a VideoFramePool that is sized once up front and the
+* number of frame allocations is reported to check there are none per frame.
+*
+* Usage:
+* VideoDecoderBenchmark [input.mp4] [repeats] [backend]
+*
+* Dependencies:
+* vcpkg install ffmpeg openh264 libvpx
+*
+* The benchmark doesn't use Media Foundation so it also builds on Linux, leave
+* out the -D define and library for the openh264 or libvpx backends if they
+* aren't installed:
+* g++ -O2 -std=c++17 -DVIDEO_DECODER_FFMPEG -DVIDEO_DECODER_OPENH264 -DVIDEO_DECODER_VPX VideoDecoderBenchmark.cpp -lavformat -lavcodec -lavutil -lopenh264 -lvpx -lpthread -o VideoDecoderBenchmark
+*
+* License: Public Domain (no warranty, use at own risk)
+/******************************************************************************/
+
+#include "../Common/VideoDecoderFactory.h"
+
+extern "C" {
+#include <libavformat/avformat.h>
+#include <libavcodec/bsf.h>
+}
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define DEFAULT_INPUT_FILE "../MediaFiles/sound_in_sync_test.mp4"
+#define DEFAULT_REPEATS 20
+#define H264_ANNEXB_FILTER "h264_mp4toannexb"
+
+/* One access unit from the input file. */
+struct AccessUnit
+{
+  std::vector<uint8_t> Data;
+  int64_t Pts = 0;
+};
+
+/* The encoded video track loaded from the input file. */
+struct EncodedVideo
+{
+  VideoCodec Codec = VideoCodec::H264;
+  unsigned int Width = 0;
+  unsigned int Height = 0;
+  int64_t Duration = 0;                 // In the stream time base, used to offset the timestamps of each repeat.
+  std::vector<AccessUnit> AccessUnits;
+};
+
+/* Results of decoding the input with one backend and threading mode. */
+struct BenchmarkResult
+{
+  double FramesPerSecond = 0;
+  double MsPerFrame = 0;
+  size_t Frames = 0;
+  size_t FormatChanges = 0;
+  size_t PoolAllocations = 0;
+};
+
+bool LoadVideoTrack(const char* path, EncodedVideo& video);
+bool RunBenchmark(const EncodedVideo& video, const std::string& backend, VideoDecoderThreading threading, unsigned int repeats,
+  BenchmarkResult& result);
+const char* GetThreadingName(VideoDecoderThreading threading);
+
+int main(int argc, char* argv[])
+{
+  const char* inputPath = (argc > 1) ? argv[1] : DEFAULT_INPUT_FILE;
+  unsigned int repeats = (argc > 2) ? atoi(argv[2]) : DEFAULT_REPEATS;
+
+  std::vector<std::string> backends = GetVideoDecoderNames();
+  if (argc > 3) {
+    backends.assign(1, argv[3]);
+  }
+
+  if (backends.empty()) {
+    printf("No decoder backends compiled in, build with VIDEO_DECODER_FFMPEG, VIDEO_DECODER_OPENH264 and/or VIDEO_DECODER_VPX defined.\n");
+    return 1;
+  }
+
+  EncodedVideo video;
+  if (!LoadVideoTrack(inputPath, video)) {
+    return 1;
+  }
+
+  printf("Input %s %ux%u, %zu access units decoded %u times, %u cores.\n", GetVideoCodecName(video.Codec), video.Width, video.Height,
+    video.AccessUnits.size(), repeats, std::thread::hardware_concurrency());
+
+  printf("\n%10s %10s %10s %10s %8s %14s %12s\n", "backend", "threading", "fps", "ms/frame", "frames", "format changes", "allocations");
+
+  const VideoDecoderThreading threadingModes[] = { VideoDecoderThreading::None, VideoDecoderThreading::Slice, VideoDecoderThreading::Frame };
+
+  for (const std::string& backend : backends) {
+    std::unique_ptr<VideoDecoder> decoder = CreateVideoDecoder(backend);
+    if (!decoder) {
+      printf("Decoder backend %s isn't available.\n", backend.c_str());
+      return 1;
+    }
+    else if (!decoder->SupportsCodec(video.Codec)) {
+      printf("%10s doesn't support %s.\n", backend.c_str(), GetVideoCodecName(video.Codec));
+      continue;
+    }
+
+    for (VideoDecoderThreading threading : threadingModes) {
+      if (!decoder->SupportsThreading(threading)) {
+        continue;
+      }
+
+      BenchmarkResult result;
+      if (!RunBenchmark(video, backend, threading, repeats, result)) {
+        return 1;
+      }
+
+      printf("%10s %10s %10.1f %10.3f %8zu %14zu %12zu\n", backend.c_str(), GetThreadingName(threading), result.FramesPerSecond,
+        result.MsPerFrame, result.Frames, result.FormatChanges, result.PoolAllocations);
+    }
+  }
+
+  return 0;
+}
+
+/**
+* Demuxes the first video track of a file into memory. H264 is converted from
+* the length prefixed mp4 format to Annex B with the parameter sets in band.
+* @param[in] path: the path of the input file.
+* @param[out] video: the access units and their format.
+* @@Returns true if the track was loaded.
+*/
+bool LoadVideoTrack(const char* path, EncodedVideo& video)
+{
+  AVFormatContext* pFormatContext = nullptr;
+  AVBSFContext* pBsfContext = nullptr;
+  AVPacket* pPacket = av_packet_alloc();
+  int streamIndex = -1;
+  bool loaded = false;
+
+  if (avformat_open_input(&pFormatContext, path, nullptr, nullptr) < 0) {
+    printf("Failed to open %s.\n", path);
+    goto done;
+  }
+
+  if (avformat_find_stream_info(pFormatContext, nullptr) < 0) {
+    printf("Failed to read the stream information from %s.\n", path);
+    goto done;
+  }
+
+  streamIndex = av_find_best_stream(pFormatContext, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+  if (streamIndex < 0) {
+    printf("No video track in %s.\n", path);
+    goto done;
+  }
+
+  {
+    AVStream* pStream = pFormatContext->streams[streamIndex];
+
+    switch (pStream->codecpar->codec_id) {
+    case AV_CODEC_ID_H264:
+      video.Codec = VideoCodec::H264;
+      break;
+    case AV_CODEC_ID_VP8:
+      video.Codec = VideoCodec::VP8;
+      break;
+    case AV_CODEC_ID_VP9:
+      video.Codec = VideoCodec::VP9;
+      break;
+    default:
+      printf("Unsupported video codec %s in %s.\n", avcodec_get_name(pStream->codecpar->codec_id), path);
+      goto done;
+    }
+
+    video.Width = pStream->codecpar->width;
+    video.Height = pStream->codecpar->height;
+
+    if (video.Codec == VideoCodec::H264) {
+      if (av_bsf_alloc(av_bsf_get_by_name(H264_ANNEXB_FILTER), &pBsfContext) < 0 ||
+        avcodec_parameters_copy(pBsfContext->par_in, pStream->codecpar) < 0) {
+        printf("Failed to create the %s bitstream filter.\n", H264_ANNEXB_FILTER);
+        goto done;
+      }
+
+      pBsfContext->time_base_in = pStream->time_base;
+
+      if (av_bsf_init(pBsfContext) < 0) {
+        printf("Failed to initialise the %s bitstream filter.\n", H264_ANNEXB_FILTER);
+        goto done;
+      }
+    }
+
+    while (av_read_frame(pFormatContext, pPacket) >= 0) {
+      if (pPacket->stream_index != streamIndex) {
+        av_packet_unref(pPacket);
+        continue;
+      }
+
+      int64_t end = pPacket->pts + pPacket->duration;
+      if (end > video.Duration) {
+        video.Duration = end;
+      }
+
+      if (pBsfContext != nullptr) {
+        if (av_bsf_send_packet(pBsfContext, pPacket) < 0) {
+          printf("Failed to convert H264 access unit %zu to Annex B.\n", video.AccessUnits.size());
+          goto done;
+        }
+
+        while (av_bsf_receive_packet(pBsfContext, pPacket) == 0) {
+          video.AccessUnits.push_back({ std::vector<uint8_t>(pPacket->data, pPacket->data + pPacket->size), pPacket->pts });
+          av_packet_unref(pPacket);
+        }
+      }
+      else {
+        video.AccessUnits.push_back({ std::vector<uint8_t>(pPacket->data, pPacket->data + pPacket->size), pPacket->pts });
+        av_packet_unref(pPacket);
+      }
+    }
+  }
+
+  if (video.AccessUnits.empty()) {
+    printf("No video access units in %s.\n", path);
+    goto done;
+  }
+
+  loaded = true;
+
+done:
+
+  av_bsf_free(&pBsfContext);
+  av_packet_free(&pPacket);
+  avformat_close_input(&pFormatContext);
+
+  return loaded;
+}
+
+/**
+* Decodes the access units a number of times with one backend and threading
+* mode, returning each frame to the pool as soon as it comes out.
+* @param[in] video: the access units to decode.
+* @param[in] backend: the VideoDecoder backend name.
+* @param[in] threading: the threading mode.
+* @param[in] repeats: the number of times to decode the access units.
+* @param[out] result: the throughput measurements.
+* @@Returns true if all the access units were decoded.
+*/
+bool RunBenchmark(const EncodedVideo& video, const std::string& backend, VideoDecoderThreading threading, unsigned int repeats,
+  BenchmarkResult& result)
+{
+  VideoFramePool pool;
+  std::unique_ptr<VideoDecoder> decoder = CreateVideoDecoder(backend);
+
+  VideoDecoderConfig config;
+  config.Codec = video.Codec;
+  config.Threading = threading;
+  config.Threads = (threading == VideoDecoderThreading::None) ? 1 : std::thread::hardware_concurrency();
+
+  if (!decoder || !decoder->Init(config, &pool)) {
+    return false;
+  }
+
+  VideoFrameBuffer* pFrame = nullptr;
+  VideoDecoderResult decodeResult;
+  size_t totalAccessUnits = video.AccessUnits.size() * repeats;
+
+  auto benchmarkStart = std::chrono::steady_clock::now();
+
+  for (size_t i = 0; i <= totalAccessUnits; i++) {
+    if (i == totalAccessUnits) {
+      if (!decoder->Drain()) {
+        return false;
+      }
+    }
+    else {
+      const AccessUnit& accessUnit = video.AccessUnits[i % video.AccessUnits.size()];
+      int64_t pts = accessUnit.Pts + (int64_t)(i / video.AccessUnits.size()) * video.Duration;
+
+      if (!decoder->PushAccessUnit(accessUnit.Data.data(), accessUnit.Data.size(), pts)) {
+        return false;
+      }
+    }
+
+    while ((decodeResult = decoder->PullFrame(&pFrame)) != VideoDecoderResult::NeedMoreInput) {
+      if (decodeResult == VideoDecoderResult::FormatChanged) {
+        result.FormatChanges++;
+      }
+      else {
+        result.Frames++;
+        pool.Release(pFrame);
+      }
+    }
+  }
+
+  double elapsedSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - benchmarkStart).count();
+
+  result.FramesPerSecond = result.Frames / elapsedSeconds;
+  result.MsPerFrame = (result.Frames > 0) ? elapsedSeconds * 1000 / result.Frames : 0;
+  result.PoolAllocations = pool.GetAllocationCount();
+
+  return true;
+}
+
+const char* GetThreadingName(VideoDecoderThreading threading)
+{
+  switch (threading) {
+  case VideoDecoderThreading::Slice:
+    return "slice";
+  case VideoDecoderThreading::Frame:
+    return "frame";
+  default:
+    return "none";
+  }
+}
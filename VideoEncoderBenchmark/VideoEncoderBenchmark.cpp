@@ -0,0 +1,454 @@
+/******************************************************************************
+* Filename: VideoEncoderBenchmark.cpp
+*
+* Description:
+* This file contains a C++ console application that compares the software
+* encoders behind the codec neutral VideoEncoder interface in the Common folder,
+* x264, openh264 and libvpx VP8/VP9. Each backend encodes the same Y4M
+* recording through the same push frame, pull access unit loop the H264 samples
+* use with the Media Foundation MFT. Half way through, the target bitrate is
+* halved and a key frame requested, the same as a sender reacting to congestion
+* feedback, so the bitrate either side of the change shows how quickly each
+* encoder's rate control follows it.
+*
+* A second table compares a key frame every REFRESH_PERIOD frames against intra
+* refresh over the same period, for the backends that support it. Key frames are
+* several times the size of the frames around them and, once paced out at the
+* target bitrate, the packets behind them queue. The spread of the frame sizes
+* and the 99th percentile queueing delay of the packets through a simulated
+* pacer show how much intra refresh smooths that out.
+*
+* A third table compares the time to the first encoded frame of a new session
+* when its encoder is created from cold against one leased from a warm
+* VideoEncoderPool, with the pool's hit rate and the start up time it saved.
+*
+* A Y4M test file can be recorded from a webcam or converted from an mp4 with ffmpeg:
+* ffmpeg -i input.mp4 -vf scale=1280:720 -pix_fmt yuv420p -frames:v 300 input.y4m
+*
+* Usage:
+* VideoEncoderBenchmark input.y4m [max frames] [bitrate kbps] [backend]
+*
+* Dependencies:
+* vcpkg install x264 openh264 libvpx
+*
+* The benchmark doesn't use Media Foundation so it also builds on Linux, leave
+* out the -D define and library for any backend that isn't installed:
+* g++ -O2 -std=c++17 -DVIDEO_ENCODER_X264 -DVIDEO_ENCODER_OPENH264 -DVIDEO_ENCODER_VPX VideoEncoderBenchmark.cpp -lx264 -lopenh264 -lvpx -lpthread -o VideoEncoderBenchmark
+*
+* License: Public Domain (no warranty, use at own risk)
+/******************************************************************************/
+
+#include "../Common/VideoEncoderFactory.h"
+#include "../Common/VideoEncoderPool.h"
+#include "../Common/Y4MReader.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define DEFAULT_MAX_FRAMES 300
+#define DEFAULT_BITS_PER_PIXEL 0.07     // Used to pick a bitrate for the input resolution if none is specified.
+#define DEFAULT_KEY_FRAME_INTERVAL 300  // Frames between scheduled key frames, only the requested one will be seen with the default max frames.
+#define STARTUP_SESSIONS 20             // Sessions started one after the other for the start up comparison.
+#define STARTUP_SESSION_FRAMES 30       // Frames each start up session encodes before it ends.
+#define REFRESH_PERIOD 30               // Key frame interval, and intra refresh period, for the frame size comparison.
+#define PACER_PACKET_SIZE 1200          // Access units are split into packets of this size for the pacer.
+#define PACER_BITRATE_FACTOR 1.0        // The simulated pacer sends at this multiple of the target bitrate.
+
+/* Results of encoding the whole input with one backend. */
+struct BenchmarkResult
+{
+  double FramesPerSecond = 0;
+  double MeanLatencyMs = 0;
+  double P50LatencyMs = 0;
+  double P99LatencyMs = 0;
+  double FirstHalfKbps = 0;             // Before the bitrate is halved.
+  double SecondHalfKbps = 0;            // After the bitrate is halved.
+  size_t AccessUnits = 0;
+  size_t KeyFrames = 0;
+};
+
+/* Frame size spread and pacer queueing for one backend with key frames or intra refresh. */
+struct RefreshResult
+{
+  double Kbps = 0;
+  double MeanFrameBytes = 0;
+  double FrameSizeCv = 0;               // Standard deviation of the frame sizes over their mean.
+  double MaxFrameRatio = 0;             // Largest frame over the mean.
+  double P99QueueMs = 0;                // Time packets wait in the pacer before being sent.
+  size_t KeyFrames = 0;
+};
+
+/* Results of starting sessions with cold and pooled encoders for one backend. */
+struct StartupResult
+{
+  double MeanColdFirstFrameMs = 0;      // Encoder created for the session, to the first access unit.
+  double MeanPooledFirstFrameMs = 0;    // Encoder leased from the pool, to the first access unit.
+  VideoEncoderPoolMetrics PoolMetrics;
+};
+
+bool RunBenchmark(const Y4MVideo& video, const std::string& backend, unsigned int bitrateKbps, BenchmarkResult& result);
+bool RunRefreshBenchmark(const Y4MVideo& video, const std::string& backend, unsigned int bitrateKbps, bool intraRefresh, RefreshResult& result);
+bool RunStartupBenchmark(const Y4MVideo& video, const std::string& backend, unsigned int bitrateKbps, StartupResult& result);
+bool EncodeSession(VideoEncoder* pEncoder, const Y4MVideo& video, std::chrono::steady_clock::time_point sessionStart, double& firstFrameMs);
+
+int main(int argc, char* argv[])
+{
+  if (argc < 2) {
+    printf("Usage: %s input.y4m [max frames] [bitrate kbps] [backend]\n", argv[0]);
+    return 1;
+  }
+
+  std::vector<std::string> backends = GetVideoEncoderNames();
+  if (argc > 4) {
+    backends.assign(1, argv[4]);
+  }
+
+  if (backends.empty()) {
+    printf("No encoder backends compiled in, build with VIDEO_ENCODER_X264, VIDEO_ENCODER_OPENH264 and/or VIDEO_ENCODER_VPX defined.\n");
+    return 1;
+  }
+
+  unsigned int maxFrames = (argc > 2) ? atoi(argv[2]) : DEFAULT_MAX_FRAMES;
+
+  Y4MVideo video;
+  if (!LoadY4M(argv[1], maxFrames, video)) {
+    return 1;
+  }
+
+  double frameRate = (double)video.FrameRateNum / video.FrameRateDen;
+  unsigned int bitrateKbps = (argc > 3) ? atoi(argv[3]) :
+    (unsigned int)(video.Width * video.Height * frameRate * DEFAULT_BITS_PER_PIXEL / 1000);
+
+  printf("Input %ux%u at %.2f fps, %zu frames, target bitrate %u kbps then %u kbps, %u cores.\n",
+    video.Width, video.Height, frameRate, video.Frames.size(), bitrateKbps, bitrateKbps / 2, std::thread::hardware_concurrency());
+
+  printf("\n%12s %10s %10s %10s %10s %12s %12s %8s %10s\n", "backend", "fps", "mean ms", "p50 ms", "p99 ms", "1st kbps", "2nd kbps",
+    "frames", "keyframes");
+
+  for (const std::string& backend : backends) {
+    BenchmarkResult result;
+    if (!RunBenchmark(video, backend, bitrateKbps, result)) {
+      return 1;
+    }
+
+    printf("%12s %10.1f %10.2f %10.2f %10.2f %12.1f %12.1f %8zu %10zu\n", backend.c_str(), result.FramesPerSecond,
+      result.MeanLatencyMs, result.P50LatencyMs, result.P99LatencyMs, result.FirstHalfKbps, result.SecondHalfKbps,
+      result.AccessUnits, result.KeyFrames);
+  }
+
+  printf("\n%12s %14s %10s %12s %10s %10s %12s %10s\n", "backend", "key frames", "kbps", "mean bytes", "size cv", "max/mean",
+    "p99 queue ms", "keyframes");
+
+  for (const std::string& backend : backends) {
+    for (int intraRefresh = 0; intraRefresh <= 1; intraRefresh++) {
+      std::string mode = intraRefresh ? "intra refresh" : "every " + std::to_string(REFRESH_PERIOD);
+      std::unique_ptr<VideoEncoder> encoder = CreateVideoEncoder(backend);
+
+      if (intraRefresh && encoder && !encoder->SupportsIntraRefresh()) {
+        printf("%12s %14s %10s\n", backend.c_str(), mode.c_str(), "n/a");
+        continue;
+      }
+
+      RefreshResult result;
+      if (!RunRefreshBenchmark(video, backend, bitrateKbps, intraRefresh != 0, result)) {
+        return 1;
+      }
+
+      printf("%12s %14s %10.1f %12.0f %10.2f %10.2f %12.1f %10zu\n", backend.c_str(), mode.c_str(), result.Kbps, result.MeanFrameBytes,
+        result.FrameSizeCv, result.MaxFrameRatio, result.P99QueueMs, result.KeyFrames);
+    }
+  }
+
+  printf("\n%12s %16s %16s %10s %12s %12s\n", "backend", "cold first ms", "pooled first ms", "hit rate", "cold start", "saved ms");
+
+  for (const std::string& backend : backends) {
+    StartupResult result;
+    if (!RunStartupBenchmark(video, backend, bitrateKbps, result)) {
+      return 1;
+    }
+
+    printf("%12s %16.2f %16.2f %9.0f%% %12.2f %12.1f\n", backend.c_str(), result.MeanColdFirstFrameMs, result.MeanPooledFirstFrameMs,
+      result.PoolMetrics.HitRate * 100, result.PoolMetrics.MeanColdStartMs, result.PoolMetrics.SavedStartMs);
+  }
+
+  return 0;
+}
+
+/**
+* Encodes all the frames with one backend, halving the bitrate half way through,
+* and collects the per frame encode times the backend reports.
+* @param[in] video: the frames to encode.
+* @param[in] backend: the VideoEncoder backend name.
+* @param[in] bitrateKbps: the target bitrate for the first half.
+* @param[out] result: the throughput, latency and bitrate measurements.
+* @@Returns true if all the frames were encoded.
+*/
+bool RunBenchmark(const Y4MVideo& video, const std::string& backend, unsigned int bitrateKbps, BenchmarkResult& result)
+{
+  std::unique_ptr<VideoEncoder> encoder = CreateVideoEncoder(backend);
+  if (!encoder) {
+    printf("Encoder backend %s isn't available.\n", backend.c_str());
+    return false;
+  }
+
+  VideoEncoderConfig config;
+  config.Width = video.Width;
+  config.Height = video.Height;
+  config.FrameRateNum = video.FrameRateNum;
+  config.FrameRateDen = video.FrameRateDen;
+  config.BitrateKbps = bitrateKbps;
+  config.KeyFrameInterval = DEFAULT_KEY_FRAME_INTERVAL;
+
+  if (!encoder->Init(config)) {
+    return false;
+  }
+
+  std::vector<double> latencies;
+  size_t encodedBytes[2] = { 0, 0 };
+  size_t halfWay = video.Frames.size() / 2;
+  EncodedAccessUnit accessUnit;
+
+  auto benchmarkStart = std::chrono::steady_clock::now();
+
+  for (size_t i = 0; i <= video.Frames.size(); i++) {
+    if (i == video.Frames.size()) {
+      if (!encoder->Drain()) {
+        return false;
+      }
+    }
+    else {
+      if (i == halfWay && i > 0) {
+        if (!encoder->Reconfigure(bitrateKbps / 2, video.FrameRateNum, video.FrameRateDen, DEFAULT_KEY_FRAME_INTERVAL)) {
+          return false;
+        }
+        encoder->RequestKeyFrame();
+      }
+
+      int64_t pts = (int64_t)i * VIDEO_ENCODER_CLOCK_RATE * video.FrameRateDen / video.FrameRateNum;
+      if (!encoder->PushFrame(video.Frames[i].data(), pts)) {
+        return false;
+      }
+    }
+
+    while (encoder->PullAccessUnit(accessUnit)) {
+      bool secondHalf = accessUnit.Pts >= (int64_t)halfWay * VIDEO_ENCODER_CLOCK_RATE * video.FrameRateDen / video.FrameRateNum;
+      encodedBytes[secondHalf ? 1 : 0] += accessUnit.Data.size();
+      latencies.push_back(accessUnit.EncodeMs);
+      result.AccessUnits++;
+      result.KeyFrames += accessUnit.IsKeyFrame ? 1 : 0;
+    }
+  }
+
+  double elapsedSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - benchmarkStart).count();
+  double firstHalfSeconds = (double)halfWay * video.FrameRateDen / video.FrameRateNum;
+  double secondHalfSeconds = (double)(video.Frames.size() - halfWay) * video.FrameRateDen / video.FrameRateNum;
+
+  double totalLatency = 0;
+  for (double latency : latencies) {
+    totalLatency += latency;
+  }
+
+  result.FramesPerSecond = video.Frames.size() / elapsedSeconds;
+  result.MeanLatencyMs = latencies.empty() ? 0 : totalLatency / latencies.size();
+  result.P50LatencyMs = Percentile(latencies, 50);
+  result.P99LatencyMs = Percentile(latencies, 99);
+  result.FirstHalfKbps = (firstHalfSeconds > 0) ? encodedBytes[0] * 8 / firstHalfSeconds / 1000 : 0;
+  result.SecondHalfKbps = (secondHalfSeconds > 0) ? encodedBytes[1] * 8 / secondHalfSeconds / 1000 : 0;
+
+  return true;
+}
+
+/**
+* Encodes all the frames with one backend, with either a key frame every
+* REFRESH_PERIOD frames or intra refresh over the same period, and measures the
+* spread of the frame sizes and the queueing delay of their packets through a
+* pacer sending at the target bitrate.
+* @param[in] video: the frames to encode.
+* @param[in] backend: the VideoEncoder backend name.
+* @param[in] bitrateKbps: the target bitrate.
+* @param[in] intraRefresh: true for intra refresh, false for periodic key frames.
+* @param[out] result: the frame size and queueing measurements.
+* @@Returns true if all the frames were encoded.
+*/
+bool RunRefreshBenchmark(const Y4MVideo& video, const std::string& backend, unsigned int bitrateKbps, bool intraRefresh, RefreshResult& result)
+{
+  std::unique_ptr<VideoEncoder> encoder = CreateVideoEncoder(backend);
+  if (!encoder) {
+    printf("Encoder backend %s isn't available.\n", backend.c_str());
+    return false;
+  }
+
+  VideoEncoderConfig config;
+  config.Width = video.Width;
+  config.Height = video.Height;
+  config.FrameRateNum = video.FrameRateNum;
+  config.FrameRateDen = video.FrameRateDen;
+  config.BitrateKbps = bitrateKbps;
+  config.KeyFrameInterval = REFRESH_PERIOD;
+  config.IntraRefresh = intraRefresh;
+
+  if (!encoder->Init(config)) {
+    return false;
+  }
+
+  std::vector<double> frameSizes;
+  std::vector<double> queueDelays;
+  double pacerBytesPerMs = bitrateKbps * PACER_BITRATE_FACTOR / 8;
+  double pacerFreeAtMs = 0;             // When the pacer finishes sending the packets already queued.
+  EncodedAccessUnit accessUnit;
+
+  for (size_t i = 0; i <= video.Frames.size(); i++) {
+    if (i == video.Frames.size()) {
+      if (!encoder->Drain()) {
+        return false;
+      }
+    }
+    else {
+      int64_t pts = (int64_t)i * VIDEO_ENCODER_CLOCK_RATE * video.FrameRateDen / video.FrameRateNum;
+      if (!encoder->PushFrame(video.Frames[i].data(), pts)) {
+        return false;
+      }
+    }
+
+    while (encoder->PullAccessUnit(accessUnit)) {
+      frameSizes.push_back((double)accessUnit.Data.size());
+      result.KeyFrames += accessUnit.IsKeyFrame ? 1 : 0;
+
+      // The access unit's packets are all queued at its capture time and sent one after the other.
+      double capturedAtMs = (double)accessUnit.Pts * 1000 / VIDEO_ENCODER_CLOCK_RATE;
+      for (size_t offset = 0; offset < accessUnit.Data.size(); offset += PACER_PACKET_SIZE) {
+        size_t packetSize = std::min((size_t)PACER_PACKET_SIZE, accessUnit.Data.size() - offset);
+        double sendAtMs = std::max(capturedAtMs, pacerFreeAtMs);
+        queueDelays.push_back(sendAtMs - capturedAtMs);
+        pacerFreeAtMs = sendAtMs + packetSize / pacerBytesPerMs;
+      }
+    }
+  }
+
+  if (frameSizes.empty()) {
+    return true;
+  }
+
+  double totalBytes = 0, maxBytes = 0;
+  for (double frameSize : frameSizes) {
+    totalBytes += frameSize;
+    maxBytes = std::max(maxBytes, frameSize);
+  }
+
+  double mean = totalBytes / frameSizes.size();
+  double variance = 0;
+  for (double frameSize : frameSizes) {
+    variance += (frameSize - mean) * (frameSize - mean);
+  }
+  variance /= frameSizes.size();
+
+  double seconds = (double)video.Frames.size() * video.FrameRateDen / video.FrameRateNum;
+
+  result.Kbps = totalBytes * 8 / seconds / 1000;
+  result.MeanFrameBytes = mean;
+  result.FrameSizeCv = (mean > 0) ? std::sqrt(variance) / mean : 0;
+  result.MaxFrameRatio = (mean > 0) ? maxBytes / mean : 0;
+  result.P99QueueMs = Percentile(queueDelays, 99);
+
+  return true;
+}
+
+/**
+* Starts a series of short sessions, first creating an encoder for each one and
+* then leasing them from a pool, and measures the time from the start of each
+* session to its first access unit.
+* @param[in] video: the frames to encode.
+* @param[in] backend: the VideoEncoder backend name.
+* @param[in] bitrateKbps: the target bitrate.
+* @param[out] result: the time to first frame and pool metrics.
+* @@Returns true if all the sessions were encoded.
+*/
+bool RunStartupBenchmark(const Y4MVideo& video, const std::string& backend, unsigned int bitrateKbps, StartupResult& result)
+{
+  VideoEncoderConfig config;
+  config.Width = video.Width;
+  config.Height = video.Height;
+  config.FrameRateNum = video.FrameRateNum;
+  config.FrameRateDen = video.FrameRateDen;
+  config.BitrateKbps = bitrateKbps;
+  config.KeyFrameInterval = DEFAULT_KEY_FRAME_INTERVAL;
+
+  double coldTotalMs = 0;
+  double pooledTotalMs = 0;
+
+  for (unsigned int i = 0; i < STARTUP_SESSIONS; i++) {
+    auto sessionStart = std::chrono::steady_clock::now();
+    double firstFrameMs = 0;
+
+    std::unique_ptr<VideoEncoder> encoder = CreateVideoEncoder(backend);
+    if (!encoder || !encoder->Init(config) || !EncodeSession(encoder.get(), video, sessionStart, firstFrameMs)) {
+      printf("Cold start session %u failed for %s.\n", i, backend.c_str());
+      return false;
+    }
+
+    coldTotalMs += firstFrameMs;
+  }
+
+  VideoEncoderPool pool;
+  if (!pool.Warm(backend, config)) {
+    return false;
+  }
+
+  for (unsigned int i = 0; i < STARTUP_SESSIONS; i++) {
+    auto sessionStart = std::chrono::steady_clock::now();
+    double firstFrameMs = 0;
+
+    std::unique_ptr<VideoEncoder> encoder = pool.Lease(backend, config);
+    if (!encoder || !EncodeSession(encoder.get(), video, sessionStart, firstFrameMs)) {
+      printf("Pooled session %u failed for %s.\n", i, backend.c_str());
+      return false;
+    }
+
+    pool.Return(std::move(encoder));
+    pooledTotalMs += firstFrameMs;
+  }
+
+  result.MeanColdFirstFrameMs = coldTotalMs / STARTUP_SESSIONS;
+  result.MeanPooledFirstFrameMs = pooledTotalMs / STARTUP_SESSIONS;
+  result.PoolMetrics = pool.GetMetrics();
+
+  return true;
+}
+
+/**
+* Encodes the first frames of the input as a short session with timestamps
+* starting from zero.
+* @param[in] pEncoder: the initialised encoder.
+* @param[in] video: the frames to encode.
+* @param[in] sessionStart: when the session started, before its encoder was created or leased.
+* @param[out] firstFrameMs: the time from the session start to the first access unit.
+* @@Returns true if the frames were encoded.
+*/
+bool EncodeSession(VideoEncoder* pEncoder, const Y4MVideo& video, std::chrono::steady_clock::time_point sessionStart, double& firstFrameMs)
+{
+  EncodedAccessUnit accessUnit;
+  bool gotFirstFrame = false;
+
+  for (size_t i = 0; i < STARTUP_SESSION_FRAMES && i < video.Frames.size(); i++) {
+    int64_t pts = (int64_t)i * VIDEO_ENCODER_CLOCK_RATE * video.FrameRateDen / video.FrameRateNum;
+    if (!pEncoder->PushFrame(video.Frames[i].data(), pts)) {
+      return false;
+    }
+
+    while (pEncoder->PullAccessUnit(accessUnit)) {
+      if (!gotFirstFrame) {
+        firstFrameMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - sessionStart).count();
+        gotFirstFrame = true;
+      }
+    }
+  }
+
+  return gotFirstFrame;
+}
@@ -0,0 +1,297 @@
+/******************************************************************************
+* Filename: VideoScalerBenchmark.cpp
+*
+* Description:
+* This file contains a C++ console application that measures the VideoScaler in
+* the Common folder, which produces the scaled layers for simulcast, thumbnails
+* and adaptation steps.
+*
+* Each filter and pixel format is timed scaling from each source size to each
+* destination size on one thread, with the vectorised passes the scaler uses
+* on this CPU and with its plain C++ version, and the two outputs are checked to
+* be identical. For I420 the box filter ScaleI420 in I420Scaler.h, which the
+* samples used before, is timed as well for comparison.
+*
+* Usage:
+* VideoScalerBenchmark [option=value ...]
+*
+* The options are given as name=value, lists are comma separated:
+* sizes=1920x1080                source frame sizes.
+* scaled=640x360,1280x720        destination frame sizes.
+* filters=bilinear,bicubic,area  the filters to time.
+* formats=I420,NV12,RGB32        the pixel formats to time.
+* fit=stretch                    stretch, letterbox or crop, how the picture is
+*                                fitted when the aspect ratios differ.
+* ms=300                         the minimum time to spend timing each scale.
+* csv=results.csv                write the results as CSV.
+*
+* The benchmark doesn't use Media Foundation so it also builds on Linux, the
+* AVX2 passes are used if the CPU has them:
+* g++ -O2 -std=c++17 VideoScalerBenchmark.cpp -o VideoScalerBenchmark
+*
+* License: Public Domain (no warranty, use at own risk)
+/******************************************************************************/
+
+#include "../Common/ColourConverter.h"
+#include "../Common/I420Scaler.h"
+#include "../Common/VideoScaler.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <string>
+#include <vector>
+
+#define DEFAULT_MEASURE_MS 300.0
+#define MIN_ITERATIONS 5
+
+static const char* FILTER_NAMES[] = { "bilinear", "bicubic", "area" };
+static const char* FIT_NAMES[] = { "stretch", "letterbox", "crop" };
+
+/* The timings for one filter and format at one source and destination size. */
+struct ScaleResult
+{
+  unsigned int SourceWidth = 0;
+  unsigned int SourceHeight = 0;
+  unsigned int Width = 0;
+  unsigned int Height = 0;
+  ColourFormat Format = ColourFormat::I420;
+  std::string Filter;
+  double SimdMs = 0;                    // Mean time per frame with the vectorised passes.
+  double PlainMs = 0;                   // Mean time per frame with the plain C++ version.
+  bool IsExact = false;                 // The vectorised and plain C++ outputs are identical.
+  double BoxMs = NAN;                   // ScaleI420's time, NAN for the formats it doesn't handle.
+};
+
+bool ParseSize(const std::string& item, std::pair<unsigned int, unsigned int>& size);
+std::vector<std::string> SplitList(const std::string& list);
+double TimeScale(const std::function<void()>& scale, double measureMs);
+bool WriteCsv(const std::string& path, const std::vector<ScaleResult>& results);
+
+int main(int argc, char* argv[])
+{
+  std::vector<std::pair<unsigned int, unsigned int>> sizes = { { 1920, 1080 } };
+  std::vector<std::pair<unsigned int, unsigned int>> scaledSizes = { { 640, 360 }, { 960, 540 }, { 1280, 720 } };
+  std::vector<std::string> filters(std::begin(FILTER_NAMES), std::end(FILTER_NAMES));
+  std::vector<ColourFormat> formats = { ColourFormat::I420, ColourFormat::NV12, ColourFormat::RGB32 };
+  ScaleFit fit = ScaleFit::Stretch;
+  double measureMs = DEFAULT_MEASURE_MS;
+  std::string csvPath;
+
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    size_t equals = arg.find('=');
+    if (equals == std::string::npos) {
+      printf("Option %s isn't in the form name=value.\n", arg.c_str());
+      return 1;
+    }
+
+    std::string name = arg.substr(0, equals);
+    std::string value = arg.substr(equals + 1);
+
+    if (name == "sizes" || name == "scaled") {
+      std::vector<std::pair<unsigned int, unsigned int>>& list = (name == "sizes") ? sizes : scaledSizes;
+      list.clear();
+      for (const std::string& item : SplitList(value)) {
+        std::pair<unsigned int, unsigned int> size;
+        if (!ParseSize(item, size)) {
+          printf("Size %s isn't in the form WxH with an even width and height.\n", item.c_str());
+          return 1;
+        }
+        list.push_back(size);
+      }
+    }
+    else if (name == "filters") {
+      filters = SplitList(value);
+      for (const std::string& filter : filters) {
+        if (std::find(std::begin(FILTER_NAMES), std::end(FILTER_NAMES), filter) == std::end(FILTER_NAMES)) {
+          printf("Unknown filter %s.\n", filter.c_str());
+          return 1;
+        }
+      }
+    }
+    else if (name == "formats") {
+      formats.clear();
+      for (const std::string& item : SplitList(value)) {
+        std::string upper = item;
+        std::transform(upper.begin(), upper.end(), upper.begin(), ::toupper);
+        ColourFormat format = (upper == "I420") ? ColourFormat::I420 : (upper == "NV12") ? ColourFormat::NV12 :
+          (upper == "RGB32") ? ColourFormat::RGB32 : (upper == "BGRA") ? ColourFormat::BGRA : ColourFormat::YUY2;
+        if (format == ColourFormat::YUY2) {
+          printf("Format %s isn't I420, NV12, RGB32 or BGRA.\n", item.c_str());
+          return 1;
+        }
+        formats.push_back(format);
+      }
+    }
+    else if (name == "fit") {
+      auto found = std::find(std::begin(FIT_NAMES), std::end(FIT_NAMES), value);
+      if (found == std::end(FIT_NAMES)) {
+        printf("Unknown fit %s.\n", value.c_str());
+        return 1;
+      }
+      fit = (ScaleFit)(found - std::begin(FIT_NAMES));
+    }
+    else if (name == "ms") {
+      measureMs = atof(value.c_str());
+    }
+    else if (name == "csv") {
+      csvPath = value;
+    }
+    else {
+      printf("Unknown option %s.\n", name.c_str());
+      return 1;
+    }
+  }
+
+  printf("VideoScaler using %s, %s fit, times are for one thread.\n", VideoScaler::GetSimdName(), FIT_NAMES[(int)fit]);
+  printf("%-21s %-6s %-9s | %9s %9s %7s %6s | %9s\n", "size", "format", "filter", "simd ms", "plain ms", "speedup", "exact", "box ms");
+
+  std::vector<ScaleResult> results;
+
+  for (const auto& size : sizes) {
+    for (ColourFormat format : formats) {
+      // Noise with a gradient, the content doesn't change the timings but gives the comparison something to check.
+      std::vector<uint8_t> sourceBuffer(GetColourImageSize(format, size.first, size.second));
+      uint32_t seed = size.first * 31 + size.second;
+      for (size_t i = 0; i < sourceBuffer.size(); i++) {
+        seed = seed * 1664525 + 1013904223;
+        sourceBuffer[i] = (uint8_t)((i / 7) + (seed >> 28));
+      }
+      ColourImage source = GetColourImage(format, sourceBuffer.data(), size.first, size.second);
+
+      for (const auto& scaledSize : scaledSizes) {
+        size_t destinationSize = GetColourImageSize(format, scaledSize.first, scaledSize.second);
+        std::vector<uint8_t> simdBuffer(destinationSize), plainBuffer(destinationSize), boxBuffer(destinationSize);
+        ColourImage simdImage = GetColourImage(format, simdBuffer.data(), scaledSize.first, scaledSize.second);
+        ColourImage plainImage = GetColourImage(format, plainBuffer.data(), scaledSize.first, scaledSize.second);
+
+        double boxMs = NAN;
+        if (format == ColourFormat::I420 && fit == ScaleFit::Stretch) {
+          boxMs = TimeScale([&]() {
+            ScaleI420(sourceBuffer.data(), size.first, size.second, boxBuffer.data(), scaledSize.first, scaledSize.second);
+          }, measureMs);
+        }
+
+        for (const std::string& filterName : filters) {
+          ScaleFilter filter = (ScaleFilter)(std::find(std::begin(FILTER_NAMES), std::end(FILTER_NAMES), filterName) - std::begin(FILTER_NAMES));
+          VideoScaler simdScaler(filter, fit, true);
+          VideoScaler plainScaler(filter, fit, false);
+
+          ScaleResult result;
+          result.SourceWidth = size.first;
+          result.SourceHeight = size.second;
+          result.Width = scaledSize.first;
+          result.Height = scaledSize.second;
+          result.Format = format;
+          result.Filter = filterName;
+          result.SimdMs = TimeScale([&]() { simdScaler.Scale(source, simdImage); }, measureMs);
+          result.PlainMs = TimeScale([&]() { plainScaler.Scale(source, plainImage); }, measureMs);
+          result.IsExact = simdBuffer == plainBuffer;
+          result.BoxMs = boxMs;
+
+          char sizeName[32], boxText[16] = "-";
+          snprintf(sizeName, sizeof(sizeName), "%ux%u->%ux%u", size.first, size.second, scaledSize.first, scaledSize.second);
+          if (!std::isnan(boxMs)) {
+            snprintf(boxText, sizeof(boxText), "%.3f", boxMs);
+          }
+
+          printf("%-21s %-6s %-9s | %9.3f %9.3f %6.1fx %6s | %9s\n", sizeName, GetColourFormatName(format), filterName.c_str(),
+            result.SimdMs, result.PlainMs, result.PlainMs / result.SimdMs, result.IsExact ? "yes" : "NO", boxText);
+
+          results.push_back(result);
+        }
+      }
+    }
+  }
+
+  if (!csvPath.empty() && !WriteCsv(csvPath, results)) {
+    return 1;
+  }
+
+  return 0;
+}
+
+bool ParseSize(const std::string& item, std::pair<unsigned int, unsigned int>& size)
+{
+  unsigned int width = 0, height = 0;
+  if (sscanf(item.c_str(), "%ux%u", &width, &height) != 2 || width == 0 || height == 0 || (width % 2) != 0 || (height % 2) != 0) {
+    return false;
+  }
+
+  size = { width, height };
+  return true;
+}
+
+std::vector<std::string> SplitList(const std::string& list)
+{
+  std::vector<std::string> items;
+  size_t start = 0;
+
+  while (start <= list.size()) {
+    size_t end = list.find(',', start);
+    if (end == std::string::npos) {
+      end = list.size();
+    }
+
+    if (end > start) {
+      items.push_back(list.substr(start, end - start));
+    }
+    start = end + 1;
+  }
+
+  return items;
+}
+
+/**
+* Repeats a scale until at least measureMs have passed and MIN_ITERATIONS have
+* been done, after one untimed run to work out the filter tables and warm the
+* caches.
+* @param[in] scale: scales the frame once.
+* @param[in] measureMs: the minimum time to spend.
+* @@Returns The mean milliseconds per frame.
+*/
+double TimeScale(const std::function<void()>& scale, double measureMs)
+{
+  scale();
+
+  auto start = std::chrono::steady_clock::now();
+  double elapsedMs = 0;
+  unsigned int iterations = 0;
+
+  while (elapsedMs < measureMs || iterations < MIN_ITERATIONS) {
+    scale();
+    iterations++;
+    elapsedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+  }
+
+  return elapsedMs / iterations;
+}
+
+bool WriteCsv(const std::string& path, const std::vector<ScaleResult>& results)
+{
+  FILE* pFile = fopen(path.c_str(), "w");
+  if (pFile == nullptr) {
+    printf("Failed to open %s for writing.\n", path.c_str());
+    return false;
+  }
+
+  fprintf(pFile, "source_width,source_height,width,height,format,filter,simd_ms,plain_ms,exact,box_ms\n");
+
+  for (const ScaleResult& result : results) {
+    fprintf(pFile, "%u,%u,%u,%u,%s,%s,%.4f,%.4f,%d,", result.SourceWidth, result.SourceHeight, result.Width, result.Height,
+      GetColourFormatName(result.Format), result.Filter.c_str(), result.SimdMs, result.PlainMs, result.IsExact ? 1 : 0);
+    if (!std::isnan(result.BoxMs)) {
+      fprintf(pFile, "%.4f", result.BoxMs);
+    }
+    fprintf(pFile, "\n");
+  }
+
+  fclose(pFile);
+  printf("Results written to %s.\n", path.c_str());
+  return true;
+}
@@ -0,0 +1,192 @@
+/******************************************************************************
+* Filename: Vp8EncoderBenchmark.cpp
+*
+* Description:
+* This file contains a C++ console application that measures libvpx VP8 encode
+* throughput and latency for a range of encoder thread counts. The input is a
+* raw I420 Y4M recording so the results aren't affected by webcam capture and
+* can be repeated. Each thread count uses the Vp8EncoderProfile from the Common
+* folder, the same tuning as the MFWebCamWebRTC sample, with the token
+* partitions matched to the threads.
+*
+* A Y4M test file can be recorded from a webcam or converted from an mp4 with ffmpeg:
+* ffmpeg -i input.mp4 -vf scale=1280:720 -pix_fmt yuv420p -frames:v 300 input.y4m
+*
+* Usage:
+* Vp8EncoderBenchmark input.y4m [max frames] [bitrate kbps]
+*
+* Dependencies:
+* vcpkg install libvpx
+*
+* The benchmark doesn't use Media Foundation so it also builds on Linux:
+* g++ -O2 -std=c++17 Vp8EncoderBenchmark.cpp -lvpx -lpthread -o Vp8EncoderBenchmark
+*
+* License: Public Domain (no warranty, use at own risk)
+/******************************************************************************/
+
+#include "../Common/Vp8EncoderProfile.h"
+#include "../Common/Y4MReader.h"
+
+#include <vpx/vpx_encoder.h>
+#include <vpx/vp8cx.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#define DEFAULT_MAX_FRAMES 300
+#define DEFAULT_BITS_PER_PIXEL 0.07     // Used to pick a bitrate for the input resolution if none is specified.
+
+/* Results of encoding the whole input with one thread count. */
+struct BenchmarkResult
+{
+  unsigned int Threads = 0;
+  unsigned int TokenPartitions = 0;
+  double FramesPerSecond = 0;
+  double MeanLatencyMs = 0;
+  double P50LatencyMs = 0;
+  double P99LatencyMs = 0;
+  double BitrateKbps = 0;
+  size_t PartitionPackets = 0;
+};
+
+bool RunBenchmark(const Y4MVideo& video, unsigned int threads, unsigned int bitrateKbps, BenchmarkResult& result);
+
+int main(int argc, char* argv[])
+{
+  if (argc < 2) {
+    printf("Usage: %s input.y4m [max frames] [bitrate kbps]\n", argv[0]);
+    return 1;
+  }
+
+  unsigned int maxFrames = (argc > 2) ? atoi(argv[2]) : DEFAULT_MAX_FRAMES;
+
+  Y4MVideo video;
+  if (!LoadY4M(argv[1], maxFrames, video)) {
+    return 1;
+  }
+
+  double frameRate = (double)video.FrameRateNum / video.FrameRateDen;
+  unsigned int bitrateKbps = (argc > 3) ? atoi(argv[3]) :
+    (unsigned int)(video.Width * video.Height * frameRate * DEFAULT_BITS_PER_PIXEL / 1000);
+
+  printf("Input %ux%u at %.2f fps, %zu frames, target bitrate %u kbps, %u cores.\n",
+    video.Width, video.Height, frameRate, video.Frames.size(), bitrateKbps, std::thread::hardware_concurrency());
+
+  Vp8EncoderProfile defaultProfile = GetVp8EncoderProfile(video.Width, video.Height, std::thread::hardware_concurrency());
+  printf("Default profile for the input: ");
+  PrintVp8EncoderProfile(defaultProfile);
+
+  printf("\n%8s %11s %10s %10s %10s %10s %12s %12s\n", "threads", "partitions", "fps", "mean ms", "p50 ms", "p99 ms", "kbps", "packets");
+
+  for (unsigned int threads = 1; threads <= 8; threads *= 2) {
+    BenchmarkResult result;
+    if (!RunBenchmark(video, threads, bitrateKbps, result)) {
+      return 1;
+    }
+
+    printf("%8u %11u %10.1f %10.2f %10.2f %10.2f %12.1f %12zu\n", result.Threads, result.TokenPartitions, result.FramesPerSecond,
+      result.MeanLatencyMs, result.P50LatencyMs, result.P99LatencyMs, result.BitrateKbps, result.PartitionPackets);
+  }
+
+  return 0;
+}
+
+/**
+* Encodes all the frames with one thread count and measures the time taken by
+* each vpx_codec_encode call plus collecting its output partitions.
+* @param[in] video: the frames to encode.
+* @param[in] threads: the number of encoder threads.
+* @param[in] bitrateKbps: the target bitrate.
+* @param[out] result: the throughput and latency measurements.
+* @@Returns true if all the frames were encoded.
+*/
+bool RunBenchmark(const Y4MVideo& video, unsigned int threads, unsigned int bitrateKbps, BenchmarkResult& result)
+{
+  vpx_codec_ctx_t vpxCodec;
+  vpx_codec_enc_cfg_t vpxConfig;
+  vpx_image_t rawImage;
+  std::vector<double> latencies;
+  size_t encodedBytes = 0;
+
+  Vp8EncoderProfile profile = GetVp8EncoderProfile(video.Width, video.Height, 0);
+  profile.Threads = threads;
+  profile.TokenPartitions = GetVp8TokenPartitions(threads);
+
+  vpx_codec_err_t res = vpx_codec_enc_config_default(vpx_codec_vp8_cx(), &vpxConfig, 0);
+  if (res) {
+    printf("Failed to get VPX codec config: %s\n", vpx_codec_err_to_string(res));
+    return false;
+  }
+
+  // Same real-time settings as the MFWebCamWebRTC sample.
+  vpxConfig.g_w = video.Width;
+  vpxConfig.g_h = video.Height;
+  vpxConfig.g_timebase.num = video.FrameRateDen;
+  vpxConfig.g_timebase.den = video.FrameRateNum;
+  vpxConfig.rc_target_bitrate = bitrateKbps;
+  vpxConfig.g_pass = VPX_RC_ONE_PASS;
+  vpxConfig.rc_end_usage = VPX_CBR;
+  vpxConfig.g_error_resilient = VPX_ERROR_RESILIENT_DEFAULT;
+  vpxConfig.g_lag_in_frames = 0;
+  vpxConfig.rc_resize_allowed = 0;
+  SetVp8EncoderProfileConfig(profile, &vpxConfig);
+
+  if (vpx_codec_enc_init(&vpxCodec, vpx_codec_vp8_cx(), &vpxConfig, VPX_CODEC_USE_OUTPUT_PARTITION)) {
+    printf("Failed to initialize libvpx encoder: %s\n", vpx_codec_error(&vpxCodec));
+    return false;
+  }
+
+  if (SetVp8EncoderProfileControls(profile, &vpxCodec) != VPX_CODEC_OK) {
+    vpx_codec_destroy(&vpxCodec);
+    return false;
+  }
+
+  auto benchmarkStart = std::chrono::steady_clock::now();
+
+  for (size_t i = 0; i < video.Frames.size(); i++) {
+    vpx_img_wrap(&rawImage, VPX_IMG_FMT_I420, video.Width, video.Height, 1, (unsigned char*)video.Frames[i].data());
+
+    auto frameStart = std::chrono::steady_clock::now();
+
+    if (vpx_codec_encode(&vpxCodec, &rawImage, i, 1, 0, VPX_DL_REALTIME)) {
+      printf("VPX codec failed to encode frame %zu: %s\n", i, vpx_codec_error(&vpxCodec));
+      vpx_codec_destroy(&vpxCodec);
+      return false;
+    }
+
+    vpx_codec_iter_t iter = NULL;
+    const vpx_codec_cx_pkt_t* pkt;
+    while ((pkt = vpx_codec_get_cx_data(&vpxCodec, &iter))) {
+      if (pkt->kind == VPX_CODEC_CX_FRAME_PKT) {
+        encodedBytes += pkt->data.frame.sz;
+        result.PartitionPackets++;
+      }
+    }
+
+    latencies.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frameStart).count());
+  }
+
+  double elapsedSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - benchmarkStart).count();
+  double durationSeconds = (double)video.Frames.size() * video.FrameRateDen / video.FrameRateNum;
+
+  vpx_codec_destroy(&vpxCodec);
+
+  double totalLatency = 0;
+  for (double latency : latencies) {
+    totalLatency += latency;
+  }
+
+  result.Threads = threads;
+  result.TokenPartitions = 1 << (int)profile.TokenPartitions;
+  result.FramesPerSecond = video.Frames.size() / elapsedSeconds;
+  result.MeanLatencyMs = totalLatency / latencies.size();
+  result.P50LatencyMs = Percentile(latencies, 50);
+  result.P99LatencyMs = Percentile(latencies, 99);
+  result.BitrateKbps = encodedBytes * 8 / durationSeconds / 1000;
+
+  return true;
+}
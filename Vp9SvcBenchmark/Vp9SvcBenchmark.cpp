@@ -0,0 +1,392 @@
+/******************************************************************************
+* Filename: Vp9SvcBenchmark.cpp
+*
+* Description:
+* This file contains a C++ console application that compares the CPU cost of
+* the two ways of serving receivers at 1/4, 1/2 and the full frame size:
+*  - A single libvpx VP9 SVC encode with three spatial and three temporal layers,
+*    using the Vp9SvcEncoderProfile from the Common folder, the same set up as
+*    the MFWebCamWebRTC sample when VIDEO_CODEC_VP9 is enabled.
+*  - Three independent VP8 encodes (simulcast) with the same 1:2:4 bitrate split
+*    and Vp8EncoderProfile tuning. The downscaling of the input for the two
+*    lower resolutions is included in the timing since the SVC encoder does its
+*    own scaling.
+*
+* Both wall clock time and process CPU time are reported as the VP9 encoder
+* uses row based multi-threading so the wall clock alone hides its cost.
+*
+* A Y4M test file can be recorded from a webcam or converted from an mp4 with ffmpeg:
+* ffmpeg -i input.mp4 -vf scale=1280:720 -pix_fmt yuv420p -frames:v 300 input.y4m
+*
+* Usage:
+* Vp9SvcBenchmark input.y4m [max frames] [bitrate kbps]
+*
+* Dependencies:
+* vcpkg install libvpx
+*
+* The benchmark doesn't use Media Foundation so it also builds on Linux:
+* g++ -O2 -std=c++17 Vp9SvcBenchmark.cpp -lvpx -lpthread -o Vp9SvcBenchmark
+*
+* License: Public Domain (no warranty, use at own risk)
+/******************************************************************************/
+
+#include "../Common/Vp8EncoderProfile.h"
+#include "../Common/Vp9SvcEncoderProfile.h"
+#include "../Common/Y4MReader.h"
+
+#include <vpx/vpx_encoder.h>
+#include <vpx/vp8cx.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#define DEFAULT_MAX_FRAMES 300
+#define DEFAULT_BITS_PER_PIXEL 0.07     // Used to pick a bitrate for the input resolution if none is specified.
+#define SIMULCAST_STREAM_COUNT 3
+
+/* Results of encoding the whole input with one of the approaches. */
+struct BenchmarkResult
+{
+  double WallSeconds = 0;
+  double CpuSeconds = 0;
+  double FramesPerSecond = 0;
+  double BitrateKbps = 0;
+  double LayerBitrateKbps[VP9_SVC_MAX_SPATIAL_LAYERS] = { 0 };   // Per spatial layer for SVC, per stream for simulcast.
+};
+
+bool RunSvcBenchmark(const Y4MVideo& video, unsigned int bitrateKbps, unsigned int threads, BenchmarkResult& result);
+bool RunSimulcastBenchmark(const Y4MVideo& video, unsigned int bitrateKbps, unsigned int threads, BenchmarkResult& result);
+void DownscaleI420(const uint8_t* src, unsigned int srcWidth, unsigned int srcHeight, uint8_t* dst);
+double GetProcessCpuSeconds();
+void PrintResult(const char* name, const BenchmarkResult& result);
+
+int main(int argc, char* argv[])
+{
+  if (argc < 2) {
+    printf("Usage: %s input.y4m [max frames] [bitrate kbps]\n", argv[0]);
+    return 1;
+  }
+
+  unsigned int maxFrames = (argc > 2) ? atoi(argv[2]) : DEFAULT_MAX_FRAMES;
+
+  Y4MVideo video;
+  if (!LoadY4M(argv[1], maxFrames, video)) {
+    return 1;
+  }
+
+  if (video.Width % 4 != 0 || video.Height % 4 != 0) {
+    printf("The frame size needs to be a multiple of 4 for the two downscaled layers.\n");
+    return 1;
+  }
+
+  double frameRate = (double)video.FrameRateNum / video.FrameRateDen;
+  unsigned int bitrateKbps = (argc > 3) ? atoi(argv[3]) :
+    (unsigned int)(video.Width * video.Height * frameRate * DEFAULT_BITS_PER_PIXEL / 1000);
+
+  // Both approaches get the same threads, the count the VP8 profile would pick for the full size.
+  unsigned int threads = GetVp8EncoderProfile(video.Width, video.Height, std::thread::hardware_concurrency()).Threads;
+
+  printf("Input %ux%u at %.2f fps, %zu frames, total bitrate %u kbps, %u threads per encoder, %u cores.\n",
+    video.Width, video.Height, frameRate, video.Frames.size(), bitrateKbps, threads, std::thread::hardware_concurrency());
+
+  printf("\n%-22s %10s %10s %10s %10s %10s %10s %10s\n", "", "wall s", "cpu s", "fps", "kbps", "L0 kbps", "L1 kbps", "L2 kbps");
+
+  BenchmarkResult svcResult;
+  if (!RunSvcBenchmark(video, bitrateKbps, threads, svcResult)) {
+    return 1;
+  }
+  PrintResult("VP9 SVC L3T3", svcResult);
+
+  BenchmarkResult simulcastResult;
+  if (!RunSimulcastBenchmark(video, bitrateKbps, threads, simulcastResult)) {
+    return 1;
+  }
+  PrintResult("VP8 simulcast x3", simulcastResult);
+
+  if (svcResult.CpuSeconds > 0) {
+    printf("\nVP8 simulcast uses %.2f times the CPU of VP9 SVC.\n", simulcastResult.CpuSeconds / svcResult.CpuSeconds);
+  }
+
+  return 0;
+}
+
+/**
+* Encodes all the frames with a single VP9 SVC encoder and measures the time
+* taken. The bitrate of each spatial layer is taken from the superframe index.
+* @param[in] video: the frames to encode.
+* @param[in] bitrateKbps: the total bitrate across all layers.
+* @param[in] threads: the number of encoder threads.
+* @param[out] result: the time and bitrate measurements.
+* @@Returns true if all the frames were encoded.
+*/
+bool RunSvcBenchmark(const Y4MVideo& video, unsigned int bitrateKbps, unsigned int threads, BenchmarkResult& result)
+{
+  vpx_codec_ctx_t vpxCodec;
+  vpx_codec_enc_cfg_t vpxConfig;
+  vpx_image_t rawImage;
+  size_t encodedBytes = 0;
+  size_t layerBytes[VP9_SVC_MAX_SPATIAL_LAYERS] = { 0 };
+
+  Vp9SvcEncoderProfile profile;
+  profile.Threads = threads;
+
+  vpx_codec_err_t res = vpx_codec_enc_config_default(vpx_codec_vp9_cx(), &vpxConfig, 0);
+  if (res) {
+    printf("Failed to get VPX codec config: %s\n", vpx_codec_err_to_string(res));
+    return false;
+  }
+
+  vpxConfig.g_w = video.Width;
+  vpxConfig.g_h = video.Height;
+  vpxConfig.g_timebase.num = video.FrameRateDen;
+  vpxConfig.g_timebase.den = video.FrameRateNum;
+  vpxConfig.g_pass = VPX_RC_ONE_PASS;
+  vpxConfig.rc_resize_allowed = 0;
+  SetVp9SvcEncoderProfileConfig(profile, bitrateKbps, &vpxConfig);
+
+  if (vpx_codec_enc_init(&vpxCodec, vpx_codec_vp9_cx(), &vpxConfig, 0)) {
+    printf("Failed to initialize libvpx VP9 encoder: %s\n", vpx_codec_error(&vpxCodec));
+    return false;
+  }
+
+  if (SetVp9SvcEncoderProfileControls(profile, &vpxConfig, &vpxCodec) != VPX_CODEC_OK) {
+    vpx_codec_destroy(&vpxCodec);
+    return false;
+  }
+
+  double cpuStart = GetProcessCpuSeconds();
+  auto wallStart = std::chrono::steady_clock::now();
+
+  for (size_t i = 0; i < video.Frames.size(); i++) {
+    vpx_img_wrap(&rawImage, VPX_IMG_FMT_I420, video.Width, video.Height, 1, (unsigned char*)video.Frames[i].data());
+
+    if (vpx_codec_encode(&vpxCodec, &rawImage, i, 1, 0, VPX_DL_REALTIME)) {
+      printf("VP9 encoder failed to encode frame %zu: %s\n", i, vpx_codec_error(&vpxCodec));
+      vpx_codec_destroy(&vpxCodec);
+      return false;
+    }
+
+    vpx_codec_iter_t iter = NULL;
+    const vpx_codec_cx_pkt_t* pkt;
+    while ((pkt = vpx_codec_get_cx_data(&vpxCodec, &iter))) {
+      if (pkt->kind == VPX_CODEC_CX_FRAME_PKT) {
+        encodedBytes += pkt->data.frame.sz;
+
+        auto layerFrames = ParseVp9Superframe((const uint8_t*)pkt->data.frame.buf, pkt->data.frame.sz);
+        for (size_t sl = 0; sl < layerFrames.size() && sl < VP9_SVC_MAX_SPATIAL_LAYERS; sl++) {
+          layerBytes[sl] += layerFrames[sl].second;
+        }
+      }
+    }
+  }
+
+  result.WallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+  result.CpuSeconds = GetProcessCpuSeconds() - cpuStart;
+
+  vpx_codec_destroy(&vpxCodec);
+
+  double durationSeconds = (double)video.Frames.size() * video.FrameRateDen / video.FrameRateNum;
+
+  result.FramesPerSecond = video.Frames.size() / result.WallSeconds;
+  result.BitrateKbps = encodedBytes * 8 / durationSeconds / 1000;
+  for (int sl = 0; sl < VP9_SVC_MAX_SPATIAL_LAYERS; sl++) {
+    result.LayerBitrateKbps[sl] = layerBytes[sl] * 8 / durationSeconds / 1000;
+  }
+
+  return true;
+}
+
+/**
+* Encodes all the frames with three VP8 encoders, one for each of the sizes the
+* SVC encode has as spatial layers, and measures the time taken including the
+* downscaling.
+* @param[in] video: the frames to encode.
+* @param[in] bitrateKbps: the total bitrate across all streams, split 1:2:4.
+* @param[in] threads: the number of threads for each encoder.
+* @param[out] result: the time and bitrate measurements.
+* @@Returns true if all the frames were encoded.
+*/
+bool RunSimulcastBenchmark(const Y4MVideo& video, unsigned int bitrateKbps, unsigned int threads, BenchmarkResult& result)
+{
+  vpx_codec_ctx_t vpxCodecs[SIMULCAST_STREAM_COUNT];
+  unsigned int widths[SIMULCAST_STREAM_COUNT];
+  unsigned int heights[SIMULCAST_STREAM_COUNT];
+  std::vector<uint8_t> scaledFrames[SIMULCAST_STREAM_COUNT];
+  size_t streamBytes[SIMULCAST_STREAM_COUNT] = { 0 };
+  int initialisedCount = 0;
+  bool success = true;
+
+  // The SVC profile is only used for its layer sizes and bitrate shares so both approaches match.
+  Vp9SvcEncoderProfile svcProfile;
+  svcProfile.SpatialLayers = SIMULCAST_STREAM_COUNT;
+
+  for (int stream = 0; stream < SIMULCAST_STREAM_COUNT; stream++) {
+    vpx_codec_enc_cfg_t vpxConfig;
+
+    widths[stream] = video.Width / GetVp9SvcScalingDenominator(svcProfile, stream);
+    heights[stream] = video.Height / GetVp9SvcScalingDenominator(svcProfile, stream);
+    scaledFrames[stream].resize(widths[stream] * heights[stream] * 3 / 2);
+
+    vpx_codec_err_t res = vpx_codec_enc_config_default(vpx_codec_vp8_cx(), &vpxConfig, 0);
+    if (res) {
+      printf("Failed to get VPX codec config: %s\n", vpx_codec_err_to_string(res));
+      success = false;
+      break;
+    }
+
+    Vp8EncoderProfile profile = GetVp8EncoderProfile(widths[stream], heights[stream], 0);
+    profile.Threads = threads;
+    profile.TokenPartitions = GetVp8TokenPartitions(threads);
+
+    vpxConfig.g_w = widths[stream];
+    vpxConfig.g_h = heights[stream];
+    vpxConfig.g_timebase.num = video.FrameRateDen;
+    vpxConfig.g_timebase.den = video.FrameRateNum;
+    vpxConfig.rc_target_bitrate = (unsigned int)(bitrateKbps * GetVp9SvcSpatialLayerShare(svcProfile, stream));
+    vpxConfig.g_pass = VPX_RC_ONE_PASS;
+    vpxConfig.rc_end_usage = VPX_CBR;
+    vpxConfig.g_error_resilient = VPX_ERROR_RESILIENT_DEFAULT;
+    vpxConfig.g_lag_in_frames = 0;
+    vpxConfig.rc_resize_allowed = 0;
+    SetVp8EncoderProfileConfig(profile, &vpxConfig);
+
+    if (vpx_codec_enc_init(&vpxCodecs[stream], vpx_codec_vp8_cx(), &vpxConfig, 0)) {
+      printf("Failed to initialize libvpx VP8 encoder: %s\n", vpx_codec_error(&vpxCodecs[stream]));
+      success = false;
+      break;
+    }
+
+    initialisedCount++;
+
+    if (SetVp8EncoderProfileControls(profile, &vpxCodecs[stream]) != VPX_CODEC_OK) {
+      success = false;
+      break;
+    }
+  }
+
+  double cpuStart = GetProcessCpuSeconds();
+  auto wallStart = std::chrono::steady_clock::now();
+
+  for (size_t i = 0; success && i < video.Frames.size(); i++) {
+    // Full size is encoded straight from the input, each lower size is downscaled from the one above.
+    const uint8_t* input = video.Frames[i].data();
+
+    for (int stream = SIMULCAST_STREAM_COUNT - 1; stream >= 0; stream--) {
+      vpx_image_t rawImage;
+
+      if (stream < SIMULCAST_STREAM_COUNT - 1) {
+        DownscaleI420(input, widths[stream + 1], heights[stream + 1], scaledFrames[stream].data());
+        input = scaledFrames[stream].data();
+      }
+
+      vpx_img_wrap(&rawImage, VPX_IMG_FMT_I420, widths[stream], heights[stream], 1, (unsigned char*)input);
+
+      if (vpx_codec_encode(&vpxCodecs[stream], &rawImage, i, 1, 0, VPX_DL_REALTIME)) {
+        printf("VP8 encoder %d failed to encode frame %zu: %s\n", stream, i, vpx_codec_error(&vpxCodecs[stream]));
+        success = false;
+        break;
+      }
+
+      vpx_codec_iter_t iter = NULL;
+      const vpx_codec_cx_pkt_t* pkt;
+      while ((pkt = vpx_codec_get_cx_data(&vpxCodecs[stream], &iter))) {
+        if (pkt->kind == VPX_CODEC_CX_FRAME_PKT) {
+          streamBytes[stream] += pkt->data.frame.sz;
+        }
+      }
+    }
+  }
+
+  result.WallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+  result.CpuSeconds = GetProcessCpuSeconds() - cpuStart;
+
+  for (int stream = 0; stream < initialisedCount; stream++) {
+    vpx_codec_destroy(&vpxCodecs[stream]);
+  }
+
+  if (!success) {
+    return false;
+  }
+
+  double durationSeconds = (double)video.Frames.size() * video.FrameRateDen / video.FrameRateNum;
+
+  result.FramesPerSecond = video.Frames.size() / result.WallSeconds;
+  for (int stream = 0; stream < SIMULCAST_STREAM_COUNT; stream++) {
+    result.LayerBitrateKbps[stream] = streamBytes[stream] * 8 / durationSeconds / 1000;
+    result.BitrateKbps += result.LayerBitrateKbps[stream];
+  }
+
+  return true;
+}
+
+/**
+* Halves the width and height of an I420 frame by averaging each 2x2 block. The
+* source width and height need to be multiples of 4 so the chroma planes halve
+* exactly as well.
+* @param[in] src: the source I420 frame.
+* @param[in] srcWidth: the source frame width.
+* @param[in] srcHeight: the source frame height.
+* @param[out] dst: the destination buffer, a quarter of the size of the source.
+*/
+void DownscaleI420(const uint8_t* src, unsigned int srcWidth, unsigned int srcHeight, uint8_t* dst)
+{
+  for (int plane = 0; plane < 3; plane++) {
+    unsigned int width = (plane == 0) ? srcWidth : srcWidth / 2;
+    unsigned int height = (plane == 0) ? srcHeight : srcHeight / 2;
+
+    for (unsigned int y = 0; y < height / 2; y++) {
+      const uint8_t* row0 = src + (2 * y) * width;
+      const uint8_t* row1 = row0 + width;
+
+      for (unsigned int x = 0; x < width / 2; x++) {
+        dst[y * (width / 2) + x] = (uint8_t)((row0[2 * x] + row0[2 * x + 1] + row1[2 * x] + row1[2 * x + 1] + 2) / 4);
+      }
+    }
+
+    src += width * height;
+    dst += (width / 2) * (height / 2);
+  }
+}
+
+/* User plus kernel CPU time used by all the threads in the process. */
+double GetProcessCpuSeconds()
+{
+#ifdef _WIN32
+  FILETIME creationTime, exitTime, kernelTime, userTime;
+  if (!GetProcessTimes(GetCurrentProcess(), &creationTime, &exitTime, &kernelTime, &userTime)) {
+    return 0;
+  }
+
+  ULARGE_INTEGER kernel, user;
+  kernel.LowPart = kernelTime.dwLowDateTime;
+  kernel.HighPart = kernelTime.dwHighDateTime;
+  user.LowPart = userTime.dwLowDateTime;
+  user.HighPart = userTime.dwHighDateTime;
+
+  return (kernel.QuadPart + user.QuadPart) / 1e7;   // FILETIME is in 100ns units.
+#else
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) {
+    return 0;
+  }
+
+  return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+#endif
+}
+
+/* Prints a row of the results table. */
+void PrintResult(const char* name, const BenchmarkResult& result)
+{
+  printf("%-22s %10.2f %10.2f %10.1f %10.1f %10.1f %10.1f %10.1f\n", name, result.WallSeconds, result.CpuSeconds, result.FramesPerSecond,
+    result.BitrateKbps, result.LayerBitrateKbps[0], result.LayerBitrateKbps[1], result.LayerBitrateKbps[2]);
+}
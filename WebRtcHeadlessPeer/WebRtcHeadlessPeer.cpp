@@ -0,0 +1,1536 @@
+/******************************************************************************
+* Filename: WebRtcHeadlessPeer.cpp
+*
+* Description:
+* This file contains a C++ console application that acts as the receiving
+* WebRTC peer for the MFWebCamWebRTC sample so it can be tested without a
+* browser, e.g. in CI. It does what the browser does in mfwebrtc.html:
+*  - POSTs a receive only SDP offer to the sample's HTTP signaling listener and
+*    takes the ICE credentials from the answer.
+*  - Sends authenticated STUN binding requests to the sample's ICE-lite agent and
+*    keeps sending them to maintain consent.
+*  - Completes the DTLS handshake as the client, on memory BIOs so the one socket
+*    can be demultiplexed, checks the server's certificate against the
+*    fingerprint in the SDP answer and derives the SRTP keys from it.
+*  - Unprotects the SRTP and SRTCP packets, reassembles the RFC7741 VP8 frames and
+*    decodes them with libvpx.
+*
+* The time each phase of the setup took is printed along with a summary of the
+* frames received. Each frame's arrival and decode times are written to a CSV
+* file. The RTCP sender reports map the video RTP timestamps to the wall clock
+* time the frames were captured, which on the same machine gives the capture to
+* decode latency.
+*
+* If a reference Y4M recording is given, and the sample's camera is a virtual
+* camera playing that recording in a loop, each decoded VP8 frame is measured
+* against the reference frame it came from with the VideoQualityMetrics in the
+* Common folder. The first decoded frame is matched to the reference frame with
+* the highest luma PSNR and the frames after it are matched from the difference
+* in their RTP timestamps at the recording's frame rate. The PSNR and SSIM of
+* each frame go in the CSV file and their means in the summary.
+*
+* VP8 and H264 are depacketised, so the peer can be used with the MFWebCamWebRTC
+* sample, with VIDEO_CODEC_VP9 left as false, and the MFWebCamWebRTCH264 sample.
+* Only VP8 is decoded. H264 access units are reassembled and checked for the
+* parameter sets a browser needs but their decoded time is when they completed.
+* Opus packets are counted but not decoded.
+*
+* In load mode a number of peers, 200 by default, join the sample at the same
+* moment, each on its own thread and socket. Each one signals, connects and
+* completes the DTLS handshake, then stays joined until the rest have finished.
+* The p50 and p99 of each setup phase across the peers are printed, which shows
+* how the sample's handshakes hold up when a burst of viewers join at once.
+*
+* Usage:
+* WebRtcHeadlessPeer [server address] [server port] [duration seconds] [frames csv] [signaling port] [reference y4m]
+* WebRtcHeadlessPeer load [peer count] [server address] [server port] [signaling port]
+*
+* The MFWebCamWebRTCH264 sample still has a fixed SDP offer, use a signaling port
+* of 0 to connect to it with the ICE credentials from that offer.
+*
+* Dependencies:
+* vcpkg install openssl libsrtp libvpx zlib
+*
+* The peer doesn't use Media Foundation so it also builds on Linux:
+* g++ -O2 -std=c++17 WebRtcHeadlessPeer.cpp -lssl -lcrypto -lsrtp2 -lvpx -lz -o WebRtcHeadlessPeer
+*
+* License: Public Domain (no warranty, use at own risk)
+/******************************************************************************/
+
+#include "../Common/VideoQualityMetrics.h"
+#include "../Common/Y4MReader.h"
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "Ws2_32.lib")
+typedef int socklen_t;
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+typedef int SOCKET;
+#define INVALID_SOCKET (-1)
+#define closesocket close
+#endif
+
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
+#include <srtp2/srtp.h>
+#include <vpx/vpx_decoder.h>
+#include <vpx/vp8dx.h>
+#include <zlib.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <future>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define DEFAULT_SERVER_ADDRESS "127.0.0.1"
+#define DEFAULT_SERVER_PORT 8888          // RTP_LISTEN_PORT in the MFWebCamWebRTC sample.
+#define DEFAULT_DURATION_SECONDS 30
+#define DEFAULT_FRAMES_FILE "frames.csv"
+#define DEFAULT_SIGNALING_PORT 8080        // HTTP_LISTEN_PORT in the MFWebCamWebRTC sample.
+#define SIGNALING_PATH "/webrtc"            // HTTP_SIGNALING_PATH in the MFWebCamWebRTC sample.
+#define ICE_USERNAME "EJYWWCUDJQLTXTNQRXEJ"     // The ICE credentials from the MFWebCamWebRTCH264 sample's SDP offer.
+#define ICE_PASSWORD "SKYKPPYLTZOAVCLTGHDUODANRKSPOVQVKXJULOGG"
+#define LOCAL_ICE_USERNAME "HEADLESSPEER"       // The ICE credentials in our SDP offer.
+#define LOCAL_ICE_PASSWORD "HEADLESSPEERPASSWORD0123"
+#define RTP_PAYLOAD_ID 100
+#define H264_PAYLOAD_ID 96              // RTP_PAYLOAD_ID in the MFWebCamWebRTCH264 sample.
+#define OPUS_PAYLOAD_ID 111
+#define RTP_HEADER_LENGTH 12
+#define RTCP_SENDER_REPORT_TYPE 200
+#define VP8_CLOCK_RATE 90000
+#define RECEIVE_BUFFER_LENGTH 4096
+#define DTLS_MTU 1200
+#define SRTP_MASTER_KEY_KEY_LEN 16
+#define SRTP_MASTER_KEY_SALT_LEN 14
+#define STUN_HEADER_LENGTH 20
+#define STUN_MAGIC_COOKIE 0x2112A442
+#define STUN_FINGERPRINT_XOR 0x5354554e
+#define STUN_RETRANSMIT_MS 250            // Binding request retransmit interval until the first response.
+#define ICE_CONSENT_INTERVAL_MS 5000      // Binding request interval once connected, well within the sample's 30s consent timeout.
+#define REFERENCE_MAX_FRAMES 300          // Frames loaded from the reference recording, the sample's camera loops it.
+#define DEFAULT_LOAD_PEER_COUNT 200
+#define LOAD_JOIN_TIMEOUT_MS 20000        // Load mode peers that haven't completed the DTLS handshake in this period have failed.
+#define LOAD_SIGNALING_RETRIES 5          // Load mode SDP offers retried when the sample drops the signaling connection.
+#define LOAD_SIGNALING_RETRY_MS 100
+#define LOAD_POLL_MS 50                   // Longest wait for a datagram, so joined load mode peers notice the others have finished.
+
+/* Per frame timings, all in milliseconds from when the peer started. */
+struct FrameRecord
+{
+  int PictureID = -1;
+  uint32_t RtpTimestamp = 0;
+  bool IsKeyFrame = false;
+  size_t Bytes = 0;
+  int Packets = 0;
+  double FirstPacketAt = 0;
+  double CompletedAt = 0;
+  double DecodedAt = 0;
+  double CaptureToDecodeMs = NAN;   // Only known once an RTCP sender report has been received.
+  double PsnrY = NAN;               // Only measured if there's a reference recording.
+  double Ssim = NAN;
+};
+
+/* What the peer needs from the sample's 201 response to its SDP offer. */
+struct SignalingAnswer
+{
+  std::string SessionPath;          // The Location of the session, DELETEd at the end.
+  std::string IceUsername;
+  std::string IcePassword;
+  std::string Fingerprint;          // The sha-256 fingerprint, upper case, the server's certificate has to match it.
+};
+
+/* Timestamps for each phase of the connection setup, 0 until reached. */
+struct SetupTimes
+{
+  double SignalingCompletedAt = 0;  // SDP answer received.
+  double IceConnectedAt = 0;        // First STUN binding success response.
+  double DtlsCompletedAt = 0;
+  double FirstRtpAt = 0;
+  double FirstFrameDecodedAt = 0;
+};
+
+/* A load mode peer's outcome. */
+struct LoadJoinResult
+{
+  bool IsJoined = false;            // The DTLS handshake completed with the certificate from the SDP answer.
+  int SignalingRetries = 0;
+  SetupTimes Setup;
+};
+
+/**
+* Reassembles VP8 frames from RTP packets using the RFC7741 payload descriptor.
+* Frames with a missing packet are discarded and, as the sample doesn't handle
+* keyframe requests, so is everything until the next keyframe.
+*/
+class Vp8Depacketiser
+{
+public:
+  std::vector<uint8_t> Frame;
+  FrameRecord Record;
+  int DiscardedFrames = 0;
+
+  /**
+  * Adds a packet's payload to the frame being assembled.
+  * @@Returns true if the packet completed a frame, available in Frame and Record.
+  */
+  bool Add(uint16_t seqNum, bool marker, uint32_t timestamp, const uint8_t* payload, size_t length, double receivedAt)
+  {
+    size_t posn = 0;
+    if (length < 1) {
+      return false;
+    }
+
+    uint8_t first = payload[posn++];
+    bool extended = (first & 0x80) != 0;
+    bool startOfPartition = (first & 0x10) != 0;
+    int partitionIndex = first & 0x0f;
+    int pictureID = -1;
+
+    if (extended && posn < length) {
+      uint8_t x = payload[posn++];
+      if ((x & 0x80) && posn < length) {
+        pictureID = payload[posn++];
+        if ((pictureID & 0x80) && posn < length) {
+          pictureID = ((pictureID & 0x7f) << 8) | payload[posn++];
+        }
+      }
+      if (x & 0x40) {
+        posn++;       // TL0PICIDX.
+      }
+      if (x & 0x30) {
+        posn++;       // TID, Y and KEYIDX.
+      }
+    }
+
+    if (posn >= length) {
+      return false;
+    }
+
+    bool isContiguous = _haveSeqNum && (uint16_t)(_lastSeqNum + 1) == seqNum;
+    _haveSeqNum = true;
+    _lastSeqNum = seqNum;
+
+    if (startOfPartition && partitionIndex == 0) {
+      // The VP8 payload header's inverse key frame flag.
+      bool isKeyFrame = (payload[posn] & 0x01) == 0;
+
+      if (_needKeyFrame && !isKeyFrame) {
+        _assembling = false;
+        return false;
+      }
+
+      _needKeyFrame = false;
+      _assembling = true;
+      Frame.clear();
+      Record = FrameRecord();
+      Record.PictureID = pictureID;
+      Record.RtpTimestamp = timestamp;
+      Record.IsKeyFrame = isKeyFrame;
+      Record.FirstPacketAt = receivedAt;
+    }
+    else if (!_assembling) {
+      return false;
+    }
+    else if (!isContiguous || timestamp != Record.RtpTimestamp) {
+      printf("Packet lost before sequence number %u, discarding frames until the next keyframe.\n", seqNum);
+      _assembling = false;
+      _needKeyFrame = true;
+      DiscardedFrames++;
+      return false;
+    }
+
+    Frame.insert(Frame.end(), payload + posn, payload + length);
+    Record.Packets++;
+
+    if (marker) {
+      _assembling = false;
+      Record.Bytes = Frame.size();
+      Record.CompletedAt = receivedAt;
+      return true;
+    }
+
+    return false;
+  }
+
+private:
+  bool _assembling = false;
+  bool _needKeyFrame = true;
+  bool _haveSeqNum = false;
+  uint16_t _lastSeqNum = 0;
+};
+
+/**
+* Reassembles H264 access units from RFC6184 packetization-mode=1 RTP packets,
+* single NAL unit, STAP-A and FU-A, into an Annex B byte stream. There's no H264
+* decoder dependency so instead each IDR frame is checked for the SPS and PPS a
+* browser needs to start decoding. As with VP8 an access unit with a missing
+* packet is discarded along with everything until the next IDR.
+*/
+class H264Depacketiser
+{
+public:
+  std::vector<uint8_t> Frame;
+  FrameRecord Record;
+  int DiscardedFrames = 0;
+  int IdrWithoutParameterSets = 0;
+  std::string ProfileLevelId;       // From the first SPS received.
+
+  /**
+  * Adds a packet's payload to the access unit being assembled.
+  * @@Returns true if the packet completed an access unit, available in Frame and Record.
+  */
+  bool Add(uint16_t seqNum, bool marker, uint32_t timestamp, const uint8_t* payload, size_t length, double receivedAt)
+  {
+    if (length < 1) {
+      return false;
+    }
+
+    bool isContiguous = _haveSeqNum && (uint16_t)(_lastSeqNum + 1) == seqNum;
+    _haveSeqNum = true;
+    _lastSeqNum = seqNum;
+
+    if (_assembling && timestamp != Record.RtpTimestamp) {
+      // The previous access unit's last packet never arrived.
+      OnLoss(seqNum);
+    }
+    else if (_assembling && !isContiguous) {
+      _isCorrupt = true;
+    }
+
+    if (!_assembling) {
+      _assembling = true;
+      _isCorrupt = false;
+      _haveSps = false;
+      _havePps = false;
+      Frame.clear();
+      Record = FrameRecord();
+      Record.RtpTimestamp = timestamp;
+      Record.FirstPacketAt = receivedAt;
+    }
+
+    uint8_t nalType = payload[0] & 0x1f;
+
+    if (nalType == STAP_A_NAL_TYPE) {
+      size_t posn = 1;
+      while (posn + 2 <= length) {
+        size_t nalLength = payload[posn] << 8 | payload[posn + 1];
+        posn += 2;
+        if (posn + nalLength > length) {
+          break;
+        }
+        AddNal(&payload[posn], nalLength);
+        posn += nalLength;
+      }
+    }
+    else if (nalType == FU_A_NAL_TYPE && length > 2) {
+      bool isStart = (payload[1] & 0x80) != 0;
+      if (isStart) {
+        // The original NAL header is rebuilt from the FU indicator and FU header.
+        uint8_t nalHeader = (payload[0] & 0xe0) | (payload[1] & 0x1f);
+        AddNal(&nalHeader, 1);
+      }
+      Frame.insert(Frame.end(), payload + 2, payload + length);
+    }
+    else {
+      AddNal(payload, length);
+    }
+
+    Record.Packets++;
+
+    if (marker) {
+      _assembling = false;
+
+      if (_isCorrupt) {
+        OnLoss(seqNum);
+        return false;
+      }
+      else if (_needKeyFrame && !Record.IsKeyFrame) {
+        return false;
+      }
+
+      if (Record.IsKeyFrame && (!_haveSps || !_havePps)) {
+        printf("IDR frame at RTP timestamp %u is missing its %s.\n", timestamp, !_haveSps ? "SPS" : "PPS");
+        IdrWithoutParameterSets++;
+      }
+
+      _needKeyFrame = false;
+      Record.Bytes = Frame.size();
+      Record.CompletedAt = receivedAt;
+      return true;
+    }
+
+    return false;
+  }
+
+private:
+  static const uint8_t IDR_NAL_TYPE = 5;
+  static const uint8_t SPS_NAL_TYPE = 7;
+  static const uint8_t PPS_NAL_TYPE = 8;
+  static const uint8_t STAP_A_NAL_TYPE = 24;
+  static const uint8_t FU_A_NAL_TYPE = 28;
+
+  bool _assembling = false;
+  bool _isCorrupt = false;
+  bool _needKeyFrame = true;
+  bool _haveSps = false;
+  bool _havePps = false;
+  bool _haveSeqNum = false;
+  uint16_t _lastSeqNum = 0;
+
+  /* Appends a NAL unit, or the start of a fragmented one, with an Annex B start code. */
+  void AddNal(const uint8_t* nal, size_t length)
+  {
+    const uint8_t startCode[] = { 0x00, 0x00, 0x00, 0x01 };
+    uint8_t nalType = nal[0] & 0x1f;
+
+    // Parameter sets that come after the IDR slice are too late for it.
+    if (nalType == SPS_NAL_TYPE) {
+      _haveSps = _haveSps || !Record.IsKeyFrame;
+      if (ProfileLevelId.empty() && length >= 4) {
+        char profileLevelId[7];
+        snprintf(profileLevelId, sizeof(profileLevelId), "%02x%02x%02x", nal[1], nal[2], nal[3]);
+        ProfileLevelId = profileLevelId;
+      }
+    }
+    else if (nalType == PPS_NAL_TYPE) {
+      _havePps = _havePps || !Record.IsKeyFrame;
+    }
+    else if (nalType == IDR_NAL_TYPE) {
+      Record.IsKeyFrame = true;
+    }
+
+    Frame.insert(Frame.end(), startCode, startCode + sizeof(startCode));
+    Frame.insert(Frame.end(), nal, nal + length);
+  }
+
+  void OnLoss(uint16_t seqNum)
+  {
+    printf("Packet lost before sequence number %u, discarding access units until the next IDR.\n", seqNum);
+    _assembling = false;
+    _needKeyFrame = true;
+    DiscardedFrames++;
+  }
+};
+
+/**
+* Maps RTP timestamps to the sender's wall clock using the most recent RTCP
+* sender report.
+*/
+class SenderClock
+{
+public:
+  void OnSenderReport(uint64_t ntpTimestamp, uint32_t rtpTimestamp)
+  {
+    _ntpSeconds = (double)(ntpTimestamp >> 32) + (double)(ntpTimestamp & 0xffffffff) / 4294967296.0;
+    _rtpTimestamp = rtpTimestamp;
+    _haveReport = true;
+  }
+
+  /**
+  * Gets the sender's wall clock time for an RTP timestamp.
+  * @@Returns false if no sender report has been received yet.
+  */
+  bool GetNtpSeconds(uint32_t rtpTimestamp, double* pNtpSeconds)
+  {
+    if (!_haveReport) {
+      return false;
+    }
+
+    int32_t diff = (int32_t)(rtpTimestamp - _rtpTimestamp);   // Copes with wrap around.
+    *pNtpSeconds = _ntpSeconds + (double)diff / VP8_CLOCK_RATE;
+    return true;
+  }
+
+private:
+  bool _haveReport = false;
+  double _ntpSeconds = 0;
+  uint32_t _rtpTimestamp = 0;
+};
+
+double MillisecondsSince(std::chrono::steady_clock::time_point start);
+double GetNtpSecondsNow();
+std::string BuildSdpOffer();
+std::string BuildSignalingRequest(const char* serverAddress);
+bool SendHttpRequest(sockaddr_in server, const std::string& request, std::string* pResponse);
+bool ParseSignalingResponse(const std::string& response, SignalingAnswer& answer);
+std::string GetSdpAttribute(const std::string& sdp, const char* name);
+SSL_CTX* CreateDtlsContext();
+SSL* CreateDtlsClient(SSL_CTX* sslCtx, BIO** ppReadBio, BIO** ppWriteBio);
+std::vector<uint8_t> BuildStunBindingRequest(const uint8_t* transactionID, const uint8_t* tieBreaker, const std::string& iceUsername, const std::string& icePassword);
+bool IsStunBindingSuccess(const uint8_t* buffer, int length, const uint8_t* transactionID);
+void FlushDtlsRecords(SOCKET sock, BIO* writeBio, const sockaddr_in& server);
+bool CreateSrtpInboundSession(SSL* ssl, srtp_t* pSrtpSession);
+std::string GetCertificateFingerprint(X509* cert);
+void OnRtcp(uint8_t* buffer, int length, std::map<uint32_t, SenderClock>& senderClocks);
+void WriteFramesCsv(const char* path, const std::vector<FrameRecord>& frames);
+QualityFrame GetVpxQualityFrame(const vpx_image_t* pImage);
+size_t FindReferenceFrame(VideoQualityMetrics& metrics, const Y4MVideo& reference, const QualityFrame& frame);
+int RunLoadTest(int peerCount, const char* serverAddress, int serverPort, int signalingPort);
+void JoinLoadSession(const char* serverAddress, sockaddr_in server, int signalingPort, SSL_CTX* sslCtx,
+  std::shared_future<void> startSignal, int peerCount, std::atomic<int>& finishedCount, LoadJoinResult* pResult);
+
+int main(int argc, char* argv[])
+{
+  if (argc > 1 && strcmp(argv[1], "load") == 0) {
+    return RunLoadTest((argc > 2) ? atoi(argv[2]) : DEFAULT_LOAD_PEER_COUNT, (argc > 3) ? argv[3] : DEFAULT_SERVER_ADDRESS,
+      (argc > 4) ? atoi(argv[4]) : DEFAULT_SERVER_PORT, (argc > 5) ? atoi(argv[5]) : DEFAULT_SIGNALING_PORT);
+  }
+
+  const char* serverAddress = (argc > 1) ? argv[1] : DEFAULT_SERVER_ADDRESS;
+  int serverPort = (argc > 2) ? atoi(argv[2]) : DEFAULT_SERVER_PORT;
+  int durationSeconds = (argc > 3) ? atoi(argv[3]) : DEFAULT_DURATION_SECONDS;
+  const char* framesPath = (argc > 4) ? argv[4] : DEFAULT_FRAMES_FILE;
+  int signalingPort = (argc > 5) ? atoi(argv[5]) : DEFAULT_SIGNALING_PORT;
+  const char* referencePath = (argc > 6) ? argv[6] : nullptr;
+
+  SOCKET sock = INVALID_SOCKET;
+  sockaddr_in server;
+  SSL_CTX* sslCtx = nullptr;
+  SSL* ssl = nullptr;
+  BIO* readBio = nullptr;
+  BIO* writeBio = nullptr;
+  srtp_t srtpSession = nullptr;
+  vpx_codec_ctx_t vpxDecoder;
+  bool decoderInitialised = false;
+  int exitCode = 1;
+
+  auto start = std::chrono::steady_clock::now();
+  SetupTimes setup;
+  Vp8Depacketiser depacketiser;
+  H264Depacketiser h264Depacketiser;
+  std::map<uint32_t, SenderClock> senderClocks;    // Sender reports can arrive before the first RTP packet so are kept for every SSRC.
+  uint32_t videoSsrc = 0;
+  std::vector<FrameRecord> frames;
+  std::vector<double> decodeTimes;
+  size_t videoBytes = 0, audioPackets = 0, rtcpPackets = 0, srtpFailures = 0;
+  bool dtlsStarted = false, dtlsComplete = false;
+  uint8_t transactionID[12];      // The same for retransmits of a request, new for each request.
+  uint8_t tieBreaker[8];          // The same for the whole session, RFC8445 section 7.1.1.
+  double nextStunAt = 0;
+  SignalingAnswer answer = { "", ICE_USERNAME, ICE_PASSWORD, "" };
+  Y4MVideo reference;
+  VideoQualityMetrics metrics;
+  bool referenceSynced = false;
+  size_t referenceSyncIndex = 0;  // The reference frame matched to the first decoded frame.
+  uint32_t referenceSyncTimestamp = 0;
+
+#ifdef _WIN32
+  WSADATA wsaData;
+  WSAStartup(MAKEWORD(2, 2), &wsaData);
+#endif
+
+  if (referencePath != nullptr && !LoadY4M(referencePath, REFERENCE_MAX_FRAMES, reference)) {
+    return 1;
+  }
+
+  memset(&server, 0, sizeof(server));
+  server.sin_family = AF_INET;
+  server.sin_port = htons(serverPort);
+  if (inet_pton(AF_INET, serverAddress, &server.sin_addr) != 1) {
+    printf("Invalid server address %s.\n", serverAddress);
+    return 1;
+  }
+
+  sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  if (sock == INVALID_SOCKET) {
+    printf("Failed to create socket.\n");
+    return 1;
+  }
+
+  srtp_init();
+
+  sslCtx = CreateDtlsContext();
+  if (sslCtx == nullptr) {
+    goto done;
+  }
+  ssl = CreateDtlsClient(sslCtx, &readBio, &writeBio);
+
+  if (vpx_codec_dec_init(&vpxDecoder, vpx_codec_vp8_dx(), nullptr, 0)) {
+    printf("Failed to initialise the VP8 decoder.\n");
+    goto done;
+  }
+  decoderInitialised = true;
+
+  RAND_bytes(transactionID, sizeof(transactionID));
+  RAND_bytes(tieBreaker, sizeof(tieBreaker));
+
+  if (signalingPort != 0) {
+    // WHIP style signaling, POST the offer and get the answer back in the 201 response.
+    sockaddr_in signalingServer = server;
+    signalingServer.sin_port = htons(signalingPort);
+
+    std::string response;
+
+    if (!SendHttpRequest(signalingServer, BuildSignalingRequest(serverAddress), &response) || response.compare(0, 12, "HTTP/1.1 201") != 0) {
+      printf("SDP offer to %s:%d failed: %s\n", serverAddress, signalingPort, response.substr(0, response.find('\r')).c_str());
+      goto done;
+    }
+
+    if (!ParseSignalingResponse(response, answer)) {
+      printf("SDP answer has no sha-256 fingerprint.\n");
+      goto done;
+    }
+
+    setup.SignalingCompletedAt = MillisecondsSince(start);
+    printf("SDP answer received in %.1fms, session %s.\n", setup.SignalingCompletedAt, answer.SessionPath.c_str());
+  }
+
+  printf("Connecting to %s:%d for %d seconds.\n", serverAddress, serverPort, durationSeconds);
+
+  while (MillisecondsSince(start) < durationSeconds * 1000.0) {
+    double now = MillisecondsSince(start);
+
+    // Connectivity checks, retransmitted quickly until the first response and then sent for consent.
+    // Each consent check is a new transaction, RFC7675 section 5.1.
+    if (now >= nextStunAt) {
+      if (setup.IceConnectedAt != 0) {
+        RAND_bytes(transactionID, sizeof(transactionID));
+      }
+      std::vector<uint8_t> request = BuildStunBindingRequest(transactionID, tieBreaker, answer.IceUsername, answer.IcePassword);
+      sendto(sock, (const char*)request.data(), (int)request.size(), 0, (sockaddr*)&server, sizeof(server));
+      nextStunAt = now + ((setup.IceConnectedAt == 0) ? STUN_RETRANSMIT_MS : ICE_CONSENT_INTERVAL_MS);
+    }
+
+    // Wake for whichever is next of the STUN timer and the DTLS retransmit timer.
+    double waitMs = std::max(nextStunAt - now, 0.0);
+    timeval dtlsTimeout;
+    if (dtlsStarted && !dtlsComplete && DTLSv1_get_timeout(ssl, &dtlsTimeout)) {
+      waitMs = std::min(waitMs, dtlsTimeout.tv_sec * 1000.0 + dtlsTimeout.tv_usec / 1000.0);
+    }
+
+    fd_set readSet;
+    FD_ZERO(&readSet);
+    FD_SET(sock, &readSet);
+    long waitUs = (long)(waitMs * 1000);
+    timeval waitTimeout = { waitUs / 1000000, waitUs % 1000000 };
+
+    int selectResult = select((int)sock + 1, &readSet, nullptr, nullptr, &waitTimeout);
+    if (selectResult < 0) {
+      printf("select failed.\n");
+      goto done;
+    }
+    else if (selectResult == 0) {
+      if (dtlsStarted && !dtlsComplete && DTLSv1_handle_timeout(ssl) > 0) {
+        FlushDtlsRecords(sock, writeBio, server);
+      }
+      continue;
+    }
+
+    uint8_t buffer[RECEIVE_BUFFER_LENGTH];
+    sockaddr_in from;
+    socklen_t fromLength = sizeof(from);
+    int length = recvfrom(sock, (char*)buffer, sizeof(buffer), 0, (sockaddr*)&from, &fromLength);
+    double receivedAt = MillisecondsSince(start);
+
+    if (length <= 0) {
+      continue;
+    }
+
+    // Same demultiplexing as the server, section 5.1.2 RFC5764.
+    if (buffer[0] <= 1) {
+      if (IsStunBindingSuccess(buffer, length, transactionID) && setup.IceConnectedAt == 0) {
+        setup.IceConnectedAt = receivedAt;
+        nextStunAt = receivedAt + ICE_CONSENT_INTERVAL_MS;
+        printf("ICE connected in %.1fms.\n", setup.IceConnectedAt - setup.SignalingCompletedAt);
+
+        // The binding response is what the browser waits for before sending its ClientHello.
+        dtlsStarted = true;
+        SSL_do_handshake(ssl);
+        FlushDtlsRecords(sock, writeBio, server);
+      }
+    }
+    else if (buffer[0] >= 20 && buffer[0] <= 63) {
+      BIO_write(readBio, buffer, length);
+
+      if (!dtlsComplete) {
+        int r = SSL_do_handshake(ssl);
+        FlushDtlsRecords(sock, writeBio, server);
+
+        if (r == 1) {
+          dtlsComplete = true;
+          setup.DtlsCompletedAt = MillisecondsSince(start);
+          printf("DTLS handshake completed in %.1fms, %s with %s.\n", setup.DtlsCompletedAt - setup.IceConnectedAt,
+            SSL_get_version(ssl), SSL_get_cipher_name(ssl));
+
+          X509* serverCert = SSL_get1_peer_certificate(ssl);
+          std::string fingerprint = GetCertificateFingerprint(serverCert);
+          X509_free(serverCert);
+          printf("Server certificate fingerprint sha-256 %s.\n", fingerprint.c_str());
+
+          // Without signaling there's no answer to check against, the MFWebCamWebRTCH264 sample prints its fingerprint.
+          if (signalingPort != 0 && (fingerprint.empty() || fingerprint != answer.Fingerprint)) {
+            printf("Server certificate doesn't match the SDP answer fingerprint %s.\n", answer.Fingerprint.c_str());
+            goto done;
+          }
+
+          if (!CreateSrtpInboundSession(ssl, &srtpSession)) {
+            goto done;
+          }
+        }
+        else {
+          int err = SSL_get_error(ssl, r);
+          if (err != SSL_ERROR_WANT_READ && err != SSL_ERROR_WANT_WRITE) {
+            printf("DTLS handshake failed, error %d.\n", err);
+            ERR_print_errors_fp(stderr);
+            goto done;
+          }
+        }
+      }
+      else {
+        uint8_t appData[RECEIVE_BUFFER_LENGTH];
+        while (SSL_read(ssl, appData, sizeof(appData)) > 0);
+        if (SSL_get_shutdown(ssl) & SSL_RECEIVED_SHUTDOWN) {
+          printf("DTLS connection closed by the server.\n");
+          break;
+        }
+      }
+    }
+    else if (buffer[0] >= 128 && buffer[0] <= 191 && srtpSession != nullptr) {
+      if (buffer[1] >= 192 && buffer[1] <= 223) {
+        // RTCP, RFC5761 section 4.
+        if (srtp_unprotect_rtcp(srtpSession, buffer, &length) != srtp_err_status_ok) {
+          srtpFailures++;
+          continue;
+        }
+        rtcpPackets++;
+        OnRtcp(buffer, length, senderClocks);
+      }
+      else {
+        if (srtp_unprotect(srtpSession, buffer, &length) != srtp_err_status_ok || length < RTP_HEADER_LENGTH) {
+          srtpFailures++;
+          continue;
+        }
+
+        if (setup.FirstRtpAt == 0) {
+          setup.FirstRtpAt = receivedAt;
+        }
+
+        bool marker = (buffer[1] & 0x80) != 0;
+        uint8_t payloadType = buffer[1] & 0x7f;
+        uint16_t seqNum = buffer[2] << 8 | buffer[3];
+        uint32_t timestamp = (uint32_t)buffer[4] << 24 | buffer[5] << 16 | buffer[6] << 8 | buffer[7];
+        uint32_t ssrc = (uint32_t)buffer[8] << 24 | buffer[9] << 16 | buffer[10] << 8 | buffer[11];
+
+        int headerLength = RTP_HEADER_LENGTH + (buffer[0] & 0x0f) * 4;
+        if ((buffer[0] & 0x10) && headerLength + 4 <= length) {
+          headerLength += 4 + (buffer[headerLength + 2] << 8 | buffer[headerLength + 3]) * 4;
+        }
+        if (buffer[0] & 0x20) {
+          length -= buffer[length - 1];     // Padding.
+        }
+        if (headerLength >= length) {
+          continue;
+        }
+
+        if (payloadType == OPUS_PAYLOAD_ID) {
+          audioPackets++;
+        }
+        else if (payloadType == RTP_PAYLOAD_ID || payloadType == H264_PAYLOAD_ID) {
+          bool isH264 = payloadType == H264_PAYLOAD_ID;
+          videoSsrc = ssrc;
+          videoBytes += length - headerLength;
+
+          bool isFrameComplete = (isH264) ?
+            h264Depacketiser.Add(seqNum, marker, timestamp, &buffer[headerLength], length - headerLength, receivedAt) :
+            depacketiser.Add(seqNum, marker, timestamp, &buffer[headerLength], length - headerLength, receivedAt);
+
+          if (isFrameComplete) {
+            FrameRecord record = (isH264) ? h264Depacketiser.Record : depacketiser.Record;
+
+            if (isH264) {
+              record.DecodedAt = record.CompletedAt;
+            }
+            else {
+              auto decodeStart = std::chrono::steady_clock::now();
+              if (vpx_codec_decode(&vpxDecoder, depacketiser.Frame.data(), (unsigned int)depacketiser.Frame.size(), nullptr, 0)) {
+                printf("Failed to decode frame %d: %s\n", record.PictureID, vpx_codec_error(&vpxDecoder));
+                continue;
+              }
+
+              vpx_codec_iter_t iter = nullptr;
+              vpx_image_t* pImage = nullptr;
+              for (vpx_image_t* pNext; (pNext = vpx_codec_get_frame(&vpxDecoder, &iter)) != nullptr;) {
+                pImage = pNext;
+              }
+
+              record.DecodedAt = MillisecondsSince(start);
+              decodeTimes.push_back(MillisecondsSince(decodeStart));
+
+              if (pImage != nullptr && !reference.Frames.empty() && pImage->d_w == reference.Width && pImage->d_h == reference.Height) {
+                QualityFrame decoded = GetVpxQualityFrame(pImage);
+
+                if (!referenceSynced) {
+                  referenceSyncIndex = FindReferenceFrame(metrics, reference, decoded);
+                  referenceSyncTimestamp = record.RtpTimestamp;
+                  referenceSynced = true;
+                  metrics.Reset();
+                }
+
+                double elapsedFrames = (double)(uint32_t)(record.RtpTimestamp - referenceSyncTimestamp) / VP8_CLOCK_RATE *
+                  reference.FrameRateNum / reference.FrameRateDen;
+                size_t referenceIndex = (referenceSyncIndex + (size_t)std::llround(elapsedFrames)) % reference.Frames.size();
+
+                QualityScores scores;
+                if (metrics.Measure(GetI420QualityFrame(reference.Frames[referenceIndex].data(), reference.Width, reference.Height),
+                  decoded, scores)) {
+                  record.PsnrY = scores.PsnrY;
+                  record.Ssim = scores.Ssim;
+                }
+              }
+            }
+
+            double captureNtpSeconds = 0;
+            if (senderClocks[videoSsrc].GetNtpSeconds(record.RtpTimestamp, &captureNtpSeconds)) {
+              record.CaptureToDecodeMs = (GetNtpSecondsNow() - captureNtpSeconds) * 1000.0;
+            }
+
+            if (setup.FirstFrameDecodedAt == 0) {
+              setup.FirstFrameDecodedAt = record.DecodedAt;
+            }
+
+            frames.push_back(record);
+          }
+        }
+      }
+    }
+  }
+
+  exitCode = 0;
+
+done:
+
+  if (ssl != nullptr && dtlsComplete) {
+    // Lets the server tear the session down straight away rather than waiting for consent to expire.
+    SSL_shutdown(ssl);
+    FlushDtlsRecords(sock, writeBio, server);
+  }
+
+  if (!answer.SessionPath.empty()) {
+    sockaddr_in signalingServer = server;
+    signalingServer.sin_port = htons(signalingPort);
+    std::string response;
+    SendHttpRequest(signalingServer, "DELETE " + answer.SessionPath + " HTTP/1.1\r\nHost: " + std::string(serverAddress) + "\r\n\r\n", &response);
+  }
+
+  printf("\nSetup: signaling %.1fms, ICE %.1fms, DTLS %.1fms, first RTP %.1fms, first frame decoded %.1fms, total %.1fms.\n",
+    setup.SignalingCompletedAt,
+    (setup.IceConnectedAt > 0) ? setup.IceConnectedAt - setup.SignalingCompletedAt : 0,
+    (setup.DtlsCompletedAt > 0) ? setup.DtlsCompletedAt - setup.IceConnectedAt : 0,
+    (setup.FirstRtpAt > 0) ? setup.FirstRtpAt - setup.DtlsCompletedAt : 0,
+    (setup.FirstFrameDecodedAt > 0) ? setup.FirstFrameDecodedAt - setup.FirstRtpAt : 0,
+    setup.FirstFrameDecodedAt);
+
+  if (!frames.empty()) {
+    double elapsedSeconds = (frames.back().DecodedAt - frames.front().DecodedAt) / 1000.0;
+    std::vector<double> assemblyTimes, captureToDecode;
+    for (auto& frame : frames) {
+      assemblyTimes.push_back(frame.CompletedAt - frame.FirstPacketAt);
+      if (!std::isnan(frame.CaptureToDecodeMs)) {
+        captureToDecode.push_back(frame.CaptureToDecodeMs);
+      }
+    }
+
+    printf("Frames: %zu decoded, %d discarded, %.1f fps, %.1f kbps video, %zu audio packets, %zu RTCP packets, %zu SRTP failures.\n",
+      frames.size(), depacketiser.DiscardedFrames + h264Depacketiser.DiscardedFrames, (elapsedSeconds > 0) ? (frames.size() - 1) / elapsedSeconds : 0,
+      (elapsedSeconds > 0) ? videoBytes * 8 / elapsedSeconds / 1000 : 0, audioPackets, rtcpPackets, srtpFailures);
+    printf("Frame assembly p50 %.2fms p99 %.2fms, decode p50 %.2fms p99 %.2fms.\n",
+      Percentile(assemblyTimes, 50), Percentile(assemblyTimes, 99), Percentile(decodeTimes, 50), Percentile(decodeTimes, 99));
+    if (!captureToDecode.empty()) {
+      printf("Capture to decode p50 %.1fms p99 %.1fms.\n", Percentile(captureToDecode, 50), Percentile(captureToDecode, 99));
+    }
+    if (metrics.GetFrameCount() > 0) {
+      QualityScores mean = metrics.GetMeanScores();
+      printf("Quality against the reference for %zu frames: PSNR Y %.2fdB U %.2fdB V %.2fdB, SSIM %.4f.\n", metrics.GetFrameCount(),
+        mean.PsnrY, mean.PsnrU, mean.PsnrV, mean.Ssim);
+    }
+    else if (!reference.Frames.empty()) {
+      printf("No decoded frames matched the %ux%u reference recording.\n", reference.Width, reference.Height);
+    }
+    if (!h264Depacketiser.ProfileLevelId.empty()) {
+      printf("H264 profile-level-id %s, %d IDR frames without parameter sets.\n",
+        h264Depacketiser.ProfileLevelId.c_str(), h264Depacketiser.IdrWithoutParameterSets);
+    }
+
+    WriteFramesCsv(framesPath, frames);
+  }
+  else {
+    printf("No frames decoded.\n");
+    exitCode = 1;
+  }
+
+  if (decoderInitialised) {
+    vpx_codec_destroy(&vpxDecoder);
+  }
+  if (srtpSession != nullptr) {
+    srtp_dealloc(srtpSession);
+  }
+  if (ssl != nullptr) {
+    SSL_free(ssl);      // Also frees the BIOs.
+  }
+  if (sslCtx != nullptr) {
+    SSL_CTX_free(sslCtx);
+  }
+
+  closesocket(sock);
+
+#ifdef _WIN32
+  WSACleanup();
+#endif
+
+  return exitCode;
+}
+
+/**
+* Load mode. Starts peerCount peers joining at the same moment, each on its own
+* thread and socket, and measures how long their setup phases take while the
+* sample deals with the burst.
+* @param[in] peerCount: the number of simultaneous joins.
+* @param[in] serverAddress: the sample's address.
+* @param[in] serverPort: the sample's RTP port.
+* @param[in] signalingPort: the sample's HTTP signaling port.
+* @@Returns 0 if every peer joined.
+*/
+int RunLoadTest(int peerCount, const char* serverAddress, int serverPort, int signalingPort)
+{
+  sockaddr_in server;
+  memset(&server, 0, sizeof(server));
+  server.sin_family = AF_INET;
+  server.sin_port = htons(serverPort);
+  if (inet_pton(AF_INET, serverAddress, &server.sin_addr) != 1) {
+    printf("Invalid server address %s.\n", serverAddress);
+    return 1;
+  }
+
+  if (peerCount <= 0 || signalingPort == 0) {
+    printf("Load mode needs at least one peer and the signaling port, each peer needs its own session.\n");
+    return 1;
+  }
+
+#ifdef _WIN32
+  WSADATA wsaData;
+  WSAStartup(MAKEWORD(2, 2), &wsaData);
+#endif
+
+  SSL_CTX* sslCtx = CreateDtlsContext();
+  if (sslCtx == nullptr) {
+    return 1;
+  }
+
+  printf("Joining %d peers to %s:%d at once.\n", peerCount, serverAddress, serverPort);
+
+  std::vector<LoadJoinResult> results(peerCount);
+  std::vector<std::thread> peers;
+  std::promise<void> startPromise;
+  std::shared_future<void> startSignal = startPromise.get_future().share();
+  std::atomic<int> finishedCount(0);
+
+  for (int i = 0; i < peerCount; i++) {
+    peers.emplace_back(JoinLoadSession, serverAddress, server, signalingPort, sslCtx, startSignal,
+      peerCount, std::ref(finishedCount), &results[i]);
+  }
+
+  // The threads are all created before any starts so the joins arrive together.
+  startPromise.set_value();
+  for (auto& peer : peers) {
+    peer.join();
+  }
+
+  std::vector<double> signalingTimes, iceTimes, dtlsTimes, joinTimes;
+  int joined = 0, signalingRetries = 0;
+  for (auto& result : results) {
+    signalingRetries += result.SignalingRetries;
+    if (result.IsJoined) {
+      joined++;
+      signalingTimes.push_back(result.Setup.SignalingCompletedAt);
+      iceTimes.push_back(result.Setup.IceConnectedAt - result.Setup.SignalingCompletedAt);
+      dtlsTimes.push_back(result.Setup.DtlsCompletedAt - result.Setup.IceConnectedAt);
+      joinTimes.push_back(result.Setup.DtlsCompletedAt);
+    }
+  }
+
+  printf("\nJoined %d of %d peers, %d SDP offers retried.\n", joined, peerCount, signalingRetries);
+  if (joined > 0) {
+    printf("Signaling p50 %.1fms p99 %.1fms, ICE p50 %.1fms p99 %.1fms.\n",
+      Percentile(signalingTimes, 50), Percentile(signalingTimes, 99), Percentile(iceTimes, 50), Percentile(iceTimes, 99));
+    printf("DTLS handshake p50 %.1fms p99 %.1fms, join to DTLS complete p50 %.1fms p99 %.1fms.\n",
+      Percentile(dtlsTimes, 50), Percentile(dtlsTimes, 99), Percentile(joinTimes, 50), Percentile(joinTimes, 99));
+  }
+
+  SSL_CTX_free(sslCtx);
+
+#ifdef _WIN32
+  WSACleanup();
+#endif
+
+  return (joined == peerCount) ? 0 : 1;
+}
+
+/**
+* One load mode peer. Signals, does the ICE connectivity check and the DTLS
+* handshake the same way as the main peer, then stays joined, keeping consent,
+* until all the other peers have finished so the sample has every session at once.
+* The media it's sent is ignored.
+* @param[in] serverAddress: the sample's address.
+* @param[in] server: the sample's RTP address and port.
+* @param[in] signalingPort: the sample's HTTP signaling port.
+* @param[in] sslCtx: the shared DTLS client context.
+* @param[in] startSignal: becomes ready when all the peers are to start joining.
+* @param[in] peerCount: the number of peers in the load test.
+* @param[in,out] finishedCount: the peers that have joined or failed to.
+* @param[out] pResult: the setup times, in milliseconds from the start signal.
+*/
+void JoinLoadSession(const char* serverAddress, sockaddr_in server, int signalingPort, SSL_CTX* sslCtx,
+  std::shared_future<void> startSignal, int peerCount, std::atomic<int>& finishedCount, LoadJoinResult* pResult)
+{
+  SOCKET sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  BIO* readBio = nullptr;
+  BIO* writeBio = nullptr;
+  SSL* ssl = CreateDtlsClient(sslCtx, &readBio, &writeBio);
+  sockaddr_in signalingServer = server;
+  std::string request = BuildSignalingRequest(serverAddress);
+  std::string response;
+  SignalingAnswer answer;
+  uint8_t transactionID[12];
+  uint8_t tieBreaker[8];
+  double nextStunAt = 0;
+  bool dtlsStarted = false;
+  std::chrono::steady_clock::time_point start;
+
+  signalingServer.sin_port = htons(signalingPort);
+  RAND_bytes(transactionID, sizeof(transactionID));
+  RAND_bytes(tieBreaker, sizeof(tieBreaker));
+
+  startSignal.wait();
+  start = std::chrono::steady_clock::now();
+
+  if (sock == INVALID_SOCKET) {
+    goto done;
+  }
+
+  // The sample drops connections when all its signaling workers are busy, a browser's page would retry.
+  while (!SendHttpRequest(signalingServer, request, &response) || response.compare(0, 12, "HTTP/1.1 201") != 0) {
+    if (pResult->SignalingRetries++ == LOAD_SIGNALING_RETRIES) {
+      printf("SDP offer failed after %d retries: %s\n", LOAD_SIGNALING_RETRIES, response.substr(0, response.find('\r')).c_str());
+      goto done;
+    }
+    response.clear();
+    std::this_thread::sleep_for(std::chrono::milliseconds(LOAD_SIGNALING_RETRY_MS));
+  }
+
+  if (!ParseSignalingResponse(response, answer)) {
+    printf("SDP answer has no sha-256 fingerprint.\n");
+    goto done;
+  }
+  pResult->Setup.SignalingCompletedAt = MillisecondsSince(start);
+
+  while (MillisecondsSince(start) < LOAD_JOIN_TIMEOUT_MS && !(pResult->IsJoined && finishedCount >= peerCount)) {
+    double now = MillisecondsSince(start);
+
+    if (now >= nextStunAt) {
+      if (pResult->Setup.IceConnectedAt != 0) {
+        RAND_bytes(transactionID, sizeof(transactionID));
+      }
+      std::vector<uint8_t> stunRequest = BuildStunBindingRequest(transactionID, tieBreaker, answer.IceUsername, answer.IcePassword);
+      sendto(sock, (const char*)stunRequest.data(), (int)stunRequest.size(), 0, (sockaddr*)&server, sizeof(server));
+      nextStunAt = now + ((pResult->Setup.IceConnectedAt == 0) ? STUN_RETRANSMIT_MS : ICE_CONSENT_INTERVAL_MS);
+    }
+
+    double waitMs = std::min(std::max(nextStunAt - now, 0.0), (double)LOAD_POLL_MS);
+    timeval dtlsTimeout;
+    if (dtlsStarted && !pResult->IsJoined && DTLSv1_get_timeout(ssl, &dtlsTimeout)) {
+      waitMs = std::min(waitMs, dtlsTimeout.tv_sec * 1000.0 + dtlsTimeout.tv_usec / 1000.0);
+    }
+
+    fd_set readSet;
+    FD_ZERO(&readSet);
+    FD_SET(sock, &readSet);
+    long waitUs = (long)(waitMs * 1000);
+    timeval waitTimeout = { waitUs / 1000000, waitUs % 1000000 };
+
+    int selectResult = select((int)sock + 1, &readSet, nullptr, nullptr, &waitTimeout);
+    if (selectResult < 0) {
+      break;
+    }
+    else if (selectResult == 0) {
+      if (dtlsStarted && !pResult->IsJoined && DTLSv1_handle_timeout(ssl) > 0) {
+        FlushDtlsRecords(sock, writeBio, server);
+      }
+      continue;
+    }
+
+    uint8_t buffer[RECEIVE_BUFFER_LENGTH];
+    int length = recv(sock, (char*)buffer, sizeof(buffer), 0);
+    if (length <= 0 || pResult->IsJoined) {
+      continue;
+    }
+
+    if (buffer[0] <= 1) {
+      if (IsStunBindingSuccess(buffer, length, transactionID) && pResult->Setup.IceConnectedAt == 0) {
+        pResult->Setup.IceConnectedAt = MillisecondsSince(start);
+        nextStunAt = pResult->Setup.IceConnectedAt + ICE_CONSENT_INTERVAL_MS;
+        dtlsStarted = true;
+        SSL_do_handshake(ssl);
+        FlushDtlsRecords(sock, writeBio, server);
+      }
+    }
+    else if (buffer[0] >= 20 && buffer[0] <= 63) {
+      BIO_write(readBio, buffer, length);
+      int r = SSL_do_handshake(ssl);
+      FlushDtlsRecords(sock, writeBio, server);
+
+      if (r == 1) {
+        X509* serverCert = SSL_get1_peer_certificate(ssl);
+        std::string fingerprint = GetCertificateFingerprint(serverCert);
+        X509_free(serverCert);
+
+        if (fingerprint.empty() || fingerprint != answer.Fingerprint) {
+          printf("Server certificate doesn't match the SDP answer fingerprint %s.\n", answer.Fingerprint.c_str());
+          break;
+        }
+
+        pResult->Setup.DtlsCompletedAt = MillisecondsSince(start);
+        pResult->IsJoined = true;
+        finishedCount++;
+      }
+      else if (SSL_get_error(ssl, r) != SSL_ERROR_WANT_READ && SSL_get_error(ssl, r) != SSL_ERROR_WANT_WRITE) {
+        printf("DTLS handshake failed, error %d.\n", SSL_get_error(ssl, r));
+        break;
+      }
+    }
+  }
+
+done:
+
+  if (!pResult->IsJoined) {
+    finishedCount++;
+  }
+  else {
+    SSL_shutdown(ssl);
+    FlushDtlsRecords(sock, writeBio, server);
+  }
+
+  if (!answer.SessionPath.empty()) {
+    response.clear();
+    SendHttpRequest(signalingServer, "DELETE " + answer.SessionPath + " HTTP/1.1\r\nHost: " + std::string(serverAddress) + "\r\n\r\n", &response);
+  }
+
+  SSL_free(ssl);      // Also frees the BIOs.
+  if (sock != INVALID_SOCKET) {
+    closesocket(sock);
+  }
+}
+
+/* Milliseconds elapsed on the steady clock. */
+double MillisecondsSince(std::chrono::steady_clock::time_point start)
+{
+  return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+/* The current wall clock time in seconds since the NTP epoch, 1900. */
+double GetNtpSecondsNow()
+{
+  const double ntpEpochOffsetSeconds = 2208988800.0;
+  return std::chrono::duration<double>(std::chrono::system_clock::now().time_since_epoch()).count() + ntpEpochOffsetSeconds;
+}
+
+/**
+* Builds the receive only SDP offer POSTed to the sample. The payload types are the
+* ones packets are demultiplexed on. There's no fingerprint as the peer doesn't
+* send a certificate, the sample doesn't ask for one. It's only the server's
+* certificate that's checked, against the fingerprint in its answer.
+* @@Returns The SDP offer.
+*/
+std::string BuildSdpOffer()
+{
+  std::string transport = "c=IN IP4 0.0.0.0\r\n"
+    "a=ice-ufrag:" LOCAL_ICE_USERNAME "\r\n"
+    "a=ice-pwd:" LOCAL_ICE_PASSWORD "\r\n"
+    "a=setup:actpass\r\n"
+    "a=recvonly\r\n"
+    "a=rtcp-mux\r\n";
+
+  return "v=0\r\n"
+    "o=- 1 1 IN IP4 127.0.0.1\r\n"
+    "s=-\r\n"
+    "t=0 0\r\n"
+    "a=group:BUNDLE 0 1\r\n"
+    "m=video 9 UDP/TLS/RTP/SAVPF " + std::to_string(RTP_PAYLOAD_ID) + "\r\n" +
+    transport +
+    "a=mid:0\r\n"
+    "a=rtpmap:" + std::to_string(RTP_PAYLOAD_ID) + " VP8/90000\r\n"
+    "m=audio 9 UDP/TLS/RTP/SAVPF " + std::to_string(OPUS_PAYLOAD_ID) + "\r\n" +
+    transport +
+    "a=mid:1\r\n"
+    "a=extmap:1 urn:ietf:params:rtp-hdrext:ssrc-audio-level\r\n"
+    "a=rtpmap:" + std::to_string(OPUS_PAYLOAD_ID) + " opus/48000/2\r\n";
+}
+
+/* The WHIP style POST of the SDP offer to the sample's signaling listener. */
+std::string BuildSignalingRequest(const char* serverAddress)
+{
+  std::string offer = BuildSdpOffer();
+  return "POST " SIGNALING_PATH " HTTP/1.1\r\nHost: " + std::string(serverAddress) + "\r\n"
+    "Content-Type: application/sdp\r\nContent-Length: " + std::to_string(offer.size()) + "\r\n\r\n" + offer;
+}
+
+/**
+* Sends an HTTP request on a new connection and reads the response until the
+* server closes the connection, which the sample does after every response.
+* @param[in] server: the signaling address and port.
+* @param[in] request: the full request.
+* @param[out] pResponse: the status line, headers and body.
+* @@Returns true if the request was sent and a response received.
+*/
+bool SendHttpRequest(sockaddr_in server, const std::string& request, std::string* pResponse)
+{
+  SOCKET httpSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  if (httpSocket == INVALID_SOCKET) {
+    return false;
+  }
+
+  if (connect(httpSocket, (sockaddr*)&server, sizeof(server)) != 0 ||
+    send(httpSocket, request.data(), (int)request.size(), 0) != (int)request.size()) {
+    closesocket(httpSocket);
+    return false;
+  }
+
+  char buffer[RECEIVE_BUFFER_LENGTH];
+  int length = 0;
+  while ((length = recv(httpSocket, buffer, sizeof(buffer), 0)) > 0) {
+    pResponse->append(buffer, length);
+  }
+
+  closesocket(httpSocket);
+  return !pResponse->empty();
+}
+
+/**
+* Takes the session location, ICE credentials and certificate fingerprint from
+* the sample's 201 response to the SDP offer.
+* @param[in] response: the full response.
+* @param[out] answer: set with what was found.
+* @@Returns true if the answer has a sha-256 fingerprint, which is needed to trust the DTLS handshake.
+*/
+bool ParseSignalingResponse(const std::string& response, SignalingAnswer& answer)
+{
+  size_t locationPosn = response.find("\r\nLocation: ");
+  if (locationPosn != std::string::npos) {
+    size_t locationEnd = response.find("\r\n", locationPosn + 2);
+    answer.SessionPath = response.substr(locationPosn + 12, locationEnd - locationPosn - 12);
+  }
+
+  size_t bodyPosn = response.find("\r\n\r\n");
+  std::string sdp = (bodyPosn != std::string::npos) ? response.substr(bodyPosn + 4) : std::string();
+  answer.IceUsername = GetSdpAttribute(sdp, "ice-ufrag");
+  answer.IcePassword = GetSdpAttribute(sdp, "ice-pwd");
+
+  std::string fingerprint = GetSdpAttribute(sdp, "fingerprint");
+  if (fingerprint.compare(0, 8, "sha-256 ") != 0) {
+    return false;
+  }
+
+  answer.Fingerprint = fingerprint.substr(8);
+  std::transform(answer.Fingerprint.begin(), answer.Fingerprint.end(), answer.Fingerprint.begin(), ::toupper);
+  return true;
+}
+
+/* Gets the value of the first a=<name>: attribute in an SDP or an empty string if there isn't one. */
+std::string GetSdpAttribute(const std::string& sdp, const char* name)
+{
+  std::string prefix = std::string("a=") + name + ":";
+  size_t posn = sdp.find(prefix);
+  if (posn == std::string::npos) {
+    return std::string();
+  }
+
+  size_t valueStart = posn + prefix.size();
+  return sdp.substr(valueStart, sdp.find_first_of("\r\n", valueStart) - valueStart);
+}
+
+/**
+* Builds a STUN binding request for an ICE connectivity check, RFC8445 section 7.1.
+* The USERNAME is the server's ufrag followed by ours, the MESSAGE-INTEGRITY uses
+* the server's password and the FINGERPRINT goes last.
+* @param[in] transactionID: the 12 byte transaction ID.
+* @param[in] tieBreaker: the 8 byte ICE-CONTROLLING tie-breaker, fixed for the session.
+* @param[in] iceUsername: the server's ufrag.
+* @param[in] icePassword: the server's password.
+* @@Returns The serialised request.
+*/
+std::vector<uint8_t> BuildStunBindingRequest(const uint8_t* transactionID, const uint8_t* tieBreaker, const std::string& iceUsername, const std::string& icePassword)
+{
+  std::vector<uint8_t> msg(STUN_HEADER_LENGTH, 0);
+
+  auto appendAttribute = [&msg](uint16_t type, const void* value, uint16_t length) {
+    msg.push_back(type >> 8);
+    msg.push_back(type & 0xff);
+    msg.push_back(length >> 8);
+    msg.push_back(length & 0xff);
+    msg.insert(msg.end(), (const uint8_t*)value, (const uint8_t*)value + length);
+    while (msg.size() % 4 != 0) {
+      msg.push_back(0);
+    }
+  };
+
+  auto setLength = [&msg](size_t attributesLength) {
+    msg[2] = (attributesLength >> 8) & 0xff;
+    msg[3] = attributesLength & 0xff;
+  };
+
+  msg[0] = 0x00;
+  msg[1] = 0x01;      // Binding request.
+  msg[4] = (STUN_MAGIC_COOKIE >> 24) & 0xff;
+  msg[5] = (STUN_MAGIC_COOKIE >> 16) & 0xff;
+  msg[6] = (STUN_MAGIC_COOKIE >> 8) & 0xff;
+  msg[7] = STUN_MAGIC_COOKIE & 0xff;
+  memcpy(&msg[8], transactionID, 12);
+
+  std::string username = iceUsername + ":" LOCAL_ICE_USERNAME;
+  uint8_t priority[4] = { 0x6e, 0x00, 0x1e, 0xff };
+
+  appendAttribute(0x0006, username.data(), (uint16_t)username.size());  // USERNAME.
+  appendAttribute(0x0024, priority, sizeof(priority));                  // PRIORITY.
+  appendAttribute(0x802A, tieBreaker, 8);                               // ICE-CONTROLLING, the server is ICE-lite.
+  appendAttribute(0x0025, nullptr, 0);                                  // USE-CANDIDATE.
+
+  // The length covers the MESSAGE-INTEGRITY attribute when the HMAC is calculated.
+  setLength(msg.size() - STUN_HEADER_LENGTH + 24);
+  uint8_t hmac[20];
+  unsigned int hmacLength = 0;
+  HMAC(EVP_sha1(), icePassword.data(), (int)icePassword.size(), msg.data(), msg.size(), hmac, &hmacLength);
+  appendAttribute(0x0008, hmac, sizeof(hmac));
+
+  setLength(msg.size() - STUN_HEADER_LENGTH + 8);
+  uint32_t crc = (uint32_t)crc32(0L, msg.data(), (uInt)msg.size()) ^ STUN_FINGERPRINT_XOR;
+  uint8_t fingerprint[4] = { (uint8_t)(crc >> 24), (uint8_t)(crc >> 16), (uint8_t)(crc >> 8), (uint8_t)crc };
+  appendAttribute(0x8028, fingerprint, sizeof(fingerprint));
+
+  return msg;
+}
+
+/* Checks a STUN message is a binding success response to our request. */
+bool IsStunBindingSuccess(const uint8_t* buffer, int length, const uint8_t* transactionID)
+{
+  return length >= STUN_HEADER_LENGTH &&
+    buffer[0] == 0x01 && buffer[1] == 0x01 &&
+    memcmp(&buffer[8], transactionID, 12) == 0;
+}
+
+/* The DTLS client context, with DTLS-SRTP and without certificate verification. */
+SSL_CTX* CreateDtlsContext()
+{
+  SSL_CTX* sslCtx = SSL_CTX_new(DTLS_client_method());
+  if (sslCtx == nullptr || SSL_CTX_set_tlsext_use_srtp(sslCtx, "SRTP_AES128_CM_SHA1_80") != 0) {
+    printf("Failed to create DTLS context.\n");
+    ERR_print_errors_fp(stderr);
+    SSL_CTX_free(sslCtx);
+    return nullptr;
+  }
+
+  SSL_CTX_set_verify(sslCtx, SSL_VERIFY_NONE, nullptr);    // Self signed, the fingerprint is checked against the SDP answer once the handshake completes.
+  SSL_CTX_set_options(sslCtx, SSL_OP_NO_QUERY_MTU);
+  return sslCtx;
+}
+
+/**
+* Creates a DTLS client on memory BIOs so the one socket can be demultiplexed.
+* @param[in] sslCtx: the context from CreateDtlsContext.
+* @param[out] ppReadBio: set with the BIO received DTLS records are written to.
+* @param[out] ppWriteBio: set with the BIO the records to send are read from.
+* @@Returns The client, freeing it also frees the BIOs.
+*/
+SSL* CreateDtlsClient(SSL_CTX* sslCtx, BIO** ppReadBio, BIO** ppWriteBio)
+{
+  SSL* ssl = SSL_new(sslCtx);
+  *ppReadBio = BIO_new(BIO_s_mem());
+  *ppWriteBio = BIO_new(BIO_s_mem());
+  BIO_set_mem_eof_return(*ppReadBio, -1);
+  BIO_set_mem_eof_return(*ppWriteBio, -1);
+  SSL_set_bio(ssl, *ppReadBio, *ppWriteBio);
+  DTLS_set_link_mtu(ssl, DTLS_MTU);
+  SSL_set_connect_state(ssl);
+  return ssl;
+}
+
+/* Sends any DTLS records OpenSSL has written, one record per datagram. */
+void FlushDtlsRecords(SOCKET sock, BIO* writeBio, const sockaddr_in& server)
+{
+  uint8_t buffer[RECEIVE_BUFFER_LENGTH];
+  int length;
+
+  while ((length = BIO_read(writeBio, buffer, sizeof(buffer))) > 0) {
+    sendto(sock, (const char*)buffer, length, 0, (sockaddr*)&server, sizeof(server));
+  }
+}
+
+/**
+* Creates the SRTP session for unprotecting what the server sends. As the DTLS
+* client our receive keys are the server write keys, RFC5764 section 4.2.
+*/
+bool CreateSrtpInboundSession(SSL* ssl, srtp_t* pSrtpSession)
+{
+  unsigned char keyingMaterial[SRTP_MASTER_KEY_KEY_LEN * 2 + SRTP_MASTER_KEY_SALT_LEN * 2];
+  unsigned char serverWriteKey[SRTP_MASTER_KEY_KEY_LEN + SRTP_MASTER_KEY_SALT_LEN];
+  const char* label = "EXTRACTOR-dtls_srtp";
+
+  if (SSL_export_keying_material(ssl, keyingMaterial, sizeof(keyingMaterial), label, strlen(label), nullptr, 0, 0) != 1) {
+    printf("Error exporting DTLS key material.\n");
+    return false;
+  }
+
+  // Client key, server key, client salt, server salt.
+  memcpy(&serverWriteKey[0], &keyingMaterial[SRTP_MASTER_KEY_KEY_LEN], SRTP_MASTER_KEY_KEY_LEN);
+  memcpy(&serverWriteKey[SRTP_MASTER_KEY_KEY_LEN], &keyingMaterial[SRTP_MASTER_KEY_KEY_LEN * 2 + SRTP_MASTER_KEY_SALT_LEN], SRTP_MASTER_KEY_SALT_LEN);
+
+  srtp_policy_t srtpPolicy;
+  memset(&srtpPolicy, 0, sizeof(srtpPolicy));
+  srtp_crypto_policy_set_rtp_default(&srtpPolicy.rtp);
+  srtp_crypto_policy_set_rtcp_default(&srtpPolicy.rtcp);
+  srtpPolicy.key = serverWriteKey;
+  srtpPolicy.ssrc.type = ssrc_any_inbound;
+  srtpPolicy.window_size = 128;
+  srtpPolicy.next = nullptr;
+
+  auto err = srtp_create(pSrtpSession, &srtpPolicy);
+  if (err != srtp_err_status_ok) {
+    printf("Unable to create SRTP session, error %d.\n", err);
+    return false;
+  }
+
+  return true;
+}
+
+/**
+* Gets the SHA-256 fingerprint of a certificate in the format used by the SDP
+* fingerprint attribute, e.g. C6:ED:8C:...
+* @param[in] cert: the certificate to get the fingerprint for.
+* @@Returns the fingerprint or an empty string if it could not be calculated.
+*/
+std::string GetCertificateFingerprint(X509* cert)
+{
+  unsigned char digest[EVP_MAX_MD_SIZE];
+  unsigned int digestLength = 0;
+  char hex[4];
+  std::string fingerprint;
+
+  if (cert != nullptr && X509_digest(cert, EVP_sha256(), digest, &digestLength) == 1) {
+    for (unsigned int i = 0; i < digestLength; i++) {
+      snprintf(hex, sizeof(hex), (i == 0) ? "%02X" : ":%02X", digest[i]);
+      fingerprint += hex;
+    }
+  }
+
+  return fingerprint;
+}
+
+/* Takes the NTP to RTP timestamp mappings from the sender reports in a compound RTCP packet. */
+void OnRtcp(uint8_t* buffer, int length, std::map<uint32_t, SenderClock>& senderClocks)
+{
+  int posn = 0;
+
+  // Walk the packets in the compound packet.
+  while (posn + 4 <= length) {
+    uint8_t packetType = buffer[posn + 1];
+    int packetLength = ((buffer[posn + 2] << 8 | buffer[posn + 3]) + 1) * 4;
+
+    if (packetType == RTCP_SENDER_REPORT_TYPE && posn + 20 <= length) {
+      const uint8_t* sr = &buffer[posn + 4];
+      uint32_t ssrc = (uint32_t)sr[0] << 24 | sr[1] << 16 | sr[2] << 8 | sr[3];
+      uint64_t ntp = (uint64_t)((uint32_t)sr[4] << 24 | sr[5] << 16 | sr[6] << 8 | sr[7]) << 32 |
+        (uint32_t)((uint32_t)sr[8] << 24 | sr[9] << 16 | sr[10] << 8 | sr[11]);
+      uint32_t rtpTimestamp = (uint32_t)sr[12] << 24 | sr[13] << 16 | sr[14] << 8 | sr[15];
+
+      senderClocks[ssrc].OnSenderReport(ntp, rtpTimestamp);
+    }
+
+    posn += packetLength;
+  }
+}
+
+/* Writes one line per decoded frame for offline analysis. */
+void WriteFramesCsv(const char* path, const std::vector<FrameRecord>& frames)
+{
+  std::ofstream file(path);
+  if (!file) {
+    printf("Failed to open %s for writing.\n", path);
+    return;
+  }
+
+  file << "picture_id,rtp_timestamp,keyframe,bytes,packets,first_packet_ms,completed_ms,decoded_ms,capture_to_decode_ms,psnr_y,ssim\n";
+
+  for (auto& frame : frames) {
+    char line[256];
+    snprintf(line, sizeof(line), "%d,%u,%d,%zu,%d,%.3f,%.3f,%.3f,%s,%s,%s\n", frame.PictureID, frame.RtpTimestamp, frame.IsKeyFrame ? 1 : 0,
+      frame.Bytes, frame.Packets, frame.FirstPacketAt, frame.CompletedAt, frame.DecodedAt,
+      std::isnan(frame.CaptureToDecodeMs) ? "" : std::to_string(frame.CaptureToDecodeMs).c_str(),
+      std::isnan(frame.PsnrY) ? "" : std::to_string(frame.PsnrY).c_str(), std::isnan(frame.Ssim) ? "" : std::to_string(frame.Ssim).c_str());
+    file << line;
+  }
+
+  printf("Wrote %zu frame records to %s.\n", frames.size(), path);
+}
+
+/* The planes of a decoded VP8 image, which is always I420. */
+QualityFrame GetVpxQualityFrame(const vpx_image_t* pImage)
+{
+  QualityFrame frame;
+  frame.Format = QualityPixelFormat::I420;
+  frame.Width = pImage->d_w;
+  frame.Height = pImage->d_h;
+
+  for (int plane = 0; plane < 3; plane++) {
+    frame.pPlanes[plane] = pImage->planes[plane];
+    frame.Strides[plane] = pImage->stride[plane];
+  }
+
+  return frame;
+}
+
+/**
+* Finds the reference frame a decoded frame came from, the one with the highest
+* luma PSNR. Adds to the metrics' means so they need to be Reset afterwards.
+* @param[in] metrics: used to measure the frames.
+* @param[in] reference: the reference recording.
+* @param[in] frame: the decoded frame.
+* @@Returns The index of the best matching reference frame.
+*/
+size_t FindReferenceFrame(VideoQualityMetrics& metrics, const Y4MVideo& reference, const QualityFrame& frame)
+{
+  size_t bestIndex = 0;
+  double bestPsnr = -1;
+
+  for (size_t i = 0; i < reference.Frames.size(); i++) {
+    QualityScores scores;
+    if (metrics.Measure(GetI420QualityFrame(reference.Frames[i].data(), reference.Width, reference.Height), frame, scores) &&
+      scores.PsnrY > bestPsnr) {
+      bestPsnr = scores.PsnrY;
+      bestIndex = i;
+    }
+  }
+
+  printf("Decoded frames synchronised to reference frame %zu, luma PSNR %.2fdB.\n", bestIndex, bestPsnr);
+  return bestIndex;
+}